@@ -0,0 +1,508 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation for the bounding volume hierarchy builder
+*/
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+
+struct Bounds {
+    float min[3];
+    float max[3];
+
+    void reset() {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = INFINITY;
+            max[axis] = -INFINITY;
+        }
+    }
+
+    void grow(const float point[3]) {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], point[axis]);
+            max[axis] = std::max(max[axis], point[axis]);
+        }
+    }
+
+    void grow(const Bounds & bounds) {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], bounds.min[axis]);
+            max[axis] = std::max(max[axis], bounds.max[axis]);
+        }
+    }
+
+    float area() const {
+        float x = max[0] - min[0];
+        float y = max[1] - min[1];
+        float z = max[2] - min[2];
+
+        return x >= 0.0f ? 2.0f * (x * y + y * z + z * x) : 0.0f;
+    }
+};
+
+struct Bin {
+    Bounds bounds;
+    uint32_t count;
+
+    void reset() {
+        bounds.reset();
+        count = 0;
+    }
+
+    void grow(const Bin & bin) {
+        bounds.grow(bin.bounds);
+        count += bin.count;
+    }
+};
+
+// A triangle being sorted into the tree. Triangles are moved along with their bounds as nodes are split,
+// so every node's triangles stay contiguous in memory.
+struct TriangleReference {
+    Bounds bounds;
+    uint32_t triangle;
+
+    float centroid(int axis) const {
+        return 0.5f * (bounds.min[axis] + bounds.max[axis]);
+    }
+};
+
+static const unsigned int maxBinCount = 64;
+
+// Nodes with more triangles than this are binned by several threads at once
+static const uint32_t parallelBinningThreshold = 1 << 17;
+
+// Subtrees with more triangles than this can be built on another thread
+static const uint32_t parallelSubtreeThreshold = 1 << 12;
+
+// Runs task(range, begin, end) over [0, count) split into one range per thread
+template <typename Task>
+void parallelRanges(uint32_t count, unsigned int threadCount, const Task & task) {
+    std::vector<std::thread> threads;
+    uint32_t rangeSize = (count + threadCount - 1) / threadCount;
+
+    for (unsigned int range = 1; range < threadCount; range++) {
+        uint32_t begin = std::min(count, range * rangeSize);
+        uint32_t end = std::min(count, begin + rangeSize);
+        threads.emplace_back([&task, range, begin, end] { task(range, begin, end); });
+    }
+
+    task(0, 0, std::min(count, rangeSize));
+
+    for (std::thread & thread : threads)
+        thread.join();
+}
+
+class Builder {
+public:
+    Builder(const BVHBuildOptions & options, BVH & bvh, unsigned int threadCount) :
+        _options(options),
+        _bvh(bvh),
+        _threadCount(threadCount),
+        _idleThreads(threadCount - 1),
+        _nodeCount(1),
+        _maxDepth(0)
+    {
+    }
+
+    // Builds over triangleCount primitives, getting the bounds of primitive i with getBounds(i, bounds)
+    template <typename GetBounds>
+    void build(uint32_t triangleCount, const GetBounds & getBounds) {
+        _references.resize(triangleCount);
+        _bvh.triangleIndices.resize(triangleCount);
+
+        // A binary tree with at least one triangle per leaf has fewer than twice as many nodes as triangles
+        _bvh.nodes.resize(triangleCount ? 2 * (size_t)triangleCount - 1 : 1);
+
+        std::vector<Bounds> rangeBounds(_threadCount);
+        std::vector<Bounds> rangeCentroidBounds(_threadCount);
+        parallelRanges(triangleCount, _threadCount, [&](unsigned int range, uint32_t begin, uint32_t end) {
+            Bounds bounds, centroidBounds;
+            bounds.reset();
+            centroidBounds.reset();
+
+            for (uint32_t i = begin; i < end; i++) {
+                TriangleReference & reference = _references[i];
+                getBounds(i, reference.bounds);
+                reference.triangle = i;
+
+                float centroid[3] = { reference.centroid(0), reference.centroid(1), reference.centroid(2) };
+                bounds.grow(reference.bounds);
+                centroidBounds.grow(centroid);
+            }
+
+            rangeBounds[range] = bounds;
+            rangeCentroidBounds[range] = centroidBounds;
+        });
+
+        Bounds bounds, centroidBounds;
+        bounds.reset();
+        centroidBounds.reset();
+        for (unsigned int i = 0; i < _threadCount; i++) {
+            bounds.grow(rangeBounds[i]);
+            centroidBounds.grow(rangeCentroidBounds[i]);
+        }
+
+        if (triangleCount)
+            buildNode(0, 0, triangleCount, bounds, centroidBounds, 1);
+        else
+            makeLeaf(_bvh.nodes[0], 0, 0, bounds);
+
+        _bvh.nodes.resize(_nodeCount);
+        _bvh.nodes.shrink_to_fit();
+
+        for (uint32_t i = 0; i < triangleCount; i++)
+            _bvh.triangleIndices[i] = _references[i].triangle;
+
+        _references = std::vector<TriangleReference>();
+    }
+
+    unsigned int maxDepth() const {
+        return _maxDepth;
+    }
+
+private:
+    const BVHBuildOptions & _options;
+    BVH & _bvh;
+    unsigned int _threadCount;
+
+    std::vector<TriangleReference> _references;
+
+    std::atomic<int> _idleThreads;
+    std::atomic<uint32_t> _nodeCount;
+    std::atomic<unsigned int> _maxDepth;
+
+    static void makeLeaf(BVHNode & node, uint32_t begin, uint32_t count, const Bounds & bounds) {
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = bounds.min[axis];
+            node.boundsMax[axis] = bounds.max[axis];
+        }
+
+        node.offset = begin;
+        node.triangleCount = (uint16_t)count;
+        node.splitAxis = 0;
+    }
+
+    // Bins of every axis of the triangles in [begin, end) of the index array
+    void binTriangles(uint32_t begin, uint32_t end, unsigned int binCount, const Bounds & centroidBounds,
+                      const float scale[3], Bin *bins) const {
+        for (unsigned int i = 0; i < 3 * binCount; i++)
+            bins[i].reset();
+
+        for (uint32_t i = begin; i < end; i++) {
+            const TriangleReference & reference = _references[i];
+            float centroid[3] = { reference.centroid(0), reference.centroid(1), reference.centroid(2) };
+
+            for (int axis = 0; axis < 3; axis++) {
+                Bin & bin = bins[axis * binCount + binIndex(centroid[axis], centroidBounds.min[axis], scale[axis], binCount)];
+                bin.bounds.grow(reference.bounds);
+                bin.count++;
+            }
+        }
+    }
+
+    static unsigned int binIndex(float centroid, float centroidMin, float scale, unsigned int binCount) {
+        unsigned int index = (unsigned int)((centroid - centroidMin) * scale);
+
+        return std::min(index, binCount - 1);
+    }
+
+    void buildNode(uint32_t nodeIndex, uint32_t begin, uint32_t end, const Bounds & bounds,
+                   const Bounds & centroidBounds, unsigned int depth)
+    {
+        unsigned int previousMaxDepth = _maxDepth.load(std::memory_order_relaxed);
+        while (depth > previousMaxDepth && !_maxDepth.compare_exchange_weak(previousMaxDepth, depth))
+            ;
+
+        BVHNode & node = _bvh.nodes[nodeIndex];
+        uint32_t count = end - begin;
+
+        if (count == 1) {
+            makeLeaf(node, begin, count, bounds);
+            return;
+        }
+
+        // Find the cheapest split between bins along every axis where the centroids spread. Small nodes use
+        // fewer bins, as sweeping the bins would cost more than binning their triangles.
+        unsigned int binCount = std::min(_options.binCount, std::max(count, 4u));
+        float scale[3];
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            scale[axis] = extent > 0.0f ? binCount * (1.0f - 1e-5f) / extent : 0.0f;
+        }
+
+        Bin bins[3 * maxBinCount];
+
+        if (count >= parallelBinningThreshold && _threadCount > 1) {
+            std::vector<Bin> threadBins(_threadCount * 3 * binCount);
+            parallelRanges(count, _threadCount, [&](unsigned int range, uint32_t rangeBegin, uint32_t rangeEnd) {
+                binTriangles(begin + rangeBegin, begin + rangeEnd, binCount, centroidBounds, scale,
+                             &threadBins[range * 3 * binCount]);
+            });
+
+            for (unsigned int i = 0; i < 3 * binCount; i++) {
+                bins[i].reset();
+                for (unsigned int thread = 0; thread < _threadCount; thread++)
+                    bins[i].grow(threadBins[thread * 3 * binCount + i]);
+            }
+        }
+        else {
+            binTriangles(begin, end, binCount, centroidBounds, scale, bins);
+        }
+
+        float bestCost = INFINITY;
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] == 0.0f)
+                continue;
+
+            const Bin *axisBins = &bins[axis * binCount];
+
+            // Area times count of everything right of each split
+            float rightCosts[maxBinCount];
+            Bounds right;
+            right.reset();
+            uint32_t rightCount = 0;
+            for (unsigned int split = binCount - 1; split > 0; split--) {
+                right.grow(axisBins[split].bounds);
+                rightCount += axisBins[split].count;
+                rightCosts[split] = right.area() * rightCount;
+            }
+
+            Bounds left;
+            left.reset();
+            uint32_t leftCount = 0;
+            for (unsigned int split = 1; split < binCount; split++) {
+                left.grow(axisBins[split - 1].bounds);
+                leftCount += axisBins[split - 1].count;
+
+                float cost = left.area() * leftCount + rightCosts[split];
+                if (leftCount && leftCount < count && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        float leafCost = _options.intersectionCost * count;
+        float splitCost = _options.traversalCost + _options.intersectionCost * bestCost / std::max(bounds.area(), 1e-30f);
+
+        if (count <= _options.maxLeafSize && (bestAxis < 0 || leafCost <= splitCost)) {
+            makeLeaf(node, begin, count, bounds);
+            return;
+        }
+
+        Bounds childBounds[2], childCentroidBounds[2];
+        uint32_t middle;
+
+        if (bestAxis >= 0) {
+            const Bin *axisBins = &bins[bestAxis * binCount];
+            childBounds[0].reset();
+            childBounds[1].reset();
+            for (unsigned int bin = 0; bin < binCount; bin++)
+                childBounds[bin < bestSplit ? 0 : 1].grow(axisBins[bin].bounds);
+
+            float centroidMin = centroidBounds.min[bestAxis];
+            float axisScale = scale[bestAxis];
+            TriangleReference *references = _references.data();
+            middle = (uint32_t)(std::partition(references + begin, references + end, [&](const TriangleReference & reference) {
+                return binIndex(reference.centroid(bestAxis), centroidMin, axisScale, binCount) < bestSplit;
+            }) - references);
+
+            for (int child = 0; child < 2; child++) {
+                childCentroidBounds[child].reset();
+                for (uint32_t i = child ? middle : begin; i < (child ? end : middle); i++) {
+                    const TriangleReference & reference = references[i];
+                    float centroid[3] = { reference.centroid(0), reference.centroid(1), reference.centroid(2) };
+                    childCentroidBounds[child].grow(centroid);
+                }
+            }
+        }
+        else {
+            // Every centroid is at the same point: split the triangles in two halves
+            middle = begin + count / 2;
+            for (int child = 0; child < 2; child++) {
+                childBounds[child].reset();
+                for (uint32_t i = child ? middle : begin; i < (child ? end : middle); i++)
+                    childBounds[child].grow(_references[i].bounds);
+                childCentroidBounds[child] = centroidBounds;
+            }
+        }
+
+        uint32_t childIndex = _nodeCount.fetch_add(2);
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = bounds.min[axis];
+            node.boundsMax[axis] = bounds.max[axis];
+        }
+        node.offset = childIndex;
+        node.triangleCount = 0;
+        node.splitAxis = (uint16_t)std::max(bestAxis, 0);
+
+        // Hand the left subtree to another thread if one is idle and it is worth it
+        if (std::min(middle - begin, end - middle) >= parallelSubtreeThreshold && acquireThread()) {
+            std::thread thread([&] {
+                buildNode(childIndex, begin, middle, childBounds[0], childCentroidBounds[0], depth + 1);
+                _idleThreads++;
+            });
+
+            buildNode(childIndex + 1, middle, end, childBounds[1], childCentroidBounds[1], depth + 1);
+            thread.join();
+        }
+        else {
+            buildNode(childIndex, begin, middle, childBounds[0], childCentroidBounds[0], depth + 1);
+            buildNode(childIndex + 1, middle, end, childBounds[1], childCentroidBounds[1], depth + 1);
+        }
+    }
+
+    bool acquireThread() {
+        int idleThreads = _idleThreads.load();
+        while (idleThreads > 0) {
+            if (_idleThreads.compare_exchange_weak(idleThreads, idleThreads - 1))
+                return true;
+        }
+
+        return false;
+    }
+};
+
+const float *vertex(const void *vertices, size_t vertexStride, uint32_t triangle, int corner) {
+    return (const float *)((const char *)vertices + (3 * (size_t)triangle + corner) * vertexStride);
+}
+
+template <typename GetBounds>
+void build(uint32_t count, const GetBounds & getBounds, const BVHBuildOptions & options, BVH & bvh,
+           BVHBuildStatistics *statistics)
+{
+    assert(options.binCount >= 2 && options.binCount <= maxBinCount);
+    assert(options.maxLeafSize >= 1 && options.maxLeafSize <= UINT16_MAX);
+    assert(count < UINT32_MAX / 2);
+
+    auto start = std::chrono::steady_clock::now();
+
+    unsigned int threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+    Builder builder(options, bvh, std::max(threadCount, 1u));
+    builder.build(count, getBounds);
+
+    if (statistics) {
+        statistics->buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        statistics->sahCost = computeSAHCost(bvh, options);
+        statistics->nodeCount = bvh.nodes.size();
+        statistics->leafCount = std::count_if(bvh.nodes.begin(), bvh.nodes.end(),
+                                              [](const BVHNode & node) { return node.triangleCount != 0; });
+        statistics->maxDepth = builder.maxDepth();
+        statistics->bytesPerTriangle = count ? (double)(bvh.nodes.size() * sizeof(BVHNode) +
+                                                        bvh.triangleIndices.size() * sizeof(uint32_t)) / count : 0.0;
+    }
+}
+
+// Children are always allocated after their parent, so walking the nodes backwards visits every child
+// before its parent
+template <typename GrowLeafBounds>
+void refit(BVH & bvh, const GrowLeafBounds & growLeafBounds) {
+    // The single leaf of a BVH over nothing keeps its empty bounds
+    if (bvh.triangleIndices.empty())
+        return;
+
+    for (size_t i = bvh.nodes.size(); i-- > 0;) {
+        BVHNode & node = bvh.nodes[i];
+
+        Bounds bounds;
+        bounds.reset();
+
+        if (node.triangleCount) {
+            for (uint32_t j = node.offset; j < node.offset + node.triangleCount; j++)
+                growLeafBounds(bvh.triangleIndices[j], bounds);
+        }
+        else {
+            for (uint32_t child = node.offset; child < node.offset + 2; child++) {
+                bounds.grow(bvh.nodes[child].boundsMin);
+                bounds.grow(bvh.nodes[child].boundsMax);
+            }
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = bounds.min[axis];
+            node.boundsMax[axis] = bounds.max[axis];
+        }
+    }
+}
+
+}
+
+void buildBVH(const void *vertices,
+              size_t vertexStride,
+              size_t triangleCount,
+              const BVHBuildOptions & options,
+              BVH & bvh,
+              BVHBuildStatistics *statistics)
+{
+    build((uint32_t)triangleCount, [=](uint32_t triangle, Bounds & bounds) {
+        bounds.reset();
+        for (int corner = 0; corner < 3; corner++)
+            bounds.grow(vertex(vertices, vertexStride, triangle, corner));
+    }, options, bvh, statistics);
+}
+
+void buildBVH(const float *boxes,
+              size_t boxCount,
+              const BVHBuildOptions & options,
+              BVH & bvh,
+              BVHBuildStatistics *statistics)
+{
+    build((uint32_t)boxCount, [=](uint32_t box, Bounds & bounds) {
+        bounds.reset();
+        bounds.grow(&boxes[6 * (size_t)box]);
+        bounds.grow(&boxes[6 * (size_t)box + 3]);
+    }, options, bvh, statistics);
+}
+
+void refitBVH(const void *vertices, size_t vertexStride, BVH & bvh) {
+    refit(bvh, [=](uint32_t triangle, Bounds & bounds) {
+        for (int corner = 0; corner < 3; corner++)
+            bounds.grow(vertex(vertices, vertexStride, triangle, corner));
+    });
+}
+
+void refitBVH(const float *boxes, BVH & bvh) {
+    refit(bvh, [=](uint32_t box, Bounds & bounds) {
+        bounds.grow(&boxes[6 * (size_t)box]);
+        bounds.grow(&boxes[6 * (size_t)box + 3]);
+    });
+}
+
+double computeSAHCost(const BVH & bvh, const BVHBuildOptions & options) {
+    if (bvh.nodes.empty())
+        return 0.0;
+
+    auto area = [](const BVHNode & node) {
+        double x = node.boundsMax[0] - node.boundsMin[0];
+        double y = node.boundsMax[1] - node.boundsMin[1];
+        double z = node.boundsMax[2] - node.boundsMin[2];
+
+        return x >= 0.0 ? 2.0 * (x * y + y * z + z * x) : 0.0;
+    };
+
+    double rootArea = area(bvh.nodes[0]);
+    if (rootArea <= 0.0)
+        return 0.0;
+
+    double cost = 0.0;
+    for (const BVHNode & node : bvh.nodes) {
+        double nodeCost = node.triangleCount ? options.intersectionCost * node.triangleCount : options.traversalCost;
+        cost += area(node) / rootArea * nodeCost;
+    }
+
+    return cost;
+}
@@ -0,0 +1,85 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for a portable bounding volume hierarchy builder over the triangles of a scene object or the
+ boxes of its instances, with refitting for animated objects
+*/
+
+#ifndef BVH_h
+#define BVH_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 32 byte node. Leaves have a nonzero primitive count and reference triangleCount entries of
+// BVH::triangleIndices starting at offset; interior nodes have children offset and offset + 1, which always
+// come after their parent. BVHs built over boxes use the same fields for box indices.
+struct BVHNode {
+    float boundsMin[3];
+    uint32_t offset;
+    float boundsMax[3];
+    uint16_t triangleCount;
+    uint16_t splitAxis;
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVH nodes must be 32 bytes");
+
+struct BVH {
+    std::vector<BVHNode> nodes;             // Root first
+    std::vector<uint32_t> triangleIndices;  // Triangles of the leaves
+};
+
+struct BVHBuildOptions {
+    // Centroid bins per axis when looking for the best split
+    unsigned int binCount = 32;
+
+    // Leaves never hold more triangles than this; smaller leaves are made when the SAH favors them
+    unsigned int maxLeafSize = 8;
+
+    // Relative costs of a traversal step and a triangle intersection
+    float traversalCost = 1.0f;
+    float intersectionCost = 1.0f;
+
+    // Threads building subtrees and binning large nodes; 0 for every hardware thread
+    unsigned int threadCount = 0;
+};
+
+struct BVHBuildStatistics {
+    double buildSeconds;
+    double sahCost;                 // Expected cost of a random ray hitting the root, in the units of the options
+    size_t nodeCount;
+    size_t leafCount;
+    unsigned int maxDepth;
+    double bytesPerTriangle;        // Nodes and leaf triangle indices
+};
+
+// Builds a BVH over a triangle soup laid out like the sample's vertices vector: triangle i has vertices
+// 3 * i to 3 * i + 2, each starting with 3 floats, vertexStride bytes apart (sizeof(vector_float3)).
+void buildBVH(const void *vertices,
+              size_t vertexStride,
+              size_t triangleCount,
+              const BVHBuildOptions & options,
+              BVH & bvh,
+              BVHBuildStatistics *statistics);
+
+// Builds a BVH over boxes, each given as 6 floats: its minimum then its maximum corner
+void buildBVH(const float *boxes,
+              size_t boxCount,
+              const BVHBuildOptions & options,
+              BVH & bvh,
+              BVHBuildStatistics *statistics);
+
+// Updates the bounds of every node to the moved vertices of the triangles the BVH was built over, keeping its
+// structure. Much cheaper than a rebuild, but the tree gets worse as triangles move away from where they were.
+void refitBVH(const void *vertices, size_t vertexStride, BVH & bvh);
+
+// Same as the above for a BVH built over boxes
+void refitBVH(const float *boxes, BVH & bvh);
+
+// Surface area heuristic cost of a BVH, the sum over nodes of their area relative to the root times the
+// traversal cost, plus the intersection cost times the triangle count for leaves
+double computeSAHCost(const BVH & bvh, const BVHBuildOptions & options);
+
+#endif /* BVH_h */
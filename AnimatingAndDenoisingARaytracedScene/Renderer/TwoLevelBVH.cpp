@@ -0,0 +1,128 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation for the two-level bounding volume hierarchy
+*/
+
+#include "TwoLevelBVH.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Transforms the root bounds of an object's BVH by a column major float4x4 into the box around the result,
+// adding up the smaller and larger product of every matrix element with the box's extent along its column
+void transformBounds(const BVH & objectBVH, const float transform[16], float box[6]) {
+    for (int row = 0; row < 3; row++)
+        box[row] = box[3 + row] = transform[12 + row];
+
+    const BVHNode & root = objectBVH.nodes[0];
+
+    // An object without triangles is a point at the instance's origin
+    if (!(root.boundsMin[0] <= root.boundsMax[0]))
+        return;
+
+    for (int column = 0; column < 3; column++) {
+        for (int row = 0; row < 3; row++) {
+            float a = transform[column * 4 + row] * root.boundsMin[column];
+            float b = transform[column * 4 + row] * root.boundsMax[column];
+
+            box[row] += a < b ? a : b;
+            box[3 + row] += a < b ? b : a;
+        }
+    }
+}
+
+void updateInstanceBoxes(const float *instanceTransforms, TwoLevelBVH & bvh) {
+    for (size_t i = 0; i < bvh.instanceObjects.size(); i++)
+        transformBounds(bvh.objectBVHs[bvh.instanceObjects[i]], &instanceTransforms[16 * i], &bvh.instanceBoxes[6 * i]);
+}
+
+}
+
+void buildTwoLevelBVH(const TwoLevelBVHObject *objects,
+                      size_t objectCount,
+                      const uint32_t *instanceObjects,
+                      const float *instanceTransforms,
+                      size_t instanceCount,
+                      const TwoLevelBVHOptions & options,
+                      TwoLevelBVH & bvh)
+{
+    bvh.objectBVHs.resize(objectCount);
+
+    for (size_t i = 0; i < objectCount; i++) {
+        const TwoLevelBVHObject & object = objects[i];
+        buildBVH(object.vertices, object.vertexStride, object.triangleCount, options.objectOptions, bvh.objectBVHs[i], nullptr);
+    }
+
+    bvh.instanceObjects.assign(instanceObjects, instanceObjects + instanceCount);
+    bvh.instanceBoxes.resize(6 * instanceCount);
+
+    for (size_t i = 0; i < instanceCount; i++)
+        assert(instanceObjects[i] < objectCount);
+
+    updateInstanceBoxes(instanceTransforms, bvh);
+
+    BVHBuildStatistics statistics;
+    buildBVH(bvh.instanceBoxes.data(), instanceCount, options.instanceOptions, bvh.instanceBVH, &statistics);
+    bvh.instanceBuildSAHCost = statistics.sahCost;
+}
+
+void updateTwoLevelBVH(const TwoLevelBVHObject *objects,
+                       const float *instanceTransforms,
+                       const TwoLevelBVHOptions & options,
+                       TwoLevelBVH & bvh,
+                       TwoLevelBVHUpdateStatistics *statistics)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Object BVHs keep the structure they were built with, like refit triangle acceleration structures.
+    // Refitting is what keeps the cost of vertex animation linear in the triangle count.
+    for (size_t i = 0; i < bvh.objectBVHs.size(); i++) {
+        const TwoLevelBVHObject & object = objects[i];
+
+        if (object.animated)
+            refitBVH(object.vertices, object.vertexStride, bvh.objectBVHs[i]);
+    }
+
+    double objectRefitSeconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+
+    // Instances can move anywhere from one frame to the next, so the refit instance BVH is only kept while its
+    // cost stays close to the cost it had when built
+    updateInstanceBoxes(instanceTransforms, bvh);
+    refitBVH(bvh.instanceBoxes.data(), bvh.instanceBVH);
+
+    double refitSAHCost = computeSAHCost(bvh.instanceBVH, options.instanceOptions);
+    double instanceSAHCost = refitSAHCost;
+    double instanceRefitSeconds = secondsSince(start);
+    double instanceRebuildSeconds = 0.0;
+
+    bool rebuild = refitSAHCost > bvh.instanceBuildSAHCost * options.rebuildThreshold;
+
+    if (rebuild) {
+        BVHBuildStatistics buildStatistics;
+        buildBVH(bvh.instanceBoxes.data(), bvh.instanceObjects.size(), options.instanceOptions, bvh.instanceBVH,
+                 &buildStatistics);
+
+        bvh.instanceBuildSAHCost = buildStatistics.sahCost;
+        instanceSAHCost = buildStatistics.sahCost;
+        instanceRebuildSeconds = buildStatistics.buildSeconds;
+    }
+
+    if (statistics) {
+        statistics->objectRefitSeconds = objectRefitSeconds;
+        statistics->instanceRefitSeconds = instanceRefitSeconds;
+        statistics->instanceRebuildSeconds = instanceRebuildSeconds;
+        statistics->instanceRefitSAHCost = refitSAHCost;
+        statistics->instanceSAHCost = instanceSAHCost;
+        statistics->instancesRebuilt = rebuild;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for a portable two-level bounding volume hierarchy mirroring the scene's acceleration structures:
+ one BVH per scene object, refit every frame if the object is animated, and one BVH over the world space
+ bounds of the instances, refit every frame and rebuilt only once instance motion has degraded it enough
+*/
+
+#ifndef TwoLevelBVH_h
+#define TwoLevelBVH_h
+
+#include "BVH.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The vertices of a scene object, laid out like its range of the vertex position buffer: triangle i has
+// vertices 3 * i to 3 * i + 2, each starting with 3 floats, vertexStride bytes apart (sizeof(float3)).
+struct TwoLevelBVHObject {
+    const void *vertices;
+    size_t vertexStride;
+    size_t triangleCount;
+
+    // Animated objects are refit every frame, like triangle acceleration structures with
+    // MPSAccelerationStructureUsageRefit
+    bool animated;
+};
+
+struct TwoLevelBVHOptions {
+    TwoLevelBVHOptions() {
+        // Every instance gets its own leaf, as a ray reaching a leaf of several would have to traverse all
+        // of their object BVHs
+        instanceOptions.maxLeafSize = 1;
+    }
+
+    BVHBuildOptions objectOptions;
+    BVHBuildOptions instanceOptions;
+
+    // The instance BVH is rebuilt when the surface area heuristic cost of the refit tree exceeds the cost it
+    // had when it was last built by this factor
+    double rebuildThreshold = 1.25;
+};
+
+struct TwoLevelBVH {
+    std::vector<BVH> objectBVHs;            // One per object, in object space
+    std::vector<uint32_t> instanceObjects;  // Object of every instance, like the scene's instance buffer
+    std::vector<float> instanceBoxes;       // World space bounds of every instance, minimum then maximum corner
+    BVH instanceBVH;                        // Over instanceBoxes; leaves reference instances
+    double instanceBuildSAHCost;            // Cost of the instance BVH when it was last built
+};
+
+struct TwoLevelBVHUpdateStatistics {
+    double objectRefitSeconds;
+    double instanceRefitSeconds;
+    double instanceRebuildSeconds;          // Zero if the instance BVH was only refit
+    double instanceRefitSAHCost;            // Cost of the instance BVH after the refit
+    double instanceSAHCost;                 // Cost of the instance BVH in use for the frame
+    bool instancesRebuilt;
+};
+
+// Builds the BVHs of every object and the BVH over instanceCount instances. instanceTransforms holds the
+// 16 floats of every instance's column major float4x4, like the current frame's range of the instance
+// transform buffer.
+void buildTwoLevelBVH(const TwoLevelBVHObject *objects,
+                      size_t objectCount,
+                      const uint32_t *instanceObjects,
+                      const float *instanceTransforms,
+                      size_t instanceCount,
+                      const TwoLevelBVHOptions & options,
+                      TwoLevelBVH & bvh);
+
+// Brings the BVHs up to date with the objects' current vertices and the instances' current transforms, once
+// per frame. The objects and instances must be the ones the BVHs were built with.
+void updateTwoLevelBVH(const TwoLevelBVHObject *objects,
+                       const float *instanceTransforms,
+                       const TwoLevelBVHOptions & options,
+                       TwoLevelBVH & bvh,
+                       TwoLevelBVHUpdateStatistics *statistics);
+
+#endif /* TwoLevelBVH_h */
@@ -0,0 +1,322 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the two-level BVH on small scenes, including objects without triangles and scenes without instances.
+ After the build and after every update, each object BVH must contain its current triangles and each instance
+ box its transformed object; objects without triangles are points at their instance's origin. The instance BVH
+ must reference each instance once, in leaves and interior nodes whose bounds contain their boxes.
+*/
+
+#include "TwoLevelBVH.h"
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Same size as float3, the sample's vertex position type
+struct Vertex {
+    float position[3];
+    float padding;
+};
+
+int failures = 0;
+
+void check(bool condition, const char *format, ...) {
+    if (condition)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, arguments);
+    fprintf(stderr, "\n");
+    va_end(arguments);
+
+    failures++;
+}
+
+// Bounds are compared with a tolerance for the rounding of transformed points
+bool contains(const float boundsMin[3], const float boundsMax[3], const float point[3]) {
+    for (int axis = 0; axis < 3; axis++) {
+        float tolerance = 1e-5f * std::max(1.0f, std::fabs(point[axis]));
+        if (point[axis] < boundsMin[axis] - tolerance || point[axis] > boundsMax[axis] + tolerance)
+            return false;
+    }
+
+    return true;
+}
+
+// Returns the number of primitives below nodeIndex, checking that each is referenced once and inside its leaf.
+// getBounds(i, min, max) gives the bounds of primitive i.
+template <typename GetBounds>
+size_t checkNode(const BVH & bvh, const char *name, uint32_t nodeIndex, std::vector<unsigned int> & references,
+                 const GetBounds & getBounds)
+{
+    const BVHNode & node = bvh.nodes[nodeIndex];
+
+    if (node.triangleCount) {
+        for (uint32_t i = node.offset; i < node.offset + node.triangleCount; i++) {
+            uint32_t primitive = bvh.triangleIndices[i];
+            check(primitive < references.size(), "%s: leaf %u references primitive %u", name, nodeIndex, primitive);
+            if (primitive >= references.size())
+                continue;
+
+            references[primitive]++;
+
+            float primitiveMin[3], primitiveMax[3];
+            getBounds(primitive, primitiveMin, primitiveMax);
+            check(contains(node.boundsMin, node.boundsMax, primitiveMin) &&
+                  contains(node.boundsMin, node.boundsMax, primitiveMax),
+                  "%s: primitive %u is outside of leaf %u", name, primitive, nodeIndex);
+        }
+
+        return node.triangleCount;
+    }
+
+    check(node.offset > nodeIndex && node.offset + 1 < bvh.nodes.size(), "%s: node %u has children %u and %u",
+          name, nodeIndex, node.offset, node.offset + 1);
+    if (node.offset <= nodeIndex || node.offset + 1 >= bvh.nodes.size())
+        return 0;
+
+    for (uint32_t child = node.offset; child < node.offset + 2; child++) {
+        check(contains(node.boundsMin, node.boundsMax, bvh.nodes[child].boundsMin) &&
+              contains(node.boundsMin, node.boundsMax, bvh.nodes[child].boundsMax),
+              "%s: child %u is outside of node %u", name, child, nodeIndex);
+    }
+
+    return checkNode(bvh, name, node.offset, references, getBounds) +
+           checkNode(bvh, name, node.offset + 1, references, getBounds);
+}
+
+// Checks that a BVH references each of primitiveCount primitives once, inside bounds containing them
+template <typename GetBounds>
+void checkBVH(const BVH & bvh, const char *name, size_t primitiveCount, const GetBounds & getBounds) {
+    check(!bvh.nodes.empty(), "%s: no root", name);
+    if (bvh.nodes.empty())
+        return;
+
+    if (primitiveCount == 0) {
+        const BVHNode & root = bvh.nodes[0];
+        check(bvh.nodes.size() == 1 && root.triangleCount == 0 && bvh.triangleIndices.empty() &&
+              !(root.boundsMin[0] <= root.boundsMax[0]), "%s: a BVH over nothing is not a single empty leaf", name);
+        return;
+    }
+
+    std::vector<unsigned int> references(primitiveCount, 0);
+    size_t leafPrimitives = checkNode(bvh, name, 0, references, getBounds);
+    check(leafPrimitives == primitiveCount, "%s: %zu primitives in the leaves instead of %zu", name, leafPrimitives,
+          primitiveCount);
+
+    for (size_t i = 0; i < primitiveCount; i++)
+        check(references[i] == 1, "%s: primitive %zu is referenced %u times", name, i, references[i]);
+}
+
+struct TestScene {
+    std::vector<std::vector<Vertex>> objectVertices;
+    std::vector<TwoLevelBVHObject> objects;
+    std::vector<uint32_t> instanceObjects;
+    std::vector<float> instanceTransforms;
+};
+
+// Column major rotation about y, uniform scale and translation
+void setTransform(float transform[16], float angle, float scale, const float translation[3]) {
+    const float c = std::cos(angle) * scale, s = std::sin(angle) * scale;
+    const float columns[16] = {
+        c, 0.0f, -s, 0.0f,
+        0.0f, scale, 0.0f, 0.0f,
+        s, 0.0f, c, 0.0f,
+        translation[0], translation[1], translation[2], 1.0f
+    };
+
+    for (int i = 0; i < 16; i++)
+        transform[i] = columns[i];
+}
+
+// Small triangles scattered in a unit cube around the origin
+std::vector<Vertex> makeTriangleSoup(size_t triangleCount, std::mt19937 & generator) {
+    std::uniform_real_distribution<float> position(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> offset(-0.05f, 0.05f);
+
+    std::vector<Vertex> vertices(3 * triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        float center[3] = { position(generator), position(generator), position(generator) };
+
+        for (int corner = 0; corner < 3; corner++) {
+            for (int axis = 0; axis < 3; axis++)
+                vertices[3 * i + corner].position[axis] = center[axis] + offset(generator);
+            vertices[3 * i + corner].padding = 0.0f;
+        }
+    }
+
+    return vertices;
+}
+
+// Places the instances randomly in a cube of `spread` units
+void placeInstances(TestScene & scene, float spread, std::mt19937 & generator) {
+    std::uniform_real_distribution<float> position(-spread, spread);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+
+    for (size_t i = 0; i < scene.instanceObjects.size(); i++) {
+        float translation[3] = { position(generator), position(generator), position(generator) };
+        setTransform(&scene.instanceTransforms[16 * i], angle(generator), scale(generator), translation);
+    }
+}
+
+void transformPoint(const float transform[16], const float point[3], float result[3]) {
+    for (int row = 0; row < 3; row++)
+        result[row] = transform[row] * point[0] + transform[4 + row] * point[1] + transform[8 + row] * point[2] +
+                      transform[12 + row];
+}
+
+void checkScene(const TestScene & scene, const TwoLevelBVH & bvh, const char *name) {
+    char bvhName[128];
+
+    check(bvh.objectBVHs.size() == scene.objects.size(), "%s: %zu object BVHs for %zu objects", name,
+          bvh.objectBVHs.size(), scene.objects.size());
+
+    for (size_t object = 0; object < scene.objects.size() && object < bvh.objectBVHs.size(); object++) {
+        const std::vector<Vertex> & vertices = scene.objectVertices[object];
+        snprintf(bvhName, sizeof(bvhName), "%s, object %zu", name, object);
+
+        checkBVH(bvh.objectBVHs[object], bvhName, scene.objects[object].triangleCount,
+                 [&](uint32_t triangle, float boundsMin[3], float boundsMax[3]) {
+            for (int axis = 0; axis < 3; axis++) {
+                boundsMin[axis] = INFINITY;
+                boundsMax[axis] = -INFINITY;
+                for (int corner = 0; corner < 3; corner++) {
+                    boundsMin[axis] = std::min(boundsMin[axis], vertices[3 * triangle + corner].position[axis]);
+                    boundsMax[axis] = std::max(boundsMax[axis], vertices[3 * triangle + corner].position[axis]);
+                }
+            }
+        });
+    }
+
+    const size_t instanceCount = scene.instanceObjects.size();
+    check(bvh.instanceBoxes.size() == 6 * instanceCount, "%s: %zu instance box floats", name, bvh.instanceBoxes.size());
+
+    for (size_t instance = 0; instance < instanceCount; instance++) {
+        const float *transform = &scene.instanceTransforms[16 * instance];
+        const float *box = &bvh.instanceBoxes[6 * instance];
+        const std::vector<Vertex> & vertices = scene.objectVertices[scene.instanceObjects[instance]];
+
+        if (vertices.empty()) {
+            // An object without triangles is a point at the instance's origin
+            check(box[0] == transform[12] && box[1] == transform[13] && box[2] == transform[14] &&
+                  box[3] == transform[12] && box[4] == transform[13] && box[5] == transform[14],
+                  "%s: the box of empty instance %zu is not its origin", name, instance);
+            continue;
+        }
+
+        for (const Vertex & vertex : vertices) {
+            float point[3];
+            transformPoint(transform, vertex.position, point);
+            check(contains(box, box + 3, point), "%s: instance %zu has a vertex outside of its box", name, instance);
+        }
+    }
+
+    snprintf(bvhName, sizeof(bvhName), "%s, instances", name);
+    checkBVH(bvh.instanceBVH, bvhName, instanceCount, [&](uint32_t instance, float boundsMin[3], float boundsMax[3]) {
+        for (int axis = 0; axis < 3; axis++) {
+            boundsMin[axis] = bvh.instanceBoxes[6 * instance + axis];
+            boundsMax[axis] = bvh.instanceBoxes[6 * instance + 3 + axis];
+        }
+    });
+}
+
+TestScene makeScene(const std::vector<size_t> & objectTriangleCounts, size_t instanceCount, std::mt19937 & generator) {
+    TestScene scene;
+
+    for (size_t triangleCount : objectTriangleCounts)
+        scene.objectVertices.push_back(makeTriangleSoup(triangleCount, generator));
+
+    // Every other object with triangles is animated
+    for (size_t i = 0; i < objectTriangleCounts.size(); i++) {
+        TwoLevelBVHObject object = { scene.objectVertices[i].data(), sizeof(Vertex), objectTriangleCounts[i], i % 2 == 0 };
+        scene.objects.push_back(object);
+    }
+
+    scene.instanceObjects.resize(instanceCount);
+    scene.instanceTransforms.resize(16 * instanceCount);
+    for (size_t i = 0; i < instanceCount; i++)
+        scene.instanceObjects[i] = (uint32_t)(i % objectTriangleCounts.size());
+
+    placeInstances(scene, 10.0f, generator);
+
+    return scene;
+}
+
+void testScene(const char *name, const std::vector<size_t> & objectTriangleCounts, size_t instanceCount,
+               std::mt19937 & generator)
+{
+    TestScene scene = makeScene(objectTriangleCounts, instanceCount, generator);
+
+    TwoLevelBVHOptions options;
+    options.objectOptions.threadCount = 1;
+    options.instanceOptions.threadCount = 1;
+
+    TwoLevelBVH bvh;
+    buildTwoLevelBVH(scene.objects.data(), scene.objects.size(),
+                     scene.instanceObjects.data(), scene.instanceTransforms.data(), instanceCount, options, bvh);
+    checkScene(scene, bvh, name);
+
+    // Animate the vertices of the animated objects and scatter the instances over a growing volume, which
+    // eventually makes the refit instance BVH bad enough to be rebuilt
+    unsigned int rebuilds = 0;
+    std::uniform_real_distribution<float> motion(-0.02f, 0.02f);
+    for (int frame = 1; frame <= 4; frame++) {
+        for (size_t object = 0; object < scene.objects.size(); object++) {
+            if (!scene.objects[object].animated)
+                continue;
+
+            for (Vertex & vertex : scene.objectVertices[object]) {
+                for (int axis = 0; axis < 3; axis++)
+                    vertex.position[axis] += motion(generator);
+            }
+        }
+
+        placeInstances(scene, 10.0f * (frame + 1), generator);
+
+        TwoLevelBVHUpdateStatistics statistics;
+        updateTwoLevelBVH(scene.objects.data(), scene.instanceTransforms.data(), options, bvh, &statistics);
+        rebuilds += statistics.instancesRebuilt;
+
+        char frameName[128];
+        snprintf(frameName, sizeof(frameName), "%s, frame %d", name, frame);
+        checkScene(scene, bvh, frameName);
+    }
+
+    printf("%-32s %zu objects, %4zu instances, %3zu instance nodes, %u instance rebuilds in 4 frames\n", name,
+           scene.objects.size(), instanceCount, bvh.instanceBVH.nodes.size(), rebuilds);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(1);
+
+    testScene("objects with triangles", { 100, 37, 1 }, 200, generator);
+    testScene("objects without triangles", { 100, 0, 5, 0 }, 200, generator);
+    testScene("only objects without triangles", { 0 }, 10, generator);
+    testScene("one instance", { 20 }, 1, generator);
+    testScene("no instances", { 100, 0 }, 0, generator);
+
+    // No objects and no instances at all
+    {
+        TwoLevelBVHOptions options;
+        TwoLevelBVH bvh;
+        buildTwoLevelBVH(nullptr, 0, nullptr, nullptr, 0, options, bvh);
+        updateTwoLevelBVH(nullptr, nullptr, options, bvh, nullptr);
+        check(bvh.objectBVHs.empty() && bvh.instanceBVH.nodes.size() == 1 && bvh.instanceBVH.triangleIndices.empty(),
+              "an empty scene does not have a single empty instance leaf");
+        printf("%-32s 0 objects,    0 instances\n", "empty scene");
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
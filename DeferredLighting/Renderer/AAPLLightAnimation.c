@@ -0,0 +1,162 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the light animation
+ Phases are fractions of a cycle in units of 2^-32, so the phase at any frame is rate * frame + phase
+ with wrapping 32-bit integer math: exact whatever the frame count, and no floor() or range reduction
+ of large angles. Lights are processed in blocks; each step of a block is a separate loop without
+ branches so the compiler can vectorize it.
+*/
+
+#include "AAPLLightAnimation.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lights per block; the intermediate positions of a block stay on the stack
+#define AAPL_LIGHT_BLOCK 64
+
+// M_PI is not part of C11
+static const double AAPLTwoPi = 6.28318530717958647692;
+
+static uint32_t fixedFromCycles(double cycles)
+{
+    return (uint32_t)(int64_t)floor(cycles * 4294967296.0 + 0.5);
+}
+
+static inline float unitFromFixed(uint32_t fixed)
+{
+    return (float)(int32_t)(fixed >> 8) * (1.0f / 16777216.0f);
+}
+
+bool AAPLLightGroupInit(AAPLLightGroup *group, AAPLLightMotion motion, uint32_t first, uint32_t count)
+{
+    memset(group, 0, sizeof(*group));
+    group->motion = motion;
+    group->first = first;
+    group->count = count;
+
+    group->x = calloc(count, sizeof(float));
+    group->y = calloc(count, sizeof(float));
+    group->z = calloc(count, sizeof(float));
+    group->rate = calloc(count, sizeof(uint32_t));
+    group->phase = calloc(count, sizeof(uint32_t));
+    if(count && !(group->x && group->y && group->z && group->rate && group->phase))
+    {
+        AAPLLightGroupDestroy(group);
+        return false;
+    }
+    return true;
+}
+
+void AAPLLightGroupDestroy(AAPLLightGroup *group)
+{
+    free(group->x);
+    free(group->y);
+    free(group->z);
+    free(group->rate);
+    free(group->phase);
+    memset(group, 0, sizeof(*group));
+}
+
+void AAPLLightGroupSetLight(AAPLLightGroup *group, uint32_t index, float x, float y, float z, float speed)
+{
+    group->x[index] = x;
+    group->y[index] = y;
+    group->z[index] = z;
+
+    if(group->motion == AAPLLightMotionRise)
+    {
+        group->rate[index] = fixedFromCycles(speed);
+        group->phase[index] = fixedFromCycles(y - floor(y));
+    }
+    else
+    {
+        group->rate[index] = fixedFromCycles(speed / AAPLTwoPi);
+        group->phase[index] = 0;
+    }
+}
+
+// Climbs 400 units over a cycle, moving outward as pow(t, 5) to follow the branches of the tree
+static void riseBlock(const AAPLLightGroup *group, uint32_t begin, uint32_t count, uint32_t frame,
+                      float *restrict px, float *restrict py, float *restrict pz)
+{
+    const float *restrict x = group->x + begin;
+    const float *restrict z = group->z + begin;
+    const uint32_t *restrict rate = group->rate + begin;
+    const uint32_t *restrict phase = group->phase + begin;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const float t = unitFromFixed(rate[i] * frame + phase[i]);
+        const float t2 = t * t;
+        const float r = 1.2f + 10.0f * (t2 * t2 * t);
+        px[i] = x[i] * r;
+        py[i] = 200.0f + t * 400.0f;
+        pz[i] = z[i] * r;
+    }
+}
+
+// Rotates around the y axis like matrix4x4_rotation(angle, 0, 1, 0). The angle is split into the nearest
+//  quarter turn and a remainder within an eighth of a turn, where short Taylor series of sine and cosine
+//  are accurate to a few float ulps.
+static void orbitBlock(const AAPLLightGroup *group, uint32_t begin, uint32_t count, uint32_t frame,
+                       float *restrict px, float *restrict py, float *restrict pz)
+{
+    const float *restrict x = group->x + begin;
+    const float *restrict y = group->y + begin;
+    const float *restrict z = group->z + begin;
+    const uint32_t *restrict rate = group->rate + begin;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t turns = rate[i] * frame;
+        const uint32_t quarter = (turns + 0x20000000u) >> 30;
+        const float a = (float)(int32_t)(turns - (quarter << 30)) * (float)(AAPLTwoPi / 4294967296.0);
+        const float a2 = a * a;
+
+        const float s = a * (1.0f + a2 * (-1.0f / 6.0f + a2 * (1.0f / 120.0f + a2 * (-1.0f / 5040.0f + a2 * (1.0f / 362880.0f)))));
+        const float c = 1.0f + a2 * (-1.0f / 2.0f + a2 * (1.0f / 24.0f + a2 * (-1.0f / 720.0f + a2 * (1.0f / 40320.0f))));
+
+        // sin and cos of a plus 0, 1, 2 or 3 quarter turns: (s, c), (c, -s), (-s, -c), (-c, s)
+        float sinAngle = (quarter & 1) ? c : s;
+        float cosAngle = (quarter & 1) ? s : c;
+        sinAngle = (quarter & 2) ? -sinAngle : sinAngle;
+        cosAngle = ((quarter + 1) & 2) ? -cosAngle : cosAngle;
+
+        px[i] = cosAngle * x[i] + sinAngle * z[i];
+        py[i] = y[i];
+        pz[i] = cosAngle * z[i] - sinAngle * x[i];
+    }
+}
+
+void AAPLLightGroupAnimate(const AAPLLightGroup *group, uint32_t begin, uint32_t end, uint64_t frame,
+                           const float modelView[16], float *positions)
+{
+    // rate * frame wraps modulo 2^32, so only the low 32 bits of the frame count matter
+    const uint32_t frameBits = (uint32_t)frame;
+    float m[16];
+    memcpy(m, modelView, sizeof(m));
+
+    for(uint32_t blockBegin = begin; blockBegin < end; blockBegin += AAPL_LIGHT_BLOCK)
+    {
+        const uint32_t count = (end - blockBegin) < AAPL_LIGHT_BLOCK ? (end - blockBegin) : AAPL_LIGHT_BLOCK;
+        float px[AAPL_LIGHT_BLOCK], py[AAPL_LIGHT_BLOCK], pz[AAPL_LIGHT_BLOCK];
+
+        if(group->motion == AAPLLightMotionRise)
+            riseBlock(group, blockBegin, count, frameBits, px, py, pz);
+        else
+            orbitBlock(group, blockBegin, count, frameBits, px, py, pz);
+
+        float *restrict out = positions + 4 * ((size_t)group->first + blockBegin);
+        for(uint32_t i = 0; i < count; i++)
+        {
+            out[4 * i + 0] = m[0] * px[i] + m[4] * py[i] + m[8]  * pz[i] + m[12];
+            out[4 * i + 1] = m[1] * px[i] + m[5] * py[i] + m[9]  * pz[i] + m[13];
+            out[4 * i + 2] = m[2] * px[i] + m[6] * py[i] + m[10] * pz[i] + m[14];
+            out[4 * i + 3] = m[3] * px[i] + m[7] * py[i] + m[11] * pz[i] + m[15];
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for the light animation, which moves the point lights of the scene in batches.
+ Lights with the same motion are stored together, one array per value, and are animated with
+ polynomial sine and cosine and with the model-view transform applied in the same pass, in loops
+ the compiler vectorizes. Large groups can be split into chunks of AAPLLightAnimationChunkSize
+ lights animated on different threads.
+*/
+
+#ifndef AAPLLightAnimation_h
+#define AAPLLightAnimation_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Lights per chunk when a group is animated on several threads; smaller groups are not worth splitting
+static const uint32_t AAPLLightAnimationChunkSize = 4096;
+
+typedef enum AAPLLightMotion
+{
+    /// Tree lights: rise along the trunk, spread out as they reach the branches, then start over
+    AAPLLightMotionRise,
+
+    /// Ground and column lights: circle around the y axis
+    AAPLLightMotionOrbit,
+} AAPLLightMotion;
+
+/// Lights with the same motion, in consecutive entries of the position buffer
+typedef struct AAPLLightGroup
+{
+    AAPLLightMotion motion;
+    uint32_t first;         // Position buffer entry of the first light
+    uint32_t count;
+
+    // Original positions
+    float *x;
+    float *y;
+    float *z;
+
+    // Cycles (rise) or turns (orbit) per frame, and position in the cycle at frame 0, in units of 2^-32 so
+    //  the phase of any frame is computed exactly with wrapping integer math
+    uint32_t *rate;
+    uint32_t *phase;
+} AAPLLightGroup;
+
+/// Allocates a group of `count` lights, at entries [first, first + count) of the position buffer
+bool AAPLLightGroupInit(AAPLLightGroup *group, AAPLLightMotion motion, uint32_t first, uint32_t count);
+
+void AAPLLightGroupDestroy(AAPLLightGroup *group);
+
+/// Sets light `index` of the group from its original position and speed: cycles per frame for rising lights,
+///   with the height giving the start of the cycle, radians per frame for orbiting lights
+void AAPLLightGroupSetLight(AAPLLightGroup *group, uint32_t index, float x, float y, float z, float speed);
+
+/// Writes the model-view space positions at `frame` of lights [begin, end) of the group, 4 floats per light,
+///   to their entries of `positions`. `modelView` is column major, like matrix_float4x4.
+void AAPLLightGroupAnimate(const AAPLLightGroup *group, uint32_t begin, uint32_t end, uint64_t frame,
+                           const float modelView[16], float *positions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AAPLLightAnimation_h */
@@ -28,16 +28,14 @@ float AAPL_SIMD_OVERLOAD degrees_from_radians(float radians);
 /// Returns the number of radians in the specified number of degrees
 float AAPL_SIMD_OVERLOAD radians_from_degrees(float degrees);
 
-// Generates random float value inside given range
-inline static float AAPL_SIMD_OVERLOAD  random_float(float min, float max)
-{
-    return (((double)rand()/RAND_MAX) * (max-min)) + min;
-}
+/// Generates random float value inside given range, from the stream seeded by seedRand
+float AAPL_SIMD_OVERLOAD random_float(float min, float max);
 
-/// Generate a random 3 component vector with values between min and max
+/// Generate a random 3 component vector with values between min and max, from the stream seeded by seedRand
 vector_float3 AAPL_SIMD_OVERLOAD generate_random_vector(float min, float max);
 
-/// Fast random seed
+/// Fast random seed; restarts the stream of randi, randf, random_float and generate_random_vector.
+///   The values only depend on the seed, on every platform (see AAPLRandom.h).
 void AAPL_SIMD_OVERLOAD seedRand(uint32_t seed);
 
 /// Fast integer random
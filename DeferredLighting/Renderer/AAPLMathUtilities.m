@@ -17,10 +17,12 @@ Implementation of vector, matrix, and quaternion math utility functions useful f
 */
 
 #import "AAPLMathUtilities.h"
+#import "AAPLRandom.h"
 #include <assert.h>
 #include <stdlib.h>
 
-uint32_t seed_lo, seed_hi;
+// Stream of the unseeded functions; zeroed, it is stream 0 of seed 0
+static AAPLRandomStream random_stream;
 
 static float inline F16ToF32(const __fp16 *address) {
     return *address;
@@ -44,22 +46,23 @@ vector_float3 AAPL_SIMD_OVERLOAD generate_random_vector(float min, float max)
 {
     vector_float3 rand;
 
-    float range = max - min;
-    rand.x = ((double)random() / (double) (0x7FFFFFFF)) * range + min;
-    rand.y = ((double)random() / (double) (0x7FFFFFFF)) * range + min;
-    rand.z = ((double)random() / (double) (0x7FFFFFFF)) * range + min;
+    rand.x = AAPLRandomNextRange(&random_stream, min, max);
+    rand.y = AAPLRandomNextRange(&random_stream, min, max);
+    rand.z = AAPLRandomNextRange(&random_stream, min, max);
 
     return rand;
 }
 
+float AAPL_SIMD_OVERLOAD random_float(float min, float max) {
+    return AAPLRandomNextRange(&random_stream, min, max);
+}
+
 void AAPL_SIMD_OVERLOAD seedRand(uint32_t seed) {
-    seed_lo = seed; seed_hi = ~seed;
+    AAPLRandomStreamInit(&random_stream, seed, 0);
 }
 
 int32_t AAPL_SIMD_OVERLOAD randi(void) {
-    seed_hi = (seed_hi<<16) + (seed_hi>>16);
-    seed_hi += seed_lo; seed_lo += seed_hi;
-    return seed_hi;
+    return (int32_t)AAPLRandomNextUInt(&random_stream);
 }
 
 float AAPL_SIMD_OVERLOAD randf(float x) {
@@ -0,0 +1,513 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the occlusion buffer
+ Screen space has its origin at the top left corner of the buffer, in pixels, with pixel centers at
+ half-pixel offsets. Triangles are wound so their edge functions are positive inside; a pixel is covered
+ when its center is inside or on the edges of the triangle, so edges shared by two occluder triangles
+ leave no gaps. Depth is interpolated as a plane in screen space, which z / w is.
+*/
+
+#include "AAPLOcclusionBuffer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <pthread.h>
+#endif
+
+#define AAPL_TILE AAPL_OCCLUSION_TILE_SIZE
+#define AAPL_BLOCK AAPL_OCCLUSION_BLOCK_SIZE
+
+static bool reserve(void **buffer, size_t *capacity, size_t count, size_t elementSize)
+{
+    if(count <= *capacity)
+        return true;
+
+    size_t newCapacity = *capacity ? *capacity : 64;
+    while(newCapacity < count)
+        newCapacity *= 2;
+
+    void *newBuffer = realloc(*buffer, newCapacity * elementSize);
+    if(!newBuffer)
+        return false;
+
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+    return true;
+}
+
+// Comparisons and truncation rather than fminf, fmaxf, floorf and ceilf, which are calls into the math
+//  library on some targets; values are clamped to the range of the buffer before being truncated
+static inline float minFloat(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float maxFloat(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+static inline float clampFloat(float value, float low, float high)
+{
+    return minFloat(maxFloat(value, low), high);
+}
+
+static inline int32_t floorToInt(float value)
+{
+    const int32_t truncated = (int32_t)value;
+    return truncated - (value < (float)truncated);
+}
+
+static inline int32_t ceilToInt(float value)
+{
+    const int32_t truncated = (int32_t)value;
+    return truncated + (value > (float)truncated);
+}
+
+static inline void transformPoint(const float m[16], const float p[3], float clip[4])
+{
+    for(int i = 0; i < 4; i++)
+    {
+        clip[i] = m[i] * p[0] + m[4 + i] * p[1] + m[8 + i] * p[2] + m[12 + i];
+    }
+}
+
+bool AAPLOcclusionBufferInit(AAPLOcclusionBuffer *buffer, uint32_t width, uint32_t height, uint32_t binnerCount)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    if(!width || !height || width % AAPL_TILE || height % AAPL_TILE || !binnerCount)
+        return false;
+
+    buffer->width = width;
+    buffer->height = height;
+    buffer->tileCountX = width / AAPL_TILE;
+    buffer->tileCountY = height / AAPL_TILE;
+    buffer->blockCountX = width / AAPL_BLOCK;
+    buffer->blockCountY = height / AAPL_BLOCK;
+    buffer->binnerCount = binnerCount;
+
+    const uint32_t tileCount = buffer->tileCountX * buffer->tileCountY;
+    buffer->depth = malloc((size_t)width * height * sizeof(float));
+    buffer->blockMaxDepth = malloc((size_t)buffer->blockCountX * buffer->blockCountY * sizeof(float));
+    buffer->binners = calloc(binnerCount, sizeof(AAPLOcclusionBinner));
+    bool success = buffer->depth && buffer->blockMaxDepth && buffer->binners;
+
+    for(uint32_t binnerIndex = 0; binnerIndex < binnerCount && success; binnerIndex++)
+    {
+        AAPLOcclusionBinner *binner = &buffer->binners[binnerIndex];
+        binner->tileTriangles = calloc(tileCount, sizeof(uint32_t *));
+        binner->tileTriangleCounts = calloc(tileCount, sizeof(uint32_t));
+        binner->tileTriangleCapacities = calloc(tileCount, sizeof(uint32_t));
+        success = binner->tileTriangles && binner->tileTriangleCounts && binner->tileTriangleCapacities;
+    }
+
+    if(!success)
+    {
+        AAPLOcclusionBufferDestroy(buffer);
+        return false;
+    }
+
+    for(size_t pixel = 0; pixel < (size_t)width * height; pixel++)
+    {
+        buffer->depth[pixel] = 1.0f;
+    }
+    for(size_t block = 0; block < (size_t)buffer->blockCountX * buffer->blockCountY; block++)
+    {
+        buffer->blockMaxDepth[block] = 1.0f;
+    }
+
+    return true;
+}
+
+void AAPLOcclusionBufferDestroy(AAPLOcclusionBuffer *buffer)
+{
+    const uint32_t tileCount = buffer->tileCountX * buffer->tileCountY;
+    for(uint32_t binnerIndex = 0; buffer->binners && binnerIndex < buffer->binnerCount; binnerIndex++)
+    {
+        AAPLOcclusionBinner *binner = &buffer->binners[binnerIndex];
+        for(uint32_t tile = 0; binner->tileTriangles && tile < tileCount; tile++)
+        {
+            free(binner->tileTriangles[tile]);
+        }
+        free(binner->tileTriangles);
+        free(binner->tileTriangleCounts);
+        free(binner->tileTriangleCapacities);
+        free(binner->triangles);
+    }
+
+    free(buffer->binners);
+    free(buffer->depth);
+    free(buffer->blockMaxDepth);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void AAPLOcclusionBufferBegin(AAPLOcclusionBuffer *buffer)
+{
+    const uint32_t tileCount = buffer->tileCountX * buffer->tileCountY;
+    for(uint32_t binnerIndex = 0; binnerIndex < buffer->binnerCount; binnerIndex++)
+    {
+        AAPLOcclusionBinner *binner = &buffer->binners[binnerIndex];
+        binner->triangleCount = 0;
+        memset(binner->tileTriangleCounts, 0, tileCount * sizeof(uint32_t));
+    }
+}
+
+static bool binTriangle(AAPLOcclusionBuffer *buffer, AAPLOcclusionBinner *binner, const AAPLOcclusionTriangle *triangle)
+{
+    if(!reserve((void **)&binner->triangles, &binner->triangleCapacity, binner->triangleCount + 1,
+                sizeof(AAPLOcclusionTriangle)))
+        return false;
+
+    const uint32_t triangleIndex = (uint32_t)binner->triangleCount++;
+    binner->triangles[triangleIndex] = *triangle;
+
+    const int16_t *pixels = triangle->pixels;
+    for(int32_t tileY = pixels[1] / AAPL_TILE; tileY <= pixels[3] / AAPL_TILE; tileY++)
+    {
+        for(int32_t tileX = pixels[0] / AAPL_TILE; tileX <= pixels[2] / AAPL_TILE; tileX++)
+        {
+            const uint32_t tile = tileY * buffer->tileCountX + tileX;
+            size_t capacity = binner->tileTriangleCapacities[tile];
+            if(!reserve((void **)&binner->tileTriangles[tile], &capacity, binner->tileTriangleCounts[tile] + 1,
+                        sizeof(uint32_t)))
+                return false;
+
+            binner->tileTriangleCapacities[tile] = (uint32_t)capacity;
+            binner->tileTriangles[tile][binner->tileTriangleCounts[tile]++] = triangleIndex;
+        }
+    }
+
+    return true;
+}
+
+bool AAPLOcclusionBufferBinTriangles(AAPLOcclusionBuffer *buffer, uint32_t binnerIndex,
+                                     const float modelViewProjection[16], const void *vertices, size_t vertexStride,
+                                     const uint32_t *indices, uint32_t triangleBegin, uint32_t triangleEnd)
+{
+    AAPLOcclusionBinner *binner = &buffer->binners[binnerIndex];
+    const float width = (float)buffer->width;
+    const float height = (float)buffer->height;
+
+    for(uint32_t triangleIndex = triangleBegin; triangleIndex < triangleEnd; triangleIndex++)
+    {
+        float x[3], y[3], z[3];
+        bool clipped = false;
+        for(int corner = 0; corner < 3; corner++)
+        {
+            const float *position = (const float *)((const char *)vertices +
+                                                    indices[3 * triangleIndex + corner] * vertexStride);
+            float clip[4];
+            transformPoint(modelViewProjection, position, clip);
+
+            // In front of the near plane, or behind the eye
+            clipped |= !(clip[2] >= 0.0f && clip[3] > 0.0f);
+
+            const float inverseW = 1.0f / clip[3];
+            x[corner] = (clip[0] * inverseW * 0.5f + 0.5f) * width;
+            y[corner] = (0.5f - clip[1] * inverseW * 0.5f) * height;
+            z[corner] = clip[2] * inverseW;
+        }
+
+        // Wind the triangle so its edge functions are positive inside
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if(clipped || !(area != 0.0f) || minFloat(minFloat(z[0], z[1]), z[2]) > 1.0f)
+            continue;
+
+        if(area < 0.0f)
+        {
+            float swap;
+            swap = x[1]; x[1] = x[2]; x[2] = swap;
+            swap = y[1]; y[1] = y[2]; y[2] = swap;
+            swap = z[1]; z[1] = z[2]; z[2] = swap;
+            area = -area;
+        }
+
+        // Pixels whose centers are in the bounding box of the triangle
+        int32_t pixels[4];
+        pixels[0] = ceilToInt(clampFloat(minFloat(minFloat(x[0], x[1]), x[2]) - 0.5f, 0.0f, width));
+        pixels[1] = ceilToInt(clampFloat(minFloat(minFloat(y[0], y[1]), y[2]) - 0.5f, 0.0f, height));
+        pixels[2] = floorToInt(clampFloat(maxFloat(maxFloat(x[0], x[1]), x[2]) - 0.5f, -1.0f, width - 1.0f));
+        pixels[3] = floorToInt(clampFloat(maxFloat(maxFloat(y[0], y[1]), y[2]) - 0.5f, -1.0f, height - 1.0f));
+        if(pixels[0] > pixels[2] || pixels[1] > pixels[3])
+            continue;
+
+        AAPLOcclusionTriangle triangle;
+        for(int corner = 0; corner < 4; corner++)
+        {
+            triangle.pixels[corner] = (int16_t)pixels[corner];
+        }
+
+        // Edge i goes from vertex i to the next one
+        for(int edge = 0; edge < 3; edge++)
+        {
+            const int next = edge == 2 ? 0 : edge + 1;
+            triangle.edgeX[edge] = y[edge] - y[next];
+            triangle.edgeY[edge] = x[next] - x[edge];
+            triangle.edgeOffset[edge] = x[edge] * y[next] - x[next] * y[edge];
+        }
+
+        const float inverseArea = 1.0f / area;
+        triangle.depthStepX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * inverseArea;
+        triangle.depthStepY = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * inverseArea;
+        triangle.depthAtOrigin = z[0] - triangle.depthStepX * x[0] - triangle.depthStepY * y[0];
+
+        if(!binTriangle(buffer, binner, &triangle))
+            return false;
+    }
+
+    return true;
+}
+
+static void rasterizeTriangle(AAPLOcclusionBuffer *buffer, const AAPLOcclusionTriangle *triangle,
+                              int32_t tileX, int32_t tileY)
+{
+    const int16_t *pixels = triangle->pixels;
+    const int32_t xBegin = pixels[0] > tileX ? pixels[0] : tileX;
+    const int32_t yBegin = pixels[1] > tileY ? pixels[1] : tileY;
+    const int32_t xEnd = (pixels[2] < tileX + AAPL_TILE - 1 ? pixels[2] : tileX + AAPL_TILE - 1) + 1;
+    const int32_t yEnd = (pixels[3] < tileY + AAPL_TILE - 1 ? pixels[3] : tileY + AAPL_TILE - 1) + 1;
+
+    const float a0 = triangle->edgeX[0], a1 = triangle->edgeX[1], a2 = triangle->edgeX[2];
+    const float depthStepX = triangle->depthStepX;
+
+    for(int32_t pixelY = yBegin; pixelY < yEnd; pixelY++)
+    {
+        const float py = (float)pixelY + 0.5f;
+        const float c0 = triangle->edgeY[0] * py + triangle->edgeOffset[0];
+        const float c1 = triangle->edgeY[1] * py + triangle->edgeOffset[1];
+        const float c2 = triangle->edgeY[2] * py + triangle->edgeOffset[2];
+        const float rowDepth = triangle->depthAtOrigin + triangle->depthStepY * py;
+
+        float *restrict depth = buffer->depth + (size_t)pixelY * buffer->width;
+        for(int32_t pixelX = xBegin; pixelX < xEnd; pixelX++)
+        {
+            const float px = (float)pixelX + 0.5f;
+            const float z = rowDepth + depthStepX * px;
+            const bool covered = (a0 * px + c0 >= 0.0f) & (a1 * px + c1 >= 0.0f) & (a2 * px + c2 >= 0.0f) &
+                                 (z < depth[pixelX]);
+            depth[pixelX] = covered ? z : depth[pixelX];
+        }
+    }
+}
+
+void AAPLOcclusionBufferRasterizeTiles(AAPLOcclusionBuffer *buffer, uint32_t tileBegin, uint32_t tileEnd)
+{
+    for(uint32_t tile = tileBegin; tile < tileEnd; tile++)
+    {
+        const int32_t tileX = (int32_t)(tile % buffer->tileCountX) * AAPL_TILE;
+        const int32_t tileY = (int32_t)(tile / buffer->tileCountX) * AAPL_TILE;
+
+        for(int32_t y = tileY; y < tileY + AAPL_TILE; y++)
+        {
+            float *depth = buffer->depth + (size_t)y * buffer->width + tileX;
+            for(int32_t x = 0; x < AAPL_TILE; x++)
+            {
+                depth[x] = 1.0f;
+            }
+        }
+
+        for(uint32_t binnerIndex = 0; binnerIndex < buffer->binnerCount; binnerIndex++)
+        {
+            const AAPLOcclusionBinner *binner = &buffer->binners[binnerIndex];
+            const uint32_t *triangles = binner->tileTriangles[tile];
+            for(uint32_t i = 0; i < binner->tileTriangleCounts[tile]; i++)
+            {
+                rasterizeTriangle(buffer, &binner->triangles[triangles[i]], tileX, tileY);
+            }
+        }
+
+        // Farthest depth of the blocks of the tile
+        for(int32_t blockY = tileY; blockY < tileY + AAPL_TILE; blockY += AAPL_BLOCK)
+        {
+            for(int32_t blockX = tileX; blockX < tileX + AAPL_TILE; blockX += AAPL_BLOCK)
+            {
+                float maxDepth = 0.0f;
+                for(int32_t y = blockY; y < blockY + AAPL_BLOCK; y++)
+                {
+                    const float *depth = buffer->depth + (size_t)y * buffer->width + blockX;
+                    for(int32_t x = 0; x < AAPL_BLOCK; x++)
+                    {
+                        maxDepth = depth[x] > maxDepth ? depth[x] : maxDepth;
+                    }
+                }
+                buffer->blockMaxDepth[(blockY / AAPL_BLOCK) * buffer->blockCountX + blockX / AAPL_BLOCK] = maxDepth;
+            }
+        }
+    }
+}
+
+/// Arguments shared by the jobs of AAPLOcclusionBufferRender; job `index` bins with binner `index` and
+///   rasterizes the `index`th range of tiles
+typedef struct AAPLOcclusionRenderJobs
+{
+    AAPLOcclusionBuffer *buffer;
+    const float *modelViewProjection;
+    const void *vertices;
+    size_t vertexStride;
+    const uint32_t *indices;
+    uint32_t triangleCount;
+    uint32_t jobCount;
+    bool *binned;
+} AAPLOcclusionRenderJobs;
+
+static void binJob(void *context, size_t index)
+{
+    AAPLOcclusionRenderJobs *jobs = (AAPLOcclusionRenderJobs *)context;
+    const uint32_t begin = (uint32_t)((uint64_t)jobs->triangleCount * index / jobs->jobCount);
+    const uint32_t end = (uint32_t)((uint64_t)jobs->triangleCount * (index + 1) / jobs->jobCount);
+    jobs->binned[index] = AAPLOcclusionBufferBinTriangles(jobs->buffer, (uint32_t)index, jobs->modelViewProjection,
+                                                          jobs->vertices, jobs->vertexStride, jobs->indices,
+                                                          begin, end);
+}
+
+static void rasterizeJob(void *context, size_t index)
+{
+    AAPLOcclusionRenderJobs *jobs = (AAPLOcclusionRenderJobs *)context;
+    const uint32_t tileCount = jobs->buffer->tileCountX * jobs->buffer->tileCountY;
+    AAPLOcclusionBufferRasterizeTiles(jobs->buffer, (uint32_t)(tileCount * index / jobs->jobCount),
+                                      (uint32_t)(tileCount * (index + 1) / jobs->jobCount));
+}
+
+#if !defined(__APPLE__)
+
+typedef struct AAPLOcclusionThread
+{
+    void (*function)(void *, size_t);
+    void *context;
+    size_t index;
+} AAPLOcclusionThread;
+
+static void *runThread(void *argument)
+{
+    AAPLOcclusionThread *thread = (AAPLOcclusionThread *)argument;
+    thread->function(thread->context, thread->index);
+    return NULL;
+}
+
+#endif
+
+/// Calls `function` with indices [0, count) on up to `count` threads and returns once all calls are done
+static void applyJobs(size_t count, void *context, void (*function)(void *, size_t))
+{
+    if(count <= 1)
+    {
+        function(context, 0);
+        return;
+    }
+#if defined(__APPLE__)
+    dispatch_apply_f(count, dispatch_get_global_queue(QOS_CLASS_USER_INTERACTIVE, 0), context, function);
+#else
+    // Job 0 runs on the calling thread, and so do the jobs whose thread could not be created
+    pthread_t threads[count];
+    AAPLOcclusionThread arguments[count];
+    bool started[count];
+    for(size_t index = 1; index < count; index++)
+    {
+        arguments[index] = (AAPLOcclusionThread){ function, context, index };
+        started[index] = pthread_create(&threads[index], NULL, runThread, &arguments[index]) == 0;
+    }
+    function(context, 0);
+    for(size_t index = 1; index < count; index++)
+    {
+        if(started[index])
+            pthread_join(threads[index], NULL);
+        else
+            function(context, index);
+    }
+#endif
+}
+
+bool AAPLOcclusionBufferRender(AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                               const void *vertices, size_t vertexStride, const uint32_t *indices,
+                               uint32_t triangleCount, uint32_t threadCount)
+{
+    uint32_t jobCount = threadCount < buffer->binnerCount ? threadCount : buffer->binnerCount;
+    jobCount = jobCount > 0 ? jobCount : 1;
+
+    bool binned[jobCount];
+    AAPLOcclusionRenderJobs jobs =
+    {
+        buffer, modelViewProjection, vertices, vertexStride, indices, triangleCount, jobCount, binned
+    };
+
+    AAPLOcclusionBufferBegin(buffer);
+    applyJobs(jobCount, &jobs, binJob);
+
+    bool success = true;
+    for(uint32_t index = 0; index < jobCount; index++)
+    {
+        success = success && binned[index];
+    }
+
+    applyJobs(jobCount, &jobs, rasterizeJob);
+    return success;
+}
+
+bool AAPLOcclusionBufferTestBox(const AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                                const float boxMin[3], const float boxMax[3])
+{
+    float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
+    float maxX = -INFINITY, maxY = -INFINITY;
+    for(int corner = 0; corner < 8; corner++)
+    {
+        const float position[3] =
+        {
+            (corner & 1) ? boxMax[0] : boxMin[0],
+            (corner & 2) ? boxMax[1] : boxMin[1],
+            (corner & 4) ? boxMax[2] : boxMin[2],
+        };
+        float clip[4];
+        transformPoint(modelViewProjection, position, clip);
+
+        // A box that crosses the near plane may cover any part of the view
+        if(!(clip[2] >= 0.0f && clip[3] > 0.0f))
+            return true;
+
+        const float inverseW = 1.0f / clip[3];
+        minX = minFloat(minX, clip[0] * inverseW);
+        maxX = maxFloat(maxX, clip[0] * inverseW);
+        minY = minFloat(minY, clip[1] * inverseW);
+        maxY = maxFloat(maxY, clip[1] * inverseW);
+        minZ = minFloat(minZ, clip[2] * inverseW);
+    }
+
+    if(minX > 1.0f || maxX < -1.0f || minY > 1.0f || maxY < -1.0f || minZ > 1.0f)
+        return false;
+
+    // Blocks under the screen space bounds of the box; y goes down the screen
+    const float blocksPerUnitX = 0.5f * buffer->blockCountX;
+    const float blocksPerUnitY = 0.5f * buffer->blockCountY;
+    const float lastBlockX = buffer->blockCountX - 1.0f;
+    const float lastBlockY = buffer->blockCountY - 1.0f;
+    const int32_t blockXBegin = floorToInt(clampFloat((minX + 1.0f) * blocksPerUnitX, 0.0f, lastBlockX));
+    const int32_t blockXEnd = floorToInt(clampFloat((maxX + 1.0f) * blocksPerUnitX, 0.0f, lastBlockX));
+    const int32_t blockYBegin = floorToInt(clampFloat((1.0f - maxY) * blocksPerUnitY, 0.0f, lastBlockY));
+    const int32_t blockYEnd = floorToInt(clampFloat((1.0f - minY) * blocksPerUnitY, 0.0f, lastBlockY));
+
+    for(int32_t blockY = blockYBegin; blockY <= blockYEnd; blockY++)
+    {
+        const float *blockMaxDepth = buffer->blockMaxDepth + blockY * buffer->blockCountX;
+        for(int32_t blockX = blockXBegin; blockX <= blockXEnd; blockX++)
+        {
+            if(minZ <= blockMaxDepth[blockX])
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool AAPLOcclusionBufferTestSphere(const AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                                   const float center[3], float radius)
+{
+    const float boxMin[3] = { center[0] - radius, center[1] - radius, center[2] - radius };
+    const float boxMax[3] = { center[0] + radius, center[1] + radius, center[2] + radius };
+    return AAPLOcclusionBufferTestBox(buffer, modelViewProjection, boxMin, boxMax);
+}
@@ -0,0 +1,126 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for the occlusion buffer, a low resolution depth buffer rasterized on the CPU from occluder
+ triangles, against which the bounding boxes and spheres of objects are tested before their draws are
+ encoded.
+ Triangles are transformed and binned to screen tiles first, then every tile is rasterized on its own
+ with edge functions evaluated a row of pixels at a time, in loops the compiler vectorizes. Binning
+ can be split over several threads, each writing to its own bins, and tiles can be rasterized on
+ separate threads; AAPLOcclusionBufferRender runs both passes that way. Every tile also keeps the farthest depth of each of its blocks, the hierarchical
+ depth that object tests read.
+ Occluders are sampled at pixel centers, so objects only visible through gaps narrower than a pixel of
+ the occlusion buffer can be culled.
+*/
+
+#ifndef AAPLOcclusionBuffer_h
+#define AAPLOcclusionBuffer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Default size of the occlusion buffer
+static const uint32_t AAPLOcclusionBufferWidth = 256;
+static const uint32_t AAPLOcclusionBufferHeight = 128;
+
+/// Size of the tiles that are rasterized separately. The buffer size must be a multiple of it.
+#define AAPL_OCCLUSION_TILE_SIZE 32
+
+/// Size of the blocks of the hierarchical depth
+#define AAPL_OCCLUSION_BLOCK_SIZE 8
+
+/// A triangle binned to tiles, set up for rasterization: its edge functions edgeX * x + edgeY * y + edgeOffset,
+///   positive inside, its depth as a plane, and the bounds of the pixels its bounding box covers
+typedef struct AAPLOcclusionTriangle
+{
+    float edgeX[3];
+    float edgeY[3];
+    float edgeOffset[3];
+    float depthAtOrigin;
+    float depthStepX;
+    float depthStepY;
+    int16_t pixels[4];              // First x, first y, last x, last y
+} AAPLOcclusionTriangle;
+
+/// Triangles binned by one thread
+typedef struct AAPLOcclusionBinner
+{
+    AAPLOcclusionTriangle *triangles;
+    size_t triangleCount;
+    size_t triangleCapacity;
+
+    // Triangles of every tile, as indices into `triangles`
+    uint32_t **tileTriangles;
+    uint32_t *tileTriangleCounts;
+    uint32_t *tileTriangleCapacities;
+} AAPLOcclusionBinner;
+
+typedef struct AAPLOcclusionBuffer
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileCountX;
+    uint32_t tileCountY;
+    uint32_t blockCountX;
+    uint32_t blockCountY;
+
+    // Depth of every pixel, 0 at the near plane and 1 at the far plane like the depth of the projection
+    //  matrices of the sample
+    float *depth;
+
+    // Farthest depth of every block
+    float *blockMaxDepth;
+
+    uint32_t binnerCount;
+    AAPLOcclusionBinner *binners;
+} AAPLOcclusionBuffer;
+
+/// Allocates a buffer of `width` by `height` pixels whose triangles can be binned by up to `binnerCount`
+///   threads at once
+bool AAPLOcclusionBufferInit(AAPLOcclusionBuffer *buffer, uint32_t width, uint32_t height, uint32_t binnerCount);
+
+void AAPLOcclusionBufferDestroy(AAPLOcclusionBuffer *buffer);
+
+/// Clears the bins of every binner before the triangles of a frame are binned
+void AAPLOcclusionBufferBegin(AAPLOcclusionBuffer *buffer);
+
+/// Transforms triangles [triangleBegin, triangleEnd) of an indexed triangle list with `modelViewProjection`,
+///   column major like matrix_float4x4, and bins them with binner `binnerIndex`. Vertex positions are 3 floats
+///   at the start of every vertex, `vertexStride` bytes apart. Triangles that cross the near plane are not
+///   binned; as occluders they are optional. Calls with different binners can run concurrently.
+bool AAPLOcclusionBufferBinTriangles(AAPLOcclusionBuffer *buffer, uint32_t binnerIndex,
+                                     const float modelViewProjection[16], const void *vertices, size_t vertexStride,
+                                     const uint32_t *indices, uint32_t triangleBegin, uint32_t triangleEnd);
+
+/// Rasterizes the triangles of tiles [tileBegin, tileEnd), in row order, and updates their blocks. Calls with
+///   disjoint tiles can run concurrently once binning is done.
+void AAPLOcclusionBufferRasterizeTiles(AAPLOcclusionBuffer *buffer, uint32_t tileBegin, uint32_t tileEnd);
+
+/// Clears the bins, then bins and rasterizes all `triangleCount` triangles of an indexed triangle list like
+///   AAPLOcclusionBufferBinTriangles and AAPLOcclusionBufferRasterizeTiles, splitting both passes over up to
+///   `threadCount` threads and no more threads than the buffer has binners. Uses dispatch_apply on Apple
+///   platforms and pthreads elsewhere. Returns false if a bin could not grow.
+bool AAPLOcclusionBufferRender(AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                               const void *vertices, size_t vertexStride, const uint32_t *indices,
+                               uint32_t triangleCount, uint32_t threadCount);
+
+/// Returns false if the box between `boxMin` and `boxMax`, transformed by `modelViewProjection`, is outside of
+///   the view or behind the occluders
+bool AAPLOcclusionBufferTestBox(const AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                                const float boxMin[3], const float boxMax[3]);
+
+/// Same as AAPLOcclusionBufferTestBox for the box around a sphere
+bool AAPLOcclusionBufferTestSphere(const AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                                   const float center[3], float radius);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AAPLOcclusionBuffer_h */
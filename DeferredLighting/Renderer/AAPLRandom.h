@@ -0,0 +1,57 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for a counter-based random number generator (Philox4x32-10) used to generate the scene.
+ Every value is a pure function of a seed, a stream index and its position in the stream, so the
+ output does not depend on the platform's rand(), and threads that each draw from their own stream
+ produce the same values whatever order they run in.
+*/
+
+#ifndef AAPLRandom_h
+#define AAPLRandom_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// A sequence of random values. A zeroed stream is stream 0 of seed 0.
+typedef struct AAPLRandomStream
+{
+    uint32_t key[2];
+    uint32_t stream[2];
+    uint64_t block;         // Next block of 4 values to generate
+    uint32_t values[4];     // Current block
+    uint32_t available;     // Values of the current block not returned yet, the last ones
+} AAPLRandomStream;
+
+/// Starts stream `streamIndex` of `seed` at its first value. Streams of the same seed do not overlap.
+void AAPLRandomStreamInit(AAPLRandomStream *stream, uint64_t seed, uint64_t streamIndex);
+
+/// Returns the next 32 random bits of the stream
+uint32_t AAPLRandomNextUInt(AAPLRandomStream *stream);
+
+/// Returns the next value of the stream as a float in [0, 1), with 24 random bits
+float AAPLRandomNextFloat(AAPLRandomStream *stream);
+
+/// Returns the next value of the stream as a float in [min, max)
+float AAPLRandomNextRange(AAPLRandomStream *stream, float min, float max);
+
+/// Returns the next value of the stream as an integer in [0, bound)
+uint32_t AAPLRandomNextBelow(AAPLRandomStream *stream, uint32_t bound);
+
+/// Writes values [first, first + count) of stream `streamIndex` of `seed`, the values
+///   AAPLRandomNextUInt would return, several blocks at a time
+void AAPLRandomFillUInts(uint64_t seed, uint64_t streamIndex, uint64_t first, uint32_t *values, size_t count);
+
+/// Same as AAPLRandomFillUInts, with the values converted like AAPLRandomNextFloat
+void AAPLRandomFillFloats(uint64_t seed, uint64_t streamIndex, uint64_t first, float *values, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AAPLRandom_h */
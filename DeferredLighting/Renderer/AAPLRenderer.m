@@ -14,7 +14,9 @@ Implementation of renderer class which performs Metal setup and per frame render
 #import "AAPLBufferExamination.h"
 #import "AAPLRenderer.h"
 #import "AAPLMesh.h"
+#import "AAPLLightAnimation.h"
 #import "AAPLMathUtilities.h"
+#import "AAPLRandom.h"
 
 // Include header shared between C code here, which executes Metal API commands, and .metal files
 #import "AAPLShaderTypes.h"
@@ -83,8 +85,9 @@ static const NSUInteger AAPLColumnLights = AAPLGroundLights  + 0.30 * AAPLNumLig
     // Mesh buffer for fairies
     id<MTLBuffer> _fairy;
 
-    // Light positions before transformation to positions in current frame
-    NSData *_originalLightPositions;
+    // Light positions before transformation to positions in current frame, and light speeds, for the tree,
+    //  ground and column lights
+    AAPLLightGroup _lightGroups[3];
 
 #if SUPPORT_BUFFER_EXAMINATION_MODE
     AAPLBufferExamination *_bufferExamination;
@@ -686,21 +689,35 @@ static const NSUInteger AAPLColumnLights = AAPLGroundLights  + 0.30 * AAPLNumLig
     }
 }
 
+- (void)dealloc
+{
+    for(uint32_t group = 0; group < 3; group++)
+    {
+        AAPLLightGroupDestroy(&_lightGroups[group]);
+    }
+}
+
 /// Initialize light positions and colors
 - (void)populateLights
 {
     AAPLPointLight *light_data = (AAPLPointLight*)[_lightsData contents];
 
-    NSMutableData * originalLightPositions =  [[NSMutableData alloc] initWithLength:_lightPositions[0].length];
+    AAPLLightGroup *lightGroups = _lightGroups;
+    // The last group also takes the lights past AAPLColumnLights, left at the origin by rounding
+    BOOL allocated = AAPLLightGroupInit(&lightGroups[0], AAPLLightMotionRise, 0, (uint32_t)AAPLTreeLights);
+    allocated &= AAPLLightGroupInit(&lightGroups[1], AAPLLightMotionOrbit, (uint32_t)AAPLTreeLights,
+                                    (uint32_t)(AAPLGroundLights - AAPLTreeLights));
+    allocated &= AAPLLightGroupInit(&lightGroups[2], AAPLLightMotionOrbit, (uint32_t)AAPLGroundLights,
+                                    (uint32_t)(AAPLNumLights - AAPLGroundLights));
 
-    _originalLightPositions = originalLightPositions;
+    NSAssert(allocated, @"Could not allocate light groups");
 
-    vector_float4 *light_position = (vector_float4*)originalLightPositions.mutableBytes;
-
-    srand(0x134e5348);
-
-    for(NSUInteger lightId = 0; lightId < AAPLNumLights; lightId++)
+    // Each light draws from its own stream, so the lights do not depend on the order they are generated in
+    dispatch_apply(AAPLNumLights, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t lightId)
     {
+        AAPLRandomStream lightRandom;
+        AAPLRandomStreamInit(&lightRandom, 0x134e5348, lightId);
+
         float distance = 0;
         float height = 0;
         float angle = 0;
@@ -708,84 +725,86 @@ static const NSUInteger AAPLColumnLights = AAPLGroundLights  + 0.30 * AAPLNumLig
 
         if(lightId < AAPLTreeLights)
         {
-            distance = random_float(38,42);
-            height = random_float(0,1);
-            angle = random_float(0, M_PI*2);
-            speed = random_float(0.003,0.014);
+            distance = AAPLRandomNextRange(&lightRandom, 38,42);
+            height = AAPLRandomNextRange(&lightRandom, 0,1);
+            angle = AAPLRandomNextRange(&lightRandom, 0, M_PI*2);
+            speed = AAPLRandomNextRange(&lightRandom, 0.003,0.014);
         }
         else if(lightId < AAPLGroundLights)
         {
-            distance = random_float(140,260);
-            height = random_float(140,150);
-            angle = random_float(0, M_PI*2);
-            speed = random_float(0.006,0.027);
-            speed *= (rand()%2)*2-1;
+            distance = AAPLRandomNextRange(&lightRandom, 140,260);
+            height = AAPLRandomNextRange(&lightRandom, 140,150);
+            angle = AAPLRandomNextRange(&lightRandom, 0, M_PI*2);
+            speed = AAPLRandomNextRange(&lightRandom, 0.006,0.027);
+            speed *= AAPLRandomNextBelow(&lightRandom, 2)*2.0f-1;
         }
         else if(lightId < AAPLColumnLights)
         {
-            distance = random_float(365,380);
-            height = random_float(150,190);
-            angle = random_float(0, M_PI*2);
-            speed = random_float(0.004,0.014);
-            speed *= (rand()%2)*2-1;
+            distance = AAPLRandomNextRange(&lightRandom, 365,380);
+            height = AAPLRandomNextRange(&lightRandom, 150,190);
+            angle = AAPLRandomNextRange(&lightRandom, 0, M_PI*2);
+            speed = AAPLRandomNextRange(&lightRandom, 0.004,0.014);
+            speed *= AAPLRandomNextBelow(&lightRandom, 2)*2.0f-1;
         }
 
         speed *= .5;
-        *light_position = (vector_float4){ distance*sinf(angle),height,distance*cosf(angle),1};
-        light_data->light_radius = random_float(25,35)/10.0;
-        light_data->light_speed  = speed;
+        for(uint32_t group = 0; group < 3; group++)
+        {
+            AAPLLightGroup *lightGroup = &lightGroups[group];
+            if(lightId - lightGroup->first < lightGroup->count)
+            {
+                AAPLLightGroupSetLight(lightGroup, (uint32_t)(lightId - lightGroup->first),
+                                       distance*sinf(angle), height, distance*cosf(angle), speed);
+            }
+        }
+        light_data[lightId].light_radius = AAPLRandomNextRange(&lightRandom, 25,35)/10.0;
+        light_data[lightId].light_speed  = speed;
 
-        int colorId = rand()%3;
+        uint32_t colorId = AAPLRandomNextBelow(&lightRandom, 3);
+        vector_float3 color;
         if( colorId == 0) {
-            light_data->light_color = (vector_float3){random_float(4,6),random_float(0,4),random_float(0,4)};
+            color.x = AAPLRandomNextRange(&lightRandom, 4,6);
+            color.y = AAPLRandomNextRange(&lightRandom, 0,4);
+            color.z = AAPLRandomNextRange(&lightRandom, 0,4);
         } else if ( colorId == 1) {
-            light_data->light_color = (vector_float3){random_float(0,4),random_float(4,6),random_float(0,4)};
+            color.x = AAPLRandomNextRange(&lightRandom, 0,4);
+            color.y = AAPLRandomNextRange(&lightRandom, 4,6);
+            color.z = AAPLRandomNextRange(&lightRandom, 0,4);
         } else {
-            light_data->light_color = (vector_float3){random_float(0,4),random_float(0,4),random_float(4,6)};
+            color.x = AAPLRandomNextRange(&lightRandom, 0,4);
+            color.y = AAPLRandomNextRange(&lightRandom, 0,4);
+            color.z = AAPLRandomNextRange(&lightRandom, 4,6);
         }
-
-        light_data++;
-        light_position++;
-    }
+        light_data[lightId].light_color = color;
+    });
 }
 
 /// Update light positions
 - (void)updateLights:(matrix_float4x4)modelViewMatrix
 {
-    AAPLPointLight *lightData = (AAPLPointLight*)((char*)[_lightsData contents]);
-
-    vector_float4 *currentBuffer =
-        (vector_float4*) _lightPositions[_currentBufferIndex].contents;
+    float *currentBuffer = (float*) _lightPositions[_currentBufferIndex].contents;
 
-    vector_float4 *originalLightPositions =  (vector_float4 *)_originalLightPositions.bytes;
+    const AAPLLightGroup *lightGroups = _lightGroups;
+    const uint64_t frameNumber = _frameNumber;
 
-    for(int i = 0; i < AAPLNumLights; i++)
+    for(uint32_t group = 0; group < 3; group++)
     {
-        vector_float4 currentPosition;
+        const AAPLLightGroup *lightGroup = &lightGroups[group];
+        const uint32_t chunkCount = (lightGroup->count + AAPLLightAnimationChunkSize - 1) / AAPLLightAnimationChunkSize;
 
-        if(i < AAPLTreeLights)
+        if(chunkCount <= 1)
         {
-            double lightPeriod = lightData[i].light_speed  * _frameNumber;
-            lightPeriod += originalLightPositions[i].y;
-            lightPeriod -= floor(lightPeriod);  // Get fractional part
-
-            // Use pow to slowly move the light outward as it reaches the branches of the tree
-            float r = 1.2 + 10.0 * powf(lightPeriod, 5.0);
-
-            currentPosition.x = originalLightPositions[i].x * r;
-            currentPosition.y = 200.0f + lightPeriod * 400.0f;
-            currentPosition.z = originalLightPositions[i].z * r;
-            currentPosition.w = 1;
-        }
-        else
-        {
-            float rotationRadians = lightData[i].light_speed * _frameNumber;
-            matrix_float4x4 rotation = matrix4x4_rotation(rotationRadians, 0, 1, 0);
-            currentPosition = matrix_multiply(rotation, originalLightPositions[i]);
+            AAPLLightGroupAnimate(lightGroup, 0, lightGroup->count, frameNumber,
+                                  (const float*)&modelViewMatrix, currentBuffer);
+            continue;
         }
 
-        currentPosition = matrix_multiply(modelViewMatrix, currentPosition);
-        currentBuffer[i] = currentPosition;
+        dispatch_apply(chunkCount, dispatch_get_global_queue(QOS_CLASS_USER_INTERACTIVE, 0), ^(size_t chunk)
+        {
+            const uint32_t begin = (uint32_t)chunk * AAPLLightAnimationChunkSize;
+            const uint32_t end = MIN(begin + AAPLLightAnimationChunkSize, lightGroup->count);
+            AAPLLightGroupAnimate(lightGroup, begin, end, frameNumber, (const float*)&modelViewMatrix, currentBuffer);
+        });
     }
 }
 
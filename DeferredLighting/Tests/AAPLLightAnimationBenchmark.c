@@ -0,0 +1,301 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the light animation against the per-light loop updateLights ran before it.
+ Lights are generated like populateLights does, split into tree, ground and column lights, for several light
+ counts. Reports the lights animated per millisecond by AAPLLightGroupAnimate and by the old loop, which
+ built a rotation matrix per orbiting light and called powf per tree light. Fails when a position differs
+ from a double precision reference by more than the rounding of the old loop allows, or from the old loop
+ by more than its own float error at that frame.
+ Usage: AAPLLightAnimationBenchmark [frames per measurement]
+*/
+
+#include "AAPLLightAnimation.h"
+#include "AAPLRandom.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const float AAPLTwoPi = 6.28318530717958647692f;
+
+/// The seed populateLights draws the lights from
+static const uint64_t AAPLLightSeed = 0x134e5348;
+
+/// The lights of the scene, as populateLights leaves them for updateLights
+typedef struct AAPLSceneLights
+{
+    uint32_t count;
+    uint32_t treeLights;
+    uint32_t groundLights;
+    float *original;            // x, y, z, 1 per light, the _originalLightPositions of the old loop
+    float *speed;               // light_speed
+    AAPLLightGroup groups[3];
+} AAPLSceneLights;
+
+static double secondsNow(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/// populateLights of AAPLRenderer.m with `count` lights
+static bool makeLights(AAPLSceneLights *lights, uint32_t count)
+{
+    memset(lights, 0, sizeof(*lights));
+    lights->count = count;
+    lights->treeLights = (uint32_t)(0.30 * count);
+    lights->groundLights = lights->treeLights + (uint32_t)(0.40 * count);
+    const uint32_t columnLights = lights->groundLights + (uint32_t)(0.30 * count);
+    lights->original = calloc(4 * (size_t)count, sizeof(float));
+    lights->speed = calloc(count, sizeof(float));
+
+    bool allocated = lights->original && lights->speed;
+    allocated &= AAPLLightGroupInit(&lights->groups[0], AAPLLightMotionRise, 0, lights->treeLights);
+    allocated &= AAPLLightGroupInit(&lights->groups[1], AAPLLightMotionOrbit, lights->treeLights,
+                                    lights->groundLights - lights->treeLights);
+    allocated &= AAPLLightGroupInit(&lights->groups[2], AAPLLightMotionOrbit, lights->groundLights,
+                                    count - lights->groundLights);
+    if(!allocated)
+        return false;
+
+    for(uint32_t lightId = 0; lightId < count; lightId++)
+    {
+        AAPLRandomStream lightRandom;
+        AAPLRandomStreamInit(&lightRandom, AAPLLightSeed, lightId);
+
+        float distance = 0, height = 0, angle = 0, speed = 0;
+        if(lightId < lights->treeLights)
+        {
+            distance = AAPLRandomNextRange(&lightRandom, 38, 42);
+            height = AAPLRandomNextRange(&lightRandom, 0, 1);
+            angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+            speed = AAPLRandomNextRange(&lightRandom, 0.003f, 0.014f);
+        }
+        else if(lightId < lights->groundLights)
+        {
+            distance = AAPLRandomNextRange(&lightRandom, 140, 260);
+            height = AAPLRandomNextRange(&lightRandom, 140, 150);
+            angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+            speed = AAPLRandomNextRange(&lightRandom, 0.006f, 0.027f);
+            speed *= AAPLRandomNextBelow(&lightRandom, 2) * 2.0f - 1;
+        }
+        else if(lightId < columnLights)
+        {
+            distance = AAPLRandomNextRange(&lightRandom, 365, 380);
+            height = AAPLRandomNextRange(&lightRandom, 150, 190);
+            angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+            speed = AAPLRandomNextRange(&lightRandom, 0.004f, 0.014f);
+            speed *= AAPLRandomNextBelow(&lightRandom, 2) * 2.0f - 1;
+        }
+        speed *= .5f;
+
+        const float x = distance * sinf(angle), z = distance * cosf(angle);
+        for(uint32_t group = 0; group < 3; group++)
+        {
+            AAPLLightGroup *lightGroup = &lights->groups[group];
+            if(lightId - lightGroup->first < lightGroup->count)
+                AAPLLightGroupSetLight(lightGroup, lightId - lightGroup->first, x, height, z, speed);
+        }
+        float *original = lights->original + 4 * (size_t)lightId;
+        original[0] = x;
+        original[1] = height;
+        original[2] = z;
+        original[3] = 1;
+        lights->speed[lightId] = speed;
+    }
+    return true;
+}
+
+static void destroyLights(AAPLSceneLights *lights)
+{
+    for(uint32_t group = 0; group < 3; group++)
+        AAPLLightGroupDestroy(&lights->groups[group]);
+    free(lights->original);
+    free(lights->speed);
+}
+
+static void animateGroups(const AAPLSceneLights *lights, uint64_t frame, const float modelView[16], float *positions)
+{
+    for(uint32_t group = 0; group < 3; group++)
+        AAPLLightGroupAnimate(&lights->groups[group], 0, lights->groups[group].count, frame, modelView, positions);
+}
+
+/// updateLights of AAPLRenderer.m before the light groups, with matrix4x4_rotation around y written out
+static void animateOld(const AAPLSceneLights *lights, uint64_t frameNumber, const float m[16], float *positions)
+{
+    for(uint32_t i = 0; i < lights->count; i++)
+    {
+        const float *original = lights->original + 4 * (size_t)i;
+        float p[4];
+
+        if(i < lights->treeLights)
+        {
+            double lightPeriod = lights->speed[i] * frameNumber;
+            lightPeriod += original[1];
+            lightPeriod -= floor(lightPeriod);  // Get fractional part
+
+            // Use pow to slowly move the light outward as it reaches the branches of the tree
+            float r = 1.2 + 10.0 * powf(lightPeriod, 5.0);
+
+            p[0] = original[0] * r;
+            p[1] = 200.0f + lightPeriod * 400.0f;
+            p[2] = original[2] * r;
+            p[3] = 1;
+        }
+        else
+        {
+            float rotationRadians = lights->speed[i] * frameNumber;
+            const float ct = cosf(rotationRadians), st = sinf(rotationRadians);
+            p[0] = ct * original[0] + st * original[2];
+            p[1] = original[1];
+            p[2] = -st * original[0] + ct * original[2];
+            p[3] = original[3];
+        }
+
+        for(int row = 0; row < 4; row++)
+            positions[4 * i + row] = m[row] * p[0] + m[4 + row] * p[1] + m[8 + row] * p[2] + m[12 + row] * p[3];
+    }
+}
+
+/// Position of tree light `i` in its cycle at `frameNumber`, in double precision
+static double treePhase(const AAPLSceneLights *lights, uint32_t i, uint64_t frameNumber)
+{
+    const double t = (double)lights->speed[i] * frameNumber + lights->original[4 * (size_t)i + 1];
+    return t - floor(t);
+}
+
+/// The motion of the lights in double precision
+static void animateReference(const AAPLSceneLights *lights, uint64_t frameNumber, const float m[16], double *positions)
+{
+    for(uint32_t i = 0; i < lights->count; i++)
+    {
+        const float *original = lights->original + 4 * (size_t)i;
+        double p[3];
+        if(i < lights->treeLights)
+        {
+            const double t = treePhase(lights, i, frameNumber);
+            const double r = 1.2 + 10.0 * pow(t, 5.0);
+            p[0] = original[0] * r;
+            p[1] = 200.0 + t * 400.0;
+            p[2] = original[2] * r;
+        }
+        else
+        {
+            const double angle = (double)lights->speed[i] * frameNumber;
+            p[0] = cos(angle) * original[0] + sin(angle) * original[2];
+            p[1] = original[1];
+            p[2] = -sin(angle) * original[0] + cos(angle) * original[2];
+        }
+        for(int row = 0; row < 4; row++)
+            positions[4 * i + row] = (double)m[row] * p[0] + (double)m[4 + row] * p[1] + (double)m[8 + row] * p[2] + m[12 + row];
+    }
+}
+
+/// Returns the failures at `frame`: positions further from the reference than `tolerance`, or from the old loop
+///   than the old loop is from the reference
+static int checkFrame(const AAPLSceneLights *lights, uint64_t frame, const float modelView[16], float *positions,
+                      float *oldPositions, double *reference, double *outError, double *outOldError)
+{
+    animateGroups(lights, frame, modelView, positions);
+    animateOld(lights, frame, modelView, oldPositions);
+    animateReference(lights, frame, modelView, reference);
+
+    // Rates in units of 2^-32 of a cycle round the speeds by up to 2^-33 of a cycle per frame, which moves an
+    //  orbiting light 380 units out by ~2.8e-7 units per frame, on top of the float rounding of the positions
+    const double tolerance = 2e-3 + 3e-7 * (double)frame;
+    const double phaseTolerance = 2.5e-10 * (double)frame + 1e-6;
+    int failures = 0;
+    double error = 0, oldError = 0;
+    for(uint32_t i = 0; i < 4 * lights->count; i++)
+    {
+        // A tree light this close to the top of its cycle may already be back at the bottom after rounding
+        if(i / 4 < lights->treeLights)
+        {
+            const double t = treePhase(lights, i / 4, frame);
+            if(t < phaseTolerance || t > 1 - phaseTolerance)
+                continue;
+        }
+
+        const double e = fabs(positions[i] - reference[i]);
+        const double oldE = fabs(oldPositions[i] - reference[i]);
+        error = fmax(error, e);
+        oldError = fmax(oldError, oldE);
+        if(e > tolerance || fabs(positions[i] - oldPositions[i]) > tolerance + oldE)
+        {
+            if(failures++ == 0)
+                fprintf(stderr, "%u lights, frame %llu: light %u component %u is %f, the old loop gives %f, the reference %f\n",
+                        lights->count, (unsigned long long)frame, i / 4, i % 4, positions[i], oldPositions[i], reference[i]);
+        }
+    }
+    *outError = fmax(*outError, error);
+    *outOldError = fmax(*outOldError, oldError);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t frameCount = argc > 1 && atoi(argv[1]) > 0 ? (uint32_t)atoi(argv[1]) : 200;
+
+    // The sample's camera: looking at the temple from its orbit, column major like matrix_float4x4
+    const float modelView[16] =
+    {
+        0.8660254f, 0.1227878f, -0.4847273f, 0,
+        0,          0.9693280f,  0.2455476f, 0,
+        0.5f,      -0.2126746f,  0.8395735f, 0,
+        0,         -40.0f,      -1000.0f,    1,
+    };
+
+    const uint32_t lightCounts[] = { 256, 5120, 102400 };
+    const uint64_t checkedFrames[] = { 0, 1, 2, 59, 1000, 65536, 123456 };
+
+    printf("%10s %14s %14s %10s %12s %12s\n", "lights", "lights/ms", "lights/ms", "speedup", "max error", "max error");
+    printf("%10s %14s %14s %10s %12s %12s\n", "", "(groups)", "(old loop)", "", "(groups)", "(old loop)");
+
+    int failures = 0;
+    for(size_t c = 0; c < sizeof(lightCounts) / sizeof(lightCounts[0]); c++)
+    {
+        const uint32_t count = lightCounts[c];
+        AAPLSceneLights lights;
+        if(!makeLights(&lights, count))
+        {
+            fprintf(stderr, "Could not allocate %u lights\n", count);
+            return 1;
+        }
+        float *positions = malloc(4 * sizeof(float) * count);
+        float *oldPositions = malloc(4 * sizeof(float) * count);
+        double *reference = malloc(4 * sizeof(double) * count);
+
+        double error = 0, oldError = 0;
+        for(size_t f = 0; f < sizeof(checkedFrames) / sizeof(checkedFrames[0]); f++)
+            failures += checkFrame(&lights, checkedFrames[f], modelView, positions, oldPositions, reference, &error, &oldError);
+
+        // Frames of the measurement, more of them for fewer lights
+        const uint32_t repetitions = frameCount * (102400 / count > 0 ? 102400 / count : 1) / 4 + 1;
+        double start = secondsNow();
+        for(uint32_t frame = 0; frame < repetitions; frame++)
+            animateGroups(&lights, frame, modelView, positions);
+        const double groupSeconds = secondsNow() - start;
+
+        start = secondsNow();
+        for(uint32_t frame = 0; frame < repetitions; frame++)
+            animateOld(&lights, frame, modelView, oldPositions);
+        const double oldSeconds = secondsNow() - start;
+
+        const double animated = (double)count * repetitions;
+        printf("%10u %14.0f %14.0f %9.2fx %12.2e %12.2e\n", count, animated / (groupSeconds * 1e3), animated / (oldSeconds * 1e3),
+               oldSeconds / groupSeconds, error, oldError);
+
+        free(positions);
+        free(oldPositions);
+        free(reference);
+        destroyLights(&lights);
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the occlusion buffer on the temple the sample draws.
+ The temple is rendered into the occlusion buffer from `frames` points of the sample's camera orbit, on one
+ thread and on `threads` threads with AAPLOcclusionBufferRender. Clusters of 64 of its triangles stand in for
+ culled objects. Reports the triangles binned and rasterized per second, and the fraction of clusters culled
+ outside the view and behind the occluders. Fails if the threads produce another depth than a single thread.
+ Usage: AAPLOcclusionBufferBenchmark [frames] [threads]
+*/
+
+#include "AAPLOcclusionBuffer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// Triangles per test cluster
+static const uint32_t AAPLClusterTriangleCount = 64;
+
+/// Renders per measurement
+static const int AAPLRepetitions = 10;
+
+typedef struct AAPLBenchmarkMesh
+{
+    float *positions;
+    uint32_t vertexCount;
+    uint32_t *indices;
+    uint32_t triangleCount;
+} AAPLBenchmarkMesh;
+
+/// Row major 4x4 matrix
+typedef struct AAPLMatrix
+{
+    float m[4][4];
+} AAPLMatrix;
+
+static double secondsNow(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static bool growArray(void **array, uint32_t *capacity, uint32_t count, size_t elementSize)
+{
+    if(count <= *capacity)
+        return true;
+    uint32_t newCapacity = *capacity ? *capacity * 2 : 1024;
+    newCapacity = newCapacity < count ? count : newCapacity;
+    void *grown = realloc(*array, newCapacity * elementSize);
+    if(!grown)
+        return false;
+    *array = grown;
+    *capacity = newCapacity;
+    return true;
+}
+
+/// Reads the positions and faces of an OBJ file; polygons are split into fans of triangles
+static bool loadMesh(const char *path, AAPLBenchmarkMesh *mesh)
+{
+    memset(mesh, 0, sizeof(*mesh));
+    FILE *file = fopen(path, "r");
+    if(!file)
+        return false;
+
+    uint32_t positionCapacity = 0, indexCapacity = 0;
+    bool success = true;
+    char line[512];
+    while(success && fgets(line, sizeof(line), file))
+    {
+        if(line[0] == 'v' && line[1] == ' ')
+        {
+            success = growArray((void **)&mesh->positions, &positionCapacity, 3 * (mesh->vertexCount + 1), sizeof(float));
+            float *p = success ? mesh->positions + 3 * mesh->vertexCount : NULL;
+            success = success && sscanf(line + 2, "%f %f %f", &p[0], &p[1], &p[2]) == 3;
+            mesh->vertexCount++;
+        }
+        else if(line[0] == 'f' && line[1] == ' ')
+        {
+            // Only the position index of every v/vt/vn corner is read
+            uint32_t corners[16];
+            uint32_t cornerCount = 0;
+            const char *cursor = line + 2;
+            int index, length;
+            while(cornerCount < 16 && sscanf(cursor, " %d%n", &index, &length) == 1)
+            {
+                corners[cornerCount++] = (uint32_t)(index - 1);
+                cursor += length;
+                while(*cursor && *cursor != ' ' && *cursor != '\n')
+                    cursor++;
+            }
+            for(uint32_t corner = 2; success && corner < cornerCount; corner++)
+            {
+                success = growArray((void **)&mesh->indices, &indexCapacity, 3 * (mesh->triangleCount + 1), sizeof(uint32_t));
+                if(success)
+                {
+                    uint32_t *triangle = mesh->indices + 3 * mesh->triangleCount++;
+                    triangle[0] = corners[0];
+                    triangle[1] = corners[corner - 1];
+                    triangle[2] = corners[corner];
+                }
+            }
+        }
+    }
+    fclose(file);
+    return success && mesh->triangleCount > 0;
+}
+
+static AAPLMatrix multiply(AAPLMatrix a, AAPLMatrix b)
+{
+    AAPLMatrix result;
+    for(int row = 0; row < 4; row++)
+    for(int column = 0; column < 4; column++)
+    {
+        result.m[row][column] = 0;
+        for(int k = 0; k < 4; k++)
+            result.m[row][column] += a.m[row][k] * b.m[k][column];
+    }
+    return result;
+}
+
+static void normalize(float v[3])
+{
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+}
+
+static void cross(const float a[3], const float b[3], float result[3])
+{
+    result[0] = a[1] * b[2] - a[2] * b[1];
+    result[1] = a[2] * b[0] - a[0] * b[2];
+    result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/// Same as matrix_look_at_left_hand with an up vector of (0, 1, 0)
+static AAPLMatrix lookAt(const float eye[3], const float target[3])
+{
+    float z[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    normalize(z);
+    const float up[3] = { 0, 1, 0 };
+    float x[3], y[3];
+    cross(up, z, x);
+    normalize(x);
+    cross(z, x, y);
+    AAPLMatrix result =
+    {{
+        { x[0], x[1], x[2], -(x[0] * eye[0] + x[1] * eye[1] + x[2] * eye[2]) },
+        { y[0], y[1], y[2], -(y[0] * eye[0] + y[1] * eye[1] + y[2] * eye[2]) },
+        { z[0], z[1], z[2], -(z[0] * eye[0] + z[1] * eye[1] + z[2] * eye[2]) },
+        { 0, 0, 0, 1 }
+    }};
+    return result;
+}
+
+static AAPLMatrix rotationY(float radians)
+{
+    const float c = cosf(radians), s = sinf(radians);
+    AAPLMatrix result = {{ { c, 0, s, 0 }, { 0, 1, 0, 0 }, { -s, 0, c, 0 }, { 0, 0, 0, 1 } }};
+    return result;
+}
+
+/// Same as matrix_perspective_left_hand
+static AAPLMatrix perspective(float fovyRadians, float aspect, float nearZ, float farZ)
+{
+    const float ys = 1 / tanf(fovyRadians * 0.5f);
+    const float xs = ys / aspect;
+    const float zs = farZ / (farZ - nearZ);
+    AAPLMatrix result = {{ { xs, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, -nearZ * zs }, { 0, 0, 1, 0 } }};
+    return result;
+}
+
+/// The temple's model-view-projection at a frame of the sample's camera orbit, column major
+static void templeModelViewProjection(uint32_t frame, float aspect, float result[16])
+{
+    const float eye[3] = { 0, 18, -50 };
+    const float target[3] = { 0, 5, 0 };
+    const AAPLMatrix model = {{ { 0.1f, 0, 0, 0 }, { 0, 0.1f, 0, -10 }, { 0, 0, 0.1f, 0 }, { 0, 0, 0, 1 } }};
+    const AAPLMatrix view = multiply(lookAt(eye, target), rotationY(frame * 0.0025f + (float)M_PI));
+    const AAPLMatrix projection = perspective(65.0f * (float)(M_PI / 180.0), aspect, 1, 150);
+    const AAPLMatrix modelViewProjection = multiply(projection, multiply(view, model));
+    for(int column = 0; column < 4; column++)
+    for(int row = 0; row < 4; row++)
+        result[column * 4 + row] = modelViewProjection.m[row][column];
+}
+
+/// Average seconds of an AAPLOcclusionBufferRender call
+static double timeRender(AAPLOcclusionBuffer *buffer, const float modelViewProjection[16],
+                         const AAPLBenchmarkMesh *mesh, uint32_t threadCount, bool *success)
+{
+    *success = AAPLOcclusionBufferRender(buffer, modelViewProjection, mesh->positions, 3 * sizeof(float),
+                                         mesh->indices, mesh->triangleCount, threadCount);
+    const double start = secondsNow();
+    for(int repetition = 0; repetition < AAPLRepetitions; repetition++)
+    {
+        AAPLOcclusionBufferRender(buffer, modelViewProjection, mesh->positions, 3 * sizeof(float),
+                                  mesh->indices, mesh->triangleCount, threadCount);
+    }
+    return (secondsNow() - start) / AAPLRepetitions;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t frameCount = argc > 1 && atoi(argv[1]) > 0 ? (uint32_t)atoi(argv[1]) : 16;
+    const uint32_t threadCount = argc > 2 && atoi(argv[2]) > 0 ? (uint32_t)atoi(argv[2]) : 4;
+
+    AAPLBenchmarkMesh mesh;
+    if(!loadMesh(AAPL_TEMPLE_MESH_PATH, &mesh))
+    {
+        fprintf(stderr, "Could not load %s\n", AAPL_TEMPLE_MESH_PATH);
+        return 1;
+    }
+
+    // Bounding boxes of the clusters
+    const uint32_t clusterCount = (mesh.triangleCount + AAPLClusterTriangleCount - 1) / AAPLClusterTriangleCount;
+    float *boxes = malloc(6 * sizeof(float) * clusterCount);
+    for(uint32_t cluster = 0; cluster < clusterCount; cluster++)
+    {
+        float *boxMin = boxes + 6 * cluster, *boxMax = boxMin + 3;
+        boxMin[0] = boxMin[1] = boxMin[2] = INFINITY;
+        boxMax[0] = boxMax[1] = boxMax[2] = -INFINITY;
+        const uint32_t end = (cluster + 1) * AAPLClusterTriangleCount;
+        for(uint32_t index = 3 * cluster * AAPLClusterTriangleCount; index < 3 * end && index < 3 * mesh.triangleCount; index++)
+        {
+            const float *p = mesh.positions + 3 * mesh.indices[index];
+            for(int axis = 0; axis < 3; axis++)
+            {
+                boxMin[axis] = fminf(boxMin[axis], p[axis]);
+                boxMax[axis] = fmaxf(boxMax[axis], p[axis]);
+            }
+        }
+    }
+
+    AAPLOcclusionBuffer serial, threaded, empty;
+    if(!AAPLOcclusionBufferInit(&serial, AAPLOcclusionBufferWidth, AAPLOcclusionBufferHeight, 1) ||
+       !AAPLOcclusionBufferInit(&threaded, AAPLOcclusionBufferWidth, AAPLOcclusionBufferHeight, threadCount) ||
+       !AAPLOcclusionBufferInit(&empty, AAPLOcclusionBufferWidth, AAPLOcclusionBufferHeight, 1))
+    {
+        fprintf(stderr, "Could not allocate the occlusion buffers\n");
+        return 1;
+    }
+
+    printf("Temple: %u vertices, %u triangles, %u clusters of %u triangles\n",
+           mesh.vertexCount, mesh.triangleCount, clusterCount, AAPLClusterTriangleCount);
+    printf("%8s %12s %12s %10s %10s\n", "frame", "Mtris/s", "Mtris/s", "culled", "culled");
+    printf("%8s %12s %12s %10s %10s\n", "", "(1 thread)", "(threads)", "(view)", "(occluded)");
+
+    const float aspect = (float)AAPLOcclusionBufferWidth / AAPLOcclusionBufferHeight;
+    const size_t depthSize = (size_t)AAPLOcclusionBufferWidth * AAPLOcclusionBufferHeight * sizeof(float);
+    const uint32_t orbitFrameCount = (uint32_t)(2 * M_PI / 0.0025);
+    double serialSeconds = 0, threadedSeconds = 0;
+    uint64_t viewCulled = 0, occlusionCulled = 0;
+    int failures = 0;
+
+    for(uint32_t frameIndex = 0; frameIndex < frameCount; frameIndex++)
+    {
+        const uint32_t frame = frameIndex * orbitFrameCount / frameCount;
+        float modelViewProjection[16];
+        templeModelViewProjection(frame, aspect, modelViewProjection);
+
+        bool serialSuccess, threadedSuccess;
+        const double serialTime = timeRender(&serial, modelViewProjection, &mesh, 1, &serialSuccess);
+        const double threadedTime = timeRender(&threaded, modelViewProjection, &mesh, threadCount, &threadedSuccess);
+        serialSeconds += serialTime;
+        threadedSeconds += threadedTime;
+
+        if(!serialSuccess || !threadedSuccess)
+        {
+            fprintf(stderr, "frame %u: binning failed\n", frame);
+            failures++;
+        }
+
+        // Triangles binned by other threads land in the bins in another order, but the nearest depth wins
+        if(memcmp(serial.depth, threaded.depth, depthSize) != 0 ||
+           memcmp(serial.blockMaxDepth, threaded.blockMaxDepth,
+                  serial.blockCountX * serial.blockCountY * sizeof(float)) != 0)
+        {
+            fprintf(stderr, "frame %u: %u threads produce another depth than 1 thread\n", frame, threadCount);
+            failures++;
+        }
+
+        // A buffer without occluders only culls outside of the view
+        AAPLOcclusionBufferRender(&empty, modelViewProjection, mesh.positions, 3 * sizeof(float), mesh.indices, 0, 1);
+        uint32_t frameViewCulled = 0, frameOcclusionCulled = 0;
+        for(uint32_t cluster = 0; cluster < clusterCount; cluster++)
+        {
+            const float *boxMin = boxes + 6 * cluster, *boxMax = boxMin + 3;
+            if(!AAPLOcclusionBufferTestBox(&empty, modelViewProjection, boxMin, boxMax))
+                frameViewCulled++;
+            else if(!AAPLOcclusionBufferTestBox(&threaded, modelViewProjection, boxMin, boxMax))
+                frameOcclusionCulled++;
+        }
+        viewCulled += frameViewCulled;
+        occlusionCulled += frameOcclusionCulled;
+
+        printf("%8u %12.2f %12.2f %9.1f%% %9.1f%%\n", frame,
+               mesh.triangleCount / serialTime * 1e-6, mesh.triangleCount / threadedTime * 1e-6,
+               100.0 * frameViewCulled / clusterCount, 100.0 * frameOcclusionCulled / clusterCount);
+    }
+
+    const double testedClusters = (double)clusterCount * frameCount;
+    printf("%8s %12.2f %12.2f %9.1f%% %9.1f%%\n", "all",
+           mesh.triangleCount * frameCount / serialSeconds * 1e-6,
+           mesh.triangleCount * frameCount / threadedSeconds * 1e-6,
+           100.0 * viewCulled / testedClusters, 100.0 * occlusionCulled / testedClusters);
+    printf("%u threads, %u frames, %d failures\n", threadCount, frameCount, failures);
+
+    AAPLOcclusionBufferDestroy(&serial);
+    AAPLOcclusionBufferDestroy(&threaded);
+    AAPLOcclusionBufferDestroy(&empty);
+    free(boxes);
+    free(mesh.positions);
+    free(mesh.indices);
+    return failures == 0 ? 0 : 1;
+}
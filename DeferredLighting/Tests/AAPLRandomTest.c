@@ -0,0 +1,305 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the Philox4x32-10 generator of AAPLRandom.
+ Checks the Random123 known-answer vectors, that the batch fills return the values of a stream one at a time
+ from any position, and that the streams of a seed are independent: no block of their first values repeats
+ and the values of neighboring streams are uncorrelated. Then generates the lights of the sample the way
+ populateLights does, each from its own stream, in order on one thread and in other orders on several
+ threads, and fails when any light differs or depends on the lights generated before it.
+ Usage: AAPLRandomTest [lights] [threads]
+*/
+
+#include "AAPLRandom.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const float AAPLTwoPi = 6.28318530717958647692f;
+
+/// The seed populateLights draws the lights from
+static const uint64_t AAPLLightSeed = 0x134e5348;
+
+/// Philox4x32-10 outputs from kat_vectors of Random123
+typedef struct AAPLKnownAnswer
+{
+    uint32_t counter[4];
+    uint32_t key[2];
+    uint32_t values[4];
+} AAPLKnownAnswer;
+
+static const AAPLKnownAnswer AAPLKnownAnswers[] =
+{
+    { { 0x00000000, 0x00000000, 0x00000000, 0x00000000 }, { 0x00000000, 0x00000000 },
+      { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+    { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff },
+      { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+    { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 },
+      { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+};
+
+/// The values populateLights draws for a light
+typedef struct AAPLTestLight
+{
+    float distance;
+    float height;
+    float angle;
+    float speed;
+    float radius;
+    float color[3];
+} AAPLTestLight;
+
+/// populateLights of AAPLRenderer.m for light `lightId` of `lightCount`, with its split into tree, ground and
+///   column lights
+static void generateLight(uint32_t lightId, uint32_t lightCount, AAPLTestLight *light)
+{
+    const uint32_t treeLights = (uint32_t)(0.30 * lightCount);
+    const uint32_t groundLights = treeLights + (uint32_t)(0.40 * lightCount);
+    const uint32_t columnLights = groundLights + (uint32_t)(0.30 * lightCount);
+
+    AAPLRandomStream lightRandom;
+    AAPLRandomStreamInit(&lightRandom, AAPLLightSeed, lightId);
+    memset(light, 0, sizeof(*light));
+
+    if(lightId < treeLights)
+    {
+        light->distance = AAPLRandomNextRange(&lightRandom, 38, 42);
+        light->height = AAPLRandomNextRange(&lightRandom, 0, 1);
+        light->angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+        light->speed = AAPLRandomNextRange(&lightRandom, 0.003f, 0.014f);
+    }
+    else if(lightId < groundLights)
+    {
+        light->distance = AAPLRandomNextRange(&lightRandom, 140, 260);
+        light->height = AAPLRandomNextRange(&lightRandom, 140, 150);
+        light->angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+        light->speed = AAPLRandomNextRange(&lightRandom, 0.006f, 0.027f);
+        light->speed *= AAPLRandomNextBelow(&lightRandom, 2) * 2.0f - 1;
+    }
+    else if(lightId < columnLights)
+    {
+        light->distance = AAPLRandomNextRange(&lightRandom, 365, 380);
+        light->height = AAPLRandomNextRange(&lightRandom, 150, 190);
+        light->angle = AAPLRandomNextRange(&lightRandom, 0, AAPLTwoPi);
+        light->speed = AAPLRandomNextRange(&lightRandom, 0.004f, 0.014f);
+        light->speed *= AAPLRandomNextBelow(&lightRandom, 2) * 2.0f - 1;
+    }
+    light->speed *= .5f;
+    light->radius = AAPLRandomNextRange(&lightRandom, 25, 35) / 10.0f;
+
+    const uint32_t colorId = AAPLRandomNextBelow(&lightRandom, 3);
+    for(uint32_t channel = 0; channel < 3; channel++)
+        light->color[channel] = channel == colorId ? AAPLRandomNextRange(&lightRandom, 4, 6) : AAPLRandomNextRange(&lightRandom, 0, 4);
+}
+
+typedef struct AAPLLightWorker
+{
+    AAPLTestLight *lights;
+    uint32_t lightCount;
+    uint32_t thread;
+    uint32_t threadCount;
+} AAPLLightWorker;
+
+/// Generates every threadCount-th light, from the last one down, like a dispatch_apply that runs the
+///   lights in another order
+static void *generateLights(void *argument)
+{
+    const AAPLLightWorker *worker = argument;
+    for(uint32_t i = worker->thread; i < worker->lightCount; i += worker->threadCount)
+    {
+        const uint32_t lightId = worker->lightCount - 1 - i;
+        generateLight(lightId, worker->lightCount, &worker->lights[lightId]);
+    }
+    return NULL;
+}
+
+static int testKnownAnswers(void)
+{
+    int failures = 0;
+    for(size_t i = 0; i < sizeof(AAPLKnownAnswers) / sizeof(AAPLKnownAnswers[0]); i++)
+    {
+        const AAPLKnownAnswer *answer = &AAPLKnownAnswers[i];
+
+        // The key holds the seed; the counter holds the block in its low half and the stream in its high half
+        AAPLRandomStream stream;
+        AAPLRandomStreamInit(&stream, answer->key[0] | (uint64_t)answer->key[1] << 32,
+                             answer->counter[2] | (uint64_t)answer->counter[3] << 32);
+        stream.block = answer->counter[0] | (uint64_t)answer->counter[1] << 32;
+
+        for(int v = 0; v < 4; v++)
+        {
+            const uint32_t value = AAPLRandomNextUInt(&stream);
+            if(value != answer->values[v])
+            {
+                fprintf(stderr, "known answer %zu: value %d is %08x, expected %08x\n", i, v, value, answer->values[v]);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static int testFills(void)
+{
+    int failures = 0;
+    enum { valueCount = 300 };
+    uint32_t expected[valueCount + 40];
+    AAPLRandomStream stream;
+    AAPLRandomStreamInit(&stream, 0x5eed5eed5eedULL, 77);
+    for(int i = 0; i < valueCount + 40; i++)
+        expected[i] = AAPLRandomNextUInt(&stream);
+
+    // Every start within a block and across batches, and counts that end anywhere in a batch
+    for(uint32_t first = 0; first < 40; first++)
+    {
+        for(size_t count = 0; count <= valueCount; count += 1 + count / 8)
+        {
+            uint32_t values[valueCount];
+            float floats[valueCount];
+            AAPLRandomFillUInts(0x5eed5eed5eedULL, 77, first, values, count);
+            AAPLRandomFillFloats(0x5eed5eed5eedULL, 77, first, floats, count);
+            for(size_t i = 0; i < count; i++)
+            {
+                const float expectedFloat = (float)(expected[first + i] >> 8) * (1.0f / 16777216.0f);
+                if(values[i] != expected[first + i] || floats[i] != expectedFloat)
+                {
+                    fprintf(stderr, "fill of %zu values from %u: value %zu is %08x (%g), expected %08x (%g)\n", count,
+                            first, i, values[i], floats[i], expected[first + i], expectedFloat);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+static int compareBlocks(const void *a, const void *b)
+{
+    return memcmp(a, b, 4 * sizeof(uint32_t));
+}
+
+static int testStreams(uint32_t streamCount)
+{
+    int failures = 0;
+
+    // The first blocks of every stream; a repeated block would mean two streams overlap
+    enum { blocksPerStream = 16, correlationValues = 4096 };
+    uint32_t *blocks = malloc((size_t)streamCount * blocksPerStream * 4 * sizeof(uint32_t));
+    for(uint32_t s = 0; s < streamCount; s++)
+        AAPLRandomFillUInts(AAPLLightSeed, s, 0, blocks + (size_t)s * blocksPerStream * 4, blocksPerStream * 4);
+    qsort(blocks, (size_t)streamCount * blocksPerStream, 4 * sizeof(uint32_t), compareBlocks);
+    for(size_t i = 1; i < (size_t)streamCount * blocksPerStream; i++)
+    {
+        if(compareBlocks(blocks + 4 * (i - 1), blocks + 4 * i) == 0)
+        {
+            fprintf(stderr, "block %08x %08x %08x %08x repeats in the first blocks of %u streams\n",
+                    blocks[4 * i], blocks[4 * i + 1], blocks[4 * i + 2], blocks[4 * i + 3], streamCount);
+            failures++;
+        }
+    }
+    free(blocks);
+
+    // Neighboring streams: the correlation of n independent uniform values stays within 5 / sqrt(n)
+    float *a = malloc(correlationValues * sizeof(float));
+    float *b = malloc(correlationValues * sizeof(float));
+    double worst = 0;
+    for(uint32_t s = 0; s + 1 < streamCount; s++)
+    {
+        AAPLRandomFillFloats(AAPLLightSeed, s, 0, a, correlationValues);
+        AAPLRandomFillFloats(AAPLLightSeed, s + 1, 0, b, correlationValues);
+        double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+        for(int i = 0; i < correlationValues; i++)
+        {
+            sumA += a[i];
+            sumB += b[i];
+            sumAA += (double)a[i] * a[i];
+            sumBB += (double)b[i] * b[i];
+            sumAB += (double)a[i] * b[i];
+        }
+        const double n = correlationValues;
+        const double correlation = (sumAB - sumA * sumB / n) /
+                                   sqrt((sumAA - sumA * sumA / n) * (sumBB - sumB * sumB / n));
+        worst = fmax(worst, fabs(correlation));
+        if(fabs(correlation) > 5 / sqrt(n))
+        {
+            fprintf(stderr, "streams %u and %u: correlation %f\n", s, s + 1, correlation);
+            failures++;
+        }
+    }
+    printf("%u streams: no repeated block in the first %d of each, worst neighbor correlation %.4f (limit %.4f)\n",
+           streamCount, blocksPerStream, worst, 5 / sqrt((double)correlationValues));
+    free(a);
+    free(b);
+    return failures;
+}
+
+static int testLights(uint32_t lightCount, uint32_t threadCount)
+{
+    int failures = 0;
+    AAPLTestLight *serial = calloc(lightCount, sizeof(AAPLTestLight));
+    AAPLTestLight *threaded = calloc(lightCount, sizeof(AAPLTestLight));
+    for(uint32_t lightId = 0; lightId < lightCount; lightId++)
+        generateLight(lightId, lightCount, &serial[lightId]);
+
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    AAPLLightWorker *workers = malloc(threadCount * sizeof(AAPLLightWorker));
+    for(uint32_t t = 0; t < threadCount; t++)
+    {
+        workers[t] = (AAPLLightWorker){ threaded, lightCount, t, threadCount };
+        pthread_create(&threads[t], NULL, generateLights, &workers[t]);
+    }
+    for(uint32_t t = 0; t < threadCount; t++)
+        pthread_join(threads[t], NULL);
+
+    uint32_t differing = 0, repeated = 0;
+    for(uint32_t lightId = 0; lightId < lightCount; lightId++)
+    {
+        // Generated again on its own, after every other light
+        AAPLTestLight alone;
+        generateLight(lightId, lightCount, &alone);
+        if(memcmp(&serial[lightId], &threaded[lightId], sizeof(AAPLTestLight)) != 0 ||
+           memcmp(&serial[lightId], &alone, sizeof(AAPLTestLight)) != 0)
+        {
+            if(differing++ == 0)
+                fprintf(stderr, "%u lights: light %u differs between orders or threads\n", lightCount, lightId);
+            failures++;
+        }
+
+        // Independent streams give every light its own color
+        if(lightId > 0 && memcmp(serial[lightId].color, serial[lightId - 1].color, sizeof(serial[lightId].color)) == 0)
+            repeated++;
+    }
+    if(repeated > 0)
+    {
+        fprintf(stderr, "%u lights: %u lights repeat the color of the previous one\n", lightCount, repeated);
+        failures++;
+    }
+    printf("%u lights on %u threads: %u differ from the serial ones\n", lightCount, threadCount, differing);
+
+    free(workers);
+    free(threads);
+    free(serial);
+    free(threaded);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t lightCount = argc > 1 && atoi(argv[1]) > 0 ? (uint32_t)atoi(argv[1]) : 256;
+    const uint32_t threadCount = argc > 2 && atoi(argv[2]) > 0 ? (uint32_t)atoi(argv[2]) : 4;
+
+    int failures = 0;
+    failures += testKnownAnswers();
+    failures += testFills();
+    failures += testStreams(lightCount > 1024 ? lightCount : 1024);
+    failures += testLights(lightCount, threadCount);
+    failures += testLights(lightCount * 64, threadCount);
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
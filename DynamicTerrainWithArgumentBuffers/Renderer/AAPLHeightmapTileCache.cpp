@@ -0,0 +1,166 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLHeightmapTileCache.
+*/
+
+#include "AAPLHeightmapTileCache.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+uint32_t AAPLHeightmapTileCache::getSlotCountForBudget (const AAPLTiledHeightmapHeader& header, size_t budgetBytes)
+{
+    size_t slotCount = budgetBytes / (header.getTileTexelCount() * sizeof(uint16_t));
+    return (uint32_t) std::min (slotCount, (size_t) kNotResident);
+}
+
+AAPLHeightmapTileCache::AAPLHeightmapTileCache (const AAPLTiledHeightmap& inSource, uint32_t slotCount) :
+source (inSource),
+header (inSource.getHeader()),
+tileTexelCount (inSource.getHeader().getTileTexelCount()),
+texels ((size_t) slotCount * tileTexelCount),
+slots (slotCount),
+pageTable ((size_t) header.tilesX * header.tilesY, kNotResident),
+head (kNoSlot),
+tail (kNoSlot),
+updateIndex (0),
+residentCount (0),
+stats ()
+{
+    assert (slotCount <= kNotResident);
+
+    // Hand out the low slots first
+    freeSlots.reserve (slotCount);
+    for (uint32_t s = slotCount; s > 0; s--)
+    {
+        slots[s - 1] = { kNoSlot, kNoSlot, kNoSlot, 0 };
+        freeSlots.push_back (s - 1);
+    }
+}
+
+void AAPLHeightmapTileCache::unlink (uint32_t slot)
+{
+    Slot& s = slots[slot];
+    if (s.prev != kNoSlot)  slots[s.prev].next = s.next;
+    else                    head = s.next;
+    if (s.next != kNoSlot)  slots[s.next].prev = s.prev;
+    else                    tail = s.prev;
+    s.prev = s.next = kNoSlot;
+}
+
+void AAPLHeightmapTileCache::pushFront (uint32_t slot)
+{
+    Slot& s = slots[slot];
+    s.prev = kNoSlot;
+    s.next = head;
+    if (head != kNoSlot)
+        slots[head].prev = slot;
+    head = slot;
+    if (tail == kNoSlot)
+        tail = slot;
+}
+
+// Returns a free slot, evicting the least recently requested tile if there is none. Tiles requested by the
+//  current update are at the front of the list, so the tail only holds one when every slot is needed.
+uint32_t AAPLHeightmapTileCache::acquireSlot ()
+{
+    if (!freeSlots.empty())
+    {
+        uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    if (tail == kNoSlot || slots[tail].lastRequested == updateIndex)
+        return kNoSlot;
+
+    uint32_t slot = tail;
+    unlink (slot);
+    pageTable[slots[slot].tile] = kNotResident;
+    slots[slot].tile = kNoSlot;
+    residentCount--;
+    stats.evictions++;
+    return slot;
+}
+
+uint32_t AAPLHeightmapTileCache::update (float cameraX, float cameraZ, float radius, uint32_t maxLoads)
+{
+    updateIndex++;
+    loadedSlots.clear();
+
+    // Tiles whose bounds are within the radius, scanning only the tile rectangle around the camera
+    const float worldOriginX = -0.5f * header.tilesX * header.tileWorldSize;
+    const float worldOriginZ = -0.5f * header.tilesY * header.tileWorldSize;
+    const float localX = (cameraX - worldOriginX) / header.tileWorldSize;
+    const float localZ = (cameraZ - worldOriginZ) / header.tileWorldSize;
+    const float tileRadius = radius / header.tileWorldSize;
+
+    int64_t minX = std::max ((int64_t) floorf (localX - tileRadius), (int64_t) 0);
+    int64_t minZ = std::max ((int64_t) floorf (localZ - tileRadius), (int64_t) 0);
+    int64_t maxX = std::min ((int64_t) floorf (localX + tileRadius), (int64_t) header.tilesX - 1);
+    int64_t maxZ = std::min ((int64_t) floorf (localZ + tileRadius), (int64_t) header.tilesY - 1);
+
+    requested.clear();
+    for (int64_t z = minZ; z <= maxZ; z++)
+    for (int64_t x = minX; x <= maxX; x++)
+    {
+        float dx = std::max (std::max ((float) x - localX, localX - (float) (x + 1)), 0.0f);
+        float dz = std::max (std::max ((float) z - localZ, localZ - (float) (z + 1)), 0.0f);
+        float distance = sqrtf (dx * dx + dz * dz);
+        if (distance <= tileRadius)
+            requested.push_back (std::make_pair (distance, (uint32_t) (z * header.tilesX + x)));
+    }
+    std::sort (requested.begin(), requested.end());
+
+    uint32_t missing = 0;
+    if (requested.size() > slots.size())
+    {
+        missing += (uint32_t) (requested.size() - slots.size());
+        requested.resize (slots.size());
+    }
+    stats.requests += requested.size();
+
+    // Mark the resident tiles first so none of them is evicted to make room for another requested tile
+    for (const std::pair<float, uint32_t>& request : requested)
+    {
+        uint16_t slot = pageTable[request.second];
+        if (slot != kNotResident)
+        {
+            slots[slot].lastRequested = updateIndex;
+            unlink (slot);
+            pushFront (slot);
+            stats.hits++;
+        }
+    }
+
+    for (const std::pair<float, uint32_t>& request : requested)
+    {
+        const uint32_t tile = request.second;
+        if (pageTable[tile] != kNotResident)
+            continue;
+
+        uint32_t slot = loadedSlots.size() < maxLoads ? acquireSlot() : kNoSlot;
+        if (slot == kNoSlot)
+        {
+            missing++;
+            continue;
+        }
+
+        const uint16_t* tileTexels = source.getTile (tile % header.tilesX, tile / header.tilesX);
+        std::copy (tileTexels, tileTexels + tileTexelCount, &texels[slot * tileTexelCount]);
+
+        slots[slot].tile = tile;
+        slots[slot].lastRequested = updateIndex;
+        pushFront (slot);
+        pageTable[tile] = (uint16_t) slot;
+        loadedSlots.push_back ((uint16_t) slot);
+        residentCount++;
+        stats.loads++;
+    }
+
+    stats.deferred += missing;
+    return missing;
+}
@@ -0,0 +1,99 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLHeightmapTileCache, which keeps the tiles of a tiled heightmap around the camera resident.
+ The cache owns a fixed number of slots sized from a memory budget, the CPU copy of what is meant to be a
+ texture array with one slice per slot. Each update requests the tiles near the camera, nearest first, and
+ streams in the missing ones by evicting the least recently requested tiles. The page table maps every tile
+ of the heightmap to its slot, so a renderer that uploads the slots and the page table can find the resident
+ data. The sample's own terrain fits in a single texture and doesn't stream. It has no Apple framework
+ dependencies.
+*/
+
+#pragma once
+
+#include "AAPLTiledHeightmap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct AAPLHeightmapTileCacheStats
+{
+    uint64_t    requests;       // Tiles requested by updates
+    uint64_t    hits;           // Requested tiles that were already resident
+    uint64_t    loads;
+    uint64_t    evictions;
+    uint64_t    deferred;       // Requested tiles left missing by the per-update load limit or the slot count
+};
+
+class AAPLHeightmapTileCache
+{
+public:
+    // Page table value of tiles that are not resident
+    static constexpr uint16_t kNotResident = 0xFFFF;
+
+    // The amount of slots that fit in `budgetBytes`, at most kNotResident
+    static uint32_t getSlotCountForBudget (const AAPLTiledHeightmapHeader& header, size_t budgetBytes);
+
+    AAPLHeightmapTileCache (const AAPLTiledHeightmap& source, uint32_t slotCount);
+
+    AAPLHeightmapTileCache (const AAPLHeightmapTileCache&) = delete;
+    AAPLHeightmapTileCache& operator= (const AAPLHeightmapTileCache&) = delete;
+
+    // Requests the tiles within `radius` world units of the camera position on the xz plane, and loads at
+    //  most `maxLoads` of the missing ones, nearest first. Tiles requested by this update are never evicted
+    //  by it; when more tiles are in range than there are slots, the farthest ones are left out.
+    // Returns the amount of requested tiles that are still not resident.
+    uint32_t update (float cameraX, float cameraZ, float radius, uint32_t maxLoads);
+
+    // tilesX * tilesY slot indices in row major order, kNotResident for tiles that are not resident
+    const std::vector<uint16_t>&    getPageTable () const       { return pageTable; }
+
+    // Slots whose texels the last update wrote, to be uploaded along with the page table
+    const std::vector<uint16_t>&    getLoadedSlots () const     { return loadedSlots; }
+
+    // Texels of a slot, laid out like AAPLTiledHeightmap::getTile
+    const uint16_t*                 getSlotTexels (uint16_t slot) const { return &texels[slot * tileTexelCount]; }
+
+    uint32_t                        getSlotCount () const       { return (uint32_t) slots.size(); }
+    uint32_t                        getResidentCount () const   { return residentCount; }
+    const AAPLHeightmapTileCacheStats& getStats () const        { return stats; }
+
+private:
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t    tile;               // Index of the resident tile, or kNoSlot for a free slot
+        uint32_t    prev;               // Neighbors in the recency list
+        uint32_t    next;
+        uint64_t    lastRequested;      // Update that last requested the tile
+    };
+
+    void        unlink (uint32_t slot);
+    void        pushFront (uint32_t slot);
+    uint32_t    acquireSlot ();
+
+    const AAPLTiledHeightmap&       source;
+    const AAPLTiledHeightmapHeader& header;
+    const size_t                    tileTexelCount;
+
+    std::vector<uint16_t>           texels;
+    std::vector<Slot>               slots;
+    std::vector<uint16_t>           pageTable;
+    std::vector<uint16_t>           loadedSlots;
+    std::vector<uint32_t>           freeSlots;
+
+    // Requested tiles with their distance to the camera, rebuilt by every update
+    std::vector<std::pair<float, uint32_t>> requested;
+
+    // Recency list, most recently requested first
+    uint32_t                        head;
+    uint32_t                        tail;
+
+    uint64_t                        updateIndex;
+    uint32_t                        residentCount;
+    AAPLHeightmapTileCacheStats     stats;
+};
@@ -102,12 +102,10 @@ using namespace simd;
     
     // Create the shadow map ahead of time in order to fill in the pass descriptor with the its texture pointer
     {
-        static const NSUInteger shadowWidth = 1024;
-        
         MTLTextureDescriptor *desc =
         [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:BufferFormats::shadowDepthFormat
-                                                           width:shadowWidth
-                                                          height:shadowWidth
+                                                           width:SHADOW_MAP_SIZE
+                                                          height:SHADOW_MAP_SIZE
                                                        mipmapped:NO];
         desc.textureType = MTLTextureType2DArray;
         desc.arrayLength = NUM_CASCADES;
@@ -368,7 +366,8 @@ using namespace simd;
     // We start the frame by doing non-render work
     // Update the terrain tesselation patches so they are more tesselated when closer to the camera
     [_terrainRenderer computeTesselationFactors:commandBuffer
-                                 globalUniforms:_uniforms_gpu];
+                                 globalUniforms:_uniforms_gpu
+                                    cpuUniforms:_uniforms_cpu];
     
 #if TARGET_OS_OSX
     // We spawn/update the particles on macOS only
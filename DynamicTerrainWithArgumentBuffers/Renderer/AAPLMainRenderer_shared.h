@@ -10,6 +10,7 @@ General Uniforms structs that are shared between Metal / Objective-C.
 #import <simd/simd.h>
 
 #define NUM_CASCADES (3)
+#define SHADOW_MAP_SIZE (1024)
 
 // Matrices that are stored and generated internally within the camera object
 struct AAPLCameraUniforms
@@ -64,3 +65,18 @@ struct AAPLObjVertex
     }
 #endif
 };
+
+// Compact encoding of an AAPLObjVertex; 12 bytes instead of 48. See AAPLVertexQuantization.h
+struct AAPLObjCompactVertex
+{
+    uint16_t            position[3];    // unorm, relative to the mesh bounds in AAPLObjVertexQuantization
+    int8_t              normal[2];      // snorm, octahedral encoding
+    uint8_t             color[4];       // unorm; w is unused
+};
+
+// Reconstructs compact positions as positionOffset + positionScale * unorm
+struct AAPLObjVertexQuantization
+{
+    simd::float3        positionOffset;
+    simd::float3        positionScale;
+};
@@ -0,0 +1,78 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the mesh optimization passes run on loaded triangle lists.
+ AAPLOptimizeVertexCache reorders triangles for post-transform cache locality (Tipsify),
+ AAPLOptimizeOverdraw then reorders the resulting clusters so outward-facing geometry draws first,
+ and AAPLComputeVertexFetchRemap renumbers vertices in order of first use for fetch locality.
+ AAPLAnalyzeVertexCache measures the result with a FIFO cache simulator.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// FIFO size the optimizer targets; small enough to be pessimistic for current GPUs
+static constexpr uint32_t kVertexCacheSize = 16;
+
+struct AAPLVertexCacheStats
+{
+    uint32_t    transformedVertices;    // Cache misses of the simulated FIFO
+    float       acmr;                   // Average cache miss ratio: transformed vertices per triangle
+    float       atvr;                   // Average transformed vertex ratio: transformed vertices per referenced vertex
+};
+
+// Simulates a FIFO post-transform cache of `cacheSize` entries over a triangle list
+AAPLVertexCacheStats AAPLAnalyzeVertexCache (const uint32_t*    indices,
+                                             size_t             indexCount,
+                                             size_t             vertexCount,
+                                             uint32_t           cacheSize = kVertexCacheSize);
+
+// Reorders the triangles of a triangle list in place for a FIFO cache of `cacheSize` entries.
+// When `outClusterStarts` is set it receives the first triangle of every cluster the algorithm had to
+//  restart from a cold cache; those are the units AAPLOptimizeOverdraw may reorder.
+void AAPLOptimizeVertexCache (uint32_t*                 indices,
+                              size_t                    indexCount,
+                              size_t                    vertexCount,
+                              uint32_t                  cacheSize = kVertexCacheSize,
+                              std::vector<uint32_t>*    outClusterStarts = nullptr);
+
+// Reorders the clusters of a cache-optimized triangle list so that clusters facing away from the mesh
+//  center draw first and occlude the inner ones. Clusters are further split wherever their running
+//  ACMR is within `threshold` of the input ACMR, trading a little cache efficiency for finer sorting.
+// `positions` points at the x, y, z floats of vertex 0; `positionStride` is the vertex size in bytes.
+void AAPLOptimizeOverdraw (uint32_t*                    indices,
+                           size_t                       indexCount,
+                           const float*                 positions,
+                           size_t                       positionStride,
+                           size_t                       vertexCount,
+                           const std::vector<uint32_t>& clusterStarts,
+                           uint32_t                     cacheSize = kVertexCacheSize,
+                           float                        threshold = 1.05f);
+
+// Computes the renumbering that orders vertices by first use in `indices`: outRemap[oldIndex] = newIndex.
+// Vertices that no index references keep their relative order after all referenced ones.
+void AAPLComputeVertexFetchRemap (const uint32_t*           indices,
+                                  size_t                    indexCount,
+                                  size_t                    vertexCount,
+                                  std::vector<uint32_t>&    outRemap);
+
+// Applies a remap from AAPLComputeVertexFetchRemap to an index list
+inline void AAPLRemapIndices (uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap)
+{
+    for (size_t i = 0; i < indexCount; i++)
+        indices[i] = remap[indices[i]];
+}
+
+// Applies a remap from AAPLComputeVertexFetchRemap to a vertex list
+template <typename TVertex>
+void AAPLRemapVertices (std::vector<TVertex>& vertices, const std::vector<uint32_t>& remap)
+{
+    std::vector<TVertex> remapped (vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++)
+        remapped[remap[v]] = vertices[v];
+    vertices.swap (remapped);
+}
@@ -0,0 +1,379 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of AAPLSimplifyMesh.
+ Follows Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics", SIGGRAPH 1997,
+ restricted to collapses onto existing vertices. Each pass sorts all edges by cost and collapses as many
+ independent ones as it can, which is much cheaper than maintaining a priority queue.
+*/
+
+#include "AAPLMeshSimplifier.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    struct Vector3
+    {
+        float x, y, z;
+    };
+
+    Vector3 operator - (const Vector3& a, const Vector3& b)   { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    float   dot (const Vector3& a, const Vector3& b)          { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Vector3 cross (const Vector3& a, const Vector3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    // Symmetric 4x4 matrix that sums the squared distances to a set of weighted planes
+    struct Quadric
+    {
+        double  a2, ab, ac, ad;
+        double      b2, bc, bd;
+        double          c2, cd;
+        double              d2;
+        double  weight;
+
+        void addPlane (const Vector3& n, float d, double w)
+        {
+            a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+            b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+            c2 += w * n.z * n.z; cd += w * n.z * d;
+            d2 += w * d * d;
+            weight += w;
+        }
+
+        void add (const Quadric& q)
+        {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+            b2 += q.b2; bc += q.bc; bd += q.bd;
+            c2 += q.c2; cd += q.cd;
+            d2 += q.d2;
+            weight += q.weight;
+        }
+
+        // Weighted mean squared distance of `p` to the planes
+        double evaluate (const Vector3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                     + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                     + c2 * z * z + 2 * cd * z
+                     + d2;
+            return weight > 0.0 ? fabs (e) / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t    from;
+        uint32_t    to;
+        double      cost;
+    };
+
+    // Border edges get a plane perpendicular to their triangle so the silhouette of open geometry,
+    //  like the leaf cards of the tree meshes, is preserved more strongly than interior detail
+    static constexpr double kBorderWeight = 10.0;
+
+    // Triangles whose normal turns further than this (cosine) in a collapse are considered flipped
+    static constexpr float  kMaxNormalDeviation = 0.25f;
+}
+
+float AAPLMeshSimplifierScale (const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride)
+{
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        const float* p = (const float*) ((const uint8_t*) positions + indices[i] * positionStride);
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            lo[c] = std::min (lo[c], p[c]);
+            hi[c] = std::max (hi[c], p[c]);
+        }
+    }
+    return indexCount ? std::max (hi[0] - lo[0], std::max (hi[1] - lo[1], hi[2] - lo[2])) : 0.0f;
+}
+
+size_t AAPLSimplifyMesh (uint32_t*          outIndices,
+                         const uint32_t*    indices,
+                         size_t             indexCount,
+                         const float*       positions,
+                         size_t             positionStride,
+                         size_t             vertexCount,
+                         size_t             targetIndexCount,
+                         float              targetError,
+                         float*             outError)
+{
+    assert (indexCount % 3 == 0);
+    memmove (outIndices, indices, indexCount * sizeof(uint32_t));
+    if (outError)
+        *outError = 0.0f;
+    if (indexCount <= targetIndexCount)
+        return indexCount;
+
+    // Work on positions scaled to the unit cube so errors are relative to the mesh size
+    float scale = AAPLMeshSimplifierScale (indices, indexCount, positions, positionStride);
+    float invScale = scale > 0.0f ? 1.0f / scale : 0.0f;
+    std::vector<Vector3> position (vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        const float* p = (const float*) ((const uint8_t*) positions + v * positionStride);
+        position[v] = { p[0] * invScale, p[1] * invScale, p[2] * invScale };
+    }
+
+    // Vertices that only differ in their attributes share one canonical vertex, the first one at that
+    //  position; collapses are decided between canonical vertices
+    std::vector<uint32_t> canonical (vertexCount);
+    {
+        std::vector<uint32_t> order (vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++)
+            order[v] = v;
+        auto less = [&] (uint32_t a, uint32_t b)
+        {
+            const Vector3& pa = position[a];
+            const Vector3& pb = position[b];
+            if (pa.x != pb.x) return pa.x < pb.x;
+            if (pa.y != pb.y) return pa.y < pb.y;
+            if (pa.z != pb.z) return pa.z < pb.z;
+            return a < b;
+        };
+        std::sort (order.begin(), order.end(), less);
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const Vector3& p = position[order[i]];
+            bool same = i > 0 && p.x == position[order[i - 1]].x && p.y == position[order[i - 1]].y && p.z == position[order[i - 1]].z;
+            canonical[order[i]] = same ? canonical[order[i - 1]] : order[i];
+        }
+    }
+
+    // Triangle plane quadrics, weighted by area
+    std::vector<Quadric> quadrics (vertexCount);
+    memset (quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        const Vector3& p0 = position[outIndices[i + 0]];
+        Vector3 n = cross (position[outIndices[i + 1]] - p0, position[outIndices[i + 2]] - p0);
+        float length = sqrtf (dot (n, n));
+        if (length == 0.0f)
+            continue;
+        n = { n.x / length, n.y / length, n.z / length };
+        for (uint32_t c = 0; c < 3; c++)
+            quadrics[canonical[outIndices[i + c]]].addPlane (n, -dot (n, p0), length * 0.5);
+    }
+
+    // Border edge quadrics; an edge is on the border when exactly one triangle uses it
+    {
+        struct Edge
+        {
+            uint32_t    a, b;       // Canonical, a < b
+            uint32_t    triangle;
+        };
+        std::vector<Edge> edges;
+        edges.reserve (indexCount);
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t a = canonical[outIndices[i + c]];
+                uint32_t b = canonical[outIndices[i + (c + 1) % 3]];
+                if (a != b)
+                    edges.push_back ({ std::min (a, b), std::max (a, b), (uint32_t) (i / 3) });
+            }
+        }
+        std::sort (edges.begin(), edges.end(), [] (const Edge& x, const Edge& y) { return x.a != y.a ? x.a < y.a : x.b < y.b; });
+
+        for (size_t e = 0; e < edges.size(); )
+        {
+            size_t next = e + 1;
+            while (next < edges.size() && edges[next].a == edges[e].a && edges[next].b == edges[e].b)
+                next++;
+            if (next - e == 1)
+            {
+                const uint32_t* tri = &outIndices[edges[e].triangle * 3];
+                const Vector3& p0 = position[tri[0]];
+                Vector3 faceNormal = cross (position[tri[1]] - p0, position[tri[2]] - p0);
+                Vector3 edgeVector = position[edges[e].b] - position[edges[e].a];
+                Vector3 n = cross (edgeVector, faceNormal);
+                float length = sqrtf (dot (n, n));
+                if (length > 0.0f)
+                {
+                    n = { n.x / length, n.y / length, n.z / length };
+                    double w = kBorderWeight * dot (edgeVector, edgeVector);
+                    quadrics[edges[e].a].addPlane (n, -dot (n, position[edges[e].a]), w);
+                    quadrics[edges[e].b].addPlane (n, -dot (n, position[edges[e].a]), w);
+                }
+            }
+            e = next;
+        }
+    }
+
+    const double maxCost = (double) targetError * (double) targetError;
+    double largestCost = 0.0;
+
+    std::vector<uint32_t> adjacencyOffsets;
+    std::vector<uint32_t> adjacency;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> collapseTarget (vertexCount);
+    std::vector<bool> locked (vertexCount);
+    std::vector<uint32_t> remap (vertexCount);
+    std::vector<bool> remapped (vertexCount);
+
+    while (indexCount > targetIndexCount)
+    {
+        // Canonical vertex to triangle adjacency
+        adjacencyOffsets.assign (vertexCount + 1, 0);
+        for (size_t i = 0; i < indexCount; i++)
+            adjacencyOffsets[canonical[outIndices[i]] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        adjacency.resize (indexCount);
+        {
+            std::vector<uint32_t> fill (adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < indexCount; i++)
+                adjacency[fill[canonical[outIndices[i]]]++] = (uint32_t) (i / 3);
+        }
+
+        // Unique edges, then the cheapest direction of each
+        edges.clear();
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t a = canonical[outIndices[i + c]];
+                uint32_t b = canonical[outIndices[i + (c + 1) % 3]];
+                if (a != b)
+                    edges.push_back (((uint64_t) std::min (a, b) << 32) | std::max (a, b));
+            }
+        }
+        std::sort (edges.begin(), edges.end());
+        edges.erase (std::unique (edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (uint64_t edge : edges)
+        {
+            uint32_t a = (uint32_t) (edge >> 32);
+            uint32_t b = (uint32_t) edge;
+            Quadric q = quadrics[a];
+            q.add (quadrics[b]);
+            double costAB = q.evaluate (position[b]);
+            double costBA = q.evaluate (position[a]);
+            collapses.push_back (costAB <= costBA ? Collapse { a, b, costAB } : Collapse { b, a, costBA });
+        }
+        std::sort (collapses.begin(), collapses.end(), [] (const Collapse& x, const Collapse& y)
+        {
+            return x.cost != y.cost ? x.cost < y.cost : (x.from != y.from ? x.from < y.from : x.to < y.to);
+        });
+
+        // Collapse independent edges, cheapest first, until the pass has removed enough triangles
+        std::fill (collapseTarget.begin(), collapseTarget.end(), UINT32_MAX);
+        std::fill (locked.begin(), locked.end(), false);
+        size_t trianglesToRemove = (indexCount - targetIndexCount + 2) / 3;
+        size_t trianglesRemoved = 0;
+        size_t collapseCount = 0;
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.cost > maxCost || trianglesRemoved >= trianglesToRemove)
+                break;
+            if (locked[collapse.from] || locked[collapse.to])
+                continue;
+
+            // Reject collapses that flip any of the remaining triangles around `from`
+            bool flips = false;
+            size_t removes = 0;
+            for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++)
+            {
+                const uint32_t* tri = &outIndices[adjacency[a] * 3];
+                Vector3 before[3], after[3];
+                bool hasTarget = false;
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    uint32_t v = canonical[tri[c]];
+                    hasTarget |= v == collapse.to;
+                    before[c] = position[v];
+                    after[c] = v == collapse.from ? position[collapse.to] : position[v];
+                }
+                if (hasTarget)
+                {
+                    removes++;
+                    continue;
+                }
+                Vector3 n0 = cross (before[1] - before[0], before[2] - before[0]);
+                Vector3 n1 = cross (after[1] - after[0], after[2] - after[0]);
+                flips = dot (n0, n1) <= kMaxNormalDeviation * sqrtf (dot (n0, n0) * dot (n1, n1));
+            }
+            if (flips)
+                continue;
+
+            collapseTarget[collapse.from] = collapse.to;
+            locked[collapse.from] = true;
+            locked[collapse.to] = true;
+            largestCost = std::max (largestCost, collapse.cost);
+            trianglesRemoved += removes;
+            collapseCount++;
+        }
+
+        if (collapseCount == 0)
+            break;
+
+        // Move every vertex of a collapsed position to a vertex at the target position, preferring one
+        //  it shares a triangle with so attributes stay on the same side of a seam
+        std::fill (remapped.begin(), remapped.end(), false);
+        for (uint32_t v = 0; v < vertexCount; v++)
+            remap[v] = v;
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t v = outIndices[i + c];
+                uint32_t target = collapseTarget[canonical[v]];
+                if (target == UINT32_MAX || remapped[v])
+                    continue;
+                for (uint32_t k = 1; k < 3; k++)
+                {
+                    uint32_t other = outIndices[i + (c + k) % 3];
+                    if (canonical[other] == target)
+                    {
+                        remap[v] = other;
+                        remapped[v] = true;
+                        break;
+                    }
+                }
+            }
+        }
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            uint32_t target = collapseTarget[canonical[v]];
+            if (target != UINT32_MAX && !remapped[v])
+                remap[v] = target;
+            if (target != UINT32_MAX && canonical[v] == v)
+                quadrics[target].add (quadrics[v]);
+        }
+
+        // Rewrite the triangles and drop the ones that became degenerate
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            uint32_t a = remap[outIndices[i + 0]];
+            uint32_t b = remap[outIndices[i + 1]];
+            uint32_t c = remap[outIndices[i + 2]];
+            if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[c] == canonical[a])
+                continue;
+            outIndices[writeIndex++] = a;
+            outIndices[writeIndex++] = b;
+            outIndices[writeIndex++] = c;
+        }
+        indexCount = writeIndex;
+    }
+
+    if (outError)
+        *outError = (float) sqrt (largestCost);
+    return indexCount;
+}
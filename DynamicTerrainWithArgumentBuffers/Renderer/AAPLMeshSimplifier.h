@@ -0,0 +1,44 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of AAPLSimplifyMesh, a quadric error metric simplifier used to build mesh LOD chains.
+ Edges collapse onto one of their existing vertices, so every LOD indexes the vertex buffer of the
+ full resolution mesh and a LOD is nothing more than another range of the index buffer.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A level of detail of a mesh: a range of its index buffer and the geometric error of that range
+struct AAPLMeshLod
+{
+    uint32_t    indexStart;
+    uint32_t    indexCount;
+    float       error;          // Object space distance; 0 for the full resolution mesh
+};
+
+// Simplifies the triangle list `indices` towards `targetIndexCount` indices and writes the result to
+//  `outIndices`, which must hold `indexCount` indices. Collapses stop before their error exceeds
+//  `targetError`. Errors are relative to the largest extent of the mesh bounds; `outError` receives the
+//  largest error of the collapses that were made.
+// `positions` points at the x, y, z floats of vertex 0; `positionStride` is the vertex size in bytes.
+// Vertices sharing a position are collapsed together, so attribute seams stay closed.
+// Returns the amount of indices written.
+size_t AAPLSimplifyMesh (uint32_t*          outIndices,
+                         const uint32_t*    indices,
+                         size_t             indexCount,
+                         const float*       positions,
+                         size_t             positionStride,
+                         size_t             vertexCount,
+                         size_t             targetIndexCount,
+                         float              targetError,
+                         float*             outError = nullptr);
+
+// Largest extent of the bounds of the referenced vertices; converts AAPLSimplifyMesh errors to object space
+float AAPLMeshSimplifierScale (const uint32_t*  indices,
+                               size_t           indexCount,
+                               const float*     positions,
+                               size_t           positionStride);
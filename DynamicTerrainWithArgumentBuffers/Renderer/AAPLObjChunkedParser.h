@@ -0,0 +1,195 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of AAPLObjParseChunked, a parallel front-end for the AAPLObjParser.
+ The file is split at newline boundaries and the chunks are parsed on an AAPLTaskPool. Every chunk
+ de-duplicates its vertices into its own table, and a final pass merges the chunk tables in file order,
+ so the resulting vertex and index streams are identical to those of a serial parse.
+*/
+
+#pragma once
+
+#include "AAPLObjParser.h"
+#include "AAPLTaskPool.h"
+#include "AAPLVertexWelder.h"
+
+#include <algorithm>
+#include <vector>
+
+struct AAPLObjFloat3
+{
+    float x, y, z;
+};
+
+// The attribute streams of an OBJ file that face corners index into
+struct AAPLObjAttributeStreams
+{
+    std::vector<AAPLObjFloat3> positions;
+    std::vector<AAPLObjFloat3> texcoords;
+    std::vector<AAPLObjFloat3> normals;
+};
+
+// Chunks are at least this large; smaller files are not worth distributing
+static constexpr size_t kObjDefaultChunkSize = 64 * 1024;
+
+// Parses the OBJ text in [begin, end) on `pool` and appends the de-duplicated vertices and triangle
+//  indices to `outVertices` / `outIndices` (which are expected to be empty).
+// `buildVertex (streams, corner)` returns the TVertex for a face corner; AAPLVertexWelderTraits<TVertex>
+//  defines vertex identity, exactly like it does for the serial loaders.
+template <typename TVertex, typename TBuildVertex>
+void AAPLObjParseChunked (const char*               begin,
+                          const char*               end,
+                          AAPLTaskPool&             pool,
+                          const TBuildVertex&       buildVertex,
+                          std::vector<TVertex>&     outVertices,
+                          std::vector<uint32_t>&    outIndices,
+                          size_t                    chunkSize = kObjDefaultChunkSize)
+{
+    struct FaceLine
+    {
+        const char*             begin;
+        const char*             end;
+        AAPLObjStreamCounts     counts;
+    };
+
+    struct Chunk
+    {
+        const char*             begin;
+        const char*             end;
+        AAPLObjAttributeStreams streams;
+        std::vector<FaceLine>   faceLines;
+        AAPLObjStreamCounts     firstIndex;
+        std::vector<TVertex>    vertices;       // Unique vertices of this chunk, in order of first use
+        std::vector<uint32_t>   indices;        // Indices into `vertices`
+        std::vector<uint32_t>   remap;          // Chunk vertex index to final vertex index
+        size_t                  firstOutIndex;
+    };
+
+    struct Visitor
+    {
+        Chunk& chunk;
+        void position (float x, float y, float z)   { chunk.streams.positions.push_back ({x, y, z}); }
+        void texcoord (float x, float y, float z)   { chunk.streams.texcoords.push_back ({x, y, z}); }
+        void normal (float x, float y, float z)     { chunk.streams.normals.push_back ({x, y, z}); }
+        void faceLine (const char* lineBegin, const char* lineEnd, const AAPLObjStreamCounts& counts)
+        {
+            chunk.faceLines.push_back ({lineBegin, lineEnd, counts});
+        }
+    };
+
+    // Split at newline boundaries; use a few chunks per thread so stealing can balance the load
+    size_t size = (size_t) (end - begin);
+    size_t targetChunks = std::max<size_t> (1, (size_t) pool.getThreadCount() * 4);
+    chunkSize = std::max (chunkSize, size / targetChunks + 1);
+
+    std::vector<Chunk> chunks;
+    for (const char* chunkBegin = begin; chunkBegin < end; )
+    {
+        const char* chunkEnd = (size_t) (end - chunkBegin) > chunkSize ? chunkBegin + chunkSize : end;
+        if (chunkEnd < end)
+        {
+            chunkEnd = AAPLObjFindLineEnd (chunkEnd, end);
+            chunkEnd += chunkEnd < end ? 1 : 0;
+        }
+        chunks.emplace_back();
+        chunks.back().begin = chunkBegin;
+        chunks.back().end   = chunkEnd;
+        chunkBegin          = chunkEnd;
+    }
+
+    // Pass 1: decode attributes; remember face lines along with the chunk-relative stream sizes
+    pool.parallelFor ((uint32_t) chunks.size(), [&] (uint32_t c, uint32_t)
+    {
+        Visitor visitor = { chunks[c] };
+        AAPLObjParser::parseDeferringFaces (chunks[c].begin, chunks[c].end, visitor);
+    });
+
+    // Concatenate the attribute streams in file order
+    AAPLObjAttributeStreams streams;
+    AAPLObjStreamCounts total = {0, 0, 0};
+    for (Chunk& chunk : chunks)
+    {
+        chunk.firstIndex = total;
+        total.positions += (uint32_t) chunk.streams.positions.size();
+        total.texcoords += (uint32_t) chunk.streams.texcoords.size();
+        total.normals   += (uint32_t) chunk.streams.normals.size();
+    }
+    streams.positions.resize (total.positions);
+    streams.texcoords.resize (total.texcoords);
+    streams.normals.resize (total.normals);
+
+    pool.parallelFor ((uint32_t) chunks.size(), [&] (uint32_t c, uint32_t)
+    {
+        Chunk& chunk = chunks[c];
+        std::copy (chunk.streams.positions.begin(), chunk.streams.positions.end(), streams.positions.begin() + chunk.firstIndex.positions);
+        std::copy (chunk.streams.texcoords.begin(), chunk.streams.texcoords.end(), streams.texcoords.begin() + chunk.firstIndex.texcoords);
+        std::copy (chunk.streams.normals.begin(),   chunk.streams.normals.end(),   streams.normals.begin()   + chunk.firstIndex.normals);
+        chunk.streams = AAPLObjAttributeStreams();
+    });
+
+    // Pass 2: decode faces and de-duplicate vertices within each chunk. Every thread reuses its own table.
+    std::vector<AAPLVertexWelder<TVertex>> threadWelders (pool.getThreadCount());
+    pool.parallelFor ((uint32_t) chunks.size(), [&] (uint32_t c, uint32_t threadIndex)
+    {
+        Chunk& chunk = chunks[c];
+        AAPLVertexWelder<TVertex>& welder = threadWelders[threadIndex];
+        welder.clear();
+        welder.reserve ((size_t) (chunk.end - chunk.begin) / kObjBytesPerVertexEstimate);
+
+        for (const FaceLine& line : chunk.faceLines)
+        {
+            AAPLObjStreamCounts counts = { chunk.firstIndex.positions + line.counts.positions,
+                                           chunk.firstIndex.texcoords + line.counts.texcoords,
+                                           chunk.firstIndex.normals   + line.counts.normals };
+            AAPLObjFaceCorner corners[AAPLObjParser::kMaxFaceCorners];
+            uint32_t cornerCount;
+            if (!AAPLObjParser::parseFace (line.begin, line.end, counts, corners, cornerCount))
+                continue;
+
+            uint32_t faceIndices[AAPLObjParser::kMaxFaceCorners];
+            for (uint32_t v = 0; v < cornerCount; v++)
+            {
+                faceIndices[v] = welder.weld (buildVertex (streams, corners[v]), chunk.vertices);
+            }
+
+            // Same triangulation as the serial loaders: quads share the 0-2 diagonal
+            chunk.indices.push_back (faceIndices[0]);
+            chunk.indices.push_back (faceIndices[1]);
+            chunk.indices.push_back (faceIndices[2]);
+            if (cornerCount == 4)
+            {
+                chunk.indices.push_back (faceIndices[0]);
+                chunk.indices.push_back (faceIndices[2]);
+                chunk.indices.push_back (faceIndices[3]);
+            }
+        }
+        chunk.faceLines = std::vector<FaceLine>();
+    });
+    threadWelders.clear();
+
+    // Merge: walking the chunks in file order and their vertices in order of first use visits every
+    //  vertex in the order a serial parse would create it, which makes the output deterministic
+    size_t chunkVertexCount = 0;
+    for (const Chunk& chunk : chunks)
+        chunkVertexCount += chunk.vertices.size();
+
+    AAPLVertexWelder<TVertex> merged (chunkVertexCount);
+    size_t indexCount = 0;
+    for (Chunk& chunk : chunks)
+    {
+        chunk.remap.resize (chunk.vertices.size());
+        for (size_t v = 0; v < chunk.vertices.size(); v++)
+            chunk.remap[v] = merged.weld (chunk.vertices[v], outVertices);
+        chunk.firstOutIndex = indexCount;
+        indexCount += chunk.indices.size();
+    }
+
+    outIndices.resize (indexCount);
+    pool.parallelFor ((uint32_t) chunks.size(), [&] (uint32_t c, uint32_t)
+    {
+        const Chunk& chunk = chunks[c];
+        for (size_t i = 0; i < chunk.indices.size(); i++)
+            outIndices[chunk.firstOutIndex + i] = chunk.remap[chunk.indices[i]];
+    });
+}
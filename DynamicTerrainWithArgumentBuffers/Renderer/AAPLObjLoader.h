@@ -9,20 +9,24 @@ Declaration of the AAPLObjLoader.
 #import <Foundation/Foundation.h>
 #import <simd/simd.h>
 #import <vector>
-#import <unordered_map>
 #import <Metal/Metal.h>
 #import "AAPLMainRenderer_shared.h"
+#import "AAPLMeshSimplifier.h"
+#import "AAPLObjMeshSplitter.h"
+#import "AAPLVertexWelder.h"
 
-// Hash function definition for the std::hash protocol to handle our ObjVertex as a hash key
-template<> struct std::hash<AAPLObjVertex>
+// Lets the AAPLVertexWelder de-duplicate ObjVertices; only the 9 used floats are hashed, not the
+//  padding lanes of the float3 members
+template<> struct AAPLVertexWelderTraits<AAPLObjVertex>
 {
-    std::size_t operator()(const AAPLObjVertex& k) const
+    static uint64_t hash (const AAPLObjVertex& k)
     {
-        std::size_t hash = 0;
-        for (uint w = 0; w < sizeof(AAPLObjVertex) / sizeof(std::size_t); w++)
-            hash ^= (((std::size_t*)&k)[w] ^ (hash << 8) ^ (hash >> 8));
-        return hash;
+        const float values[9] = { k.position.x, k.position.y, k.position.z,
+                                  k.normal.x,   k.normal.y,   k.normal.z,
+                                  k.color.x,    k.color.y,    k.color.z };
+        return AAPLHashFloats (values, 9);
     }
+    static bool equal (const AAPLObjVertex& a, const AAPLObjVertex& b) { return a == b; }
 };
 
 // A simple class containing our standardized OBJ geometry
@@ -30,6 +34,18 @@ template<> struct std::hash<AAPLObjVertex>
     @property float          boundingRadius;
     @property id <MTLBuffer> vertexBuffer;
     @property id <MTLBuffer> indexBuffer;
+    @property MTLIndexType   indexType;
+
+    // When set, the vertex buffer holds AAPLObjCompactVertex elements to unpack with `quantization`
+    @property BOOL           compactVertices;
+    @property AAPLObjVertexQuantization quantization;
+
+    // Ranges of the index buffer to draw with their base vertex; there is a single submesh
+    //  unless the loader split a mesh that was too large for 16-bit indices
+    @property std::vector<AAPLObjSubmesh> submeshes;
+
+    // Levels of detail, finest first; LOD 0 is the full mesh. All of them index the same vertices
+    @property std::vector<AAPLMeshLod> lods;
 
 -(NSUInteger) indexCount;
 -(NSUInteger) vertexCount;
@@ -41,4 +57,31 @@ template<> struct std::hash<AAPLObjVertex>
 -(instancetype) initWithDevice:(id<MTLDevice>) device;
 -(AAPLObjMesh*) loadFromUrl:(NSURL*) inUrl;
 
+// When set, large files are split at line boundaries and parsed on a thread pool
+//  The resulting meshes are identical to those of the serial path
+@property BOOL parallelParsing;
+
+// When set, the parsed vertices and indices are stored in a binary cache the first time a file is loaded,
+//  and later loads map that cache instead of parsing the OBJ again. See AAPLObjMeshCache.h
+@property BOOL useMeshCache;
+
+// Meshes with more than 64K vertices use 32-bit indices by default. When set, they are split into
+//  submeshes that keep 16-bit indices instead, at the cost of one draw per submesh
+@property BOOL splitLargeMeshes;
+
+// When set, triangles are reordered for the post-transform vertex cache and for less overdraw, and
+//  vertices are reordered for fetch locality. The ACMR/ATVR before and after are logged
+@property BOOL optimizeMeshes;
+
+// When set, meshes are created with AAPLObjCompactVertex vertices instead of AAPLObjVertex ones
+@property BOOL compactVertices;
+
+// When above 1, up to this many levels of detail are built per mesh by quadric edge collapse.
+//  Each LOD targets `lodTriangleRatio` times the triangles of the previous one, and no collapse may
+//  move the surface further than `lodMaxError` times the mesh extent. Meshes split for 16-bit indices
+//  only get LOD 0
+@property NSUInteger lodCount;
+@property float lodTriangleRatio;
+@property float lodMaxError;
+
 @end
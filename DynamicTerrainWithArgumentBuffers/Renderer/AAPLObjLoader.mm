@@ -7,13 +7,95 @@ Implementation of the AAPLObjLoader.
 */
 
 #import "AAPLObjLoader.h"
-#include <stdio.h>
+#import "AAPLObjParser.h"
+#import "AAPLObjChunkedParser.h"
+#import "AAPLObjMeshCache.h"
+#import "AAPLMeshOptimizer.h"
+#import "AAPLVertexQuantization.h"
 
 @implementation AAPLObjMesh
--(NSUInteger) vertexCount { return _vertexBuffer.length / sizeof(AAPLObjVertex); }
--(NSUInteger) indexCount { return _indexBuffer.length / sizeof(uint16_t); }
+-(NSUInteger) vertexCount { return _vertexBuffer.length / (_compactVertices ? sizeof(AAPLObjCompactVertex) : sizeof(AAPLObjVertex)); }
+-(NSUInteger) indexCount { return _indexBuffer.length / (_indexType == MTLIndexTypeUInt16 ? sizeof(uint16_t) : sizeof(uint32_t)); }
 @end
 
+@interface AAPLObjLoader ()
+-(uint32_t) createOrFindVertex:(const AAPLObjVertex&) vertex;
+@end
+
+// Collects the attribute streams of an OBJ file and turns its faces into de-duplicated vertices and indices
+struct AAPLObjLoaderVisitor
+{
+    __unsafe_unretained AAPLObjLoader*  loader;
+    std::vector<simd::float3>&          positions;
+    std::vector<simd::float3>&          normals;
+    std::vector<simd::float3>&          colors;
+    std::vector<uint32_t>&              indices;
+
+    void position (float x, float y, float z)   { positions.push_back ((simd::float3) {x,y,z}); }
+    void texcoord (float x, float y, float z)   { colors.push_back ((simd::float3) {x,y,z}); }
+    void normal (float x, float y, float z)     { normals.push_back ((simd::float3) {x,y,z}); }
+
+    void face (const AAPLObjFaceCorner* corners, uint32_t cornerCount)
+    {
+        uint32_t faceIndices[AAPLObjParser::kMaxFaceCorners];
+        for (uint v = 0; v < cornerCount; v++)
+        {
+            AAPLObjVertex vtx;
+            vtx.position      = positions[corners[v].position];
+            vtx.normal        = normals[corners[v].normal];
+            vtx.color         = colors[corners[v].texcoord];
+            faceIndices[v]    = [loader createOrFindVertex:vtx];
+        }
+
+        // Triangles are emitted as-is, quads are split into two triangles sharing the 0-2 diagonal
+        indices.push_back (faceIndices[0]);
+        indices.push_back (faceIndices[1]);
+        indices.push_back (faceIndices[2]);
+        if (cornerCount == 4)
+        {
+            indices.push_back (faceIndices[0]);
+            indices.push_back (faceIndices[2]);
+            indices.push_back (faceIndices[3]);
+        }
+    }
+};
+
+// Encodes vertices in the compact format, quantizing positions relative to the bounds of the mesh
+static AAPLObjVertexQuantization AAPLCompactObjVertices (const std::vector<AAPLObjVertex>&      vertices,
+                                                         std::vector<AAPLObjCompactVertex>&     outVertices)
+{
+    simd::float3 lo = INFINITY, hi = -INFINITY;
+    for (const AAPLObjVertex& vertex : vertices)
+    {
+        lo = simd::min (lo, vertex.position);
+        hi = simd::max (hi, vertex.position);
+    }
+    
+    if (vertices.empty())
+        lo = hi = 0.0f;
+    
+    AAPLObjVertexQuantization quantization;
+    quantization.positionOffset = lo;
+    quantization.positionScale  = hi - lo;
+    
+    outVertices.resize (vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        const AAPLObjVertex& in = vertices[v];
+        AAPLObjCompactVertex& out = outVertices[v];
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            out.position[c] = AAPLEncodePositionComponent (in.position[c], quantization.positionOffset[c], quantization.positionScale[c]);
+            out.color[c]    = AAPLEncodeUnorm8 (in.color[c]);
+        }
+        out.color[3] = 0;
+        
+        const float normal[3] = { in.normal.x, in.normal.y, in.normal.z };
+        AAPLEncodeOctahedral (normal, out.normal);
+    }
+    return quantization;
+}
+
 @implementation AAPLObjLoader
 {
     // Indexed positions, normals, uvs from ObjFile; to be collated into ObjVertices during face read
@@ -22,21 +104,24 @@ Implementation of the AAPLObjLoader.
     std::vector<simd::float3>                   _colors;
     float                                       _boundingSphereRadius;
     
-    // Map that holds all generated vertices to de-duplicate
-    std::unordered_map<AAPLObjVertex, uint32_t> _vertexMap;
+    // Table that indexes all generated vertices to de-duplicate
+    AAPLVertexWelder<AAPLObjVertex>             _vertexWelder;
     
     id<MTLDevice>                               _device;
     std::vector<AAPLObjVertex>                  _vertices;
-    std::vector<uint16_t>                       _indices;
+    std::vector<uint32_t>                       _indices;
+    
+    // Workers for parallel parsing; created on first use
+    std::unique_ptr<AAPLTaskPool>               _taskPool;
 }
 
-// Buffer size used to store file data internally during read operations
-static constexpr uint kBufferSize = 2048;
-
 -(instancetype)initWithDevice:(id<MTLDevice>) device
 {
     self = [super init];
     _device = device;
+    _lodCount = 1;
+    _lodTriangleRatio = 0.5f;
+    _lodMaxError = 0.05f;
     return self;
 }
 
@@ -45,133 +130,140 @@ static constexpr uint kBufferSize = 2048;
     _boundingSphereRadius = 0.0f;
     _indices.clear();
     _vertices.clear();
-    _vertexMap.clear();
+    _vertexWelder.clear();
     _normals.clear();
     _colors.clear();
     _positions.clear();
 }
 
-// Create or retrieve an exisiting vertex from our current vertex buffer; we keep a hash map for fast lookups
+// Create or retrieve an exisiting vertex from our current vertex buffer; we keep a hash table for fast lookups
 -(uint32_t) createOrFindVertex:(const AAPLObjVertex&) vertex
 {
-    // Find vertex is a hashmap
-    std::unordered_map<AAPLObjVertex, uint32_t>::iterator i = _vertexMap.find(vertex);
-    if (i == _vertexMap.end())
-    {
-        // If not present, add to map and vertex list
-        _vertexMap.insert(std::pair<AAPLObjVertex,uint>(vertex, _vertices.size()));
-        _vertices.push_back(vertex);
-        
+    // If not present, the welder appends the vertex to the vertex list
+    bool inserted;
+    uint32_t index = _vertexWelder.weld(vertex, _vertices, &inserted);
+    if (inserted)
         _boundingSphereRadius = fmax(_boundingSphereRadius, simd::length(vertex.position));
-        
-        return (uint32_t) (_vertices.size()) - 1;
-    }
-    else
-    {
-        // Return the previously found vertex index from the list
-        return i->second;
-    }
     
+    return index;
 }
 
 
--(void) readLine: (NSData*)inLine lineNumber:(uint) inNumber
+// Parallel variant of the parse; fills in the same vertex and index lists as the serial path
+-(void) parseChunked:(const AAPLMappedFile&) file
 {
-    float x = 0.0f;
-    float y = 0.0f;
-    float z = 0.0f;
-    uint iv[4];
-    uint ivn[4];
-    uint ivt[4];
-    
-    if      (sscanf(((char*)inLine.bytes), "v %f %f %f", &x, &y, &z) == 3)  _positions.push_back( (simd::float3) {x,y,z} );
-    else if (sscanf(((char*)inLine.bytes), "vt %f %f %f", &x, &y, &z) == 3) _colors.push_back( (simd::float3) {x,y,z} );
-    else if (sscanf(((char*)inLine.bytes), "vn %f %f %f", &x, &y, &z) == 3) _normals.push_back( (simd::float3) {x,y,z} );
-    else if (sscanf(((char*)inLine.bytes), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", &iv[0], &ivt[0], &ivn[0], &iv[1], &ivt[1], &ivn[1], &iv[2], &ivt[2], &ivn[2], &iv[3], &ivt[3], &ivn[3]) == 12) // quad
-    {
-        uint indices[4];
-        for (uint v = 0; v < 4; v++)
-        {
-            AAPLObjVertex vtx;
-            vtx.position      = _positions[iv[v]-1];
-            vtx.normal        = _normals[ivn[v]-1];
-            vtx.color         = _colors[ivt[v]-1];
-            indices[v]        = [self createOrFindVertex:vtx];
-        }
-        _indices.push_back(indices[0]);
-        _indices.push_back(indices[1]);
-        _indices.push_back(indices[2]);
-        _indices.push_back(indices[0]);
-        _indices.push_back(indices[2]);
-        _indices.push_back(indices[3]);
-    }
-    else if (sscanf(((char*)inLine.bytes), "f %d/%d/%d %d/%d/%d %d/%d/%d", &iv[0], &ivt[0], &ivn[0], &iv[1], &ivt[1], &ivn[1], &iv[2], &ivt[2], &ivn[2]) == 9) // triangle
-    {
-        uint indices[3];
-        for (uint v = 0; v < 3; v++)
+    if (!_taskPool)
+        _taskPool.reset (new AAPLTaskPool ());
+    
+    AAPLObjParseChunked<AAPLObjVertex> (file.begin(), file.end(), *_taskPool,
+        [] (const AAPLObjAttributeStreams& streams, const AAPLObjFaceCorner& corner)
         {
+            const AAPLObjFloat3& p = streams.positions[corner.position];
+            const AAPLObjFloat3& n = streams.normals[corner.normal];
+            const AAPLObjFloat3& c = streams.texcoords[corner.texcoord];
             AAPLObjVertex vtx;
-            vtx.position      = _positions[iv[v]-1];
-            vtx.normal        = _normals[ivn[v]-1];
-            vtx.color         = _colors[ivt[v]-1];
-            indices[v]        = [self createOrFindVertex:vtx];
-        }
-        _indices.push_back(indices[0]);
-        _indices.push_back(indices[1]);
-        _indices.push_back(indices[2]);
-    }
+            vtx.position      = (simd::float3) {p.x, p.y, p.z};
+            vtx.normal        = (simd::float3) {n.x, n.y, n.z};
+            vtx.color         = (simd::float3) {c.x, c.y, c.z};
+            return vtx;
+        },
+        _vertices, _indices);
+    
+    for (const AAPLObjVertex& vertex : _vertices)
+        _boundingSphereRadius = fmax(_boundingSphereRadius, simd::length(vertex.position));
 }
 
-
-// File loading entrypoint that loads an URL and extracts lines from it for further processing
--(AAPLObjMesh*) loadFromUrl:(NSURL*) inUrl
+// Reorders triangles for the post-transform cache and overdraw, then vertices for fetch locality.
+//  Meshes already in a cache friendly order keep it when reordering would transform more vertices.
+-(void) optimizeMeshForUrl:(NSURL*) inUrl
 {
-    [self clear];
+    const size_t indexCount = _indices.size();
+    const size_t vertexCount = _vertices.size();
+    if (indexCount == 0)
+        return;
+    
+    AAPLVertexCacheStats before = AAPLAnalyzeVertexCache (_indices.data(), indexCount, vertexCount);
+    
+    std::vector<uint32_t> cacheOrder (_indices);
+    std::vector<uint32_t> clusterStarts;
+    AAPLOptimizeVertexCache (cacheOrder.data(), indexCount, vertexCount, kVertexCacheSize, &clusterStarts);
     
-    NSInputStream* is = [NSInputStream inputStreamWithURL:inUrl];
-    assert(is != nil);
-    [is open];
+    std::vector<uint32_t> overdrawOrder (cacheOrder);
+    AAPLOptimizeOverdraw (overdrawOrder.data(), indexCount, (const float*) &_vertices[0].position, sizeof(AAPLObjVertex),
+                          vertexCount, clusterStarts);
     
-    uint8_t read_buffer[kBufferSize];
+    // Prefer the overdraw order, then the cache order when sorting for overdraw lost the cache gain
+    if (AAPLAnalyzeVertexCache (overdrawOrder.data(), indexCount, vertexCount).acmr <= before.acmr)
+        _indices.swap (overdrawOrder);
+    else if (AAPLAnalyzeVertexCache (cacheOrder.data(), indexCount, vertexCount).acmr < before.acmr)
+        _indices.swap (cacheOrder);
     
-    // Begin of current line(part) within buffer
-    uint8_t* begin_line         = read_buffer;
+    std::vector<uint32_t> remap;
+    AAPLComputeVertexFetchRemap (_indices.data(), indexCount, vertexCount, remap);
+    AAPLRemapIndices (_indices.data(), indexCount, remap);
+    AAPLRemapVertices (_vertices, remap);
     
-    // End of current line(part) within buffer
-    uint8_t* end_line           = read_buffer;
+    AAPLVertexCacheStats after = AAPLAnalyzeVertexCache (_indices.data(), indexCount, vertexCount);
+    NSLog(@"Optimized %@: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", inUrl.lastPathComponent,
+          before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+// Appends the coarser levels of detail to the index list. Every LOD is simplified from the full mesh
+//  rather than from the previous LOD so errors do not accumulate, then reordered for the vertex cache.
+-(void) buildLods:(std::vector<AAPLMeshLod>&) lods
+{
+    const uint32_t fullIndexCount = (uint32_t) _indices.size();
+    lods.assign (1, AAPLMeshLod { 0, fullIndexCount, 0.0f });
+    if (fullIndexCount == 0 || _lodCount < 2)
+        return;
     
-    // End of valid data in the buffer
-    uint8_t* end_buffer         = read_buffer;
-    NSMutableData* line         = [NSMutableData data];
-    uint lineNumber             = 0;
+    const float* positions = (const float*) &_vertices[0].position;
+    const float scale = AAPLMeshSimplifierScale (_indices.data(), fullIndexCount, positions, sizeof(AAPLObjVertex));
+    std::vector<uint32_t> lodIndices (fullIndexCount);
+    float triangleRatio = 1.0f;
     
-    // Run until we run out of buffer and the input stream has no more data to retrieve
-    while(begin_line != end_buffer || [is hasBytesAvailable])
+    for (NSUInteger l = 1; l < _lodCount; l++)
     {
-        // Scan to end of buffer/end of line
-        for (end_line = begin_line; (end_line < end_buffer) && (*end_line != '\n'); end_line++) {}
+        triangleRatio *= _lodTriangleRatio;
+        size_t targetIndexCount = (size_t) (fullIndexCount / 3 * triangleRatio) * 3;
+        float error = 0.0f;
+        size_t indexCount = AAPLSimplifyMesh (lodIndices.data(), _indices.data(), fullIndexCount,
+                                              positions, sizeof(AAPLObjVertex), _vertices.size(),
+                                              targetIndexCount, _lodMaxError, &error);
         
-        // Append part of c-style string to line buffer
-        [line appendBytes: begin_line length:end_line-begin_line];
+        // Stop once the error bound keeps the simplifier from removing at least a tenth of the triangles
+        if (indexCount == 0 || indexCount * 10 > lods.back().indexCount * 9)
+            break;
         
-        if (end_line == end_buffer)
-        {
-            // In case of out-of-buffer, read new data, reset buffer
-            end_buffer = read_buffer + [is read:&read_buffer[0] maxLength:kBufferSize-1];
-            begin_line = read_buffer;
-        }
-        else
-        {
-            // In case of end-of-line, push new line, reset line buffer
-            [line appendBytes:"" length:1];
-            [self readLine: line lineNumber:++lineNumber];
-            [line setLength:0];
-            begin_line = end_line+1;
-        }
+        AAPLOptimizeVertexCache (lodIndices.data(), indexCount, _vertices.size());
+        
+        // Errors must not decrease along the chain for the selection to be monotonic
+        AAPLMeshLod lod = { (uint32_t) _indices.size(), (uint32_t) indexCount, std::max (error * scale, lods.back().error) };
+        _indices.insert (_indices.end(), lodIndices.begin(), lodIndices.begin() + indexCount);
+        lods.push_back (lod);
     }
-    [is close];
-    
+}
+
+// Creates the Metal buffers of a mesh from vertex and index data in memory
+-(AAPLObjMesh*) createMeshWithVertices:(const void*) vertices
+                        vertexDataSize:(size_t) vertexDataSize
+                               indices:(const void*) indices
+                         indexDataSize:(size_t) indexDataSize
+                             indexType:(MTLIndexType) indexType
+                             submeshes:(const AAPLObjSubmesh*) submeshes
+                          submeshCount:(size_t) submeshCount
+                                  lods:(const AAPLMeshLod*) lods
+                              lodCount:(size_t) lodCount
+                        boundingRadius:(float) boundingRadius
+                          quantization:(const AAPLObjVertexQuantization*) quantization
+{
     AAPLObjMesh* new_mesh = [[AAPLObjMesh alloc] init];
+    new_mesh.compactVertices = quantization != nullptr;
+    if (quantization)
+        new_mesh.quantization = *quantization;
+    new_mesh.indexType = indexType;
+    new_mesh.submeshes = std::vector<AAPLObjSubmesh> (submeshes, submeshes + submeshCount);
+    new_mesh.lods = std::vector<AAPLMeshLod> (lods, lods + lodCount);
 
 #if TARGET_OS_IOS
     const MTLResourceOptions storageMode = MTLResourceStorageModeShared;
@@ -180,21 +272,156 @@ static constexpr uint kBufferSize = 2048;
 #endif
     
     // Generate buffers
-    new_mesh.vertexBuffer =     [_device newBufferWithLength:(sizeof(AAPLObjVertex)*_vertices.size())         options:storageMode];
-    new_mesh.indexBuffer =      [_device newBufferWithLength:(sizeof(uint16_t)*_indices.size())               options:storageMode];
-    new_mesh.boundingRadius = _boundingSphereRadius;
+    new_mesh.vertexBuffer =     [_device newBufferWithLength:vertexDataSize         options:storageMode];
+    new_mesh.indexBuffer =      [_device newBufferWithLength:indexDataSize          options:storageMode];
+    new_mesh.boundingRadius = boundingRadius;
     
     // Copy vertices
-    memcpy(new_mesh.vertexBuffer.contents, _vertices.data(), sizeof(AAPLObjVertex) * _vertices.size());
+    memcpy(new_mesh.vertexBuffer.contents, vertices, vertexDataSize);
 #if TARGET_OS_OSX
     [new_mesh.vertexBuffer didModifyRange:NSMakeRange(0, new_mesh.vertexBuffer.length)];
 #endif
     
     // Copy indices
-    memcpy(new_mesh.indexBuffer.contents, _indices.data(), sizeof(uint16_t) * _indices.size());
+    memcpy(new_mesh.indexBuffer.contents, indices, indexDataSize);
 #if TARGET_OS_OSX
     [new_mesh.indexBuffer didModifyRange:NSMakeRange(0, new_mesh.indexBuffer.length)];
 #endif
+    
+    return new_mesh;
+}
+
+// Caches are written next to the OBJ when that directory is writable (e.g. while developing from a
+//  source checkout) and to the user's caches directory otherwise, since application bundles are read-only
+-(NSURL*) cacheUrlForUrl:(NSURL*) inUrl
+{
+    NSURL* directory = [inUrl URLByDeletingLastPathComponent];
+    if (![[NSFileManager defaultManager] isWritableFileAtPath:directory.path])
+    {
+        directory = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask].firstObject;
+    }
+    return [directory URLByAppendingPathComponent:[inUrl.lastPathComponent stringByAppendingString:@".meshcache"]];
+}
+
+// File loading entrypoint that maps an URL and parses it in place
+-(AAPLObjMesh*) loadFromUrl:(NSURL*) inUrl
+{
+    [self clear];
+    
+    // Use the binary cache if there is an up-to-date one
+    AAPLObjMeshCacheSource source;
+    bool hasSource = AAPLGetObjMeshCacheSource (inUrl.fileSystemRepresentation, source);
+    NSURL* cacheUrl = _useMeshCache && hasSource ? [self cacheUrlForUrl:inUrl] : nil;
+    const AAPLObjMeshCacheOptions cacheOptions = { (uint32_t) _lodCount, _lodTriangleRatio, _lodMaxError,
+                                                   _splitLargeMeshes ? 1u : 0u, _optimizeMeshes ? 1u : 0u };
+    if (cacheUrl)
+    {
+        AAPLObjMeshCacheReader cache (cacheUrl.fileSystemRepresentation, source, cacheOptions,
+                                      _compactVertices ? sizeof(AAPLObjCompactVertex) : sizeof(AAPLObjVertex));
+        if (cache.isValid())
+        {
+            AAPLObjVertexQuantization quantization;
+            const float* offset = cache.getPositionOffset();
+            const float* scale = cache.getPositionScale();
+            quantization.positionOffset = (simd::float3) { offset[0], offset[1], offset[2] };
+            quantization.positionScale  = (simd::float3) { scale[0], scale[1], scale[2] };
+            return [self createMeshWithVertices:cache.getVertices() vertexDataSize:cache.getVertexDataSize()
+                                        indices:cache.getIndices() indexDataSize:cache.getIndexDataSize()
+                                      indexType:cache.getIndexStride() == sizeof(uint16_t) ? MTLIndexTypeUInt16 : MTLIndexTypeUInt32
+                                      submeshes:cache.getSubmeshes() submeshCount:cache.getSubmeshCount()
+                                           lods:cache.getLods() lodCount:cache.getLodCount()
+                                 boundingRadius:cache.getBoundingRadius()
+                                   quantization:_compactVertices ? &quantization : nullptr];
+        }
+    }
+    
+    AAPLMappedFile file (inUrl.fileSystemRepresentation);
+    assert (file.isValid());
+
+    if (_parallelParsing && file.getSize() > 2 * kObjDefaultChunkSize)
+    {
+        [self parseChunked:file];
+    }
+    else
+    {
+        _vertexWelder.reserve(file.getSize() / kObjBytesPerVertexEstimate);
+        AAPLObjLoaderVisitor visitor = { self, _positions, _normals, _colors, _indices };
+        AAPLObjParser::parse (file.begin(), file.end(), visitor);
+    }
+    
+    if (_optimizeMeshes)
+        [self optimizeMeshForUrl:inUrl];
+    
+    // Split meshes keep a single LOD, as the splitter expects the index list to hold one copy of the mesh
+    std::vector<AAPLMeshLod> lods;
+    if (_vertices.size() <= kObjMaxVerticesPer16BitMesh || !_splitLargeMeshes)
+        [self buildLods:lods];
+    else
+        lods.assign (1, AAPLMeshLod { 0, (uint32_t) _indices.size(), 0.0f });
+    
+    // 16-bit indices address up to 64K vertices; larger meshes either keep 32-bit indices or are
+    //  split into submeshes that are each small enough for 16-bit indices
+    auto getPosition = [] (const AAPLObjVertex& vertex) { return (const float*) &vertex.position; };
+    std::vector<AAPLObjVertex> splitVertices;
+    std::vector<uint16_t> indices16;
+    std::vector<AAPLObjSubmesh> submeshes;
+    const std::vector<AAPLObjVertex>* vertices = &_vertices;
+    MTLIndexType indexType = MTLIndexTypeUInt16;
+    
+    if (_vertices.size() <= kObjMaxVerticesPer16BitMesh)
+    {
+        indices16.assign (_indices.begin(), _indices.end());
+    }
+    else if (_splitLargeMeshes)
+    {
+        AAPLSplitObjMesh (_vertices, _indices, getPosition, splitVertices, indices16, submeshes);
+        vertices = &splitVertices;
+    }
+    else
+    {
+        indexType = MTLIndexTypeUInt32;
+    }
+    
+    if (submeshes.empty())
+    {
+        AAPLObjSubmesh submesh = { 0, lods[0].indexCount, 0, (uint32_t) _vertices.size() };
+        AAPLComputeObjSubmeshBounds (_vertices.data(), submesh.vertexCount, getPosition, submesh);
+        submeshes.push_back (submesh);
+    }
+    
+    const void* indexData       = indexType == MTLIndexTypeUInt16 ? (const void*) indices16.data() : (const void*) _indices.data();
+    const uint32_t indexStride  = indexType == MTLIndexTypeUInt16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    const size_t indexCount     = indexType == MTLIndexTypeUInt16 ? indices16.size() : _indices.size();
+    
+    // Compaction comes last so that optimization and splitting work on full precision vertices
+    std::vector<AAPLObjCompactVertex> compactVertices;
+    AAPLObjVertexQuantization quantization = {};
+    if (_compactVertices)
+        quantization = AAPLCompactObjVertices (*vertices, compactVertices);
+    
+    const void* vertexData      = _compactVertices ? (const void*) compactVertices.data() : (const void*) vertices->data();
+    const uint32_t vertexStride = _compactVertices ? sizeof(AAPLObjCompactVertex) : sizeof(AAPLObjVertex);
+    
+    AAPLObjMesh* new_mesh = [self createMeshWithVertices:vertexData vertexDataSize:vertexStride * vertices->size()
+                                                 indices:indexData indexDataSize:indexStride * indexCount
+                                               indexType:indexType
+                                               submeshes:submeshes.data() submeshCount:submeshes.size()
+                                                    lods:lods.data() lodCount:lods.size()
+                                          boundingRadius:_boundingSphereRadius
+                                            quantization:_compactVertices ? &quantization : nullptr];
+    
+    // Failing to write the cache is not an error; the next launch simply parses the OBJ again
+    if (cacheUrl && !AAPLWriteObjMeshCache (cacheUrl.fileSystemRepresentation, source, cacheOptions,
+                                            vertexData, vertexStride, vertices->size(),
+                                            indexData, indexStride, indexCount,
+                                            submeshes.data(), submeshes.size(),
+                                            lods.data(), lods.size(),
+                                            _boundingSphereRadius,
+                                            (const float*) &quantization.positionOffset,
+                                            (const float*) &quantization.positionScale))
+    {
+        NSLog(@"Failed to write mesh cache %@", cacheUrl.path);
+    }
 
     [self clear];
     return new_mesh;
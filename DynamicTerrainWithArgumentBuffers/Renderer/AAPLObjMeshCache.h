@@ -0,0 +1,236 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header-only reader and writer for the binary OBJ mesh cache.
+ A cache file holds the output of the OBJ loader (a vertex blob in AAPLObjVertex or AAPLObjCompactVertex
+ layout, an index blob, the submesh and LOD tables, the bounding radius and the position dequantization) so later
+ launches can map the file and create their buffers without parsing any text.
+ The header records the source file's size and modification time, and the loader options that shaped the
+ data, so stale caches and caches built with other options are ignored.
+*/
+
+#pragma once
+
+#include "AAPLMeshSimplifier.h"
+#include "AAPLObjMeshSplitter.h"
+#include "AAPLObjParser.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+
+// Bump whenever the layout of the cache or of the vertex / index data changes
+static constexpr uint32_t kObjMeshCacheVersion  = 5;
+static constexpr uint32_t kObjMeshCacheMagic    = 0x434D4F41; // 'AOMC'
+
+// Blobs start on this alignment so they can be read in place
+static constexpr uint64_t kObjMeshCacheAlignment = 256;
+
+// Identifies the OBJ file a cache was generated from
+struct AAPLObjMeshCacheSource
+{
+    uint64_t    fileSize;
+    int64_t     modificationSeconds;
+    int64_t     modificationNanoseconds;
+
+    bool operator == (const AAPLObjMeshCacheSource& o) const
+    {
+        return fileSize == o.fileSize &&
+               modificationSeconds == o.modificationSeconds &&
+               modificationNanoseconds == o.modificationNanoseconds;
+    }
+};
+
+// The AAPLObjLoader options that change the cached data. The vertex layout chosen by compactVertices is
+//  checked through the vertex stride, and parallelParsing produces the same data as the serial parser
+struct AAPLObjMeshCacheOptions
+{
+    uint32_t    lodCount;
+    float       lodTriangleRatio;
+    float       lodMaxError;
+    uint32_t    splitLargeMeshes;
+    uint32_t    optimizeMeshes;
+
+    bool operator == (const AAPLObjMeshCacheOptions& o) const
+    {
+        return lodCount == o.lodCount &&
+               lodTriangleRatio == o.lodTriangleRatio &&
+               lodMaxError == o.lodMaxError &&
+               splitLargeMeshes == o.splitLargeMeshes &&
+               optimizeMeshes == o.optimizeMeshes;
+    }
+};
+
+struct AAPLObjMeshCacheHeader
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                vertexStride;       // sizeof the vertex type, to reject caches with another layout
+                                                //  (e.g. float vertices when compact ones are expected)
+    uint32_t                indexStride;        // 2 or 4, as meshes above 64K vertices may use 32-bit indices
+    AAPLObjMeshCacheSource  source;
+    AAPLObjMeshCacheOptions options;
+    uint64_t                vertexCount;
+    uint64_t                indexCount;
+    uint64_t                submeshCount;
+    uint64_t                lodCount;
+    uint64_t                vertexOffset;       // From the start of the file
+    uint64_t                indexOffset;
+    uint64_t                submeshOffset;
+    uint64_t                lodOffset;
+    float                   boundingRadius;
+    float                   positionOffset[3];  // Dequantization of compact vertex positions
+    float                   positionScale[3];
+};
+
+inline bool AAPLGetObjMeshCacheSource (const char* objPath, AAPLObjMeshCacheSource& outSource)
+{
+    struct stat st;
+    if (stat (objPath, &st) != 0)
+        return false;
+
+    outSource.fileSize = (uint64_t) st.st_size;
+#if defined(__APPLE__)
+    outSource.modificationSeconds       = st.st_mtimespec.tv_sec;
+    outSource.modificationNanoseconds   = st.st_mtimespec.tv_nsec;
+#else
+    outSource.modificationSeconds       = st.st_mtim.tv_sec;
+    outSource.modificationNanoseconds   = st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+// Writes a cache file. The data goes to a temporary file that is renamed into place,
+//  so a reader never observes a partially written cache.
+inline bool AAPLWriteObjMeshCache (const char*                      cachePath,
+                                   const AAPLObjMeshCacheSource&    source,
+                                   const AAPLObjMeshCacheOptions&   options,
+                                   const void*                      vertices,
+                                   uint32_t                         vertexStride,
+                                   uint64_t                         vertexCount,
+                                   const void*                      indices,
+                                   uint32_t                         indexStride,
+                                   uint64_t                         indexCount,
+                                   const AAPLObjSubmesh*            submeshes,
+                                   uint64_t                         submeshCount,
+                                   const AAPLMeshLod*               lods,
+                                   uint64_t                         lodCount,
+                                   float                            boundingRadius,
+                                   const float                      positionOffset[3] = nullptr,
+                                   const float                      positionScale[3] = nullptr)
+{
+    auto align = [] (uint64_t offset) { return (offset + kObjMeshCacheAlignment - 1) & ~(kObjMeshCacheAlignment - 1); };
+
+    AAPLObjMeshCacheHeader header;
+    memset (&header, 0, sizeof(header));
+    header.magic            = kObjMeshCacheMagic;
+    header.version          = kObjMeshCacheVersion;
+    header.vertexStride     = vertexStride;
+    header.indexStride      = indexStride;
+    header.source           = source;
+    header.options          = options;
+    header.vertexCount      = vertexCount;
+    header.indexCount       = indexCount;
+    header.submeshCount     = submeshCount;
+    header.lodCount         = lodCount;
+    header.vertexOffset     = align (sizeof(header));
+    header.indexOffset      = align (header.vertexOffset + vertexCount * vertexStride);
+    header.submeshOffset    = align (header.indexOffset + indexCount * indexStride);
+    header.lodOffset        = align (header.submeshOffset + submeshCount * sizeof(AAPLObjSubmesh));
+    header.boundingRadius   = boundingRadius;
+    if (positionOffset && positionScale)
+    {
+        memcpy (header.positionOffset, positionOffset, sizeof(header.positionOffset));
+        memcpy (header.positionScale, positionScale, sizeof(header.positionScale));
+    }
+
+    std::string temporaryPath = std::string (cachePath) + ".tmp";
+    FILE* file = fopen (temporaryPath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    // Pads the file up to `offset`
+    static const uint8_t kPadding[kObjMeshCacheAlignment] = {};
+    auto padTo = [file] (uint64_t offset)
+    {
+        size_t padding = (size_t) (offset - (uint64_t) ftell (file));
+        return fwrite (kPadding, 1, padding, file) == padding;
+    };
+
+    bool success =
+        fwrite (&header, sizeof(header), 1, file) == 1 &&
+        padTo (header.vertexOffset) &&
+        fwrite (vertices, vertexStride, vertexCount, file) == vertexCount &&
+        padTo (header.indexOffset) &&
+        fwrite (indices, indexStride, indexCount, file) == indexCount &&
+        padTo (header.submeshOffset) &&
+        fwrite (submeshes, sizeof(AAPLObjSubmesh), submeshCount, file) == submeshCount &&
+        padTo (header.lodOffset) &&
+        fwrite (lods, sizeof(AAPLMeshLod), lodCount, file) == lodCount;
+
+    success = (fclose (file) == 0) && success;
+    if (success)
+        success = rename (temporaryPath.c_str(), cachePath) == 0;
+    if (!success)
+        remove (temporaryPath.c_str());
+    return success;
+}
+
+// Maps a cache file and validates it against the expected source, loader options and data layout
+class AAPLObjMeshCacheReader
+{
+public:
+    AAPLObjMeshCacheReader (const char*                     cachePath,
+                            const AAPLObjMeshCacheSource&   expectedSource,
+                            const AAPLObjMeshCacheOptions&  expectedOptions,
+                            uint32_t                        expectedVertexStride) :
+    file (cachePath),
+    header (nullptr)
+    {
+        if (!file.isValid() || file.getSize() < sizeof(AAPLObjMeshCacheHeader))
+            return;
+
+        const AAPLObjMeshCacheHeader* candidate = (const AAPLObjMeshCacheHeader*) file.begin();
+        if (candidate->magic != kObjMeshCacheMagic ||
+            candidate->version != kObjMeshCacheVersion ||
+            candidate->vertexStride != expectedVertexStride ||
+            (candidate->indexStride != sizeof(uint16_t) && candidate->indexStride != sizeof(uint32_t)) ||
+            !(candidate->source == expectedSource) ||
+            !(candidate->options == expectedOptions))
+            return;
+
+        // Reject truncated files before handing out pointers into them
+        uint64_t vertexEnd = candidate->vertexOffset + candidate->vertexCount * candidate->vertexStride;
+        uint64_t indexEnd  = candidate->indexOffset + candidate->indexCount * candidate->indexStride;
+        uint64_t submeshEnd = candidate->submeshOffset + candidate->submeshCount * sizeof(AAPLObjSubmesh);
+        uint64_t lodEnd = candidate->lodOffset + candidate->lodCount * sizeof(AAPLMeshLod);
+        if (lodEnd > file.getSize() || candidate->vertexOffset < sizeof(AAPLObjMeshCacheHeader) ||
+            candidate->indexOffset < vertexEnd || candidate->submeshOffset < indexEnd || candidate->lodOffset < submeshEnd)
+            return;
+
+        header = candidate;
+    }
+
+    bool            isValid () const            { return header != nullptr; }
+    uint64_t        getVertexCount () const     { return header->vertexCount; }
+    uint64_t        getIndexCount () const      { return header->indexCount; }
+    uint32_t        getIndexStride () const     { return header->indexStride; }
+    uint64_t        getSubmeshCount () const    { return header->submeshCount; }
+    uint64_t        getLodCount () const        { return header->lodCount; }
+    float           getBoundingRadius () const  { return header->boundingRadius; }
+    const float*    getPositionOffset () const  { return header->positionOffset; }
+    const float*    getPositionScale () const   { return header->positionScale; }
+    const void*     getVertices () const        { return file.begin() + header->vertexOffset; }
+    const void*     getIndices () const         { return file.begin() + header->indexOffset; }
+    const AAPLObjSubmesh* getSubmeshes () const { return (const AAPLObjSubmesh*) (file.begin() + header->submeshOffset); }
+    const AAPLMeshLod* getLods () const         { return (const AAPLMeshLod*) (file.begin() + header->lodOffset); }
+    size_t          getVertexDataSize () const  { return (size_t) (header->vertexCount * header->vertexStride); }
+    size_t          getIndexDataSize () const   { return (size_t) (header->indexCount * header->indexStride); }
+
+private:
+    AAPLMappedFile                  file;
+    const AAPLObjMeshCacheHeader*   header;
+};
@@ -0,0 +1,131 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of AAPLSplitObjMesh, which breaks a mesh with 32-bit indices into submeshes that each
+ reference at most 64K vertices, so every submesh can be drawn with 16-bit indices and a base vertex.
+ Triangles keep their order; vertices shared by two submeshes are duplicated into both.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// Amount of distinct vertices a 16-bit index can address
+static constexpr uint32_t kObjMaxVerticesPer16BitMesh = 65536;
+
+// A range of a mesh's index buffer, drawn with `baseVertex` added to each of its indices
+struct AAPLObjSubmesh
+{
+    uint32_t    indexStart;
+    uint32_t    indexCount;
+    uint32_t    baseVertex;
+    uint32_t    vertexCount;
+    float       boundingCenter[3];  // Bounding sphere of the vertices in the submesh
+    float       boundingRadius;
+};
+
+// Computes a bounding sphere around the AABB center of `vertexCount` vertices starting at `vertices`
+template <typename TVertex, typename TGetPosition>
+void AAPLComputeObjSubmeshBounds (const TVertex* vertices, uint32_t vertexCount, const TGetPosition& getPosition, AAPLObjSubmesh& submesh)
+{
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        const float* p = getPosition (vertices[v]);
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            lo[c] = std::min (lo[c], p[c]);
+            hi[c] = std::max (hi[c], p[c]);
+        }
+    }
+
+    float radiusSquared = 0.0f;
+    for (uint32_t c = 0; c < 3; c++)
+        submesh.boundingCenter[c] = vertexCount ? (lo[c] + hi[c]) * 0.5f : 0.0f;
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        const float* p = getPosition (vertices[v]);
+        float dx = p[0] - submesh.boundingCenter[0];
+        float dy = p[1] - submesh.boundingCenter[1];
+        float dz = p[2] - submesh.boundingCenter[2];
+        radiusSquared = std::max (radiusSquared, dx * dx + dy * dy + dz * dz);
+    }
+    submesh.boundingRadius = sqrtf (radiusSquared);
+}
+
+// Splits the triangle list `indices` over `vertices` into submeshes of at most `maxVertices` vertices.
+// The submesh vertices are written consecutively to `outVertices`, and `outIndices` holds the
+//  triangles in their original order, relative to the base vertex of their submesh.
+// `getPosition (vertex)` returns a pointer to the 3 position floats of a vertex.
+template <typename TVertex, typename TGetPosition>
+void AAPLSplitObjMesh (const std::vector<TVertex>&      vertices,
+                       const std::vector<uint32_t>&     indices,
+                       const TGetPosition&              getPosition,
+                       std::vector<TVertex>&            outVertices,
+                       std::vector<uint16_t>&           outIndices,
+                       std::vector<AAPLObjSubmesh>&     outSubmeshes,
+                       uint32_t                         maxVertices = kObjMaxVerticesPer16BitMesh)
+{
+    assert (indices.size() % 3 == 0);
+    assert (maxVertices >= 3 && maxVertices <= kObjMaxVerticesPer16BitMesh);
+
+    // Local index of every source vertex, valid when its stamp matches the current submesh
+    std::vector<uint32_t> localIndex (vertices.size());
+    std::vector<uint32_t> stamp (vertices.size(), UINT32_MAX);
+
+    outVertices.clear();
+    outIndices.clear();
+    outSubmeshes.clear();
+    outVertices.reserve (vertices.size());
+    outIndices.reserve (indices.size());
+
+    auto beginSubmesh = [&] ()
+    {
+        AAPLObjSubmesh submesh = {};
+        submesh.indexStart = (uint32_t) outIndices.size();
+        submesh.baseVertex = (uint32_t) outVertices.size();
+        outSubmeshes.push_back (submesh);
+    };
+
+    uint32_t submeshIndex = 0;
+    beginSubmesh();
+    for (size_t t = 0; t < indices.size(); t += 3)
+    {
+        // Close the submesh if the new vertices of this triangle would not fit
+        uint32_t newVertices = 0;
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            uint32_t index = indices[t + c];
+            bool seenEarlierInTriangle = (c > 0 && indices[t] == index) || (c > 1 && indices[t + 1] == index);
+            newVertices += (stamp[index] != submeshIndex && !seenEarlierInTriangle) ? 1 : 0;
+        }
+        if (outSubmeshes.back().vertexCount + newVertices > maxVertices)
+        {
+            submeshIndex++;
+            beginSubmesh();
+        }
+
+        AAPLObjSubmesh& submesh = outSubmeshes.back();
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            uint32_t index = indices[t + c];
+            if (stamp[index] != submeshIndex)
+            {
+                stamp[index] = submeshIndex;
+                localIndex[index] = submesh.vertexCount++;
+                outVertices.push_back (vertices[index]);
+            }
+            outIndices.push_back ((uint16_t) localIndex[index]);
+        }
+        submesh.indexCount += 3;
+    }
+
+    for (AAPLObjSubmesh& submesh : outSubmeshes)
+        AAPLComputeObjSubmeshBounds (&outVertices[submesh.baseVertex], submesh.vertexCount, getPosition, submesh);
+}
@@ -0,0 +1,213 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLObjParser helpers: file mapping, SIMD line scanning and number parsing.
+*/
+
+#include "AAPLObjParser.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+AAPLMappedFile::AAPLMappedFile (const char* path) :
+data (nullptr),
+size (0),
+isOpen (false)
+{
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat (fd, &st) == 0)
+    {
+        isOpen = true;
+        size = (size_t) st.st_size;
+        if (size > 0)
+        {
+            void* mapping = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                // The file is read front to back exactly once
+                madvise (mapping, size, MADV_SEQUENTIAL);
+                data = (const char*) mapping;
+            }
+            else
+            {
+                isOpen = false;
+                size = 0;
+            }
+        }
+    }
+    close (fd);
+}
+
+AAPLMappedFile::~AAPLMappedFile ()
+{
+    if (data != nullptr)
+        munmap ((void*) data, size);
+}
+
+const char* AAPLObjFindLineEnd (const char* begin, const char* end)
+{
+    const char* c = begin;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8 ('\n');
+    for (; end - c >= 16; c += 16)
+    {
+        int mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*) c), newline));
+        if (mask != 0)
+            return c + __builtin_ctz (mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t newline = vdupq_n_u8 ('\n');
+    for (; end - c >= 16; c += 16)
+    {
+        // Narrow the 16 byte compare result to a 64-bit mask holding 4 bits per byte
+        uint8x16_t eq = vceqq_u8 (vld1q_u8 ((const uint8_t*) c), newline);
+        uint64_t mask = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+        if (mask != 0)
+            return c + (__builtin_ctzll (mask) >> 2);
+    }
+#endif
+    for (; c < end; c++)
+    {
+        if (*c == '\n')
+            return c;
+    }
+    return end;
+}
+
+bool AAPLObjParseInt (const char*& cursor, const char* end, int64_t& outValue)
+{
+    const char* c = cursor;
+    while (c < end && (*c == ' ' || *c == '\t')) c++;
+
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+'))
+        negative = (*c++ == '-');
+
+    const char* digits = c;
+    int64_t value = 0;
+    for (; c < end && (unsigned) (*c - '0') < 10 && c - digits < 18; c++)
+        value = value * 10 + (*c - '0');
+
+    if (c == digits)
+        return false;
+
+    outValue = negative ? -value : value;
+    cursor = c;
+    return true;
+}
+
+// Powers of ten that are exactly representable as a double
+static const double kExactPowersOfTen[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Slow path; strtof needs a terminated string so copy the token into a local buffer
+static bool ParseFloatWithStrtof (const char*& cursor, const char* end, float& outValue)
+{
+    char token[64];
+    size_t length = 0;
+    while (cursor + length < end && length < sizeof(token) - 1 &&
+           cursor[length] != ' ' && cursor[length] != '\t' && cursor[length] != '\r' && cursor[length] != '\n')
+    {
+        token[length] = cursor[length];
+        length++;
+    }
+    token[length] = 0;
+
+    char* tokenEnd = nullptr;
+    float value = strtof (token, &tokenEnd);
+    if (tokenEnd == token)
+        return false;
+
+    outValue = value;
+    cursor += tokenEnd - token;
+    return true;
+}
+
+bool AAPLObjParseFloat (const char*& cursor, const char* end, float& outValue)
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++;
+
+    const char* c = cursor;
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+'))
+        negative = (*c++ == '-');
+
+    // Accumulate up to 19 significant digits exactly in an integer mantissa
+    uint64_t mantissa = 0;
+    int digitCount = 0;
+    int exponent = 0;
+    const char* digitsBegin = c;
+    for (; c < end && (unsigned) (*c - '0') < 10; c++, digitCount++)
+        mantissa = mantissa * 10 + (*c - '0');
+
+    bool hasDigits = c != digitsBegin;
+    if (c < end && *c == '.')
+    {
+        const char* fraction = ++c;
+        for (; c < end && (unsigned) (*c - '0') < 10; c++, digitCount++)
+            mantissa = mantissa * 10 + (*c - '0');
+        exponent -= (int) (c - fraction);
+        hasDigits |= c != fraction;
+    }
+
+    // Anything unusual (inf, nan, hex floats, leading dots without digits) is left to strtof
+    if (!hasDigits)
+        return ParseFloatWithStrtof (cursor, end, outValue);
+
+    if (c < end && (*c == 'e' || *c == 'E'))
+    {
+        const char* e = c + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negativeExponent = (*e++ == '-');
+        int value = 0;
+        const char* exponentDigits = e;
+        for (; e < end && (unsigned) (*e - '0') < 10; e++)
+            value = value < 10000 ? value * 10 + (*e - '0') : value;
+        if (e != exponentDigits)
+        {
+            exponent += negativeExponent ? -value : value;
+            c = e;
+        }
+    }
+
+    // Clinger's fast path: with a mantissa below 2^53 and |exponent| <= 22 a single IEEE multiply or
+    //  divide yields the correctly rounded double. Rounding that double to float is only ambiguous
+    //  when it lands exactly on a float halfway point, which we detect and leave to strtof.
+    if (digitCount <= 19 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double value = (double) mantissa;
+        value = exponent < 0 ? value / kExactPowersOfTen[-exponent] : value * kExactPowersOfTen[exponent];
+
+        uint64_t bits;
+        memcpy (&bits, &value, sizeof(bits));
+        const uint64_t halfwayMask = (1ull << 29) - 1;
+        bool isHalfway = (bits & halfwayMask) == (1ull << 28);
+        bool isNormalFloat = value == 0.0 || (value >= 1.17549435e-38 && value <= 3.40282346e38);
+        if (!isHalfway && isNormalFloat)
+        {
+            outValue = (float) (negative ? -value : value);
+            cursor = c;
+            return true;
+        }
+    }
+    return ParseFloatWithStrtof (cursor, end, outValue);
+}
@@ -0,0 +1,211 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLObjParser, a portable OBJ tokenizer.
+ The parser works directly on a memory-mapped file: line boundaries are located with SIMD
+ compares and floats / face indices are decoded with a hand-written fast path, so no line
+ is ever copied. It has no Apple framework dependencies so it can be used by offline tools.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// One corner of a face, as 0-based indices into the position / texcoord / normal streams
+struct AAPLObjFaceCorner
+{
+    uint32_t position;
+    uint32_t texcoord;
+    uint32_t normal;
+};
+
+// Read-only view of a whole file; uses mmap where possible
+class AAPLMappedFile
+{
+public:
+    explicit AAPLMappedFile (const char* path);
+    ~AAPLMappedFile ();
+
+    AAPLMappedFile (const AAPLMappedFile&) = delete;
+    AAPLMappedFile& operator= (const AAPLMappedFile&) = delete;
+
+    bool            isValid () const    { return data != nullptr || (isOpen && size == 0); }
+    const char*     begin () const      { return data; }
+    const char*     end () const        { return data + size; }
+    size_t          getSize () const    { return size; }
+
+private:
+    const char*     data;
+    size_t          size;
+    bool            isOpen;
+};
+
+// Returns a pointer to the first '\n' in [begin, end), or end if there is none
+const char* AAPLObjFindLineEnd (const char* begin, const char* end);
+
+// Parses a float at `cursor`, skipping leading blanks. Returns false if no number was found.
+// The result is bit-identical to strtof; the fast path falls back to it for inputs it can't round exactly
+bool AAPLObjParseFloat (const char*& cursor, const char* end, float& outValue);
+
+// Parses a signed integer at `cursor`, skipping leading blanks
+bool AAPLObjParseInt (const char*& cursor, const char* end, int64_t& outValue);
+
+// Text OBJ files spend roughly 100 bytes per unique vertex on their v, vt, vn and face lines;
+//  dividing a file size by this smaller figure gives a vertex count estimate that rarely needs to grow
+static constexpr size_t kObjBytesPerVertexEstimate = 64;
+
+// Sizes of the attribute streams at some point in an OBJ file
+struct AAPLObjStreamCounts
+{
+    uint32_t positions;
+    uint32_t texcoords;
+    uint32_t normals;
+};
+
+class AAPLObjParser
+{
+public:
+    // Maximum corners per face; matches the loaders, which handle triangles and quads
+    static constexpr uint32_t kMaxFaceCorners = 4;
+
+    // Parses the OBJ text in [begin, end) and reports every recognized line to `visitor`:
+    //  - visitor.position (x, y, z)           for 'v' lines
+    //  - visitor.texcoord (x, y, z)           for 'vt' lines (z is 0 when omitted)
+    //  - visitor.normal (x, y, z)             for 'vn' lines
+    //  - visitor.face (corners, cornerCount)  for 'f' lines with 3 or 4 'v/vt/vn' corners
+    // `counts` are the stream sizes before `begin`; they are needed to validate face indices and
+    //  resolve negative (relative) ones when only a part of a file is parsed.
+    // Unrecognized and malformed lines are skipped, as they were with the sscanf based loader.
+    template <typename TVisitor>
+    static void parse (const char* begin, const char* end, TVisitor& visitor,
+                       AAPLObjStreamCounts counts = AAPLObjStreamCounts());
+
+    // Same as parse, but face lines are not decoded; instead visitor.faceLine (lineBegin, lineEnd, counts)
+    //  receives the line and the stream sizes (relative to `begin`) that are in effect for it, so the
+    //  faces can be decoded with parseFace once the sizes of the preceding chunks are known
+    template <typename TVisitor>
+    static void parseDeferringFaces (const char* begin, const char* end, TVisitor& visitor);
+
+    // Decodes the 'v/vt/vn' corners of a face line (with or without its leading 'f')
+    // Returns false if the line is malformed or references attributes outside `counts`
+    static bool parseFace (const char* begin, const char* end, const AAPLObjStreamCounts& counts,
+                           AAPLObjFaceCorner (&corners)[kMaxFaceCorners], uint32_t& cornerCount)
+    {
+        const char* c = skipBlanks (begin, end);
+        if (c < end && *c == 'f')
+            c++;
+
+        cornerCount = 0;
+        for (c = skipBlanks (c, end); c < end; c = skipBlanks (c, end))
+        {
+            int64_t p, t, n;
+            bool valid = cornerCount < kMaxFaceCorners &&
+                         AAPLObjParseInt (c, end, p) && c < end && *c++ == '/' &&
+                         AAPLObjParseInt (c, end, t) && c < end && *c++ == '/' &&
+                         AAPLObjParseInt (c, end, n) &&
+                         resolveIndex (p, counts.positions, corners[cornerCount].position) &&
+                         resolveIndex (t, counts.texcoords, corners[cornerCount].texcoord) &&
+                         resolveIndex (n, counts.normals,   corners[cornerCount].normal);
+            if (!valid)
+                return false;
+            cornerCount++;
+        }
+        return cornerCount >= 3;
+    }
+
+private:
+    template <bool kDeferFaces, typename TVisitor>
+    static void parseLines (const char* begin, const char* end, TVisitor& visitor, AAPLObjStreamCounts counts);
+
+    template <typename TVisitor>
+    static void handleFace (std::false_type, const char* begin, const char* end, TVisitor& visitor, const AAPLObjStreamCounts& counts)
+    {
+        AAPLObjFaceCorner corners[kMaxFaceCorners];
+        uint32_t cornerCount;
+        if (parseFace (begin, end, counts, corners, cornerCount))
+            visitor.face (corners, cornerCount);
+    }
+
+    template <typename TVisitor>
+    static void handleFace (std::true_type, const char* begin, const char* end, TVisitor& visitor, const AAPLObjStreamCounts& counts)
+    {
+        visitor.faceLine (begin, end, counts);
+    }
+
+    static const char* skipBlanks (const char* cursor, const char* end)
+    {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+        return cursor;
+    }
+
+    static bool parseFloat3 (const char*& cursor, const char* end, float (&v)[3], bool thirdIsOptional)
+    {
+        if (!AAPLObjParseFloat (cursor, end, v[0]) || !AAPLObjParseFloat (cursor, end, v[1])) return false;
+        if (AAPLObjParseFloat (cursor, end, v[2])) return true;
+        v[2] = 0.0f;
+        return thirdIsOptional;
+    }
+
+    // Resolves a 1-based (or negative, relative) OBJ index against the current stream size
+    static bool resolveIndex (int64_t index, uint32_t count, uint32_t& outIndex)
+    {
+        if (index > 0 && index <= count)        { outIndex = (uint32_t) (index - 1); return true; }
+        if (index < 0 && -index <= count)       { outIndex = (uint32_t) (count + index); return true; }
+        return false;
+    }
+};
+
+// Template inline implementations
+template <typename TVisitor>
+void AAPLObjParser::parse (const char* begin, const char* end, TVisitor& visitor, AAPLObjStreamCounts counts)
+{
+    parseLines<false> (begin, end, visitor, counts);
+}
+
+template <typename TVisitor>
+void AAPLObjParser::parseDeferringFaces (const char* begin, const char* end, TVisitor& visitor)
+{
+    parseLines<true> (begin, end, visitor, AAPLObjStreamCounts());
+}
+
+template <bool kDeferFaces, typename TVisitor>
+void AAPLObjParser::parseLines (const char* begin, const char* end, TVisitor& visitor, AAPLObjStreamCounts counts)
+{
+    for (const char* line = begin; line < end; )
+    {
+        const char* lineEnd = AAPLObjFindLineEnd (line, end);
+        const char* c       = skipBlanks (line, lineEnd);
+        const char* next    = lineEnd + (lineEnd < end ? 1 : 0);
+
+        if (lineEnd - c < 2)
+        {
+            line = next;
+            continue;
+        }
+
+        float v[3];
+        if (c[0] == 'v' && (c[1] == ' ' || c[1] == '\t'))
+        {
+            c += 1;
+            if (parseFloat3 (c, lineEnd, v, false)) { visitor.position (v[0], v[1], v[2]); counts.positions++; }
+        }
+        else if (c[0] == 'v' && c[1] == 't' && lineEnd - c > 2 && (c[2] == ' ' || c[2] == '\t'))
+        {
+            c += 2;
+            if (parseFloat3 (c, lineEnd, v, true)) { visitor.texcoord (v[0], v[1], v[2]); counts.texcoords++; }
+        }
+        else if (c[0] == 'v' && c[1] == 'n' && lineEnd - c > 2 && (c[2] == ' ' || c[2] == '\t'))
+        {
+            c += 2;
+            if (parseFloat3 (c, lineEnd, v, false)) { visitor.normal (v[0], v[1], v[2]); counts.normals++; }
+        }
+        else if (c[0] == 'f' && (c[1] == ' ' || c[1] == '\t'))
+        {
+            handleFace (std::integral_constant<bool, kDeferFaces>(), c, lineEnd, visitor, counts);
+        }
+        line = next;
+    }
+}
@@ -0,0 +1,216 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLParticlePagePool.
+*/
+
+#include "AAPLParticlePagePool.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+static uint32_t shiftOf (uint32_t value)
+{
+    uint32_t shift = 0;
+    while ((1u << shift) < value)
+        shift++;
+    return shift;
+}
+
+AAPLParticlePagePool::AAPLParticlePagePool (uint32_t inElementSize, uint32_t pageSize, uint32_t inMaxPageCount) :
+elementSize (inElementSize),
+pageShift (shiftOf (pageSize)),
+pageMask (pageSize - 1),
+maxPageCount (inMaxPageCount),
+residentPageCount (0),
+aliveCount (0),
+firstPageWithRoom (0)
+{
+    assert (elementSize > 0);
+    assert (pageSize >= 64 && (pageSize & (pageSize - 1)) == 0);
+    assert ((uint64_t) maxPageCount << pageShift <= UINT32_MAX);
+}
+
+bool AAPLParticlePagePool::isAlive (uint32_t slot) const
+{
+    const Page& page = pages[slot >> pageShift];
+    const uint32_t index = slot & pageMask;
+    return page.data && ((page.aliveMask[index >> 6] >> (index & 63)) & 1);
+}
+
+// Allocates a page under the lowest free number, or a new number when none is free
+uint32_t AAPLParticlePagePool::addPage ()
+{
+    uint32_t page = 0;
+    while (page < pages.size() && pages[page].data)
+        page++;
+    if (page == pages.size())
+        pages.emplace_back ();
+
+    Page& p = pages[page];
+    p.data.reset (new uint8_t[(size_t) elementSize << pageShift]);
+    p.aliveMask.assign ((1u << pageShift) / 64, 0);
+    p.aliveCount = 0;
+    residentPageCount++;
+
+    // The number may be one freed below the first page with room
+    firstPageWithRoom = std::min (firstPageWithRoom, page);
+    return page;
+}
+
+void AAPLParticlePagePool::freePage (uint32_t page)
+{
+    assert (pages[page].aliveCount == 0);
+    pages[page].data.reset ();
+    pages[page].aliveMask.clear ();
+    pages[page].aliveMask.shrink_to_fit ();
+    residentPageCount--;
+
+    while (!pages.empty() && !pages.back().data)
+        pages.pop_back();
+}
+
+// Marks up to `count` free slots of a resident page alive, lowest first
+uint32_t AAPLParticlePagePool::takeFreeSlots (uint32_t page, uint32_t count, uint32_t* outSlots)
+{
+    Page& p = pages[page];
+    uint32_t taken = 0;
+    for (uint32_t w = 0; w < p.aliveMask.size() && taken < count && p.aliveCount < (1u << pageShift); w++)
+    {
+        uint64_t free = ~p.aliveMask[w];
+        while (free && taken < count)
+        {
+            const uint32_t bit = (uint32_t) __builtin_ctzll (free);
+            free &= free - 1;
+            p.aliveMask[w] |= 1ull << bit;
+            outSlots[taken++] = (page << pageShift) | (w * 64 + bit);
+        }
+    }
+    p.aliveCount += taken;
+    aliveCount += taken;
+    return taken;
+}
+
+uint32_t AAPLParticlePagePool::allocate (uint32_t count, uint32_t* outSlots)
+{
+    const uint32_t pageSize = 1u << pageShift;
+    uint32_t allocated = 0;
+
+    for (uint32_t page = firstPageWithRoom; page < pages.size() && allocated < count; page++)
+    {
+        if (!pages[page].data || pages[page].aliveCount == pageSize)
+            continue;
+        allocated += takeFreeSlots (page, count - allocated, outSlots + allocated);
+    }
+
+    while (allocated < count && residentPageCount < maxPageCount)
+        allocated += takeFreeSlots (addPage (), count - allocated, outSlots + allocated);
+
+    // Every page below the last one taken from is now full, unless the pool ran out of slots
+    while (firstPageWithRoom < pages.size() &&
+           (!pages[firstPageWithRoom].data || pages[firstPageWithRoom].aliveCount == pageSize))
+        firstPageWithRoom++;
+
+    return allocated;
+}
+
+void AAPLParticlePagePool::release (const uint32_t* slots, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t page = slots[i] >> pageShift;
+        const uint32_t index = slots[i] & pageMask;
+        Page& p = pages[page];
+        assert (isAlive (slots[i]));
+
+        p.aliveMask[index >> 6] &= ~(1ull << (index & 63));
+        p.aliveCount--;
+        firstPageWithRoom = std::min (firstPageWithRoom, page);
+    }
+    aliveCount -= count;
+}
+
+uint32_t AAPLParticlePagePool::compact (float maxOccupancy, std::vector<AAPLParticlePageMove>& outMoves)
+{
+    const uint32_t pageSize = 1u << pageShift;
+    const uint32_t sparseLimit = (uint32_t) (std::max (0.0f, std::min (maxOccupancy, 1.0f)) * pageSize);
+
+    // Pages worth emptying, sparsest first and, among equals, the highest first so the low ones stay packed
+    std::vector<uint32_t> sparse;
+    uint32_t freeSlotCount = 0;
+    for (uint32_t page = 0; page < pages.size(); page++)
+    {
+        if (!pages[page].data)
+            continue;
+        freeSlotCount += pageSize - pages[page].aliveCount;
+        if (pages[page].aliveCount > 0 && pages[page].aliveCount <= sparseLimit)
+            sparse.push_back (page);
+    }
+    std::sort (sparse.begin(), sparse.end(), [this] (uint32_t a, uint32_t b)
+    {
+        return pages[a].aliveCount != pages[b].aliveCount ? pages[a].aliveCount < pages[b].aliveCount : a > b;
+    });
+
+    // A page can be emptied when the pages that are kept have room for it and for the ones before it.
+    //  Emptied pages take no particles, so their free slots do not count.
+    std::vector<uint8_t> emptied (pages.size(), 0);
+    uint32_t toMove = 0;
+    for (uint32_t page : sparse)
+    {
+        const uint32_t alive = pages[page].aliveCount;
+        const uint32_t roomLeft = freeSlotCount - (pageSize - alive);
+        if (toMove + alive > roomLeft)
+            break;
+        emptied[page] = 1;
+        freeSlotCount = roomLeft;
+        toMove += alive;
+    }
+
+    // Move the particles, filling the kept pages from the lowest
+    const size_t firstMove = outMoves.size();
+    uint32_t destination = 0;
+    for (uint32_t page : sparse)
+    {
+        if (!emptied[page])
+            break;
+
+        Page& source = pages[page];
+        for (uint32_t w = 0; w < source.aliveMask.size(); w++)
+        {
+            uint64_t alive = source.aliveMask[w];
+            while (alive)
+            {
+                const uint32_t bit = (uint32_t) __builtin_ctzll (alive);
+                alive &= alive - 1;
+
+                while (emptied[destination] || !pages[destination].data || pages[destination].aliveCount == pageSize)
+                    destination++;
+
+                uint32_t to = 0;
+                takeFreeSlots (destination, 1, &to);
+                const uint32_t from = (page << pageShift) | (w * 64 + bit);
+                memcpy (getSlotData (to), getSlotData (from), elementSize);
+                outMoves.push_back ({ from, to });
+            }
+            source.aliveMask[w] = 0;
+        }
+        aliveCount -= source.aliveCount;
+        source.aliveCount = 0;
+    }
+
+    for (uint32_t page = (uint32_t) pages.size(); page > 0; page--)
+    {
+        // Freeing a page trims the released pages at the end of the table
+        if (page - 1 < pages.size() && pages[page - 1].data && pages[page - 1].aliveCount == 0)
+            freePage (page - 1);
+    }
+
+    firstPageWithRoom = 0;
+    while (firstPageWithRoom < pages.size() &&
+           (!pages[firstPageWithRoom].data || pages[firstPageWithRoom].aliveCount == pageSize))
+        firstPageWithRoom++;
+
+    return (uint32_t) (outMoves.size() - firstMove);
+}
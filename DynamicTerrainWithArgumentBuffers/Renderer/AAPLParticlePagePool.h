@@ -0,0 +1,104 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLParticlePagePool, a particle pool that grows in fixed-size pages instead of being
+ one allocation of MAX_PARTICLES entries. A slot is addressed by its page and its index in the page; every
+ page keeps a mask and a count of its alive slots, so passes that spawn or animate particles can skip the
+ empty pages and walk only the set bits of the others. Slots are handed out first fit, from the lowest
+ page with room, which keeps the particles packed in the low pages. Compaction moves the particles of
+ sparse pages into the free slots of the others and releases the pages left empty; it reports every move
+ so the owner can patch the slot indices it keeps. The pool is not thread safe; allocations, releases
+ and compactions must not run concurrently. It has no Apple framework dependencies.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+struct AAPLParticlePageMove
+{
+    uint32_t    from;
+    uint32_t    to;
+};
+
+class AAPLParticlePagePool
+{
+public:
+    // Pages hold `pageSize` elements of `elementSize` bytes; `pageSize` must be a power of two of at least 64.
+    //  The pool never holds more than `maxPageCount` pages.
+    AAPLParticlePagePool (uint32_t elementSize, uint32_t pageSize, uint32_t maxPageCount);
+
+    AAPLParticlePagePool (const AAPLParticlePagePool&) = delete;
+    AAPLParticlePagePool& operator= (const AAPLParticlePagePool&) = delete;
+
+    // Writes up to `count` newly allocated slots to `outSlots`, adding pages as needed. Returns how many
+    //  were allocated, fewer than `count` only once the pool holds maxPageCount full pages.
+    uint32_t    allocate (uint32_t count, uint32_t* outSlots);
+
+    // Returns alive slots to the pool; their pages stay allocated until the next compaction
+    void        release (const uint32_t* slots, uint32_t count);
+
+    // Empties the sparsest pages holding at most `maxOccupancy` of a page of particles, as long as the
+    //  other pages have room for them, then frees every empty page. Appends the moves to `outMoves` and
+    //  returns their count. The element bytes are copied; the owner updates the indices it keeps.
+    uint32_t    compact (float maxOccupancy, std::vector<AAPLParticlePageMove>& outMoves);
+
+    uint32_t    getPageSize () const                        { return 1u << pageShift; }
+    uint32_t    getPageShift () const                       { return pageShift; }
+    uint32_t    getElementSize () const                     { return elementSize; }
+
+    // Pages are numbered in [0, getPageCount()); numbers of freed pages are reused by later growth
+    uint32_t    getPageCount () const                       { return (uint32_t) pages.size(); }
+    uint32_t    getResidentPageCount () const               { return residentPageCount; }
+    uint32_t    getCapacity () const                        { return residentPageCount << pageShift; }
+    uint32_t    getAliveCount () const                      { return aliveCount; }
+
+    bool        isPageResident (uint32_t page) const        { return pages[page].data != nullptr; }
+    uint32_t    getPageAliveCount (uint32_t page) const     { return pages[page].aliveCount; }
+
+    // getPageSize() / 64 words, bit i of word w set when slot w * 64 + i of the page is alive
+    const uint64_t* getPageAliveMask (uint32_t page) const  { return pages[page].aliveMask.data(); }
+
+    bool        isAlive (uint32_t slot) const;
+
+    // Elements of a resident page, getPageSize() * getElementSize() bytes
+    uint8_t*        getPageData (uint32_t page)             { return pages[page].data.get(); }
+    const uint8_t*  getPageData (uint32_t page) const       { return pages[page].data.get(); }
+
+    void*       getSlotData (uint32_t slot)
+    {
+        return pages[slot >> pageShift].data.get() + (size_t) (slot & pageMask) * elementSize;
+    }
+    const void* getSlotData (uint32_t slot) const
+    {
+        return pages[slot >> pageShift].data.get() + (size_t) (slot & pageMask) * elementSize;
+    }
+
+private:
+    struct Page
+    {
+        std::unique_ptr<uint8_t[]>  data;           // Null once the page is freed
+        std::vector<uint64_t>       aliveMask;
+        uint32_t                    aliveCount;
+    };
+
+    uint32_t    addPage ();
+    uint32_t    takeFreeSlots (uint32_t page, uint32_t count, uint32_t* outSlots);
+    void        freePage (uint32_t page);
+
+    const uint32_t          elementSize;
+    const uint32_t          pageShift;
+    const uint32_t          pageMask;
+    const uint32_t          maxPageCount;
+
+    std::vector<Page>       pages;
+    uint32_t                residentPageCount;
+    uint32_t                aliveCount;
+
+    // No page below this one has a free slot
+    uint32_t                firstPageWithRoom;
+};
@@ -11,6 +11,7 @@ Declaration of the AAPLParticleRenderer which is responsible for rendering parti
 #import <array>
 
 #import "AAPLAllocator.h"
+#import "AAPLParticleSimulation.h"
 #import "AAPLMainRenderer_shared.h"
 #import "AAPLTerrainRenderer_shared.h"
 #import "AAPLTerrainRenderer.h"
@@ -19,6 +20,9 @@ Declaration of the AAPLParticleRenderer which is responsible for rendering parti
 
 +(std::array <const TerrainHabitat::ParticleProperties*, 4>) GetParticleProperties;
 
+// The particle properties above, as the CPU particle simulation takes them
++(void) GetParticleHabitats: (AAPLParticleHabitat (&)[AAPLParticleSimulation::kHabitatCount]) outHabitats;
+
 #if TARGET_OS_OSX
 
 -(id) initWithDevice: (id <MTLDevice>)  device
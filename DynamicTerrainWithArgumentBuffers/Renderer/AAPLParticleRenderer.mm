@@ -440,4 +440,24 @@ MTKMesh* LoadParticleMesh (id <MTLDevice> device, NSString* path)
     return res;
 }
 
++(void) GetParticleHabitats: (AAPLParticleHabitat (&)[AAPLParticleSimulation::kHabitatCount]) outHabitats
+{
+    std::array <const TerrainHabitat::ParticleProperties*, 4> properties = [AAPLParticleRenderer GetParticleProperties];
+    for (uint32_t i = 0; i < AAPLParticleSimulation::kHabitatCount; i++)
+    {
+        const TerrainHabitat::ParticleProperties& src = *properties[i];
+        AAPLParticleHabitat& dst = outHabitats[i];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            dst.keyTimePoints[c] = src.keyTimePoints[c];
+            dst.scaleFactors[c] = src.scaleFactors[c];
+            dst.alphaFactors[c] = src.alphaFactors[c];
+        }
+        for (uint32_t c = 0; c < 3; c++)
+            dst.gravity[c] = src.gravity[c];
+        dst.doesCollide = src.doesCollide != 0;
+        dst.doesRotate = src.doesRotate != 0;
+    }
+}
+
 @end
@@ -14,7 +14,9 @@ Particle Renderer's uniforms that are shared between Metal / Objective-C.
 using namespace metal;
 #endif
 
-#define MAX_PARTICLES (int)(4096*4)
+// The particle buffers of the kernels hold this many particles up front; it is the most their 16 bit alive
+//  and unused indices address. AAPLParticleSimulation grows in pages instead, up to the count it is given.
+#define MAX_PARTICLES (int)(4096*16)
 #define PARTICLES_PER_THREADGROUP 128
 
 struct ParticleInstanceBufferDescription
@@ -0,0 +1,444 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLParticleSimulation.
+ The physics follows AnimateAndCleanupOldParticles in AAPLParticleRenderer.metal, keep them in sync. It is
+ split in loops over the arrays of a page: the integration, the forces and the fading are written without
+ branches so they vectorize, while the terrain lookups, the collision response and the rotation, which only
+ some habitats have, run in loops of their own. The results match the kernels up to the rounding
+ differences of Metal's fast math.
+*/
+
+#include "AAPLParticleSimulation.h"
+#include "AAPLTaskPool.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+static constexpr float kRestitution = 0.5f;
+static constexpr float kFriction    = 0.02f;
+static constexpr float kDrag        = 0.99f;
+
+static const float kIdentity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+struct Vec3
+{
+    float   x, y, z;
+};
+
+static inline Vec3  operator+ (Vec3 a, Vec3 b)      { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+static inline Vec3  operator- (Vec3 a, Vec3 b)      { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+static inline Vec3  operator* (Vec3 a, float s)     { return { a.x * s, a.y * s, a.z * s }; }
+static inline Vec3  operator* (float s, Vec3 a)     { return { a.x * s, a.y * s, a.z * s }; }
+static inline float dot (Vec3 a, Vec3 b)            { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline Vec3  cross (Vec3 a, Vec3 b)          { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+static inline Vec3  normalize (Vec3 a)              { return a * (1.0f / sqrtf (dot (a, a))); }
+
+// wang_hash of AAPLMainRendererUtilities.metal
+static inline uint32_t wangHash (uint32_t seed)
+{
+    seed = (seed ^ 61) ^ (seed >> 16);
+    seed *= 9;
+    seed = seed ^ (seed >> 4);
+    seed *= 0x27d4eb2d;
+    seed = seed ^ (seed >> 15);
+    return seed;
+}
+
+// smoothStep of the kernels, with every segment evaluated and the right one selected
+static inline float keyFrameValue (float time, const float keys[4], const float values[4])
+{
+    float value = values[3];
+    value = time < keys[3] ? (values[3] - values[2]) * ((time - keys[2]) / (keys[3] - keys[2])) + values[2] : value;
+    value = time < keys[2] ? (values[2] - values[1]) * ((time - keys[1]) / (keys[2] - keys[1])) + values[1] : value;
+    value = time < keys[1] ? (values[1] - values[0]) * (time / (keys[1] - keys[0])) + values[0] : value;
+    value = time < keys[0] ? values[0] : value;
+    return value;
+}
+
+// rotationMatrix of the kernels, column major
+static void rotationMatrix (Vec3 axis, float angle, float m[9])
+{
+    float s = sinf (angle);
+    float c = cosf (angle);
+    float oc = 1.0f - c;
+    m[0] = oc * axis.x * axis.x + c;
+    m[1] = oc * axis.x * axis.y - axis.z * s;
+    m[2] = oc * axis.z * axis.x + axis.y * s;
+    m[3] = oc * axis.x * axis.y + axis.z * s;
+    m[4] = oc * axis.y * axis.y + c;
+    m[5] = oc * axis.y * axis.z - axis.x * s;
+    m[6] = oc * axis.z * axis.x - axis.y * s;
+    m[7] = oc * axis.y * axis.z + axis.x * s;
+    m[8] = oc * axis.z * axis.z + c;
+}
+
+void AAPLParticleLanes::resize (size_t count)
+{
+    for (std::vector<float>* values : { &positionX, &positionY, &positionZ, &velocityX, &velocityY, &velocityZ,
+                                        &age, &scale, &sphereRadius, &opacity })
+        values->resize (count);
+    for (uint32_t i = 0; i < 9; i++)
+    {
+        orientation[i].resize (count);
+        angularVelocity[i].resize (count);
+    }
+    slot.resize (count);
+    habitat.resize (count);
+}
+
+AAPLParticleSimulation::AAPLParticleSimulation (uint32_t maxParticles, const AAPLParticleHabitat (&inHabitats)[kHabitatCount]) :
+maxPageCount ((maxParticles + kPageSize - 1) / kPageSize),
+particles (sizeof(AAPLParticle), kPageSize, maxPageCount)
+{
+    std::copy (inHabitats, inHabitats + kHabitatCount, habitats);
+}
+
+// Advances the particles in lanes [begin, end) by a frame, in place
+void AAPLParticleSimulation::animate (AAPLParticleLanes& p, uint32_t begin, uint32_t end, float* heights,
+                                      const AAPLParticleFrame& frame, const AAPLParticleTerrain& terrain) const
+{
+    const float dt = frame.frameTime;
+    const AAPLParticleHabitat* h = habitats;
+    float* __restrict px = p.positionX.data();
+    float* __restrict py = p.positionY.data();
+    float* __restrict pz = p.positionZ.data();
+    float* __restrict vx = p.velocityX.data();
+    float* __restrict vy = p.velocityY.data();
+    float* __restrict vz = p.velocityZ.data();
+    const uint8_t* habitat = p.habitat.data();
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        pz[i] += vz[i] * dt;
+    }
+
+    for (uint32_t i = begin; i < end; i++)
+        heights[i - begin] = terrain.heights->getHeight (px[i], pz[i]);
+
+    // Collisions; only particles touching the terrain take the long path
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const float terrainHeight = heights[i - begin];
+        if (!h[habitat[i]].doesCollide)
+        {
+            py[i] = terrainHeight;
+            continue;
+        }
+
+        const float radius = p.sphereRadius[i] * p.scale[i];
+        const float overlap = terrainHeight - (py[i] - radius);
+        if (overlap <= 0.0f)
+            continue;
+
+        // Calculating approximate world normal at point of collision
+        Vec3 worldPos0 = { px[i], terrainHeight, pz[i] };
+        Vec3 worldPos1 = { px[i] + 1.0f, terrain.heights->getHeight (px[i] + 1.0f, pz[i]), pz[i] };
+        Vec3 worldPos2 = { px[i], terrain.heights->getHeight (px[i], pz[i] + 1.0f), pz[i] + 1.0f };
+        Vec3 normal = normalize (cross (worldPos2 - worldPos0, worldPos1 - worldPos0));
+
+        Vec3 velocity = { vx[i], vy[i], vz[i] };
+        Vec3 bitangent = cross (normal, velocity);
+        Vec3 tangent;
+        if (fabsf (bitangent.x) > 0.001f || fabsf (bitangent.y) > 0.001f || fabsf (bitangent.z) > 0.001f)
+        {
+            bitangent = normalize (bitangent);
+            tangent = normalize (cross (normal, bitangent));
+        }
+        else
+        {
+            tangent = { 1, 0, 0 };
+        }
+
+        float nd = dot (velocity, normal);
+        float td = dot (velocity, tangent);
+
+        // Reflect
+        if (nd < 0.0f)
+            velocity = velocity - (1.0f + kRestitution) * nd * normal;
+
+        // Friction
+        velocity = velocity - td * tangent * kFriction;
+        vx[i] = velocity.x;
+        vy[i] = velocity.y;
+        vz[i] = velocity.z;
+
+        // Remove the overlap
+        py[i] += overlap;
+
+        // Base angular velocity on linear velocity during last ground contact
+        float angularSpeed = td / radius;
+        Vec3 rotationAxis = cross ({ 0, 1, 0 }, velocity);
+        if (fabsf (rotationAxis.x) < 0.0001f && fabsf (rotationAxis.y) < 0.0001f && fabsf (rotationAxis.z) < 0.0001f)
+            rotationAxis = { 0, 1, 0 };
+        else
+            rotationAxis = normalize (rotationAxis);
+
+        float m[9];
+        rotationMatrix (rotationAxis, angularSpeed * dt, m);
+        for (uint32_t e = 0; e < 9; e++)
+            p.angularVelocity[e][i] = m[e];
+    }
+
+    // orientation = angularVelocity * orientation for the rotating habitats
+    const uint32_t rotatingHabitats = (h[0].doesRotate ? 1 : 0) | (h[1].doesRotate ? 2 : 0) |
+                                      (h[2].doesRotate ? 4 : 0) | (h[3].doesRotate ? 8 : 0);
+    if (rotatingHabitats)
+    {
+        float* __restrict o[9];
+        const float* a[9];
+        for (uint32_t e = 0; e < 9; e++)
+        {
+            o[e] = p.orientation[e].data();
+            a[e] = p.angularVelocity[e].data();
+        }
+        for (uint32_t i = begin; i < end; i++)
+        {
+            if (!((rotatingHabitats >> habitat[i]) & 1))
+                continue;
+
+            float r[9];
+            for (uint32_t column = 0; column < 3; column++)
+            {
+                for (uint32_t row = 0; row < 3; row++)
+                {
+                    r[column * 3 + row] = a[row][i]     * o[column * 3][i] +
+                                          a[3 + row][i] * o[column * 3 + 1][i] +
+                                          a[6 + row][i] * o[column * 3 + 2][i];
+                }
+            }
+            for (uint32_t e = 0; e < 9; e++)
+                o[e][i] = r[e];
+        }
+    }
+
+    float* __restrict scale = p.scale.data();
+    float* __restrict opacity = p.opacity.data();
+    const float* age = p.age.data();
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const AAPLParticleHabitat& props = h[habitat[i]];
+        vx[i] = (vx[i] + props.gravity[0] * dt) * kDrag;
+        vy[i] = (vy[i] + props.gravity[1] * dt) * kDrag;
+        vz[i] = (vz[i] + props.gravity[2] * dt) * kDrag;
+        scale[i] = keyFrameValue (age[i], props.keyTimePoints, props.scaleFactors);
+        opacity[i] = keyFrameValue (age[i], props.keyTimePoints, props.alphaFactors);
+    }
+}
+
+// The particle of SpawnNewParticles thread spawnIndex + 1
+void AAPLParticleSimulation::spawn (AAPLParticle& particle, uint32_t spawnIndex, const AAPLParticleFrame& frame,
+                                    const AAPLParticleTerrain& terrain) const
+{
+    const float uintToUnitFloat = 1.0f / (float) 0xFFFFFFFFu;
+
+    uint32_t randSeed = (spawnIndex + 1) | ((uint32_t) ((frame.gameTime - floorf (frame.gameTime)) * 4194303) << 10);
+    randSeed = wangHash (randSeed);
+    const float randDist = powf ((float) randSeed * uintToUnitFloat, 0.5f);
+    randSeed = wangHash (randSeed);
+    const float randAngle = (float) randSeed * uintToUnitFloat * 2.0f * 3.14159265359f;
+    randSeed = wangHash (randSeed);
+    const float unitFloat = (float) randSeed * uintToUnitFloat;
+    const float initialRadius = unitFloat * 20.0f + 10.0f;
+    const float initialAge = unitFloat * 0.5f;
+
+    float x = frame.brushPosition[0] + cosf (randAngle) * frame.brushSize * 0.75f * randDist;
+    float z = frame.brushPosition[2] + sinf (randAngle) * frame.brushSize * 0.75f * randDist;
+    uint32_t habitat = std::min (terrain.habitatAt (x, z), (uint32_t) kHabitatCount - 1);
+    const AAPLParticleHabitat& props = habitats[habitat];
+
+    particle.habitat = habitat;
+    particle.position[0] = x;
+    particle.position[1] = terrain.heights->getHeight (x, z);
+    particle.position[2] = z;
+    particle.velocity[0] = 0.0f;
+    particle.velocity[1] = 0.0f;
+    particle.velocity[2] = 0.0f;
+    particle.opacity = 1.0f;
+    particle.age = initialAge * props.keyTimePoints[3];
+    particle.scale = props.scaleFactors[0];
+    particle.sphereRadius = initialRadius;
+    std::copy (kIdentity, kIdentity + 9, particle.orientation);
+    std::copy (kIdentity, kIdentity + 9, particle.angularVelocity);
+}
+
+void AAPLParticleSimulation::countPages ()
+{
+    const uint32_t pageCount = particles.getPageCount();
+    activePages.clear();
+    pageFirstAlive.resize (pageCount + 1);
+
+    uint32_t alive = 0;
+    for (uint32_t page = 0; page < pageCount; page++)
+    {
+        pageFirstAlive[page] = alive;
+        if (!particles.isPageResident (page) || particles.getPageAliveCount (page) == 0)
+            continue;
+        activePages.push_back (page);
+        alive += particles.getPageAliveCount (page);
+    }
+    pageFirstAlive[pageCount] = alive;
+}
+
+void AAPLParticleSimulation::updateAliveSlots ()
+{
+    countPages ();
+    aliveSlots.resize (particles.getAliveCount());
+
+    const uint32_t shift = particles.getPageShift();
+    for (uint32_t page : activePages)
+    {
+        const uint64_t* mask = particles.getPageAliveMask (page);
+        uint32_t* out = aliveSlots.data() + pageFirstAlive[page];
+        for (uint32_t w = 0; w < kPageSize / 64; w++)
+        {
+            for (uint64_t bits = mask[w]; bits; bits &= bits - 1)
+                *out++ = (page << shift) | (w * 64 + (uint32_t) __builtin_ctzll (bits));
+        }
+    }
+}
+
+uint32_t AAPLParticleSimulation::compact (float maxOccupancy, std::vector<AAPLParticlePageMove>& outMoves)
+{
+    const uint32_t moveCount = particles.compact (maxOccupancy, outMoves);
+    updateAliveSlots ();
+    return moveCount;
+}
+
+void AAPLParticleSimulation::step (const AAPLParticleFrame& frame, const AAPLParticleTerrain& terrain, AAPLTaskPool* pool)
+{
+    assert (terrain.heights && terrain.heights->isBuilt());
+
+    auto run = [pool] (uint32_t count, const std::function<void (uint32_t, uint32_t)>& task)
+    {
+        if (pool)
+        {
+            pool->parallelFor (count, task);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+                task (i, 0);
+        }
+    };
+
+    const uint32_t aliveCount = particles.getAliveCount();
+    const uint32_t maxParticles = getMaxParticles();
+
+    // The spawns are reserved up front: when even a full set of pages has no room for them, the particles
+    //  at the start of the alive list die to make some
+    const uint32_t spawnCount = std::min (frame.spawnCount, maxParticles);
+    const uint32_t killCount = aliveCount + spawnCount > maxParticles ? aliveCount + spawnCount - maxParticles : 0;
+
+    const uint32_t threadCount = pool ? pool->getThreadCount() : 1;
+    lanes.resize (threadCount);
+    terrainHeights.resize (threadCount);
+
+    countPages ();
+    dyingSlots.resize (aliveCount);
+    pageDeaths.resize (particles.getPageCount());
+
+    // Age and animate the particles of every page holding any. The ones that survive are gathered into the
+    //  lanes, the others are left for the slots to be freed below.
+    run ((uint32_t) activePages.size(), [&] (uint32_t task, uint32_t threadIndex)
+    {
+        const uint32_t page = activePages[task];
+        const uint64_t* mask = particles.getPageAliveMask (page);
+        const uint32_t firstAlive = pageFirstAlive[page];
+        const uint32_t shift = particles.getPageShift();
+
+        AAPLParticleLanes& p = lanes[threadIndex];
+        std::vector<float>& heights = terrainHeights[threadIndex];
+        p.resize (kPageSize);
+        heights.resize (kPageSize);
+
+        uint32_t survivors = 0, deaths = 0;
+        for (uint32_t w = 0; w < kPageSize / 64; w++)
+        {
+            for (uint64_t bits = mask[w]; bits; bits &= bits - 1)
+            {
+                const uint32_t slot = (page << shift) | (w * 64 + (uint32_t) __builtin_ctzll (bits));
+                const AAPLParticle& particle = getParticle (slot);
+                const float age = particle.age + frame.frameTime;
+                const uint32_t rank = firstAlive + survivors + deaths;
+                if (age >= habitats[particle.habitat].keyTimePoints[3] || rank < killCount)
+                {
+                    dyingSlots[firstAlive + deaths++] = slot;
+                    continue;
+                }
+
+                const uint32_t lane = survivors++;
+                p.slot[lane] = slot;
+                p.habitat[lane] = (uint8_t) particle.habitat;
+                p.positionX[lane] = particle.position[0];
+                p.positionY[lane] = particle.position[1];
+                p.positionZ[lane] = particle.position[2];
+                p.velocityX[lane] = particle.velocity[0];
+                p.velocityY[lane] = particle.velocity[1];
+                p.velocityZ[lane] = particle.velocity[2];
+                p.age[lane] = age;
+                p.scale[lane] = particle.scale;
+                p.sphereRadius[lane] = particle.sphereRadius;
+                p.opacity[lane] = particle.opacity;
+                for (uint32_t e = 0; e < 9; e++)
+                {
+                    p.orientation[e][lane] = particle.orientation[e];
+                    p.angularVelocity[e][lane] = particle.angularVelocity[e];
+                }
+            }
+        }
+        pageDeaths[page] = deaths;
+
+        animate (p, 0, survivors, heights.data(), frame, terrain);
+
+        for (uint32_t lane = 0; lane < survivors; lane++)
+        {
+            AAPLParticle& particle = *static_cast<AAPLParticle*> (particles.getSlotData (p.slot[lane]));
+            particle.position[0] = p.positionX[lane];
+            particle.position[1] = p.positionY[lane];
+            particle.position[2] = p.positionZ[lane];
+            particle.velocity[0] = p.velocityX[lane];
+            particle.velocity[1] = p.velocityY[lane];
+            particle.velocity[2] = p.velocityZ[lane];
+            particle.age = p.age[lane];
+            particle.scale = p.scale[lane];
+            particle.opacity = p.opacity[lane];
+            for (uint32_t e = 0; e < 9; e++)
+            {
+                particle.orientation[e] = p.orientation[e][lane];
+                particle.angularVelocity[e] = p.angularVelocity[e][lane];
+            }
+        }
+    });
+
+    for (uint32_t page : activePages)
+        particles.release (dyingSlots.data() + pageFirstAlive[page], pageDeaths[page]);
+
+    // Spawn thread i takes the i-th slot the pool hands out, first fit from the lowest page, which adds
+    //  pages once the resident ones are full
+    spawnSlots.resize (spawnCount);
+    const uint32_t allocated = particles.allocate (spawnCount, spawnSlots.data());
+    assert (allocated == spawnCount);
+    (void) allocated;
+
+    // The spawns run a task per page they fall in; the other pages are skipped
+    spawnRuns.clear();
+    for (uint32_t i = 0; i < spawnCount; i++)
+    {
+        if (i == 0 || (spawnSlots[i] >> particles.getPageShift()) != (spawnSlots[i - 1] >> particles.getPageShift()))
+            spawnRuns.push_back (i);
+    }
+    spawnRuns.push_back (spawnCount);
+
+    run ((uint32_t) spawnRuns.size() - 1, [&] (uint32_t spawnRun, uint32_t)
+    {
+        for (uint32_t i = spawnRuns[spawnRun]; i < spawnRuns[spawnRun + 1]; i++)
+            spawn (*static_cast<AAPLParticle*> (particles.getSlotData (spawnSlots[i])), i, frame, terrain);
+    });
+
+    updateAliveSlots ();
+}
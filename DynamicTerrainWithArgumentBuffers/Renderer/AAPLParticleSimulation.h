@@ -0,0 +1,161 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLParticleSimulation, a CPU backend for the particles with the semantics of the
+ AnimateAndCleanupOldParticles and SpawnNewParticles kernels, for headless simulation and as a reference.
+ The particles live in the pages of an AAPLParticlePagePool, which grows a page at a time up to the most
+ particles the simulation is created for, rather than being one allocation of that size. Particles age, die
+ past their last key time point or, once every page is full, to make room for new ones, bounce off or stick
+ to the terrain, and spawn around the brush. Each step works page by page and skips the empty pages: the
+ alive particles of a page are gathered into one array per value, so the integration runs over contiguous
+ arrays, and scattered back. Where the kernels append to their lists with atomics, in whatever order the
+ threads run, the backend frees and allocates slots between the passes, in page order, which needs neither
+ atomics nor locks and gives the same result for any number of threads.
+ It has no Apple framework dependencies.
+*/
+
+#pragma once
+
+#include "AAPLParticlePagePool.h"
+#include "AAPLTerrainHeightPyramid.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+class AAPLTaskPool;
+
+// The values of TerrainHabitat::ParticleProperties the simulation reads; AAPLParticleRenderer's
+//  GetParticleProperties holds the ones of the sample
+struct AAPLParticleHabitat
+{
+    float       keyTimePoints[4];       // Ages of the scale and alpha keys; particles die at the last one
+    float       scaleFactors[4];
+    float       alphaFactors[4];
+    float       gravity[3];             // Includes the weight
+    bool        doesCollide;            // Bounce off the terrain, rather than stick to its surface
+    bool        doesRotate;
+};
+
+struct AAPLParticleTerrain
+{
+    // Heights the particles spawn at and collide with; bilinear like the getHeight of the kernels
+    const AAPLTerrainHeightPyramid*             heights;
+
+    // Index of the habitat with the highest percentage at world position (x, z), as EvaluateTerrainAtLocation
+    //  rates them. Called from the threads of the task pool.
+    std::function<uint32_t (float x, float z)>  habitatAt;
+};
+
+// The parts of AAPLUniforms and of the mouse buffer the kernels read
+struct AAPLParticleFrame
+{
+    float       frameTime;
+    float       gameTime;
+    float       brushPosition[3];
+    float       brushSize;
+    uint32_t    spawnCount;             // numParticles of spawnParticleWithCommandBuffer
+};
+
+// ParticleData of the kernels, as the pages of the pool store it. The 3x3 matrices are column major.
+struct AAPLParticle
+{
+    float       orientation[9];
+    float       angularVelocity[9];
+    float       position[3];
+    float       velocity[3];
+    float       age;
+    float       scale;
+    float       sphereRadius;
+    float       opacity;
+    uint32_t    habitat;
+};
+
+// The alive particles of a page, one array per value, while a step works on them. The 3x3 matrices are
+//  column major, one array per element.
+struct AAPLParticleLanes
+{
+    std::vector<uint32_t>   slot;       // Slot of the particle in the pool
+    std::vector<uint8_t>    habitat;
+    std::vector<float>      positionX, positionY, positionZ;
+    std::vector<float>      velocityX, velocityY, velocityZ;
+    std::vector<float>      age;
+    std::vector<float>      scale;
+    std::vector<float>      sphereRadius;
+    std::vector<float>      opacity;
+    std::vector<float>      orientation[9];
+    std::vector<float>      angularVelocity[9];
+
+    void resize (size_t count);
+};
+
+class AAPLParticleSimulation
+{
+public:
+    static constexpr uint32_t kHabitatCount = 4;
+
+    // Particles per page of the pool. A step runs a task per page, whose lanes stay in the cache across the
+    //  loops that process them.
+    static constexpr uint32_t kPageSize = 1024;
+
+    // The pool grows up to `maxParticles`, rounded up to whole pages
+    AAPLParticleSimulation (uint32_t maxParticles, const AAPLParticleHabitat (&habitats)[kHabitatCount]);
+
+    // Simulates one frame like AnimateAndCleanupOldParticles followed by SpawnNewParticles. Pages of
+    //  particles run on the threads of `pool` when there is one.
+    void step (const AAPLParticleFrame& frame, const AAPLParticleTerrain& terrain, AAPLTaskPool* pool);
+
+    // Moves the particles of the pages holding at most `maxOccupancy` of a page into the others and frees
+    //  the pages left empty; see AAPLParticlePagePool::compact. Appends the moves to `outMoves` and returns
+    //  their count.
+    uint32_t                    compact (float maxOccupancy, std::vector<AAPLParticlePageMove>& outMoves);
+
+    uint32_t                    getMaxParticles () const    { return particles.getPageSize() * maxPageCount; }
+    uint32_t                    getCapacity () const        { return particles.getCapacity(); }
+    uint32_t                    getAliveCount () const      { return particles.getAliveCount(); }
+
+    // The slots of the alive particles in increasing order, like the alive list of the kernels
+    const std::vector<uint32_t>& getAliveSlots () const     { return aliveSlots; }
+
+    const AAPLParticle&         getParticle (uint32_t slot) const
+    {
+        return *static_cast<const AAPLParticle*> (particles.getSlotData (slot));
+    }
+
+    const AAPLParticlePagePool& getPagePool () const        { return particles; }
+
+private:
+    void        animate (AAPLParticleLanes& pageLanes, uint32_t begin, uint32_t end, float* terrainHeights,
+                         const AAPLParticleFrame& frame, const AAPLParticleTerrain& terrain) const;
+    void        spawn (AAPLParticle& particle, uint32_t spawnIndex, const AAPLParticleFrame& frame,
+                       const AAPLParticleTerrain& terrain) const;
+
+    // Counts the alive particles of the pages before each one into pageFirstAlive, and lists the pages
+    //  holding any into activePages
+    void        countPages ();
+    void        updateAliveSlots ();
+
+    const uint32_t                  maxPageCount;
+    AAPLParticleHabitat             habitats[kHabitatCount];
+
+    AAPLParticlePagePool            particles;
+    std::vector<uint32_t>           aliveSlots;
+
+    std::vector<uint32_t>           activePages;
+    std::vector<uint32_t>           pageFirstAlive;
+
+    // Slots of the particles that die during a step, at the alive particles before their page, and how
+    //  many die per page
+    std::vector<uint32_t>           dyingSlots;
+    std::vector<uint32_t>           pageDeaths;
+
+    // Spawned slots, and where the runs of them in the same page start
+    std::vector<uint32_t>           spawnSlots;
+    std::vector<uint32_t>           spawnRuns;
+
+    // Per thread scratch: the lanes of a page and the terrain heights under them
+    std::vector<AAPLParticleLanes>  lanes;
+    std::vector<std::vector<float>> terrainHeights;
+};
@@ -0,0 +1,164 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the counter-based random number generator
+ Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3") maps a 128-bit counter
+ and a 64-bit key to 4 random 32-bit values with 10 rounds of multiplies and xors. The key holds the
+ seed, the counter holds the stream index in its high half and the block index in its low half.
+ The batch fills run the rounds on several blocks side by side, in loops the compiler vectorizes.
+ Every sample builds on its own, without files from the others, so DeferredLighting and
+ DynamicTerrainWithArgumentBuffers each keep a copy of this file and of AAPLRandom.h; a change to one copy
+ belongs in both. AAPLRandomTest in DeferredLighting/Tests checks the Random123 known answers.
+*/
+
+#include "AAPLRandom.h"
+
+static const uint32_t kPhiloxM0 = 0xD2511F53;
+static const uint32_t kPhiloxM1 = 0xCD9E8D57;
+static const uint32_t kPhiloxW0 = 0x9E3779B9;
+static const uint32_t kPhiloxW1 = 0xBB67AE85;
+
+// Blocks generated side by side by the batch fills
+#define AAPL_RANDOM_BATCH 8
+
+static void philox(const uint32_t key[2], const uint32_t counter[4], uint32_t out[4])
+{
+    uint32_t k0 = key[0], k1 = key[1];
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+
+    for(int round = 0; round < 10; round++)
+    {
+        uint64_t p0 = (uint64_t)kPhiloxM0 * c0;
+        uint64_t p1 = (uint64_t)kPhiloxM1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += kPhiloxW0;
+        k1 += kPhiloxW1;
+    }
+
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// Blocks [block, block + AAPL_RANDOM_BATCH) of a stream, values of block b at out[4 * b] to out[4 * b + 3]
+static void philoxBatch(const uint32_t key[2], const uint32_t stream[2], uint64_t block,
+                        uint32_t out[4 * AAPL_RANDOM_BATCH])
+{
+    uint32_t c0[AAPL_RANDOM_BATCH], c1[AAPL_RANDOM_BATCH], c2[AAPL_RANDOM_BATCH], c3[AAPL_RANDOM_BATCH];
+    for(int lane = 0; lane < AAPL_RANDOM_BATCH; lane++)
+    {
+        c0[lane] = (uint32_t)(block + lane);
+        c1[lane] = (uint32_t)((block + lane) >> 32);
+        c2[lane] = stream[0];
+        c3[lane] = stream[1];
+    }
+
+    uint32_t k0 = key[0], k1 = key[1];
+    for(int round = 0; round < 10; round++)
+    {
+        for(int lane = 0; lane < AAPL_RANDOM_BATCH; lane++)
+        {
+            uint64_t p0 = (uint64_t)kPhiloxM0 * c0[lane];
+            uint64_t p1 = (uint64_t)kPhiloxM1 * c2[lane];
+            c0[lane] = (uint32_t)(p1 >> 32) ^ c1[lane] ^ k0;
+            c1[lane] = (uint32_t)p1;
+            c2[lane] = (uint32_t)(p0 >> 32) ^ c3[lane] ^ k1;
+            c3[lane] = (uint32_t)p0;
+        }
+        k0 += kPhiloxW0;
+        k1 += kPhiloxW1;
+    }
+
+    for(int lane = 0; lane < AAPL_RANDOM_BATCH; lane++)
+    {
+        out[4 * lane + 0] = c0[lane];
+        out[4 * lane + 1] = c1[lane];
+        out[4 * lane + 2] = c2[lane];
+        out[4 * lane + 3] = c3[lane];
+    }
+}
+
+static inline float floatFromBits(uint32_t bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+void AAPLRandomStreamInit(AAPLRandomStream *stream, uint64_t seed, uint64_t streamIndex)
+{
+    stream->key[0] = (uint32_t)seed;
+    stream->key[1] = (uint32_t)(seed >> 32);
+    stream->stream[0] = (uint32_t)streamIndex;
+    stream->stream[1] = (uint32_t)(streamIndex >> 32);
+    stream->block = 0;
+    stream->available = 0;
+}
+
+uint32_t AAPLRandomNextUInt(AAPLRandomStream *stream)
+{
+    if(stream->available == 0)
+    {
+        const uint32_t counter[4] = { (uint32_t)stream->block, (uint32_t)(stream->block >> 32),
+                                      stream->stream[0], stream->stream[1] };
+        philox(stream->key, counter, stream->values);
+        stream->block++;
+        stream->available = 4;
+    }
+    return stream->values[4 - stream->available--];
+}
+
+float AAPLRandomNextFloat(AAPLRandomStream *stream)
+{
+    return floatFromBits(AAPLRandomNextUInt(stream));
+}
+
+float AAPLRandomNextRange(AAPLRandomStream *stream, float min, float max)
+{
+    return AAPLRandomNextFloat(stream) * (max - min) + min;
+}
+
+uint32_t AAPLRandomNextBelow(AAPLRandomStream *stream, uint32_t bound)
+{
+    // Multiply and shift; the bias is below bound / 2^32
+    return (uint32_t)(((uint64_t)AAPLRandomNextUInt(stream) * bound) >> 32);
+}
+
+void AAPLRandomFillUInts(uint64_t seed, uint64_t streamIndex, uint64_t first, uint32_t *values, size_t count)
+{
+    const uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+    const uint32_t stream[2] = { (uint32_t)streamIndex, (uint32_t)(streamIndex >> 32) };
+    uint32_t batch[4 * AAPL_RANDOM_BATCH];
+
+    uint64_t block = first / 4;
+    uint32_t skip = (uint32_t)(first % 4);
+    while(count > 0)
+    {
+        philoxBatch(key, stream, block, batch);
+        size_t n = 4 * AAPL_RANDOM_BATCH - skip;
+        n = n < count ? n : count;
+        for(size_t i = 0; i < n; i++)
+            values[i] = batch[skip + i];
+
+        values += n;
+        count -= n;
+        block += AAPL_RANDOM_BATCH;
+        skip = 0;
+    }
+}
+
+void AAPLRandomFillFloats(uint64_t seed, uint64_t streamIndex, uint64_t first, float *values, size_t count)
+{
+    uint32_t bits[4 * AAPL_RANDOM_BATCH];
+    while(count > 0)
+    {
+        size_t n = count < 4 * AAPL_RANDOM_BATCH ? count : 4 * AAPL_RANDOM_BATCH;
+        AAPLRandomFillUInts(seed, streamIndex, first, bits, n);
+        for(size_t i = 0; i < n; i++)
+            values[i] = floatFromBits(bits[i]);
+
+        values += n;
+        count -= n;
+        first += n;
+    }
+}
@@ -0,0 +1,142 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLTaskPool.
+*/
+
+#include "AAPLTaskPool.h"
+
+AAPLTaskPool::AAPLTaskPool (uint32_t workerCount) :
+currentTask (nullptr),
+jobGeneration (0),
+activeWorkers (0),
+remainingTasks (0),
+isShuttingDown (false)
+{
+    if (workerCount == 0)
+    {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    // Queue 0 belongs to the thread that calls parallelFor
+    for (uint32_t i = 0; i <= workerCount; i++)
+        queues.emplace_back (new Queue);
+
+    for (uint32_t i = 1; i <= workerCount; i++)
+        workers.emplace_back (&AAPLTaskPool::workerMain, this, i);
+}
+
+AAPLTaskPool::~AAPLTaskPool ()
+{
+    {
+        std::lock_guard<std::mutex> lock (jobMutex);
+        isShuttingDown = true;
+    }
+    jobStarted.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void AAPLTaskPool::parallelFor (uint32_t count, const std::function<void (uint32_t, uint32_t)>& task)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            task (i, 0);
+        return;
+    }
+
+    // Deal the indices round-robin; neighbouring tasks tend to have similar cost so this balances
+    //  the initial distribution, and stealing takes care of the rest
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Queue& queue = *queues[i % queues.size()];
+        std::lock_guard<std::mutex> lock (queue.mutex);
+        queue.indices.push_back (i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (jobMutex);
+        currentTask = &task;
+        remainingTasks = count;
+        activeWorkers = (uint32_t) workers.size();
+        jobGeneration++;
+    }
+    jobStarted.notify_all();
+
+    runTasks (0);
+
+    // Wait for the workers to leave the job, after which `task` may go out of scope
+    std::unique_lock<std::mutex> lock (jobMutex);
+    jobFinished.wait (lock, [this] { return activeWorkers == 0; });
+    currentTask = nullptr;
+}
+
+void AAPLTaskPool::workerMain (uint32_t threadIndex)
+{
+    uint64_t seenGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock (jobMutex);
+            jobStarted.wait (lock, [&] { return isShuttingDown || jobGeneration != seenGeneration; });
+            if (isShuttingDown)
+                return;
+            seenGeneration = jobGeneration;
+        }
+
+        runTasks (threadIndex);
+
+        std::lock_guard<std::mutex> lock (jobMutex);
+        if (--activeWorkers == 0)
+            jobFinished.notify_all();
+    }
+}
+
+void AAPLTaskPool::runTasks (uint32_t threadIndex)
+{
+    uint32_t index;
+    while (remainingTasks.load (std::memory_order_acquire) > 0)
+    {
+        if (!popOrSteal (threadIndex, index))
+        {
+            // The last tasks are still running on other threads
+            std::this_thread::yield();
+            continue;
+        }
+        (*currentTask) (index, threadIndex);
+        remainingTasks.fetch_sub (1, std::memory_order_acq_rel);
+    }
+}
+
+bool AAPLTaskPool::popOrSteal (uint32_t threadIndex, uint32_t& outIndex)
+{
+    {
+        Queue& own = *queues[threadIndex];
+        std::lock_guard<std::mutex> lock (own.mutex);
+        if (!own.indices.empty())
+        {
+            outIndex = own.indices.back();
+            own.indices.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& victim = *queues[(threadIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock (victim.mutex);
+        if (!victim.indices.empty())
+        {
+            outIndex = victim.indices.front();
+            victim.indices.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
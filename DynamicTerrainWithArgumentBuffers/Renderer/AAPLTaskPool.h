@@ -0,0 +1,63 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLTaskPool, a small work-stealing thread pool.
+ Each worker owns a queue of task indices; it pops work from the back of its own queue and,
+ once that runs dry, steals from the front of the other queues. The thread calling
+ parallelFor takes part in the work, so a pool with zero workers simply runs serially.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AAPLTaskPool
+{
+public:
+    // A thread count of 0 creates one worker per hardware thread, minus the calling thread
+    explicit AAPLTaskPool (uint32_t workerCount = 0);
+    ~AAPLTaskPool ();
+
+    AAPLTaskPool (const AAPLTaskPool&) = delete;
+    AAPLTaskPool& operator= (const AAPLTaskPool&) = delete;
+
+    // Amount of threads executing a parallelFor, including the calling thread
+    uint32_t    getThreadCount () const { return (uint32_t) queues.size(); }
+
+    // Runs task (index, threadIndex) for every index in [0, count) and returns once all have completed.
+    // threadIndex is in [0, getThreadCount()) and is stable for the duration of one task, so it can
+    //  be used to address per-thread scratch data. Only one parallelFor may run at a time.
+    void        parallelFor (uint32_t count, const std::function<void (uint32_t, uint32_t)>& task);
+
+private:
+    struct Queue
+    {
+        std::mutex              mutex;
+        std::deque<uint32_t>    indices;
+    };
+
+    void        workerMain (uint32_t threadIndex);
+    void        runTasks (uint32_t threadIndex);
+    bool        popOrSteal (uint32_t threadIndex, uint32_t& outIndex);
+
+    std::vector<std::unique_ptr<Queue>>                 queues;
+    std::vector<std::thread>                            workers;
+
+    std::mutex                                          jobMutex;
+    std::condition_variable                             jobStarted;
+    std::condition_variable                             jobFinished;
+    const std::function<void (uint32_t, uint32_t)>*     currentTask;
+    uint64_t                                            jobGeneration;
+    uint32_t                                            activeWorkers;
+    std::atomic<uint32_t>                               remainingTasks;
+    bool                                                isShuttingDown;
+};
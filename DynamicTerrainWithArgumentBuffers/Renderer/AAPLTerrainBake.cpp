@@ -0,0 +1,428 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the CPU terrain bakes.
+ Every function follows its kernel in AAPLTerrainRenderer.metal, keep them in sync. The samplers of the
+ kernels use nearest filtering and clamp to the edge, which turns every height lookup into a read of a
+ clamped texel.
+*/
+
+#include "AAPLTerrainBake.h"
+#include "AAPLRandom.h"
+#include "AAPLTaskPool.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// AAPLTerrainRenderer_shared.h
+static constexpr float kTerrainScale        = 15000.0f;
+static constexpr float kTerrainHeight       = 4500.0f;
+static constexpr float kBakePadding         = 32.0f;
+
+// Candidates drawn for every blue noise sample
+static constexpr uint32_t kBestCandidateCount = 32;
+
+// Rows of the properties map baked by one task of AAPLBakeTerrainPropertiesMap
+static constexpr uint32_t kPropertiesRowsPerTask = 8;
+
+// Spacing of the 7x7 neighborhood the slope variance averages, in texels
+static constexpr float kVarianceSpacing     = 3.5f;
+
+static inline uint32_t levelSize (uint32_t size, uint32_t level)
+{
+    return std::max (size >> level, 1u);
+}
+
+// The texel nearest filtering hits at an offset of `d` texels from a texel center
+static inline int32_t texelOffset (float d)
+{
+    return (int32_t) floorf (0.5f + d);
+}
+
+AAPLTerrainBakedMaps::AAPLTerrainBakedMaps (uint32_t inWidth, uint32_t inHeight) :
+width (inWidth),
+height (inHeight)
+{
+    uint32_t levelCount = 1;
+    while ((std::max (width, height) >> levelCount) > 0)
+        levelCount++;
+
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        size_t texelCount = (size_t) levelSize (width, level) * levelSize (height, level);
+        normalLevels.push_back (std::vector<float> (texelCount * 4, 0.0f));
+        propertiesLevels.push_back (std::vector<float> (texelCount * 4, 0.0f));
+    }
+}
+
+AAPLTerrainBakeRegion AAPLGetTerrainBrushBakeRegion (float brushX, float brushZ, float brushSize, uint32_t width, uint32_t height)
+{
+    // TerrainKnl_UpdateHeightmap only changes the texels closer than two brush sizes to the cursor; like
+    //  it, both axes are scaled by the width
+    float minX = floorf (((brushX - 2.0f * brushSize) / kTerrainScale + 0.5f) * width) - kBakePadding;
+    float minY = floorf (((brushZ - 2.0f * brushSize) / kTerrainScale + 0.5f) * width) - kBakePadding;
+    float maxX = ceilf (((brushX + 2.0f * brushSize) / kTerrainScale + 0.5f) * width) + 1.0f + kBakePadding;
+    float maxY = ceilf (((brushZ + 2.0f * brushSize) / kTerrainScale + 0.5f) * width) + 1.0f + kBakePadding;
+
+    uint32_t x0 = (uint32_t) std::min (std::max (minX, 0.0f), (float) width);
+    uint32_t y0 = (uint32_t) std::min (std::max (minY, 0.0f), (float) height);
+    uint32_t x1 = (uint32_t) std::min (std::max (maxX, 0.0f), (float) width);
+    uint32_t y1 = (uint32_t) std::min (std::max (maxY, 0.0f), (float) height);
+    return { x0, y0, x1 - std::min (x0, x1), y1 - std::min (y0, y1) };
+}
+
+AAPLTerrainBakeRegion AAPLGetTerrainMipBakeRegion (const AAPLTerrainBakeRegion& region, uint32_t width, uint32_t height, uint32_t level)
+{
+    // A mip texel averages a 2x2 block of the level above
+    const uint32_t round = (1u << level) - 1;
+    uint32_t x0 = region.x >> level;
+    uint32_t y0 = region.y >> level;
+    uint32_t x1 = std::min ((region.x + region.width + round) >> level, levelSize (width, level));
+    uint32_t y1 = std::min ((region.y + region.height + round) >> level, levelSize (height, level));
+    return { x0, y0, x1 - std::min (x0, x1), y1 - std::min (y0, y1) };
+}
+
+void AAPLBakeTerrainNormals (const float* heights, uint32_t width, uint32_t height,
+                             const AAPLTerrainBakeRegion& region, float* normals)
+{
+    const float xzScale = kTerrainScale / width;
+    const float yScale = kTerrainHeight;
+
+    for (uint32_t y = region.y; y < region.y + region.height; y++)
+    {
+        const float* row  = heights + (size_t) y * width;
+        const float* up   = heights + (size_t) std::min (y + 1, height - 1) * width;
+        const float* down = heights + (size_t) (y > 0 ? y - 1 : 0) * width;
+
+        for (uint32_t x = region.x; x < region.x + region.width; x++)
+        {
+            float hCenter = row[x];
+            float hUp     = up[x];
+            float hDown   = down[x];
+            float hRight  = row[std::min (x + 1, width - 1)];
+            float hLeft   = row[x > 0 ? x - 1 : 0];
+
+            // The cross products of v_up, v_right, v_down and v_left summed, with their zero terms left out
+            float dUp    = (hUp    - hCenter) * yScale;
+            float dDown  = (hDown  - hCenter) * yScale;
+            float dRight = (hRight - hCenter) * yScale;
+            float dLeft  = (hLeft  - hCenter) * yScale;
+
+            float nx = xzScale * (dLeft - dRight) * 2.0f;
+            float ny = xzScale * xzScale * 4.0f;
+            float nz = xzScale * (dDown - dUp) * 2.0f;
+            float invLength = 1.0f / sqrtf (nx * nx + ny * ny + nz * nz);
+
+            // Written as n.xzy
+            float* texel = normals + ((size_t) y * width + x) * 4;
+            texel[0] = nx * invLength * 0.5f + 0.5f;
+            texel[1] = nz * invLength * 0.5f + 0.5f;
+            texel[2] = ny * invLength * 0.5f + 0.5f;
+            texel[3] = 1.0f;
+        }
+    }
+}
+
+void AAPLBakeTerrainProperties (const float* heights, uint32_t width, uint32_t height,
+                                const std::vector<AAPLTerrainBakeSample>& samples,
+                                const AAPLTerrainBakeRegion& region, float* properties)
+{
+    // Nearest filtering at the center of texel (x, y) offset by (dx, dy) texels
+    auto sample = [heights, width, height] (uint32_t x, uint32_t y, float dx, float dy)
+    {
+        int64_t sx = (int64_t) x + texelOffset (dx);
+        int64_t sy = (int64_t) y + texelOffset (dy);
+        sx = std::min (std::max (sx, (int64_t) 0), (int64_t) width - 1);
+        sy = std::min (std::max (sy, (int64_t) 0), (int64_t) height - 1);
+        return heights[sy * width + sx];
+    };
+
+    const float offset = kVarianceSpacing;
+
+    for (uint32_t y = region.y; y < region.y + region.height; y++)
+    for (uint32_t x = region.x; x < region.x + region.width; x++)
+    {
+        // Occlusion: the share of the samples below the texel
+        float hCenter = heights[(size_t) y * width + x] + 0.001f;
+        uint32_t visibleCount = 0;
+        for (const AAPLTerrainBakeSample& s : samples)
+        {
+            if (sample (x, y, s.x, s.y) < hCenter)
+                visibleCount++;
+        }
+        float occlusion = (float) visibleCount / (float) samples.size();
+
+        // Variance: how much higher the 7x7 neighborhood is on average
+        float center = heights[(size_t) y * width + x];
+        float total = 0.0f;
+        for (int j = -3; j <= 3; ++j)
+        {
+            for (int i = -3; i <= 3; ++i)
+            {
+                if (i == 0 && j == 0) continue;
+                total += sample (x, y, offset * i, offset * j) - center;
+            }
+        }
+        total = std::max (total, 0.0f);
+        total = total / ((7 * 7) - 1);
+        float variance = std::min (std::max (total * 2.0f, 0.0f), 1.0f);
+
+        float* texel = properties + ((size_t) y * width + x) * 4;
+        texel[0] = occlusion;
+        texel[1] = variance;
+    }
+}
+
+void AAPLDownsampleTerrainMip (const float* source, uint32_t sourceWidth, uint32_t sourceHeight,
+                               const AAPLTerrainBakeRegion& region, float* destination)
+{
+    const uint32_t width = std::max (sourceWidth / 2, 1u);
+
+    for (uint32_t y = region.y; y < region.y + region.height; y++)
+    {
+        const float* row0 = source + (size_t) std::min (y * 2,     sourceHeight - 1) * sourceWidth * 4;
+        const float* row1 = source + (size_t) std::min (y * 2 + 1, sourceHeight - 1) * sourceWidth * 4;
+
+        for (uint32_t x = region.x; x < region.x + region.width; x++)
+        {
+            const uint32_t x0 = std::min (x * 2,     sourceWidth - 1) * 4;
+            const uint32_t x1 = std::min (x * 2 + 1, sourceWidth - 1) * 4;
+
+            float* texel = destination + ((size_t) y * width + x) * 4;
+            for (uint32_t c = 0; c < 4; c++)
+                texel[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+        }
+    }
+}
+
+void AAPLBakeTerrainMaps (const float* heights,
+                          const std::vector<AAPLTerrainBakeSample>& samples,
+                          const AAPLTerrainBakeRegion& region,
+                          AAPLTerrainBakedMaps& maps)
+{
+    assert (region.x + region.width <= maps.width && region.y + region.height <= maps.height);
+
+    AAPLBakeTerrainNormals (heights, maps.width, maps.height, region, maps.normalLevels[0].data());
+    AAPLBakeTerrainProperties (heights, maps.width, maps.height, samples, region, maps.propertiesLevels[0].data());
+
+    for (uint32_t level = 1; level < maps.getLevelCount(); level++)
+    {
+        const AAPLTerrainBakeRegion levelRegion = AAPLGetTerrainMipBakeRegion (region, maps.width, maps.height, level);
+        const uint32_t sourceWidth = levelSize (maps.width, level - 1);
+        const uint32_t sourceHeight = levelSize (maps.height, level - 1);
+
+        AAPLDownsampleTerrainMip (maps.normalLevels[level - 1].data(), sourceWidth, sourceHeight,
+                                  levelRegion, maps.normalLevels[level].data());
+        AAPLDownsampleTerrainMip (maps.propertiesLevels[level - 1].data(), sourceWidth, sourceHeight,
+                                  levelRegion, maps.propertiesLevels[level].data());
+    }
+}
+
+static AAPLTerrainBakeSample randomDiskSample (AAPLRandomStream& random, float radius)
+{
+    float r = sqrtf (AAPLRandomNextFloat (&random)) * radius;
+    float theta = 2.0f * (float) M_PI * AAPLRandomNextFloat (&random);
+    return { cosf (theta) * r, sinf (theta) * r };
+}
+
+std::vector<AAPLTerrainBakeSample> AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling sampling,
+                                                                        uint32_t count, float radius, uint32_t seed)
+{
+    // Philox streams, so the sample sets do not depend on the rand() of the platform
+    AAPLRandomStream random;
+    AAPLRandomStreamInit (&random, seed, 0);
+    std::vector<AAPLTerrainBakeSample> samples;
+    samples.reserve (count);
+
+    while (samples.size() < count)
+    {
+        if (sampling == AAPLTerrainOcclusionSampling::Uniform)
+        {
+            samples.push_back (randomDiskSample (random, radius));
+            continue;
+        }
+
+        // Keep the candidate farthest from the samples so far; every prefix of the set stays evenly spread
+        AAPLTerrainBakeSample best = {};
+        float bestDistance = -1.0f;
+        for (uint32_t c = 0; c < kBestCandidateCount; c++)
+        {
+            AAPLTerrainBakeSample candidate = randomDiskSample (random, radius);
+            float nearest = FLT_MAX;
+            for (const AAPLTerrainBakeSample& sample : samples)
+            {
+                float dx = candidate.x - sample.x;
+                float dy = candidate.y - sample.y;
+                nearest = std::min (nearest, dx * dx + dy * dy);
+            }
+            if (nearest > bestDistance)
+            {
+                best = candidate;
+                bestDistance = nearest;
+            }
+        }
+        samples.push_back (best);
+    }
+    return samples;
+}
+
+// The conversion of unorm16 heights the offline bake matches
+static inline float unormToFloat (uint16_t value)
+{
+    return (float) value / 65535.0f;
+}
+
+// Adds one to the count of every texel whose occlusion sample, read from `source`, is visible. Written
+//  without branches over restrict qualified arrays so it vectorizes
+static void countVisibleSamples (uint32_t                   count,
+                                 const uint16_t*            source,
+                                 const uint16_t*            visibleMax,
+                                 uint16_t* __restrict       counts)
+{
+    for (uint32_t x = 0; x < count; x++)
+        counts[x] += source[x] <= visibleMax[x] ? 1 : 0;
+}
+
+static void accumulateVariance (uint32_t                    count,
+                                const uint16_t*             source,
+                                const float*                centers,
+                                float* __restrict           totals)
+{
+    for (uint32_t x = 0; x < count; x++)
+        totals[x] += unormToFloat (source[x]) - centers[x];
+}
+
+static inline uint8_t floatToUnorm8 (float value)
+{
+    return (uint8_t) lrintf (std::min (std::max (value, 0.0f), 1.0f) * 255.0f);
+}
+
+void AAPLBakeTerrainPropertiesMap (const uint16_t* heights, uint32_t width, uint32_t height, uint32_t channelCount,
+                                   const std::vector<AAPLTerrainBakeSample>& samples,
+                                   uint8_t* properties, AAPLTaskPool* pool)
+{
+    assert (!samples.empty() && samples.size() <= UINT16_MAX);
+
+    // Texel offsets of the occlusion samples and of the variance neighborhood, like the samples of
+    //  AAPLBakeTerrainProperties hit them
+    std::vector<int32_t> sampleOffsetsX, sampleOffsetsY;
+    int32_t varianceOffsets[7];
+    int32_t padding = 0;
+    for (const AAPLTerrainBakeSample& sample : samples)
+    {
+        sampleOffsetsX.push_back (texelOffset (sample.x));
+        sampleOffsetsY.push_back (texelOffset (sample.y));
+        padding = std::max (padding, abs (sampleOffsetsX.back()));
+    }
+    for (int i = -3; i <= 3; i++)
+    {
+        varianceOffsets[i + 3] = texelOffset (kVarianceSpacing * i);
+        padding = std::max (padding, abs (varianceOffsets[i + 3]));
+    }
+
+    // The first channel, with every row extended by `padding` copies of its edge texels on both sides, so
+    //  rows of samples are contiguous reads; rows out of the map clamp to the edge rows
+    const size_t stride = width + 2 * (size_t) padding;
+    std::vector<uint16_t> padded (stride * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < stride; x++)
+        {
+            int64_t source = std::min (std::max ((int64_t) x - padding, (int64_t) 0), (int64_t) width - 1);
+            padded[y * stride + x] = heights[((size_t) y * width + source) * channelCount];
+        }
+    }
+    auto paddedRow = [&padded, stride, padding, height] (int64_t y, int32_t offsetX)
+    {
+        y = std::min (std::max (y, (int64_t) 0), (int64_t) height - 1);
+        return &padded[y * stride + padding + offsetX];
+    };
+
+    // A sample is visible below the center height plus 0.001. The conversion to float never decreases, so for
+    //  every center height that is every unorm16 height up to some largest one, found here once for all of them
+    std::vector<uint16_t> visibleMaxOfHeight (UINT16_MAX + 1);
+    uint32_t visibleCount = 0;
+    for (uint32_t center = 0; center <= UINT16_MAX; center++)
+    {
+        const float threshold = unormToFloat ((uint16_t) center) + 0.001f;
+        while (visibleCount <= UINT16_MAX && unormToFloat ((uint16_t) visibleCount) < threshold)
+            visibleCount++;
+        visibleMaxOfHeight[center] = (uint16_t) (visibleCount - 1);
+    }
+
+    struct Scratch
+    {
+        std::vector<uint16_t>   visibleMax, counts;
+        std::vector<float>      centers, totals;
+    };
+    std::vector<Scratch> scratches (pool ? pool->getThreadCount() : 1);
+    for (Scratch& scratch : scratches)
+    {
+        scratch.visibleMax.resize (width);
+        scratch.counts.resize (width);
+        scratch.centers.resize (width);
+        scratch.totals.resize (width);
+    }
+
+    // Each row runs every sample over all of its texels; the rows a band reads stay in the cache
+    auto bakeRows = [&] (uint32_t task, uint32_t threadIndex)
+    {
+        Scratch& scratch = scratches[threadIndex];
+        const uint32_t yEnd = std::min ((task + 1) * kPropertiesRowsPerTask, height);
+
+        for (uint32_t y = task * kPropertiesRowsPerTask; y < yEnd; y++)
+        {
+            const uint16_t* centerRow = paddedRow (y, 0);
+            for (uint32_t x = 0; x < width; x++)
+            {
+                scratch.visibleMax[x] = visibleMaxOfHeight[centerRow[x]];
+                scratch.centers[x] = unormToFloat (centerRow[x]);
+            }
+
+            std::fill (scratch.counts.begin(), scratch.counts.end(), 0);
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                countVisibleSamples (width, paddedRow ((int64_t) y + sampleOffsetsY[i], sampleOffsetsX[i]),
+                                     scratch.visibleMax.data(), scratch.counts.data());
+            }
+
+            // Summed in the order of the reference, so the totals are the same
+            std::fill (scratch.totals.begin(), scratch.totals.end(), 0.0f);
+            for (int j = 0; j < 7; j++)
+            {
+                for (int i = 0; i < 7; i++)
+                {
+                    if (i == 3 && j == 3) continue;
+                    accumulateVariance (width, paddedRow ((int64_t) y + varianceOffsets[j], varianceOffsets[i]),
+                                        scratch.centers.data(), scratch.totals.data());
+                }
+            }
+
+            uint8_t* texel = properties + (size_t) y * width * 4;
+            for (uint32_t x = 0; x < width; x++, texel += 4)
+            {
+                float occlusion = (float) scratch.counts[x] / (float) samples.size();
+                float total = std::max (scratch.totals[x], 0.0f) / ((7 * 7) - 1);
+                float variance = std::min (std::max (total * 2.0f, 0.0f), 1.0f);
+
+                texel[0] = floatToUnorm8 (occlusion);
+                texel[1] = floatToUnorm8 (variance);
+            }
+        }
+    };
+
+    const uint32_t taskCount = (height + kPropertiesRowsPerTask - 1) / kPropertiesRowsPerTask;
+    if (pool)
+    {
+        pool->parallelFor (taskCount, bakeRows);
+    }
+    else
+    {
+        for (uint32_t task = 0; task < taskCount; task++)
+            bakeRows (task, 0);
+    }
+}
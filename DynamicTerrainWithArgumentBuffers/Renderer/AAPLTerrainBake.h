@@ -0,0 +1,93 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of a portable CPU implementation of the terrain bakes: the normal map, the properties map
+ (occlusion and slope variance) and their mip chains, over the whole map or only the region a brush
+ stroke changed. It mirrors TerrainKnl_ComputeBrushBakeRegions, TerrainKnl_ComputeNormalsFromHeightmap,
+ TerrainKnl_ComputeOcclusionAndSlopeFromHeightmap and TerrainKnl_DownsampleMip so the incremental rebakes
+ can be checked against full ones away from a GPU. The properties map also has a vectorized, multithreaded
+ bake of the whole map for offline asset builds. Nothing here depends on Metal or simd.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class AAPLTaskPool;
+
+// Texels of one mip level; the origin and size of TerrainBakeRegion
+struct AAPLTerrainBakeRegion
+{
+    uint32_t    x;
+    uint32_t    y;
+    uint32_t    width;
+    uint32_t    height;
+};
+
+// Offset of an occlusion sample, in texels
+struct AAPLTerrainBakeSample
+{
+    float       x;
+    float       y;
+};
+
+// The maps and all their mip levels, four float channels per texel like the GPU textures read back
+struct AAPLTerrainBakedMaps
+{
+    uint32_t                            width;
+    uint32_t                            height;
+    std::vector<std::vector<float>>     normalLevels;
+    std::vector<std::vector<float>>     propertiesLevels;
+
+    // Allocates the full mip chains, cleared to zero like the properties map before its first bake
+    AAPLTerrainBakedMaps (uint32_t width, uint32_t height);
+
+    uint32_t getLevelCount () const { return (uint32_t) normalLevels.size(); }
+};
+
+// The level 0 texels whose normals or properties change when a brush of `brushSize` world units at
+//  world position (brushX, brushZ) edits the height map, padded by TERRAIN_BAKE_PADDING
+AAPLTerrainBakeRegion AAPLGetTerrainBrushBakeRegion (float brushX, float brushZ, float brushSize, uint32_t width, uint32_t height);
+
+// The texels of mip level `level` that depend on `region` of level 0
+AAPLTerrainBakeRegion AAPLGetTerrainMipBakeRegion (const AAPLTerrainBakeRegion& region, uint32_t width, uint32_t height, uint32_t level);
+
+// The bake kernels, run over `region` of level 0. `heights` holds width * height normalized heights.
+//  Normal and property texels are four floats; the bake only writes the first two property channels.
+void AAPLBakeTerrainNormals (const float* heights, uint32_t width, uint32_t height,
+                             const AAPLTerrainBakeRegion& region, float* normals);
+void AAPLBakeTerrainProperties (const float* heights, uint32_t width, uint32_t height,
+                                const std::vector<AAPLTerrainBakeSample>& samples,
+                                const AAPLTerrainBakeRegion& region, float* properties);
+
+// Box filters `region` of a level from the level above it, which is sourceWidth by sourceHeight texels
+void AAPLDownsampleTerrainMip (const float* source, uint32_t sourceWidth, uint32_t sourceHeight,
+                               const AAPLTerrainBakeRegion& region, float* destination);
+
+// Bakes `region` of level 0 of both maps, then the parts of every mip level that depend on it
+void AAPLBakeTerrainMaps (const float* heights,
+                          const std::vector<AAPLTerrainBakeSample>& samples,
+                          const AAPLTerrainBakeRegion& region,
+                          AAPLTerrainBakedMaps& maps);
+
+// Distribution of the occlusion samples over their disk
+enum class AAPLTerrainOcclusionSampling
+{
+    Uniform,        // Independent uniformly distributed samples, what the renderer bakes with
+    BlueNoise,      // Mitchell's best candidate samples; evenly spread, so fewer of them reach the same error
+};
+
+// `count` occlusion sample offsets within `radius` texels. The sets only depend on the arguments, so offline
+//  bakes can reproduce the samples of the renderer.
+std::vector<AAPLTerrainBakeSample> AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling sampling,
+                                                                        uint32_t count, float radius, uint32_t seed);
+
+// Bakes the whole properties map from unorm16 heights, `channelCount` channels per texel of which the first
+//  is read, like the RG16 height map. The result is AAPLBakeTerrainProperties over the heights divided by
+//  65535, rounded to the RGBA8Unorm texels the kernel writes. Only the red and green channels of the width *
+//  height texels of `properties` are written. Bands of rows run on the threads of `pool` when there is one.
+void AAPLBakeTerrainPropertiesMap (const uint16_t* heights, uint32_t width, uint32_t height, uint32_t channelCount,
+                                   const std::vector<AAPLTerrainBakeSample>& samples,
+                                   uint8_t* properties, AAPLTaskPool* pool);
@@ -0,0 +1,425 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLTerrainHeightPyramid.
+ Rays are traced in grid space, where texel centers sit on integer coordinates and the map covers
+ [-0.5, size - 0.5]. Cell c spans [c, c + 1]; the first and last cells also cover the half texel to the
+ edge of the map, where linear filtering clamps to the edge texels. The traversal starts at the root,
+ descends into the nodes the ray reaches below their highest point, and climbs a level every time it steps
+ past a node. Along a cell the bilinear surface is quadratic in the ray distance, so the exact first hit is
+ a root of a quadratic. The ray math runs in double precision, which keeps the steps between node
+ boundaries exact enough to always make progress.
+*/
+
+#include "AAPLTerrainHeightPyramid.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+// Nudge along the ray, in cells, that places points on a node boundary in the node the ray enters
+static constexpr double kBoundaryNudge = 1e-7;
+
+// The cell of grid coordinate `coordinate` a ray moving along `direction` is in
+static inline uint32_t cellAt (double coordinate, double direction, uint32_t cellCount)
+{
+    if (direction > 0.0)
+        coordinate += kBoundaryNudge;
+    else if (direction < 0.0)
+        coordinate -= kBoundaryNudge;
+    double cell = floor (coordinate);
+    return (uint32_t) std::min (std::max (cell, 0.0), (double) (cellCount - 1));
+}
+
+// Smallest s in [0, length] with f (s) = f0 + p1 * s + p2 * s^2 <= 0, for f0 > 0
+static bool firstRootOfQuadratic (double f0, double p1, double p2, double length, double& outS)
+{
+    double s = length + 1.0;
+    if (p2 == 0.0)
+    {
+        if (p1 < 0.0)
+            s = -f0 / p1;
+    }
+    else
+    {
+        double discriminant = p1 * p1 - 4.0 * p2 * f0;
+        if (discriminant >= 0.0)
+        {
+            // Both roots without cancellation; f0 > 0 so neither is 0 and q is not either
+            double q = -0.5 * (p1 + copysign (sqrt (discriminant), p1));
+            double r0 = q / p2;
+            double r1 = f0 / q;
+            if (r0 > 0.0) s = std::min (s, r0);
+            if (r1 > 0.0) s = std::min (s, r1);
+        }
+    }
+
+    if (s <= length)
+    {
+        outS = s;
+        return true;
+    }
+
+    // Rounding can hide a root right at the end
+    if (f0 + (p1 + p2 * length) * length <= 0.0)
+    {
+        outS = length;
+        return true;
+    }
+    return false;
+}
+
+AAPLTerrainHeightPyramid::AAPLTerrainHeightPyramid (float inTerrainScale, float inTerrainHeight) :
+terrainScale (inTerrainScale),
+terrainHeight (inTerrainHeight),
+mapWidth (0),
+mapHeight (0),
+cellsX (0),
+cellsY (0),
+built (false)
+{
+}
+
+void AAPLTerrainHeightPyramid::build (const AAPLTerrainQuadtreeHeights& source)
+{
+    assert (source.width >= 2 && source.height >= 2);
+
+    mapWidth = source.width;
+    mapHeight = source.height;
+    cellsX = mapWidth - 1;
+    cellsY = mapHeight - 1;
+    heights.resize ((size_t) mapWidth * mapHeight);
+
+    levels.clear();
+    levelWidths.clear();
+    levelHeights.clear();
+    uint32_t width = cellsX;
+    uint32_t height = cellsY;
+    while (true)
+    {
+        levels.emplace_back ((size_t) width * height);
+        levelWidths.push_back (width);
+        levelHeights.push_back (height);
+        if (width == 1 && height == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    built = true;
+    update (source, 0, 0, mapWidth, mapHeight);
+}
+
+void AAPLTerrainHeightPyramid::update (const AAPLTerrainQuadtreeHeights& source, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    assert (built && source.width == mapWidth && source.height == mapHeight);
+
+    x1 = std::min (x1, mapWidth);
+    y1 = std::min (y1, mapHeight);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    const float toWorld = terrainHeight / 65535.0f;
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        const uint16_t* row = source.data + (size_t) y * mapWidth * source.channelCount;
+        float* destination = &heights[(size_t) y * mapWidth];
+        for (uint32_t x = x0; x < x1; x++)
+            destination[x] = row[x * source.channelCount] * toWorld;
+    }
+
+    // A texel is a corner of the cells on both sides of it
+    updateCells (x0 > 0 ? x0 - 1 : 0, y0 > 0 ? y0 - 1 : 0, std::min (x1, cellsX), std::min (y1, cellsY));
+}
+
+// Rebounds the cells in [cx0, cx1) x [cy0, cy1) and the nodes above them
+void AAPLTerrainHeightPyramid::updateCells (uint32_t cx0, uint32_t cy0, uint32_t cx1, uint32_t cy1)
+{
+    std::vector<Bounds>& cells = levels[0];
+    for (uint32_t cy = cy0; cy < cy1; cy++)
+    {
+        const float* row0 = &heights[(size_t) cy * mapWidth];
+        const float* row1 = row0 + mapWidth;
+        for (uint32_t cx = cx0; cx < cx1; cx++)
+        {
+            Bounds& bounds = cells[(size_t) cy * cellsX + cx];
+            bounds.minY = std::min (std::min (row0[cx], row0[cx + 1]), std::min (row1[cx], row1[cx + 1]));
+            bounds.maxY = std::max (std::max (row0[cx], row0[cx + 1]), std::max (row1[cx], row1[cx + 1]));
+        }
+    }
+
+    for (uint32_t level = 1; level < levels.size(); level++)
+    {
+        const std::vector<Bounds>& children = levels[level - 1];
+        const uint32_t childWidth = levelWidths[level - 1];
+        const uint32_t childHeight = levelHeights[level - 1];
+        const uint32_t width = levelWidths[level];
+
+        cx0 = cx0 / 2;
+        cy0 = cy0 / 2;
+        cx1 = (cx1 + 1) / 2;
+        cy1 = (cy1 + 1) / 2;
+        for (uint32_t y = cy0; y < cy1; y++)
+        {
+            for (uint32_t x = cx0; x < cx1; x++)
+            {
+                Bounds bounds = children[(size_t) (y * 2) * childWidth + x * 2];
+                for (uint32_t j = y * 2; j < std::min (y * 2 + 2, childHeight); j++)
+                {
+                    for (uint32_t i = x * 2; i < std::min (x * 2 + 2, childWidth); i++)
+                    {
+                        const Bounds& child = children[(size_t) j * childWidth + i];
+                        bounds.minY = std::min (bounds.minY, child.minY);
+                        bounds.maxY = std::max (bounds.maxY, child.maxY);
+                    }
+                }
+                levels[level][(size_t) y * width + x] = bounds;
+            }
+        }
+    }
+}
+
+// Grid coordinates where a node starts and ends; the edge nodes extend to the edges of the map
+float AAPLTerrainHeightPyramid::nodeLow (uint32_t node, uint32_t level) const
+{
+    return node == 0 ? -0.5f : (float) (node << level);
+}
+
+float AAPLTerrainHeightPyramid::nodeHigh (uint32_t node, uint32_t level, uint32_t cellCount) const
+{
+    uint32_t end = (node + 1) << level;
+    return end >= cellCount ? (float) cellCount + 0.5f : (float) end;
+}
+
+float AAPLTerrainHeightPyramid::getGridHeight (double gx, double gy) const
+{
+    gx = std::min (std::max (gx, 0.0), (double) cellsX);
+    gy = std::min (std::max (gy, 0.0), (double) cellsY);
+    uint32_t cx = std::min ((uint32_t) gx, cellsX - 1);
+    uint32_t cy = std::min ((uint32_t) gy, cellsY - 1);
+    float u = (float) (gx - cx);
+    float v = (float) (gy - cy);
+
+    const float* row0 = &heights[(size_t) cy * mapWidth];
+    const float* row1 = row0 + mapWidth;
+    float top = row0[cx] + (row0[cx + 1] - row0[cx]) * u;
+    float bottom = row1[cx] + (row1[cx + 1] - row1[cx]) * u;
+    return top + (bottom - top) * v;
+}
+
+float AAPLTerrainHeightPyramid::getHeight (float x, float z) const
+{
+    if (!built)
+        return 0.0f;
+    return getGridHeight ((x / terrainScale + 0.5) * mapWidth - 0.5, (z / terrainScale + 0.5) * mapHeight - 0.5);
+}
+
+void AAPLTerrainHeightPyramid::getSurfaceNormal (double gx, double gy, float normal[3]) const
+{
+    // Past the edge texel centers the surface is flat across the edge
+    uint32_t cx = std::min ((uint32_t) std::max (gx, 0.0), cellsX - 1);
+    uint32_t cy = std::min ((uint32_t) std::max (gy, 0.0), cellsY - 1);
+    float u = (float) std::min (std::max (gx - cx, 0.0), 1.0);
+    float v = (float) std::min (std::max (gy - cy, 0.0), 1.0);
+
+    const float* row0 = &heights[(size_t) cy * mapWidth];
+    const float* row1 = row0 + mapWidth;
+    float dhdu = (row0[cx + 1] - row0[cx]) * (1.0f - v) + (row1[cx + 1] - row1[cx]) * v;
+    float dhdv = (row1[cx] - row0[cx]) * (1.0f - u) + (row1[cx + 1] - row0[cx + 1]) * u;
+    if (gx < 0.0 || gx > cellsX) dhdu = 0.0f;
+    if (gy < 0.0 || gy > cellsY) dhdv = 0.0f;
+
+    // Slopes per world unit
+    float dhdx = dhdu * mapWidth / terrainScale;
+    float dhdz = dhdv * mapHeight / terrainScale;
+    float invLength = 1.0f / sqrtf (dhdx * dhdx + 1.0f + dhdz * dhdz);
+    normal[0] = -dhdx * invLength;
+    normal[1] = invLength;
+    normal[2] = -dhdz * invLength;
+}
+
+// Finds the first t in [t0, t1] where the ray is at or below the surface of a cell. The edge cells clamp the
+//  interpolation past the edge texel centers, which splits the ray into up to five pieces with different
+//  quadratics.
+bool AAPLTerrainHeightPyramid::intersectCell (uint32_t cx, uint32_t cy, const double origin[3], const double direction[3],
+                                              double t0, double t1, double& outT) const
+{
+    const float* row0 = &heights[(size_t) cy * mapWidth];
+    const float* row1 = row0 + mapWidth;
+    const double h00 = row0[cx];
+    const double a = row0[cx + 1] - h00;
+    const double b = row1[cx] - h00;
+    const double c = h00 - row0[cx + 1] - row1[cx] + row1[cx + 1];
+
+    double splits[6] = { t0 };
+    uint32_t splitCount = 1;
+    for (double edge : { 0.0, 1.0 })
+    {
+        if (direction[0] != 0.0)
+        {
+            double t = (cx + edge - origin[0]) / direction[0];
+            if (t > t0 && t < t1) splits[splitCount++] = t;
+        }
+        if (direction[2] != 0.0)
+        {
+            double t = (cy + edge - origin[2]) / direction[2];
+            if (t > t0 && t < t1) splits[splitCount++] = t;
+        }
+    }
+    for (uint32_t i = 2; i < splitCount; i++)
+    {
+        for (uint32_t j = i; j > 1 && splits[j] < splits[j - 1]; j--)
+            std::swap (splits[j], splits[j - 1]);
+    }
+    splits[splitCount] = t1;
+
+    for (uint32_t i = 0; i < splitCount; i++)
+    {
+        const double start = splits[i];
+        const double end = splits[i + 1];
+        if (end < start)
+            continue;
+
+        // u = u0 + du * s and v = v0 + dv * s, with s the distance from the start of the piece
+        const double middle = (start + end) * 0.5;
+        double u0 = origin[0] + direction[0] * start - cx;
+        double v0 = origin[2] + direction[2] * start - cy;
+        double du = direction[0];
+        double dv = direction[2];
+        const double uMiddle = u0 + du * (middle - start);
+        const double vMiddle = v0 + dv * (middle - start);
+        if (uMiddle < 0.0 || uMiddle > 1.0) { u0 = uMiddle < 0.0 ? 0.0 : 1.0; du = 0.0; }
+        if (vMiddle < 0.0 || vMiddle > 1.0) { v0 = vMiddle < 0.0 ? 0.0 : 1.0; dv = 0.0; }
+
+        // Ray height minus surface height
+        const double f0 = origin[1] + direction[1] * start - (h00 + a * u0 + b * v0 + c * u0 * v0);
+        if (f0 <= 0.0)
+        {
+            outT = start;
+            return true;
+        }
+        const double p1 = direction[1] - a * du - b * dv - c * (u0 * dv + du * v0);
+        const double p2 = -c * du * dv;
+
+        double s;
+        if (firstRootOfQuadratic (f0, p1, p2, end - start, s))
+        {
+            outT = start + s;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AAPLTerrainHeightPyramid::raycast (const float inOrigin[3], const float inDirection[3], float maxDistance, AAPLTerrainRayHit* outHit) const
+{
+    if (!built)
+        return false;
+
+    const double length = sqrt ((double) inDirection[0] * inDirection[0] +
+                                (double) inDirection[1] * inDirection[1] +
+                                (double) inDirection[2] * inDirection[2]);
+    if (length == 0.0)
+        return false;
+
+    // Grid space keeps the world distance as the ray parameter
+    const double origin[3] =
+    {
+        ((double) inOrigin[0] / terrainScale + 0.5) * mapWidth - 0.5,
+        inOrigin[1],
+        ((double) inOrigin[2] / terrainScale + 0.5) * mapHeight - 0.5,
+    };
+    const double direction[3] =
+    {
+        inDirection[0] / length / terrainScale * mapWidth,
+        inDirection[1] / length,
+        inDirection[2] / length / terrainScale * mapHeight,
+    };
+
+    // Clip the ray to the map, and to where it is not above the whole terrain for good
+    double tEnter = 0.0;
+    double tExit = maxDistance;
+    auto clip = [&tEnter, &tExit] (double o, double d, double lo, double hi)
+    {
+        if (d == 0.0)
+        {
+            if (o < lo || o > hi)
+                tExit = -1.0;
+            return;
+        }
+        double ta = (lo - o) / d;
+        double tb = (hi - o) / d;
+        tEnter = std::max (tEnter, std::min (ta, tb));
+        tExit = std::min (tExit, std::max (ta, tb));
+    };
+    clip (origin[0], direction[0], -0.5, mapWidth - 0.5);
+    clip (origin[2], direction[2], -0.5, mapHeight - 0.5);
+
+    const Bounds& root = levels.back()[0];
+    if (direction[1] < 0.0)
+        tEnter = std::max (tEnter, (root.maxY - origin[1]) / direction[1]);
+    else if (origin[1] > root.maxY)
+        return false;
+    else if (direction[1] > 0.0)
+        tExit = std::min (tExit, (root.maxY - origin[1]) / direction[1]);
+
+    if (tEnter > tExit)
+        return false;
+
+    const uint32_t topLevel = (uint32_t) levels.size() - 1;
+    uint32_t level = topLevel;
+    double t = tEnter;
+    while (true)
+    {
+        const uint32_t cx = cellAt (origin[0] + direction[0] * t, direction[0], cellsX);
+        const uint32_t cy = cellAt (origin[2] + direction[2] * t, direction[2], cellsY);
+        const uint32_t nx = cx >> level;
+        const uint32_t ny = cy >> level;
+        const Bounds& node = levels[level][(size_t) ny * levelWidths[level] + nx];
+
+        // Where the ray leaves the node
+        double tNode = tExit;
+        if (direction[0] > 0.0)      tNode = std::min (tNode, (nodeHigh (nx, level, cellsX) - origin[0]) / direction[0]);
+        else if (direction[0] < 0.0) tNode = std::min (tNode, (nodeLow (nx, level) - origin[0]) / direction[0]);
+        if (direction[2] > 0.0)      tNode = std::min (tNode, (nodeHigh (ny, level, cellsY) - origin[2]) / direction[2]);
+        else if (direction[2] < 0.0) tNode = std::min (tNode, (nodeLow (ny, level) - origin[2]) / direction[2]);
+        tNode = std::max (tNode, t);
+
+        const double lowestY = origin[1] + direction[1] * (direction[1] < 0.0 ? tNode : t);
+        if (lowestY <= node.maxY)
+        {
+            if (level > 0)
+            {
+                level--;
+                continue;
+            }
+
+            double tHit;
+            if (intersectCell (cx, cy, origin, direction, t, tNode, tHit))
+            {
+                const double gx = origin[0] + direction[0] * tHit;
+                const double gy = origin[2] + direction[2] * tHit;
+                outHit->distance = (float) tHit;
+                outHit->position[0] = (float) (((gx + 0.5) / mapWidth - 0.5) * terrainScale);
+                outHit->position[1] = (float) (origin[1] + direction[1] * tHit);
+                outHit->position[2] = (float) (((gy + 0.5) / mapHeight - 0.5) * terrainScale);
+                getSurfaceNormal (gx, gy, outHit->normal);
+                return true;
+            }
+        }
+
+        if (tNode >= tExit)
+            return false;
+        t = tNode;
+        level = std::min (level + 1, topLevel);
+    }
+}
+
+bool AAPLTerrainHeightPyramid::isLineOfSightClear (const float from[3], const float to[3]) const
+{
+    const float direction[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+    const float distance = sqrtf (direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+    AAPLTerrainRayHit hit;
+    return distance == 0.0f || !raycast (from, direction, distance, &hit);
+}
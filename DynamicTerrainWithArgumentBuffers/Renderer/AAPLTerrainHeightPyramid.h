@@ -0,0 +1,84 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLTerrainHeightPyramid, a CPU copy of the terrain heights with a min/max pyramid over
+ them, for ray queries that must not wait on the GPU: picking, line of sight checks and collisions.
+ The surface is the bilinear interpolation of the height map the vertex shader samples. Level 0 of the
+ pyramid bounds the cells between four neighboring texel centers; every level above bounds 2x2 nodes of the
+ one below. Rays skip the nodes they pass above and are only intersected exactly with the cells they reach.
+ Edits only rebuild the cells they touch and their ancestors; queries only read, so any number of threads
+ can run them between edits. It has no Apple framework dependencies.
+*/
+
+#pragma once
+
+#include "AAPLTerrainQuadtree.h"
+
+#include <stdint.h>
+#include <vector>
+
+struct AAPLTerrainRayHit
+{
+    float       distance;       // Along the normalized direction of the ray
+    float       position[3];
+    float       normal[3];
+};
+
+class AAPLTerrainHeightPyramid
+{
+public:
+    // The terrain spans [-terrainScale / 2, terrainScale / 2] on x and z and [0, terrainHeight] on y
+    AAPLTerrainHeightPyramid (float terrainScale, float terrainHeight);
+
+    // Copies the heights of the whole map, which must be at least 2x2 texels, and bounds every cell
+    void build (const AAPLTerrainQuadtreeHeights& heights);
+
+    // Copies the texels in [x0, x1) x [y0, y1) and refreshes the cells around them and their ancestors. The
+    //  map must have the size it was built with.
+    void update (const AAPLTerrainQuadtreeHeights& heights, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+    bool isBuilt () const { return built; }
+
+    // World height of the surface at world position (x, z), clamped to the edges of the map
+    float getHeight (float x, float z) const;
+
+    // Finds the first point within `maxDistance` of `origin` along `direction` that is at or below the
+    //  surface; a ray starting below the surface hits where it enters the map. `direction` does not need
+    //  to be normalized. Returns false on a miss, leaving `outHit` untouched.
+    bool raycast (const float origin[3], const float direction[3], float maxDistance, AAPLTerrainRayHit* outHit) const;
+
+    // Whether the segment between two points stays above the surface
+    bool isLineOfSightClear (const float from[3], const float to[3]) const;
+
+private:
+    struct Bounds
+    {
+        float   minY;
+        float   maxY;
+    };
+
+    void        updateCells (uint32_t cx0, uint32_t cy0, uint32_t cx1, uint32_t cy1);
+    float       nodeLow (uint32_t node, uint32_t level) const;
+    float       nodeHigh (uint32_t node, uint32_t level, uint32_t cellCount) const;
+    bool        intersectCell (uint32_t cx, uint32_t cy, const double origin[3], const double direction[3],
+                               double t0, double t1, double& outT) const;
+    float       getGridHeight (double gx, double gy) const;
+    void        getSurfaceNormal (double gx, double gy, float normal[3]) const;
+
+    const float         terrainScale;
+    const float         terrainHeight;
+    uint32_t            mapWidth;
+    uint32_t            mapHeight;
+    uint32_t            cellsX;                 // mapWidth - 1
+    uint32_t            cellsY;
+    bool                built;
+
+    // World heights of the texels, row major
+    std::vector<float>                  heights;
+
+    // Level 0 has a node per cell; level l has ceil (cells / 2^l) nodes per side, the last one a single node
+    std::vector<std::vector<Bounds>>    levels;
+    std::vector<uint32_t>               levelWidths;
+    std::vector<uint32_t>               levelHeights;
+};
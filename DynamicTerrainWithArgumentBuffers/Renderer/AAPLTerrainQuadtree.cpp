@@ -0,0 +1,427 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the AAPLTerrainQuadtree.
+ Patch bounds cover every texel the bilinear height lookups of a patch can blend, so they stay
+ conservative for the vertex shader. The tessellation factors follow tessFactor and
+ TerrainKnl_FillInTesselationFactors in AAPLTerrainRenderer.metal, keep them in sync.
+ Horizon culling works on the azimuths around the camera rather than on screen columns, so it holds for
+ any camera orientation. Below its lowest height a patch is solid, so every line of sight crossing its
+ footprint under some slope is blocked. Per azimuth column the horizon keeps the steepest such slope among
+ the accepted patches and how far away it is; a node is hidden when, in all the columns it spans, its
+ steepest line of sight is blocked by patches entirely in front of it.
+*/
+
+#include "AAPLTerrainQuadtree.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// Metal's largest tessellation factor; pipelines clamp to their own maxTessellationFactor
+static constexpr float kMaxTessellationFactor = 64.0f;
+
+// Rounds a factor in [1, kMaxTessellationFactor] to the nearest half, ties to even
+static inline uint16_t factorToHalf (float factor)
+{
+    uint32_t bits;
+    memcpy (&bits, &factor, sizeof(bits));
+    bits += 0x0FFF + ((bits >> 13) & 1);
+    return (uint16_t) ((bits >> 13) - ((127 - 15) << 10));
+}
+
+// First of the two texels linear filtering blends at the patch boundary of normalized coordinate
+//  patch / patchesPerSide, which sits half a texel off the texel centers
+static inline int64_t firstTexelAt (uint32_t patch, uint32_t patchesPerSide, uint32_t size)
+{
+    return (int64_t) floorf ((float) patch * size / patchesPerSide - 0.5f);
+}
+
+AAPLTerrainQuadtree::AAPLTerrainQuadtree (uint32_t inPatchesPerSide, float inTerrainScale, float inTerrainHeight) :
+patchesPerSide (inPatchesPerSide),
+terrainScale (inTerrainScale),
+terrainHeight (inTerrainHeight),
+levelCount (0),
+mapWidth (0),
+mapHeight (0),
+built (false),
+cornerHeights ((size_t) (inPatchesPerSide + 1) * (inPatchesPerSide + 1)),
+edgeFactors ((size_t) 2 * inPatchesPerSide * (inPatchesPerSide + 1)),
+visiblePatches (nullptr),
+stats ()
+{
+    assert (patchesPerSide > 0 && (patchesPerSide & (patchesPerSide - 1)) == 0);
+
+    for (uint32_t side = patchesPerSide; side > 0; side /= 2)
+    {
+        levels.push_back (std::vector<Bounds> ((size_t) side * side));
+        levelCount++;
+    }
+}
+
+void AAPLTerrainQuadtree::build (const AAPLTerrainQuadtreeHeights& heights)
+{
+    mapWidth = heights.width;
+    mapHeight = heights.height;
+    updateLeaves (heights, 0, 0, patchesPerSide, patchesPerSide);
+    built = true;
+}
+
+void AAPLTerrainQuadtree::update (const AAPLTerrainQuadtreeHeights& heights, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    assert (built && heights.width == mapWidth && heights.height == mapHeight);
+    x1 = std::min (x1, mapWidth);
+    y1 = std::min (y1, mapHeight);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    // Patch p reads the texels from the first one of its left boundary to the last one of its right one
+    auto patchRange = [this] (uint32_t t0, uint32_t t1, uint32_t size, uint32_t& p0, uint32_t& p1)
+    {
+        p0 = patchesPerSide;
+        p1 = 0;
+        for (uint32_t p = 0; p < patchesPerSide; p++)
+        {
+            int64_t first = firstTexelAt (p, patchesPerSide, size);
+            int64_t last = firstTexelAt (p + 1, patchesPerSide, size) + 1;
+            if (last >= (int64_t) t0 && first < (int64_t) t1)
+            {
+                p0 = std::min (p0, p);
+                p1 = p + 1;
+            }
+        }
+    };
+
+    uint32_t px0, px1, py0, py1;
+    patchRange (x0, x1, mapWidth, px0, px1);
+    patchRange (y0, y1, mapHeight, py0, py1);
+    if (px0 < px1 && py0 < py1)
+        updateLeaves (heights, px0, py0, px1, py1);
+}
+
+// Recomputes the leaves in [px0, px1) x [py0, py1), their corners, and the ancestors above them
+void AAPLTerrainQuadtree::updateLeaves (const AAPLTerrainQuadtreeHeights& heights, uint32_t px0, uint32_t py0, uint32_t px1, uint32_t py1)
+{
+    const uint32_t channelCount = heights.channelCount;
+    const float toWorld = terrainHeight / 65535.0f;
+
+    auto texel = [&heights, channelCount] (int64_t x, int64_t y)
+    {
+        x = std::min (std::max (x, (int64_t) 0), (int64_t) heights.width - 1);
+        y = std::min (std::max (y, (int64_t) 0), (int64_t) heights.height - 1);
+        return heights.data[((size_t) y * heights.width + x) * channelCount];
+    };
+
+    std::vector<Bounds>& leaves = levels[0];
+    for (uint32_t py = py0; py < py1; py++)
+    {
+        int64_t ty0 = std::max (firstTexelAt (py, patchesPerSide, mapHeight), (int64_t) 0);
+        int64_t ty1 = std::min (firstTexelAt (py + 1, patchesPerSide, mapHeight) + 1, (int64_t) mapHeight - 1);
+
+        for (uint32_t px = px0; px < px1; px++)
+        {
+            int64_t tx0 = std::max (firstTexelAt (px, patchesPerSide, mapWidth), (int64_t) 0);
+            int64_t tx1 = std::min (firstTexelAt (px + 1, patchesPerSide, mapWidth) + 1, (int64_t) mapWidth - 1);
+
+            uint16_t lo = UINT16_MAX;
+            uint16_t hi = 0;
+            for (int64_t y = ty0; y <= ty1; y++)
+            {
+                const uint16_t* row = heights.data + ((size_t) y * mapWidth) * channelCount;
+                for (int64_t x = tx0; x <= tx1; x++)
+                {
+                    uint16_t h = row[x * channelCount];
+                    lo = h < lo ? h : lo;
+                    hi = h > hi ? h : hi;
+                }
+            }
+            leaves[py * patchesPerSide + px] = { lo * toWorld, hi * toWorld };
+        }
+    }
+
+    // Corner heights, filtered like the kernel's clamp to edge sampler
+    for (uint32_t cy = py0; cy <= py1; cy++)
+    for (uint32_t cx = px0; cx <= px1; cx++)
+    {
+        float tx = (float) cx * mapWidth / patchesPerSide - 0.5f;
+        float ty = (float) cy * mapHeight / patchesPerSide - 0.5f;
+        int64_t ix = (int64_t) floorf (tx);
+        int64_t iy = (int64_t) floorf (ty);
+        float fx = tx - ix;
+        float fy = ty - iy;
+
+        float top    = texel (ix, iy)     * (1.0f - fx) + texel (ix + 1, iy)     * fx;
+        float bottom = texel (ix, iy + 1) * (1.0f - fx) + texel (ix + 1, iy + 1) * fx;
+        cornerHeights[cy * (patchesPerSide + 1) + cx] = (top * (1.0f - fy) + bottom * fy) * toWorld;
+    }
+
+    for (uint32_t level = 1; level < levelCount; level++)
+    {
+        const uint32_t side = patchesPerSide >> level;
+        const std::vector<Bounds>& children = levels[level - 1];
+        std::vector<Bounds>& nodes = levels[level];
+
+        px0 /= 2; py0 /= 2;
+        px1 = (px1 + 1) / 2; py1 = (py1 + 1) / 2;
+        for (uint32_t y = py0; y < py1; y++)
+        for (uint32_t x = px0; x < px1; x++)
+        {
+            const Bounds& c00 = children[(2 * y)     * (2 * side) + 2 * x];
+            const Bounds& c10 = children[(2 * y)     * (2 * side) + 2 * x + 1];
+            const Bounds& c01 = children[(2 * y + 1) * (2 * side) + 2 * x];
+            const Bounds& c11 = children[(2 * y + 1) * (2 * side) + 2 * x + 1];
+            nodes[y * side + x] = { std::min (std::min (c00.minY, c10.minY), std::min (c01.minY, c11.minY)),
+                                    std::max (std::max (c00.maxY, c10.maxY), std::max (c01.maxY, c11.maxY)) };
+        }
+    }
+}
+
+// One factor per edge, from its two corners, so the two patches sharing an edge read the same value
+void AAPLTerrainQuadtree::computeEdgeFactors (const AAPLTerrainQuadtreeView& view)
+{
+    const uint32_t stride = patchesPerSide + 1;
+    const float* m = view.viewProjection;
+
+    auto tessFactor = [&view, m] (float x0, float y0, float z0, float x1, float y1, float z1)
+    {
+        float dx = x1 - x0, dy = y1 - y0, dz = z1 - z0;
+        float diameter = sqrtf (dx * dx + dy * dy + dz * dz);
+
+        float w = m[3] * (x0 + x1) * 0.5f + m[7] * (y0 + y1) * 0.5f + m[11] * (z0 + z1) * 0.5f + m[15];
+        float factor = std::max (view.tessellationScale * fabsf (diameter * view.projectionYScale / w), 1.0f);
+
+        // Also catches the infinity and NaN of edges crossing the camera plane
+        return factor < kMaxTessellationFactor ? factor : kMaxTessellationFactor;
+    };
+
+    auto cornerX = [this] (uint32_t i) { return ((float) i / patchesPerSide - 0.5f) * terrainScale; };
+
+    float* alongX = edgeFactors.data();
+    float* alongZ = edgeFactors.data() + patchesPerSide * stride;
+    for (uint32_t j = 0; j <= patchesPerSide; j++)
+    for (uint32_t i = 0; i < patchesPerSide; i++)
+    {
+        alongX[j * patchesPerSide + i] = tessFactor (cornerX (i),     cornerHeights[j * stride + i],     cornerX (j),
+                                                     cornerX (i + 1), cornerHeights[j * stride + i + 1], cornerX (j));
+    }
+    for (uint32_t j = 0; j < patchesPerSide; j++)
+    for (uint32_t i = 0; i <= patchesPerSide; i++)
+    {
+        alongZ[j * stride + i] = tessFactor (cornerX (i), cornerHeights[j * stride + i],       cornerX (j),
+                                             cornerX (i), cornerHeights[(j + 1) * stride + i], cornerX (j + 1));
+    }
+}
+
+uint32_t AAPLTerrainQuadtree::cull (const AAPLTerrainQuadtreeView& view, uint32_t* outVisiblePatches, AAPLTerrainPatchFactors* outFactors)
+{
+    assert (built);
+    memset (&stats, 0, sizeof(stats));
+
+    computeEdgeFactors (view);
+
+    const uint32_t stride = patchesPerSide + 1;
+    const float* alongX = edgeFactors.data();
+    const float* alongZ = edgeFactors.data() + patchesPerSide * stride;
+    for (uint32_t y = 0; y < patchesPerSide; y++)
+    for (uint32_t x = 0; x < patchesPerSide; x++)
+    {
+        // Edges of TerrainKnl_FillInTesselationFactors: (p00, p01), (p00, p10), (p10, p11), (p01, p11)
+        float e0 = alongZ[y * stride + x];
+        float e1 = alongX[y * patchesPerSide + x];
+        float e2 = alongZ[y * stride + x + 1];
+        float e3 = alongX[(y + 1) * patchesPerSide + x];
+
+        AAPLTerrainPatchFactors& factors = outFactors[y * patchesPerSide + x];
+        factors.edge[0] = factorToHalf (e0);
+        factors.edge[1] = factorToHalf (e1);
+        factors.edge[2] = factorToHalf (e2);
+        factors.edge[3] = factorToHalf (e3);
+        factors.inside[0] = factorToHalf ((e1 + e3) * 0.5f);
+        factors.inside[1] = factorToHalf ((e0 + e2) * 0.5f);
+    }
+
+    std::fill (horizonSlope, horizonSlope + kHorizonResolution, -FLT_MAX);
+    std::fill (horizonDistance, horizonDistance + kHorizonResolution, FLT_MAX);
+    visiblePatches = outVisiblePatches;
+    visit (view, levelCount - 1, 0, 0, 0x3F);
+    visiblePatches = nullptr;
+
+    return stats.visiblePatches;
+}
+
+// A node's footprint on the xz plane as seen from the camera: the azimuths it spans and its distances.
+//  Azimuths are pseudo angles in [0, 4) rather than radians; they only need to grow monotonically with the
+//  angle around the camera, and are much cheaper than atan2.
+struct AAPLTerrainQuadtree::Footprint
+{
+    bool    containsCamera;
+    float   azimuthMin;         // azimuthMax - azimuthMin < 2, half a turn; may leave [0, 4)
+    float   azimuthMax;
+    float   distanceMin;
+    float   distanceMax;
+};
+
+static inline float pseudoAzimuth (float x, float z)
+{
+    float p = x / (fabsf (x) + fabsf (z));
+    return z >= 0.0f ? 1.0f - p : 3.0f + p;
+}
+
+AAPLTerrainQuadtree::Footprint AAPLTerrainQuadtree::footprintOf (const float camera[3], const float boxMin[3], const float boxMax[3])
+{
+    Footprint footprint;
+
+    float dx = std::max (std::max (boxMin[0] - camera[0], camera[0] - boxMax[0]), 0.0f);
+    float dz = std::max (std::max (boxMin[2] - camera[2], camera[2] - boxMax[2]), 0.0f);
+    footprint.containsCamera = dx == 0.0f && dz == 0.0f;
+    footprint.distanceMin = sqrtf (dx * dx + dz * dz);
+    footprint.distanceMax = 0.0f;
+    if (footprint.containsCamera)
+        return footprint;
+
+    // Corner azimuths relative to the center's, which the footprint spans less than half a turn around
+    const float center = pseudoAzimuth ((boxMin[0] + boxMax[0]) * 0.5f - camera[0], (boxMin[2] + boxMax[2]) * 0.5f - camera[2]);
+    float deltaMin = 0.0f, deltaMax = 0.0f;
+    for (uint32_t c = 0; c < 4; c++)
+    {
+        float cx = ((c & 1) ? boxMax[0] : boxMin[0]) - camera[0];
+        float cz = ((c & 2) ? boxMax[2] : boxMin[2]) - camera[2];
+        footprint.distanceMax = std::max (footprint.distanceMax, sqrtf (cx * cx + cz * cz));
+
+        float delta = pseudoAzimuth (cx, cz) - center;
+        delta = delta >  2.0f ? delta - 4.0f :
+                delta < -2.0f ? delta + 4.0f : delta;
+        deltaMin = std::min (deltaMin, delta);
+        deltaMax = std::max (deltaMax, delta);
+    }
+    footprint.azimuthMin = center + deltaMin;
+    footprint.azimuthMax = center + deltaMax;
+    return footprint;
+}
+
+void AAPLTerrainQuadtree::visit (const AAPLTerrainQuadtreeView& view, uint32_t level, uint32_t x, uint32_t y, uint32_t planeMask)
+{
+    stats.visitedNodes++;
+
+    const uint32_t side = patchesPerSide >> level;
+    const uint32_t patchCount = 1u << (2 * level);
+    const float nodeSize = terrainScale / side;
+    const Bounds& bounds = levels[level][y * side + x];
+
+    const float boxMin[3] = { x * nodeSize - 0.5f * terrainScale,       bounds.minY, y * nodeSize - 0.5f * terrainScale };
+    const float boxMax[3] = { (x + 1) * nodeSize - 0.5f * terrainScale, bounds.maxY, (y + 1) * nodeSize - 0.5f * terrainScale };
+
+    // Planes the parent is entirely inside of are left out of the mask
+    for (uint32_t p = 0; p < 6; p++)
+    {
+        if ((planeMask & (1u << p)) == 0)
+            continue;
+
+        const float* plane = view.frustumPlanes[p];
+        float farthest = plane[3], nearest = plane[3];
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            farthest += plane[axis] * (plane[axis] >= 0.0f ? boxMax[axis] : boxMin[axis]);
+            nearest  += plane[axis] * (plane[axis] >= 0.0f ? boxMin[axis] : boxMax[axis]);
+        }
+
+        if (farthest < 0.0f)
+        {
+            stats.frustumCulledPatches += patchCount;
+            return;
+        }
+        if (nearest >= 0.0f)
+            planeMask &= ~(1u << p);
+    }
+
+    Footprint footprint;
+    if (view.horizonCulling)
+    {
+        footprint = footprintOf (view.cameraPosition, boxMin, boxMax);
+        if (isBelowHorizon (footprint, boxMax[1] - view.cameraPosition[1]))
+        {
+            stats.horizonCulledPatches += patchCount;
+            return;
+        }
+    }
+
+    if (level == 0)
+    {
+        visiblePatches[stats.visiblePatches++] = y * patchesPerSide + x;
+        if (view.horizonCulling)
+            raiseHorizon (footprint, boxMin[1] - view.cameraPosition[1]);
+        return;
+    }
+
+    // Children nearest to the camera first
+    float distances[4];
+    uint32_t order[4] = { 0, 1, 2, 3 };
+    for (uint32_t c = 0; c < 4; c++)
+    {
+        float dx = boxMin[0] + ((c & 1) + 0.5f) * nodeSize * 0.5f - view.cameraPosition[0];
+        float dz = boxMin[2] + ((c >> 1) + 0.5f) * nodeSize * 0.5f - view.cameraPosition[2];
+        distances[c] = dx * dx + dz * dz;
+    }
+    std::sort (order, order + 4, [&distances] (uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
+
+    for (uint32_t c : order)
+        visit (view, level - 1, 2 * x + (c & 1), 2 * y + (c >> 1), planeMask);
+}
+
+static inline float azimuthToColumn (float azimuth)
+{
+    return azimuth * (AAPLTerrainQuadtree::kHorizonResolution / 4.0f);
+}
+
+static inline uint32_t wrapColumn (int32_t column)
+{
+    return (uint32_t) column & (AAPLTerrainQuadtree::kHorizonResolution - 1);
+}
+
+// `rise` is the height of the node's top above the camera
+bool AAPLTerrainQuadtree::isBelowHorizon (const Footprint& footprint, float rise) const
+{
+    if (footprint.containsCamera)
+        return false;
+
+    // The steepest line of sight from the camera to the node
+    const float slope = rise / (rise > 0.0f ? footprint.distanceMin : footprint.distanceMax);
+
+    // Every column the node touches must be blocked at least as steeply, closer than the node
+    int32_t c0 = (int32_t) floorf (azimuthToColumn (footprint.azimuthMin));
+    int32_t c1 = (int32_t) floorf (azimuthToColumn (footprint.azimuthMax));
+    for (int32_t c = c0; c <= c1; c++)
+    {
+        uint32_t column = wrapColumn (c);
+        if (horizonSlope[column] < slope || horizonDistance[column] > footprint.distanceMin)
+            return false;
+    }
+    return true;
+}
+
+// `rise` is the lowest height of the patch above the camera
+void AAPLTerrainQuadtree::raiseHorizon (const Footprint& footprint, float rise)
+{
+    if (footprint.containsCamera)
+        return;
+
+    // Lines of sight crossing the footprint hit the solid part below the patch's lowest height when they
+    //  are at most this steep, whatever the distance at which they cross it
+    const float slope = rise / (rise > 0.0f ? footprint.distanceMax : footprint.distanceMin);
+
+    // Only the columns entirely within the footprint's azimuths cross it
+    int32_t c0 = (int32_t) ceilf (azimuthToColumn (footprint.azimuthMin));
+    int32_t c1 = (int32_t) floorf (azimuthToColumn (footprint.azimuthMax)) - 1;
+    for (int32_t c = c0; c <= c1; c++)
+    {
+        uint32_t column = wrapColumn (c);
+        if (slope > horizonSlope[column])
+        {
+            horizonSlope[column] = slope;
+            horizonDistance[column] = footprint.distanceMax;
+        }
+    }
+}
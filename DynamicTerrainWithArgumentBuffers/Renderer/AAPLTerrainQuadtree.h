@@ -0,0 +1,135 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLTerrainQuadtree, a min/max height quadtree over the terrain patches used to cull
+ them on the CPU. Its leaves are the TERRAIN_PATCHES x TERRAIN_PATCHES tessellated patches; each node
+ bounds the heights its patches can reach. Culling walks the tree front to back, rejects nodes outside of
+ the view frustum or below the horizon of the patches already accepted, and writes the tessellation
+ factors of every patch the way TerrainKnl_FillInTesselationFactors does.
+ Edits only rebuild the leaves they touch and their ancestors. It has no Apple framework dependencies.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Layout of MTLQuadTessellationFactorsHalf
+struct AAPLTerrainPatchFactors
+{
+    uint16_t    edge[4];
+    uint16_t    inside[2];
+};
+
+// Heights as unorm16 texels, rows tightly packed; only the first channel is read
+struct AAPLTerrainQuadtreeHeights
+{
+    const uint16_t* data;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        channelCount;
+};
+
+struct AAPLTerrainQuadtreeView
+{
+    float       viewProjection[16];     // Column major, like simd::float4x4
+    float       frustumPlanes[6][4];    // Points inside have dot (plane, (p, 1)) >= 0, like AAPLCameraUniforms
+    float       cameraPosition[3];
+    float       projectionYScale;
+    float       tessellationScale;
+    bool        horizonCulling;
+};
+
+struct AAPLTerrainQuadtreeStats
+{
+    uint32_t    visitedNodes;
+    uint32_t    frustumCulledPatches;
+    uint32_t    horizonCulledPatches;
+    uint32_t    visiblePatches;
+};
+
+class AAPLTerrainQuadtree
+{
+public:
+    // Azimuth columns of the horizon around the camera, a power of two; more columns cull closer to the
+    //  actual silhouette
+    static constexpr uint32_t kHorizonResolution = 512;
+
+    // `patchesPerSide` must be a power of two. The terrain spans [-terrainScale / 2, terrainScale / 2]
+    //  on x and z and [0, terrainHeight] on y.
+    AAPLTerrainQuadtree (uint32_t patchesPerSide, float terrainScale, float terrainHeight);
+
+    // Bounds every patch with the heights of the whole map
+    void build (const AAPLTerrainQuadtreeHeights& heights);
+
+    // Refreshes the patches that can sample texels in [x0, x1) x [y0, y1) and their ancestors. The map must
+    //  have the size it was built with.
+    void update (const AAPLTerrainQuadtreeHeights& heights, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+
+    bool isBuilt () const { return built; }
+
+    // Writes the IDs of the visible patches to `outVisiblePatches`, front to back, and returns their
+    //  count. `outFactors` receives the factors of every patch by patch ID, visible or not, so other
+    //  views can draw any patch with them. Neighboring patches share the factor of their common edge,
+    //  so the tessellation has no cracks.
+    uint32_t cull (const AAPLTerrainQuadtreeView& view, uint32_t* outVisiblePatches, AAPLTerrainPatchFactors* outFactors);
+
+    const AAPLTerrainQuadtreeStats& getStats () const { return stats; }
+
+    uint32_t getPatchCount () const { return patchesPerSide * patchesPerSide; }
+
+    // Level 0 holds the patches; level l has patchesPerSide >> l nodes per side
+    uint32_t getLevelCount () const { return levelCount; }
+
+    // World heights a node's patches can reach
+    void getNodeBounds (uint32_t level, uint32_t x, uint32_t y, float& outMinY, float& outMaxY) const
+    {
+        const Bounds& bounds = levels[level][y * (patchesPerSide >> level) + x];
+        outMinY = bounds.minY;
+        outMaxY = bounds.maxY;
+    }
+
+    // World height at corner (x, y) of the (patchesPerSide + 1)^2 patch corners
+    float getCornerHeight (uint32_t x, uint32_t y) const { return cornerHeights[y * (patchesPerSide + 1) + x]; }
+
+private:
+    struct Bounds
+    {
+        float   minY;
+        float   maxY;
+    };
+
+    void        updateLeaves (const AAPLTerrainQuadtreeHeights& heights, uint32_t px0, uint32_t py0, uint32_t px1, uint32_t py1);
+    void        computeEdgeFactors (const AAPLTerrainQuadtreeView& view);
+    void        visit (const AAPLTerrainQuadtreeView& view, uint32_t level, uint32_t x, uint32_t y, uint32_t planeMask);
+    struct Footprint;
+    static Footprint footprintOf (const float camera[3], const float boxMin[3], const float boxMax[3]);
+    bool        isBelowHorizon (const Footprint& footprint, float rise) const;
+    void        raiseHorizon (const Footprint& footprint, float rise);
+
+    const uint32_t      patchesPerSide;
+    const float         terrainScale;
+    const float         terrainHeight;
+    uint32_t            levelCount;
+    uint32_t            mapWidth;
+    uint32_t            mapHeight;
+    bool                built;
+
+    // Level 0 holds the leaves; level l has patchesPerSide >> l nodes per side
+    std::vector<std::vector<Bounds>>    levels;
+
+    // World height at each of the (patchesPerSide + 1)^2 patch corners
+    std::vector<float>                  cornerHeights;
+
+    // Factors of the patchesPerSide * (patchesPerSide + 1) edges along x, then as many along z
+    std::vector<float>                  edgeFactors;
+
+    // Per azimuth column, the steepest slope up to which lines of sight are blocked, and the distance
+    //  within which they are
+    float                               horizonSlope[kHorizonResolution];
+    float                               horizonDistance[kHorizonResolution];
+
+    uint32_t*                           visiblePatches;
+    AAPLTerrainQuadtreeStats            stats;
+};
@@ -21,15 +21,33 @@ Declaration of the terrain renderer which is responsible for rendering tesselate
 @property (readonly) simd::float3       terrainWorldBoundsMin;
 @property (readonly) simd::float3       terrainWorldBoundsMax;
 
+// Culls the patches against the main camera on the CPU and draws only the visible ones, instead of
+//  drawing every patch with the factors of TerrainKnl_FillInTesselationFactors. Culling starts once the
+//  initial height map has been read back.
+@property bool                          cpuPatchCulling;
+@property (readonly) uint32_t           visiblePatchCount;
+
 -(simd::float3) terrainWorldBoundsMax;
 -(simd::float3) terrainWorldBoundsMin;
 
+// Ray queries against a CPU copy of the terrain, for game logic that cannot wait on the GPU. The copy is
+//  updated from the height map readbacks of completed frames, so it trails sculpting by the frames in flight;
+//  until the initial readback, rays miss, lines of sight are clear and heights are 0.
+-(bool) raycastTerrainFrom:(simd::float3) origin
+                 direction:(simd::float3) direction
+               maxDistance:(float) maxDistance
+               hitPosition:(simd::float3*) outPosition
+                 hitNormal:(simd::float3*) outNormal;
+-(bool) isTerrainLineOfSightClearFrom:(simd::float3) from to:(simd::float3) to;
+-(float) terrainHeightAt:(simd::float2) position;
+
 
 -(instancetype) initWithDevice:(id <MTLDevice>) device
                        library:(id <MTLLibrary>) library;
 
 -(void) computeTesselationFactors:(id <MTLCommandBuffer>) commandBuffer
-                   globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms;
+                   globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms
+                      cpuUniforms:(const AAPLUniforms&)cpuUniforms;
 
 - (void)drawShadowsWithEncoder:(id <MTLRenderCommandEncoder>)renderEncoder
                 globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms;
@@ -347,8 +347,42 @@ kernel void TerrainKnl_FillInTesselationFactors (device MTLQuadTessellationFacto
     }
 }
 
+// Finds the texels of every mip level whose normals and properties a brush stroke changes; one thread per level
+kernel void TerrainKnl_ComputeBrushBakeRegions (constant float4 &mousePosition            [[buffer(0)]],
+                                                constant AAPLUniforms& globalUniforms      [[buffer(1)]],
+                                                device TerrainBakeRegion* outRegions       [[buffer(2)]],
+                                                constant uint &levelCount                  [[buffer(3)]],
+                                                texture2d<float> heightMap                 [[texture(0)]],
+                                                uint level                                 [[thread_position_in_grid]])
+{
+    if (level >= levelCount)
+        return;
+    
+    // TerrainKnl_UpdateHeightmap only changes the texels closer than two brush sizes to the cursor
+    float2 size = float2(heightMap.get_width(), heightMap.get_height());
+    float2 brushMin = ((mousePosition.xz - 2.0f * globalUniforms.brushSize) / TERRAIN_SCALE + 0.5f) * heightMap.get_width();
+    float2 brushMax = ((mousePosition.xz + 2.0f * globalUniforms.brushSize) / TERRAIN_SCALE + 0.5f) * heightMap.get_width();
+    uint2 regionMin = uint2(clamp(floor(brushMin) - TERRAIN_BAKE_PADDING, float2(0), size));
+    uint2 regionMax = uint2(clamp(ceil(brushMax) + 1.0f + TERRAIN_BAKE_PADDING, float2(0), size));
+    
+    // A mip texel averages a 2x2 block of the level above
+    uint2 levelSize = max(uint2(size) >> level, uint2(1));
+    regionMin = regionMin >> level;
+    regionMax = min((regionMax + (1u << level) - 1u) >> level, levelSize);
+    
+    uint2 regionSize = regionMax - min(regionMin, regionMax);
+    outRegions[level].threadgroupsPerGrid[0] = (regionSize.x + TERRAIN_BAKE_THREADGROUP_SIZE - 1) / TERRAIN_BAKE_THREADGROUP_SIZE;
+    outRegions[level].threadgroupsPerGrid[1] = (regionSize.y + TERRAIN_BAKE_THREADGROUP_SIZE - 1) / TERRAIN_BAKE_THREADGROUP_SIZE;
+    outRegions[level].threadgroupsPerGrid[2] = 1;
+    outRegions[level].originX = regionMin.x;
+    outRegions[level].originY = regionMin.y;
+    outRegions[level].width = regionSize.x;
+    outRegions[level].height = regionSize.y;
+}
+
 kernel void TerrainKnl_ComputeNormalsFromHeightmap(texture2d<float> height [[texture(0)]],
                                                    texture2d<float, access::write> normal [[texture(1)]],
+                                                   constant TerrainBakeRegion& region [[buffer(0)]],
                                                    uint2 tid [[thread_position_in_grid]])
 {
     constexpr sampler sam(min_filter::nearest, mag_filter::nearest, mip_filter::none,
@@ -357,12 +391,16 @@ kernel void TerrainKnl_ComputeNormalsFromHeightmap(texture2d<float> height [[tex
     float xz_scale = TERRAIN_SCALE / height.get_width();
     float y_scale = TERRAIN_HEIGHT;
     
+    if (tid.x >= region.width || tid.y >= region.height)
+        return;
+    tid += uint2(region.originX, region.originY);
+    
     if (tid.x < height.get_width() && tid.y < height.get_height()) {
-        float h_up     = height.sample(sam, (float2)(tid + uint2(0, 1))).r;
-        float h_down   = height.sample(sam, (float2)(tid - uint2(0, 1))).r;
-        float h_right  = height.sample(sam, (float2)(tid + uint2(1, 0))).r;
-        float h_left   = height.sample(sam, (float2)(tid - uint2(1, 0))).r;
-        float h_center = height.sample(sam, (float2)(tid + uint2(0, 0))).r;
+        float h_up     = height.sample(sam, (float2)tid + float2(0, 1)).r;
+        float h_down   = height.sample(sam, (float2)tid - float2(0, 1)).r;
+        float h_right  = height.sample(sam, (float2)tid + float2(1, 0)).r;
+        float h_left   = height.sample(sam, (float2)tid - float2(1, 0)).r;
+        float h_center = height.sample(sam, (float2)tid).r;
         
         float3 v_up    = float3( 0,        (h_up    - h_center) * y_scale,  xz_scale);
         float3 v_down  = float3( 0,        (h_down  - h_center) * y_scale, -xz_scale);
@@ -385,11 +423,16 @@ kernel void TerrainKnl_ComputeOcclusionAndSlopeFromHeightmap (texture2d<float> h
                                                               constant float2 *aoSamples [[buffer(0)]],
                                                               constant int & aoSampleCount [[buffer(1)]],
                                                               constant float2 &invSize [[buffer(2)]],
+                                                              constant TerrainBakeRegion& region [[buffer(3)]],
                                                               uint2 tid [[thread_position_in_grid]])
 {
     constexpr sampler sam(min_filter::nearest, mag_filter::nearest, mip_filter::none,
                           address::clamp_to_edge);
     
+    if (tid.x >= region.width || tid.y >= region.height)
+        return;
+    tid += uint2(region.originX, region.originY);
+    
     float2 uv_center = ((float2)tid + float2(0.5f, 0.5f)) * invSize;
     float aoVal;
     
@@ -444,6 +487,26 @@ kernel void TerrainKnl_ComputeOcclusionAndSlopeFromHeightmap (texture2d<float> h
     propTexture.write(oldval, tid);
 }
 
+// Fills a region of a mip level with the 2x2 box filtered texels of the level above
+kernel void TerrainKnl_DownsampleMip(texture2d<float> source [[texture(0)]],
+                                     texture2d<float, access::write> destination [[texture(1)]],
+                                     const device TerrainBakeRegion* regions [[buffer(0)]],
+                                     constant uint &level [[buffer(1)]],
+                                     uint2 tid [[thread_position_in_grid]])
+{
+    const device TerrainBakeRegion& region = regions[level];
+    if (tid.x >= region.width || tid.y >= region.height)
+        return;
+    tid += uint2(region.originX, region.originY);
+    
+    uint2 last = uint2(source.get_width(), source.get_height()) - 1;
+    float4 sum = source.read(min(tid * 2,               last)) +
+                 source.read(min(tid * 2 + uint2(1, 0), last)) +
+                 source.read(min(tid * 2 + uint2(0, 1), last)) +
+                 source.read(min(tid * 2 + uint2(1, 1), last));
+    destination.write(sum * 0.25f, tid);
+}
+
 kernel void TerrainKnl_ClearTexture(texture2d<float, access::write> tex,
                                     uint2 tid [[thread_position_in_grid]])
 {
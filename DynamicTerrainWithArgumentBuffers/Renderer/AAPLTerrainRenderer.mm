@@ -8,15 +8,41 @@ Implementation of the terrain renderer which is responsible for rendering tessel
 #import "TargetConditionals.h"
 #import <type_traits>
 #import <array>
+#import <memory>
+#import <mutex>
+#import <vector>
 
 #import "AAPLTerrainRenderer.h"
 #import "AAPLTerrainRenderer_shared.h"
 #import "AAPLParticleRenderer.h"
 #import "AAPLBufferFormats.h"
 #import "AAPLAllocator.h"
+#import "AAPLTerrainQuadtree.h"
+#import "AAPLTerrainBake.h"
+#import "AAPLTerrainHeightPyramid.h"
 
 using namespace simd;
 
+static_assert(sizeof(AAPLTerrainPatchFactors) == sizeof(MTLQuadTessellationFactorsHalf), "Tessellation factor layouts differ");
+static_assert(sizeof(AAPLTerrainQuadtreeView::viewProjection) == sizeof(float4x4), "Matrix layouts differ");
+static_assert(sizeof(AAPLTerrainQuadtreeView::frustumPlanes) == sizeof(AAPLCameraUniforms::frustumPlanes), "Plane layouts differ");
+
+// Frames the main renderer keeps in flight; each one gets its own copy of the CPU culling output
+static const NSUInteger kCpuCullingRingSize = 3;
+
+// A copy of the height map for the quadtree: the RG16 texels, followed by the brush of the edit
+struct HeightReadbackBrush
+{
+    float4  mousePosition;
+    float   brushSize;
+};
+
+struct HeightReadback
+{
+    id <MTLBuffer>  buffer;
+    bool            wholeMap;   // No brush; rebuild the quadtree from scratch
+};
+
 struct HabitatTextures
 {
     id <MTLTexture> diffSpecTextureArray;
@@ -69,11 +95,38 @@ static std::array <HabitatTextures, 4> CreateTerrainTextures (id<MTLDevice> devi
     id <MTLTexture> _terrainPropertiesMap;
     id <MTLTexture> _targetHeightmap;
     
+    // Single level views of the normal and properties maps, for the mip downsampling
+    std::vector <id <MTLTexture>> _terrainNormalMapLevels;
+    std::vector <id <MTLTexture>> _terrainPropertiesMapLevels;
+    
+    // Per mip level regions of the bakes: the whole maps, and the texels of the last brush stroke
+    id <MTLBuffer> _fullBakeRegionsBfr;
+    id <MTLBuffer> _brushBakeRegionsBfr;
+    
     // Tesselation data
     id <MTLBuffer> _visiblePatchesTessFactorBfr;
     id <MTLBuffer> _visiblePatchIndicesBfr;
     float _tessellationScale;
     
+    // CPU patch culling
+    std::unique_ptr <AAPLTerrainQuadtree> _quadtree;
+    
+    // CPU ray queries, fed by the same height map copies as the quadtree
+    std::unique_ptr <AAPLTerrainHeightPyramid> _heightPyramid;
+    std::array <id <MTLBuffer>, kCpuCullingRingSize> _cpuPatchIndicesBfr;
+    std::array <id <MTLBuffer>, kCpuCullingRingSize> _cpuTessFactorBfr;
+    NSUInteger _cpuCullingRingIndex;
+    id <MTLBuffer> _allPatchIndicesBfr;
+    
+    // Patches of the main view, from the GPU kernel or the CPU culling of this frame
+    id <MTLBuffer> _drawPatchIndicesBfr;
+    id <MTLBuffer> _drawTessFactorBfr;
+    
+    // Height map copies of completed command buffers, waiting for the quadtree to pick them up
+    std::mutex _heightReadbackMutex;
+    std::vector <HeightReadback> _pendingHeightReadbacks;
+    std::vector <id <MTLBuffer>> _freeHeightReadbackBfrs;
+    
     // Render pipelines
     id <MTLRenderPipelineState> _pplRnd_TerrainMainView;
     NSUInteger _iabBufferIndex_PplTerrainMainView;
@@ -85,6 +138,8 @@ static std::array <HabitatTextures, 4> CreateTerrainTextures (id<MTLDevice> devi
     id <MTLComputePipelineState> _pplCmp_BakePropertiesMips;
     id <MTLComputePipelineState> _pplCmp_ClearTexture;
     id <MTLComputePipelineState> _pplCmp_UpdateHeightmap;;
+    id <MTLComputePipelineState> _pplCmp_ComputeBrushBakeRegions;
+    id <MTLComputePipelineState> _pplCmp_DownsampleMip;
 }
 
 -(float3) terrainWorldBoundsMax
@@ -97,40 +152,29 @@ static std::array <HabitatTextures, 4> CreateTerrainTextures (id<MTLDevice> devi
     return (float3) { TERRAIN_SCALE / 2.0f, TERRAIN_HEIGHT, TERRAIN_SCALE / 2.0f};
 }
 
--(void) GenerateTerrainNormalMap: (id <MTLCommandBuffer>) commandBuffer
+// Bakes the region of level 0 at the start of `regions`, one TerrainBakeRegion per mip level
+-(void) GenerateTerrainNormalMap: (id <MTLCommandBuffer>) commandBuffer regions:(id <MTLBuffer>) regions
 {
     id <MTLComputeCommandEncoder> computeEncoder = [commandBuffer computeCommandEncoder];
     
-    MTLSize threadsPerThreadgroup = (MTLSize){ 16, 16, 1 };
-    assert (((_terrainHeight.width  / 16)*16) == _terrainHeight.width);
-    assert (((_terrainHeight.height / 16)*16) == _terrainHeight.height);
+    MTLSize threadsPerThreadgroup = (MTLSize){ TERRAIN_BAKE_THREADGROUP_SIZE, TERRAIN_BAKE_THREADGROUP_SIZE, 1 };
     
     [computeEncoder setComputePipelineState:_pplCmp_BakeNormalsMips];
     [computeEncoder setTexture:_terrainHeight atIndex:0];
     [computeEncoder setTexture:_terrainNormalMap atIndex:1];
-    [computeEncoder dispatchThreads:MTLSizeMake(_terrainHeight.width, _terrainHeight.height, 1) threadsPerThreadgroup:threadsPerThreadgroup];
+    [computeEncoder setBuffer:regions offset:0 atIndex:0];
+    [computeEncoder dispatchThreadgroupsWithIndirectBuffer:regions indirectBufferOffset:0 threadsPerThreadgroup:threadsPerThreadgroup];
     [computeEncoder endEncoding];
 }
 
--(void) GenerateTerrainPropertiesMap: (id <MTLCommandBuffer>) commandBuffer
+-(void) GenerateTerrainPropertiesMap: (id <MTLCommandBuffer>) commandBuffer regions:(id <MTLBuffer>) regions
 {
     auto GenerateSamplesBuffer = [] (id<MTLDevice> device, int numSamples)
     {
-        std::vector <float2> res;
-        
-        srand(12345);
-        const float sampleRadius = 32.0f;
-        
-        for (int i = 0; i < numSamples; i++)
-        {
-            float u = (float)rand() / (float)RAND_MAX;
-            float v = (float)rand() / (float)RAND_MAX;
-            
-            float r = sqrtf(u);
-            float theta = 2.0f * (float)M_PI * v;
-            
-            res.push_back ((float2) {cosf(theta), sinf(theta)} * r * sampleRadius);
-        }
+        // Portable samples, so offline bakes with AAPLBakeTerrainPropertiesMap reproduce this map
+        static_assert (sizeof(AAPLTerrainBakeSample) == sizeof(float2), "Occlusion samples are float2 in the kernel");
+        std::vector <AAPLTerrainBakeSample> res = AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling::Uniform,
+                                                                                      numSamples, TERRAIN_BAKE_PADDING, 12345);
         
         id<MTLBuffer> buffer = [device newBufferWithBytes:res.data()
                                                    length:res.size()*sizeof(res[0])
@@ -154,7 +198,34 @@ static std::array <HabitatTextures, 4> CreateTerrainTextures (id<MTLDevice> devi
     
     packed_float2 invSize = {1.f / _terrainHeight.width, 1.f / _terrainHeight.height};
     [computeEncoder setBytes:&invSize length:sizeof(invSize) atIndex:2];
-    [computeEncoder dispatchThreads:{_terrainHeight.width, _terrainHeight.height, 1} threadsPerThreadgroup:{16, 16, 1}];
+    [computeEncoder setBuffer:regions offset:0 atIndex:3];
+    [computeEncoder dispatchThreadgroupsWithIndirectBuffer:regions
+                                      indirectBufferOffset:0
+                                     threadsPerThreadgroup:{TERRAIN_BAKE_THREADGROUP_SIZE, TERRAIN_BAKE_THREADGROUP_SIZE, 1}];
+    [computeEncoder endEncoding];
+}
+
+// Downsamples the regions of the mip levels below level 0 in both maps, each level from the one above it.
+//  The dispatches of a compute encoder run one after the other, so each level reads a finished parent.
+-(void) GenerateTerrainMips: (id <MTLCommandBuffer>) commandBuffer regions:(id <MTLBuffer>) regions
+{
+    id <MTLComputeCommandEncoder> computeEncoder = [commandBuffer computeCommandEncoder];
+    
+    [computeEncoder setComputePipelineState:_pplCmp_DownsampleMip];
+    [computeEncoder setBuffer:regions offset:0 atIndex:0];
+    for (uint32_t level = 1; level < _terrainNormalMapLevels.size(); level++)
+    {
+        [computeEncoder setBytes:&level length:sizeof(level) atIndex:1];
+        
+        for (const std::vector <id <MTLTexture>>* levels : { &_terrainNormalMapLevels, &_terrainPropertiesMapLevels })
+        {
+            [computeEncoder setTexture:(*levels)[level - 1] atIndex:0];
+            [computeEncoder setTexture:(*levels)[level] atIndex:1];
+            [computeEncoder dispatchThreadgroupsWithIndirectBuffer:regions
+                                              indirectBufferOffset:level * sizeof(TerrainBakeRegion)
+                                             threadsPerThreadgroup:{TERRAIN_BAKE_THREADGROUP_SIZE, TERRAIN_BAKE_THREADGROUP_SIZE, 1}];
+        }
+    }
     [computeEncoder endEncoding];
 }
 
@@ -300,6 +371,8 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
         _pplCmp_BakeNormalsMips =                   CreateKernelPipeline (device, library, @"TerrainKnl_ComputeNormalsFromHeightmap");
         _pplCmp_ClearTexture =                      CreateKernelPipeline (device, library, @"TerrainKnl_ClearTexture");
         _pplCmp_UpdateHeightmap =                   CreateKernelPipeline (device, library, @"TerrainKnl_UpdateHeightmap");
+        _pplCmp_ComputeBrushBakeRegions =           CreateKernelPipeline (device, library, @"TerrainKnl_ComputeBrushBakeRegions");
+        _pplCmp_DownsampleMip =                     CreateKernelPipeline (device, library, @"TerrainKnl_DownsampleMip");
     }
     
     // Use a height map to define the initial terrain topography
@@ -341,11 +414,46 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
         texDesc.mipmapLevelCount = std::log2(MAX(heightMapWidth, heightMapHeight)) + 1;
         texDesc.storageMode = MTLStorageModePrivate;
         _terrainNormalMap = [device newTextureWithDescriptor:texDesc];
-        [self GenerateTerrainNormalMap:commandBuffer];
         
         texDesc.pixelFormat = MTLPixelFormatRGBA8Unorm;
         _terrainPropertiesMap = [device newTextureWithDescriptor:texDesc];
         
+        for (NSUInteger level = 0; level < texDesc.mipmapLevelCount; level++)
+        {
+            _terrainNormalMapLevels.push_back ([_terrainNormalMap newTextureViewWithPixelFormat:_terrainNormalMap.pixelFormat
+                                                                                    textureType:MTLTextureType2D
+                                                                                         levels:NSMakeRange(level, 1)
+                                                                                         slices:NSMakeRange(0, 1)]);
+            _terrainPropertiesMapLevels.push_back ([_terrainPropertiesMap newTextureViewWithPixelFormat:_terrainPropertiesMap.pixelFormat
+                                                                                            textureType:MTLTextureType2D
+                                                                                                 levels:NSMakeRange(level, 1)
+                                                                                                 slices:NSMakeRange(0, 1)]);
+        }
+        
+        // The regions covering every texel of every level, for the initial bake. A brush stroke only rebakes
+        //  the regions TerrainKnl_ComputeBrushBakeRegions finds, including their mip ancestors.
+        static_assert (sizeof (TerrainBakeRegion::threadgroupsPerGrid) == sizeof (MTLDispatchThreadgroupsIndirectArguments),
+                       "TerrainBakeRegion must start with the indirect dispatch arguments");
+        const NSUInteger regionsLength = texDesc.mipmapLevelCount * sizeof(TerrainBakeRegion);
+        _fullBakeRegionsBfr = [device newBufferWithLength:regionsLength options:MTLResourceStorageModeShared];
+        _brushBakeRegionsBfr = [device newBufferWithLength:regionsLength options:MTLResourceStorageModePrivate];
+        
+        const AAPLTerrainBakeRegion fullRegion = { 0, 0, (uint32_t)heightMapWidth, (uint32_t)heightMapHeight };
+        TerrainBakeRegion* fullRegions = (TerrainBakeRegion*)_fullBakeRegionsBfr.contents;
+        for (uint32_t level = 0; level < texDesc.mipmapLevelCount; level++)
+        {
+            const AAPLTerrainBakeRegion region = AAPLGetTerrainMipBakeRegion (fullRegion, (uint32_t)heightMapWidth, (uint32_t)heightMapHeight, level);
+            fullRegions [level].threadgroupsPerGrid [0] = (region.width + TERRAIN_BAKE_THREADGROUP_SIZE - 1) / TERRAIN_BAKE_THREADGROUP_SIZE;
+            fullRegions [level].threadgroupsPerGrid [1] = (region.height + TERRAIN_BAKE_THREADGROUP_SIZE - 1) / TERRAIN_BAKE_THREADGROUP_SIZE;
+            fullRegions [level].threadgroupsPerGrid [2] = 1;
+            fullRegions [level].originX = region.x;
+            fullRegions [level].originY = region.y;
+            fullRegions [level].width = region.width;
+            fullRegions [level].height = region.height;
+        }
+        
+        [self GenerateTerrainNormalMap:commandBuffer regions:_fullBakeRegionsBfr];
+        
         // We need to clear the properties map as 'GenerateTerrainPropertiesMap' will only fill in specific color channels
         {
             id <MTLComputeCommandEncoder> encoder = [commandBuffer computeCommandEncoder];
@@ -354,14 +462,8 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
             [encoder dispatchThreads:{heightMapWidth, heightMapHeight, 1} threadsPerThreadgroup:{8, 8, 1}];
             [encoder endEncoding];
         }
-        [self GenerateTerrainPropertiesMap:commandBuffer];
-        
-        {
-            id<MTLBlitCommandEncoder> blit = [commandBuffer blitCommandEncoder];
-            [blit generateMipmapsForTexture:_terrainNormalMap];
-            [blit generateMipmapsForTexture:_terrainPropertiesMap];
-            [blit endEncoding];
-        }
+        [self GenerateTerrainPropertiesMap:commandBuffer regions:_fullBakeRegionsBfr];
+        [self GenerateTerrainMips:commandBuffer regions:_fullBakeRegionsBfr];
     }
     
     // Loading rendering pipelines
@@ -437,14 +539,196 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
     
     _visiblePatchesTessFactorBfr = [device newBufferWithLength:sizeof(MTLQuadTessellationFactorsHalf) * TERRAIN_PATCHES * TERRAIN_PATCHES
                                                        options:MTLResourceStorageModePrivate];
+    _drawPatchIndicesBfr = _visiblePatchIndicesBfr;
+    _drawTessFactorBfr = _visiblePatchesTessFactorBfr;
+    _visiblePatchCount = TERRAIN_PATCHES * TERRAIN_PATCHES;
+    
+    // The shadow views draw every patch
+    {
+        std::vector <uint32_t> allPatchIndices (TERRAIN_PATCHES * TERRAIN_PATCHES);
+        for (uint32_t i = 0; i < allPatchIndices.size(); i++)
+            allPatchIndices [i] = i;
+        _allPatchIndicesBfr = [device newBufferWithBytes:allPatchIndices.data()
+                                                  length:allPatchIndices.size() * sizeof(uint32_t)
+                                                 options:MTLResourceStorageModeShared];
+    }
+    
+    // The quadtree is built from a copy of the initial height map once this command buffer completes;
+    //  until then the patches are drawn with the GPU tessellation factors
+    _cpuPatchCulling = true;
+    _quadtree = std::make_unique <AAPLTerrainQuadtree> (TERRAIN_PATCHES, TERRAIN_SCALE, TERRAIN_HEIGHT);
+    _heightPyramid = std::make_unique <AAPLTerrainHeightPyramid> (TERRAIN_SCALE, TERRAIN_HEIGHT);
+    for (NSUInteger i = 0; i < kCpuCullingRingSize; i++)
+    {
+        _cpuPatchIndicesBfr [i] = [device newBufferWithLength:sizeof(uint32_t) * TERRAIN_PATCHES * TERRAIN_PATCHES
+                                                      options:MTLResourceStorageModeShared];
+        _cpuTessFactorBfr [i] = [device newBufferWithLength:sizeof(MTLQuadTessellationFactorsHalf) * TERRAIN_PATCHES * TERRAIN_PATCHES
+                                                    options:MTLResourceStorageModeShared];
+    }
+    const AAPLGpuBuffer<AAPLUniforms> noUniforms;
+    [self encodeHeightReadback:commandBuffer
+                globalUniforms:noUniforms
+                   mouseBuffer:nil];
     
     [commandBuffer commit];
     return self;
 }
 
+// Copies the height map to a buffer the quadtree reads once the command buffer completes. After an edit,
+//  the brush goes along so only the patches it touched are refreshed; without a mouse buffer the whole
+//  map is.
+-(void) encodeHeightReadback:(id <MTLCommandBuffer>) commandBuffer
+              globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms
+                 mouseBuffer:(id<MTLBuffer>) mouseBuffer
+{
+    const NSUInteger texelBytes = _terrainHeight.width * _terrainHeight.height * sizeof(uint16_t) * 2;
+    
+    id <MTLBuffer> buffer;
+    if (_freeHeightReadbackBfrs.empty())
+    {
+        buffer = [commandBuffer.device newBufferWithLength:texelBytes + sizeof(HeightReadbackBrush)
+                                                   options:MTLResourceStorageModeShared];
+    }
+    else
+    {
+        buffer = _freeHeightReadbackBfrs.back();
+        _freeHeightReadbackBfrs.pop_back();
+    }
+    
+    id <MTLBlitCommandEncoder> blit = [commandBuffer blitCommandEncoder];
+    [blit copyFromTexture:_terrainHeight
+              sourceSlice:0
+              sourceLevel:0
+             sourceOrigin:{0,0,0}
+               sourceSize:MTLSizeMake(_terrainHeight.width, _terrainHeight.height, 1)
+                 toBuffer:buffer
+        destinationOffset:0
+   destinationBytesPerRow:_terrainHeight.width * sizeof(uint16_t) * 2
+ destinationBytesPerImage:texelBytes];
+    
+    const bool wholeMap = (mouseBuffer == nil);
+    if (!wholeMap)
+    {
+        [blit copyFromBuffer:mouseBuffer
+                sourceOffset:0
+                    toBuffer:buffer
+           destinationOffset:texelBytes + offsetof(HeightReadbackBrush, mousePosition)
+                        size:sizeof(float4)];
+        [blit copyFromBuffer:globalUniforms.getBuffer()
+                sourceOffset:globalUniforms.getOffset() + offsetof(AAPLUniforms, brushSize)
+                    toBuffer:buffer
+           destinationOffset:texelBytes + offsetof(HeightReadbackBrush, brushSize)
+                        size:sizeof(float)];
+    }
+    [blit endEncoding];
+    
+    [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer> _Nonnull)
+    {
+        std::lock_guard <std::mutex> lock (self->_heightReadbackMutex);
+        self->_pendingHeightReadbacks.push_back ({ buffer, wholeMap });
+    }];
+}
+
+// Brings the quadtree and the height pyramid up to date with the height map copies of the command buffers completed so far
+-(void) applyHeightReadbacks
+{
+    std::vector <HeightReadback> readbacks;
+    {
+        std::lock_guard <std::mutex> lock (_heightReadbackMutex);
+        readbacks.swap (_pendingHeightReadbacks);
+    }
+    
+    const uint32_t width = (uint32_t)_terrainHeight.width;
+    const uint32_t height = (uint32_t)_terrainHeight.height;
+    for (const HeightReadback& readback : readbacks)
+    {
+        const AAPLTerrainQuadtreeHeights heights = { (const uint16_t*)readback.buffer.contents, width, height, 2 };
+        if (readback.wholeMap)
+        {
+            _quadtree->build (heights);
+            _heightPyramid->build (heights);
+        }
+        else if (_quadtree->isBuilt())
+        {
+            // TerrainKnl_UpdateHeightmap leaves the texels two brush sizes away from the cursor untouched
+            const HeightReadbackBrush& brush =
+                *(const HeightReadbackBrush*)((const uint8_t*)readback.buffer.contents + width * height * sizeof(uint16_t) * 2);
+            const float2 size = (float2) { (float)width, (float)height };
+            const float2 lo = simd::floor (((brush.mousePosition.xz - 2.0f * brush.brushSize) / TERRAIN_SCALE + 0.5f) * size);
+            const float2 hi = simd::ceil (((brush.mousePosition.xz + 2.0f * brush.brushSize) / TERRAIN_SCALE + 0.5f) * size) + 1.0f;
+            const uint2 texelMin = (uint2) simd::clamp (lo, (float2) { 0, 0 }, size);
+            const uint2 texelMax = (uint2) simd::clamp (hi, (float2) { 0, 0 }, size);
+            _quadtree->update (heights, texelMin.x, texelMin.y, texelMax.x, texelMax.y);
+            _heightPyramid->update (heights, texelMin.x, texelMin.y, texelMax.x, texelMax.y);
+        }
+        _freeHeightReadbackBfrs.push_back (readback.buffer);
+    }
+}
+
+-(bool) raycastTerrainFrom:(float3) origin
+                 direction:(float3) direction
+               maxDistance:(float) maxDistance
+               hitPosition:(float3*) outPosition
+                 hitNormal:(float3*) outNormal
+{
+    const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+    const float rayDirection[3] = { direction.x, direction.y, direction.z };
+    AAPLTerrainRayHit hit;
+    if (!_heightPyramid->raycast (rayOrigin, rayDirection, maxDistance, &hit))
+        return false;
+    
+    if (outPosition)
+        *outPosition = (float3) { hit.position[0], hit.position[1], hit.position[2] };
+    if (outNormal)
+        *outNormal = (float3) { hit.normal[0], hit.normal[1], hit.normal[2] };
+    return true;
+}
+
+-(bool) isTerrainLineOfSightClearFrom:(float3) from to:(float3) to
+{
+    const float start[3] = { from.x, from.y, from.z };
+    const float end[3] = { to.x, to.y, to.z };
+    return _heightPyramid->isLineOfSightClear (start, end);
+}
+
+-(float) terrainHeightAt:(float2) position
+{
+    return _heightPyramid->getHeight (position.x, position.y);
+}
+
 -(void) computeTesselationFactors:(id <MTLCommandBuffer>) commandBuffer
-                   globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms;
+                   globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms
+                      cpuUniforms:(const AAPLUniforms&)cpuUniforms
 {
+    [self applyHeightReadbacks];
+    
+    if (_cpuPatchCulling && _quadtree->isBuilt())
+    {
+        // Cull against the main camera; the factors of all patches are still written for the shadow views
+        AAPLTerrainQuadtreeView view;
+        memcpy (view.viewProjection, &cpuUniforms.cameraUniforms.viewProjectionMatrix, sizeof(view.viewProjection));
+        memcpy (view.frustumPlanes, cpuUniforms.cameraUniforms.frustumPlanes, sizeof(view.frustumPlanes));
+        const float4 cameraPosition = cpuUniforms.cameraUniforms.invViewMatrix.columns[3];
+        view.cameraPosition[0] = cameraPosition.x;
+        view.cameraPosition[1] = cameraPosition.y;
+        view.cameraPosition[2] = cameraPosition.z;
+        view.projectionYScale = cpuUniforms.projectionYScale;
+        view.tessellationScale = _tessellationScale;
+        view.horizonCulling = true;
+        
+        _cpuCullingRingIndex = (_cpuCullingRingIndex + 1) % kCpuCullingRingSize;
+        _drawPatchIndicesBfr = _cpuPatchIndicesBfr [_cpuCullingRingIndex];
+        _drawTessFactorBfr = _cpuTessFactorBfr [_cpuCullingRingIndex];
+        _visiblePatchCount = _quadtree->cull (view,
+                                              (uint32_t*)_drawPatchIndicesBfr.contents,
+                                              (AAPLTerrainPatchFactors*)_drawTessFactorBfr.contents);
+        return;
+    }
+    
+    _drawPatchIndicesBfr = _visiblePatchIndicesBfr;
+    _drawTessFactorBfr = _visiblePatchesTessFactorBfr;
+    _visiblePatchCount = TERRAIN_PATCHES * TERRAIN_PATCHES;
+    
     id <MTLComputeCommandEncoder> computeEncoder = [commandBuffer computeCommandEncoder];
     
     [computeEncoder setComputePipelineState:_pplCmp_FillInTesselationFactors];
@@ -470,7 +754,7 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
     [renderEncoder setRenderPipelineState:_pplRnd_TerrainShadow];
     [renderEncoder setDepthBias:0.001 slopeScale:2 clamp:1];
     
-    [renderEncoder setTessellationFactorBuffer:_visiblePatchesTessFactorBfr offset:0 instanceStride:0];
+    [renderEncoder setTessellationFactorBuffer:_drawTessFactorBfr offset:0 instanceStride:0];
     [renderEncoder setCullMode:MTLCullModeFront];
     
     [renderEncoder setVertexBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:1];
@@ -479,7 +763,7 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
     [renderEncoder drawPatches:4
                     patchStart:0
                     patchCount:TERRAIN_PATCHES*TERRAIN_PATCHES
-              patchIndexBuffer:_visiblePatchIndicesBfr
+              patchIndexBuffer:_allPatchIndicesBfr
         patchIndexBufferOffset:0
                  instanceCount:1
                   baseInstance:0];
@@ -503,7 +787,7 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
                              usage: MTLResourceUsageSample | MTLResourceUsageRead];
     }
 
-    [renderEncoder setTessellationFactorBuffer:_visiblePatchesTessFactorBfr offset:0 instanceStride:0];
+    [renderEncoder setTessellationFactorBuffer:_drawTessFactorBfr offset:0 instanceStride:0];
     [renderEncoder setVertexBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:1];
     [renderEncoder setVertexTexture:_terrainHeight atIndex:0];
 
@@ -515,10 +799,13 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
     [renderEncoder setFragmentTexture:_terrainNormalMap atIndex:1];
     [renderEncoder setFragmentTexture:_terrainPropertiesMap atIndex:2];
     
+    if (_visiblePatchCount == 0)
+        return;
+    
     [renderEncoder drawPatches:4
                     patchStart:0
-                    patchCount:TERRAIN_PATCHES*TERRAIN_PATCHES
-              patchIndexBuffer:_visiblePatchIndicesBfr
+                    patchCount:_visiblePatchCount
+              patchIndexBuffer:_drawPatchIndicesBfr
         patchIndexBufferOffset:0
                  instanceCount:1
                   baseInstance:0];
@@ -537,15 +824,23 @@ static void EncodeParam (id <MTLArgumentEncoder> paramsEncoder,
     [computeEncoder setBuffer:mouseBuffer offset:0 atIndex:0];
     [computeEncoder setBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:1];
     [computeEncoder dispatchThreadgroups:MTLSizeMake(_terrainHeight.width/8, _terrainHeight.height/8, 1) threadsPerThreadgroup:MTLSizeMake(8, 8, 1)];
+    
+    // Only the texels around the brush need a rebake; the mouse position is only known on the GPU, so the
+    //  regions are found there and drive indirect dispatches
+    const uint32_t levelCount = (uint32_t)_terrainNormalMapLevels.size();
+    [computeEncoder setComputePipelineState:_pplCmp_ComputeBrushBakeRegions];
+    [computeEncoder setBuffer:_brushBakeRegionsBfr offset:0 atIndex:2];
+    [computeEncoder setBytes:&levelCount length:sizeof(levelCount) atIndex:3];
+    [computeEncoder dispatchThreads:MTLSizeMake(levelCount, 1, 1) threadsPerThreadgroup:MTLSizeMake(levelCount, 1, 1)];
     [computeEncoder endEncoding];
     
-    [self GenerateTerrainNormalMap:commandBuffer];
-    [self GenerateTerrainPropertiesMap:commandBuffer];
+    [self GenerateTerrainNormalMap:commandBuffer regions:_brushBakeRegionsBfr];
+    [self GenerateTerrainPropertiesMap:commandBuffer regions:_brushBakeRegionsBfr];
+    [self GenerateTerrainMips:commandBuffer regions:_brushBakeRegionsBfr];
     
-    id<MTLBlitCommandEncoder> blit = [commandBuffer blitCommandEncoder];
-    [blit generateMipmapsForTexture:_terrainNormalMap];
-    [blit generateMipmapsForTexture:_terrainPropertiesMap];
-    [blit endEncoding];
+    [self encodeHeightReadback:commandBuffer
+                globalUniforms:globalUniforms
+                   mouseBuffer:mouseBuffer];
 }
 
 @end
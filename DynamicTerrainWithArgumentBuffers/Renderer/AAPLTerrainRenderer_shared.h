@@ -116,6 +116,23 @@ struct TerrainParams
 #define TERRAIN_HEIGHT  4500.0f
 #define TERRAIN_WATER_LEVEL 50.0
 
+// Threads along a side of the threadgroups of the normal and properties map bakes
+#define TERRAIN_BAKE_THREADGROUP_SIZE 16
+
+// Texels around a height edit whose normals and properties change: the radius of the occlusion samples
+#define TERRAIN_BAKE_PADDING 32
+
+// The texels of one mip level of the normal and properties maps a bake covers, and the indirect dispatch
+//  running TERRAIN_BAKE_THREADGROUP_SIZE^2 threadgroups over them (see AAPLTerrainBake.h)
+struct TerrainBakeRegion
+{
+    uint32_t        threadgroupsPerGrid[3];     // Layout of MTLDispatchThreadgroupsIndirectArguments
+    uint32_t        originX;
+    uint32_t        originY;
+    uint32_t        width;
+    uint32_t        height;
+};
+
 struct TerrainAdjustParams
 {
     simd::float4x4  inverseViewProjectionMatrix;
@@ -0,0 +1,146 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header-only reader and writer for tiled heightmaps, the on-disk format of terrains too large for one texture.
+ A file holds a grid of fixed size tiles of 16-bit heights in row major order. Every tile carries a border
+ of texels copied from its neighbors so it can be filtered on its own, and all tiles have the same size so
+ a tile is found by its index alone and read in place from the mapped file.
+ Tile (0, 0) starts at world position (-tilesX, -tilesY) * tileWorldSize / 2, which centers the terrain on
+ the origin like the single texture terrain.
+*/
+
+#pragma once
+
+#include "AAPLObjParser.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static constexpr uint32_t kTiledHeightmapVersion    = 1;
+static constexpr uint32_t kTiledHeightmapMagic      = 0x48544C41; // 'ALTH'
+
+// Tile data starts on this alignment so it can be read in place
+static constexpr uint64_t kTiledHeightmapAlignment  = 256;
+
+struct AAPLTiledHeightmapHeader
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    tileSize;           // Texels along a tile side, not counting the border
+    uint32_t    tileBorder;         // Texels on each side of a tile repeated from its neighbors
+    uint32_t    tilesX;
+    uint32_t    tilesY;
+    float       tileWorldSize;      // World units covered by the tileSize texels of a tile
+    float       heightScale;        // World height of the texel value 65535
+    uint64_t    tileDataOffset;     // From the start of the file
+
+    // Texels along a tile side, including the border
+    uint32_t    getStride () const          { return tileSize + 2 * tileBorder; }
+    size_t      getTileTexelCount () const  { return (size_t) getStride() * getStride(); }
+};
+
+// Splits a heightmap whose sides are multiples of `tileSize` into tiles and writes them out. Borders
+//  outside of the heightmap repeat its edge texels. The data goes to a temporary file that is renamed
+//  into place so a reader never observes a partially written file.
+inline bool AAPLWriteTiledHeightmap (const char*        path,
+                                     const uint16_t*    heights,
+                                     uint32_t           width,
+                                     uint32_t           height,
+                                     uint32_t           tileSize,
+                                     uint32_t           tileBorder,
+                                     float              tileWorldSize,
+                                     float              heightScale)
+{
+    if (tileSize == 0 || width % tileSize != 0 || height % tileSize != 0)
+        return false;
+
+    AAPLTiledHeightmapHeader header;
+    memset (&header, 0, sizeof(header));
+    header.magic            = kTiledHeightmapMagic;
+    header.version          = kTiledHeightmapVersion;
+    header.tileSize         = tileSize;
+    header.tileBorder       = tileBorder;
+    header.tilesX           = width / tileSize;
+    header.tilesY           = height / tileSize;
+    header.tileWorldSize    = tileWorldSize;
+    header.heightScale      = heightScale;
+    header.tileDataOffset   = (sizeof(header) + kTiledHeightmapAlignment - 1) & ~(kTiledHeightmapAlignment - 1);
+
+    std::string temporaryPath = std::string (path) + ".tmp";
+    FILE* file = fopen (temporaryPath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    static const uint8_t kPadding[kTiledHeightmapAlignment] = {};
+    bool success = fwrite (&header, sizeof(header), 1, file) == 1 &&
+                   fwrite (kPadding, 1, header.tileDataOffset - sizeof(header), file) == header.tileDataOffset - sizeof(header);
+
+    const uint32_t stride = header.getStride();
+    std::vector<uint16_t> tile (header.getTileTexelCount());
+    for (uint32_t ty = 0; ty < header.tilesY && success; ty++)
+    for (uint32_t tx = 0; tx < header.tilesX && success; tx++)
+    {
+        for (uint32_t y = 0; y < stride; y++)
+        {
+            int64_t sy = std::min (std::max ((int64_t) ty * tileSize + y - tileBorder, (int64_t) 0), (int64_t) height - 1);
+            for (uint32_t x = 0; x < stride; x++)
+            {
+                int64_t sx = std::min (std::max ((int64_t) tx * tileSize + x - tileBorder, (int64_t) 0), (int64_t) width - 1);
+                tile[y * stride + x] = heights[sy * width + sx];
+            }
+        }
+        success = fwrite (tile.data(), sizeof(uint16_t), tile.size(), file) == tile.size();
+    }
+
+    success = (fclose (file) == 0) && success;
+    if (success)
+        success = rename (temporaryPath.c_str(), path) == 0;
+    if (!success)
+        remove (temporaryPath.c_str());
+    return success;
+}
+
+// Maps a tiled heightmap and validates its header against the file size
+class AAPLTiledHeightmap
+{
+public:
+    explicit AAPLTiledHeightmap (const char* path) :
+    file (path),
+    header (nullptr)
+    {
+        if (!file.isValid() || file.getSize() < sizeof(AAPLTiledHeightmapHeader))
+            return;
+
+        const AAPLTiledHeightmapHeader* candidate = (const AAPLTiledHeightmapHeader*) file.begin();
+        if (candidate->magic != kTiledHeightmapMagic ||
+            candidate->version != kTiledHeightmapVersion ||
+            candidate->tileSize == 0 || candidate->tilesX == 0 || candidate->tilesY == 0 ||
+            candidate->tileDataOffset < sizeof(AAPLTiledHeightmapHeader))
+            return;
+
+        uint64_t tileBytes = candidate->getTileTexelCount() * sizeof(uint16_t);
+        if (candidate->tileDataOffset + (uint64_t) candidate->tilesX * candidate->tilesY * tileBytes > file.getSize())
+            return;
+
+        header = candidate;
+    }
+
+    bool                                isValid () const    { return header != nullptr; }
+    const AAPLTiledHeightmapHeader&     getHeader () const  { return *header; }
+
+    // Texels of a tile, getStride() by getStride() including the border
+    const uint16_t* getTile (uint32_t tileX, uint32_t tileY) const
+    {
+        size_t index = (size_t) tileY * header->tilesX + tileX;
+        return (const uint16_t*) (file.begin() + header->tileDataOffset) + index * header->getTileTexelCount();
+    }
+
+private:
+    AAPLMappedFile                      file;
+    const AAPLTiledHeightmapHeader*     header;
+};
@@ -0,0 +1,457 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the CPU vegetation placement.
+ The grid is processed a row at a time. The per-cell terrain evaluation is written as loops over
+ structure-of-arrays rows with no branches, which the compiler vectorizes; only the texture reads (gathers)
+ and the rule selection, history update and instance appends, which branch per cell, stay scalar.
+ Clang vectorizes them as is; GCC also needs -fno-trapping-math to if-convert the selects.
+ Every step follows vegetation_instanceGenerate and EvaluateTerrainAtLocation line for line, keep them in sync.
+*/
+
+#include "AAPLVegetationPlacement.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+// Selects rather than std::min/max on references so loops using it can be if-converted and vectorized
+static inline float saturate (float v)
+{
+    v = v > 0.0f ? v : 0.0f;
+    return v < 1.0f ? v : 1.0f;
+}
+
+static inline float smoothstep (float edge0, float edge1, float x)
+{
+    float t = saturate ((x - edge0) / (edge1 - edge0));
+    return t * t * (3.0f - 2.0f * t);
+}
+
+static inline float step (float edge, float x)
+{
+    return x >= edge ? 1.0f : 0.0f;
+}
+
+static inline float fadeInOut (float rangeStart, float rangeEnd, float fadeIn, float fadeOut, float value)
+{
+    float in  = smoothstep (rangeStart, rangeStart + (rangeEnd - rangeStart) * fadeIn, value);
+    float out = 1.0f - smoothstep (rangeEnd - (rangeEnd - rangeStart) * fadeOut, rangeEnd, value);
+    return in * out;
+}
+
+// The Metal version computes max (value, step (1.0-thld, value)) first but overwrites it
+static inline float trim (float threshold, float value)
+{
+    float stepped = step (threshold, value);
+    return value < stepped ? value : stepped;
+}
+
+static inline uint32_t wangHash (uint32_t seed)
+{
+    seed = (seed ^ 61) ^ (seed >> 16);
+    seed *= 9;
+    seed = seed ^ (seed >> 4);
+    seed *= 0x27d4eb2d;
+    seed = seed ^ (seed >> 15);
+    return seed;
+}
+
+static inline void normalize (float v[3])
+{
+    float invLength = 1.0f / sqrtf (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] *= invLength;
+    v[1] *= invLength;
+    v[2] *= invLength;
+}
+
+static inline void cross (const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Bilinear sample at normalized coordinates with clamp to edge addressing
+static float sampleImage (const AAPLVegetationPlacementImage& image, float u, float v, uint32_t channel)
+{
+    assert (channel < image.channelCount);
+    float x = u * (float) image.width - 0.5f;
+    float y = v * (float) image.height - 0.5f;
+    float fx = floorf (x);
+    float fy = floorf (y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    const int maxX = (int) image.width - 1;
+    const int maxY = (int) image.height - 1;
+    int x0 = std::min (std::max ((int) fx, 0), maxX);
+    int y0 = std::min (std::max ((int) fy, 0), maxY);
+    int x1 = std::min (std::max ((int) fx + 1, 0), maxX);
+    int y1 = std::min (std::max ((int) fy + 1, 0), maxY);
+
+    auto texel = [&] (int i, int j) { return image.data[((size_t) j * image.width + i) * image.channelCount + channel]; };
+    float top    = texel (x0, y0) + (texel (x1, y0) - texel (x0, y0)) * tx;
+    float bottom = texel (x0, y1) + (texel (x1, y1) - texel (x0, y1)) * tx;
+    return top + (bottom - top) * ty;
+}
+
+namespace
+{
+    // Per-cell values of one grid row, one array per value
+    struct PlacementRow
+    {
+        std::vector<uint32_t>   rnd0, rnd1;
+        std::vector<float>      u, v;
+        std::vector<float>      height, normalX, normalY, normalZ, heightVariance;
+        std::vector<float>      habitats[AAPLVegetationHabitatCount];
+
+        explicit PlacementRow (size_t width) :
+        rnd0 (width), rnd1 (width), u (width), v (width),
+        height (width), normalX (width), normalY (width), normalZ (width), heightVariance (width)
+        {
+            for (std::vector<float>& habitat : habitats)
+                habitat.resize (width);
+        }
+    };
+}
+
+// Habitat percentages of a row of cells, as EvaluateTerrainAtLocation. The outputs are restrict
+//  qualified; with nine arrays the compiler would otherwise give up on checking their overlap at run time
+static void evaluateHabitats (uint32_t              count,
+                              float                 terrainHeight,
+                              const float*          heights,
+                              const float*          normalsX,
+                              const float*          normalsY,
+                              const float*          normalsZ,
+                              const float*          heightVariances,
+                              float* __restrict     sands,
+                              float* __restrict     grasses,
+                              float* __restrict     rocks,
+                              float* __restrict     snows)
+{
+    for (uint32_t x = 0; x < count; x++)
+    {
+        float nx = normalsX[x] * 2.0f - 1.0f;
+        float ny = normalsY[x] * 2.0f - 1.0f;
+        float nz = normalsZ[x] * 2.0f - 1.0f;
+        float slope = saturate (ny / sqrtf (nx * nx + ny * ny + nz * nz));
+        float elevation = saturate (heights[x] * terrainHeight / terrainHeight);
+
+        float heightVarianceFade = smoothstep (0.1f, 1.0f, (elevation + 0.09f) * 0.9174f);
+        float snow = trim (0.002f, saturate (smoothstep (0.2f, 1.0f, elevation) +
+                                             smoothstep (0.0f, 1.0f, heightVarianceFade * heightVariances[x] * 250.0f)));
+        float sand = trim (0.002f, 1.0f - smoothstep (0.0f, 1.0f, saturate ((elevation - 0.009f) * (1.0f / 0.05f))));
+        float grass = trim (0.002f, fadeInOut (0.04f, 0.25f, 0.2f, 0.5f, elevation) *
+                                    smoothstep (0.0f, 1.0f, saturate (slope * 2.2f - 1.1f)));
+
+        float grassPlusSand = sand + grass;
+        float normalization = grassPlusSand > 1.0f ? grassPlusSand : 1.0f;
+        float remainder = 1.0f - snow;
+        sand  = sand / normalization * remainder;
+        grass = grass / normalization * remainder;
+
+        snows[x]   = snow;
+        sands[x]   = sand;
+        grasses[x] = grass;
+        rocks[x]   = remainder - sand - grass;
+    }
+}
+
+// Picks the LOD of every shadow cascade bin; the main camera bins keep LOD 0
+static void selectShadowLods (const AAPLVegetationPlacementSettings& settings, const AAPLVegetationPlacementFrame& frame, AAPLVegetationPlacementOutput& output)
+{
+    for (uint32_t camera = 1; camera < settings.cameraCount; camera++)
+    {
+        float texelsPerWorldUnit = frame.cameras[camera].projectionYScale * 0.5f * settings.shadowMapSize;
+        for (uint32_t population = 0; population < settings.populationCount; population++)
+        {
+            const AAPLVegetationPlacementLod* lods = &settings.lods[population * settings.maxLodCount];
+            uint32_t lod = 0;
+            for (uint32_t l = 1; l < settings.maxLodCount; l++)
+            {
+                if (lods[l].worldError * texelsPerWorldUnit <= settings.maxLodTexelError)
+                    lod = l;
+            }
+            AAPLVegetationPlacementArguments& arguments = output.arguments[population + camera * settings.populationCount];
+            arguments.indexStart = lods[lod].indexStart;
+            arguments.indexCount = lods[lod].indexCount;
+        }
+    }
+}
+
+// Appends an instance to the bin of every camera whose frustum its bounding sphere touches
+static void spawnInstance (const AAPLVegetationPlacementSettings&   settings,
+                           const AAPLVegetationPlacementFrame&      frame,
+                           uint32_t                                 population,
+                           const AAPLVegetationPlacementMatrix&     worldMatrix,
+                           const float                              center[3],
+                           float                                    radius,
+                           AAPLVegetationPlacementOutput&           output)
+{
+    for (uint32_t camera = 0; camera < settings.cameraCount; camera++)
+    {
+        bool visible = true;
+        for (uint32_t p = 0; p < 6; p++)
+        {
+            const float* plane = frame.cameras[camera].frustumPlanes[p];
+            visible = visible && plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] > -radius;
+        }
+        if (!visible)
+            continue;
+
+        // A full bin drops the instance, as the kernel rewinds its slot allocation
+        uint32_t bin = population + camera * settings.populationCount;
+        AAPLVegetationPlacementArguments& arguments = output.arguments[bin];
+        if (arguments.instanceCount < settings.maxInstanceCount)
+            output.instances[(size_t) bin * settings.maxInstanceCount + arguments.instanceCount++] = worldMatrix;
+    }
+}
+
+static AAPLVegetationPlacementMatrix makeWorldMatrix (const float fwd[3], const float up[3], const float right[3], const float position[3], float scale)
+{
+    AAPLVegetationPlacementMatrix matrix;
+    for (uint32_t c = 0; c < 3; c++)
+    {
+        matrix.columns[0][c] = fwd[c] * scale;
+        matrix.columns[1][c] = up[c] * scale;
+        matrix.columns[2][c] = right[c] * scale;
+        matrix.columns[3][c] = position[c];
+    }
+    matrix.columns[0][3] = matrix.columns[1][3] = matrix.columns[2][3] = 0.0f;
+    matrix.columns[3][3] = 1.0f;
+    return matrix;
+}
+
+static float boingEase (float f)
+{
+    return 1.0f - cosf (20.0f * f) * powf (2.0f, f * -12.0f);
+}
+
+void AAPLPlaceVegetation (const AAPLVegetationPlacementSettings&    settings,
+                          const AAPLVegetationPlacementTerrain&     terrain,
+                          const AAPLVegetationPlacementFrame&       frame,
+                          std::vector<uint32_t>&                    history,
+                          AAPLVegetationPlacementOutput&            output)
+{
+    const uint32_t grid = settings.gridResolution;
+    const uint32_t binCount = settings.populationCount * settings.cameraCount;
+    assert (settings.rules.size() == AAPLVegetationHabitatCount * settings.rulesPerHabitat);
+    assert (settings.lods.size() == settings.populationCount * settings.maxLodCount);
+    assert (frame.cameras.size() == settings.cameraCount);
+    assert (history.size() == (size_t) grid * grid);
+
+    // Same reset state as the indirect reset buffer
+    output.instances.resize ((size_t) binCount * settings.maxInstanceCount);
+    output.arguments.resize (binCount);
+    for (uint32_t b = 0; b < binCount; b++)
+    {
+        const AAPLVegetationPlacementLod& lod = settings.lods[(b % settings.populationCount) * settings.maxLodCount];
+        output.arguments[b] = { lod.indexCount, 0, lod.indexStart, 0, b * settings.maxInstanceCount };
+    }
+    selectShadowLods (settings, frame, output);
+
+    // The random directions only take 255 and 256 distinct angles
+    float sinTable[0xFF];
+    float cosTable[0x100];
+    for (uint32_t i = 0; i < 0xFF; i++)
+        sinTable[i] = sinf ((float) i);
+    for (uint32_t i = 0; i < 0x100; i++)
+        cosTable[i] = cosf ((float) i);
+
+    PlacementRow row (grid);
+    for (uint32_t y = 0; y < grid; y++)
+    {
+        // Random values and placement coordinates
+        for (uint32_t x = 0; x < grid; x++)
+        {
+            row.rnd0[x] = wangHash (x + y * 0xABBA);
+            row.rnd1[x] = wangHash (row.rnd0[x]);
+        }
+        for (uint32_t x = 0; x < grid; x++)
+        {
+            row.u[x] = (sinTable[row.rnd0[x] % 0xFF] * 0.5f + (float) x) / (float) grid;
+            row.v[x] = (cosTable[row.rnd0[x] & 0xFF] * 0.5f + (float) y) / (float) grid;
+        }
+
+        // Texture reads
+        for (uint32_t x = 0; x < grid; x++)
+        {
+            row.height[x]  = sampleImage (terrain.heightMap, row.u[x], row.v[x], 0);
+            row.normalX[x] = sampleImage (terrain.normalMap, row.u[x], row.v[x], 0);
+            row.normalY[x] = sampleImage (terrain.normalMap, row.u[x], row.v[x], 2);
+            row.normalZ[x] = sampleImage (terrain.normalMap, row.u[x], row.v[x], 1);
+            row.heightVariance[x] = std::max (sampleImage (terrain.propertiesMap, row.u[x], row.v[x], 1),
+                                              sampleImage (terrain.propertiesMapLevel1, row.u[x], row.v[x], 1));
+        }
+
+        evaluateHabitats (grid, settings.terrainHeight,
+                          row.height.data(), row.normalX.data(), row.normalY.data(), row.normalZ.data(), row.heightVariance.data(),
+                          row.habitats[AAPLVegetationHabitatSand].data(), row.habitats[AAPLVegetationHabitatGrass].data(),
+                          row.habitats[AAPLVegetationHabitatRock].data(), row.habitats[AAPLVegetationHabitatSnow].data());
+
+        // Rule selection, history and spawning
+        for (uint32_t x = 0; x < grid; x++)
+        {
+            float nrnd0 = (row.rnd0[x] & 0xFFFF) / 65535.0f;
+            float nrnd1 = (row.rnd1[x] & 0xFFFF) / 65535.0f;
+            float vrnd0[2] = { sinTable[row.rnd0[x] % 0xFF], cosTable[row.rnd0[x] & 0xFF] };
+            float vrnd1[2] = { sinTable[row.rnd1[x] % 0xFF], cosTable[row.rnd1[x] & 0xFF] };
+
+            const float worldHeight = row.height[x] * settings.terrainHeight;
+            const float worldPos[3] = { (row.u[x] - 0.5f) * settings.terrainScale, worldHeight, (row.v[x] - 0.5f) * settings.terrainScale };
+
+            uint32_t population = settings.populationCount;
+            float populationScale = 1.0f;
+            float s = nrnd1;
+            for (uint32_t h = 0; h < AAPLVegetationHabitatCount; h++)
+            {
+                s -= row.habitats[h][x];
+                if (s < 0)
+                {
+                    for (uint32_t r = 0; r < settings.rulesPerHabitat; r++)
+                    {
+                        const AAPLVegetationPlacementRule& rule = settings.rules[h * settings.rulesPerHabitat + r];
+                        s += rule.densityInHabitat;
+                        if (s > 0)
+                        {
+                            population = rule.populationStartIndex + (uint32_t) (s / rule.densityInHabitat * (float) rule.populationIndexCount);
+                            populationScale = rule.scale;
+                            break;
+                        }
+                    }
+                    break;
+                }
+            }
+
+            if (population >= settings.populationCount)
+                continue;
+
+            uint32_t& packedHistory = history[x + y * grid];
+            uint32_t fadeInPopulation   = (packedHistory & 0x000000FF) >> 0;
+            uint32_t fadeInFrame        = (packedHistory & 0x0000FF00) >> 8;
+            uint32_t fadeOutPopulation  = (packedHistory & 0x00FF0000) >> 16;
+            uint32_t fadeOutFrame       = (packedHistory & 0xFF000000) >> 24;
+
+            if (fadeInFrame < 255) fadeInFrame++;
+            if (fadeOutFrame < 255) fadeOutFrame++;
+
+            if (fadeInPopulation != population)
+            {
+                if (fadeInFrame == 255)
+                {
+                    fadeOutPopulation   = population;
+                    fadeOutFrame        = 0;
+                }
+                fadeInPopulation = population;
+                fadeInFrame = 0;
+            }
+
+            packedHistory = fadeInPopulation | (fadeInFrame << 8) | (fadeOutPopulation << 16) | (fadeOutFrame << 24);
+
+            float fadeInSeconds  = (float) fadeInFrame / 60;
+            float fadeOutSeconds = (float) fadeOutFrame / 60;
+            float growFactor     = boingEase (saturate (fadeInSeconds - nrnd0 * 3.0f));
+
+            // Terrain basis from two more height samples
+            float ys = sampleImage (terrain.heightMap, row.u[x], row.v[x] + 1.0f / settings.terrainScale, 0) * settings.terrainHeight;
+            float yt = sampleImage (terrain.heightMap, row.u[x] + 1.0f / settings.terrainScale, row.v[x], 0) * settings.terrainHeight;
+            float tangentS[3] = { 1.0f, ys - worldHeight, 0.0f };
+            float tangentT[3] = { 0.0f, yt - worldHeight, 1.0f };
+            normalize (tangentS);
+            normalize (tangentT);
+            float terrainCross[3];
+            cross (tangentS, tangentT, terrainCross);
+            const float terrainUp[3] = { -terrainCross[2], -terrainCross[1], -terrainCross[0] };
+
+            // Wind
+            float windSpeed = 0.1f + 0.4f * saturate (1.0f + cosf (frame.gameTime * 0.8f + nrnd1 * 1.0f + worldPos[2] * -0.0002f + sinf (worldPos[0] * -0.001f)));
+            float windX = (1.0f + 0.2f * sinf (frame.gameTime * 20.0f * (nrnd0 - 0.5f))) * windSpeed;
+            float windY = (1.0f + 0.2f * cosf (frame.gameTime * 20.0f * (nrnd0 - 0.5f))) * windSpeed;
+
+            float up[3] = { terrainUp[0] + vrnd1[0] + windY, terrainUp[1] + 8.0f, terrainUp[2] + vrnd1[1] + windX };
+            normalize (up);
+            const float rotation[3] = { vrnd0[0], 0.0f, vrnd0[1] };
+            float right[3];
+            cross (up, rotation, right);
+            normalize (right);
+            float fwd[3];
+            cross (up, right, fwd);
+
+            float radius = settings.vegetationScale * 2.0f * populationScale;
+            AAPLVegetationPlacementMatrix worldMatrix = makeWorldMatrix (fwd, up, right, worldPos, settings.vegetationScale * populationScale * growFactor);
+            spawnInstance (settings, frame, population, worldMatrix, worldPos, radius, output);
+
+            if (fadeOutFrame < 100)
+            {
+                const float tumblePos[3] = { worldPos[0], worldPos[1] + fadeOutSeconds * 4000.0f, worldPos[2] };
+                float tumbleScale = saturate (1.0f - fadeOutSeconds * 4.0f);
+                AAPLVegetationPlacementMatrix tumbleMatrix = makeWorldMatrix (fwd, up, right, tumblePos, settings.vegetationScale * tumbleScale);
+                spawnInstance (settings, frame, fadeOutPopulation, tumbleMatrix, tumblePos, radius, output);
+            }
+        }
+    }
+}
+
+AAPLVegetationPlacementDiff AAPLCompareVegetationPlacement (const AAPLVegetationPlacementSettings&   settings,
+                                                            const AAPLVegetationPlacementOutput&     reference,
+                                                            const AAPLVegetationPlacementOutput&     candidate,
+                                                            float                                    tolerance)
+{
+    AAPLVegetationPlacementDiff diff = { 0, 0, 0, 0.0f };
+    const uint32_t binCount = settings.populationCount * settings.cameraCount;
+    assert (reference.arguments.size() == binCount && candidate.arguments.size() == binCount);
+
+    std::vector<uint32_t> order;
+    std::vector<bool> matched;
+    for (uint32_t b = 0; b < binCount; b++)
+    {
+        const AAPLVegetationPlacementArguments& a = reference.arguments[b];
+        const AAPLVegetationPlacementArguments& c = candidate.arguments[b];
+        if (a.indexCount != c.indexCount || a.indexStart != c.indexStart || a.instanceCount != c.instanceCount)
+            diff.argumentMismatches++;
+
+        if (a.instanceCount >= settings.maxInstanceCount || c.instanceCount >= settings.maxInstanceCount)
+        {
+            diff.skippedBins++;
+            continue;
+        }
+
+        // Sort the candidate instances along x so each reference instance only scans its neighborhood
+        const AAPLVegetationPlacementMatrix* referenceInstances = &reference.instances[(size_t) b * settings.maxInstanceCount];
+        const AAPLVegetationPlacementMatrix* candidateInstances = &candidate.instances[(size_t) b * settings.maxInstanceCount];
+        order.resize (c.instanceCount);
+        for (uint32_t i = 0; i < c.instanceCount; i++)
+            order[i] = i;
+        std::sort (order.begin(), order.end(), [&] (uint32_t i, uint32_t j)
+                   { return candidateInstances[i].columns[3][0] < candidateInstances[j].columns[3][0]; });
+        matched.assign (c.instanceCount, false);
+
+        uint32_t matchCount = 0;
+        for (uint32_t i = 0; i < a.instanceCount; i++)
+        {
+            const AAPLVegetationPlacementMatrix& instance = referenceInstances[i];
+            auto first = std::lower_bound (order.begin(), order.end(), instance.columns[3][0] - tolerance, [&] (uint32_t j, float x)
+                                           { return candidateInstances[j].columns[3][0] < x; });
+            for (auto it = first; it != order.end() && candidateInstances[*it].columns[3][0] <= instance.columns[3][0] + tolerance; ++it)
+            {
+                if (matched[*it])
+                    continue;
+
+                float error = 0.0f;
+                for (uint32_t k = 0; k < 16; k++)
+                    error = std::max (error, fabsf ((&instance.columns[0][0])[k] - (&candidateInstances[*it].columns[0][0])[k]));
+                if (error <= tolerance)
+                {
+                    matched[*it] = true;
+                    matchCount++;
+                    diff.maxMatrixError = std::max (diff.maxMatrixError, error);
+                    break;
+                }
+            }
+        }
+        diff.unmatchedInstances += (a.instanceCount - matchCount) + (c.instanceCount - matchCount);
+    }
+    return diff;
+}
@@ -0,0 +1,148 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of AAPLPlaceVegetation, a portable CPU implementation of the vegetation_instanceGenerate kernel.
+ It evaluates the population rules over the same placement grid, updates the same history and produces
+ the same per-bin instance lists and indirect arguments, so it can bake vegetation offline and serve as
+ a reference to diff the GPU output against. Nothing here depends on Metal or simd.
+ The constants and structs mirror AAPLVegetationRenderer_shared.h; AAPLVegetationRenderer.mm checks
+ that their layouts match and fills in the settings of the running sample.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Habitat slots of the rule table, in TerrainHabitatType order
+enum AAPLVegetationHabitat : uint32_t
+{
+    AAPLVegetationHabitatSand,
+    AAPLVegetationHabitatGrass,
+    AAPLVegetationHabitatRock,
+    AAPLVegetationHabitatSnow,
+    AAPLVegetationHabitatCount
+};
+
+// Layout of AAPLPopulationRule
+struct AAPLVegetationPlacementRule
+{
+    float       densityInHabitat;
+    float       scale;
+    uint32_t    populationStartIndex;
+    uint32_t    populationIndexCount;
+};
+
+// Layout of AAPLPopulationLod
+struct AAPLVegetationPlacementLod
+{
+    uint32_t    indexStart;
+    uint32_t    indexCount;
+    float       worldError;
+};
+
+// Layout of MTLDrawIndexedPrimitivesIndirectArguments
+struct AAPLVegetationPlacementArguments
+{
+    uint32_t    indexCount;
+    uint32_t    instanceCount;
+    uint32_t    indexStart;
+    int32_t     baseVertex;
+    uint32_t    baseInstance;
+};
+
+// Column major, like simd::float4x4
+struct AAPLVegetationPlacementMatrix
+{
+    float       columns[4][4];
+};
+
+// Everything that stays the same from frame to frame
+struct AAPLVegetationPlacementSettings
+{
+    uint32_t    gridResolution;         // kGridResolution
+    uint32_t    populationCount;        // kPopulationCount
+    uint32_t    cameraCount;            // kCameraCount; the main camera, then one per shadow cascade
+    uint32_t    maxInstanceCount;       // kMaxInstanceCount
+    uint32_t    rulesPerHabitat;        // kRulesPerHabitat
+    uint32_t    maxLodCount;            // kMaxLodCount
+    float       vegetationScale;        // kVegetationScale
+    float       maxLodTexelError;       // kMaxLodTexelError
+    float       shadowMapSize;          // SHADOW_MAP_SIZE
+    float       terrainScale;           // TERRAIN_SCALE
+    float       terrainHeight;          // TERRAIN_HEIGHT
+
+    // AAPLVegetationHabitatCount * rulesPerHabitat rules, and populationCount * maxLodCount LODs
+    std::vector<AAPLVegetationPlacementRule>    rules;
+    std::vector<AAPLVegetationPlacementLod>     lods;
+};
+
+// A float texture in memory, rows tightly packed. Sampled like the kernel samples its textures:
+//  bilinear filtering, normalized coordinates, clamped to the edge
+struct AAPLVegetationPlacementImage
+{
+    const float*    data;
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        channelCount;
+};
+
+// The terrain textures the kernel reads; the properties map is also read at its second mip level
+struct AAPLVegetationPlacementTerrain
+{
+    AAPLVegetationPlacementImage    heightMap;
+    AAPLVegetationPlacementImage    normalMap;
+    AAPLVegetationPlacementImage    propertiesMap;
+    AAPLVegetationPlacementImage    propertiesMapLevel1;
+};
+
+struct AAPLVegetationPlacementCamera
+{
+    float       frustumPlanes[6][4];
+    float       projectionYScale;       // projectionMatrix[1][1]; only read for the shadow cascades
+};
+
+// The per-frame part of AAPLUniforms that placement depends on
+struct AAPLVegetationPlacementFrame
+{
+    std::vector<AAPLVegetationPlacementCamera>  cameras;        // settings.cameraCount entries
+    float                                       gameTime;
+};
+
+struct AAPLVegetationPlacementOutput
+{
+    // populationCount * cameraCount bins of maxInstanceCount matrices each, bin (population, camera) at
+    //  population + camera * populationCount like GetBinFor; only the first instanceCount of a bin are set
+    std::vector<AAPLVegetationPlacementMatrix>      instances;
+    std::vector<AAPLVegetationPlacementArguments>   arguments;
+};
+
+// Places the vegetation of one frame. `history` holds gridResolution^2 packed fade states and is
+//  updated in place like the kernel's history buffer, so consecutive calls animate like consecutive frames.
+// Instances are appended cell by cell in row major order; the GPU appends in whatever order its threads run.
+void AAPLPlaceVegetation (const AAPLVegetationPlacementSettings&    settings,
+                          const AAPLVegetationPlacementTerrain&     terrain,
+                          const AAPLVegetationPlacementFrame&       frame,
+                          std::vector<uint32_t>&                    history,
+                          AAPLVegetationPlacementOutput&            output);
+
+// Differences between two placements of the same frame, e.g. the CPU reference and a GPU read-back
+struct AAPLVegetationPlacementDiff
+{
+    uint32_t    argumentMismatches;     // Bins whose index range or instance count differ
+    uint32_t    unmatchedInstances;     // Instances of either output without a counterpart in the other
+    uint32_t    skippedBins;            // Full bins; which instances a full GPU bin keeps depends on thread order
+    float       maxMatrixError;         // Largest component difference between matched instances
+
+    bool matches () const { return argumentMismatches == 0 && unmatchedInstances == 0; }
+};
+
+// Compares two outputs bin by bin. The instances of a bin are compared as unordered sets: an instance
+//  matches one of the other output when all its matrix components are within `tolerance`, in world units.
+//  Expect a few mismatches between CPU and GPU where a cell's random value lands right on a habitat or
+//  rule boundary, since the two evaluate the terrain with slightly different precision.
+AAPLVegetationPlacementDiff AAPLCompareVegetationPlacement (const AAPLVegetationPlacementSettings&   settings,
+                                                            const AAPLVegetationPlacementOutput&     reference,
+                                                            const AAPLVegetationPlacementOutput&     candidate,
+                                                            float                                    tolerance);
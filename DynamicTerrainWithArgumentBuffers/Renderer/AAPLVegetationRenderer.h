@@ -8,6 +8,7 @@ Declaration of the vegetation renderer which is responsible for the terrain-spec
 #import <Foundation/Foundation.h>
 #import "AAPLAllocator.h"
 #import "AAPLObjLoader.h"
+#import "AAPLVegetationPlacement.h"
 #import <Metal/Metal.h>
 #import <simd/simd.h>
 
@@ -46,6 +47,10 @@ Declaration of the vegetation renderer which is responsible for the terrain-spec
                globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms
                  cascadeIndex:(uint) index;
 
+// The rules, levels of detail and constants vegetation_instanceGenerate runs with, for the CPU reference
+//  placement (AAPLPlaceVegetation) to reproduce or validate the GPU output
+-(AAPLVegetationPlacementSettings) placementSettings;
+
 @end
 
 
@@ -24,6 +24,22 @@ typedef struct
 
 } VegetationVertexOut;
 
+// Transforms a vegetation vertex with its instance matrix and the main camera matrix, or with the
+//  auxillary, depth-only matrix for shadow cascades
+static VegetationVertexOut vegetationTransform(float3 position, float3 normal, float3 color,
+                                               float4x4 instance, float4x4 viewProjectionMatrix)
+{
+    VegetationVertexOut out;
+    out.position = viewProjectionMatrix * (instance * float4(position, 1.0));
+
+    if (!g_isShadowPass)
+    {
+        out.color       = color;
+        out.normal      = (instance * float4(normal, 0)).xyz;
+    }
+    return out;
+}
+
 // Vertex shader that transforms the main camera matrix or with the auxillary, depth-only matrix for shadow cascades
 vertex VegetationVertexOut vegetation_vertex(   device const AAPLObjVertex* in [[ buffer(0) ]],
                                                 device const float4x4* instances [[ buffer(1) ]],
@@ -32,21 +48,48 @@ vertex VegetationVertexOut vegetation_vertex(   device const AAPLObjVertex* in [
                                                 uint iid [[instance_id]],
                                                 constant float4x4& depthOnlyMatrix[[buffer(6), function_constant(g_isShadowPass)]])
 {
-    VegetationVertexOut out;
-    float4 position = float4(in[vid].position, 1.0);
-    float4 world_pos = instances[iid] * position;
+    float4x4 viewProjectionMatrix = g_isShadowPass ? depthOnlyMatrix : uniforms.cameraUniforms.viewProjectionMatrix;
+    return vegetationTransform(in[vid].position, in[vid].normal, in[vid].color, instances[iid], viewProjectionMatrix);
+}
 
-    if (g_isShadowPass)
-    {
-        out.position = depthOnlyMatrix * world_pos;
-    }
-    else
+// Unpack functions for AAPLObjCompactVertex; AAPLVertexQuantization.h mirrors them on the CPU
+float3 unpackObjPosition(device const AAPLObjCompactVertex& v, constant AAPLObjVertexQuantization& quantization)
+{
+    float3 unorm = float3(v.position[0], v.position[1], v.position[2]) / 65535.0;
+    return quantization.positionOffset + quantization.positionScale * unorm;
+}
+
+float3 unpackOctahedralNormal(device const AAPLObjCompactVertex& v)
+{
+    float2 e = max(float2(v.normal[0], v.normal[1]) / 127.0, -1.0);
+    float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0)
     {
-        out.position    = uniforms.cameraUniforms.viewProjectionMatrix * world_pos;
-        out.color       = (in[vid].color);
-        out.normal      = (instances[iid] * float4(in[vid].normal, 0)).xyz;
+        // Unfold the lower hemisphere
+        n.xy = (1.0 - abs(n.yx)) * select(float2(-1.0), float2(1.0), n.xy >= 0.0);
     }
-    return out;
+    return normalize(n);
+}
+
+float3 unpackObjColor(device const AAPLObjCompactVertex& v)
+{
+    return float3(v.color[0], v.color[1], v.color[2]) / 255.0;
+}
+
+// Variant of vegetation_vertex that reads compact vertices
+vertex VegetationVertexOut vegetation_vertex_compact(   device const AAPLObjCompactVertex* in [[ buffer(0) ]],
+                                                        device const float4x4* instances [[ buffer(1) ]],
+                                                        constant AAPLUniforms & uniforms [[ buffer(2) ]],
+                                                        constant AAPLObjVertexQuantization& quantization [[ buffer(3) ]],
+                                                        uint vid [[vertex_id]],
+                                                        uint iid [[instance_id]],
+                                                        constant float4x4& depthOnlyMatrix[[buffer(6), function_constant(g_isShadowPass)]])
+{
+    float4x4 viewProjectionMatrix = g_isShadowPass ? depthOnlyMatrix : uniforms.cameraUniforms.viewProjectionMatrix;
+    return vegetationTransform(unpackObjPosition(in[vid], quantization),
+                               unpackOctahedralNormal(in[vid]),
+                               unpackObjColor(in[vid]),
+                               instances[iid], viewProjectionMatrix);
 }
 
 // Fragment shader that renders the vegetation geometry for the deferred renderer
@@ -137,11 +180,35 @@ kernel void vegetation_instanceGenerate (       texture2d<float> heightMap
                                                 constant TerrainParams& terrainParams           [[buffer(3)]],
                                                 constant AAPLPopulationRule* rules              [[buffer(4)]],
                                                 device  uint* history                           [[buffer(5)]],
+                                                constant AAPLPopulationLod* lods                [[buffer(6)]],
                                          
                                                 uint2 tid                                       [[thread_position_in_grid]])
 {
     constexpr sampler sam(min_filter::linear, mag_filter::linear, mip_filter::none, address::clamp_to_edge, coord::normalized);
     
+    // A single thread picks the level of detail of every shadow cascade bin. The shadow cameras are parallel
+    // projections, so the world space size of a shadow map texel, and with it the LOD, is the same for every
+    // instance in a bin. The main camera bins keep drawing the full resolution meshes.
+    if (tid.x == 0 && tid.y == 0)
+    {
+        for (uint cascade = 0; cascade < NUM_CASCADES; cascade++)
+        {
+            float texelsPerWorldUnit = globalUniforms.shadowCameraUniforms[cascade].projectionMatrix[1][1] * 0.5 * SHADOW_MAP_SIZE;
+            for (uint pop = 0; pop < kPopulationCount; pop++)
+            {
+                uint lod = 0;
+                for (uint l = 1; l < kMaxLodCount; l++)
+                {
+                    if (lods[pop * kMaxLodCount + l].worldError * texelsPerWorldUnit <= kMaxLodTexelError)
+                        lod = l;
+                }
+                uint bin = GetBinFor(pop, 1 + cascade);
+                indirect[bin].indexStart = lods[pop * kMaxLodCount + lod].indexStart;
+                indirect[bin].indexCount = lods[pop * kMaxLodCount + lod].indexCount;
+            }
+        }
+    }
+    
     // Initialize some random variables to get a randomized batch of vegetation
     uint rnd0 = wang_hash(tid.x + tid.y * 0xABBA);
     uint rnd1 = wang_hash(rnd0);
@@ -13,6 +13,15 @@ Implementation of the vegetation renderer which is responsible for the terrain-s
 #import "AAPLCamera.h"
 using namespace simd;
 
+// The CPU placement mirrors the structures the instance generator reads and writes
+static_assert(sizeof(AAPLVegetationPlacementRule) == sizeof(AAPLPopulationRule), "Rule layouts differ");
+static_assert(sizeof(AAPLVegetationPlacementLod) == sizeof(AAPLPopulationLod), "LOD layouts differ");
+static_assert(sizeof(AAPLVegetationPlacementArguments) == sizeof(MTLDrawIndexedPrimitivesIndirectArguments), "Indirect argument layouts differ");
+static_assert(sizeof(AAPLVegetationPlacementMatrix) == sizeof(float4x4), "Instance layouts differ");
+static_assert(AAPLVegetationHabitatSand == TerrainHabitatTypeSand && AAPLVegetationHabitatGrass == TerrainHabitatTypeGrass &&
+              AAPLVegetationHabitatRock == TerrainHabitatTypeRock && AAPLVegetationHabitatSnow == TerrainHabitatTypeSnow &&
+              AAPLVegetationHabitatCount == TerrainHabitatTypeCOUNT, "Habitat orders differ");
+
 @implementation AAPLVegetationPopulation
 
 -(instancetype) initWithObjMesh:(const AAPLObjMesh*) mesh
@@ -36,6 +45,14 @@ using namespace simd;
     id <MTLBuffer>                  _indirectBuffer;
     id <MTLBuffer>                  _ruleBuffer;
     id <MTLBuffer>                  _historyBuffer;
+    id <MTLBuffer>                  _lodBuffer;
+    
+    // Meshes split into submeshes for 16-bit indices are drawn with one indirect draw per submesh.
+    //  Those draws have their own arguments, starting at `_submeshArgumentStart` for a population
+    //  (ordered by camera, then submesh); the instance generator only fills in the arguments of the
+    //  population's bin, so their instance counts are copied over once it has run.
+    id <MTLBuffer>                  _submeshIndirectBuffer;
+    uint                            _submeshArgumentStart[kPopulationCount];
     
     // Utility to load vegetation geometry from disk
     AAPLObjLoader*                  _objLoader;
@@ -51,6 +68,12 @@ using namespace simd;
     self = [super init];
     _device = device;
     _objLoader = [[AAPLObjLoader alloc] initWithDevice:device];
+    _objLoader.parallelParsing = YES;
+    _objLoader.useMeshCache = YES;
+    _objLoader.splitLargeMeshes = YES;
+    _objLoader.optimizeMeshes = YES;
+    _objLoader.compactVertices = YES;
+    _objLoader.lodCount = kMaxLodCount;
     
     [self loadAssetsFromLibrary: library];
     
@@ -61,7 +84,8 @@ using namespace simd;
     MTLRenderPipelineDescriptor *pipelineStateDescriptor = [[MTLRenderPipelineDescriptor alloc] init];
     pipelineStateDescriptor.sampleCount = BufferFormats::sampleCount;
     pipelineStateDescriptor.label = @"VegetationGeo";
-    pipelineStateDescriptor.vertexFunction = [library newFunctionWithName:@"vegetation_vertex" constantValues:constants error:nil];
+    NSString* vertexFunctionName = _objLoader.compactVertices ? @"vegetation_vertex_compact" : @"vegetation_vertex";
+    pipelineStateDescriptor.vertexFunction = [library newFunctionWithName:vertexFunctionName constantValues:constants error:nil];
     pipelineStateDescriptor.fragmentFunction = [library newFunctionWithName:@"vegetation_fragment"];
     assert (pipelineStateDescriptor.vertexFunction != nil && pipelineStateDescriptor.fragmentFunction != nil);
 
@@ -79,7 +103,7 @@ using namespace simd;
     [constants setConstantValue:&shadow_only type:MTLDataTypeBool atIndex:0];
     pipelineStateDescriptor.sampleCount = BufferFormats::sampleCount;
     pipelineStateDescriptor.label = @"VegetationShadow";
-    pipelineStateDescriptor.vertexFunction = [library newFunctionWithName:@"vegetation_vertex" constantValues:constants error:nil];
+    pipelineStateDescriptor.vertexFunction = [library newFunctionWithName:vertexFunctionName constantValues:constants error:nil];
     pipelineStateDescriptor.fragmentFunction = nil;
     pipelineStateDescriptor.colorAttachments[0].pixelFormat = MTLPixelFormatInvalid;
     pipelineStateDescriptor.colorAttachments[1].pixelFormat = MTLPixelFormatInvalid;
@@ -115,6 +139,7 @@ using namespace simd;
     _ruleBuffer             = [device newBufferWithLength:(sizeof(AAPLPopulationRule)*kRulesPerHabitat*TerrainHabitatTypeCOUNT) options:storageMode];
     _indirectResetBuffer    = [device newBufferWithLength:(sizeof(MTLDrawIndexedPrimitivesIndirectArguments)*kPopulationCount*kCameraCount) options:storageMode];
     _historyBuffer          = [device newBufferWithLength:(sizeof(uint32_t)*kGridResolution*kGridResolution) options:MTLResourceStorageModePrivate];
+    _lodBuffer              = [device newBufferWithLength:(sizeof(AAPLPopulationLod)*kMaxLodCount*kPopulationCount) options:storageMode];
 
 
     // Interate over all cameras and all populations and initialize all bins
@@ -126,13 +151,48 @@ using namespace simd;
         args[b].baseInstance = b * kMaxInstanceCount;
         args[b].baseVertex = 0;
         args[b].instanceCount = 0;
-        args[b].indexCount = (uint32_t) _populations[pop_idx].mesh.indexCount;
-        args[b].indexStart = 0;
+        args[b].indexCount = _populations[pop_idx].mesh.lods[0].indexCount;
+        args[b].indexStart = _populations[pop_idx].mesh.lods[0].indexStart;
     }
 #if !TARGET_OS_IOS
     [_indirectResetBuffer didModifyRange:NSMakeRange(0, _indirectBuffer.length)];
 #endif
     
+    // Arguments of the per-submesh draws; everything but their instance counts is known up front
+    uint submeshArgumentCount = 0;
+    for (uint pop_idx = 0; pop_idx < kPopulationCount; pop_idx++)
+    {
+        const size_t submesh_count = _populations[pop_idx].mesh.submeshes.size();
+        _submeshArgumentStart[pop_idx] = submeshArgumentCount;
+        submeshArgumentCount += submesh_count > 1 ? (uint)submesh_count * kCameraCount : 0;
+    }
+    
+    if (submeshArgumentCount > 0)
+    {
+        _submeshIndirectBuffer = [device newBufferWithLength:(sizeof(MTLDrawIndexedPrimitivesIndirectArguments)*submeshArgumentCount) options:storageMode];
+        MTLDrawIndexedPrimitivesIndirectArguments* submesh_args = (MTLDrawIndexedPrimitivesIndirectArguments*)_submeshIndirectBuffer.contents;
+        for (uint pop_idx = 0; pop_idx < kPopulationCount; pop_idx++)
+        {
+            const std::vector<AAPLObjSubmesh> submeshes = _populations[pop_idx].mesh.submeshes;
+            if (submeshes.size() < 2)
+                continue;
+            
+            for (uint cam_idx = 0; cam_idx < kCameraCount; cam_idx++)
+            for (uint s = 0; s < submeshes.size(); s++)
+            {
+                MTLDrawIndexedPrimitivesIndirectArguments& arg = submesh_args[_submeshArgumentStart[pop_idx] + cam_idx * submeshes.size() + s];
+                arg.baseInstance = GetBinFor(pop_idx, cam_idx) * kMaxInstanceCount;
+                arg.baseVertex = submeshes[s].baseVertex;
+                arg.instanceCount = 0;
+                arg.indexCount = submeshes[s].indexCount;
+                arg.indexStart = submeshes[s].indexStart;
+            }
+        }
+#if !TARGET_OS_IOS
+        [_submeshIndirectBuffer didModifyRange:NSMakeRange(0, _submeshIndirectBuffer.length)];
+#endif
+    }
+    
     
     // Copy the rules over to the rule buffer for run-time evaluation
     AAPLPopulationRule* pph = (AAPLPopulationRule*)_ruleBuffer.contents;
@@ -141,6 +201,36 @@ using namespace simd;
     [_ruleBuffer didModifyRange:NSMakeRange(0, _ruleBuffer.length)];
 #endif
     
+    // Fill in the levels of detail of every population, with their error at the largest scale a rule
+    //  applies; the instance generator picks the LOD of each shadow cascade bin from these
+    float populationScale[kPopulationCount] = {};
+    for (uint h = 0; h < TerrainHabitatTypeCOUNT; h++)
+    for (uint r = 0; r < kRulesPerHabitat; r++)
+    {
+        const AAPLPopulationRule& rule = _rules[h][r];
+        for (uint p = rule.populationStartIndex; p < rule.populationStartIndex + rule.populationIndexCount; p++)
+            populationScale[p] = fmax(populationScale[p], rule.scale);
+    }
+    
+    AAPLPopulationLod* lods = (AAPLPopulationLod*)_lodBuffer.contents;
+    for (uint pop_idx = 0; pop_idx < kPopulationCount; pop_idx++)
+    {
+        const std::vector<AAPLMeshLod> mesh_lods = _populations[pop_idx].mesh.lods;
+        for (uint l = 0; l < kMaxLodCount; l++)
+        {
+            AAPLPopulationLod& lod = lods[pop_idx * kMaxLodCount + l];
+            const AAPLMeshLod& mesh_lod = mesh_lods[std::min<size_t>(l, mesh_lods.size() - 1)];
+            lod.indexStart = mesh_lod.indexStart;
+            lod.indexCount = mesh_lod.indexCount;
+            
+            // Slots past the last LOD of a mesh are never selected
+            lod.worldError = l < mesh_lods.size() ? mesh_lod.error * kVegetationScale * populationScale[pop_idx] : INFINITY;
+        }
+    }
+#if !TARGET_OS_IOS
+    [_lodBuffer didModifyRange:NSMakeRange(0, _lodBuffer.length)];
+#endif
+    
     return self;
 }
 
@@ -220,6 +310,28 @@ using namespace simd;
 }
 
 
+-(AAPLVegetationPlacementSettings) placementSettings
+{
+    AAPLVegetationPlacementSettings settings;
+    settings.gridResolution     = kGridResolution;
+    settings.populationCount    = kPopulationCount;
+    settings.cameraCount        = kCameraCount;
+    settings.maxInstanceCount   = kMaxInstanceCount;
+    settings.rulesPerHabitat    = kRulesPerHabitat;
+    settings.maxLodCount        = kMaxLodCount;
+    settings.vegetationScale    = kVegetationScale;
+    settings.maxLodTexelError   = kMaxLodTexelError;
+    settings.shadowMapSize      = SHADOW_MAP_SIZE;
+    settings.terrainScale       = TERRAIN_SCALE;
+    settings.terrainHeight      = TERRAIN_HEIGHT;
+    
+    const AAPLVegetationPlacementRule* rules = (const AAPLVegetationPlacementRule*)_ruleBuffer.contents;
+    settings.rules.assign(rules, rules + kRulesPerHabitat * TerrainHabitatTypeCOUNT);
+    const AAPLVegetationPlacementLod* lods = (const AAPLVegetationPlacementLod*)_lodBuffer.contents;
+    settings.lods.assign(lods, lods + kMaxLodCount * kPopulationCount);
+    return settings;
+}
+
 -(void) spawnVegetationWithCommandbuffer: (id <MTLCommandBuffer>) commandBuffer
                                 uniforms: (AAPLGpuBuffer <AAPLUniforms>) uniforms
                                  terrain: (AAPLTerrainRenderer*) terrain
@@ -240,6 +352,7 @@ using namespace simd;
 
     [computeEncoder setBuffer:_ruleBuffer offset:0 atIndex:4];
     [computeEncoder setBuffer:_historyBuffer offset:0 atIndex:5];
+    [computeEncoder setBuffer:_lodBuffer offset:0 atIndex:6];
 
     [computeEncoder setTexture:terrain.terrainHeight atIndex: 0];
     [computeEncoder setTexture:terrain.terrainNormalMap atIndex: 1];
@@ -250,12 +363,62 @@ using namespace simd;
     
     // Sync all population data back to CPU for stats
     blitEncoder = [commandBuffer blitCommandEncoder];
+    
+    // Hand the instance counts of split meshes to the draws of their submeshes
+    const NSUInteger instance_count_offset = offsetof(MTLDrawIndexedPrimitivesIndirectArguments, instanceCount);
+    for (uint pop_idx = 0; pop_idx < kPopulationCount; pop_idx++)
+    {
+        const NSUInteger submesh_count = _populations[pop_idx].mesh.submeshes.size();
+        if (submesh_count < 2)
+            continue;
+        
+        for (uint cam_idx = 0; cam_idx < kCameraCount; cam_idx++)
+        for (uint s = 0; s < submesh_count; s++)
+        {
+            NSUInteger slot = _submeshArgumentStart[pop_idx] + cam_idx * submesh_count + s;
+            [blitEncoder copyFromBuffer:_indirectBuffer
+                           sourceOffset:GetBinFor(pop_idx, cam_idx)*sizeof(MTLDrawIndexedPrimitivesIndirectArguments) + instance_count_offset
+                               toBuffer:_submeshIndirectBuffer
+                      destinationOffset:slot*sizeof(MTLDrawIndexedPrimitivesIndirectArguments) + instance_count_offset
+                                   size:sizeof(uint32_t)];
+        }
+    }
+    
 #if TARGET_OS_OSX
     [blitEncoder synchronizeResource:_indirectBuffer];
 #endif
     [blitEncoder endEncoding];
 }
 
+// Draws the instances of a population's bin for a camera; split meshes take one draw per submesh
+-(void)drawPopulation:(uint)pop_idx camera:(uint)cam_idx withEncoder:(id <MTLRenderCommandEncoder>)renderEncoder
+{
+    AAPLVegetationPopulation* pop = _populations[pop_idx];
+    const NSUInteger submesh_count = pop.mesh.submeshes.size();
+    
+    if (submesh_count < 2)
+    {
+        [renderEncoder drawIndexedPrimitives:MTLPrimitiveTypeTriangle
+                                   indexType:pop.mesh.indexType
+                                 indexBuffer:pop.mesh.indexBuffer
+                           indexBufferOffset:0
+                              indirectBuffer:_indirectBuffer
+                        indirectBufferOffset:GetBinFor(pop_idx, cam_idx)*sizeof(MTLDrawIndexedPrimitivesIndirectArguments)];
+        return;
+    }
+    
+    for (uint s = 0; s < submesh_count; s++)
+    {
+        NSUInteger slot = _submeshArgumentStart[pop_idx] + cam_idx * submesh_count + s;
+        [renderEncoder drawIndexedPrimitives:MTLPrimitiveTypeTriangle
+                                   indexType:pop.mesh.indexType
+                                 indexBuffer:pop.mesh.indexBuffer
+                           indexBufferOffset:0
+                              indirectBuffer:_submeshIndirectBuffer
+                        indirectBufferOffset:slot*sizeof(MTLDrawIndexedPrimitivesIndirectArguments)];
+    }
+}
+
 -(void)drawVegetationWithEncoder:(id <MTLRenderCommandEncoder>)renderEncoder
                   globalUniforms:(const AAPLGpuBuffer<AAPLUniforms>&)globalUniforms
 {
@@ -265,15 +428,15 @@ using namespace simd;
         AAPLVegetationPopulation* pop = _populations[pop_idx];
         
         [renderEncoder setVertexBuffer:pop.mesh.vertexBuffer offset:0 atIndex:0];
+        if (pop.mesh.compactVertices)
+        {
+            AAPLObjVertexQuantization quantization = pop.mesh.quantization;
+            [renderEncoder setVertexBytes:&quantization length:sizeof(quantization) atIndex:3];
+        }
         [renderEncoder setVertexBuffer:_instanceBuffer offset:0 atIndex:1];
         [renderEncoder setVertexBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:2];
         [renderEncoder setFragmentBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:0];
-        [renderEncoder drawIndexedPrimitives:MTLPrimitiveTypeTriangle
-                                   indexType:MTLIndexTypeUInt16
-                                 indexBuffer:pop.mesh.indexBuffer
-                           indexBufferOffset:0
-                              indirectBuffer:_indirectBuffer
-                        indirectBufferOffset:GetBinFor(pop_idx, 0)*sizeof(MTLDrawIndexedPrimitivesIndirectArguments)];
+        [self drawPopulation:pop_idx camera:0 withEncoder:renderEncoder];
     }
 }
 
@@ -287,15 +450,15 @@ using namespace simd;
     {
         AAPLVegetationPopulation* pop = _populations[pop_idx];
         [renderEncoder setVertexBuffer:pop.mesh.vertexBuffer offset:0 atIndex:0];
+        if (pop.mesh.compactVertices)
+        {
+            AAPLObjVertexQuantization quantization = pop.mesh.quantization;
+            [renderEncoder setVertexBytes:&quantization length:sizeof(quantization) atIndex:3];
+        }
         [renderEncoder setVertexBuffer:_instanceBuffer offset:0 atIndex:1];
         [renderEncoder setVertexBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:2];
         [renderEncoder setFragmentBuffer:globalUniforms.getBuffer() offset:globalUniforms.getOffset() atIndex:0];
-        [renderEncoder drawIndexedPrimitives:MTLPrimitiveTypeTriangle
-        indexType:MTLIndexTypeUInt16
-        indexBuffer:pop.mesh.indexBuffer
-        indexBufferOffset:0
-        indirectBuffer:_indirectBuffer
-        indirectBufferOffset:GetBinFor(pop_idx, cam_idx)*sizeof(MTLDrawIndexedPrimitivesIndirectArguments)];
+        [self drawPopulation:pop_idx camera:cam_idx withEncoder:renderEncoder];
     }
 }
 
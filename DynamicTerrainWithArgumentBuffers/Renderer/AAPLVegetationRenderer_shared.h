@@ -33,6 +33,12 @@ CONSTANT uint  kMaxInstanceCount    = 1024 * 16;
 // The scale applied on all meshes to fit within the overal world unit scale
 CONSTANT float kVegetationScale     = 200.0f;
 
+// The maximum amount of levels of detail per population, including the full resolution mesh
+CONSTANT uint  kMaxLodCount         = 4;
+
+// Shadow cascades draw the coarsest level of detail whose error stays below this many shadow map texels
+CONSTANT float kMaxLodTexelError    = 1.0f;
+
 // Helper function to find the "bin" (which is the instance buffer) for each population within each viewport/camera
 uint GetBinFor(uint inPopulationIndex, uint inCameraIndex)
 {
@@ -48,3 +54,12 @@ struct AAPLPopulationRule
     uint    populationStartIndex = 0;   // index in VegetationRenderer::populations
     uint    populationIndexCount = 0;   // a list of populations can be defined; density is evenly distributed between them
 };
+
+// A level of detail of a population mesh, as the instance generator uses it to pick the range
+// of the index buffer to draw for each bin
+struct AAPLPopulationLod
+{
+    uint    indexStart = 0;
+    uint    indexCount = 0;
+    float   worldError = 0.0f;          // geometric error at the largest scale any rule places the population with
+};
@@ -0,0 +1,111 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Encode and decode helpers for the compact vertex format (AAPLObjCompactVertex).
+ Positions are stored as 16-bit unorm relative to the mesh bounds, normals as 8-bit snorm octahedral
+ coordinates and colors as 8-bit unorm. The decode functions mirror the unpack functions in
+ AAPLVegetationRenderer.metal so the reconstruction error can be measured on the CPU.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+
+// Quantizes v in [0, 1] to the nearest 16-bit unorm
+inline uint16_t AAPLEncodeUnorm16 (float v)
+{
+    return (uint16_t) (std::min (std::max (v, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+inline float AAPLDecodeUnorm16 (uint16_t v)
+{
+    return (float) v / 65535.0f;
+}
+
+inline uint8_t AAPLEncodeUnorm8 (float v)
+{
+    return (uint8_t) (std::min (std::max (v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline float AAPLDecodeUnorm8 (uint8_t v)
+{
+    return (float) v / 255.0f;
+}
+
+inline int8_t AAPLEncodeSnorm8 (float v)
+{
+    return (int8_t) roundf (std::min (std::max (v, -1.0f), 1.0f) * 127.0f);
+}
+
+// -128 decodes to -1 like -127 does, matching the GPU's snorm conversion
+inline float AAPLDecodeSnorm8 (int8_t v)
+{
+    return std::max ((float) v / 127.0f, -1.0f);
+}
+
+// Maps a position component into [0, 1] given the bounds offset and extent of its axis
+inline uint16_t AAPLEncodePositionComponent (float v, float offset, float scale)
+{
+    return AAPLEncodeUnorm16 (scale > 0.0f ? (v - offset) / scale : 0.0f);
+}
+
+inline float AAPLDecodePositionComponent (uint16_t v, float offset, float scale)
+{
+    return offset + scale * AAPLDecodeUnorm16 (v);
+}
+
+inline void AAPLDecodeOctahedral (const int8_t encoded[2], float outNormal[3])
+{
+    float x = AAPLDecodeSnorm8 (encoded[0]);
+    float y = AAPLDecodeSnorm8 (encoded[1]);
+    float z = 1.0f - fabsf (x) - fabsf (y);
+    if (z < 0.0f)
+    {
+        // Unfold the lower hemisphere
+        float foldedX = (1.0f - fabsf (y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - fabsf (x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    float invLength = 1.0f / sqrtf (x * x + y * y + z * z);
+    outNormal[0] = x * invLength;
+    outNormal[1] = y * invLength;
+    outNormal[2] = z * invLength;
+}
+
+// Octahedral encoding of a unit normal. Of the four snorm8 grid points around the exact projection,
+//  the one that decodes closest to the input is kept, which roughly halves the error of plain rounding.
+inline void AAPLEncodeOctahedral (const float normal[3], int8_t outEncoded[2])
+{
+    float length = fabsf (normal[0]) + fabsf (normal[1]) + fabsf (normal[2]);
+    float x = length > 0.0f ? normal[0] / length : 0.0f;
+    float y = length > 0.0f ? normal[1] / length : 0.0f;
+    if (normal[2] < 0.0f)
+    {
+        float foldedX = (1.0f - fabsf (y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - fabsf (x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    float baseX = floorf (std::min (std::max (x, -1.0f), 1.0f) * 127.0f);
+    float baseY = floorf (std::min (std::max (y, -1.0f), 1.0f) * 127.0f);
+    float bestDot = -2.0f;
+    for (uint32_t candidate = 0; candidate < 4; candidate++)
+    {
+        int8_t encoded[2] = { (int8_t) std::min (baseX + (float) (candidate & 1), 127.0f),
+                              (int8_t) std::min (baseY + (float) (candidate >> 1), 127.0f) };
+        float decoded[3];
+        AAPLDecodeOctahedral (encoded, decoded);
+        float dot = decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2];
+        if (dot > bestDot)
+        {
+            bestDot = dot;
+            outEncoded[0] = encoded[0];
+            outEncoded[1] = encoded[1];
+        }
+    }
+}
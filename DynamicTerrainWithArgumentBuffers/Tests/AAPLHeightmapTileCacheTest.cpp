@@ -0,0 +1,215 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Simulated camera paths over a tiled heightmap streamed through the AAPLHeightmapTileCache.
+ A procedural heightmap is written with AAPLWriteTiledHeightmap, then several scripted camera paths update a
+ cache sized from a memory budget once per frame. Reports the hit rate, loads, evictions and peak resident tiles
+ of every path, and fails when the resident tiles exceed the budget, when the page table disagrees with the
+ slots, when a slot holds other texels than its tile, when an update loads more tiles than allowed, or when the
+ cache doesn't converge to every tile in range once the camera stops.
+*/
+
+#include "AAPLHeightmapTileCache.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const uint32_t kTileSize     = 64;
+static const uint32_t kTileBorder   = 2;
+static const uint32_t kTilesX       = 32;
+static const uint32_t kTilesY       = 16;
+static const float    kTileWorldSize = 500.0f;
+
+// Camera position of a path at time t in [0, 1]
+struct AAPLCameraPath
+{
+    const char*     name;
+    float           radius;         // Streaming radius
+    uint32_t        maxLoads;       // Tile loads per update
+    void            (*position) (float t, float& outX, float& outZ);
+};
+
+static const float kHalfWidth = 0.5f * kTilesX * kTileWorldSize;
+static const float kHalfDepth = 0.5f * kTilesY * kTileWorldSize;
+
+static const AAPLCameraPath kPaths[] =
+{
+    // Flies across the whole map along its long axis
+    { "flyover", 1200.0f, 4, [] (float t, float& x, float& z) { x = (t * 2.0f - 1.0f) * kHalfWidth; z = 0.0f; } },
+
+    // Circles the center; every tile on the circle is revisited once per lap
+    { "orbit", 1000.0f, 4, [] (float t, float& x, float& z)
+      { x = cosf (t * 12.566f) * kHalfDepth * 0.6f; z = sinf (t * 12.566f) * kHalfDepth * 0.6f; } },
+
+    // Walks back and forth over the same few tiles, which should nearly always hit
+    { "patrol", 800.0f, 2, [] (float t, float& x, float& z) { x = sinf (t * 31.4f) * 1500.0f; z = 200.0f; } },
+
+    // Teleports between map corners, loading far more tiles per frame than the limit allows
+    { "teleport", 1500.0f, 3, [] (float t, float& x, float& z)
+      { int corner = (int) (t * 8.0f) % 4; x = (corner & 1 ? 0.8f : -0.8f) * kHalfWidth; z = (corner & 2 ? 0.8f : -0.8f) * kHalfDepth; } },
+};
+
+static std::vector<uint16_t> AAPLMakeHeights (uint32_t width, uint32_t height)
+{
+    std::vector<uint16_t> heights ((size_t) width * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            float h = 0.5f + 0.25f * sinf (x * 0.013f) * cosf (y * 0.021f) + 0.2f * sinf ((x + y) * 0.0047f);
+            heights[(size_t) y * width + x] = (uint16_t) (std::min (std::max (h, 0.0f), 1.0f) * 65535.0f);
+        }
+    }
+    return heights;
+}
+
+// Checks that the page table and the slots agree and that every resident slot holds its tile's texels
+static int AAPLCheckCache (const AAPLHeightmapTileCache& cache, const AAPLTiledHeightmap& source, const char* pathName, uint32_t frame)
+{
+    int failures = 0;
+    const AAPLTiledHeightmapHeader& header = source.getHeader();
+    const std::vector<uint16_t>& pageTable = cache.getPageTable();
+    std::vector<bool> slotUsed (cache.getSlotCount(), false);
+    uint32_t resident = 0;
+
+    for (uint32_t tile = 0; tile < pageTable.size(); tile++)
+    {
+        uint16_t slot = pageTable[tile];
+        if (slot == AAPLHeightmapTileCache::kNotResident)
+            continue;
+
+        resident++;
+        if (slot >= cache.getSlotCount() || slotUsed[slot])
+        {
+            AAPL_TEST_CHECK (failures, false, "%s frame %u: tile %u maps to slot %u, which is out of range or shared", pathName, frame, tile, slot);
+            continue;
+        }
+        slotUsed[slot] = true;
+
+        const uint16_t* expected = source.getTile (tile % header.tilesX, tile / header.tilesX);
+        AAPL_TEST_CHECK (failures, memcmp (cache.getSlotTexels (slot), expected, header.getTileTexelCount() * sizeof(uint16_t)) == 0,
+                         "%s frame %u: slot %u doesn't hold the texels of tile %u", pathName, frame, slot, tile);
+    }
+
+    AAPL_TEST_CHECK (failures, resident == cache.getResidentCount(), "%s frame %u: %u tiles in the page table, %u resident",
+                     pathName, frame, resident, cache.getResidentCount());
+    AAPL_TEST_CHECK (failures, resident <= cache.getSlotCount(), "%s frame %u: %u resident tiles exceed the %u slots of the budget",
+                     pathName, frame, resident, cache.getSlotCount());
+    return failures;
+}
+
+// Height at a world position through the page table, the lookup a renderer would do on the GPU.
+//  Returns false when the tile is not resident.
+static bool AAPLSampleResidentHeight (const AAPLHeightmapTileCache& cache, const AAPLTiledHeightmapHeader& header,
+                                      float x, float z, uint16_t& outHeight)
+{
+    float tileX = x / header.tileWorldSize + header.tilesX * 0.5f;
+    float tileZ = z / header.tileWorldSize + header.tilesY * 0.5f;
+    if (tileX < 0.0f || tileZ < 0.0f || tileX >= header.tilesX || tileZ >= header.tilesY)
+        return false;
+
+    uint32_t tile = (uint32_t) tileZ * header.tilesX + (uint32_t) tileX;
+    uint16_t slot = cache.getPageTable()[tile];
+    if (slot == AAPLHeightmapTileCache::kNotResident)
+        return false;
+
+    uint32_t texelX = header.tileBorder + std::min ((uint32_t) ((tileX - floorf (tileX)) * header.tileSize), header.tileSize - 1);
+    uint32_t texelZ = header.tileBorder + std::min ((uint32_t) ((tileZ - floorf (tileZ)) * header.tileSize), header.tileSize - 1);
+    outHeight = cache.getSlotTexels (slot)[texelZ * header.getStride() + texelX];
+    return true;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t frameCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 16) : 2000;
+
+    char directoryTemplate[] = "/tmp/AAPLHeightmapTileCacheTest.XXXXXX";
+    const char* directory = mkdtemp (directoryTemplate);
+    if (directory == nullptr)
+    {
+        perror ("mkdtemp");
+        return 1;
+    }
+    const std::string path = std::string (directory) + "/terrain.tiles";
+
+    const uint32_t width = kTilesX * kTileSize, height = kTilesY * kTileSize;
+    const std::vector<uint16_t> heights = AAPLMakeHeights (width, height);
+
+    int failures = 0;
+    AAPL_TEST_CHECK (failures, AAPLWriteTiledHeightmap (path.c_str(), heights.data(), width, height, kTileSize, kTileBorder,
+                                                        kTileWorldSize, 4500.0f), "%s", path.c_str());
+    AAPLTiledHeightmap source (path.c_str());
+    AAPL_TEST_CHECK (failures, source.isValid(), "%s", path.c_str());
+    if (!source.isValid())
+        return 1;
+    const AAPLTiledHeightmapHeader& header = source.getHeader();
+
+    // Room for a fifth of the map
+    const size_t budgetBytes = (size_t) kTilesX * kTilesY / 5 * header.getTileTexelCount() * sizeof(uint16_t);
+    const uint32_t slotCount = AAPLHeightmapTileCache::getSlotCountForBudget (header, budgetBytes);
+    AAPL_TEST_CHECK (failures, slotCount * header.getTileTexelCount() * sizeof(uint16_t) <= budgetBytes, "the slots exceed the budget");
+
+    printf ("%u x %u tiles of %u texels, %u slots (%.1f MB budget), %u frames per path\n", kTilesX, kTilesY, kTileSize,
+            slotCount, budgetBytes / 1e6, frameCount);
+    printf ("%-10s %8s %8s %8s %10s %10s %10s %10s\n", "path", "requests", "hit rate", "loads", "evictions", "deferred",
+            "peak", "settle");
+
+    for (const AAPLCameraPath& cameraPath : kPaths)
+    {
+        AAPLHeightmapTileCache cache (source, slotCount);
+        uint32_t peakResident = 0;
+
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            float x, z;
+            cameraPath.position ((float) frame / frameCount, x, z);
+            cache.update (x, z, cameraPath.radius, cameraPath.maxLoads);
+
+            AAPL_TEST_CHECK (failures, cache.getLoadedSlots().size() <= cameraPath.maxLoads, "%s frame %u: %zu loads",
+                             cameraPath.name, frame, cache.getLoadedSlots().size());
+            peakResident = std::max (peakResident, cache.getResidentCount());
+
+            // Checking every slot is slow; every frame early on and then a sample keeps the test short
+            if (frame < 64 || frame % 16 == 0)
+                failures += AAPLCheckCache (cache, source, cameraPath.name, frame);
+        }
+
+        // Once the camera stops, every tile in range becomes resident within a few updates and then always hits
+        float x, z;
+        cameraPath.position ((float) (frameCount - 1) / frameCount, x, z);
+        uint32_t settleUpdates = 0;
+        while (cache.update (x, z, cameraPath.radius, cameraPath.maxLoads) != 0 && settleUpdates < slotCount)
+            settleUpdates++;
+        AAPLHeightmapTileCacheStats before = cache.getStats();
+        AAPL_TEST_CHECK (failures, cache.update (x, z, cameraPath.radius, cameraPath.maxLoads) == 0,
+                         "%s: tiles in range are still missing after %u updates at rest", cameraPath.name, settleUpdates);
+        AAPL_TEST_CHECK (failures, cache.getStats().hits - before.hits == cache.getStats().requests - before.requests,
+                         "%s: an update at rest missed", cameraPath.name);
+        failures += AAPLCheckCache (cache, source, cameraPath.name, frameCount);
+
+        uint16_t sampled = 0;
+        AAPL_TEST_CHECK (failures, AAPLSampleResidentHeight (cache, header, x, z, sampled), "%s: the camera's tile isn't resident", cameraPath.name);
+        uint32_t texelX = (uint32_t) ((x / kTileWorldSize + kTilesX * 0.5f) * kTileSize);
+        uint32_t texelZ = (uint32_t) ((z / kTileWorldSize + kTilesY * 0.5f) * kTileSize);
+        AAPL_TEST_CHECK (failures, sampled == heights[(size_t) texelZ * width + texelX], "%s: the page table lookup reads the wrong height",
+                         cameraPath.name);
+
+        const AAPLHeightmapTileCacheStats& stats = cache.getStats();
+        AAPL_TEST_CHECK (failures, stats.hits + stats.loads <= stats.requests, "%s: more hits and loads than requests", cameraPath.name);
+        AAPL_TEST_CHECK (failures, stats.evictions == stats.loads - cache.getResidentCount(),
+                         "%s: %llu loads, %llu evictions and %u resident tiles don't add up", cameraPath.name,
+                         (unsigned long long) stats.loads, (unsigned long long) stats.evictions, cache.getResidentCount());
+        AAPL_TEST_CHECK (failures, peakResident <= slotCount, "%s: %u resident tiles exceed the budget", cameraPath.name, peakResident);
+
+        printf ("%-10s %8llu %7.1f%% %8llu %10llu %10llu %10u %10u\n", cameraPath.name, (unsigned long long) stats.requests,
+                100.0 * stats.hits / std::max<uint64_t> (stats.requests, 1), (unsigned long long) stats.loads,
+                (unsigned long long) stats.evictions, (unsigned long long) stats.deferred, peakResident, settleUpdates);
+    }
+
+    unlink (path.c_str());
+    rmdir (directory);
+    return failures == 0 ? 0 : 1;
+}
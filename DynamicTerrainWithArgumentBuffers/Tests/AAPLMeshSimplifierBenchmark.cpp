@@ -0,0 +1,101 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the LOD chains built by AAPLSimplifyMesh on the shipped tree meshes.
+ Every mesh gets the chain AAPLObjLoader builds with lodCount 4 and the default ratio and error bound. For every
+ LOD the simplification time, the triangles kept relative to LOD 0 and the object space error are reported.
+ Fails if a LOD does not reduce the triangle count or if its error exceeds the bound.
+ Usage: AAPLMeshSimplifierBenchmark [repetitions]
+*/
+
+#include "AAPLTestMesh.h"
+#include "AAPLMeshSimplifier.h"
+
+#include <stdlib.h>
+
+int main (int argc, char** argv)
+{
+    const int repetitions = argc > 1 ? std::max (atoi (argv[1]), 1) : 10;
+    const uint32_t lodCount = 4;
+    const float lodTriangleRatio = 0.5f;
+    const float lodMaxError = 0.05f;
+
+    std::vector<std::string> paths = AAPLTreeMeshPaths();
+    if (paths.empty())
+    {
+        fprintf (stderr, "No meshes found in %s\n", AAPL_TREE_MESH_DIR);
+        return 1;
+    }
+
+    int failures = 0;
+    double totalSeconds = 0.0;
+    size_t totalTriangles = 0, totalLodTriangles[lodCount] = {};
+
+    printf ("%-16s %4s %9s %9s %10s %10s\n", "mesh", "LOD", "triangles", "kept", "error", "ms");
+
+    for (const std::string& path : paths)
+    {
+        const char* name = AAPLTestFileName (path);
+        AAPLTestMesh mesh;
+        AAPL_TEST_CHECK (failures, AAPLLoadTestMesh (path.c_str(), mesh), "%s", name);
+
+        // Same chain as AAPLObjLoader's buildLods: every LOD is simplified from the full mesh, and the chain
+        //  stops once the error bound keeps the simplifier from removing at least a tenth of the triangles
+        const uint32_t fullIndexCount = (uint32_t) mesh.indices.size();
+        const float* positions = mesh.vertices[0].position;
+        const float scale = AAPLMeshSimplifierScale (mesh.indices.data(), fullIndexCount, positions, sizeof(AAPLTestVertex));
+        std::vector<uint32_t> lodIndices (fullIndexCount);
+        size_t previousIndexCount = fullIndexCount;
+        float triangleRatio = 1.0f;
+
+        // A chain that stops early draws its coarsest LOD in place of the missing ones
+        size_t lodIndexCounts[lodCount];
+        std::fill (lodIndexCounts, lodIndexCounts + lodCount, (size_t) fullIndexCount);
+
+        printf ("%-16s %4u %9u %8.1f%% %10.2e %10s\n", name, 0, fullIndexCount / 3, 100.0, 0.0, "");
+        totalTriangles += fullIndexCount / 3;
+        totalLodTriangles[0] += fullIndexCount / 3;
+
+        for (uint32_t l = 1; l < lodCount; l++)
+        {
+            triangleRatio *= lodTriangleRatio;
+            size_t targetIndexCount = (size_t) (fullIndexCount / 3 * triangleRatio) * 3;
+            size_t indexCount = 0;
+            float error = 0.0f;
+
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repetitions; r++)
+            {
+                indexCount = AAPLSimplifyMesh (lodIndices.data(), mesh.indices.data(), fullIndexCount,
+                                               positions, sizeof(AAPLTestVertex), mesh.vertices.size(),
+                                               targetIndexCount, lodMaxError, &error);
+            }
+            double seconds = AAPLTestSecondsSince (start) / repetitions;
+            totalSeconds += seconds;
+
+            AAPL_TEST_CHECK (failures, indexCount % 3 == 0 && indexCount <= fullIndexCount, "%s LOD %u: %zu indices",
+                             name, l, indexCount);
+            AAPL_TEST_CHECK (failures, error <= lodMaxError, "%s LOD %u: error %g above the bound", name, l, error);
+            for (size_t i = 0; i < indexCount && failures == 0; i++)
+                AAPL_TEST_CHECK (failures, lodIndices[i] < mesh.vertices.size(), "%s LOD %u: index out of range", name, l);
+
+            printf ("%-16s %4u %9zu %8.1f%% %10.2e %10.3f\n", "", l, indexCount / 3,
+                    100.0 * indexCount / fullIndexCount, error * scale, seconds * 1e3);
+
+            if (indexCount == 0 || indexCount * 10 > previousIndexCount * 9)
+                break;
+            previousIndexCount = indexCount;
+            std::fill (lodIndexCounts + l, lodIndexCounts + lodCount, indexCount);
+        }
+        for (uint32_t l = 1; l < lodCount; l++)
+            totalLodTriangles[l] += lodIndexCounts[l] / 3;
+    }
+
+    printf ("all: %zu triangles", totalTriangles);
+    for (uint32_t l = 1; l < lodCount; l++)
+        printf (", LOD %u keeps %.1f%%", l, 100.0 * totalLodTriangles[l] / totalTriangles);
+    printf (", %.1f ms for all LODs, %d repetitions\n", totalSeconds * 1e3, repetitions);
+
+    return failures == 0 ? 0 : 1;
+}
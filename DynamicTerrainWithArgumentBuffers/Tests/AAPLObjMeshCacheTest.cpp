@@ -0,0 +1,176 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Round-trip test of the binary OBJ mesh cache.
+ Every tree mesh is parsed, written to a cache and mapped back; the mapped vertices, indices, submeshes, LODs and
+ bounding radius must match a fresh parse of the OBJ. Caches with another source, loader options, vertex layout
+ or a truncated file must be rejected.
+*/
+
+#include "AAPLTestMesh.h"
+#include "AAPLObjMeshCache.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The data AAPLObjLoader writes for a mesh that fits 16-bit indices
+struct AAPLTestCacheContents
+{
+    std::vector<AAPLTestVertex>     vertices;
+    std::vector<uint16_t>           indices;
+    AAPLObjSubmesh                  submesh;
+    AAPLMeshLod                     lod;
+    float                           boundingRadius;
+};
+
+static AAPLTestCacheContents AAPLMakeTestCacheContents (const AAPLTestMesh& mesh)
+{
+    AAPLTestCacheContents contents;
+    contents.vertices = mesh.vertices;
+    contents.indices.assign (mesh.indices.begin(), mesh.indices.end());
+    contents.submesh = {};
+    contents.submesh.indexCount = (uint32_t) mesh.indices.size();
+    contents.submesh.vertexCount = (uint32_t) mesh.vertices.size();
+    AAPLComputeObjSubmeshBounds (mesh.vertices.data(), contents.submesh.vertexCount,
+                                 [] (const AAPLTestVertex& vertex) { return vertex.position; }, contents.submesh);
+    contents.lod = { 0, (uint32_t) mesh.indices.size(), 0.0f };
+    contents.boundingRadius = 0.0f;
+    for (const AAPLTestVertex& vertex : mesh.vertices)
+    {
+        const float* p = vertex.position;
+        contents.boundingRadius = fmaxf (contents.boundingRadius, sqrtf (p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+    }
+    return contents;
+}
+
+// The options of a loader with the default LOD settings and mesh optimization enabled
+static const AAPLObjMeshCacheOptions kTestCacheOptions = { 1, 0.5f, 0.05f, 0, 1 };
+
+static bool AAPLWriteTestCache (const std::string& cachePath, const AAPLObjMeshCacheSource& source,
+                                const AAPLTestCacheContents& contents)
+{
+    const float positionOffset[3] = { -1.0f, -2.0f, -3.0f };
+    const float positionScale[3] = { 4.0f, 5.0f, 6.0f };
+    return AAPLWriteObjMeshCache (cachePath.c_str(), source, kTestCacheOptions,
+                                  contents.vertices.data(), sizeof(AAPLTestVertex), contents.vertices.size(),
+                                  contents.indices.data(), sizeof(uint16_t), contents.indices.size(),
+                                  &contents.submesh, 1, &contents.lod, 1,
+                                  contents.boundingRadius, positionOffset, positionScale);
+}
+
+int main ()
+{
+    std::vector<std::string> paths = AAPLTreeMeshPaths();
+    if (paths.empty())
+    {
+        fprintf (stderr, "No meshes found in %s\n", AAPL_TREE_MESH_DIR);
+        return 1;
+    }
+
+    char directoryTemplate[] = "/tmp/AAPLObjMeshCacheTest.XXXXXX";
+    const char* directory = mkdtemp (directoryTemplate);
+    if (directory == nullptr)
+    {
+        perror ("mkdtemp");
+        return 1;
+    }
+
+    int failures = 0;
+    for (const std::string& path : paths)
+    {
+        const char* name = AAPLTestFileName (path);
+        AAPLObjMeshCacheSource source;
+        AAPLTestMesh mesh;
+        AAPL_TEST_CHECK (failures, AAPLGetObjMeshCacheSource (path.c_str(), source), "%s", name);
+        AAPL_TEST_CHECK (failures, AAPLLoadTestMesh (path.c_str(), mesh), "%s", name);
+        AAPL_TEST_CHECK (failures, mesh.vertices.size() <= kObjMaxVerticesPer16BitMesh, "%s", name);
+
+        const AAPLTestCacheContents written = AAPLMakeTestCacheContents (mesh);
+        const std::string cachePath = std::string (directory) + "/" + name + ".meshcache";
+        AAPL_TEST_CHECK (failures, AAPLWriteTestCache (cachePath, source, written), "%s", name);
+
+        {
+            // Compare the mapped cache with a fresh parse rather than with the data that was written
+            AAPLTestMesh fresh;
+            AAPLLoadTestMesh (path.c_str(), fresh);
+            const AAPLTestCacheContents expected = AAPLMakeTestCacheContents (fresh);
+
+            AAPLObjMeshCacheReader cache (cachePath.c_str(), source, kTestCacheOptions, sizeof(AAPLTestVertex));
+            AAPL_TEST_CHECK (failures, cache.isValid(), "%s", name);
+            if (!cache.isValid())
+                continue;
+
+            AAPL_TEST_CHECK (failures, cache.getVertexCount() == expected.vertices.size(), "%s", name);
+            AAPL_TEST_CHECK (failures, cache.getIndexCount() == expected.indices.size(), "%s", name);
+            AAPL_TEST_CHECK (failures, cache.getIndexStride() == sizeof(uint16_t), "%s", name);
+            AAPL_TEST_CHECK (failures, cache.getVertexDataSize() == expected.vertices.size() * sizeof(AAPLTestVertex) &&
+                             memcmp (cache.getVertices(), expected.vertices.data(), cache.getVertexDataSize()) == 0,
+                             "%s: vertices differ", name);
+            AAPL_TEST_CHECK (failures, cache.getIndexDataSize() == expected.indices.size() * sizeof(uint16_t) &&
+                             memcmp (cache.getIndices(), expected.indices.data(), cache.getIndexDataSize()) == 0,
+                             "%s: indices differ", name);
+            AAPL_TEST_CHECK (failures, cache.getSubmeshCount() == 1 &&
+                             memcmp (cache.getSubmeshes(), &expected.submesh, sizeof(AAPLObjSubmesh)) == 0,
+                             "%s: submeshes differ", name);
+            AAPL_TEST_CHECK (failures, cache.getLodCount() == 1 &&
+                             memcmp (cache.getLods(), &expected.lod, sizeof(AAPLMeshLod)) == 0,
+                             "%s: LODs differ", name);
+            AAPL_TEST_CHECK (failures, cache.getBoundingRadius() == expected.boundingRadius, "%s", name);
+            AAPL_TEST_CHECK (failures, cache.getPositionOffset()[2] == -3.0f && cache.getPositionScale()[2] == 6.0f,
+                             "%s: position dequantization differs", name);
+            AAPL_TEST_CHECK (failures, ((uintptr_t) cache.getVertices() % kObjMeshCacheAlignment) == 0 &&
+                             ((uintptr_t) cache.getIndices() % kObjMeshCacheAlignment) == 0,
+                             "%s: blobs are not aligned", name);
+        }
+
+        // A cache made for another version of the OBJ, with other loader options or for the compact vertex
+        //  layout must not be used
+        AAPLObjMeshCacheSource staleSource = source;
+        staleSource.modificationNanoseconds++;
+        AAPL_TEST_CHECK (failures, !AAPLObjMeshCacheReader (cachePath.c_str(), staleSource, kTestCacheOptions,
+                                                            sizeof(AAPLTestVertex)).isValid(),
+                         "%s: stale cache accepted", name);
+        AAPL_TEST_CHECK (failures, !AAPLObjMeshCacheReader (cachePath.c_str(), source, kTestCacheOptions, 12).isValid(),
+                         "%s: cache with another vertex stride accepted", name);
+
+        AAPLObjMeshCacheOptions otherOptions[5] = { kTestCacheOptions, kTestCacheOptions, kTestCacheOptions,
+                                                    kTestCacheOptions, kTestCacheOptions };
+        otherOptions[0].lodCount = 3;
+        otherOptions[1].lodTriangleRatio = 0.25f;
+        otherOptions[2].lodMaxError = 0.1f;
+        otherOptions[3].splitLargeMeshes = 1;
+        otherOptions[4].optimizeMeshes = 0;
+        for (const AAPLObjMeshCacheOptions& options : otherOptions)
+        {
+            AAPL_TEST_CHECK (failures, !AAPLObjMeshCacheReader (cachePath.c_str(), source, options,
+                                                                sizeof(AAPLTestVertex)).isValid(),
+                             "%s: cache with other loader options accepted", name);
+        }
+
+        // Truncated files must be rejected before any pointer into them is handed out
+        AAPLMappedFile cacheFile (cachePath.c_str());
+        const std::string truncatedPath = cachePath + ".truncated";
+        if (FILE* truncated = fopen (truncatedPath.c_str(), "wb"))
+        {
+            fwrite (cacheFile.begin(), 1, cacheFile.getSize() - 1, truncated);
+            fclose (truncated);
+        }
+        AAPL_TEST_CHECK (failures, !AAPLObjMeshCacheReader (truncatedPath.c_str(), source, kTestCacheOptions,
+                                                            sizeof(AAPLTestVertex)).isValid(),
+                         "%s: truncated cache accepted", name);
+
+        unlink (truncatedPath.c_str());
+        unlink (cachePath.c_str());
+    }
+
+    AAPL_TEST_CHECK (failures, !AAPLObjMeshCacheReader ((std::string (directory) + "/missing").c_str(),
+                                                        AAPLObjMeshCacheSource(), kTestCacheOptions,
+                                                        sizeof(AAPLTestVertex)).isValid(),
+                     "missing cache accepted");
+    rmdir (directory);
+
+    printf ("%zu meshes, %d failures\n", paths.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
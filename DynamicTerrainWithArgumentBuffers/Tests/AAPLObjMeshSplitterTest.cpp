@@ -0,0 +1,156 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of meshes with more than 64K vertices.
+ Synthetic OBJ files with about 200K vertices are parsed with 32-bit indices, then split into submeshes with
+ 16-bit indices the way AAPLObjLoader does when splitLargeMeshes is set. Both paths must preserve the triangle
+ soup: every triangle must reference the same three vertices, in the same order, as in the OBJ.
+*/
+
+#include "AAPLTestMesh.h"
+#include "AAPLObjMeshSplitter.h"
+
+#include <math.h>
+#include <string>
+
+// Appends a v/vt/vn triple to `obj`; the texcoord stands in for the color like it does in the tree meshes
+static void AAPLAppendTestVertex (std::string& obj, float x, float y, float z)
+{
+    char line[256];
+    snprintf (line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f 0\nvn 0 1 0\n", x, y, z, x * 0.5f, z * 0.5f);
+    obj += line;
+}
+
+// A triangle soup: triangles are 2 units apart so no two share a vertex, and the mesh has 3 vertices per triangle
+static std::string AAPLMakeTriangleSoupObj (uint32_t triangleCount)
+{
+    std::string obj;
+    for (uint32_t t = 0; t < triangleCount; t++)
+    {
+        float x = (float) (2 * (t % 512)), z = (float) (2 * (t / 512));
+        AAPLAppendTestVertex (obj, x, 0.0f, z);
+        AAPLAppendTestVertex (obj, x + 1.0f, 0.0f, z);
+        AAPLAppendTestVertex (obj, x, 0.0f, z + 1.0f);
+        obj += "f -3/-3/-3 -2/-2/-2 -1/-1/-1\n";
+    }
+    return obj;
+}
+
+// A grid of quads sharing their corners, so the splitter has to duplicate the vertices along the
+//  triangle ranges where it starts a new submesh
+static std::string AAPLMakeGridObj (uint32_t size)
+{
+    std::string obj;
+    for (uint32_t z = 0; z < size; z++)
+    for (uint32_t x = 0; x < size; x++)
+        AAPLAppendTestVertex (obj, (float) x, sinf ((float) (x + z)), (float) z);
+
+    char line[256];
+    for (uint32_t z = 0; z + 1 < size; z++)
+    for (uint32_t x = 0; x + 1 < size; x++)
+    {
+        uint32_t v = z * size + x + 1;
+        snprintf (line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n",
+                  v, v, v, v + size, v + size, v + size, v + size + 1, v + size + 1, v + size + 1, v + 1, v + 1, v + 1);
+        obj += line;
+    }
+    return obj;
+}
+
+// Checks that the split mesh draws exactly the triangles of `mesh`, and that every submesh fits 16-bit indices
+static int AAPLCheckSplitMesh (const char* name, const AAPLTestMesh& mesh)
+{
+    int failures = 0;
+    std::vector<AAPLTestVertex> splitVertices;
+    std::vector<uint16_t> splitIndices;
+    std::vector<AAPLObjSubmesh> submeshes;
+    auto getPosition = [] (const AAPLTestVertex& vertex) { return vertex.position; };
+    AAPLSplitObjMesh (mesh.vertices, mesh.indices, getPosition, splitVertices, splitIndices, submeshes);
+
+    AAPL_TEST_CHECK (failures, submeshes.size() > 1, "%s: %zu submeshes", name, submeshes.size());
+    AAPL_TEST_CHECK (failures, splitIndices.size() == mesh.indices.size(), "%s: %zu split indices, %zu indices",
+                     name, splitIndices.size(), mesh.indices.size());
+
+    uint32_t nextIndex = 0, nextVertex = 0;
+    for (const AAPLObjSubmesh& submesh : submeshes)
+    {
+        // Submeshes cover the index and vertex lists in order, without gaps
+        AAPL_TEST_CHECK (failures, submesh.indexStart == nextIndex && submesh.baseVertex == nextVertex, "%s", name);
+        AAPL_TEST_CHECK (failures, submesh.vertexCount <= kObjMaxVerticesPer16BitMesh, "%s: %u vertices",
+                         name, submesh.vertexCount);
+        nextIndex += submesh.indexCount;
+        nextVertex += submesh.vertexCount;
+
+        for (uint32_t i = submesh.indexStart; i < submesh.indexStart + submesh.indexCount && failures == 0; i++)
+        {
+            // Drawing with the submesh's base vertex must fetch the vertex of the original index
+            AAPL_TEST_CHECK (failures, splitIndices[i] < submesh.vertexCount, "%s: index %u out of its submesh", name, i);
+            AAPL_TEST_CHECK (failures, splitVertices[submesh.baseVertex + splitIndices[i]] == mesh.vertices[mesh.indices[i]],
+                             "%s: index %u fetches another vertex", name, i);
+        }
+
+        for (uint32_t v = submesh.baseVertex; v < submesh.baseVertex + submesh.vertexCount && failures == 0; v++)
+        {
+            const float* p = splitVertices[v].position;
+            float dx = p[0] - submesh.boundingCenter[0];
+            float dy = p[1] - submesh.boundingCenter[1];
+            float dz = p[2] - submesh.boundingCenter[2];
+            AAPL_TEST_CHECK (failures, sqrtf (dx * dx + dy * dy + dz * dz) <= submesh.boundingRadius * 1.0001f,
+                             "%s: vertex %u outside of its submesh bounds", name, v);
+        }
+    }
+    AAPL_TEST_CHECK (failures, nextIndex == splitIndices.size() && nextVertex == splitVertices.size(), "%s", name);
+
+    printf ("%s: %zu vertices, %zu triangles, split into %zu submeshes with %zu vertices\n", name,
+            mesh.vertices.size(), mesh.indices.size() / 3, submeshes.size(), splitVertices.size());
+    return failures;
+}
+
+int main ()
+{
+    int failures = 0;
+    AAPLTaskPool pool;
+
+    // 66,667 triangles of 3 unique vertices each: 200,001 vertices
+    const uint32_t soupTriangleCount = 66667;
+    const std::string soup = AAPLMakeTriangleSoupObj (soupTriangleCount);
+    {
+        AAPLTestMesh mesh, chunked;
+        AAPLParseTestMesh (soup.data(), soup.data() + soup.size(), mesh);
+        AAPLParseTestMeshChunked (soup.data(), soup.data() + soup.size(), pool, chunked);
+
+        AAPL_TEST_CHECK (failures, mesh.vertices.size() == 3 * soupTriangleCount, "%zu vertices", mesh.vertices.size());
+        AAPL_TEST_CHECK (failures, mesh.indices.size() == 3 * soupTriangleCount, "%zu indices", mesh.indices.size());
+        AAPL_TEST_CHECK (failures, mesh.vertices == chunked.vertices && mesh.indices == chunked.indices,
+                         "the chunked parse differs from the serial one");
+
+        // With 32-bit indices, no index may have wrapped around 64K: the soup references its vertices in order
+        for (uint32_t i = 0; i < mesh.indices.size() && failures == 0; i++)
+            AAPL_TEST_CHECK (failures, mesh.indices[i] == i, "index %u is %u", i, mesh.indices[i]);
+
+        // Every triangle keeps its corners
+        for (uint32_t t = 0; t < soupTriangleCount && failures == 0; t++)
+        {
+            const float* p0 = mesh.vertices[mesh.indices[3 * t]].position;
+            const float* p2 = mesh.vertices[mesh.indices[3 * t + 2]].position;
+            AAPL_TEST_CHECK (failures, p0[0] == (float) (2 * (t % 512)) && p0[2] == (float) (2 * (t / 512)) &&
+                             p2[0] == p0[0] && p2[2] == p0[2] + 1.0f, "triangle %u moved", t);
+        }
+
+        failures += AAPLCheckSplitMesh ("soup", mesh);
+    }
+
+    // 448 x 448 = 200,704 shared vertices
+    const std::string grid = AAPLMakeGridObj (448);
+    {
+        AAPLTestMesh mesh;
+        AAPLParseTestMesh (grid.data(), grid.data() + grid.size(), mesh);
+        AAPL_TEST_CHECK (failures, mesh.vertices.size() == 448 * 448, "%zu vertices", mesh.vertices.size());
+        AAPL_TEST_CHECK (failures, mesh.indices.size() == 447 * 447 * 6, "%zu indices", mesh.indices.size());
+        failures += AAPLCheckSplitMesh ("grid", mesh);
+    }
+
+    printf ("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
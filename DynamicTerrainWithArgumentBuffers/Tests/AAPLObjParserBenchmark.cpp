@@ -0,0 +1,79 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the OBJ parser on the shipped tree meshes.
+ Reports MB/s and welded vertices/s of the serial parser and of the chunked parser for every mesh, and fails if
+ the chunked parser does not produce the same vertices and indices as the serial one.
+ Usage: AAPLObjParserBenchmark [repetitions]
+*/
+
+#include "AAPLTestMesh.h"
+
+#include <stdlib.h>
+
+int main (int argc, char** argv)
+{
+    const int repetitions = argc > 1 ? std::max (atoi (argv[1]), 1) : 50;
+
+    std::vector<std::string> paths = AAPLTreeMeshPaths();
+    if (paths.empty())
+    {
+        fprintf (stderr, "No meshes found in %s\n", AAPL_TREE_MESH_DIR);
+        return 1;
+    }
+
+    // The tree meshes are smaller than two default chunks, so the chunked parser is given smaller chunks
+    //  to split them over the pool at all
+    const size_t chunkSize = 16 * 1024;
+    AAPLTaskPool pool;
+
+    int failures = 0;
+    double totalBytes = 0.0, totalVertices = 0.0, totalSerialSeconds = 0.0, totalChunkedSeconds = 0.0;
+
+    printf ("%-16s %8s %8s %10s %10s %10s %10s\n", "mesh", "KB", "vertices", "MB/s", "Mvert/s", "MB/s", "Mvert/s");
+    printf ("%-16s %8s %8s %21s %21s\n", "", "", "", "(serial)", "(chunked)");
+
+    for (const std::string& path : paths)
+    {
+        AAPLMappedFile file (path.c_str());
+        AAPL_TEST_CHECK (failures, file.isValid(), "%s", path.c_str());
+        if (!file.isValid())
+            continue;
+
+        AAPLTestMesh serial, chunked;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++)
+            AAPLParseTestMesh (file.begin(), file.end(), serial);
+        double serialSeconds = AAPLTestSecondsSince (start) / repetitions;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++)
+            AAPLParseTestMeshChunked (file.begin(), file.end(), pool, chunked, chunkSize);
+        double chunkedSeconds = AAPLTestSecondsSince (start) / repetitions;
+
+        AAPL_TEST_CHECK (failures, !serial.indices.empty(), "%s has no triangles", path.c_str());
+        AAPL_TEST_CHECK (failures, serial.vertices == chunked.vertices && serial.indices == chunked.indices,
+                         "%s: the chunked parse differs from the serial one", path.c_str());
+
+        const double megabytes = file.getSize() / 1e6;
+        const double megavertices = serial.vertices.size() / 1e6;
+        printf ("%-16s %8.1f %8zu %10.1f %10.2f %10.1f %10.2f\n", AAPLTestFileName (path),
+                file.getSize() / 1024.0, serial.vertices.size(),
+                megabytes / serialSeconds, megavertices / serialSeconds,
+                megabytes / chunkedSeconds, megavertices / chunkedSeconds);
+
+        totalBytes += file.getSize();
+        totalVertices += serial.vertices.size();
+        totalSerialSeconds += serialSeconds;
+        totalChunkedSeconds += chunkedSeconds;
+    }
+
+    printf ("%-16s %8.1f %8.0f %10.1f %10.2f %10.1f %10.2f\n", "all", totalBytes / 1024.0, totalVertices,
+            totalBytes / 1e6 / totalSerialSeconds, totalVertices / 1e6 / totalSerialSeconds,
+            totalBytes / 1e6 / totalChunkedSeconds, totalVertices / 1e6 / totalChunkedSeconds);
+    printf ("%u threads, %d repetitions\n", pool.getThreadCount(), repetitions);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Stress test of the AAPLParticlePagePool against a model of the particles it holds.
+ Every round allocates, releases or compacts at random, tagging each particle with an ID in its slot. After
+ each round, the masks, the alive counts of the pages and of the pool and the set of alive slots must match
+ the model, and every alive slot must hold its particle's ID. Allocations must take the lowest free slots
+ of the resident pages before adding pages, and stop at the page budget. A compaction may only move the
+ particles of pages it empties, all of them, into slots that were free on the pages it keeps; the sparsest
+ pages must go first, and every page left empty must be freed.
+ Usage: AAPLParticlePagePoolTest [rounds]
+*/
+
+#include "AAPLParticlePagePool.h"
+#include "AAPLRandom.h"
+#include "AAPLTestMesh.h"
+
+#include <stdlib.h>
+#include <map>
+
+static const uint32_t kPageSize     = 128;
+static const uint32_t kMaxPageCount = 24;
+
+struct AAPLTestParticle
+{
+    uint64_t    id;
+    uint64_t    check;          // ~id, so a copy of half a particle shows
+};
+
+// Slot to ID of every alive particle
+typedef std::map<uint32_t, uint64_t> AAPLParticleModel;
+
+static int AAPLCheckPool (const AAPLParticlePagePool& pool, const AAPLParticleModel& model, uint32_t round)
+{
+    int failures = 0;
+    AAPL_TEST_CHECK (failures, pool.getAliveCount() == model.size(), "round %u: %u alive particles, %zu expected",
+                     round, pool.getAliveCount(), model.size());
+    AAPL_TEST_CHECK (failures, pool.getResidentPageCount() <= kMaxPageCount && pool.getCapacity() == pool.getResidentPageCount() * kPageSize,
+                     "round %u: %u resident pages, %u slots", round, pool.getResidentPageCount(), pool.getCapacity());
+
+    uint32_t resident = 0;
+    auto next = model.begin();
+    for (uint32_t page = 0; page < pool.getPageCount() && failures == 0; page++)
+    {
+        const uint32_t pageBegin = page * kPageSize;
+        if (!pool.isPageResident (page))
+        {
+            AAPL_TEST_CHECK (failures, next == model.end() || next->first >= pageBegin + kPageSize,
+                             "round %u: slot %u is alive on freed page %u", round, next->first, page);
+            continue;
+        }
+        resident++;
+
+        const uint64_t* mask = pool.getPageAliveMask (page);
+        uint32_t alive = 0;
+        for (uint32_t index = 0; index < kPageSize && failures == 0; index++)
+        {
+            const uint32_t slot = pageBegin + index;
+            const bool inMask = (mask[index / 64] >> (index % 64)) & 1;
+            const bool inModel = next != model.end() && next->first == slot;
+            AAPL_TEST_CHECK (failures, inMask == inModel && pool.isAlive (slot) == inModel, "round %u: slot %u is %s in its mask, %s in the model",
+                             round, slot, inMask ? "alive" : "free", inModel ? "alive" : "free");
+            if (!inModel)
+                continue;
+
+            AAPLTestParticle particle;
+            memcpy (&particle, pool.getPageData (page) + (size_t) index * sizeof(AAPLTestParticle), sizeof(particle));
+            AAPL_TEST_CHECK (failures, particle.id == next->second && particle.check == ~next->second,
+                             "round %u: slot %u holds particle %llu, expected %llu", round, slot,
+                             (unsigned long long) particle.id, (unsigned long long) next->second);
+            alive++;
+            ++next;
+        }
+        AAPL_TEST_CHECK (failures, alive == pool.getPageAliveCount (page), "round %u: page %u counts %u alive particles, its mask %u",
+                         round, page, pool.getPageAliveCount (page), alive);
+    }
+    AAPL_TEST_CHECK (failures, failures != 0 || next == model.end(), "round %u: slot %u is alive past the last page", round, next->first);
+    AAPL_TEST_CHECK (failures, resident == pool.getResidentPageCount(), "round %u: %u resident pages, %u counted",
+                     round, pool.getResidentPageCount(), resident);
+    return failures;
+}
+
+// Free slots of the resident pages in increasing order
+static std::vector<uint32_t> AAPLFreeSlots (const AAPLParticlePagePool& pool, const AAPLParticleModel& model)
+{
+    std::vector<uint32_t> freeSlots;
+    for (uint32_t page = 0; page < pool.getPageCount(); page++)
+    {
+        for (uint32_t index = 0; pool.isPageResident (page) && index < kPageSize; index++)
+        {
+            if (model.count (page * kPageSize + index) == 0)
+                freeSlots.push_back (page * kPageSize + index);
+        }
+    }
+    return freeSlots;
+}
+
+static int AAPLTestAllocate (AAPLParticlePagePool& pool, AAPLParticleModel& model, uint32_t count, uint64_t& nextID, uint32_t round)
+{
+    int failures = 0;
+    const std::vector<uint32_t> freeSlots = AAPLFreeSlots (pool, model);
+    std::vector<uint8_t> wasResident (kMaxPageCount, 0);
+    for (uint32_t page = 0; page < pool.getPageCount(); page++)
+        wasResident[page] = pool.isPageResident (page);
+
+    std::vector<uint32_t> slots (count);
+    const uint32_t allocated = pool.allocate (count, slots.data());
+    const uint32_t expected = std::min (count, kMaxPageCount * kPageSize - (uint32_t) model.size());
+    AAPL_TEST_CHECK (failures, allocated == expected, "round %u: allocated %u of %u particles, expected %u", round, allocated, count, expected);
+
+    for (uint32_t i = 0; i < allocated && failures == 0; i++)
+    {
+        const uint32_t slot = slots[i];
+        const uint32_t page = slot / kPageSize;
+        AAPL_TEST_CHECK (failures, model.count (slot) == 0, "round %u: allocated slot %u is already alive", round, slot);
+
+        // First fit: the free slots of the resident pages in order, then slots of new pages in order
+        if (i < freeSlots.size())
+            AAPL_TEST_CHECK (failures, slot == freeSlots[i], "round %u: allocation %u took slot %u, the lowest free one is %u",
+                             round, i, slot, freeSlots[i]);
+        else
+            AAPL_TEST_CHECK (failures, page < kMaxPageCount && !wasResident[page] && (i == 0 || slot / kPageSize != slots[i - 1] / kPageSize ||
+                             slot > slots[i - 1]), "round %u: allocation %u took slot %u, not the next one of a new page", round, i, slot);
+
+        const AAPLTestParticle particle = { nextID, ~nextID };
+        memcpy (pool.getSlotData (slot), &particle, sizeof(particle));
+        model[slot] = nextID++;
+    }
+    return failures;
+}
+
+static int AAPLTestCompact (AAPLParticlePagePool& pool, AAPLParticleModel& model, float maxOccupancy, uint32_t round, uint64_t& moveTotal)
+{
+    int failures = 0;
+    std::vector<uint32_t> aliveBefore (kMaxPageCount, 0);
+    for (uint32_t page = 0; page < pool.getPageCount(); page++)
+        aliveBefore[page] = pool.isPageResident (page) ? pool.getPageAliveCount (page) : 0;
+    const uint32_t sparseLimit = (uint32_t) (std::max (0.0f, std::min (maxOccupancy, 1.0f)) * kPageSize);
+
+    std::vector<AAPLParticlePageMove> moves (3, { ~0u, ~0u });
+    const uint32_t moveCount = pool.compact (maxOccupancy, moves);
+    AAPL_TEST_CHECK (failures, moveCount == moves.size() - 3, "round %u: %u moves returned, %zu appended", round, moveCount, moves.size() - 3);
+    moveTotal += moveCount;
+
+    // A page is emptied when its particles move; it must lose all of them
+    std::vector<uint32_t> movedFrom (kMaxPageCount, 0);
+    AAPLParticleModel moved;
+    for (size_t m = 3; m < moves.size() && failures == 0; m++)
+    {
+        const AAPLParticlePageMove move = moves[m];
+        AAPL_TEST_CHECK (failures, model.count (move.from) == 1 && model.count (move.to) == 0 && moved.count (move.to) == 0,
+                         "round %u: move %u -> %u from a free slot or to a taken one", round, move.from, move.to);
+        if (failures)
+            break;
+        movedFrom[move.from / kPageSize]++;
+        moved[move.to] = model[move.from];
+        model.erase (move.from);
+    }
+    for (const auto& particle : moved)
+        model.insert (particle);
+
+    for (uint32_t page = 0; page < kMaxPageCount && failures == 0; page++)
+    {
+        const bool emptied = movedFrom[page] > 0;
+        AAPL_TEST_CHECK (failures, !emptied || (movedFrom[page] == aliveBefore[page] && aliveBefore[page] <= sparseLimit),
+                         "round %u: %u of the %u particles of page %u moved, %u or fewer make a page sparse", round,
+                         movedFrom[page], aliveBefore[page], page, sparseLimit);
+
+        // Sparsest first, and the highest of equally sparse pages
+        for (uint32_t kept = 0; kept < kMaxPageCount && emptied; kept++)
+        {
+            if (movedFrom[kept] > 0 || aliveBefore[kept] == 0 || aliveBefore[kept] > sparseLimit)
+                continue;
+            AAPL_TEST_CHECK (failures, aliveBefore[page] < aliveBefore[kept] || (aliveBefore[page] == aliveBefore[kept] && page > kept),
+                             "round %u: page %u with %u particles was emptied before page %u with %u", round, page,
+                             aliveBefore[page], kept, aliveBefore[kept]);
+        }
+
+        const bool resident = page < pool.getPageCount() && pool.isPageResident (page);
+        AAPL_TEST_CHECK (failures, !resident || pool.getPageAliveCount (page) > 0, "round %u: empty page %u is still resident", round, page);
+        AAPL_TEST_CHECK (failures, !emptied || !resident, "round %u: emptied page %u is still resident", round, page);
+    }
+    return failures;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t roundCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 1) : 20000;
+
+    AAPLParticlePagePool pool (sizeof(AAPLTestParticle), kPageSize, kMaxPageCount);
+    AAPLParticleModel model;
+    AAPLRandomStream random;
+    AAPLRandomStreamInit (&random, 16, 0);
+
+    int failures = 0;
+    uint64_t nextID = 1;
+    uint64_t allocations = 0, releases = 0, moves = 0, compactions = 0, fullAllocations = 0;
+    uint32_t peakPages = 0;
+    for (uint32_t round = 0; round < roundCount && failures == 0; round++)
+    {
+        // Phases of growth and decay, so the pool fills up, drains and fragments
+        const bool growing = (round / 500) % 2 == 0;
+        const uint32_t operation = AAPLRandomNextBelow (&random, 16);
+        if (operation < (growing ? 9u : 5u))
+        {
+            const uint32_t count = AAPLRandomNextBelow (&random, 2) ? AAPLRandomNextBelow (&random, 8) : AAPLRandomNextBelow (&random, 400);
+            fullAllocations += model.size() + count > kMaxPageCount * kPageSize ? 1 : 0;
+            failures += AAPLTestAllocate (pool, model, count, nextID, round);
+            allocations += count;
+        }
+        else if (operation < 14)
+        {
+            // Random particles, or a whole run of them so pages empty
+            std::vector<uint32_t> slots;
+            const uint32_t count = AAPLRandomNextBelow (&random, (uint32_t) model.size() / 4 + 2);
+            const bool run = AAPLRandomNextBelow (&random, 3) == 0;
+            for (const auto& particle : model)
+            {
+                if (run ? slots.size() < count : AAPLRandomNextBelow (&random, (uint32_t) model.size() + 1) < count)
+                    slots.push_back (particle.first);
+            }
+            std::vector<uint32_t> order (slots);
+            for (uint32_t i = (uint32_t) order.size(); i > 1; i--)
+                std::swap (order[i - 1], order[AAPLRandomNextBelow (&random, i)]);
+
+            pool.release (order.data(), (uint32_t) order.size());
+            for (uint32_t slot : slots)
+                model.erase (slot);
+            releases += slots.size();
+        }
+        else
+        {
+            const size_t before = model.size();
+            const float maxOccupancy = AAPLRandomNextRange (&random, -0.1f, 1.1f);
+            failures += AAPLTestCompact (pool, model, maxOccupancy, round, moves);
+            AAPL_TEST_CHECK (failures, model.size() == before, "round %u: compaction changed the particle count", round);
+            compactions++;
+        }
+
+        failures += AAPLCheckPool (pool, model, round);
+        peakPages = std::max (peakPages, pool.getResidentPageCount());
+    }
+
+    printf ("%u rounds: %llu allocations, %llu at the page budget, %llu releases, %llu compactions moving %llu particles, "
+            "peak %u of %u pages\n", roundCount, (unsigned long long) allocations, (unsigned long long) fullAllocations,
+            (unsigned long long) releases, (unsigned long long) compactions, (unsigned long long) moves, peakPages, kMaxPageCount);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the AAPLParticleSimulation with up to 16K, 256K and 4M particles.
+ The brush sweeps a procedural heightmap and spawns a steady stream of particles of the sample's habitats, with
+ bursts larger than the free slots so particles die to make room, and the sparse pages are compacted every
+ 30 frames. Every size runs serially and on a task pool, and reports the particles simulated per second and the
+ pages in use. Fails when, after any step or compaction, the alive list and the free slots of the resident pages
+ together are not a permutation of the slots of those pages, or when the serial and threaded runs end with
+ different particles.
+ Usage: AAPLParticleSimulationBenchmark [largest pool] [frames]
+*/
+
+#include "AAPLParticleSimulation.h"
+#include "AAPLTaskPool.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const float    kTerrainScale  = 15000.0f;    // TERRAIN_SCALE
+static const float    kTerrainHeight = 4500.0f;     // TERRAIN_HEIGHT
+static const uint32_t kMapSize       = 512;
+static const float    kFrameTime     = 1.0f / 60.0f;
+
+// AAPLParticleRenderer's GetParticleProperties: puffy particles on the first two habitats, chunky ones on the others
+static const AAPLParticleHabitat kPuffy =
+{
+    { 0.0f, 0.3f, 0.8f, 1.2f }, { 0.0f, 0.24f, 0.6f, 0.87f }, { 1.0f, 1.0f, 1.0f, 0.0f }, { 0.0f, -50.0f, 0.0f }, false, false
+};
+static const AAPLParticleHabitat kChunky =
+{
+    { 0.0f, 4.0f, 5.0f, 6.0f }, { 1.0f, 1.0f, 1.0f, 0.4f }, { 1.0f, 1.0f, 1.0f, 0.0f }, { 0.0f, -400.0f, 0.0f }, true, true
+};
+static const AAPLParticleHabitat kHabitats[AAPLParticleSimulation::kHabitatCount] = { kPuffy, kPuffy, kChunky, kChunky };
+
+static std::vector<uint16_t> AAPLMakeHeights ()
+{
+    std::vector<uint16_t> heights ((size_t) kMapSize * kMapSize);
+    for (uint32_t y = 0; y < kMapSize; y++)
+    {
+        for (uint32_t x = 0; x < kMapSize; x++)
+        {
+            float h = 0.4f + 0.25f * sinf (x * 0.023f) * cosf (y * 0.017f) + 0.05f * sinf ((x + 2 * y) * 0.11f);
+            heights[(size_t) y * kMapSize + x] = (uint16_t) (std::min (std::max (h, 0.0f), 1.0f) * 65535.0f);
+        }
+    }
+    return heights;
+}
+
+// The frame the renderer would send: the brush circles the map, and every 50th frame spawns a burst of a
+//  quarter of the pool
+static AAPLParticleFrame AAPLMakeFrame (uint32_t frame, uint32_t capacity)
+{
+    AAPLParticleFrame f;
+    f.frameTime = kFrameTime;
+    f.gameTime = frame * kFrameTime;
+    f.brushPosition[0] = cosf (f.gameTime * 0.7f) * kTerrainScale * 0.3f;
+    f.brushPosition[1] = 0.0f;
+    f.brushPosition[2] = sinf (f.gameTime * 0.7f) * kTerrainScale * 0.3f;
+    f.brushSize = 600.0f;
+    f.spawnCount = frame % 50 == 49 ? capacity / 4 : capacity / 90;
+    return f;
+}
+
+// Every slot of a resident page must be either in the alive list or free, exactly once, and the alive lists
+//  must agree with the masks and the counts of the pages
+static int AAPLCheckSlots (const AAPLParticleSimulation& simulation, std::vector<uint8_t>& seen, const char* name, uint32_t frame)
+{
+    int failures = 0;
+    const AAPLParticlePagePool& pages = simulation.getPagePool();
+    const std::vector<uint32_t>& alive = simulation.getAliveSlots();
+
+    AAPL_TEST_CHECK (failures, alive.size() == simulation.getAliveCount() && simulation.getAliveCount() <= simulation.getCapacity() &&
+                     simulation.getCapacity() <= simulation.getMaxParticles(),
+                     "%s frame %u: %zu slots in the alive list, %u alive particles, %u slots and at most %u particles", name, frame,
+                     alive.size(), simulation.getAliveCount(), simulation.getCapacity(), simulation.getMaxParticles());
+
+    seen.assign ((size_t) pages.getPageCount() * pages.getPageSize(), 0);
+    for (size_t i = 0; i < alive.size() && failures == 0; i++)
+    {
+        const uint32_t slot = alive[i];
+        AAPL_TEST_CHECK (failures, slot < seen.size() && !seen[slot] && pages.isAlive (slot) && (i == 0 || slot > alive[i - 1]),
+                         "%s frame %u: alive slot %u is out of range, listed twice, out of order or not alive in its page",
+                         name, frame, slot);
+        if (failures == 0)
+            seen[slot] = 1;
+    }
+
+    uint32_t aliveSlots = 0, freeSlots = 0;
+    for (uint32_t page = 0; page < pages.getPageCount() && failures == 0; page++)
+    {
+        if (!pages.isPageResident (page))
+            continue;
+        const uint64_t* mask = pages.getPageAliveMask (page);
+        uint32_t pageAlive = 0;
+        for (uint32_t index = 0; index < pages.getPageSize(); index++)
+        {
+            const bool isAlive = (mask[index / 64] >> (index % 64)) & 1;
+            AAPL_TEST_CHECK (failures, isAlive == (seen[page * pages.getPageSize() + index] != 0),
+                             "%s frame %u: slot %u is %s in its page but %s the alive list", name, frame,
+                             page * pages.getPageSize() + index, isAlive ? "alive" : "free", isAlive ? "not in" : "in");
+            pageAlive += isAlive ? 1 : 0;
+        }
+        AAPL_TEST_CHECK (failures, pageAlive == pages.getPageAliveCount (page), "%s frame %u: page %u counts %u alive particles, its mask %u",
+                         name, frame, page, pages.getPageAliveCount (page), pageAlive);
+        aliveSlots += pageAlive;
+        freeSlots += pages.getPageSize() - pageAlive;
+    }
+    AAPL_TEST_CHECK (failures, failures != 0 || (aliveSlots == alive.size() && aliveSlots + freeSlots == simulation.getCapacity()),
+                     "%s frame %u: %u alive and %u free slots in pages of %u slots", name, frame, aliveSlots, freeSlots,
+                     simulation.getCapacity());
+    return failures;
+}
+
+// Runs `frameCount` frames, checking the slots after each step and compaction; the checks are not timed
+static int AAPLRun (AAPLParticleSimulation& simulation, const AAPLParticleTerrain& terrain, uint32_t frameCount,
+                    AAPLTaskPool* pool, const char* name, double& outSeconds, double& outParticles, uint32_t& outPeakPages)
+{
+    int failures = 0;
+    std::vector<uint8_t> seen;
+    std::vector<AAPLParticlePageMove> moves;
+    outSeconds = 0.0;
+    outParticles = 0.0;
+    outPeakPages = 0;
+    for (uint32_t frame = 0; frame < frameCount && failures == 0; frame++)
+    {
+        const AAPLParticleFrame f = AAPLMakeFrame (frame, simulation.getMaxParticles());
+        outParticles += simulation.getAliveCount() + std::min (f.spawnCount, simulation.getMaxParticles());
+
+        auto start = std::chrono::steady_clock::now();
+        simulation.step (f, terrain, pool);
+        if (frame % 30 == 29)
+            simulation.compact (0.25f, moves);
+        outSeconds += AAPLTestSecondsSince (start);
+
+        outPeakPages = std::max (outPeakPages, simulation.getPagePool().getResidentPageCount());
+        failures += AAPLCheckSlots (simulation, seen, name, frame);
+    }
+    return failures;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t largestPool = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 1024) : 4096 * 1024;
+    const uint32_t frameCount = argc > 2 ? (uint32_t) std::max (atoi (argv[2]), 1) : 150;
+
+    const std::vector<uint16_t> heights = AAPLMakeHeights ();
+    AAPLTerrainHeightPyramid pyramid (kTerrainScale, kTerrainHeight);
+    pyramid.build ({ heights.data(), kMapSize, kMapSize, 1 });
+
+    // Bands of habitats across the map, so both kinds of particles spawn under the brush
+    AAPLParticleTerrain terrain;
+    terrain.heights = &pyramid;
+    terrain.habitatAt = [] (float x, float z) { return (uint32_t) (sinf (x * 0.004f) * cosf (z * 0.003f) * 1.99f + 2.0f); };
+
+    const uint32_t threads = std::max (std::thread::hardware_concurrency(), 2u);
+    AAPLTaskPool pool (threads - 1);
+
+    printf ("%u frames per size, %u threads\n", frameCount, threads);
+    printf ("%-10s %8s %12s %12s %14s %14s\n", "particles", "threads", "alive", "peak pages", "Mparticles/s", "ms/frame");
+
+    int failures = 0;
+    for (uint32_t maxParticles = 16 * 1024; maxParticles <= largestPool && failures == 0; maxParticles *= 16)
+    {
+        std::vector<uint32_t> serialSlots;
+        std::vector<AAPLParticle> serialParticles;
+        for (AAPLTaskPool* stepPool : { (AAPLTaskPool*) nullptr, &pool })
+        {
+            char name[48];
+            snprintf (name, sizeof(name), "%uK particles, %u threads", maxParticles / 1024, stepPool ? threads : 1);
+
+            AAPLParticleSimulation simulation (maxParticles, kHabitats);
+            double seconds = 0.0, particles = 0.0;
+            uint32_t peakPages = 0;
+            failures += AAPLRun (simulation, terrain, frameCount, stepPool, name, seconds, particles, peakPages);
+
+            // Slots are freed and allocated in page order, so any number of threads gives the same particles
+            const std::vector<uint32_t>& alive = simulation.getAliveSlots();
+            std::vector<AAPLParticle> aliveParticles;
+            for (uint32_t slot : alive)
+                aliveParticles.push_back (simulation.getParticle (slot));
+            if (!stepPool)
+            {
+                serialSlots = alive;
+                serialParticles = aliveParticles;
+            }
+            else
+            {
+                AAPL_TEST_CHECK (failures, alive == serialSlots &&
+                                 memcmp (serialParticles.data(), aliveParticles.data(), alive.size() * sizeof(AAPLParticle)) == 0,
+                                 "%s: the particles differ from the serial run", name);
+            }
+
+            printf ("%7uK %8u %12zu %12u %14.2f %14.3f\n", maxParticles / 1024, stepPool ? threads : 1, alive.size(), peakPages,
+                    particles / seconds / 1e6, seconds * 1e3 / frameCount);
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the incremental terrain bakes against full ones.
+ Random brush strokes edit a procedural heightmap the way TerrainKnl_UpdateHeightmap does, over every texel of
+ the map. After each stroke, the normal and properties maps and their mips are rebaked over the region
+ AAPLGetTerrainBrushBakeRegion finds, and compared to maps baked from scratch. Fails when any texel of any mip
+ level differs. Runs on a square map and on a smaller one with odd mip sizes, and reports the rebaked texels and
+ the time of the incremental and full bakes.
+ Usage: AAPLTerrainBakeTest [strokes per map]
+*/
+
+#include "AAPLRandom.h"
+#include "AAPLTerrainBake.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// AAPLTerrainRenderer_shared.h
+static const float kTerrainScale = 15000.0f;
+
+static std::vector<float> AAPLMakeHeights (uint32_t width, uint32_t height)
+{
+    std::vector<float> heights ((size_t) width * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+            heights[(size_t) y * width + x] = 0.4f + 0.2f * sinf (x * 0.05f) * cosf (y * 0.07f) + 0.1f * sinf ((x + y) * 0.21f);
+    }
+    return heights;
+}
+
+// evaluateModificationBrush in AAPLMainRendererUtilities.metal
+static float AAPLEvaluateBrush (float x, float z, float brushX, float brushZ, float brushSize)
+{
+    float dist = sqrtf ((x - brushX) * (x - brushX) + (z - brushZ) * (z - brushZ)) / brushSize;
+    float brush = std::min (2.0f - dist, 1.0f / (1.0f + powf (dist * 2.0f, 4.0f)));
+    return std::min (std::max (brush, 0.0f), 1.0f);
+}
+
+// TerrainKnl_UpdateHeightmap over every texel; like the kernel, both axes are scaled by the width.
+//  The heights stay within the range of the unorm height map.
+static void AAPLApplyBrush (std::vector<float>& heights, uint32_t width, uint32_t height,
+                            float brushX, float brushZ, float brushSize, bool lower)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            float worldX = ((float) x / width - 0.5f) * kTerrainScale;
+            float worldZ = ((float) y / width - 0.5f) * kTerrainScale;
+            float displacement = AAPLEvaluateBrush (worldX, worldZ, brushX, brushZ, brushSize) * 0.008f;
+            float& h = heights[(size_t) y * width + x];
+            h = std::min (std::max (h + (lower ? -displacement : displacement), 0.0f), 1.0f);
+        }
+    }
+}
+
+// Returns the failures, reporting the first differing texel of every level of `name`
+static int AAPLCompareLevels (const std::vector<std::vector<float>>& incremental, const std::vector<std::vector<float>>& full,
+                              const char* name, uint32_t width, uint32_t stroke)
+{
+    int failures = 0;
+    for (uint32_t level = 0; level < full.size(); level++)
+    {
+        const std::vector<float>& a = incremental[level];
+        const std::vector<float>& b = full[level];
+        const uint32_t levelWidth = std::max (width >> level, 1u);
+        for (size_t i = 0; i < b.size(); i++)
+        {
+            if (memcmp (&a[i], &b[i], sizeof(float)) != 0)
+            {
+                AAPL_TEST_CHECK (failures, false, "stroke %u: %s level %u texel (%zu, %zu) channel %zu is %g incrementally, %g fully baked",
+                                 stroke, name, level, i / 4 % levelWidth, i / 4 / levelWidth, i % 4, a[i], b[i]);
+                break;
+            }
+        }
+    }
+    return failures;
+}
+
+static int AAPLTestStrokes (uint32_t width, uint32_t height, uint32_t strokeCount, const std::vector<AAPLTerrainBakeSample>& samples)
+{
+    int failures = 0;
+    std::vector<float> heights = AAPLMakeHeights (width, height);
+
+    AAPLTerrainBakedMaps maps (width, height);
+    AAPLBakeTerrainMaps (heights.data(), samples, { 0, 0, width, height }, maps);
+
+    AAPLRandomStream random;
+    AAPLRandomStreamInit (&random, width * 65536 + height, 0);
+
+    double regionTexels = 0.0, incrementalSeconds = 0.0, fullSeconds = 0.0;
+    for (uint32_t stroke = 0; stroke < strokeCount && failures == 0; stroke++)
+    {
+        // Brushes from a few texels wide to a large part of the map, some of them past its edges
+        const float brushX = AAPLRandomNextRange (&random, -0.6f, 0.6f) * kTerrainScale;
+        const float brushZ = AAPLRandomNextRange (&random, -0.6f, 0.6f * height / width) * kTerrainScale;
+        const float brushSize = AAPLRandomNextRange (&random, 1.0f, 25.0f) * kTerrainScale / width;
+        AAPLApplyBrush (heights, width, height, brushX, brushZ, brushSize, AAPLRandomNextBelow (&random, 2) != 0);
+
+        const AAPLTerrainBakeRegion region = AAPLGetTerrainBrushBakeRegion (brushX, brushZ, brushSize, width, height);
+        auto start = std::chrono::steady_clock::now();
+        AAPLBakeTerrainMaps (heights.data(), samples, region, maps);
+        incrementalSeconds += AAPLTestSecondsSince (start);
+        regionTexels += (double) region.width * region.height;
+
+        AAPLTerrainBakedMaps fullMaps (width, height);
+        start = std::chrono::steady_clock::now();
+        AAPLBakeTerrainMaps (heights.data(), samples, { 0, 0, width, height }, fullMaps);
+        fullSeconds += AAPLTestSecondsSince (start);
+
+        failures += AAPLCompareLevels (maps.normalLevels, fullMaps.normalLevels, "normal map", width, stroke);
+        failures += AAPLCompareLevels (maps.propertiesLevels, fullMaps.propertiesLevels, "properties map", width, stroke);
+    }
+
+    printf ("%4u x %-4u %8u %6u %14.0f %12.3f %12.3f\n", width, height, maps.getLevelCount(), strokeCount,
+            regionTexels / strokeCount, incrementalSeconds * 1e3 / strokeCount, fullSeconds * 1e3 / strokeCount);
+    return failures;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t strokeCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 1) : 24;
+
+    // The renderer's occlusion samples
+    const std::vector<AAPLTerrainBakeSample> samples = AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling::Uniform,
+                                                                                            256, 32.0f, 12345);
+
+    printf ("%-11s %8s %6s %14s %12s %12s\n", "map", "levels", "strokes", "texels/stroke", "ms/stroke", "ms/stroke");
+    printf ("%-11s %8s %6s %14s %12s %12s\n", "", "", "", "(rebaked)", "(rebake)", "(full bake)");
+
+    int failures = 0;
+    failures += AAPLTestStrokes (256, 256, strokeCount, samples);
+    failures += AAPLTestStrokes (200, 120, strokeCount, samples);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the AAPLTerrainHeightPyramid against marching rays over the height field.
+ The brute force reference marches along each ray over the bilinear surface of the map, with steps as long as the
+ height of the ray above the surface divided by how fast that height can change, so it can't step over a hit.
+ Several sets of scripted queries run over a procedural heightmap: picking rays from above, steep rays along the
+ map edges, nearly horizontal rays at low altitude, rays entering the map from outside of it or starting below its
+ surface, and line of sight checks between points above it. Reports queries/s of both, and fails when they disagree
+ on a hit or a miss, or when the hit distances differ by more than a millimeter of height error allows: the float
+ heights of the pyramid move a grazing hit much further along the ray than a steep one.
+ Usage: AAPLTerrainHeightPyramidBenchmark [queries per set]
+*/
+
+#include "AAPLRandom.h"
+#include "AAPLTerrainHeightPyramid.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const float    kTerrainScale  = 15000.0f;    // TERRAIN_SCALE
+static const float    kTerrainHeight = 4500.0f;     // TERRAIN_HEIGHT
+static const uint32_t kMapSize       = 1024;
+static const uint32_t kChannelCount  = 2;           // Like the renderer's height readbacks
+static const float    kTexelSize     = kTerrainScale / kMapSize;
+
+// Mountains with sharp ridges, in the first of two channels
+static std::vector<uint16_t> AAPLMakeHeights ()
+{
+    std::vector<uint16_t> heights ((size_t) kMapSize * kMapSize * kChannelCount);
+    for (uint32_t y = 0; y < kMapSize; y++)
+    {
+        for (uint32_t x = 0; x < kMapSize; x++)
+        {
+            float ridge = 1.0f - fabsf (sinf (x * 0.013f + 0.4f * cosf (y * 0.009f)));
+            float h = 0.15f + 0.35f * ridge * ridge + 0.1f * sinf (x * 0.057f) * cosf (y * 0.043f)
+                    + 0.02f * sinf ((x * 7 + y * 3) * 0.31f);
+            size_t texel = ((size_t) y * kMapSize + x) * kChannelCount;
+            heights[texel] = (uint16_t) (std::min (std::max (h, 0.0f), 1.0f) * 65535.0f);
+            heights[texel + 1] = (uint16_t) (x * 13 + y);   // Must be ignored
+        }
+    }
+    return heights;
+}
+
+// Height field marching, independent of the pyramid. Along a ray, its height above the bilinear surface changes by
+//  at most `rate` per unit of distance, from the steepest slope of the map and the ray's own slope, so a step as long
+//  as that height divided by `rate` can't pass a point where the ray reaches the surface. The march stops within
+//  kContact of the surface.
+struct AAPLHeightFieldMarcher
+{
+    static constexpr double kContact = 1e-5;
+
+    const std::vector<uint16_t>&    heights;
+    double                          slope;      // Steepest slope of the surface
+
+    explicit AAPLHeightFieldMarcher (const std::vector<uint16_t>& inHeights) : heights (inHeights), slope (0.0)
+    {
+        // Within a cell, each partial derivative is bounded by the steepest of the differences it blends
+        uint32_t maxDeltaX = 0, maxDeltaY = 0;
+        for (uint32_t y = 0; y < kMapSize; y++)
+        for (uint32_t x = 0; x < kMapSize; x++)
+        {
+            int32_t h = texel (x, y);
+            if (x + 1 < kMapSize) maxDeltaX = std::max (maxDeltaX, (uint32_t) abs (texel (x + 1, y) - h));
+            if (y + 1 < kMapSize) maxDeltaY = std::max (maxDeltaY, (uint32_t) abs (texel (x, y + 1) - h));
+        }
+        const double toWorld = (double) kTerrainHeight / 65535.0 / kTexelSize;
+        slope = sqrt ((double) maxDeltaX * maxDeltaX + (double) maxDeltaY * maxDeltaY) * toWorld;
+    }
+
+    int32_t texel (int64_t x, int64_t y) const
+    {
+        x = std::min (std::max (x, (int64_t) 0), (int64_t) kMapSize - 1);
+        y = std::min (std::max (y, (int64_t) 0), (int64_t) kMapSize - 1);
+        return heights[((size_t) y * kMapSize + x) * kChannelCount];
+    }
+
+    // Bilinear surface height at world (x, z), clamped to the edge texels
+    double surface (double x, double z) const
+    {
+        double tx = (x / kTerrainScale + 0.5) * kMapSize - 0.5;
+        double ty = (z / kTerrainScale + 0.5) * kMapSize - 0.5;
+        double ix = floor (tx), iy = floor (ty);
+        double fx = tx - ix, fy = ty - iy;
+        double top    = texel ((int64_t) ix, (int64_t) iy)     * (1.0 - fx) + texel ((int64_t) ix + 1, (int64_t) iy)     * fx;
+        double bottom = texel ((int64_t) ix, (int64_t) iy + 1) * (1.0 - fx) + texel ((int64_t) ix + 1, (int64_t) iy + 1) * fx;
+        return (top * (1.0 - fy) + bottom * fy) * kTerrainHeight / 65535.0;
+    }
+
+    // How fast the height of the ray above the surface changes at distance t, in meters per meter
+    double getClearanceRate (const float inOrigin[3], const float inDirection[3], double t) const
+    {
+        const double length = sqrt ((double) inDirection[0] * inDirection[0] + (double) inDirection[1] * inDirection[1] +
+                                    (double) inDirection[2] * inDirection[2]);
+        const double step = 1e-3;
+        double before = surface (inOrigin[0] + inDirection[0] / length * (t - step), inOrigin[2] + inDirection[2] / length * (t - step));
+        double after  = surface (inOrigin[0] + inDirection[0] / length * (t + step), inOrigin[2] + inDirection[2] / length * (t + step));
+        return fabs (inDirection[1] / length - (after - before) / (2.0 * step));
+    }
+
+    // First distance within maxDistance where the normalized ray is at or below the surface of the map
+    bool raycast (const float inOrigin[3], const float inDirection[3], float maxDistance, double& outDistance) const
+    {
+        const double length = sqrt ((double) inDirection[0] * inDirection[0] + (double) inDirection[1] * inDirection[1] +
+                                    (double) inDirection[2] * inDirection[2]);
+        const double origin[3] = { inOrigin[0], inOrigin[1], inOrigin[2] };
+        const double direction[3] = { inDirection[0] / length, inDirection[1] / length, inDirection[2] / length };
+
+        // The part of the ray over the map
+        double tEnter = 0.0, tExit = maxDistance;
+        for (uint32_t axis : { 0u, 2u })
+        {
+            const double half = kTerrainScale * 0.5;
+            if (direction[axis] == 0.0)
+            {
+                if (fabs (origin[axis]) > half)
+                    return false;
+                continue;
+            }
+            double ta = (-half - origin[axis]) / direction[axis], tb = (half - origin[axis]) / direction[axis];
+            tEnter = std::max (tEnter, std::min (ta, tb));
+            tExit = std::min (tExit, std::max (ta, tb));
+        }
+
+        const double rate = slope * sqrt (direction[0] * direction[0] + direction[2] * direction[2]) + fabs (direction[1]);
+        for (double t = tEnter; t <= tExit; )
+        {
+            double clearance = origin[1] + direction[1] * t - surface (origin[0] + direction[0] * t, origin[2] + direction[2] * t);
+            if (clearance <= kContact)
+            {
+                outDistance = t;
+                return true;
+            }
+            t += clearance / rate;
+        }
+        return false;
+    }
+};
+
+struct AAPLQuery
+{
+    float   origin[3];
+    float   direction[3];
+    float   maxDistance;
+};
+
+// A set of queries; `make` writes the next query, with the marcher to place points relative to the surface
+struct AAPLQuerySet
+{
+    const char*     name;
+    bool            lineOfSight;        // Checked with isLineOfSightClear from origin to origin + direction
+    void            (*make) (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& query);
+};
+
+static float AAPLSurfaceHeight (const AAPLHeightFieldMarcher& marcher, float x, float z)
+{
+    return (float) marcher.surface (x, z);
+}
+
+static const AAPLQuerySet kQuerySets[] =
+{
+    // Picking: from high above towards a random point of the map, past it
+    { "picking", false, [] (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          float tx = AAPLRandomNextRange (&random, -0.5f, 0.5f) * kTerrainScale, tz = AAPLRandomNextRange (&random, -0.5f, 0.5f) * kTerrainScale;
+          q.origin[0] = AAPLRandomNextRange (&random, -0.6f, 0.6f) * kTerrainScale;
+          q.origin[1] = AAPLRandomNextRange (&random, 2500.0f, 6000.0f);
+          q.origin[2] = AAPLRandomNextRange (&random, -0.6f, 0.6f) * kTerrainScale;
+          q.direction[0] = tx - q.origin[0];
+          q.direction[1] = AAPLSurfaceHeight (marcher, tx, tz) - q.origin[1];
+          q.direction[2] = tz - q.origin[2];
+          q.maxDistance = 30000.0f;
+      } },
+
+    // Nearly horizontal rays a little above the ground, which graze ridges or fly over them
+    { "low altitude", false, [] (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          q.origin[0] = AAPLRandomNextRange (&random, -0.45f, 0.45f) * kTerrainScale;
+          q.origin[2] = AAPLRandomNextRange (&random, -0.45f, 0.45f) * kTerrainScale;
+          q.origin[1] = AAPLSurfaceHeight (marcher, q.origin[0], q.origin[2]) + AAPLRandomNextRange (&random, 2.0f, 100.0f);
+          float angle = AAPLRandomNextRange (&random, 0.0f, 6.2832f);
+          q.direction[0] = cosf (angle);
+          q.direction[1] = AAPLRandomNextRange (&random, -0.05f, 0.08f);
+          q.direction[2] = sinf (angle);
+          q.maxDistance = 8000.0f;
+      } },
+
+    // Steep rays along the edges of the map, where the surface is flat from the edge texel centers outwards
+    { "map edges", false, [] (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          float along = AAPLRandomNextRange (&random, -0.5f, 0.5f) * kTerrainScale;
+          float across = (0.5f - AAPLRandomNextRange (&random, 0.0f, 1.5f) / kMapSize) * kTerrainScale;
+          float tx = AAPLRandomNextBelow (&random, 2) ? along : across, tz = tx == along ? across : along;
+          if (AAPLRandomNextBelow (&random, 2)) { tx = -tx; tz = -tz; }
+          q.origin[0] = tx + AAPLRandomNextRange (&random, -100.0f, 100.0f);
+          q.origin[1] = AAPLSurfaceHeight (marcher, tx, tz) + AAPLRandomNextRange (&random, 50.0f, 500.0f);
+          q.origin[2] = tz + AAPLRandomNextRange (&random, -100.0f, 100.0f);
+          q.direction[0] = tx - q.origin[0];
+          q.direction[1] = AAPLSurfaceHeight (marcher, tx, tz) - q.origin[1];
+          q.direction[2] = tz - q.origin[2];
+          q.maxDistance = 1000.0f;
+      } },
+
+    // From outside of the map, some of them below the height its edge reaches
+    { "entering", false, [] (const AAPLHeightFieldMarcher&, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          float angle = AAPLRandomNextRange (&random, 0.0f, 6.2832f);
+          q.origin[0] = cosf (angle) * kTerrainScale * 0.8f;
+          q.origin[1] = AAPLRandomNextRange (&random, 200.0f, 4000.0f);
+          q.origin[2] = sinf (angle) * kTerrainScale * 0.8f;
+          q.direction[0] = AAPLRandomNextRange (&random, -0.3f, 0.3f) * kTerrainScale - q.origin[0];
+          q.direction[1] = AAPLRandomNextRange (&random, -3000.0f, 500.0f);
+          q.direction[2] = AAPLRandomNextRange (&random, -0.3f, 0.3f) * kTerrainScale - q.origin[2];
+          q.maxDistance = 25000.0f;
+      } },
+
+    // Starting below the surface: hits where the ray starts
+    { "underground", false, [] (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          q.origin[0] = AAPLRandomNextRange (&random, -0.49f, 0.49f) * kTerrainScale;
+          q.origin[2] = AAPLRandomNextRange (&random, -0.49f, 0.49f) * kTerrainScale;
+          q.origin[1] = AAPLSurfaceHeight (marcher, q.origin[0], q.origin[2]) - AAPLRandomNextRange (&random, 1.0f, 50.0f);
+          q.direction[0] = AAPLRandomNextRange (&random, -1.0f, 1.0f);
+          q.direction[1] = AAPLRandomNextRange (&random, -1.0f, 1.0f);
+          q.direction[2] = AAPLRandomNextRange (&random, -1.0f, 1.0f);
+          q.maxDistance = 1000.0f;
+      } },
+
+    // Line of sight between points a little above the ground
+    { "line of sight", true, [] (const AAPLHeightFieldMarcher& marcher, AAPLRandomStream& random, AAPLQuery& q)
+      {
+          float to[3];
+          q.origin[0] = AAPLRandomNextRange (&random, -0.45f, 0.45f) * kTerrainScale;
+          q.origin[2] = AAPLRandomNextRange (&random, -0.45f, 0.45f) * kTerrainScale;
+          q.origin[1] = AAPLSurfaceHeight (marcher, q.origin[0], q.origin[2]) + AAPLRandomNextRange (&random, 2.0f, 300.0f);
+          to[0] = q.origin[0] + AAPLRandomNextRange (&random, -2000.0f, 2000.0f);
+          to[2] = q.origin[2] + AAPLRandomNextRange (&random, -2000.0f, 2000.0f);
+          to[1] = AAPLSurfaceHeight (marcher, to[0], to[2]) + AAPLRandomNextRange (&random, 2.0f, 300.0f);
+          for (uint32_t c = 0; c < 3; c++)
+              q.direction[c] = to[c] - q.origin[c];
+          q.maxDistance = sqrtf (q.direction[0] * q.direction[0] + q.direction[1] * q.direction[1] + q.direction[2] * q.direction[2]);
+      } },
+};
+
+int main (int argc, char** argv)
+{
+    const uint32_t queryCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 1) : 2000;
+
+    const std::vector<uint16_t> heights = AAPLMakeHeights();
+    const AAPLTerrainQuadtreeHeights map = { heights.data(), kMapSize, kMapSize, kChannelCount };
+    const AAPLHeightFieldMarcher marcher (heights);
+
+    AAPLTerrainHeightPyramid pyramid (kTerrainScale, kTerrainHeight);
+    auto start = std::chrono::steady_clock::now();
+    pyramid.build (map);
+    const double buildSeconds = AAPLTestSecondsSince (start);
+
+    printf ("%u x %u map, built in %.2f ms, %u queries per set, steepest slope %.2f\n", kMapSize, kMapSize,
+            buildSeconds * 1e3, queryCount, marcher.slope);
+    printf ("%-14s %6s %14s %14s %9s %12s\n", "queries", "hits", "queries/s", "queries/s", "speedup", "max error");
+    printf ("%-14s %6s %14s %14s %9s %12s\n", "", "", "(pyramid)", "(marching)", "", "(m)");
+
+    int failures = 0;
+    for (const AAPLQuerySet& set : kQuerySets)
+    {
+        AAPLRandomStream random;
+        AAPLRandomStreamInit (&random, 2024, (uint64_t) (&set - kQuerySets));
+        std::vector<AAPLQuery> queries (queryCount);
+        for (AAPLQuery& query : queries)
+            set.make (marcher, random, query);
+
+        std::vector<char> hits (queryCount);
+        std::vector<double> distances (queryCount, 0.0);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < queryCount; i++)
+        {
+            const AAPLQuery& q = queries[i];
+            if (set.lineOfSight)
+            {
+                const float to[3] = { q.origin[0] + q.direction[0], q.origin[1] + q.direction[1], q.origin[2] + q.direction[2] };
+                hits[i] = !pyramid.isLineOfSightClear (q.origin, to);
+            }
+            else
+            {
+                AAPLTerrainRayHit hit;
+                hits[i] = pyramid.raycast (q.origin, q.direction, q.maxDistance, &hit);
+                distances[i] = hits[i] ? hit.distance : 0.0;
+            }
+        }
+        const double pyramidSeconds = AAPLTestSecondsSince (start);
+
+        std::vector<char> marchedHits (queryCount);
+        std::vector<double> marchedDistances (queryCount, 0.0);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < queryCount; i++)
+            marchedHits[i] = marcher.raycast (queries[i].origin, queries[i].direction, queries[i].maxDistance, marchedDistances[i]);
+        const double marchSeconds = AAPLTestSecondsSince (start);
+
+        uint32_t hitCount = 0;
+        double maxError = 0.0;
+        for (uint32_t i = 0; i < queryCount; i++)
+        {
+            const AAPLQuery& q = queries[i];
+            AAPL_TEST_CHECK (failures, hits[i] == marchedHits[i], "%s query %u from (%g, %g, %g) along (%g, %g, %g): %s, marching %s",
+                             set.name, i, q.origin[0], q.origin[1], q.origin[2], q.direction[0], q.direction[1], q.direction[2],
+                             hits[i] ? "hit" : "miss", marchedHits[i] ? "hits" : "misses");
+            if (!hits[i] || !marchedHits[i] || set.lineOfSight)
+                continue;
+
+            // The pyramid returns a float distance from float heights; a millimeter of height error moves the hit along
+            //  the ray by a millimeter over how fast the ray closes in on the surface there
+            const double error = fabs (distances[i] - marchedDistances[i]);
+            const double rate = marcher.getClearanceRate (q.origin, q.direction, marchedDistances[i]);
+            AAPL_TEST_CHECK (failures, error <= 1e-3 + 1e-6 * marchedDistances[i] + 1e-3 / std::max (rate, 1e-3),
+                             "%s query %u: hit at %.4f, marching at %.4f", set.name, i, distances[i], marchedDistances[i]);
+            maxError = std::max (maxError, error);
+            hitCount++;
+        }
+        if (set.lineOfSight)
+            hitCount = (uint32_t) std::count (hits.begin(), hits.end(), 1);
+
+        printf ("%-14s %6u %14.0f %14.0f %8.0fx %12.2e\n", set.name, hitCount, queryCount / pyramidSeconds,
+                queryCount / marchSeconds, marchSeconds / pyramidSeconds, maxError);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
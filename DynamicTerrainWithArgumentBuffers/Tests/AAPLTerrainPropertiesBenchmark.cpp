@@ -0,0 +1,149 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of AAPLBakeTerrainPropertiesMap against the scalar AAPLBakeTerrainProperties it must match.
+ Bakes the whole properties map of a procedural RG16 heightmap with the renderer's occlusion samples, serially and
+ on task pools of growing thread counts, and reports texels/s and texels/s per core of each. Fails when a texel
+ of any bake is not the scalar bake rounded to RGBA8Unorm, or when a bake writes its blue or alpha channels.
+ A smaller map with an odd size, flat plateaus at the ends of the unorm range and cliffs between them is checked
+ the same way, with uniform and blue noise samples.
+ Usage: AAPLTerrainPropertiesBenchmark [map size] [repetitions]
+*/
+
+#include "AAPLTaskPool.h"
+#include "AAPLTerrainBake.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const uint32_t kChannelCount = 2;    // The RG16 height map
+static const uint8_t  kUntouched    = 0xA5;
+
+// Rolling hills, or plateaus at 0 and 65535 and cliffs between them when `cliffs` is set
+static std::vector<uint16_t> AAPLMakeHeights (uint32_t width, uint32_t height, bool cliffs)
+{
+    std::vector<uint16_t> heights ((size_t) width * height * kChannelCount);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            float h = 0.5f + 0.3f * sinf (x * 0.021f) * cosf (y * 0.013f) + 0.1f * sinf ((x + 3 * y) * 0.09f);
+            uint16_t value = (uint16_t) (std::min (std::max (h, 0.0f), 1.0f) * 65535.0f);
+            if (cliffs)
+                value = ((x / 40 + y / 24) % 3 == 0) ? 0 : ((x / 40 + y / 24) % 3 == 1) ? 65535 : (uint16_t) (x * 257 + y * 31);
+
+            size_t texel = ((size_t) y * width + x) * kChannelCount;
+            heights[texel] = value;
+            heights[texel + 1] = (uint16_t) (x ^ y);    // Must be ignored
+        }
+    }
+    return heights;
+}
+
+// The scalar bake of the whole map, rounded to RGBA8Unorm like AAPLBakeTerrainPropertiesMap
+static std::vector<uint8_t> AAPLBakeReference (const std::vector<uint16_t>& heights, uint32_t width, uint32_t height,
+                                               const std::vector<AAPLTerrainBakeSample>& samples, double& outSeconds)
+{
+    std::vector<float> normalized ((size_t) width * height);
+    for (size_t i = 0; i < normalized.size(); i++)
+        normalized[i] = (float) heights[i * kChannelCount] / 65535.0f;
+
+    std::vector<float> properties (normalized.size() * 4, 0.0f);
+    auto start = std::chrono::steady_clock::now();
+    AAPLBakeTerrainProperties (normalized.data(), width, height, samples, { 0, 0, width, height }, properties.data());
+    outSeconds = AAPLTestSecondsSince (start);
+
+    std::vector<uint8_t> rounded (properties.size(), kUntouched);
+    for (size_t i = 0; i < normalized.size(); i++)
+    {
+        rounded[i * 4 + 0] = (uint8_t) lrintf (std::min (std::max (properties[i * 4 + 0], 0.0f), 1.0f) * 255.0f);
+        rounded[i * 4 + 1] = (uint8_t) lrintf (std::min (std::max (properties[i * 4 + 1], 0.0f), 1.0f) * 255.0f);
+    }
+    return rounded;
+}
+
+// Bakes with `pool` and checks every texel against `reference`; returns the failures
+static int AAPLCheckBake (const std::vector<uint16_t>& heights, uint32_t width, uint32_t height,
+                          const std::vector<AAPLTerrainBakeSample>& samples, const std::vector<uint8_t>& reference,
+                          AAPLTaskPool* pool, const char* name, double& outSeconds)
+{
+    int failures = 0;
+    std::vector<uint8_t> properties (reference.size(), kUntouched);
+    auto start = std::chrono::steady_clock::now();
+    AAPLBakeTerrainPropertiesMap (heights.data(), width, height, kChannelCount, samples, properties.data(), pool);
+    outSeconds = AAPLTestSecondsSince (start);
+
+    for (size_t i = 0; i < properties.size(); i++)
+    {
+        if (properties[i] != reference[i])
+        {
+            AAPL_TEST_CHECK (failures, false, "%s, %u x %u map: texel (%zu, %zu) channel %zu is %u, the scalar bake gives %u",
+                             name, width, height, i / 4 % width, i / 4 / width, i % 4, properties[i], reference[i]);
+            break;
+        }
+    }
+    return failures;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t mapSize = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 16) : 1024;
+    const int repetitions = argc > 2 ? std::max (atoi (argv[2]), 1) : 5;
+
+    // The renderer's occlusion samples
+    const std::vector<AAPLTerrainBakeSample> samples = AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling::Uniform,
+                                                                                            256, 32.0f, 12345);
+    int failures = 0;
+    double seconds = 0.0;
+
+    // Odd sizes, clamping at every edge and every height the threshold table treats specially
+    const std::vector<AAPLTerrainBakeSample> blueNoiseSamples = AAPLGenerateTerrainOcclusionSamples (AAPLTerrainOcclusionSampling::BlueNoise,
+                                                                                                     64, 32.0f, 7);
+    for (const std::vector<AAPLTerrainBakeSample>* sampleSet : { &samples, &blueNoiseSamples })
+    {
+        AAPLTaskPool pool (3);
+        const std::vector<uint16_t> cliffs = AAPLMakeHeights (301, 157, true);
+        const std::vector<uint8_t> reference = AAPLBakeReference (cliffs, 301, 157, *sampleSet, seconds);
+        failures += AAPLCheckBake (cliffs, 301, 157, *sampleSet, reference, nullptr, "cliffs, serial", seconds);
+        failures += AAPLCheckBake (cliffs, 301, 157, *sampleSet, reference, &pool, "cliffs, 4 threads", seconds);
+    }
+
+    const std::vector<uint16_t> heights = AAPLMakeHeights (mapSize, mapSize, false);
+    const double texels = (double) mapSize * mapSize;
+
+    double referenceSeconds = 0.0;
+    const std::vector<uint8_t> reference = AAPLBakeReference (heights, mapSize, mapSize, samples, referenceSeconds);
+
+    printf ("%u x %u map, %zu occlusion samples, best of %d\n", mapSize, mapSize, samples.size(), repetitions);
+    printf ("%-28s %8s %14s %14s\n", "bake", "threads", "Mtexels/s", "Mtexels/s/core");
+    printf ("%-28s %8u %14.2f %14.2f\n", "AAPLBakeTerrainProperties", 1, texels / 1e6 / referenceSeconds, texels / 1e6 / referenceSeconds);
+
+    double best = 1e30;
+    for (int r = 0; r < repetitions; r++)
+    {
+        failures += AAPLCheckBake (heights, mapSize, mapSize, samples, reference, nullptr, "serial", seconds);
+        best = std::min (best, seconds);
+    }
+    printf ("%-28s %8u %14.2f %14.2f\n", "AAPLBakeTerrainPropertiesMap", 1, texels / 1e6 / best, texels / 1e6 / best);
+
+    const uint32_t hardwareThreads = std::max (std::thread::hardware_concurrency(), 1u);
+    for (uint32_t threads = 2; threads <= std::max (hardwareThreads, 2u); threads *= 2)
+    {
+        AAPLTaskPool pool (threads - 1);
+        char name[32];
+        snprintf (name, sizeof(name), "%u threads", threads);
+
+        best = 1e30;
+        for (int r = 0; r < repetitions; r++)
+        {
+            failures += AAPLCheckBake (heights, mapSize, mapSize, samples, reference, &pool, name, seconds);
+            best = std::min (best, seconds);
+        }
+        printf ("%-28s %8u %14.2f %14.2f\n", "AAPLBakeTerrainPropertiesMap", threads, texels / 1e6 / best,
+                texels / 1e6 / best / std::min (threads, hardwareThreads));
+    }
+
+    return failures == 0 ? 0 : 1;
+}
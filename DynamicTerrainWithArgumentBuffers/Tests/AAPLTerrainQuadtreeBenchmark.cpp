@@ -0,0 +1,331 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the AAPLTerrainQuadtree along scripted camera paths over a procedural heightmap.
+ The cameras use the projection of the sample's main camera. Reports the visible patches and the culling time
+ per frame of every path, with and without horizon culling, and fails when horizon culling shows a patch the
+ frustum alone culls. Then sculpts the heightmap with random brush strokes and refreshes the tree with update after
+ every stroke. Fails when its node bounds or corner heights differ from those of a tree built from scratch on
+ the sculpted map after any stroke, or when their culling results, tessellation factors or stats differ for any
+ frame of any path.
+ Usage: AAPLTerrainQuadtreeBenchmark [frames per path]
+*/
+
+#include "AAPLTerrainQuadtree.h"
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const uint32_t kPatchesPerSide = 32;         // TERRAIN_PATCHES
+static const float    kTerrainScale   = 15000.0f;   // TERRAIN_SCALE
+static const float    kTerrainHeight  = 4500.0f;    // TERRAIN_HEIGHT
+static const uint32_t kMapSize        = 1024;
+static const uint32_t kChannelCount   = 2;          // Like the renderer's height readbacks
+
+// Procedural unorm16 heights: rolling hills with a ridge, in the first of two channels
+static std::vector<uint16_t> AAPLMakeHeights ()
+{
+    std::vector<uint16_t> heights ((size_t) kMapSize * kMapSize * kChannelCount);
+    for (uint32_t y = 0; y < kMapSize; y++)
+    {
+        for (uint32_t x = 0; x < kMapSize; x++)
+        {
+            float h = 0.3f + 0.15f * sinf (x * 0.011f) * cosf (y * 0.017f) + 0.08f * sinf ((x + 2 * y) * 0.041f)
+                    + 0.3f * expf (-fabsf ((float) x - 0.6f * y - 300.0f) * 0.01f);
+            size_t texel = ((size_t) y * kMapSize + x) * kChannelCount;
+            heights[texel] = (uint16_t) (std::min (std::max (h, 0.0f), 1.0f) * 65535.0f);
+            heights[texel + 1] = (uint16_t) (x * 31 + y * 17);   // Must be ignored
+        }
+    }
+    return heights;
+}
+
+// World height at (x, z), bilinear like the terrain's sampler
+static float AAPLSampleHeight (const std::vector<uint16_t>& heights, float x, float z)
+{
+    auto texel = [&heights] (int32_t tx, int32_t ty)
+    {
+        tx = std::min (std::max (tx, 0), (int32_t) kMapSize - 1);
+        ty = std::min (std::max (ty, 0), (int32_t) kMapSize - 1);
+        return (float) heights[((size_t) ty * kMapSize + tx) * kChannelCount];
+    };
+
+    float tx = (x / kTerrainScale + 0.5f) * kMapSize - 0.5f;
+    float ty = (z / kTerrainScale + 0.5f) * kMapSize - 0.5f;
+    int32_t ix = (int32_t) floorf (tx), iy = (int32_t) floorf (ty);
+    float fx = tx - ix, fy = ty - iy;
+    float top    = texel (ix, iy)     * (1.0f - fx) + texel (ix + 1, iy)     * fx;
+    float bottom = texel (ix, iy + 1) * (1.0f - fx) + texel (ix + 1, iy + 1) * fx;
+    return (top * (1.0f - fy) + bottom * fy) * kTerrainHeight / 65535.0f;
+}
+
+// Same matrices and planes as -[AAPLCamera updateUniforms] for a perspective camera with the sample's
+//  60 degree view angle, 16:9 aspect ratio and near and far planes
+static AAPLTerrainQuadtreeView AAPLMakeView (const float eye[3], const float target[3], bool horizonCulling)
+{
+    const float nearPlane = 10.0f, farPlane = 60000.0f, aspectRatio = 16.0f / 9.0f;
+
+    auto normalize = [] (float v[3]) { float l = sqrtf (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); v[0] /= l; v[1] /= l; v[2] /= l; };
+    float z[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    normalize (z);
+    float x[3] = { z[2], 0.0f, -z[0] };     // cross ((0, 1, 0), z)
+    normalize (x);
+    float y[3] = { z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0] };
+
+    // Rows of the view matrix, then of the projection matrix
+    const float view[4][4] =
+    {
+        { x[0], x[1], x[2], -(x[0] * eye[0] + x[1] * eye[1] + x[2] * eye[2]) },
+        { y[0], y[1], y[2], -(y[0] * eye[0] + y[1] * eye[1] + y[2] * eye[2]) },
+        { z[0], z[1], z[2], -(z[0] * eye[0] + z[1] * eye[1] + z[2] * eye[2]) },
+        { 0.0f, 0.0f, 0.0f, 1.0f },
+    };
+    const float ys = 1.0f / tanf (3.14159265f / 6.0f), xs = ys / aspectRatio, zs = farPlane / (farPlane - nearPlane);
+    const float projection[4][4] =
+    {
+        { xs,   0.0f, 0.0f, 0.0f },
+        { 0.0f, ys,   0.0f, 0.0f },
+        { 0.0f, 0.0f, zs,   -nearPlane * zs },
+        { 0.0f, 0.0f, 1.0f, 0.0f },
+    };
+
+    float rows[4][4];
+    for (uint32_t r = 0; r < 4; r++)
+    for (uint32_t c = 0; c < 4; c++)
+        rows[r][c] = projection[r][0] * view[0][c] + projection[r][1] * view[1][c] + projection[r][2] * view[2][c] + projection[r][3] * view[3][c];
+
+    AAPLTerrainQuadtreeView result;
+    for (uint32_t r = 0; r < 4; r++)
+    for (uint32_t c = 0; c < 4; c++)
+        result.viewProjection[c * 4 + r] = rows[r][c];
+
+    // Left, right, up, down, near, far
+    for (uint32_t p = 0; p < 6; p++)
+    {
+        const float sign = (p & 1) ? -1.0f : 1.0f;
+        const float* row = rows[p / 2];
+        float* plane = result.frustumPlanes[p];
+        for (uint32_t c = 0; c < 4; c++)
+            plane[c] = rows[3][c] + sign * row[c];
+        float length = sqrtf (plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (uint32_t c = 0; c < 4; c++)
+            plane[c] /= length;
+    }
+
+    memcpy (result.cameraPosition, eye, sizeof(result.cameraPosition));
+    result.projectionYScale = ys;
+    result.tessellationScale = 25.0f;
+    result.horizonCulling = horizonCulling;
+    return result;
+}
+
+// Camera position and target of a path at time t in [0, 1]
+struct AAPLCameraPath
+{
+    const char*     name;
+    void            (*pose) (const std::vector<uint16_t>& heights, float t, float outEye[3], float outTarget[3]);
+};
+
+static const AAPLCameraPath kPaths[] =
+{
+    // From the application's startup position, descending towards the far corner of the map
+    { "startup flyover", [] (const std::vector<uint16_t>&, float t, float* eye, float* target)
+      {
+          eye[0] = 6183.96f - t * 11000.0f; eye[1] = 2800.0f - t * 1200.0f; eye[2] = 5665.08f - t * 11000.0f;
+          target[0] = eye[0] - 0.56f; target[1] = eye[1] - 0.412f; target[2] = eye[2] - 0.715f;
+      } },
+
+    // Walks across the map a few meters above the ground, where the hills hide most of the terrain
+    { "low altitude walk", [] (const std::vector<uint16_t>& heights, float t, float* eye, float* target)
+      {
+          eye[0] = -6000.0f + t * 12000.0f; eye[2] = 2500.0f * sinf (t * 6.0f);
+          eye[1] = AAPLSampleHeight (heights, eye[0], eye[2]) + 2.0f;
+          target[0] = eye[0] + 1.0f; target[1] = eye[1] - 0.05f; target[2] = eye[2] + 0.4f * cosf (t * 6.0f);
+      } },
+
+    // Circles the map high above it, looking at its center
+    { "high orbit", [] (const std::vector<uint16_t>&, float t, float* eye, float* target)
+      {
+          eye[0] = 9000.0f * cosf (t * 6.2832f); eye[1] = 7000.0f; eye[2] = 9000.0f * sinf (t * 6.2832f);
+          target[0] = 0.0f; target[1] = 0.0f; target[2] = 0.0f;
+      } },
+};
+
+// Raises or lowers a bump with a sharp rim and returns the texels that changed in outRect as [x0, y0, x1, y1).
+//  The rim changes the edge texels too, so an update that misses the patches sharing them has stale bounds.
+static void AAPLSculpt (std::vector<uint16_t>& heights, uint32_t& random, uint32_t outRect[4])
+{
+    auto next = [&random] () { random = random * 1664525u + 1013904223u; return random >> 8; };
+    const int32_t cx = next() % kMapSize, cy = next() % kMapSize, radius = 1 + next() % 60;
+    const float strength = ((next() & 1) ? 1.0f : -1.0f) * (0.05f + (next() % 1000) * 0.0003f);
+
+    outRect[0] = outRect[1] = kMapSize;
+    outRect[2] = outRect[3] = 0;
+    for (int32_t y = std::max (cy - radius, 0); y <= std::min (cy + radius, (int32_t) kMapSize - 1); y++)
+    {
+        for (int32_t x = std::max (cx - radius, 0); x <= std::min (cx + radius, (int32_t) kMapSize - 1); x++)
+        {
+            float d = sqrtf ((float) ((x - cx) * (x - cx) + (y - cy) * (y - cy))) / radius;
+            if (d > 1.0f)
+                continue;
+            uint16_t& h = heights[((size_t) y * kMapSize + x) * kChannelCount];
+            uint16_t value = (uint16_t) (std::min (std::max (h / 65535.0f + strength * (1.0f - 0.5f * d * d), 0.0f), 1.0f) * 65535.0f);
+            if (value == h)
+                continue;
+            h = value;
+            outRect[0] = std::min (outRect[0], (uint32_t) x);
+            outRect[1] = std::min (outRect[1], (uint32_t) y);
+            outRect[2] = std::max (outRect[2], (uint32_t) x + 1);
+            outRect[3] = std::max (outRect[3], (uint32_t) y + 1);
+        }
+    }
+}
+
+// Checks that every node's bounds and every corner height of `quadtree` are those of `rebuilt`, and that the corner
+//  heights are the terrain's heights there
+static int AAPLCompareTrees (const AAPLTerrainQuadtree& quadtree, const AAPLTerrainQuadtree& rebuilt,
+                             const std::vector<uint16_t>& heights, uint32_t stroke)
+{
+    int failures = 0;
+    for (uint32_t level = 0; level < quadtree.getLevelCount(); level++)
+    {
+        const uint32_t side = kPatchesPerSide >> level;
+        for (uint32_t y = 0; y < side; y++)
+        for (uint32_t x = 0; x < side; x++)
+        {
+            float minY, maxY, rebuiltMinY, rebuiltMaxY;
+            quadtree.getNodeBounds (level, x, y, minY, maxY);
+            rebuilt.getNodeBounds (level, x, y, rebuiltMinY, rebuiltMaxY);
+            AAPL_TEST_CHECK (failures, minY == rebuiltMinY && maxY == rebuiltMaxY,
+                             "stroke %u: node (%u, %u) of level %u bounds [%g, %g] after updates, [%g, %g] rebuilt",
+                             stroke, x, y, level, minY, maxY, rebuiltMinY, rebuiltMaxY);
+        }
+    }
+    for (uint32_t y = 0; y <= kPatchesPerSide; y++)
+    for (uint32_t x = 0; x <= kPatchesPerSide; x++)
+    {
+        AAPL_TEST_CHECK (failures, quadtree.getCornerHeight (x, y) == rebuilt.getCornerHeight (x, y),
+                         "stroke %u: corner (%u, %u) is at %g after updates, %g rebuilt", stroke, x, y,
+                         quadtree.getCornerHeight (x, y), rebuilt.getCornerHeight (x, y));
+
+        const float height = AAPLSampleHeight (heights, ((float) x / kPatchesPerSide - 0.5f) * kTerrainScale,
+                                               ((float) y / kPatchesPerSide - 0.5f) * kTerrainScale);
+        AAPL_TEST_CHECK (failures, fabsf (rebuilt.getCornerHeight (x, y) - height) < 0.01f,
+                         "stroke %u: corner (%u, %u) is at %g, the terrain at %g", stroke, x, y, rebuilt.getCornerHeight (x, y), height);
+    }
+    return failures;
+}
+
+int main (int argc, char** argv)
+{
+    const uint32_t frameCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 2) : 600;
+    const uint32_t patchCount = kPatchesPerSide * kPatchesPerSide;
+
+    std::vector<uint16_t> heights = AAPLMakeHeights();
+    AAPLTerrainQuadtreeHeights map = { heights.data(), kMapSize, kMapSize, kChannelCount };
+
+    AAPLTerrainQuadtree quadtree (kPatchesPerSide, kTerrainScale, kTerrainHeight);
+    auto start = std::chrono::steady_clock::now();
+    quadtree.build (map);
+    const double buildSeconds = AAPLTestSecondsSince (start);
+
+    int failures = 0;
+    std::vector<uint32_t> visible (patchCount), frustumVisible (patchCount);
+    std::vector<AAPLTerrainPatchFactors> factors (patchCount), frustumFactors (patchCount);
+
+    printf ("%u x %u patches over a %u x %u map, built in %.3f ms, %u frames per path\n", kPatchesPerSide, kPatchesPerSide,
+            kMapSize, kMapSize, buildSeconds * 1e3, frameCount);
+    printf ("%-18s %9s %9s %9s %9s %9s %11s %11s\n", "path", "visible", "min", "max", "frustum", "horizon", "us/cull", "us/cull");
+    printf ("%-18s %9s %9s %9s %9s %9s %11s %11s\n", "", "(mean)", "", "", "(culled)", "(culled)", "(horizon)", "(frustum)");
+
+    for (const AAPLCameraPath& path : kPaths)
+    {
+        double visibleSum = 0.0, frustumCulledSum = 0.0, horizonCulledSum = 0.0, horizonSeconds = 0.0, frustumSeconds = 0.0;
+        uint32_t visibleMin = patchCount, visibleMax = 0;
+
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            float eye[3], target[3];
+            path.pose (heights, (float) frame / (frameCount - 1), eye, target);
+
+            start = std::chrono::steady_clock::now();
+            uint32_t count = quadtree.cull (AAPLMakeView (eye, target, true), visible.data(), factors.data());
+            horizonSeconds += AAPLTestSecondsSince (start);
+            const AAPLTerrainQuadtreeStats stats = quadtree.getStats();
+
+            start = std::chrono::steady_clock::now();
+            uint32_t frustumCount = quadtree.cull (AAPLMakeView (eye, target, false), frustumVisible.data(), frustumFactors.data());
+            frustumSeconds += AAPLTestSecondsSince (start);
+
+            AAPL_TEST_CHECK (failures, stats.visiblePatches + stats.frustumCulledPatches + stats.horizonCulledPatches == patchCount,
+                             "%s frame %u: the stats don't account for every patch", path.name, frame);
+            AAPL_TEST_CHECK (failures, memcmp (factors.data(), frustumFactors.data(), patchCount * sizeof(AAPLTerrainPatchFactors)) == 0,
+                             "%s frame %u: horizon culling changed the factors", path.name, frame);
+
+            std::vector<bool> inFrustum (patchCount, false);
+            for (uint32_t i = 0; i < frustumCount; i++)
+                inFrustum[frustumVisible[i]] = true;
+            for (uint32_t i = 0; i < count; i++)
+                AAPL_TEST_CHECK (failures, inFrustum[visible[i]], "%s frame %u: patch %u is visible with horizon culling only",
+                                 path.name, frame, visible[i]);
+
+            visibleSum += count;
+            visibleMin = std::min (visibleMin, count);
+            visibleMax = std::max (visibleMax, count);
+            frustumCulledSum += stats.frustumCulledPatches;
+            horizonCulledSum += stats.horizonCulledPatches;
+        }
+
+        printf ("%-18s %9.1f %9u %9u %9.1f %9.1f %11.2f %11.2f\n", path.name, visibleSum / frameCount, visibleMin, visibleMax,
+                frustumCulledSum / frameCount, horizonCulledSum / frameCount, horizonSeconds * 1e6 / frameCount,
+                frustumSeconds * 1e6 / frameCount);
+    }
+
+    // Sculpt, refreshing `quadtree` with the texels each stroke changed, and compare it to a tree rebuilt from the result
+    const uint32_t strokeCount = 400;
+    uint32_t random = 12345;
+    double updateSeconds = 0.0;
+    AAPLTerrainQuadtree rebuilt (kPatchesPerSide, kTerrainScale, kTerrainHeight);
+    for (uint32_t stroke = 0; stroke < strokeCount && failures == 0; stroke++)
+    {
+        uint32_t rect[4];
+        AAPLSculpt (heights, random, rect);
+        start = std::chrono::steady_clock::now();
+        quadtree.update (map, rect[0], rect[1], rect[2], rect[3]);
+        updateSeconds += AAPLTestSecondsSince (start);
+
+        rebuilt.build (map);
+        failures += AAPLCompareTrees (quadtree, rebuilt, heights, stroke);
+    }
+
+    std::vector<uint32_t> rebuiltVisible (patchCount);
+    std::vector<AAPLTerrainPatchFactors> rebuiltFactors (patchCount);
+    uint32_t differingViews = 0;
+    for (const AAPLCameraPath& path : kPaths)
+    {
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            float eye[3], target[3];
+            path.pose (heights, (float) frame / (frameCount - 1), eye, target);
+            const AAPLTerrainQuadtreeView view = AAPLMakeView (eye, target, true);
+
+            uint32_t count = quadtree.cull (view, visible.data(), factors.data());
+            uint32_t rebuiltCount = rebuilt.cull (view, rebuiltVisible.data(), rebuiltFactors.data());
+            const AAPLTerrainQuadtreeStats& stats = quadtree.getStats();
+            const AAPLTerrainQuadtreeStats& rebuiltStats = rebuilt.getStats();
+
+            bool same = count == rebuiltCount && memcmp (visible.data(), rebuiltVisible.data(), count * sizeof(uint32_t)) == 0 &&
+                        memcmp (factors.data(), rebuiltFactors.data(), patchCount * sizeof(AAPLTerrainPatchFactors)) == 0 &&
+                        memcmp (&stats, &rebuiltStats, sizeof(stats)) == 0;
+            if (!same && differingViews++ < 8)
+                fprintf (stderr, "%s frame %u: the updated tree culls differently than a rebuilt one\n", path.name, frame);
+        }
+    }
+    AAPL_TEST_CHECK (failures, differingViews == 0, "%u views differ after %u strokes", differingViews, strokeCount);
+    printf ("%u strokes, %.2f us per update, %u views compared to a rebuilt tree\n", strokeCount, updateSeconds * 1e6 / strokeCount,
+            frameCount * (uint32_t) (sizeof(kPaths) / sizeof(kPaths[0])));
+
+    return failures == 0 ? 0 : 1;
+}
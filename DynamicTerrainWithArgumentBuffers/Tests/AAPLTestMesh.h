@@ -0,0 +1,185 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Helpers shared by the portable mesh tests and benchmarks.
+ AAPLTestVertex has the layout of AAPLObjVertex without its simd dependency, and AAPLLoadTestMesh turns an
+ OBJ file into welded vertices and triangle indices the way AAPLObjLoader does before building its buffers.
+*/
+
+#pragma once
+
+#include "AAPLObjChunkedParser.h"
+#include "AAPLObjParser.h"
+#include "AAPLVertexWelder.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Same layout as AAPLObjVertex: three float3s of 16 bytes each. The fourth lane of each is padding and stays 0
+struct AAPLTestVertex
+{
+    float   position[4];
+    float   normal[4];
+    float   color[4];
+
+    bool operator == (const AAPLTestVertex& o) const
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            if (position[c] != o.position[c] || normal[c] != o.normal[c] || color[c] != o.color[c])
+                return false;
+        }
+        return true;
+    }
+};
+
+static_assert (sizeof(AAPLTestVertex) == 48, "AAPLTestVertex must match the layout of AAPLObjVertex");
+
+template<> struct AAPLVertexWelderTraits<AAPLTestVertex>
+{
+    static uint64_t hash (const AAPLTestVertex& k)
+    {
+        const float values[9] = { k.position[0], k.position[1], k.position[2],
+                                  k.normal[0],   k.normal[1],   k.normal[2],
+                                  k.color[0],    k.color[1],    k.color[2] };
+        return AAPLHashFloats (values, 9);
+    }
+    static bool equal (const AAPLTestVertex& a, const AAPLTestVertex& b) { return a == b; }
+};
+
+struct AAPLTestMesh
+{
+    std::vector<AAPLTestVertex>     vertices;
+    std::vector<uint32_t>           indices;
+};
+
+inline AAPLTestVertex AAPLMakeTestVertex (const AAPLObjFloat3& p, const AAPLObjFloat3& n, const AAPLObjFloat3& c)
+{
+    AAPLTestVertex vertex = {};
+    vertex.position[0] = p.x; vertex.position[1] = p.y; vertex.position[2] = p.z;
+    vertex.normal[0]   = n.x; vertex.normal[1]   = n.y; vertex.normal[2]   = n.z;
+    vertex.color[0]    = c.x; vertex.color[1]    = c.y; vertex.color[2]    = c.z;
+    return vertex;
+}
+
+// Same work as AAPLObjLoaderVisitor: collects the attribute streams and welds the face corners
+struct AAPLTestMeshVisitor
+{
+    AAPLObjAttributeStreams&            streams;
+    AAPLVertexWelder<AAPLTestVertex>&   welder;
+    AAPLTestMesh&                       mesh;
+
+    void position (float x, float y, float z)   { streams.positions.push_back ({x, y, z}); }
+    void texcoord (float x, float y, float z)   { streams.texcoords.push_back ({x, y, z}); }
+    void normal (float x, float y, float z)     { streams.normals.push_back ({x, y, z}); }
+
+    void face (const AAPLObjFaceCorner* corners, uint32_t cornerCount)
+    {
+        uint32_t faceIndices[AAPLObjParser::kMaxFaceCorners];
+        for (uint32_t v = 0; v < cornerCount; v++)
+        {
+            AAPLTestVertex vertex = AAPLMakeTestVertex (streams.positions[corners[v].position],
+                                                        streams.normals[corners[v].normal],
+                                                        streams.texcoords[corners[v].texcoord]);
+            faceIndices[v] = welder.weld (vertex, mesh.vertices);
+        }
+
+        mesh.indices.push_back (faceIndices[0]);
+        mesh.indices.push_back (faceIndices[1]);
+        mesh.indices.push_back (faceIndices[2]);
+        if (cornerCount == 4)
+        {
+            mesh.indices.push_back (faceIndices[0]);
+            mesh.indices.push_back (faceIndices[2]);
+            mesh.indices.push_back (faceIndices[3]);
+        }
+    }
+};
+
+// Parses and welds the OBJ text in [begin, end) with the serial parser
+inline void AAPLParseTestMesh (const char* begin, const char* end, AAPLTestMesh& outMesh)
+{
+    outMesh.vertices.clear();
+    outMesh.indices.clear();
+
+    AAPLObjAttributeStreams streams;
+    AAPLVertexWelder<AAPLTestVertex> welder ((size_t) (end - begin) / kObjBytesPerVertexEstimate);
+    AAPLTestMeshVisitor visitor = { streams, welder, outMesh };
+    AAPLObjParser::parse (begin, end, visitor);
+}
+
+// Parses and welds the OBJ text in [begin, end) with the chunked parser
+inline void AAPLParseTestMeshChunked (const char* begin, const char* end, AAPLTaskPool& pool, AAPLTestMesh& outMesh,
+                                      size_t chunkSize = kObjDefaultChunkSize)
+{
+    outMesh.vertices.clear();
+    outMesh.indices.clear();
+
+    AAPLObjParseChunked<AAPLTestVertex> (begin, end, pool,
+        [] (const AAPLObjAttributeStreams& streams, const AAPLObjFaceCorner& corner)
+        {
+            return AAPLMakeTestVertex (streams.positions[corner.position],
+                                       streams.normals[corner.normal],
+                                       streams.texcoords[corner.texcoord]);
+        },
+        outMesh.vertices, outMesh.indices, chunkSize);
+}
+
+inline bool AAPLLoadTestMesh (const char* path, AAPLTestMesh& outMesh)
+{
+    AAPLMappedFile file (path);
+    if (!file.isValid())
+        return false;
+    AAPLParseTestMesh (file.begin(), file.end(), outMesh);
+    return true;
+}
+
+// Paths of the .obj files shipped in Data/Meshes/Trees, sorted by name
+inline std::vector<std::string> AAPLTreeMeshPaths ()
+{
+    std::vector<std::string> paths;
+    if (DIR* directory = opendir (AAPL_TREE_MESH_DIR))
+    {
+        while (dirent* entry = readdir (directory))
+        {
+            size_t length = strlen (entry->d_name);
+            if (length > 4 && strcmp (entry->d_name + length - 4, ".obj") == 0)
+                paths.push_back (std::string (AAPL_TREE_MESH_DIR) + "/" + entry->d_name);
+        }
+        closedir (directory);
+    }
+    std::sort (paths.begin(), paths.end());
+    return paths;
+}
+
+// File name of a path, for reports
+inline const char* AAPLTestFileName (const std::string& path)
+{
+    size_t slash = path.find_last_of ('/');
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+inline double AAPLTestSecondsSince (std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+}
+
+// Reports a failed check and remembers it in `failures`
+#define AAPL_TEST_CHECK(failures, condition, ...)                                   \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf (stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+            fprintf (stderr, __VA_ARGS__);                                          \
+            fprintf (stderr, "\n");                                                 \
+            (failures)++;                                                           \
+        }                                                                           \
+    } while (0)
@@ -0,0 +1,586 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Regression test of AAPLPlaceVegetation against the rules of the vegetation_instanceGenerate kernel.
+ The reference below is a line for line port of the kernel and of EvaluateTerrainAtLocation: one call per grid
+ thread, in a shuffled thread order, appending to the bins with the same rewinding slot allocation. Both place
+ several frames over a procedural terrain with the sample's rules. The history starts with faded in cells so
+ fade-outs happen, the terrain is edited half way through, and a second run uses bins small enough to overflow.
+ The test fails when a frame's instances or indirect arguments differ, when the fade histories differ, or when
+ an output breaks the rules the kernel enforces by construction.
+ Usage: AAPLVegetationPlacementTest [frames]
+*/
+
+#include "AAPLTestMesh.h"
+#include "AAPLVegetationPlacement.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+namespace
+{
+    // Just enough of Metal's float3 to transliterate the kernel
+    struct float3
+    {
+        float x, y, z;
+    };
+
+    float3 operator + (float3 a, float3 b)  { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    float3 operator - (float3 a)            { return { -a.x, -a.y, -a.z }; }
+    float3 operator * (float3 a, float s)   { return { a.x * s, a.y * s, a.z * s }; }
+    float3 cross (float3 a, float3 b)       { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+    float3 normalize (float3 a)             { return a * (1.0f / sqrtf (a.x * a.x + a.y * a.y + a.z * a.z)); }
+
+    float saturate (float v)                { return std::min (std::max (v, 0.0f), 1.0f); }
+    float step (float edge, float x)        { return x >= edge ? 1.0f : 0.0f; }
+
+    float smoothstep (float edge0, float edge1, float x)
+    {
+        float t = saturate ((x - edge0) / (edge1 - edge0));
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    float fade_in_out (float rangeX, float rangeY, float fadeRangeX, float fadeRangeY, float val)
+    {
+        float fade_in = smoothstep (rangeX, rangeX + (rangeY - rangeX) * fadeRangeX, val);
+        float fade_out = 1 - smoothstep (rangeY - (rangeY - rangeX) * fadeRangeY, rangeY, val);
+        return fade_in * fade_out;
+    }
+
+    float trim (float thld, float value)
+    {
+        float res = std::max (value, step (1.0f - thld, value));
+        res = std::min (value, step (thld, value));
+        return res;
+    }
+
+    uint32_t wang_hash (uint32_t seed)
+    {
+        seed = (seed ^ 61) ^ (seed >> 16);
+        seed *= 9;
+        seed = seed ^ (seed >> 4);
+        seed *= 0x27d4eb2d;
+        seed = seed ^ (seed >> 15);
+        return seed;
+    }
+
+    float boingEase (float f)
+    {
+        return 1.0f - cosf (20.0f * f) * powf (2.0f, f * -12.0f);
+    }
+
+    // sampler (filter::linear, address::clamp_to_edge, coord::normalized)
+    float sample (const AAPLVegetationPlacementImage& image, float u, float v, uint32_t channel)
+    {
+        float x = u * image.width - 0.5f, y = v * image.height - 0.5f;
+        float fx = floorf (x), fy = floorf (y);
+        auto texel = [&] (float i, float j)
+        {
+            int ci = std::min (std::max ((int) i, 0), (int) image.width - 1);
+            int cj = std::min (std::max ((int) j, 0), (int) image.height - 1);
+            return image.data[((size_t) cj * image.width + ci) * image.channelCount + channel];
+        };
+        float top    = texel (fx, fy)     + (texel (fx + 1, fy)     - texel (fx, fy))     * (x - fx);
+        float bottom = texel (fx, fy + 1) + (texel (fx + 1, fy + 1) - texel (fx, fy + 1)) * (x - fx);
+        return top + (bottom - top) * (y - fy);
+    }
+
+    // EvaluateTerrainAtLocation, habitats in TerrainHabitatType order
+    void EvaluateTerrainAtLocation (float u, float v, float3 worldPosition, const AAPLVegetationPlacementSettings& settings,
+                                    const AAPLVegetationPlacementTerrain& terrain, float outHabitat[AAPLVegetationHabitatCount])
+    {
+        // normalMap.sample (sam, uv).xzy * 2 - 1
+        float3 outNormal = normalize ({ sample (terrain.normalMap, u, v, 0) * 2.0f - 1.0f,
+                                        sample (terrain.normalMap, u, v, 2) * 2.0f - 1.0f,
+                                        sample (terrain.normalMap, u, v, 1) * 2.0f - 1.0f });
+
+        float heightVariance = sample (terrain.propertiesMap, u, v, 1);
+        heightVariance = std::max (heightVariance, sample (terrain.propertiesMapLevel1, u, v, 1));
+
+        float elevation = saturate (worldPosition.y / settings.terrainHeight);
+        float slope = saturate (outNormal.y);
+
+        float heightVarianceFade = smoothstep (0.1f, 1, (elevation + 0.09f) * 0.9174f);
+        float snow = saturate (smoothstep (0.2f, 1, elevation) + smoothstep (0.0f, 1.0f, heightVarianceFade * heightVariance * 250.0f));
+        float grass = fade_in_out (0.04f, 0.25f, 0.2f, 0.5f, elevation) * smoothstep (0.0f, 1.0f, saturate (slope * 2.2f - 1.1f));
+        float sand = 1.0f - smoothstep (0.0f, 1.0f, saturate ((elevation - 0.009f) * (1.0f / 0.05f)));
+
+        outHabitat[AAPLVegetationHabitatSnow] = trim (0.002f, snow);
+        float remainder = 1.0f - outHabitat[AAPLVegetationHabitatSnow];
+        outHabitat[AAPLVegetationHabitatSand] = trim (0.002f, sand);
+        outHabitat[AAPLVegetationHabitatGrass] = trim (0.002f, grass);
+        const float grassPlusSand = outHabitat[AAPLVegetationHabitatSand] + outHabitat[AAPLVegetationHabitatGrass];
+        if (grassPlusSand > 1)
+        {
+            outHabitat[AAPLVegetationHabitatSand] /= grassPlusSand;
+            outHabitat[AAPLVegetationHabitatGrass] /= grassPlusSand;
+        }
+        outHabitat[AAPLVegetationHabitatSand] *= remainder;
+        outHabitat[AAPLVegetationHabitatGrass] *= remainder;
+        remainder -= outHabitat[AAPLVegetationHabitatSand];
+        remainder -= outHabitat[AAPLVegetationHabitatGrass];
+        outHabitat[AAPLVegetationHabitatRock] = remainder;
+    }
+
+    // vegetationSpawnInstance; the atomic slot allocation of the kernel is serialized by the caller's thread order
+    void vegetationSpawnInstance (const AAPLVegetationPlacementSettings& settings, const AAPLVegetationPlacementFrame& frame,
+                                  uint32_t populationIndex, const AAPLVegetationPlacementMatrix& worldMatrix,
+                                  float3 center, float radius, AAPLVegetationPlacementOutput& output)
+    {
+        for (uint32_t camera = 0; camera < settings.cameraCount; camera++)
+        {
+            const float (*planes)[4] = frame.cameras[camera].frustumPlanes;
+            bool inside = true;
+            for (uint32_t p = 0; p < 6; p++)
+                inside = inside && planes[p][0] * center.x + planes[p][1] * center.y + planes[p][2] * center.z + planes[p][3] > -radius;
+            if (!inside)
+                continue;
+
+            uint32_t bin = populationIndex + camera * settings.populationCount;
+            uint32_t instance_slot = output.arguments[bin].instanceCount++;
+            if (instance_slot < settings.maxInstanceCount)
+                output.instances[instance_slot + (size_t) bin * settings.maxInstanceCount] = worldMatrix;
+            else
+                output.arguments[bin].instanceCount--;
+        }
+    }
+
+    AAPLVegetationPlacementMatrix makeMatrix (float3 fwd, float3 up, float3 right, float scale, float3 position)
+    {
+        fwd = fwd * scale;
+        up = up * scale;
+        right = right * scale;
+        return { { { fwd.x, fwd.y, fwd.z, 0 }, { up.x, up.y, up.z, 0 }, { right.x, right.y, right.z, 0 },
+                   { position.x, position.y, position.z, 1 } } };
+    }
+
+    // The body of vegetation_instanceGenerate for thread `tid`, after the LOD selection of thread (0, 0)
+    void instanceGenerateThread (uint32_t tidX, uint32_t tidY, const AAPLVegetationPlacementSettings& settings,
+                                 const AAPLVegetationPlacementTerrain& terrain, const AAPLVegetationPlacementFrame& frame,
+                                 std::vector<uint32_t>& history, AAPLVegetationPlacementOutput& output)
+    {
+        uint32_t rnd0 = wang_hash (tidX + tidY * 0xABBA);
+        uint32_t rnd1 = wang_hash (rnd0);
+        float nrnd0 = (rnd0 & 0xFFFF) / 65535.0f;
+        float nrnd1 = (rnd1 & 0xFFFF) / 65535.0f;
+        float vrnd0[2] = { sinf (float (rnd0 % 0xFF)), cosf (float (rnd0 & 0xFF)) };
+        float vrnd1[2] = { sinf (float (rnd1 % 0xFF)), cosf (float (rnd1 & 0xFF)) };
+
+        float u = (vrnd0[0] * .5f + float (tidX)) / (float) settings.gridResolution;
+        float v = (vrnd0[1] * .5f + float (tidY)) / (float) settings.gridResolution;
+
+        float sample_height = sample (terrain.heightMap, u, v, 0);
+        float world_height = sample_height * settings.terrainHeight;
+        float3 world_pos = { (u - 0.5f) * settings.terrainScale, world_height, (v - 0.5f) * settings.terrainScale };
+
+        float habitatPercentages[AAPLVegetationHabitatCount];
+        EvaluateTerrainAtLocation (u, v, world_pos, settings, terrain, habitatPercentages);
+
+        uint32_t pop_idx = settings.populationCount;
+        float population_scale = 1.0f;
+        float s = nrnd1;
+        for (uint32_t h = 0; h < AAPLVegetationHabitatCount; h++)
+        {
+            s -= habitatPercentages[h];
+            if (s < 0)
+            {
+                for (uint32_t r = 0; r < settings.rulesPerHabitat; r++)
+                {
+                    const AAPLVegetationPlacementRule& rule = settings.rules[h * settings.rulesPerHabitat + r];
+                    s += rule.densityInHabitat;
+                    if (s > 0)
+                    {
+                        pop_idx = rule.populationStartIndex + uint32_t ((s / rule.densityInHabitat * float (rule.populationIndexCount)));
+                        population_scale = rule.scale;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        if (pop_idx >= settings.populationCount)
+            return;
+
+        uint32_t history_idx     = tidX + tidY * settings.gridResolution;
+        uint32_t packed_hist     = history[history_idx];
+        uint32_t fade_in_popidx  = (packed_hist & 0x000000FF) >> 0;
+        uint32_t fade_in_frame   = (packed_hist & 0x0000FF00) >> 8;
+        uint32_t fade_out_popidx = (packed_hist & 0x00FF0000) >> 16;
+        uint32_t fade_out_frame  = (packed_hist & 0xFF000000) >> 24;
+
+        if (fade_in_frame < 255) fade_in_frame++;
+        if (fade_out_frame < 255) fade_out_frame++;
+
+        if (fade_in_popidx != pop_idx)
+        {
+            if (fade_in_frame == 255)
+            {
+                fade_out_popidx = pop_idx;
+                fade_out_frame  = 0;
+            }
+            fade_in_popidx = pop_idx;
+            fade_in_frame = 0;
+        }
+
+        packed_hist  = fade_in_popidx;
+        packed_hist |= fade_in_frame << 8;
+        packed_hist |= fade_out_popidx << 16;
+        packed_hist |= fade_out_frame << 24;
+        history[history_idx] = packed_hist;
+
+        float fade_in_seconds  = float (fade_in_frame) / 60;
+        float fade_out_seconds = float (fade_out_frame) / 60;
+        float grow_factor      = boingEase (saturate (fade_in_seconds - nrnd0 * 3.0f));
+
+        float y_s = sample (terrain.heightMap, u, v + 1.0f / settings.terrainScale, 0) * settings.terrainHeight;
+        float y_t = sample (terrain.heightMap, u + 1.0f / settings.terrainScale, v, 0) * settings.terrainHeight;
+        float3 c = -cross (normalize ({ 1, y_s - world_height, 0 }), normalize ({ 0, y_t - world_height, 1 }));
+        float3 terrain_up = { c.z, c.y, c.x };
+
+        float wind_speed = 0.1f + 0.4f * saturate (1.0f + (cosf (frame.gameTime * 0.8f + nrnd1 * 1.0f + world_pos.z * -0.0002f + sinf (world_pos.x * -0.001f))));
+        float windx = (1.0f + 0.2f * sinf (frame.gameTime * 20.0f * (nrnd0 - .5f))) * wind_speed;
+        float windy = (1.0f + 0.2f * cosf (frame.gameTime * 20.0f * (nrnd0 - .5f))) * wind_speed;
+
+        float3 nudge = { vrnd1[0] + windy, 8.0f, vrnd1[1] + windx };
+        float3 up    = normalize (terrain_up + nudge);
+        float3 right = normalize (cross (up, { vrnd0[0], 0, vrnd0[1] }));
+        float3 fwd   = cross (up, right);
+
+        float radius = settings.vegetationScale * 2.0f * population_scale;
+        vegetationSpawnInstance (settings, frame, pop_idx,
+                                 makeMatrix (fwd, up, right, settings.vegetationScale * population_scale * grow_factor, world_pos),
+                                 world_pos, radius, output);
+
+        if (fade_out_frame < 100)
+        {
+            float3 tumble_pos = world_pos + float3 { 0, fade_out_seconds * 4000.0f, 0 };
+            float tumble_scale = saturate (1.0f - fade_out_seconds * 4.0f);
+            vegetationSpawnInstance (settings, frame, fade_out_popidx,
+                                     makeMatrix (fwd, up, right, settings.vegetationScale * tumble_scale, tumble_pos),
+                                     tumble_pos, radius, output);
+        }
+    }
+
+    // The whole dispatch: the indirect reset blit, the LOD selection and every thread in `threadOrder`
+    void instanceGenerate (const AAPLVegetationPlacementSettings& settings, const AAPLVegetationPlacementTerrain& terrain,
+                           const AAPLVegetationPlacementFrame& frame, const std::vector<uint32_t>& threadOrder,
+                           std::vector<uint32_t>& history, AAPLVegetationPlacementOutput& output)
+    {
+        const uint32_t binCount = settings.populationCount * settings.cameraCount;
+        output.instances.assign ((size_t) binCount * settings.maxInstanceCount, AAPLVegetationPlacementMatrix {});
+        output.arguments.resize (binCount);
+        for (uint32_t b = 0; b < binCount; b++)
+        {
+            const AAPLVegetationPlacementLod& lod0 = settings.lods[(b % settings.populationCount) * settings.maxLodCount];
+            output.arguments[b] = { lod0.indexCount, 0, lod0.indexStart, 0, b * settings.maxInstanceCount };
+        }
+
+        for (uint32_t cascade = 0; cascade + 1 < settings.cameraCount; cascade++)
+        {
+            float texelsPerWorldUnit = frame.cameras[1 + cascade].projectionYScale * 0.5f * settings.shadowMapSize;
+            for (uint32_t pop = 0; pop < settings.populationCount; pop++)
+            {
+                uint32_t lod = 0;
+                for (uint32_t l = 1; l < settings.maxLodCount; l++)
+                {
+                    if (settings.lods[pop * settings.maxLodCount + l].worldError * texelsPerWorldUnit <= settings.maxLodTexelError)
+                        lod = l;
+                }
+                uint32_t bin = pop + (1 + cascade) * settings.populationCount;
+                output.arguments[bin].indexStart = settings.lods[pop * settings.maxLodCount + lod].indexStart;
+                output.arguments[bin].indexCount = settings.lods[pop * settings.maxLodCount + lod].indexCount;
+            }
+        }
+
+        for (uint32_t tid : threadOrder)
+            instanceGenerateThread (tid % settings.gridResolution, tid / settings.gridResolution, settings, terrain, frame, history, output);
+    }
+
+    // A height field with sea level sand, grassy slopes, rocky cliffs and snowy peaks, and the maps derived from it
+    struct TestTerrain
+    {
+        uint32_t            size;
+        std::vector<float>  heights, normals, properties, propertiesLevel1;
+
+        TestTerrain (uint32_t inSize, float peakHeight) : size (inSize)
+        {
+            heights.resize ((size_t) size * size);
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    float u = (float) x / size, v = (float) y / size;
+                    float h = 0.35f + 0.25f * sinf (u * 9.0f) * cosf (v * 7.0f) + 0.1f * sinf ((u + v) * 31.0f)
+                            + peakHeight * expf (-((u - 0.7f) * (u - 0.7f) + (v - 0.3f) * (v - 0.3f)) * 40.0f);
+                    heights[y * size + x] = saturate (h);
+                }
+            }
+
+            // Normals of the world space height field, stored xzy in [0, 1] like the normal map
+            const float texelSize = 15000.0f / size;
+            normals.resize ((size_t) size * size * 3);
+            properties.resize ((size_t) size * size * 2);
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    float dx = (height (x + 1, y) - height (x - 1, y)) * 4500.0f / (2.0f * texelSize);
+                    float dz = (height (x, y + 1) - height (x, y - 1)) * 4500.0f / (2.0f * texelSize);
+                    float3 n = normalize ({ -dx, 1.0f, -dz });
+                    float* out = &normals[(y * size + x) * 3];
+                    out[0] = n.x * 0.5f + 0.5f;
+                    out[1] = n.z * 0.5f + 0.5f;
+                    out[2] = n.y * 0.5f + 0.5f;
+
+                    float mean = (height (x - 1, y) + height (x + 1, y) + height (x, y - 1) + height (x, y + 1)) * 0.25f;
+                    properties[(y * size + x) * 2 + 1] = fabsf (height (x, y) - mean);
+                }
+            }
+
+            const uint32_t half = size / 2;
+            propertiesLevel1.resize ((size_t) half * half * 2);
+            for (uint32_t y = 0; y < half; y++)
+            {
+                for (uint32_t x = 0; x < half; x++)
+                {
+                    float sum = 0.0f;
+                    for (uint32_t k = 0; k < 4; k++)
+                        sum += properties[((y * 2 + k / 2) * size + x * 2 + k % 2) * 2 + 1];
+                    propertiesLevel1[(y * half + x) * 2 + 1] = sum * 0.25f;
+                }
+            }
+        }
+
+        float height (uint32_t x, uint32_t y) const
+        {
+            x = std::min (x, size - 1);
+            y = std::min (y, size - 1);
+            return heights[y * size + x];
+        }
+
+        AAPLVegetationPlacementTerrain maps () const
+        {
+            return { { heights.data(), size, size, 1 }, { normals.data(), size, size, 3 },
+                     { properties.data(), size, size, 2 }, { propertiesLevel1.data(), size / 2, size / 2, 2 } };
+        }
+    };
+
+    // The sample's constants and rule table, with made up LODs
+    AAPLVegetationPlacementSettings makeSettings (uint32_t maxInstanceCount)
+    {
+        AAPLVegetationPlacementSettings settings;
+        settings.gridResolution     = 64;
+        settings.populationCount    = 21;
+        settings.cameraCount        = 4;
+        settings.maxInstanceCount   = maxInstanceCount;
+        settings.rulesPerHabitat    = 4;
+        settings.maxLodCount        = 4;
+        settings.vegetationScale    = 200.0f;
+        settings.maxLodTexelError   = 1.0f;
+        settings.shadowMapSize      = 1024.0f;
+        settings.terrainScale       = 15000.0f;
+        settings.terrainHeight      = 4500.0f;
+
+        settings.rules.assign (AAPLVegetationHabitatCount * settings.rulesPerHabitat, { 0.0f, 1.0f, 0, 0 });
+        auto rule = [&] (AAPLVegetationHabitat h, uint32_t r) -> AAPLVegetationPlacementRule& { return settings.rules[h * settings.rulesPerHabitat + r]; };
+        rule (AAPLVegetationHabitatGrass, 0) = { 0.05f, 2.0f, 0, 4 };
+        rule (AAPLVegetationHabitatGrass, 1) = { 0.30f, 1.0f, 4, 4 };
+        rule (AAPLVegetationHabitatGrass, 2) = { 0.35f, 0.7f, 8, 4 };
+        rule (AAPLVegetationHabitatRock, 0)  = { 0.1f, 1.0f, 12, 2 };
+        rule (AAPLVegetationHabitatSnow, 0)  = { 0.9f, 1.0f, 17, 4 };
+        rule (AAPLVegetationHabitatSnow, 1)  = { 0.1f, 1.0f, 12, 2 };
+        rule (AAPLVegetationHabitatSand, 0)  = { 0.2f, 1.0f, 14, 3 };
+        rule (AAPLVegetationHabitatSand, 1)  = { 0.1f, 1.0f, 12, 2 };
+
+        for (uint32_t pop = 0; pop < settings.populationCount; pop++)
+        {
+            for (uint32_t l = 0; l < settings.maxLodCount; l++)
+            {
+                float worldError = l == 0 ? 0.0f : (pop % 3 == 2 && l == 3) ? INFINITY : 0.5f * (float) (1u << l) * (1 + pop % 4);
+                settings.lods.push_back ({ pop * 10000 + l * 1000, 3000u >> l, worldError });
+            }
+        }
+        return settings;
+    }
+
+    // A frustum given by six planes bounding the box [lo, hi], facing inwards
+    AAPLVegetationPlacementCamera makeBoxCamera (const float lo[3], const float hi[3], float projectionYScale)
+    {
+        AAPLVegetationPlacementCamera camera = {};
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            camera.frustumPlanes[axis * 2][axis] = 1.0f;
+            camera.frustumPlanes[axis * 2][3] = -lo[axis];
+            camera.frustumPlanes[axis * 2 + 1][axis] = -1.0f;
+            camera.frustumPlanes[axis * 2 + 1][3] = hi[axis];
+        }
+        camera.projectionYScale = projectionYScale;
+        return camera;
+    }
+
+    // The main camera sees a wedge of the terrain; the cascades are nested boxes of growing size
+    AAPLVegetationPlacementFrame makeFrame (uint32_t frameIndex)
+    {
+        AAPLVegetationPlacementFrame frame;
+        frame.gameTime = frameIndex / 60.0f;
+
+        float yaw = frameIndex * 0.05f;
+        float forward[2] = { cosf (yaw), sinf (yaw) };
+        AAPLVegetationPlacementCamera main = {};
+        const float eye[3] = { -500.0f, 3000.0f, 200.0f };
+        const float sides[4][3] = { { forward[0], 0.0f, forward[1] },                               // Near
+                                    { -forward[0], 0.0f, -forward[1] },                             // Far
+                                    { forward[0] - forward[1], 0.0f, forward[1] + forward[0] },     // Left
+                                    { forward[0] + forward[1], 0.0f, forward[1] - forward[0] } };   // Right
+        const float offsets[4] = { -10.0f, 6000.0f, 0.0f, 0.0f };
+        for (uint32_t p = 0; p < 4; p++)
+        {
+            float length = sqrtf (sides[p][0] * sides[p][0] + sides[p][2] * sides[p][2]);
+            for (uint32_t k = 0; k < 3; k++)
+                main.frustumPlanes[p][k] = sides[p][k] / length;
+            main.frustumPlanes[p][3] = -(main.frustumPlanes[p][0] * eye[0] + main.frustumPlanes[p][2] * eye[2]) + offsets[p];
+        }
+        main.frustumPlanes[4][1] = 1.0f;    main.frustumPlanes[4][3] = 100.0f;
+        main.frustumPlanes[5][1] = -1.0f;   main.frustumPlanes[5][3] = 20000.0f;
+        frame.cameras.push_back (main);
+
+        for (uint32_t cascade = 0; cascade < 3; cascade++)
+        {
+            float extent = 1500.0f * (float) (1u << (cascade * 2));
+            const float lo[3] = { eye[0] - extent, -10000.0f, eye[2] - extent };
+            const float hi[3] = { eye[0] + extent,  10000.0f, eye[2] + extent };
+            frame.cameras.push_back (makeBoxCamera (lo, hi, 1.0f / extent));
+        }
+        return frame;
+    }
+
+    // Checks the rules the kernel enforces by construction on one output
+    int checkRules (const AAPLVegetationPlacementSettings& settings, const AAPLVegetationPlacementFrame& frame,
+                    const AAPLVegetationPlacementOutput& output, uint32_t frameIndex)
+    {
+        int failures = 0;
+        const float texelError = settings.maxLodTexelError;
+        for (uint32_t camera = 0; camera < settings.cameraCount; camera++)
+        {
+            for (uint32_t pop = 0; pop < settings.populationCount; pop++)
+            {
+                const uint32_t bin = pop + camera * settings.populationCount;
+                const AAPLVegetationPlacementArguments& arguments = output.arguments[bin];
+                AAPL_TEST_CHECK (failures, arguments.instanceCount <= settings.maxInstanceCount, "frame %u bin %u overflows", frameIndex, bin);
+                AAPL_TEST_CHECK (failures, arguments.baseInstance == bin * settings.maxInstanceCount && arguments.baseVertex == 0,
+                                 "frame %u bin %u has the wrong base", frameIndex, bin);
+
+                // Main camera bins draw LOD 0; a cascade draws the coarsest LOD within the texel error
+                const AAPLVegetationPlacementLod* lods = &settings.lods[pop * settings.maxLodCount];
+                uint32_t lod = 0;
+                for (uint32_t l = 1; camera > 0 && l < settings.maxLodCount; l++)
+                {
+                    if (lods[l].worldError * frame.cameras[camera].projectionYScale * 0.5f * settings.shadowMapSize <= texelError)
+                        lod = l;
+                }
+                AAPL_TEST_CHECK (failures, arguments.indexStart == lods[lod].indexStart && arguments.indexCount == lods[lod].indexCount,
+                                 "frame %u bin %u draws the wrong LOD", frameIndex, bin);
+
+                // Every instance is inside the camera's frustum, by its bounding sphere, and on the terrain or above it
+                for (uint32_t i = 0; i < std::min (arguments.instanceCount, settings.maxInstanceCount); i++)
+                {
+                    const AAPLVegetationPlacementMatrix& m = output.instances[(size_t) bin * settings.maxInstanceCount + i];
+                    float radius = settings.vegetationScale * 2.0f * 2.0f;
+                    for (uint32_t p = 0; p < 6; p++)
+                    {
+                        const float* plane = frame.cameras[camera].frustumPlanes[p];
+                        float distance = plane[0] * m.columns[3][0] + plane[1] * m.columns[3][1] + plane[2] * m.columns[3][2] + plane[3];
+                        AAPL_TEST_CHECK (failures, distance > -radius, "frame %u bin %u instance %u is outside the frustum", frameIndex, bin, i);
+                    }
+                    // Placement jitters cells by up to half a cell, so instances can stand half a cell past the edge
+                    const float extent = settings.terrainScale * (0.5f + 0.5f / settings.gridResolution);
+                    AAPL_TEST_CHECK (failures, fabsf (m.columns[3][0]) <= extent && fabsf (m.columns[3][2]) <= extent &&
+                                               m.columns[3][1] >= 0.0f && m.columns[3][3] == 1.0f,
+                                     "frame %u bin %u instance %u is off the terrain", frameIndex, bin, i);
+                }
+            }
+        }
+        return failures;
+    }
+}
+
+// Largest matrix component difference between matched instances. Columns are scaled by up to 400 and positions
+//  reach 7500, so this is a few float ulps; it still catches a height sample a texel off
+static const float kTolerance = 2.5e-4f;
+
+int main (int argc, char** argv)
+{
+    const uint32_t frameCount = argc > 1 ? (uint32_t) std::max (atoi (argv[1]), 4) : 120;
+
+    // The peak grows half way through, like a sculpt, so cells change population
+    const TestTerrain terrains[2] = { TestTerrain (256, 0.0f), TestTerrain (256, 0.6f) };
+
+    int failures = 0;
+    printf ("%-10s %8s %10s %10s %10s %12s %10s\n", "bins", "frames", "instances", "fade-outs", "full bins", "max error", "ms/frame");
+
+    // Sample sized bins, then bins small enough that some fill up
+    for (uint32_t maxInstanceCount : { 16u * 1024u, 48u })
+    {
+        AAPLVegetationPlacementSettings settings = makeSettings (maxInstanceCount);
+        const uint32_t cellCount = settings.gridResolution * settings.gridResolution;
+
+        // Start from a session where every other cell has long faded in some population. Cells that now pick
+        //  another one fade it out, which takes 255 frames to happen from an empty history
+        std::vector<uint32_t> history (cellCount, 0);
+        for (uint32_t cell = 0; cell < cellCount; cell += 2)
+            history[cell] = (cell % settings.populationCount) | (255u << 8) | (255u << 24);
+        std::vector<uint32_t> referenceHistory = history;
+        std::vector<uint32_t> threadOrder (cellCount);
+        for (uint32_t t = 0; t < cellCount; t++)
+            threadOrder[t] = t;
+
+        AAPLVegetationPlacementOutput output, reference;
+        size_t instanceCount = 0, fadeOutCount = 0;
+        uint32_t fullBins = 0;
+        float maxError = 0.0f;
+        double seconds = 0.0;
+        uint32_t random = 7;
+
+        for (uint32_t frameIndex = 0; frameIndex < frameCount; frameIndex++)
+        {
+            const AAPLVegetationPlacementTerrain terrain = terrains[frameIndex < frameCount / 2 ? 0 : 1].maps();
+            const AAPLVegetationPlacementFrame frame = makeFrame (frameIndex);
+
+            auto start = std::chrono::steady_clock::now();
+            AAPLPlaceVegetation (settings, terrain, frame, history, output);
+            seconds += AAPLTestSecondsSince (start);
+
+            // GPU threads run in no particular order
+            for (uint32_t t = cellCount - 1; t > 0; t--)
+            {
+                random = random * 1664525u + 1013904223u;
+                std::swap (threadOrder[t], threadOrder[random % (t + 1)]);
+            }
+            instanceGenerate (settings, terrain, frame, threadOrder, referenceHistory, reference);
+
+            AAPLVegetationPlacementDiff diff = AAPLCompareVegetationPlacement (settings, reference, output, kTolerance);
+            AAPL_TEST_CHECK (failures, diff.matches(), "%u bins, frame %u: %u argument mismatches, %u unmatched instances",
+                             maxInstanceCount, frameIndex, diff.argumentMismatches, diff.unmatchedInstances);
+            AAPL_TEST_CHECK (failures, history == referenceHistory, "%u bins, frame %u: the fade history differs", maxInstanceCount, frameIndex);
+            failures += checkRules (settings, frame, output, frameIndex);
+
+            for (const AAPLVegetationPlacementArguments& arguments : output.arguments)
+                instanceCount += arguments.instanceCount;
+            for (uint32_t cell = 0; cell < cellCount; cell++)
+                fadeOutCount += (history[cell] >> 24) == 0;
+            fullBins += diff.skippedBins;
+            maxError = std::max (maxError, diff.maxMatrixError);
+        }
+
+        printf ("%-10u %8u %10zu %10zu %10u %12.2e %10.3f\n", maxInstanceCount, frameCount, instanceCount, fadeOutCount,
+                fullBins, maxError, seconds * 1000.0 / frameCount);
+
+        // The test is only meaningful if some cells faded out and, with small bins, some bins filled up
+        AAPL_TEST_CHECK (failures, fadeOutCount > 0, "%u bins: no cell started a fade-out", maxInstanceCount);
+        AAPL_TEST_CHECK (failures, maxInstanceCount > 1024 || fullBins > 0, "%u bins: no bin filled up", maxInstanceCount);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the compact vertex format on the shipped tree meshes.
+ Every mesh is encoded the way AAPLObjLoader does when compactVertices is set and decoded with the CPU mirrors of
+ the shader unpack functions. Reports the bytes per vertex and the largest position, normal and color errors, and
+ fails when an error exceeds what the quantization step allows.
+*/
+
+#include "AAPLTestMesh.h"
+#include "AAPLVertexQuantization.h"
+
+#include <math.h>
+
+// Same layout as AAPLObjCompactVertex
+struct AAPLTestCompactVertex
+{
+    uint16_t    position[3];
+    int8_t      normal[2];
+    uint8_t     color[4];
+};
+
+static_assert (sizeof(AAPLTestCompactVertex) == 12, "AAPLTestCompactVertex must match the layout of AAPLObjCompactVertex");
+
+// Largest errors between decoded and original vertices
+struct AAPLQuantizationErrors
+{
+    float   position;       // In object space
+    float   positionSteps;  // Relative to the quantization step of each axis; rounding allows 0.5
+    float   normalDegrees;
+    float   color;          // Against the saturated color the fragment shader uses
+};
+
+// Encodes and decodes `vertices` like AAPLCompactObjVertices and the vegetation_vertex_compact unpack functions
+static AAPLQuantizationErrors AAPLMeasureQuantization (const std::vector<AAPLTestVertex>& vertices,
+                                                       std::vector<AAPLTestCompactVertex>& outVertices)
+{
+    float lo[3] = {  INFINITY,  INFINITY,  INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (const AAPLTestVertex& vertex : vertices)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            lo[c] = std::min (lo[c], vertex.position[c]);
+            hi[c] = std::max (hi[c], vertex.position[c]);
+        }
+    }
+    const float offset[3] = { lo[0], lo[1], lo[2] };
+    const float scale[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+
+    AAPLQuantizationErrors errors = {};
+    outVertices.resize (vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        const AAPLTestVertex& in = vertices[v];
+        AAPLTestCompactVertex& out = outVertices[v];
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            out.position[c] = AAPLEncodePositionComponent (in.position[c], offset[c], scale[c]);
+            out.color[c]    = AAPLEncodeUnorm8 (in.color[c]);
+        }
+        out.color[3] = 0;
+        AAPLEncodeOctahedral (in.normal, out.normal);
+
+        float decodedNormal[3];
+        AAPLDecodeOctahedral (out.normal, decodedNormal);
+
+        float length = sqrtf (in.normal[0] * in.normal[0] + in.normal[1] * in.normal[1] + in.normal[2] * in.normal[2]);
+        float dot = 0.0f;
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            float position = AAPLDecodePositionComponent (out.position[c], offset[c], scale[c]);
+            float error = fabsf (position - in.position[c]);
+            errors.position = std::max (errors.position, error);
+            if (scale[c] > 0.0f)
+                errors.positionSteps = std::max (errors.positionSteps, error * 65535.0f / scale[c]);
+
+            float saturated = std::min (std::max (in.color[c], 0.0f), 1.0f);
+            errors.color = std::max (errors.color, fabsf (AAPLDecodeUnorm8 (out.color[c]) - saturated));
+
+            dot += decodedNormal[c] * in.normal[c] / length;
+        }
+        float degrees = acosf (std::min (std::max (dot, -1.0f), 1.0f)) * (float) (180.0 / M_PI);
+        errors.normalDegrees = std::max (errors.normalDegrees, degrees);
+    }
+    return errors;
+}
+
+int main ()
+{
+    std::vector<std::string> paths = AAPLTreeMeshPaths();
+    if (paths.empty())
+    {
+        fprintf (stderr, "No meshes found in %s\n", AAPL_TREE_MESH_DIR);
+        return 1;
+    }
+
+    int failures = 0;
+    size_t totalVertices = 0;
+    AAPLQuantizationErrors worst = {};
+
+    printf ("%-16s %8s %10s %10s %10s %12s %10s\n", "mesh", "vertices", "KB", "KB", "position", "normal", "color");
+    printf ("%-16s %8s %10s %10s %10s %12s %10s\n", "", "", "(float)", "(compact)", "error", "error (deg)", "error");
+
+    for (const std::string& path : paths)
+    {
+        const char* name = AAPLTestFileName (path);
+        AAPLTestMesh mesh;
+        AAPL_TEST_CHECK (failures, AAPLLoadTestMesh (path.c_str(), mesh), "%s", name);
+
+        std::vector<AAPLTestCompactVertex> compact;
+        AAPLQuantizationErrors errors = AAPLMeasureQuantization (mesh.vertices, compact);
+
+        // Rounding to the nearest step allows half a step, plus float rounding in the decode
+        AAPL_TEST_CHECK (failures, errors.positionSteps <= 0.51f, "%s: position error of %.3f steps", name, errors.positionSteps);
+        AAPL_TEST_CHECK (failures, errors.normalDegrees <= 1.0f, "%s: normal error of %.3f degrees", name, errors.normalDegrees);
+        AAPL_TEST_CHECK (failures, errors.color <= 0.5f / 255.0f + 1e-6f, "%s: color error of %g", name, errors.color);
+
+        printf ("%-16s %8zu %10.1f %10.1f %10.2e %12.3f %10.2e\n", name, mesh.vertices.size(),
+                mesh.vertices.size() * sizeof(AAPLTestVertex) / 1024.0, compact.size() * sizeof(AAPLTestCompactVertex) / 1024.0,
+                errors.position, errors.normalDegrees, errors.color);
+
+        totalVertices += mesh.vertices.size();
+        worst.position = std::max (worst.position, errors.position);
+        worst.normalDegrees = std::max (worst.normalDegrees, errors.normalDegrees);
+        worst.color = std::max (worst.color, errors.color);
+    }
+
+    printf ("%-16s %8zu %10.1f %10.1f %10.2e %12.3f %10.2e\n", "all", totalVertices,
+            totalVertices * sizeof(AAPLTestVertex) / 1024.0, totalVertices * sizeof(AAPLTestCompactVertex) / 1024.0,
+            worst.position, worst.normalDegrees, worst.color);
+    printf ("%zu bytes per vertex instead of %zu\n", sizeof(AAPLTestCompactVertex), sizeof(AAPLTestVertex));
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Microbenchmark of AAPLVertexWelder against the std::unordered_map the OBJ loader used before it.
+ Both weld the face corners of the shipped tree meshes and of a synthetic grid where every vertex is shared by four
+ quads. Reports welded corners/s and inserted vertices/s, and the peak RSS each table adds while welding the grid,
+ measured in a forked child per table. Fails if the two tables don't produce the same vertices and indices.
+ Both tables use AAPLHashFloats, so the comparison measures the table layouts and not the hash functions.
+ Usage: AAPLVertexWelderBenchmark [repetitions] [grid size]
+*/
+
+#include "AAPLTestMesh.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+struct AAPLTestVertexHash
+{
+    size_t operator () (const AAPLTestVertex& vertex) const
+    {
+        return (size_t) AAPLVertexWelderTraits<AAPLTestVertex>::hash (vertex);
+    }
+};
+
+// Welds with one node per unique vertex, the way AAPLObjLoader did before AAPLVertexWelder
+struct AAPLUnorderedMapWelder
+{
+    std::unordered_map<AAPLTestVertex, uint32_t, AAPLTestVertexHash> map;
+
+    explicit AAPLUnorderedMapWelder (size_t expectedVertexCount) { map.reserve (expectedVertexCount); }
+
+    uint32_t weld (const AAPLTestVertex& vertex, std::vector<AAPLTestVertex>& vertices)
+    {
+        auto inserted = map.emplace (vertex, (uint32_t) vertices.size());
+        if (inserted.second)
+            vertices.push_back (vertex);
+        return inserted.first->second;
+    }
+};
+
+// Calls `visit` with the four corners of every quad of a `size` x `size` quad grid, in row order.
+// Interior vertices are shared by four quads, about the sharing of a smooth OBJ mesh.
+template <typename TVisit>
+static void AAPLForEachGridCorner (uint32_t size, TVisit visit)
+{
+    static const uint32_t kCorners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    for (uint32_t z = 0; z < size; z++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            for (const uint32_t* corner : kCorners)
+            {
+                AAPLTestVertex vertex = {};
+                vertex.position[0] = (float) (x + corner[0]);
+                vertex.position[1] = sinf ((x + corner[0]) * 0.1f) * cosf ((z + corner[1]) * 0.1f);
+                vertex.position[2] = (float) (z + corner[1]);
+                vertex.normal[1]   = 1.0f;
+                vertex.color[0]    = (float) ((x + corner[0]) & 0xFF) / 255.0f;
+                vertex.color[1]    = 0.5f;
+                vertex.color[2]    = (float) ((z + corner[1]) & 0xFF) / 255.0f;
+                visit (vertex);
+            }
+        }
+    }
+}
+
+template <typename TWelder>
+static void AAPLWeldGrid (uint32_t size, AAPLTestMesh& outMesh)
+{
+    const size_t vertexCount = (size_t) (size + 1) * (size + 1);
+    outMesh.vertices.clear();
+    outMesh.indices.clear();
+    outMesh.vertices.reserve (vertexCount);
+    outMesh.indices.reserve ((size_t) size * size * 4);
+
+    TWelder welder (vertexCount);
+    AAPLForEachGridCorner (size, [&] (const AAPLTestVertex& vertex)
+    {
+        outMesh.indices.push_back (welder.weld (vertex, outMesh.vertices));
+    });
+}
+
+// Baseline for the peak RSS: the output mesh alone
+template <>
+void AAPLWeldGrid<void> (uint32_t size, AAPLTestMesh& outMesh)
+{
+    outMesh.vertices.resize ((size_t) (size + 1) * (size + 1));
+    outMesh.indices.resize ((size_t) size * size * 4);
+}
+
+// Re-welds the corners of `mesh` into `outMesh`
+template <typename TWelder>
+static void AAPLWeldCorners (const AAPLTestMesh& mesh, AAPLTestMesh& outMesh)
+{
+    outMesh.vertices.clear();
+    outMesh.indices.clear();
+    outMesh.vertices.reserve (mesh.vertices.size());
+    outMesh.indices.reserve (mesh.indices.size());
+
+    TWelder welder (mesh.vertices.size());
+    for (uint32_t index : mesh.indices)
+        outMesh.indices.push_back (welder.weld (mesh.vertices[index], outMesh.vertices));
+}
+
+// Peak resident set in KB of a forked child welding a `size` x `size` grid with `TWelder`, or only allocating
+//  the output mesh when `TWelder` is void.
+// A forked child starts out with the pages of its parent, so this must run before the parent allocates much.
+template <typename TWelder>
+static long AAPLChildPeakKilobytes (uint32_t size)
+{
+    fflush (stdout);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        AAPLTestMesh mesh;
+        AAPLWeldGrid<TWelder> (size, mesh);
+        _exit (0);
+    }
+
+    int status = 0;
+    struct rusage usage = {};
+    if (child < 0 || wait4 (child, &status, 0, &usage) != child || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;  // Bytes on macOS
+#else
+    return usage.ru_maxrss;         // KB on Linux
+#endif
+}
+
+int main (int argc, char** argv)
+{
+    const int repetitions = argc > 1 ? std::max (atoi (argv[1]), 1) : 50;
+    const uint32_t gridSize = argc > 2 ? (uint32_t) std::max (atoi (argv[2]), 1) : 1024;
+
+    // The children build the same output mesh, so the difference to the baseline is what the table costs
+    long baseline = AAPLChildPeakKilobytes<void> (gridSize);
+    long welderPeak = AAPLChildPeakKilobytes<AAPLVertexWelder<AAPLTestVertex>> (gridSize);
+    long mapPeak = AAPLChildPeakKilobytes<AAPLUnorderedMapWelder> (gridSize);
+
+    std::vector<std::string> paths = AAPLTreeMeshPaths();
+    if (paths.empty())
+    {
+        fprintf (stderr, "No meshes found in %s\n", AAPL_TREE_MESH_DIR);
+        return 1;
+    }
+
+    int failures = 0;
+    double totalCorners = 0.0, totalVertices = 0.0, totalWelderSeconds = 0.0, totalMapSeconds = 0.0;
+
+    printf ("%-16s %8s %8s %10s %10s %10s %10s\n", "mesh", "corners", "vertices", "Mcorner/s", "Minsert/s", "Mcorner/s", "Minsert/s");
+    printf ("%-16s %8s %8s %21s %21s\n", "", "", "", "(welder)", "(unordered_map)");
+
+    // Welds `mesh` with both tables, checks they agree and prints a row
+    auto measure = [&] (const char* name, const AAPLTestMesh& mesh, int meshRepetitions)
+    {
+        AAPLTestMesh welded, mapped;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < meshRepetitions; r++)
+            AAPLWeldCorners<AAPLVertexWelder<AAPLTestVertex>> (mesh, welded);
+        double welderSeconds = AAPLTestSecondsSince (start) / meshRepetitions;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < meshRepetitions; r++)
+            AAPLWeldCorners<AAPLUnorderedMapWelder> (mesh, mapped);
+        double mapSeconds = AAPLTestSecondsSince (start) / meshRepetitions;
+
+        AAPL_TEST_CHECK (failures, welded.vertices == mesh.vertices && welded.indices == mesh.indices,
+                         "%s: re-welding with AAPLVertexWelder changed the mesh", name);
+        AAPL_TEST_CHECK (failures, mapped.vertices == welded.vertices && mapped.indices == welded.indices,
+                         "%s: std::unordered_map welded differently", name);
+
+        const double corners = mesh.indices.size(), vertices = mesh.vertices.size();
+        printf ("%-16s %8.0f %8.0f %10.1f %10.1f %10.1f %10.1f\n", name, corners, vertices,
+                corners / 1e6 / welderSeconds, vertices / 1e6 / welderSeconds,
+                corners / 1e6 / mapSeconds, vertices / 1e6 / mapSeconds);
+
+        totalCorners += corners;
+        totalVertices += vertices;
+        totalWelderSeconds += welderSeconds;
+        totalMapSeconds += mapSeconds;
+    };
+
+    for (const std::string& path : paths)
+    {
+        AAPLTestMesh mesh;
+        AAPL_TEST_CHECK (failures, AAPLLoadTestMesh (path.c_str(), mesh), "%s", path.c_str());
+        measure (AAPLTestFileName (path), mesh, repetitions);
+    }
+
+    AAPLTestMesh grid;
+    AAPLWeldGrid<AAPLVertexWelder<AAPLTestVertex>> (gridSize, grid);
+    AAPL_TEST_CHECK (failures, grid.vertices.size() == (size_t) (gridSize + 1) * (gridSize + 1),
+                     "the grid welded to %zu vertices", grid.vertices.size());
+    measure ("grid", grid, std::max (repetitions / 10, 1));
+
+    printf ("%-16s %8.0f %8.0f %10.1f %10.1f %10.1f %10.1f\n", "all", totalCorners, totalVertices,
+            totalCorners / 1e6 / totalWelderSeconds, totalVertices / 1e6 / totalWelderSeconds,
+            totalCorners / 1e6 / totalMapSeconds, totalVertices / 1e6 / totalMapSeconds);
+    printf ("%d repetitions, %ux%u grid\n", repetitions, gridSize, gridSize);
+
+    AAPL_TEST_CHECK (failures, baseline >= 0 && welderPeak >= 0 && mapPeak >= 0, "a measuring child failed");
+
+    printf ("peak RSS welding the grid: %ld KB for the mesh, +%ld KB welder, +%ld KB unordered_map\n",
+            baseline, welderPeak - baseline, mapPeak - baseline);
+
+    return failures == 0 ? 0 : 1;
+}
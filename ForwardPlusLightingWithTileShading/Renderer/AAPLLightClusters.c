@@ -0,0 +1,554 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the CPU light cluster builder
+ Testing every light against every tile does not scale to thousands of lights, so the lights are first
+ binned: the planes of the tile columns and rows all go through the eye, and the ones a sphere touches
+ are the ones between its two tangent planes, which have a closed form. The bins are conservative; the
+ lights of a tile's bin then go through the six plane test of cull_lights, written as a branchless loop
+ over the bin so it vectorizes, and the survivors are spread over the slices their depth range covers.
+*/
+
+#include "AAPLLightClusters.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct AAPLLightClusterRow
+{
+    uint32_t *indices;
+    size_t count;
+    size_t capacity;
+};
+
+// Bins are padded by this fraction of a tile on every side, for the rounding of the tangent planes
+static const double kBinPadding = 1.0 / 64.0;
+
+static bool reserve(void **buffer, size_t *capacity, size_t count, size_t elementSize)
+{
+    if(count <= *capacity)
+        return true;
+
+    size_t newCapacity = *capacity ? *capacity : 64;
+    while(newCapacity < count)
+        newCapacity *= 2;
+
+    void *newBuffer = realloc(*buffer, newCapacity * elementSize);
+    if(!newBuffer)
+        return false;
+
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+    return true;
+}
+
+static inline float unprojectDepth(const AAPLLightClusterParams *params, float depth)
+{
+    return params->depthUnproject[1] / (depth - params->depthUnproject[0]);
+}
+
+bool AAPLLightClusterBuilderInit(AAPLLightClusterBuilder *builder, const AAPLLightClusterParams *params)
+{
+    memset(builder, 0, sizeof(*builder));
+    builder->params = *params;
+    builder->tileCountX = (params->width + params->tileWidth - 1) / params->tileWidth;
+    builder->tileCountY = (params->height + params->tileHeight - 1) / params->tileHeight;
+    builder->clusterCount = builder->tileCountX * builder->tileCountY * params->sliceCount;
+    builder->sliceScale = params->sliceCount / logf(params->farPlane / params->nearPlane);
+
+    const size_t tileCount = (size_t)builder->tileCountX * builder->tileCountY;
+    builder->clusterOffsets = calloc(builder->clusterCount, sizeof(uint32_t));
+    builder->clusterCounts = calloc(builder->clusterCount, sizeof(uint32_t));
+    builder->tileMinDepth = calloc(tileCount, sizeof(float));
+    builder->tileMaxDepth = calloc(tileCount, sizeof(float));
+    builder->tileBoundsX = calloc(builder->tileCountX + 1, sizeof(float));
+    builder->tileBoundsY = calloc(builder->tileCountY + 1, sizeof(float));
+    builder->rowOffsets = calloc(builder->tileCountY + 1, sizeof(uint32_t));
+    builder->rows = calloc(builder->tileCountY, sizeof(struct AAPLLightClusterRow));
+
+    if(!builder->clusterOffsets || !builder->clusterCounts || !builder->tileMinDepth || !builder->tileMaxDepth ||
+       !builder->tileBoundsX || !builder->tileBoundsY || !builder->rowOffsets || !builder->rows)
+    {
+        AAPLLightClusterBuilderDestroy(builder);
+        return false;
+    }
+
+    // screen_to_view_at_z1 of the tile corners
+    const float *screenToView = params->screenToViewSpace;
+    for(uint32_t column = 0; column <= builder->tileCountX; column++)
+    {
+        builder->tileBoundsX[column] = (float)(column * params->tileWidth) * screenToView[0] + screenToView[1];
+    }
+    for(uint32_t row = 0; row <= builder->tileCountY; row++)
+    {
+        builder->tileBoundsY[row] = (float)(row * params->tileHeight) * -screenToView[0] - screenToView[2];
+    }
+
+    return true;
+}
+
+void AAPLLightClusterBuilderDestroy(AAPLLightClusterBuilder *builder)
+{
+    if(builder->rows)
+    {
+        for(uint32_t row = 0; row < builder->tileCountY; row++)
+        {
+            free(builder->rows[row].indices);
+        }
+    }
+
+    free(builder->clusterOffsets);
+    free(builder->clusterCounts);
+    free(builder->lightIndices);
+    free(builder->tileMinDepth);
+    free(builder->tileMaxDepth);
+    free(builder->tileBoundsX);
+    free(builder->tileBoundsY);
+    free(builder->rowOffsets);
+    free(builder->rowLights);
+    free(builder->lightColumns);
+    free(builder->lightRows);
+    free(builder->rows);
+    memset(builder, 0, sizeof(*builder));
+}
+
+// The tiles whose planes a sphere may touch along one axis. `center` and `depth` are the sphere's coordinates
+//  along that axis and along z; the boundaries of tile t are at `origin` + t * `step` at z = 1.
+static void tileRange(double center, double depth, double radius, double origin, double step, int32_t tileCount,
+                      int32_t range[2])
+{
+    // The tangent planes through the eye are at the roots of (z^2 - r^2) a^2 - 2 c z a + c^2 - r^2 = 0
+    const double denominator = depth * depth - radius * radius;
+    const double root = radius * sqrt(center * center + denominator);
+    double first = ((center * depth - root) / denominator - origin) / step;
+    double last = ((center * depth + root) / denominator - origin) / step;
+    if(first > last)
+    {
+        double swap = first;
+        first = last;
+        last = swap;
+    }
+
+    first = floor(first - kBinPadding);
+    last = floor(last + kBinPadding);
+    range[0] = first < 0 ? 0 : (int32_t)fmin(first, tileCount);
+    range[1] = last >= tileCount ? tileCount - 1 : (int32_t)fmax(last, -1);
+}
+
+bool AAPLLightClusterBuilderBegin(AAPLLightClusterBuilder *builder, const float *depth, size_t depthRowPitch,
+                                  const float *lights, uint32_t lightCount)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    builder->depth = depth;
+    builder->depthRowPitch = depthRowPitch;
+    builder->lights = lights;
+    builder->lightCount = lightCount;
+
+    if(lightCount > builder->lightCapacity)
+    {
+        int32_t *columns = realloc(builder->lightColumns, 2 * sizeof(int32_t) * lightCount);
+        if(columns)
+            builder->lightColumns = columns;
+        int32_t *rows = realloc(builder->lightRows, 2 * sizeof(int32_t) * lightCount);
+        if(rows)
+            builder->lightRows = rows;
+        if(!columns || !rows)
+            return false;
+        builder->lightCapacity = lightCount;
+    }
+
+    const int32_t tileCountX = (int32_t)builder->tileCountX;
+    const int32_t tileCountY = (int32_t)builder->tileCountY;
+    const double columnStep = (double)params->screenToViewSpace[0] * params->tileWidth;
+    const double rowStep = (double)params->screenToViewSpace[0] * params->tileHeight;
+
+    memset(builder->rowOffsets, 0, (builder->tileCountY + 1) * sizeof(uint32_t));
+
+    for(uint32_t light = 0; light < lightCount; light++)
+    {
+        const double x = lights[4 * light + 0];
+        const double y = lights[4 * light + 1];
+        const double z = lights[4 * light + 2];
+        const double r = lights[4 * light + 3];
+        int32_t *columns = builder->lightColumns + 2 * light;
+        int32_t *rows = builder->lightRows + 2 * light;
+
+        if(z + r < params->nearPlane || z - r > params->farPlane)
+        {
+            // Outside of the depth range of every tile
+            columns[0] = rows[0] = 0;
+            columns[1] = rows[1] = -1;
+            continue;
+        }
+
+        if(z > r * 1.001)
+        {
+            tileRange(x, z, r, params->screenToViewSpace[1], columnStep, tileCountX, columns);
+
+            // Rows go down the screen while view space y goes up
+            tileRange(-y, z, r, params->screenToViewSpace[2], rowStep, tileCountY, rows);
+        }
+        else
+        {
+            // The sphere reaches behind the eye, where its tangent planes stop bounding it
+            columns[0] = rows[0] = 0;
+            columns[1] = tileCountX - 1;
+            rows[1] = tileCountY - 1;
+        }
+
+        if(columns[0] > columns[1])
+            rows[1] = rows[0] - 1;
+
+        for(int32_t row = rows[0]; row <= rows[1]; row++)
+        {
+            builder->rowOffsets[row + 1]++;
+        }
+    }
+
+    for(uint32_t row = 0; row < builder->tileCountY; row++)
+    {
+        builder->rowOffsets[row + 1] += builder->rowOffsets[row];
+    }
+
+    if(!reserve((void **)&builder->rowLights, &builder->rowLightCapacity,
+                builder->rowOffsets[builder->tileCountY], sizeof(uint32_t)))
+        return false;
+
+    // Filled in light order, so every bin lists its lights in ascending order. The cluster counts are only
+    //  written once rows are built, so they hold the fill positions meanwhile.
+    uint32_t *rowFill = builder->clusterCounts;
+    memcpy(rowFill, builder->rowOffsets, builder->tileCountY * sizeof(uint32_t));
+    for(uint32_t light = 0; light < lightCount; light++)
+    {
+        const int32_t *rows = builder->lightRows + 2 * light;
+        for(int32_t row = rows[0]; row <= rows[1]; row++)
+        {
+            builder->rowLights[rowFill[row]++] = light;
+        }
+    }
+
+    return true;
+}
+
+// create_bins: the depth range of the pixels of every tile of a row, unprojected to view space. The pixel
+//  rows are first folded into the range of every pixel column, an elementwise loop that vectorizes.
+static void computeTileDepths(AAPLLightClusterBuilder *builder, uint32_t row, float *restrict columnMin,
+                              float *restrict columnMax)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    const uint32_t width = params->width;
+    const uint32_t yBegin = row * params->tileHeight;
+    const uint32_t yEnd = yBegin + params->tileHeight < params->height ? yBegin + params->tileHeight : params->height;
+
+    memcpy(columnMin, builder->depth + yBegin * builder->depthRowPitch, width * sizeof(float));
+    memcpy(columnMax, columnMin, width * sizeof(float));
+    for(uint32_t y = yBegin + 1; y < yEnd; y++)
+    {
+        // Compares rather than fminf and fmaxf, which must handle NaNs and do not vectorize
+        const float *restrict depthRow = builder->depth + y * builder->depthRowPitch;
+        for(uint32_t x = 0; x < width; x++)
+        {
+            columnMin[x] = depthRow[x] < columnMin[x] ? depthRow[x] : columnMin[x];
+            columnMax[x] = depthRow[x] > columnMax[x] ? depthRow[x] : columnMax[x];
+        }
+    }
+
+    float *minDepth = builder->tileMinDepth + (size_t)row * builder->tileCountX;
+    float *maxDepth = builder->tileMaxDepth + (size_t)row * builder->tileCountX;
+    for(uint32_t tile = 0; tile < builder->tileCountX; tile++)
+    {
+        const uint32_t xBegin = tile * params->tileWidth;
+        const uint32_t xEnd = xBegin + params->tileWidth < width ? xBegin + params->tileWidth : width;
+        float tileMin = columnMin[xBegin];
+        float tileMax = columnMax[xBegin];
+        for(uint32_t x = xBegin + 1; x < xEnd; x++)
+        {
+            tileMin = columnMin[x] < tileMin ? columnMin[x] : tileMin;
+            tileMax = columnMax[x] > tileMax ? columnMax[x] : tileMax;
+        }
+        minDepth[tile] = unprojectDepth(params, tileMin);
+        maxDepth[tile] = unprojectDepth(params, tileMax);
+    }
+}
+
+static inline uint32_t sliceOf(const AAPLLightClusterBuilder *builder, float depth)
+{
+    const float slice = floorf(logf(depth / builder->params.nearPlane) * builder->sliceScale);
+    const float lastSlice = (float)(builder->params.sliceCount - 1);
+    return (uint32_t)fminf(fmaxf(slice, 0.0f), lastSlice);
+}
+
+typedef struct AAPLLightClusterScratch
+{
+    float *x, *y, *z, *radius;
+    uint32_t *index;
+    uint8_t *visible;
+    uint32_t *firstSlice, *lastSlice;
+    uint32_t *sliceOffsets;
+    float *columnMin, *columnMax;
+
+    // Lights of the row binned to its tiles
+    uint32_t *tileOffsets;
+    uint32_t *tileLights;
+    size_t tileLightCapacity;
+} AAPLLightClusterScratch;
+
+// Spreads the lights of a row's bin over the tiles of the row, in light order. Lights outside of the depth
+//  range of the whole row, such as the ones around the eye that every tile column may see, are dropped.
+static bool binRowToTiles(const AAPLLightClusterBuilder *builder, uint32_t row, AAPLLightClusterScratch *scratch)
+{
+    const uint32_t *rowLights = builder->rowLights + builder->rowOffsets[row];
+    const uint32_t rowLightCount = builder->rowOffsets[row + 1] - builder->rowOffsets[row];
+    uint32_t *tileOffsets = scratch->tileOffsets;
+
+    const float *tileMinDepth = builder->tileMinDepth + (size_t)row * builder->tileCountX;
+    const float *tileMaxDepth = builder->tileMaxDepth + (size_t)row * builder->tileCountX;
+    float rowMinDepth = tileMinDepth[0];
+    float rowMaxDepth = tileMaxDepth[0];
+    for(uint32_t column = 1; column < builder->tileCountX; column++)
+    {
+        rowMinDepth = fminf(rowMinDepth, tileMinDepth[column]);
+        rowMaxDepth = fmaxf(rowMaxDepth, tileMaxDepth[column]);
+    }
+
+    // Filtered into the index buffer, which the tiles only use once the row is binned
+    uint32_t *binLights = scratch->index;
+    uint32_t binCount = 0;
+    for(uint32_t i = 0; i < rowLightCount; i++)
+    {
+        const float *light = builder->lights + 4 * rowLights[i];
+        binLights[binCount] = rowLights[i];
+        binCount += (light[2] + light[3] >= rowMinDepth) & (light[2] - light[3] <= rowMaxDepth);
+    }
+
+    memset(tileOffsets, 0, (builder->tileCountX + 1) * sizeof(uint32_t));
+    for(uint32_t i = 0; i < binCount; i++)
+    {
+        const int32_t *columns = builder->lightColumns + 2 * binLights[i];
+        for(int32_t column = columns[0]; column <= columns[1]; column++)
+        {
+            tileOffsets[column + 1]++;
+        }
+    }
+    for(uint32_t column = 0; column < builder->tileCountX; column++)
+    {
+        tileOffsets[column + 1] += tileOffsets[column];
+    }
+
+    if(!reserve((void **)&scratch->tileLights, &scratch->tileLightCapacity,
+                tileOffsets[builder->tileCountX], sizeof(uint32_t)))
+        return false;
+
+    for(uint32_t i = 0; i < binCount; i++)
+    {
+        const int32_t *columns = builder->lightColumns + 2 * binLights[i];
+        for(int32_t column = columns[0]; column <= columns[1]; column++)
+        {
+            scratch->tileLights[tileOffsets[column]++] = binLights[i];
+        }
+    }
+
+    // Filling moved every offset to the start of the next tile
+    memmove(tileOffsets + 1, tileOffsets, builder->tileCountX * sizeof(uint32_t));
+    tileOffsets[0] = 0;
+    return true;
+}
+
+static bool buildTile(AAPLLightClusterBuilder *builder, uint32_t row, uint32_t column,
+                      const AAPLLightClusterScratch *scratch, struct AAPLLightClusterRow *rowLists)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    const uint32_t tile = row * builder->tileCountX + column;
+    const uint32_t sliceCount = params->sliceCount;
+    uint32_t *clusterOffsets = builder->clusterOffsets + (size_t)tile * sliceCount;
+    uint32_t *clusterCounts = builder->clusterCounts + (size_t)tile * sliceCount;
+
+    // Gather the lights binned to this tile
+    const uint32_t *tileLights = scratch->tileLights + scratch->tileOffsets[column];
+    const uint32_t count = scratch->tileOffsets[column + 1] - scratch->tileOffsets[column];
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t light = tileLights[i];
+        scratch->x[i] = builder->lights[4 * light + 0];
+        scratch->y[i] = builder->lights[4 * light + 1];
+        scratch->z[i] = builder->lights[4 * light + 2];
+        scratch->radius[i] = builder->lights[4 * light + 3];
+        scratch->index[i] = light;
+    }
+
+    // The planes of cull_lights; the side ones go through the eye
+    const float minDepthView = builder->tileMinDepth[tile];
+    const float maxDepthView = builder->tileMaxDepth[tile];
+    const float minX = builder->tileBoundsX[column], maxX = builder->tileBoundsX[column + 1];
+    const float minY = builder->tileBoundsY[row], maxY = builder->tileBoundsY[row + 1];
+    const float rightScale = 1.0f / sqrtf(1.0f + maxX * maxX);
+    const float topScale = 1.0f / sqrtf(1.0f + minY * minY);
+    const float leftScale = 1.0f / sqrtf(1.0f + minX * minX);
+    const float bottomScale = 1.0f / sqrtf(1.0f + maxY * maxY);
+
+    const float *restrict x = scratch->x;
+    const float *restrict y = scratch->y;
+    const float *restrict z = scratch->z;
+    const float *restrict radius = scratch->radius;
+    uint8_t *restrict visible = scratch->visible;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const float right = (x[i] - maxX * z[i]) * rightScale;
+        const float top = (y[i] - minY * z[i]) * topScale;
+        const float left = (minX * z[i] - x[i]) * leftScale;
+        const float bottom = (maxY * z[i] - y[i]) * bottomScale;
+        const float nearDistance = minDepthView - z[i];
+        const float farDistance = z[i] - maxDepthView;
+        const float distance = fmaxf(fmaxf(fmaxf(right, top), fmaxf(left, bottom)), fmaxf(nearDistance, farDistance));
+        visible[i] = distance <= radius[i];
+    }
+
+    // Spread the visible lights over the slices between the near and far ends of their sphere
+    memset(clusterCounts, 0, sliceCount * sizeof(uint32_t));
+    uint32_t visibleCount = 0;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(!visible[i])
+            continue;
+
+        const uint32_t firstSlice = sliceOf(builder, fmaxf(z[i] - radius[i], minDepthView));
+        const uint32_t lastSlice = sliceOf(builder, fminf(z[i] + radius[i], maxDepthView));
+        for(uint32_t slice = firstSlice; slice <= lastSlice; slice++)
+        {
+            clusterCounts[slice]++;
+        }
+        scratch->index[visibleCount] = scratch->index[i];
+        scratch->firstSlice[visibleCount] = firstSlice;
+        scratch->lastSlice[visibleCount] = lastSlice;
+        visibleCount++;
+    }
+
+    size_t total = 0;
+    for(uint32_t slice = 0; slice < sliceCount; slice++)
+    {
+        clusterOffsets[slice] = (uint32_t)(rowLists->count + total);
+        scratch->sliceOffsets[slice] = (uint32_t)total;
+        total += clusterCounts[slice];
+    }
+
+    if(!reserve((void **)&rowLists->indices, &rowLists->capacity, rowLists->count + total, sizeof(uint32_t)))
+        return false;
+
+    uint32_t *indices = rowLists->indices + rowLists->count;
+    for(uint32_t i = 0; i < visibleCount; i++)
+    {
+        for(uint32_t slice = scratch->firstSlice[i]; slice <= scratch->lastSlice[i]; slice++)
+        {
+            indices[scratch->sliceOffsets[slice]++] = scratch->index[i];
+        }
+    }
+    rowLists->count += total;
+
+    return true;
+}
+
+bool AAPLLightClusterBuilderBuildRows(AAPLLightClusterBuilder *builder, uint32_t rowBegin, uint32_t rowEnd)
+{
+    uint32_t maxBinCount = 0;
+    for(uint32_t row = rowBegin; row < rowEnd; row++)
+    {
+        const uint32_t binCount = builder->rowOffsets[row + 1] - builder->rowOffsets[row];
+        maxBinCount = binCount > maxBinCount ? binCount : maxBinCount;
+    }
+
+    const size_t capacity = maxBinCount ? maxBinCount : 1;
+    AAPLLightClusterScratch scratch;
+    scratch.x = malloc(capacity * sizeof(float));
+    scratch.y = malloc(capacity * sizeof(float));
+    scratch.z = malloc(capacity * sizeof(float));
+    scratch.radius = malloc(capacity * sizeof(float));
+    scratch.index = malloc(capacity * sizeof(uint32_t));
+    scratch.visible = malloc(capacity);
+    scratch.firstSlice = malloc(capacity * sizeof(uint32_t));
+    scratch.lastSlice = malloc(capacity * sizeof(uint32_t));
+    scratch.sliceOffsets = malloc(builder->params.sliceCount * sizeof(uint32_t));
+    scratch.columnMin = malloc(builder->params.width * sizeof(float));
+    scratch.columnMax = malloc(builder->params.width * sizeof(float));
+    scratch.tileOffsets = malloc((builder->tileCountX + 1) * sizeof(uint32_t));
+    scratch.tileLights = NULL;
+    scratch.tileLightCapacity = 0;
+
+    bool success = scratch.x && scratch.y && scratch.z && scratch.radius && scratch.index && scratch.visible &&
+                   scratch.firstSlice && scratch.lastSlice && scratch.sliceOffsets && scratch.columnMin && scratch.columnMax &&
+                   scratch.tileOffsets;
+
+    for(uint32_t row = rowBegin; row < rowEnd && success; row++)
+    {
+        computeTileDepths(builder, row, scratch.columnMin, scratch.columnMax);
+        success = binRowToTiles(builder, row, &scratch);
+
+        struct AAPLLightClusterRow *rowLists = &builder->rows[row];
+        rowLists->count = 0;
+        for(uint32_t column = 0; column < builder->tileCountX && success; column++)
+        {
+            success = buildTile(builder, row, column, &scratch, rowLists);
+        }
+    }
+
+    free(scratch.x);
+    free(scratch.y);
+    free(scratch.z);
+    free(scratch.radius);
+    free(scratch.index);
+    free(scratch.visible);
+    free(scratch.firstSlice);
+    free(scratch.lastSlice);
+    free(scratch.sliceOffsets);
+    free(scratch.columnMin);
+    free(scratch.columnMax);
+    free(scratch.tileOffsets);
+    free(scratch.tileLights);
+    return success;
+}
+
+bool AAPLLightClusterBuilderEnd(AAPLLightClusterBuilder *builder)
+{
+    size_t total = 0;
+    for(uint32_t row = 0; row < builder->tileCountY; row++)
+    {
+        total += builder->rows[row].count;
+    }
+
+    size_t capacity = builder->lightIndexCount;
+    if(total > capacity)
+    {
+        uint32_t *indices = realloc(builder->lightIndices, total * sizeof(uint32_t));
+        if(!indices)
+            return false;
+        builder->lightIndices = indices;
+    }
+    builder->lightIndexCount = total;
+
+    const size_t clustersPerRow = (size_t)builder->tileCountX * builder->params.sliceCount;
+    size_t rowBase = 0;
+    for(uint32_t row = 0; row < builder->tileCountY; row++)
+    {
+        const struct AAPLLightClusterRow *rowLists = &builder->rows[row];
+        memcpy(builder->lightIndices + rowBase, rowLists->indices, rowLists->count * sizeof(uint32_t));
+
+        uint32_t *clusterOffsets = builder->clusterOffsets + row * clustersPerRow;
+        for(size_t cluster = 0; cluster < clustersPerRow; cluster++)
+        {
+            clusterOffsets[cluster] += (uint32_t)rowBase;
+        }
+        rowBase += rowLists->count;
+    }
+
+    return true;
+}
+
+bool AAPLLightClusterBuilderBuild(AAPLLightClusterBuilder *builder, const float *depth, size_t depthRowPitch,
+                                  const float *lights, uint32_t lightCount)
+{
+    return AAPLLightClusterBuilderBegin(builder, depth, depthRowPitch, lights, lightCount) &&
+           AAPLLightClusterBuilderBuildRows(builder, 0, builder->tileCountY) &&
+           AAPLLightClusterBuilderEnd(builder);
+}
@@ -0,0 +1,108 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for the CPU light cluster builder, a portable counterpart of the create_bins and cull_lights tile
+ shaders for a software fallback and for validating GPU results.
+ The screen is divided into tiles, and the depth range of each tile into slices; every slice of a tile, or
+ cluster, gets the list of lights whose sphere is not separated from it by one of its six planes, the test
+ cull_lights performs per tile. Lists have no size limit and hold light indices in ascending order.
+ Tile rows can be built on separate threads.
+*/
+
+#ifndef AAPLLightClusters_h
+#define AAPLLightClusters_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AAPLLightClusterParams
+{
+    uint32_t width;                 // Size of the depth buffer
+    uint32_t height;
+    uint32_t tileWidth;             // AAPLTileWidth and AAPLTileHeight for the tiles of the GPU
+    uint32_t tileHeight;
+
+    // Depth slices of every tile, spaced exponentially between the near and far planes. With a single slice
+    //  every cluster covers the depth range of its tile, like the tiles of cull_lights.
+    uint32_t sliceCount;
+    float nearPlane;
+    float farPlane;
+
+    // The values of AAPLUniforms
+    float depthUnproject[2];
+    float screenToViewSpace[3];
+} AAPLLightClusterParams;
+
+typedef struct AAPLLightClusterBuilder
+{
+    AAPLLightClusterParams params;
+    uint32_t tileCountX;
+    uint32_t tileCountY;
+    uint32_t clusterCount;          // tileCountX * tileCountY * sliceCount
+
+    // Results. Cluster (x, y, slice) is entry (y * tileCountX + x) * sliceCount + slice. Its lights are
+    //  lightIndices[clusterOffsets[cluster]] to lightIndices[clusterOffsets[cluster] + clusterCounts[cluster] - 1].
+    uint32_t *clusterOffsets;
+    uint32_t *clusterCounts;
+    uint32_t *lightIndices;
+    size_t lightIndexCount;
+
+    // View space depth range of the geometry of every tile, what create_bins computes
+    float *tileMinDepth;
+    float *tileMaxDepth;
+
+    // Inputs of the current build
+    const float *depth;
+    size_t depthRowPitch;
+    const float *lights;
+    uint32_t lightCount;
+
+    // Slice scale, and tile boundaries as view space x and y at z = 1
+    float sliceScale;
+    float *tileBoundsX;
+    float *tileBoundsY;
+
+    // Lights binned to the tile rows their sphere may touch, with the tile columns it may touch
+    uint32_t *rowOffsets;
+    uint32_t *rowLights;
+    size_t rowLightCapacity;
+    int32_t *lightColumns;          // First and last column of every light
+    int32_t *lightRows;             // First and last row of every light
+
+    // Light lists of every tile row, with offsets relative to their row until the build ends
+    struct AAPLLightClusterRow *rows;
+
+    size_t lightCapacity;
+} AAPLLightClusterBuilder;
+
+bool AAPLLightClusterBuilderInit(AAPLLightClusterBuilder *builder, const AAPLLightClusterParams *params);
+
+void AAPLLightClusterBuilderDestroy(AAPLLightClusterBuilder *builder);
+
+/// Starts a build: bins the lights to tiles. `depth` holds the screen space depth of every pixel,
+///   `depthRowPitch` floats apart; `lights` holds the view space position and radius of every light, 4 floats
+///   per light, like the light_positions buffer of the tile shaders. Both must stay valid until the build ends.
+bool AAPLLightClusterBuilderBegin(AAPLLightClusterBuilder *builder, const float *depth, size_t depthRowPitch,
+                                  const float *lights, uint32_t lightCount);
+
+/// Builds the clusters of tile rows [rowBegin, rowEnd). Calls with disjoint rows can run concurrently.
+bool AAPLLightClusterBuilderBuildRows(AAPLLightClusterBuilder *builder, uint32_t rowBegin, uint32_t rowEnd);
+
+/// Gathers the light lists of every row once all rows are built
+bool AAPLLightClusterBuilderEnd(AAPLLightClusterBuilder *builder);
+
+/// Runs a whole build on the calling thread
+bool AAPLLightClusterBuilderBuild(AAPLLightClusterBuilder *builder, const float *depth, size_t depthRowPitch,
+                                  const float *lights, uint32_t lightCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AAPLLightClusters_h */
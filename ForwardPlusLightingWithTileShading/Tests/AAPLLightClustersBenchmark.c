@@ -0,0 +1,562 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark and brute-force check of the CPU light cluster builder at 1080p and 4K, with 1K to 64K lights.
+ The depth buffer is raycast from the sample's camera against a ground plane and a ring of columns, and the
+ lights are placed in the bands populateLights uses, plus a few around the eye. Reports the time of a build on
+ one thread and with the tile rows split over several, with one slice per tile like cull_lights and with 16.
+ Fails when:
+ - the depth range of a tile differs from the range of its pixels,
+ - a list is not in ascending order, or the threaded build differs from the serial one,
+ - a point inside a light's sphere lies in a cluster whose list does not have the light,
+ - or, for up to 4K lights, a cluster misses a light whose sphere overlaps it by a margin in a double
+   precision six plane test of every light against every cluster, or lists one separated from it by that margin.
+ Usage: AAPLLightClustersBenchmark [largest light count] [builds per measurement]
+*/
+
+#include "AAPLLightClusters.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The camera of the sample: AAPLTileWidth and AAPLTileHeight, its field of view and depth range
+static const uint32_t AAPLTileWidth = 16;
+static const uint32_t AAPLTileHeight = 16;
+static const float AAPLFieldOfView = 65.0f * (3.14159265358979323846f / 180.0f);
+static const float AAPLNearPlane = 1.0f;
+static const float AAPLFarPlane = 1500.0f;
+
+/// Largest light count whose clusters are checked against every light
+static const uint32_t AAPLBruteForceLights = 4096;
+
+/// Points of every light's sphere looked up in the clusters
+static const uint32_t AAPLSamplesPerLight = 32;
+
+typedef struct AAPLCamera
+{
+    double eye[3];
+    double right[3];
+    double up[3];
+    double forward[3];
+} AAPLCamera;
+
+typedef struct AAPLBuildTask
+{
+    AAPLLightClusterBuilder *builder;
+    uint32_t rowBegin;
+    uint32_t rowEnd;
+    bool success;
+} AAPLBuildTask;
+
+static double secondsNow(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static uint32_t randomState;
+
+/// random_float of the sample, from a generator that does not depend on the C library
+static float randomFloat(float min, float max)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return min + (max - min) * (float)(randomState >> 8) * (1.0f / 16777216.0f);
+}
+
+static double dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void normalize(double v[3])
+{
+    const double length = sqrt(dot(v, v));
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+}
+
+/// Left-handed look-at, like matrix_look_at_left_hand
+static AAPLCamera makeCamera(void)
+{
+    AAPLCamera camera = { { 0, 260, -700 }, { 0 }, { 0 }, { 0, 120 - 260, 700 } };
+    normalize(camera.forward);
+    const double up[3] = { 0, 1, 0 };
+    camera.right[0] = up[1] * camera.forward[2] - up[2] * camera.forward[1];
+    camera.right[1] = up[2] * camera.forward[0] - up[0] * camera.forward[2];
+    camera.right[2] = up[0] * camera.forward[1] - up[1] * camera.forward[0];
+    normalize(camera.right);
+    camera.up[0] = camera.forward[1] * camera.right[2] - camera.forward[2] * camera.right[1];
+    camera.up[1] = camera.forward[2] * camera.right[0] - camera.forward[0] * camera.right[2];
+    camera.up[2] = camera.forward[0] * camera.right[1] - camera.forward[1] * camera.right[0];
+    return camera;
+}
+
+/// The values updateUniforms computes for a framebuffer of `width` by `height` pixels
+static AAPLLightClusterParams makeParams(uint32_t width, uint32_t height, uint32_t sliceCount)
+{
+    AAPLLightClusterParams params;
+    params.width = width;
+    params.height = height;
+    params.tileWidth = AAPLTileWidth;
+    params.tileHeight = AAPLTileHeight;
+    params.sliceCount = sliceCount;
+    params.nearPlane = AAPLNearPlane;
+    params.farPlane = AAPLFarPlane;
+    params.depthUnproject[0] = AAPLFarPlane / (AAPLFarPlane - AAPLNearPlane);
+    params.depthUnproject[1] = (-AAPLFarPlane * AAPLNearPlane) / (AAPLFarPlane - AAPLNearPlane);
+
+    const float fovScale = tanf(0.5f * AAPLFieldOfView) * 2.0f;
+    const float aspectRatio = (float)width / height;
+    params.screenToViewSpace[0] = fovScale / height;
+    params.screenToViewSpace[1] = -fovScale * 0.5f * aspectRatio;
+    params.screenToViewSpace[2] = -fovScale * 0.5f;
+    return params;
+}
+
+/// Screen space depth of the ground plane and of a ring of columns, or of the far plane where the ray hits nothing
+static float *makeDepth(const AAPLLightClusterParams *params, const AAPLCamera *camera)
+{
+    float *depth = malloc(sizeof(float) * params->width * params->height);
+    if(!depth)
+        return NULL;
+
+    for(uint32_t y = 0; y < params->height; y++)
+    {
+        for(uint32_t x = 0; x < params->width; x++)
+        {
+            // View space direction through the pixel center, with z = 1
+            const double a = (x + 0.5) * params->screenToViewSpace[0] + params->screenToViewSpace[1];
+            const double b = -(y + 0.5) * params->screenToViewSpace[0] - params->screenToViewSpace[2];
+            double direction[3];
+            for(int i = 0; i < 3; i++)
+                direction[i] = a * camera->right[i] + b * camera->up[i] + camera->forward[i];
+
+            double hit = INFINITY;
+            if(direction[1] < 0)
+                hit = -camera->eye[1] / direction[1];
+
+            // Vertical columns of radius 20 on a circle of radius 300, 250 units high
+            for(int column = 0; column < 12; column++)
+            {
+                const double angle = column * (2.0 * 3.14159265358979323846 / 12);
+                const double ox = camera->eye[0] - 300 * sin(angle), oz = camera->eye[2] - 300 * cos(angle);
+                const double qa = direction[0] * direction[0] + direction[2] * direction[2];
+                const double qb = ox * direction[0] + oz * direction[2];
+                const double qc = ox * ox + oz * oz - 20 * 20;
+                const double discriminant = qb * qb - qa * qc;
+                if(discriminant < 0)
+                    continue;
+                const double t = (-qb - sqrt(discriminant)) / qa;
+                const double height = camera->eye[1] + t * direction[1];
+                if(t > 0 && t < hit && height >= 0 && height <= 250)
+                    hit = t;
+            }
+
+            // The view space z of the hit is its ray parameter, since the direction has z = 1
+            float value = 1.0f;
+            if(hit < AAPLFarPlane)
+            {
+                const float z = (float)fmax(hit, AAPLNearPlane);
+                value = params->depthUnproject[0] + params->depthUnproject[1] / z;
+            }
+            depth[(size_t)y * params->width + x] = value;
+        }
+    }
+    return depth;
+}
+
+/// View space position and radius of `count` lights in the bands of populateLights, with one in 16 near the eye
+static float *makeLights(uint32_t count, const AAPLCamera *camera)
+{
+    float *lights = malloc(4 * sizeof(float) * count);
+    if(!lights)
+        return NULL;
+
+    randomState = 0x134e5348;
+    for(uint32_t lightId = 0; lightId < count; lightId++)
+    {
+        float distance, height;
+        if(lightId < count / 4)
+        {
+            distance = randomFloat(140, 260);
+            height = randomFloat(140, 150);
+        }
+        else if(lightId < (count * 3) / 8)
+        {
+            distance = randomFloat(350, 362);
+            height = randomFloat(140, 400);
+        }
+        else if(lightId < (count * 15) / 16)
+        {
+            distance = randomFloat(400, 480);
+            height = randomFloat(68, 80);
+        }
+        else
+        {
+            distance = randomFloat(650, 750);
+            height = randomFloat(200, 320);
+        }
+        const float angle = randomFloat(0, 2.0f * 3.14159265358979323846f);
+        const float radius = randomFloat(25, 35);
+
+        const double world[3] = { distance * sinf(angle) - camera->eye[0], height - camera->eye[1],
+                                  distance * cosf(angle) - camera->eye[2] };
+        lights[4 * lightId + 0] = (float)dot(world, camera->right);
+        lights[4 * lightId + 1] = (float)dot(world, camera->up);
+        lights[4 * lightId + 2] = (float)dot(world, camera->forward);
+        lights[4 * lightId + 3] = radius;
+    }
+    return lights;
+}
+
+static void *buildRows(void *argument)
+{
+    AAPLBuildTask *task = argument;
+    task->success = AAPLLightClusterBuilderBuildRows(task->builder, task->rowBegin, task->rowEnd);
+    return NULL;
+}
+
+/// A build with the tile rows split over `threadCount` threads
+static bool buildThreaded(AAPLLightClusterBuilder *builder, const float *depth, const float *lights, uint32_t lightCount,
+                          uint32_t threadCount)
+{
+    if(!AAPLLightClusterBuilderBegin(builder, depth, builder->params.width, lights, lightCount))
+        return false;
+
+    pthread_t threads[64];
+    AAPLBuildTask tasks[64];
+    bool success = true;
+    for(uint32_t thread = 0; thread < threadCount; thread++)
+    {
+        tasks[thread].builder = builder;
+        tasks[thread].rowBegin = builder->tileCountY * thread / threadCount;
+        tasks[thread].rowEnd = builder->tileCountY * (thread + 1) / threadCount;
+        tasks[thread].success = false;
+        if(pthread_create(&threads[thread], NULL, buildRows, &tasks[thread]) != 0)
+        {
+            threadCount = thread;
+            success = false;
+        }
+    }
+    for(uint32_t thread = 0; thread < threadCount; thread++)
+    {
+        pthread_join(threads[thread], NULL);
+        success &= tasks[thread].success;
+    }
+    return success && AAPLLightClusterBuilderEnd(builder);
+}
+
+/// Slice of view space depth `z`, like sliceOf of the builder but in double precision
+static uint32_t sliceOfDepth(const AAPLLightClusterParams *params, double z)
+{
+    const double slice = floor(log(z / params->nearPlane) / log((double)params->farPlane / params->nearPlane) * params->sliceCount);
+    return (uint32_t)fmin(fmax(slice, 0), params->sliceCount - 1);
+}
+
+static bool clusterHasLight(const AAPLLightClusterBuilder *builder, uint32_t cluster, uint32_t light)
+{
+    const uint32_t *indices = builder->lightIndices + builder->clusterOffsets[cluster];
+    uint32_t low = 0, high = builder->clusterCounts[cluster];
+    while(low < high)
+    {
+        const uint32_t middle = (low + high) / 2;
+        if(indices[middle] < light)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < builder->clusterCounts[cluster] && indices[low] == light;
+}
+
+/// create_bins: the depth range of every tile, from its pixels
+static int checkTileDepths(const AAPLLightClusterBuilder *builder, const float *depth, const char *name)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    int failures = 0;
+    for(uint32_t tile = 0; tile < builder->tileCountX * builder->tileCountY; tile++)
+    {
+        const uint32_t column = tile % builder->tileCountX, row = tile / builder->tileCountX;
+        float minDepth = 1.0f, maxDepth = 0.0f;
+        for(uint32_t y = row * params->tileHeight; y < (row + 1) * params->tileHeight && y < params->height; y++)
+        {
+            for(uint32_t x = column * params->tileWidth; x < (column + 1) * params->tileWidth && x < params->width; x++)
+            {
+                minDepth = fminf(minDepth, depth[(size_t)y * params->width + x]);
+                maxDepth = fmaxf(maxDepth, depth[(size_t)y * params->width + x]);
+            }
+        }
+        const float minView = params->depthUnproject[1] / (minDepth - params->depthUnproject[0]);
+        const float maxView = params->depthUnproject[1] / (maxDepth - params->depthUnproject[0]);
+        if(builder->tileMinDepth[tile] != minView || builder->tileMaxDepth[tile] != maxView)
+        {
+            if(failures++ == 0)
+                fprintf(stderr, "%s: tile (%u, %u) spans depths %f to %f, its pixels %f to %f\n", name, column, row,
+                        builder->tileMinDepth[tile], builder->tileMaxDepth[tile], minView, maxView);
+        }
+    }
+    return failures;
+}
+
+/// Every list is in ascending order, without repeats, inside the index buffer
+static int checkLists(const AAPLLightClusterBuilder *builder, const char *name)
+{
+    int failures = 0;
+    for(uint32_t cluster = 0; cluster < builder->clusterCount; cluster++)
+    {
+        const uint32_t offset = builder->clusterOffsets[cluster], count = builder->clusterCounts[cluster];
+        bool valid = (size_t)offset + count <= builder->lightIndexCount;
+        for(uint32_t i = 0; i < count && valid; i++)
+            valid = builder->lightIndices[offset + i] < builder->lightCount &&
+                    (i == 0 || builder->lightIndices[offset + i] > builder->lightIndices[offset + i - 1]);
+        if(!valid && failures++ == 0)
+            fprintf(stderr, "%s: the list of cluster %u is out of range or out of order\n", name, cluster);
+    }
+    return failures;
+}
+
+/// Looks up points inside every light's sphere: the cluster each falls in must list the light
+static int checkSamples(const AAPLLightClusterBuilder *builder, const char *name)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    int failures = 0;
+    randomState = 0x5eed;
+    for(uint32_t light = 0; light < builder->lightCount; light++)
+    {
+        const float *sphere = builder->lights + 4 * light;
+        for(uint32_t sample = 0; sample < AAPLSamplesPerLight; sample++)
+        {
+            // The ends of the three axes, then points in the sphere, just inside it so rounding keeps them there
+            double offset[3] = { 0, 0, 0 };
+            if(sample < 6)
+            {
+                offset[sample / 2] = sample % 2 ? 1 : -1;
+            }
+            else
+            {
+                for(int i = 0; i < 3; i++)
+                    offset[i] = randomFloat(-1, 1);
+                normalize(offset);
+                const double scale = cbrt(randomFloat(0, 1));
+                for(int i = 0; i < 3; i++)
+                    offset[i] *= scale;
+            }
+            const double x = sphere[0] + 0.999 * sphere[3] * offset[0];
+            const double y = sphere[1] + 0.999 * sphere[3] * offset[1];
+            const double z = sphere[2] + 0.999 * sphere[3] * offset[2];
+            if(z <= 0)
+                continue;
+
+            const double pixelX = (x / z - params->screenToViewSpace[1]) / params->screenToViewSpace[0];
+            const double pixelY = (-y / z - params->screenToViewSpace[2]) / params->screenToViewSpace[0];
+            if(pixelX < 0 || pixelY < 0 || pixelX >= builder->tileCountX * params->tileWidth ||
+               pixelY >= builder->tileCountY * params->tileHeight)
+                continue;
+
+            const uint32_t tile = (uint32_t)pixelY / params->tileHeight * builder->tileCountX + (uint32_t)pixelX / params->tileWidth;
+            if(z < builder->tileMinDepth[tile] || z > builder->tileMaxDepth[tile])
+                continue;
+
+            const uint32_t cluster = tile * params->sliceCount + sliceOfDepth(params, z);
+            if(!clusterHasLight(builder, cluster, light))
+            {
+                if(failures++ == 0)
+                    fprintf(stderr, "%s: light %u is missing from cluster %u, which holds its point (%f, %f, %f)\n",
+                            name, light, cluster, x, y, z);
+            }
+        }
+    }
+    return failures;
+}
+
+/// Tests every light against every cluster with the six planes of cull_lights in double precision. Lights
+///   overlapping a cluster by more than a margin for rounding must be in its list, lights further than the
+///   margin from it must not. The lists of a tile are walked along with the lights, as both are in light order.
+static int checkBruteForce(const AAPLLightClusterBuilder *builder, const char *name)
+{
+    const AAPLLightClusterParams *params = &builder->params;
+    const uint32_t sliceCount = params->sliceCount;
+    double *sliceBounds = malloc((sliceCount + 1) * sizeof(double));
+    uint32_t *cursors = malloc(sliceCount * sizeof(uint32_t));
+
+    // The first and last slices take everything in front of and behind the depth range
+    for(uint32_t slice = 0; slice <= sliceCount; slice++)
+        sliceBounds[slice] = params->nearPlane * exp(log((double)params->farPlane / params->nearPlane) * slice / sliceCount);
+    sliceBounds[0] = -INFINITY;
+    sliceBounds[sliceCount] = INFINITY;
+
+    int failures = 0;
+    for(uint32_t tile = 0; tile < builder->tileCountX * builder->tileCountY; tile++)
+    {
+        const uint32_t column = tile % builder->tileCountX, row = tile / builder->tileCountX;
+        const double minX = builder->tileBoundsX[column], maxX = builder->tileBoundsX[column + 1];
+        const double minY = builder->tileBoundsY[row], maxY = builder->tileBoundsY[row + 1];
+        const double minDepth = builder->tileMinDepth[tile], maxDepth = builder->tileMaxDepth[tile];
+        const uint32_t *offsets = builder->clusterOffsets + (size_t)tile * sliceCount;
+        const uint32_t *counts = builder->clusterCounts + (size_t)tile * sliceCount;
+        memset(cursors, 0, sliceCount * sizeof(uint32_t));
+
+        for(uint32_t light = 0; light < builder->lightCount; light++)
+        {
+            const double x = builder->lights[4 * light + 0], y = builder->lights[4 * light + 1];
+            const double z = builder->lights[4 * light + 2], r = builder->lights[4 * light + 3];
+            const double margin = 1e-4 * (1 + fabs(x) + fabs(y) + fabs(z) + r);
+
+            const double right = (x - maxX * z) / sqrt(1 + maxX * maxX);
+            const double top = (y - minY * z) / sqrt(1 + minY * minY);
+            const double left = (minX * z - x) / sqrt(1 + minX * minX);
+            const double bottom = (maxY * z - y) / sqrt(1 + maxY * maxY);
+            const double side = fmax(fmax(right, top), fmax(left, bottom));
+            const double depthDistance = fmax(minDepth - z, z - maxDepth);
+
+            // Lights separated from the whole tile are checked once a later light or the end of the tile
+            //  shows they were listed
+            if(fmax(side, depthDistance) > r + margin)
+                continue;
+
+            for(uint32_t slice = 0; slice < sliceCount; slice++)
+            {
+                const uint32_t *indices = builder->lightIndices + offsets[slice];
+                while(cursors[slice] < counts[slice] && indices[cursors[slice]] < light)
+                {
+                    if(failures++ == 0)
+                        fprintf(stderr, "%s: cluster (%u, %u, %u) lists light %u, which is separated from it\n",
+                                name, column, row, slice, indices[cursors[slice]]);
+                    cursors[slice]++;
+                }
+                const bool listed = cursors[slice] < counts[slice] && indices[cursors[slice]] == light;
+                cursors[slice] += listed;
+
+                // Where the tile's geometry does not reach the slice, the cluster is empty; within the margin
+                //  rounding decides whether it is
+                const double clusterNear = fmax(minDepth, sliceBounds[slice]);
+                const double clusterFar = fmin(maxDepth, sliceBounds[slice + 1]);
+                const double distance = fmax(side, fmax(clusterNear - z, z - clusterFar));
+                const bool empty = clusterNear > clusterFar + margin;
+                const bool overlaps = !empty && clusterNear < clusterFar - margin && distance < r - margin;
+                const bool separated = empty || distance > r + margin;
+                if((overlaps && !listed) || (separated && listed))
+                {
+                    if(failures++ == 0)
+                        fprintf(stderr, "%s: light %u is %.4f from cluster (%u, %u, %u) with radius %.4f, but is%s listed\n",
+                                name, light, distance, column, row, slice, r, listed ? "" : " not");
+                }
+            }
+        }
+
+        for(uint32_t slice = 0; slice < sliceCount; slice++)
+        {
+            if(cursors[slice] < counts[slice] && failures++ == 0)
+                fprintf(stderr, "%s: cluster (%u, %u, %u) lists light %u, which is separated from it\n", name, column, row,
+                        slice, builder->lightIndices[offsets[slice] + cursors[slice]]);
+        }
+    }
+
+    free(sliceBounds);
+    free(cursors);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t largestCount = argc > 1 && atoi(argv[1]) > 0 ? (uint32_t)atoi(argv[1]) : 65536;
+    const uint32_t repetitions = argc > 2 && atoi(argv[2]) > 0 ? (uint32_t)atoi(argv[2]) : 3;
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    const uint32_t threadCount = processors < 2 ? 2 : (processors > 64 ? 64 : (uint32_t)processors);
+
+    const uint32_t resolutions[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    const uint32_t sliceCounts[] = { 1, 16 };
+    const AAPLCamera camera = makeCamera();
+
+    printf("%u builds per measurement, %u threads\n", repetitions, threadCount);
+    printf("%-11s %7s %8s %12s %14s %14s %14s\n", "resolution", "slices", "lights", "indices", "ms (1 thread)",
+           "ms (threads)", "ms (brute)");
+
+    int failures = 0;
+    for(size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+    {
+        for(size_t s = 0; s < sizeof(sliceCounts) / sizeof(sliceCounts[0]); s++)
+        {
+            const AAPLLightClusterParams params = makeParams(resolutions[r][0], resolutions[r][1], sliceCounts[s]);
+            float *depth = makeDepth(&params, &camera);
+            AAPLLightClusterBuilder builder, threadedBuilder;
+            if(!depth || !AAPLLightClusterBuilderInit(&builder, &params) || !AAPLLightClusterBuilderInit(&threadedBuilder, &params))
+            {
+                fprintf(stderr, "Could not allocate the clusters of %ux%u\n", params.width, params.height);
+                return 1;
+            }
+
+            for(uint32_t lightCount = 1024; lightCount <= largestCount; lightCount *= 4)
+            {
+                char name[64];
+                snprintf(name, sizeof(name), "%ux%u, %u slices, %u lights", params.width, params.height,
+                         params.sliceCount, lightCount);
+
+                float *lights = makeLights(lightCount, &camera);
+                if(!lights)
+                {
+                    fprintf(stderr, "%s: could not allocate the lights\n", name);
+                    return 1;
+                }
+
+                double start = secondsNow();
+                bool built = true;
+                for(uint32_t repetition = 0; repetition < repetitions; repetition++)
+                    built &= AAPLLightClusterBuilderBuild(&builder, depth, params.width, lights, lightCount);
+                const double serialSeconds = (secondsNow() - start) / repetitions;
+
+                start = secondsNow();
+                for(uint32_t repetition = 0; repetition < repetitions; repetition++)
+                    built &= buildThreaded(&threadedBuilder, depth, lights, lightCount, threadCount);
+                const double threadedSeconds = (secondsNow() - start) / repetitions;
+
+                if(!built)
+                {
+                    fprintf(stderr, "%s: a build failed\n", name);
+                    return 1;
+                }
+
+                failures += checkTileDepths(&builder, depth, name);
+                failures += checkLists(&builder, name);
+                failures += checkSamples(&builder, name);
+                if(threadedBuilder.lightIndexCount != builder.lightIndexCount ||
+                   memcmp(threadedBuilder.clusterOffsets, builder.clusterOffsets, builder.clusterCount * sizeof(uint32_t)) ||
+                   memcmp(threadedBuilder.clusterCounts, builder.clusterCounts, builder.clusterCount * sizeof(uint32_t)) ||
+                   memcmp(threadedBuilder.lightIndices, builder.lightIndices, builder.lightIndexCount * sizeof(uint32_t)))
+                {
+                    fprintf(stderr, "%s: the build on %u threads differs from the serial build\n", name, threadCount);
+                    failures++;
+                }
+
+                char bruteTime[16] = "-";
+                if(lightCount <= AAPLBruteForceLights)
+                {
+                    start = secondsNow();
+                    failures += checkBruteForce(&builder, name);
+                    snprintf(bruteTime, sizeof(bruteTime), "%.2f", (secondsNow() - start) * 1e3);
+                }
+
+                printf("%4ux%-6u %7u %8u %12zu %14.2f %14.2f %14s\n", params.width, params.height, params.sliceCount,
+                       lightCount, builder.lightIndexCount, serialSeconds * 1e3, threadedSeconds * 1e3, bruteTime);
+                free(lights);
+            }
+
+            AAPLLightClusterBuilderDestroy(&builder);
+            AAPLLightClusterBuilderDestroy(&threadedBuilder);
+            free(depth);
+        }
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,539 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation for the CPU path tracer. Like the renderer, every stage runs over a dense queue of the rays still
+ active rather than over the pixels.
+*/
+
+#include "PathTracer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+// Same as the masks in ShaderTypes.h, which can't be included without the simd headers
+static const uint32_t triangleMaskGeometry = 1;
+
+static const uint32_t rayMaskPrimary = 3;
+static const uint32_t rayMaskShadow = 1;
+static const uint32_t rayMaskSecondary = 1;
+
+struct Float3 {
+    float x, y, z;
+};
+
+inline Float3 loadFloat3(const float *v) {
+    return { v[0], v[1], v[2] };
+}
+
+inline void storeFloat3(Float3 a, float *v) {
+    v[0] = a.x;
+    v[1] = a.y;
+    v[2] = a.z;
+}
+
+inline Float3 operator+(Float3 a, Float3 b) {
+    return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+inline Float3 operator-(Float3 a, Float3 b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline Float3 operator-(Float3 a) {
+    return { -a.x, -a.y, -a.z };
+}
+
+inline Float3 operator*(Float3 a, Float3 b) {
+    return { a.x * b.x, a.y * b.y, a.z * b.z };
+}
+
+inline Float3 operator*(Float3 a, float s) {
+    return { a.x * s, a.y * s, a.z * s };
+}
+
+inline Float3 operator*(float s, Float3 a) {
+    return a * s;
+}
+
+inline float dot(Float3 a, Float3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Float3 cross(Float3 a, Float3 b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline float length(Float3 a) {
+    return sqrtf(dot(a, a));
+}
+
+inline Float3 normalize(Float3 a) {
+    return a * (1.0f / length(a));
+}
+
+inline float saturate(float a) {
+    return std::min(std::max(a, 0.0f), 1.0f);
+}
+
+static const unsigned int primes[] = {
+    2,     3,   5,   7,
+    11,   13,  17,  19,
+    23,   29,  31,  37,
+    41,   43,  47,  53,
+    59,   61,  67,  71,
+    73,   79,  83,  89,
+    97,  101, 103, 107,
+    109, 113, 127, 131,
+    137, 139,
+};
+
+static_assert(sizeof(primes) / sizeof(primes[0]) >= 2 + pathTracerMaxBounceCount * 4,
+              "Every bounce needs four dimensions of the Halton sequence");
+
+// Same as the shaders' halton(), in single precision so both draw the same sample positions
+float halton(unsigned int i, unsigned int d) {
+    assert(d < sizeof(primes) / sizeof(primes[0]));
+
+    unsigned int b = primes[d];
+
+    float f = 1.0f;
+    float invB = 1.0f / b;
+
+    float r = 0;
+
+    while (i > 0) {
+        f = f * invB;
+        r = r + f * (i % b);
+        i = i / b;
+    }
+
+    return r;
+}
+
+// Same as the shaders' hashedRandom(): a uniformly random number for the given sample and bounce
+float hashedRandom(unsigned int i, unsigned int bounce) {
+    unsigned int x = i * pathTracerMaxBounceCount + bounce;
+
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline Float3 sampleCosineWeightedHemisphere(float u0, float u1) {
+    float phi = 2.0f * (float)M_PI * u0;
+
+    float cosTheta = sqrtf(u1);
+    float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+
+    return { sinTheta * cosf(phi), cosTheta, sinTheta * sinf(phi) };
+}
+
+inline Float3 alignHemisphereWithNormal(Float3 sample, Float3 normal) {
+    Float3 up = normal;
+    Float3 right = normalize(cross(normal, { 0.0072f, 1.0f, 0.0034f }));
+    Float3 forward = cross(right, up);
+
+    return sample.x * right + sample.y * up + sample.z * forward;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs task(range, begin, end) over [0, count) split into one range per thread
+template <typename Task>
+void parallelRanges(size_t count, unsigned int threadCount, const Task & task) {
+    std::vector<std::thread> threads;
+    size_t rangeSize = (count + threadCount - 1) / threadCount;
+
+    for (unsigned int range = 1; range < threadCount; range++) {
+        size_t begin = std::min(count, range * rangeSize);
+        size_t end = std::min(count, begin + rangeSize);
+        threads.emplace_back([&task, range, begin, end] { task(range, begin, end); });
+    }
+
+    task(0, 0, std::min(count, rangeSize));
+
+    for (std::thread & thread : threads)
+        thread.join();
+}
+
+// Rays are sorted into one bucket per octant of their direction, the sign test the intersector uses to group
+// rays into packets
+static const unsigned int octantCount = 8;
+
+inline unsigned int directionOctant(const RayOriginMaskDirectionMaxDistance & ray) {
+    return (ray.direction[0] < 0.0f ? 1 : 0) | (ray.direction[1] < 0.0f ? 2 : 0) | (ray.direction[2] < 0.0f ? 4 : 0);
+}
+
+class Wavefront {
+public:
+    Wavefront(const WideBVH & wideBVH,
+              const PathTracerScene & scene,
+              const PathTracerCamera & camera,
+              const PathTracerAreaLight & light,
+              const PathTracerOptions & options,
+              PathTracer & pathTracer) :
+        _wideBVH(wideBVH),
+        _scene(scene),
+        _camera(camera),
+        _light(light),
+        _options(options),
+        _pathTracer(pathTracer)
+    {
+        _threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+        _threadCount = std::max(_threadCount, 1u);
+    }
+
+    void generateRays();
+    void intersect(std::vector<PathTracerRay> & rays, size_t rayCount, RayIntersectionType intersectionType,
+                   RayIntersectionDataType intersectionDataType, bool usePackets, void *intersections);
+    void shade(size_t rayCount, unsigned int bounce);
+    void addShadowRayColors(size_t rayCount);
+    size_t compact(size_t rayCount);
+    void accumulate();
+
+private:
+    Float3 interpolateVertexAttribute(const void *attributes, const IntersectionDistancePrimitiveIndexCoordinates & intersection) const;
+
+    const WideBVH & _wideBVH;
+    const PathTracerScene & _scene;
+    const PathTracerCamera & _camera;
+    const PathTracerAreaLight & _light;
+    const PathTracerOptions & _options;
+    PathTracer & _pathTracer;
+    unsigned int _threadCount;
+};
+
+// rayKernel: one ray per pixel through a random position within the pixel
+void Wavefront::generateRays() {
+    PathTracer & pathTracer = _pathTracer;
+    size_t pixelCount = (size_t)pathTracer.width * pathTracer.height;
+
+    Float3 position = loadFloat3(_camera.position);
+    Float3 right = loadFloat3(_camera.right);
+    Float3 up = loadFloat3(_camera.up);
+    Float3 forward = loadFloat3(_camera.forward);
+
+    parallelRanges(pixelCount, _threadCount, [&](unsigned int, size_t begin, size_t end) {
+        for (size_t pixelIndex = begin; pixelIndex < end; pixelIndex++) {
+            PathTracerRay & ray = pathTracer.rays[pixelIndex];
+
+            unsigned int offset = pathTracer.randomValues[pixelIndex];
+
+            float x = (float)(pixelIndex % pathTracer.width) + halton(offset + pathTracer.frameIndex, 0);
+            float y = (float)(pixelIndex / pathTracer.width) + halton(offset + pathTracer.frameIndex, 1);
+
+            float u = x / (float)pathTracer.width * 2.0f - 1.0f;
+            float v = y / (float)pathTracer.height * 2.0f - 1.0f;
+
+            storeFloat3(position, ray.ray.origin);
+            storeFloat3(normalize(u * right + v * up + forward), ray.ray.direction);
+            ray.ray.mask = rayMaskPrimary;
+            ray.ray.maxDistance = INFINITY;
+            storeFloat3({ 1.0f, 1.0f, 1.0f }, ray.color);
+            ray.pixelIndex = (uint32_t)pixelIndex;
+
+            // The fourth float is padding, like the radiance buffer's float3s
+            float *color = &pathTracer.renderTarget[4 * pixelIndex];
+            color[0] = color[1] = color[2] = color[3] = 0.0f;
+        }
+    });
+}
+
+void Wavefront::intersect(std::vector<PathTracerRay> & rays,
+                          size_t rayCount,
+                          RayIntersectionType intersectionType,
+                          RayIntersectionDataType intersectionDataType,
+                          bool usePackets,
+                          void *intersections)
+{
+    RayIntersectorOptions options;
+    options.intersectionType = intersectionType;
+    options.intersectionDataType = intersectionDataType;
+    options.rayStride = sizeof(PathTracerRay);
+    options.usePackets = usePackets;
+    options.threadCount = _threadCount;
+
+    intersectRays(_wideBVH, options, rays.data(), intersections, rayCount);
+}
+
+Float3 Wavefront::interpolateVertexAttribute(const void *attributes,
+                                             const IntersectionDistancePrimitiveIndexCoordinates & intersection) const
+{
+    const uint8_t *vertex = (const uint8_t *)attributes + (size_t)intersection.primitiveIndex * 3 * _scene.vertexStride;
+
+    Float3 T0 = loadFloat3((const float *)vertex);
+    Float3 T1 = loadFloat3((const float *)(vertex + _scene.vertexStride));
+    Float3 T2 = loadFloat3((const float *)(vertex + 2 * _scene.vertexStride));
+
+    float u = intersection.coordinates[0];
+    float v = intersection.coordinates[1];
+    float w = 1.0f - u - v;
+
+    return u * T0 + v * T1 + w * T2;
+}
+
+// shadeKernel: samples the light from every hit and picks the direction the path continues in. Rays which
+// missed or hit the light are disabled along with their shadow ray.
+void Wavefront::shade(size_t rayCount, unsigned int bounce) {
+    PathTracer & pathTracer = _pathTracer;
+
+    Float3 lightPosition = loadFloat3(_light.position);
+    Float3 lightForward = loadFloat3(_light.forward);
+    Float3 lightRight = loadFloat3(_light.right);
+    Float3 lightUp = loadFloat3(_light.up);
+    Float3 lightColor = loadFloat3(_light.color);
+
+    parallelRanges(rayCount, _threadCount, [&](unsigned int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            PathTracerRay & ray = pathTracer.rays[i];
+            PathTracerRay & shadowRay = pathTracer.shadowRays[i];
+            const IntersectionDistancePrimitiveIndexCoordinates & intersection = pathTracer.intersections[i];
+
+            shadowRay.pixelIndex = ray.pixelIndex;
+            pathTracer.rayKeys[i] = inactiveRayKey;
+
+            // Queued rays are never disabled, so only misses need checking
+            if (intersection.distance < 0.0f) {
+                ray.ray.maxDistance = -1.0f;
+                shadowRay.ray.maxDistance = -1.0f;
+                continue;
+            }
+
+            if (_scene.triangleMasks[intersection.primitiveIndex] != triangleMaskGeometry) {
+                // A camera ray hit the light source directly
+                storeFloat3(lightColor, &pathTracer.renderTarget[4 * ray.pixelIndex]);
+
+                ray.ray.maxDistance = -1.0f;
+                shadowRay.ray.maxDistance = -1.0f;
+                continue;
+            }
+
+            Float3 intersectionPoint = loadFloat3(ray.ray.origin) + loadFloat3(ray.ray.direction) * intersection.distance;
+            Float3 surfaceNormal = normalize(interpolateVertexAttribute(_scene.vertexNormals, intersection));
+
+            unsigned int sampleIndex = pathTracer.randomValues[ray.pixelIndex] + pathTracer.frameIndex;
+
+            // Same as sampleAreaLight
+            float u0 = halton(sampleIndex, 2 + bounce * 4 + 0) * 2.0f - 1.0f;
+            float u1 = halton(sampleIndex, 2 + bounce * 4 + 1) * 2.0f - 1.0f;
+
+            Float3 samplePosition = lightPosition + lightRight * u0 + lightUp * u1;
+            Float3 lightDirection = samplePosition - intersectionPoint;
+
+            float lightDistance = length(lightDirection);
+            float inverseLightDistance = 1.0f / std::max(lightDistance, 1e-3f);
+
+            lightDirection = lightDirection * inverseLightDistance;
+
+            Float3 sampleColor = lightColor * (inverseLightDistance * inverseLightDistance);
+            sampleColor = sampleColor * saturate(dot(-lightDirection, lightForward));
+            sampleColor = sampleColor * saturate(dot(surfaceNormal, lightDirection));
+
+            Float3 color = loadFloat3(ray.color) * interpolateVertexAttribute(_scene.vertexColors, intersection);
+
+            storeFloat3(intersectionPoint + surfaceNormal * 1e-3f, shadowRay.ray.origin);
+            storeFloat3(lightDirection, shadowRay.ray.direction);
+            shadowRay.ray.mask = rayMaskShadow;
+            shadowRay.ray.maxDistance = lightDistance - 1e-3f;
+            storeFloat3(sampleColor * color, shadowRay.color);
+
+            // Russian roulette: dim paths are likely to end here, and the others make up for them
+            if (bounce >= _options.russianRouletteStartBounce) {
+                float survivalProbability = std::min(std::max(std::max(color.x, color.y), color.z), 1.0f);
+
+                if (hashedRandom(sampleIndex, bounce) >= survivalProbability) {
+                    ray.ray.maxDistance = -1.0f;
+                    continue;
+                }
+
+                color = color * (1.0f / survivalProbability);
+            }
+
+            Float3 sampleDirection = sampleCosineWeightedHemisphere(halton(sampleIndex, 2 + bounce * 4 + 2),
+                                                                    halton(sampleIndex, 2 + bounce * 4 + 3));
+            sampleDirection = alignHemisphereWithNormal(sampleDirection, surfaceNormal);
+
+            storeFloat3(intersectionPoint + surfaceNormal * 1e-3f, ray.ray.origin);
+            storeFloat3(sampleDirection, ray.ray.direction);
+            storeFloat3(color, ray.color);
+            ray.ray.mask = rayMaskSecondary;
+
+            pathTracer.rayKeys[i] = _options.sortRays ? directionOctant(ray.ray) : 0;
+        }
+    });
+}
+
+// shadowKernel: adds the color of every shadow ray which reached the light
+void Wavefront::addShadowRayColors(size_t rayCount) {
+    PathTracer & pathTracer = _pathTracer;
+
+    parallelRanges(rayCount, _threadCount, [&](unsigned int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const PathTracerRay & shadowRay = pathTracer.shadowRays[i];
+
+            if (shadowRay.ray.maxDistance >= 0.0f && pathTracer.shadowIntersections[i] < 0.0f) {
+                float *color = &pathTracer.renderTarget[4 * shadowRay.pixelIndex];
+
+                for (int channel = 0; channel < 3; channel++)
+                    color[channel] += shadowRay.color[channel];
+            }
+        }
+    });
+}
+
+// Moves the rays which are still active to the front of the queue, sorted by direction octant if requested.
+// Returns the number of active rays.
+size_t Wavefront::compact(size_t rayCount) {
+    PathTracer & pathTracer = _pathTracer;
+
+    RayCompactionOptions options;
+    options.keyCount = _options.sortRays ? octantCount : 1;
+    options.threadCount = _threadCount;
+
+    size_t activeRayCount = compactRays(pathTracer.rays.data(), sizeof(PathTracerRay), pathTracer.rayKeys.data(), rayCount,
+                                        options, pathTracer.compactedRays.data());
+
+    std::swap(pathTracer.rays, pathTracer.compactedRays);
+
+    return activeRayCount;
+}
+
+// accumulateKernel: running average of every frame
+void Wavefront::accumulate() {
+    PathTracer & pathTracer = _pathTracer;
+    size_t pixelCount = (size_t)pathTracer.width * pathTracer.height;
+
+    parallelRanges(pixelCount, _threadCount, [&](unsigned int, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Float3 color = loadFloat3(&pathTracer.renderTarget[4 * i]);
+
+            if (pathTracer.frameIndex > 0) {
+                Float3 prevColor = loadFloat3(&pathTracer.accumulationTarget[4 * i]);
+                prevColor = prevColor * (float)pathTracer.frameIndex;
+
+                color = color + prevColor;
+                color = color * (1.0f / (float)(pathTracer.frameIndex + 1));
+            }
+
+            storeFloat3(color, &pathTracer.accumulationTarget[4 * i]);
+            pathTracer.accumulationTarget[4 * i + 3] = 1.0f;
+        }
+    });
+}
+
+}
+
+void createPathTracer(unsigned int width, unsigned int height, PathTracer & pathTracer) {
+    size_t pixelCount = (size_t)width * height;
+
+    pathTracer.width = width;
+    pathTracer.height = height;
+    pathTracer.frameIndex = 0;
+
+    pathTracer.randomValues.resize(pixelCount);
+
+    for (size_t i = 0; i < pixelCount; i++)
+        pathTracer.randomValues[i] = rand() % (1024 * 1024);
+
+    pathTracer.renderTarget.assign(4 * pixelCount, 0.0f);
+    pathTracer.accumulationTarget.assign(4 * pixelCount, 0.0f);
+
+    pathTracer.rays.resize(pixelCount);
+    pathTracer.compactedRays.resize(pixelCount);
+    pathTracer.shadowRays.resize(pixelCount);
+    pathTracer.rayKeys.resize(pixelCount);
+    pathTracer.intersections.resize(pixelCount);
+    pathTracer.shadowIntersections.resize(pixelCount);
+}
+
+void renderPathTracerFrame(const WideBVH & wideBVH,
+                           const PathTracerScene & scene,
+                           const PathTracerCamera & camera,
+                           const PathTracerAreaLight & light,
+                           const PathTracerOptions & options,
+                           PathTracer & pathTracer,
+                           PathTracerFrameStatistics *statistics)
+{
+    assert(options.bounceCount >= 1 && options.bounceCount <= pathTracerMaxBounceCount);
+
+    Wavefront wavefront(wideBVH, scene, camera, light, options, pathTracer);
+    PathTracerFrameStatistics frameStatistics = {};
+
+    auto start = std::chrono::steady_clock::now();
+    wavefront.generateRays();
+    frameStatistics.rayGenerationSeconds = secondsSince(start);
+
+    // Camera rays are already coherent, in pixel order
+    size_t rayCount = (size_t)pathTracer.width * pathTracer.height;
+
+    // Only camera rays and their shadow rays are coherent enough for packet traversal. Packets of diffuse bounces
+    // share little of the tree, even when their directions fall in the same octant.
+    for (unsigned int bounce = 0; bounce < options.bounceCount && rayCount > 0; bounce++) {
+        start = std::chrono::steady_clock::now();
+        wavefront.intersect(pathTracer.rays, rayCount, RayIntersectionType::Nearest,
+                            RayIntersectionDataType::DistancePrimitiveIndexCoordinates, bounce == 0,
+                            pathTracer.intersections.data());
+        frameStatistics.intersectionSeconds += secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        wavefront.shade(rayCount, bounce);
+        frameStatistics.shadingSeconds += secondsSince(start);
+
+        // Shadow rays only need to know whether anything is in the way
+        start = std::chrono::steady_clock::now();
+        wavefront.intersect(pathTracer.shadowRays, rayCount, RayIntersectionType::Any,
+                            RayIntersectionDataType::Distance, bounce == 0, pathTracer.shadowIntersections.data());
+        wavefront.addShadowRayColors(rayCount);
+        frameStatistics.shadowSeconds += secondsSince(start);
+
+        frameStatistics.activeRayCounts[bounce] = rayCount;
+        frameStatistics.rayCount += rayCount;
+        frameStatistics.shadowRayCount += rayCount;
+
+        if (bounce + 1 < options.bounceCount) {
+            start = std::chrono::steady_clock::now();
+            rayCount = wavefront.compact(rayCount);
+            frameStatistics.compactionSeconds += secondsSince(start);
+        }
+    }
+
+    start = std::chrono::steady_clock::now();
+    wavefront.accumulate();
+    frameStatistics.accumulationSeconds = secondsSince(start);
+
+    pathTracer.frameIndex++;
+
+    if (statistics)
+        *statistics = frameStatistics;
+}
+
+bool writePathTracerImage(const PathTracer & pathTracer, const char *path) {
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+        return false;
+
+    // A negative scale marks little endian floats
+    bool written = fprintf(file, "PF\n%u %u\n-1.0\n", pathTracer.width, pathTracer.height) > 0;
+
+    size_t pixelCount = (size_t)pathTracer.width * pathTracer.height;
+
+    for (size_t i = 0; i < pixelCount && written; i++)
+        written = fwrite(&pathTracer.accumulationTarget[4 * i], sizeof(float), 3, file) == 3;
+
+    return fclose(file) == 0 && written;
+}
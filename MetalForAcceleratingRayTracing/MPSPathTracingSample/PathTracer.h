@@ -0,0 +1,130 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for a portable CPU path tracer running the same stages as the sample's compute kernels, for headless
+ regression renders and convergence benchmarks whose images can be compared with GPU captures
+*/
+
+#ifndef PathTracer_h
+#define PathTracer_h
+
+#include "RayCompaction.h"
+#include "RayIntersector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Same layout as the shaders' Ray: the intersector's ray followed by the color accumulated along the path. The
+// padding after the color holds the index of the ray's pixel, so rays can be reordered between stages.
+struct PathTracerRay {
+    RayOriginMaskDirectionMaxDistance ray;
+    float color[3];
+    uint32_t pixelIndex;
+};
+
+static_assert(sizeof(PathTracerRay) == 48, "Path tracer rays must match the shaders' rays");
+
+// Same values as the Camera uniforms: right and up are already scaled by the size of the image plane
+struct PathTracerCamera {
+    float position[3];
+    float right[3];
+    float up[3];
+    float forward[3];
+};
+
+// Same values as the AreaLight uniforms
+struct PathTracerAreaLight {
+    float position[3];
+    float forward[3];
+    float right[3];
+    float up[3];
+    float color[3];
+};
+
+// The scene's vertex attributes, laid out like the vertex buffers: triangle i has vertices 3 * i to 3 * i + 2,
+// each attribute starting with 3 floats, vertexStride bytes apart (sizeof(float3)). Vertex positions are only
+// needed by the intersector, so they come from the wide BVH.
+struct PathTracerScene {
+    const void *vertexNormals;
+    const void *vertexColors;
+    size_t vertexStride;
+    const uint32_t *triangleMasks;
+};
+
+// Most bounces a path can take, like MAX_BOUNCES
+static const unsigned int pathTracerMaxBounceCount = 8;
+
+struct PathTracerOptions {
+    // Iterations of the intersect, shade and shadow stages, like the renderer's maxBounces, from 1 to
+    // pathTracerMaxBounceCount
+    unsigned int bounceCount = 3;
+
+    // First bounce whose hits end their path at random, with a probability of one minus the brightest channel of
+    // the path's color, like RUSSIAN_ROULETTE_START_BOUNCE. The paths which continue are brightened to make up for
+    // the ones which ended, so the image converges to the same result.
+    unsigned int russianRouletteStartBounce = 2;
+
+    // Sorts the rays surviving each bounce by the octant of their direction, the order in which a GPU would
+    // intersect them most coherently. The CPU intersector traverses these rays one at a time, for which the
+    // order makes little difference. Rays are compacted either way, and the image is the same.
+    bool sortRays = false;
+
+    // Threads splitting every stage; 0 for every hardware thread
+    unsigned int threadCount = 0;
+};
+
+struct PathTracerFrameStatistics {
+    double rayGenerationSeconds;
+    double intersectionSeconds;             // Nearest intersections of the rays of every bounce
+    double shadingSeconds;
+    double shadowSeconds;                   // Shadow ray intersections and their contributions
+    double compactionSeconds;               // Removing terminated rays and sorting the others
+    double accumulationSeconds;
+    size_t rayCount;                        // Rays intersected over every bounce
+    size_t shadowRayCount;
+
+    // Rays intersected by every bounce, like the renderer's activeRayCounts. Zero past the last bounce.
+    size_t activeRayCounts[pathTracerMaxBounceCount];
+};
+
+// Images hold four floats per pixel like the renderer's radiance buffer and RGBA32Float accumulation targets, row y
+// holding the pixels of thread positions (x, y)
+struct PathTracer {
+    unsigned int width;
+    unsigned int height;
+    unsigned int frameIndex;                // Frames accumulated so far
+
+    std::vector<uint32_t> randomValues;     // Per pixel offsets into the Halton sequence, like the random texture
+    std::vector<float> renderTarget;        // The frame being rendered, like the radiance buffer
+    std::vector<float> accumulationTarget;  // Average of every frame rendered
+
+    // Ray queues and intersections, kept between frames to avoid reallocating them
+    std::vector<PathTracerRay> rays;
+    std::vector<PathTracerRay> compactedRays;
+    std::vector<PathTracerRay> shadowRays;
+    std::vector<uint32_t> rayKeys;          // Where each ray goes when compacted, or inactiveRayKey
+    std::vector<IntersectionDistancePrimitiveIndexCoordinates> intersections;
+    std::vector<float> shadowIntersections;
+};
+
+// Sizes the path tracer's images and starts accumulating from the first frame. The random offsets are drawn with
+// rand() like the random texture; replace them with the texture's contents to match a GPU capture.
+void createPathTracer(unsigned int width, unsigned int height, PathTracer & pathTracer);
+
+// Renders a frame into the render target and averages it into the accumulation target, like one call to
+// drawInMTKView. wideBVH must be built over the triangles of `scene`.
+void renderPathTracerFrame(const WideBVH & wideBVH,
+                           const PathTracerScene & scene,
+                           const PathTracerCamera & camera,
+                           const PathTracerAreaLight & light,
+                           const PathTracerOptions & options,
+                           PathTracer & pathTracer,
+                           PathTracerFrameStatistics *statistics);
+
+// Writes the RGB channels of the accumulation target to a portable float map, whose bottom row comes first like
+// row 0 of the accumulation targets. Returns false if the file could not be written.
+bool writePathTracerImage(const PathTracer & pathTracer, const char *path);
+
+#endif /* PathTracer_h */
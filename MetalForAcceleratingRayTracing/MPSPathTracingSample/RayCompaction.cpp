@@ -0,0 +1,97 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation for the portable ray compaction
+*/
+
+#include "RayCompaction.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Runs task(begin, end) over [0, count) split into one range per thread
+template <typename Task>
+void parallelRanges(size_t count, unsigned int threadCount, const Task & task) {
+    std::vector<std::thread> threads;
+    size_t rangeSize = (count + threadCount - 1) / threadCount;
+
+    for (unsigned int range = 1; range < threadCount; range++) {
+        size_t begin = std::min(count, range * rangeSize);
+        size_t end = std::min(count, begin + rangeSize);
+        threads.emplace_back([&task, begin, end] { task(begin, end); });
+    }
+
+    task(0, std::min(count, rangeSize));
+
+    for (std::thread & thread : threads)
+        thread.join();
+}
+
+}
+
+uint32_t exclusivePrefixSum(uint32_t *values, size_t count) {
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = values[i];
+        values[i] = sum;
+        sum += value;
+    }
+
+    return sum;
+}
+
+size_t compactRays(const void *rays,
+                   size_t rayStride,
+                   const uint32_t *keys,
+                   size_t rayCount,
+                   const RayCompactionOptions & options,
+                   void *compactedRays)
+{
+    assert(options.keyCount > 0);
+
+    size_t keyCount = options.keyCount;
+    size_t blockCount = (rayCount + rayCompactionBlockSize - 1) / rayCompactionBlockSize;
+
+    unsigned int threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+    threadCount = (unsigned int)std::min((size_t)std::max(threadCount, 1u), std::max(blockCount, (size_t)1));
+
+    // Active rays of every block per key, stored key major so the prefix sum over them places all of the rays of
+    // a key before those of the next key. Each block's counts then become the first slot of its rays of each key.
+    std::vector<uint32_t> offsets(keyCount * blockCount, 0);
+
+    parallelRanges(blockCount, threadCount, [&](size_t beginBlock, size_t endBlock) {
+        for (size_t block = beginBlock; block < endBlock; block++) {
+            size_t end = std::min(rayCount, (block + 1) * rayCompactionBlockSize);
+
+            for (size_t i = block * rayCompactionBlockSize; i < end; i++) {
+                if (keys[i] < keyCount)
+                    offsets[keys[i] * blockCount + block]++;
+            }
+        }
+    });
+
+    uint32_t activeRayCount = exclusivePrefixSum(offsets.data(), offsets.size());
+
+    parallelRanges(blockCount, threadCount, [&](size_t beginBlock, size_t endBlock) {
+        for (size_t block = beginBlock; block < endBlock; block++) {
+            size_t end = std::min(rayCount, (block + 1) * rayCompactionBlockSize);
+
+            for (size_t i = block * rayCompactionBlockSize; i < end; i++) {
+                if (keys[i] < keyCount) {
+                    uint32_t slot = offsets[keys[i] * blockCount + block]++;
+
+                    memcpy((uint8_t *)compactedRays + slot * rayStride, (const uint8_t *)rays + i * rayStride, rayStride);
+                }
+            }
+        }
+    });
+
+    return activeRayCount;
+}
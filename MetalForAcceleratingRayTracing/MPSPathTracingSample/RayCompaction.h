@@ -0,0 +1,46 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for the portable version of the ray compaction kernels, which move the rays still active after a bounce
+ to the front of a dense queue using prefix sums over blocks of rays
+*/
+
+#ifndef RayCompaction_h
+#define RayCompaction_h
+
+#include <cstddef>
+#include <cstdint>
+
+// Rays handled by one block, like the threadgroups of the compaction kernels (COMPACTION_BLOCK_SIZE)
+static const size_t rayCompactionBlockSize = 256;
+
+// Key of the rays which are dropped
+static const uint32_t inactiveRayKey = UINT32_MAX;
+
+struct RayCompactionOptions {
+    // Active rays have a key below keyCount, and are grouped by key in the compacted queue. A single key keeps
+    // the rays in their original order.
+    unsigned int keyCount = 1;
+
+    // Threads splitting the blocks; 0 for every hardware thread
+    unsigned int threadCount = 0;
+};
+
+// Replaces values[0, count) with their exclusive prefix sum and returns the sum of every value
+uint32_t exclusivePrefixSum(uint32_t *values, size_t count);
+
+// Copies the rays of [0, rayCount) whose key is below options.keyCount to the front of compactedRays, ordered
+// by key and keeping their order within each key, and returns their number. Rays are rayStride bytes apart in
+// both buffers, which must not overlap.
+//
+// Like the kernels, every block of rays first counts its active rays per key, an exclusive prefix sum over
+// the counts in key then block order gives each block where its rays go, and each block copies its rays there.
+size_t compactRays(const void *rays,
+                   size_t rayStride,
+                   const uint32_t *keys,
+                   size_t rayCount,
+                   const RayCompactionOptions & options,
+                   void *compactedRays);
+
+#endif /* RayCompaction_h */
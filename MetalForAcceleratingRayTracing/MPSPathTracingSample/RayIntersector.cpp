@@ -0,0 +1,776 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation for the CPU ray intersector. The loops over the eight children of a node, the four triangles
+ of a packet and the eight rays of a ray packet have fixed trip counts and no branches, so the compiler turns
+ them into vector instructions of whatever width the target has.
+*/
+
+#include "RayIntersector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+static const unsigned int wideBVHWidth = 8;
+static const unsigned int packetWidth = 4;
+static const unsigned int rayPacketSize = 8;
+
+// The traversal stacks hold every child pushed along a path of maxWideBVHDepth wide nodes
+static const unsigned int maxStackSize = maxWideBVHDepth * (wideBVHWidth - 1) + 1;
+
+// Rays handed to a thread at a time
+static const size_t rayChunkSize = 1024;
+
+// Far distances of box tests are scaled up by this so that rounding never misses flat boxes or box edges
+static const float farDistanceScale = 1.0f + 4.0f * 1.1920929e-7f;
+
+inline float minFloat(float a, float b) {
+    return a < b ? a : b;
+}
+
+inline float maxFloat(float a, float b) {
+    return a > b ? a : b;
+}
+
+// Bounds of the product of a value in [a0, a1] and one in [b0, b1]
+inline float intervalProductMin(float a0, float a1, float b0, float b1) {
+    return minFloat(minFloat(a0 * b0, a0 * b1), minFloat(a1 * b0, a1 * b1));
+}
+
+inline float intervalProductMax(float a0, float a1, float b0, float b1) {
+    return maxFloat(maxFloat(a0 * b0, a0 * b1), maxFloat(a1 * b0, a1 * b1));
+}
+
+class Collapser {
+public:
+    Collapser(const BVH & bvh, const void *vertices, size_t vertexStride, const uint32_t *triangleMasks, WideBVH & wideBVH) :
+        _bvh(bvh),
+        _vertices((const uint8_t *)vertices),
+        _vertexStride(vertexStride),
+        _triangleMasks(triangleMasks),
+        _wideBVH(wideBVH)
+    {
+    }
+
+    void collapse() {
+        _wideBVH.nodes.clear();
+        _wideBVH.packets.clear();
+
+        // An empty scene has a single leaf without triangles and collapses to no wide nodes, which every ray misses
+        if (_bvh.nodes.empty() || _bvh.triangleIndices.empty())
+            return;
+
+        _wideBVH.nodes.reserve(_bvh.nodes.size() / 4 + 1);
+        _wideBVH.packets.reserve(_bvh.triangleIndices.size() / 2 + 1);
+
+        collapseNode(0, 1);
+
+        _wideBVH.nodes.shrink_to_fit();
+        _wideBVH.packets.shrink_to_fit();
+    }
+
+private:
+    static float area(const BVHNode & node) {
+        float x = node.boundsMax[0] - node.boundsMin[0];
+        float y = node.boundsMax[1] - node.boundsMin[1];
+        float z = node.boundsMax[2] - node.boundsMin[2];
+
+        return x * y + y * z + z * x;
+    }
+
+    const float *vertex(uint32_t triangle, unsigned int corner) const {
+        return (const float *)(_vertices + (3 * (size_t)triangle + corner) * _vertexStride);
+    }
+
+    // Returns the index of the wide node made of the binary nodes below binaryIndex
+    uint32_t collapseNode(uint32_t binaryIndex, unsigned int depth) {
+        assert(depth <= maxWideBVHDepth);
+
+        uint32_t wideIndex = (uint32_t)_wideBVH.nodes.size();
+        _wideBVH.nodes.emplace_back();
+
+        const BVHNode & binaryNode = _bvh.nodes[binaryIndex];
+
+        // Open the largest interior child until there are eight children or only leaves
+        uint32_t children[wideBVHWidth];
+        unsigned int childCount = 0;
+
+        if (binaryNode.triangleCount) {
+            children[childCount++] = binaryIndex;
+        }
+        else {
+            children[childCount++] = binaryNode.offset;
+            children[childCount++] = binaryNode.offset + 1;
+        }
+
+        while (childCount < wideBVHWidth) {
+            int largest = -1;
+            float largestArea = -1.0f;
+
+            for (unsigned int i = 0; i < childCount; i++) {
+                const BVHNode & child = _bvh.nodes[children[i]];
+
+                if (!child.triangleCount && area(child) > largestArea) {
+                    largest = i;
+                    largestArea = area(child);
+                }
+            }
+
+            if (largest < 0)
+                break;
+
+            uint32_t opened = _bvh.nodes[children[largest]].offset;
+            children[largest] = opened;
+            children[childCount++] = opened + 1;
+        }
+
+        // Recursion grows the node array, so the node is filled in locally
+        WideBVHNode node;
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds[axis][0][i] = INFINITY;
+                node.bounds[axis][1][i] = -INFINITY;
+            }
+
+            node.children[i] = 0;
+            node.packetCounts[i] = 0;
+        }
+
+        for (unsigned int i = 0; i < childCount; i++) {
+            const BVHNode & child = _bvh.nodes[children[i]];
+
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds[axis][0][i] = child.boundsMin[axis];
+                node.bounds[axis][1][i] = child.boundsMax[axis];
+            }
+
+            if (child.triangleCount) {
+                node.children[i] = (uint32_t)_wideBVH.packets.size();
+                node.packetCounts[i] = (child.triangleCount + packetWidth - 1) / packetWidth;
+                addPackets(&_bvh.triangleIndices[child.offset], child.triangleCount);
+            }
+            else if (depth == maxWideBVHDepth) {
+                // Degenerate binary BVHs, such as chains peeling one triangle off at a time, would overflow the
+                // traversal stacks; their deepest subtrees are intersected triangle by triangle instead
+                node.children[i] = (uint32_t)_wideBVH.packets.size();
+                addSubtreePackets(children[i]);
+                node.packetCounts[i] = (uint32_t)_wideBVH.packets.size() - node.children[i];
+            }
+            else {
+                node.children[i] = collapseNode(children[i], depth + 1);
+            }
+        }
+
+        _wideBVH.nodes[wideIndex] = node;
+
+        return wideIndex;
+    }
+
+    // Adds the packets of every triangle of the leaves below binaryIndex
+    void addSubtreePackets(uint32_t binaryIndex) {
+        std::vector<uint32_t> triangles;
+        std::vector<uint32_t> stack(1, binaryIndex);
+
+        while (!stack.empty()) {
+            const BVHNode & node = _bvh.nodes[stack.back()];
+            stack.pop_back();
+
+            if (node.triangleCount) {
+                triangles.insert(triangles.end(), &_bvh.triangleIndices[node.offset],
+                                 &_bvh.triangleIndices[node.offset] + node.triangleCount);
+            }
+            else {
+                stack.push_back(node.offset);
+                stack.push_back(node.offset + 1);
+            }
+        }
+
+        addPackets(triangles.data(), (uint32_t)triangles.size());
+    }
+
+    void addPackets(const uint32_t *triangles, uint32_t triangleCount) {
+        for (uint32_t first = 0; first < triangleCount; first += packetWidth) {
+            TrianglePacket packet;
+            memset(&packet, 0, sizeof(packet));
+
+            for (uint32_t lane = 0; lane < packetWidth && first + lane < triangleCount; lane++) {
+                uint32_t triangle = triangles[first + lane];
+
+                const float *v0 = vertex(triangle, 0);
+                const float *v1 = vertex(triangle, 1);
+                const float *v2 = vertex(triangle, 2);
+
+                for (int axis = 0; axis < 3; axis++) {
+                    packet.vertex0[axis][lane] = v0[axis];
+                    packet.edge1[axis][lane] = v1[axis] - v0[axis];
+                    packet.edge2[axis][lane] = v2[axis] - v0[axis];
+                }
+
+                packet.masks[lane] = _triangleMasks ? _triangleMasks[triangle] : ~0u;
+                packet.primitiveIndices[lane] = triangle;
+            }
+
+            _wideBVH.packets.push_back(packet);
+        }
+    }
+
+    const BVH & _bvh;
+    const uint8_t *_vertices;
+    size_t _vertexStride;
+    const uint32_t *_triangleMasks;
+    WideBVH & _wideBVH;
+};
+
+struct StackEntry {
+    uint32_t index;
+    uint32_t packetCount;   // Nonzero for leaves
+    float distance;         // Distance at which the ray enters the child
+};
+
+typedef IntersectionDistancePrimitiveIndexCoordinates Hit;
+
+// Walks the wide BVH with one ray or a packet of rays. Triangles are tested following Möller and Trumbore;
+// degenerate padding triangles fail the barycentric tests.
+class Traverser {
+public:
+    Traverser(const WideBVH & wideBVH, const RayIntersectorOptions & options) :
+        _wideBVH(wideBVH),
+        _anyHit(options.intersectionType == RayIntersectionType::Any),
+        _ignoreMasks(options.rayMaskOptions == RayMaskOptions::None)
+    {
+    }
+
+    void intersectRay(const RayOriginMaskDirectionMaxDistance & ray, Hit & hit) const;
+    void intersectPacket(const RayOriginMaskDirectionMaxDistance *rays[rayPacketSize], uint32_t activeRays,
+                         Hit hits[rayPacketSize]) const;
+
+private:
+    // Returns true if the ray should stop, when it is an any-hit ray that found a triangle
+    bool intersectLeaf(const float origin[3], const float direction[3], uint32_t rayMask,
+                       uint32_t first, uint32_t packetCount, Hit & hit) const;
+
+    const WideBVH & _wideBVH;
+    bool _anyHit;
+    bool _ignoreMasks;
+};
+
+bool Traverser::intersectLeaf(const float origin[3], const float direction[3], uint32_t rayMask,
+                              uint32_t first, uint32_t packetCount, Hit & hit) const
+{
+    for (uint32_t p = first; p < first + packetCount; p++) {
+        const TrianglePacket & packet = _wideBVH.packets[p];
+
+        float distances[packetWidth];
+        float us[packetWidth];
+        float vs[packetWidth];
+
+        for (unsigned int lane = 0; lane < packetWidth; lane++) {
+            float e1x = packet.edge1[0][lane], e1y = packet.edge1[1][lane], e1z = packet.edge1[2][lane];
+            float e2x = packet.edge2[0][lane], e2y = packet.edge2[1][lane], e2z = packet.edge2[2][lane];
+
+            float px = direction[1] * e2z - direction[2] * e2y;
+            float py = direction[2] * e2x - direction[0] * e2z;
+            float pz = direction[0] * e2y - direction[1] * e2x;
+
+            float inverseDeterminant = 1.0f / (e1x * px + e1y * py + e1z * pz);
+
+            float tx = origin[0] - packet.vertex0[0][lane];
+            float ty = origin[1] - packet.vertex0[1][lane];
+            float tz = origin[2] - packet.vertex0[2][lane];
+
+            float u = (tx * px + ty * py + tz * pz) * inverseDeterminant;
+
+            float qx = ty * e1z - tz * e1y;
+            float qy = tz * e1x - tx * e1z;
+            float qz = tx * e1y - ty * e1x;
+
+            float v = (direction[0] * qx + direction[1] * qy + direction[2] * qz) * inverseDeterminant;
+            float t = (e2x * qx + e2y * qy + e2z * qz) * inverseDeterminant;
+
+            // Combined without branches so the loop stays vectorized
+            bool accepted = (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (t >= 0.0f) & (t < hit.distance) &
+                            (((packet.masks[lane] & rayMask) != 0) | _ignoreMasks);
+
+            distances[lane] = accepted ? t : INFINITY;
+            us[lane] = u;
+            vs[lane] = v;
+        }
+
+        for (unsigned int lane = 0; lane < packetWidth; lane++) {
+            if (distances[lane] < hit.distance) {
+                hit.distance = distances[lane];
+                hit.primitiveIndex = packet.primitiveIndices[lane];
+                hit.coordinates[0] = 1.0f - us[lane] - vs[lane];
+                hit.coordinates[1] = us[lane];
+
+                if (_anyHit)
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void Traverser::intersectRay(const RayOriginMaskDirectionMaxDistance & ray, Hit & hit) const {
+    float inverseDirection[3];
+    float scaledOrigin[3];
+    int nearSide[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        inverseDirection[axis] = 1.0f / ray.direction[axis];
+        scaledOrigin[axis] = ray.origin[axis] * inverseDirection[axis];
+        nearSide[axis] = inverseDirection[axis] < 0.0f ? 1 : 0;
+    }
+
+    hit.distance = ray.maxDistance;
+
+    StackEntry stack[maxStackSize];
+    unsigned int stackSize = 0;
+
+    stack[stackSize++] = { 0, 0, 0.0f };
+
+    while (stackSize) {
+        StackEntry entry = stack[--stackSize];
+
+        // Skip children entered beyond the closest hit found since they were pushed
+        if (entry.distance >= hit.distance)
+            continue;
+
+        if (entry.packetCount) {
+            if (intersectLeaf(ray.origin, ray.direction, ray.mask, entry.index, entry.packetCount, hit))
+                return;
+
+            continue;
+        }
+
+        const WideBVHNode & node = _wideBVH.nodes[entry.index];
+
+        float entryDistances[wideBVHWidth];
+        int hits[wideBVHWidth];
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            float nearX = node.bounds[0][nearSide[0]][i] * inverseDirection[0] - scaledOrigin[0];
+            float nearY = node.bounds[1][nearSide[1]][i] * inverseDirection[1] - scaledOrigin[1];
+            float nearZ = node.bounds[2][nearSide[2]][i] * inverseDirection[2] - scaledOrigin[2];
+            float farX = node.bounds[0][1 - nearSide[0]][i] * inverseDirection[0] - scaledOrigin[0];
+            float farY = node.bounds[1][1 - nearSide[1]][i] * inverseDirection[1] - scaledOrigin[1];
+            float farZ = node.bounds[2][1 - nearSide[2]][i] * inverseDirection[2] - scaledOrigin[2];
+
+            float enter = maxFloat(maxFloat(nearX, nearY), maxFloat(nearZ, 0.0f));
+            float exit = minFloat(minFloat(farX, farY), minFloat(farZ, hit.distance)) * farDistanceScale;
+
+            entryDistances[i] = enter;
+            hits[i] = enter <= exit;
+        }
+
+        // Push the children that were hit farthest first, so the nearest is visited next
+        unsigned int first = stackSize;
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            if (!hits[i])
+                continue;
+
+            StackEntry child = { node.children[i], node.packetCounts[i], entryDistances[i] };
+
+            unsigned int j = stackSize++;
+            for (; j > first && stack[j - 1].distance < child.distance; j--)
+                stack[j] = stack[j - 1];
+
+            stack[j] = child;
+        }
+    }
+}
+
+void Traverser::intersectPacket(const RayOriginMaskDirectionMaxDistance *rays[rayPacketSize], uint32_t activeRays,
+                                Hit hits[rayPacketSize]) const
+{
+    // Rays of a packet share the signs of their directions and so the near sides of every box
+    float originX[rayPacketSize], originY[rayPacketSize], originZ[rayPacketSize];
+    float directionX[rayPacketSize], directionY[rayPacketSize], directionZ[rayPacketSize];
+    float inverseX[rayPacketSize], inverseY[rayPacketSize], inverseZ[rayPacketSize];
+    float scaledX[rayPacketSize], scaledY[rayPacketSize], scaledZ[rayPacketSize];
+    float distance[rayPacketSize], u[rayPacketSize], v[rayPacketSize];
+    uint32_t masks[rayPacketSize], primitiveIndex[rayPacketSize];
+
+    unsigned int lead = 0;
+    while (!(activeRays & (1u << lead)))
+        lead++;
+
+    for (unsigned int r = 0; r < rayPacketSize; r++) {
+        const RayOriginMaskDirectionMaxDistance & ray = *rays[(activeRays & (1u << r)) ? r : lead];
+
+        originX[r] = ray.origin[0];
+        originY[r] = ray.origin[1];
+        originZ[r] = ray.origin[2];
+        directionX[r] = ray.direction[0];
+        directionY[r] = ray.direction[1];
+        directionZ[r] = ray.direction[2];
+        inverseX[r] = 1.0f / ray.direction[0];
+        inverseY[r] = 1.0f / ray.direction[1];
+        inverseZ[r] = 1.0f / ray.direction[2];
+        scaledX[r] = originX[r] * inverseX[r];
+        scaledY[r] = originY[r] * inverseY[r];
+        scaledZ[r] = originZ[r] * inverseZ[r];
+        distance[r] = (activeRays & (1u << r)) ? ray.maxDistance : -1.0f;
+        masks[r] = _ignoreMasks ? ~0u : ray.mask;
+        primitiveIndex[r] = UINT32_MAX;
+        u[r] = 0.0f;
+        v[r] = 0.0f;
+    }
+
+    int nearX = inverseX[lead] < 0.0f ? 1 : 0;
+    int nearY = inverseY[lead] < 0.0f ? 1 : 0;
+    int nearZ = inverseZ[lead] < 0.0f ? 1 : 0;
+
+    // Ranges of the origins and inverse directions of the packet, to test it as a whole against boxes
+    const float *origins[3] = { originX, originY, originZ };
+    const float *inverses[3] = { inverseX, inverseY, inverseZ };
+    const int nearSides[3] = { nearX, nearY, nearZ };
+    float originMin[3], originMax[3], inverseMin[3], inverseMax[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        originMin[axis] = originMax[axis] = origins[axis][0];
+        inverseMin[axis] = inverseMax[axis] = inverses[axis][0];
+
+        for (unsigned int r = 1; r < rayPacketSize; r++) {
+            originMin[axis] = minFloat(originMin[axis], origins[axis][r]);
+            originMax[axis] = maxFloat(originMax[axis], origins[axis][r]);
+            inverseMin[axis] = minFloat(inverseMin[axis], inverses[axis][r]);
+            inverseMax[axis] = maxFloat(inverseMax[axis], inverses[axis][r]);
+        }
+    }
+
+    // Any-hit rays that found a triangle
+    uint32_t finishedRays = 0;
+
+    struct PacketStackEntry {
+        uint32_t index;
+        uint32_t packetCount;
+        float distances[rayPacketSize];     // Distance at which each ray enters the child, infinite if it misses
+    };
+
+    PacketStackEntry stack[maxStackSize];
+    unsigned int stackSize = 0;
+
+    stack[stackSize].index = 0;
+    stack[stackSize].packetCount = 0;
+    for (unsigned int r = 0; r < rayPacketSize; r++)
+        stack[stackSize].distances[r] = (activeRays & (1u << r)) ? 0.0f : INFINITY;
+    stackSize++;
+
+    while (stackSize) {
+        PacketStackEntry entry = stack[--stackSize];
+
+        // Rays still looking for a hit beyond the distance at which they enter the child
+        int rayActive[rayPacketSize];
+        for (unsigned int r = 0; r < rayPacketSize; r++)
+            rayActive[r] = entry.distances[r] < distance[r];
+
+        uint32_t entryRays = 0;
+        for (unsigned int r = 0; r < rayPacketSize; r++)
+            entryRays |= (uint32_t)rayActive[r] << r;
+
+        entryRays &= ~finishedRays;
+        if (!entryRays)
+            continue;
+
+        for (unsigned int r = 0; r < rayPacketSize; r++)
+            rayActive[r] = (entryRays >> r) & 1;
+
+        if (entry.packetCount) {
+            float hitDistances[rayPacketSize], hitUs[rayPacketSize], hitVs[rayPacketSize];
+
+            for (uint32_t p = entry.index; p < entry.index + entry.packetCount; p++) {
+                const TrianglePacket & packet = _wideBVH.packets[p];
+
+                for (unsigned int lane = 0; lane < packetWidth; lane++) {
+                    float e1x = packet.edge1[0][lane], e1y = packet.edge1[1][lane], e1z = packet.edge1[2][lane];
+                    float e2x = packet.edge2[0][lane], e2y = packet.edge2[1][lane], e2z = packet.edge2[2][lane];
+                    float v0x = packet.vertex0[0][lane], v0y = packet.vertex0[1][lane], v0z = packet.vertex0[2][lane];
+                    uint32_t triangleMask = _ignoreMasks ? ~0u : packet.masks[lane];
+                    uint32_t triangle = packet.primitiveIndices[lane];
+
+                    for (unsigned int r = 0; r < rayPacketSize; r++) {
+                        float px = directionY[r] * e2z - directionZ[r] * e2y;
+                        float py = directionZ[r] * e2x - directionX[r] * e2z;
+                        float pz = directionX[r] * e2y - directionY[r] * e2x;
+
+                        float inverseDeterminant = 1.0f / (e1x * px + e1y * py + e1z * pz);
+
+                        float tx = originX[r] - v0x;
+                        float ty = originY[r] - v0y;
+                        float tz = originZ[r] - v0z;
+
+                        float hitU = (tx * px + ty * py + tz * pz) * inverseDeterminant;
+
+                        float qx = ty * e1z - tz * e1y;
+                        float qy = tz * e1x - tx * e1z;
+                        float qz = tx * e1y - ty * e1x;
+
+                        float hitV = (directionX[r] * qx + directionY[r] * qy + directionZ[r] * qz) * inverseDeterminant;
+                        float t = (e2x * qx + e2y * qy + e2z * qz) * inverseDeterminant;
+
+                        bool accepted = rayActive[r] & (hitU >= 0.0f) & (hitV >= 0.0f) & (hitU + hitV <= 1.0f) &
+                                        (t >= 0.0f) & ((triangleMask & masks[r]) != 0);
+
+                        hitDistances[r] = accepted ? t : INFINITY;
+                        hitUs[r] = hitU;
+                        hitVs[r] = hitV;
+                    }
+
+                    // Merged separately, which keeps both loops free of branches
+                    for (unsigned int r = 0; r < rayPacketSize; r++) {
+                        bool closer = hitDistances[r] < distance[r];
+
+                        distance[r] = closer ? hitDistances[r] : distance[r];
+                        primitiveIndex[r] = closer ? triangle : primitiveIndex[r];
+                        u[r] = closer ? hitUs[r] : u[r];
+                        v[r] = closer ? hitVs[r] : v[r];
+                    }
+                }
+            }
+
+            if (_anyHit) {
+                for (unsigned int r = 0; r < rayPacketSize; r++)
+                    if (primitiveIndex[r] != UINT32_MAX)
+                        finishedRays |= 1u << r;
+
+                if ((activeRays & ~finishedRays) == 0)
+                    break;
+            }
+
+            continue;
+        }
+
+        const WideBVHNode & node = _wideBVH.nodes[entry.index];
+
+        float farthest = distance[0];
+        for (unsigned int r = 1; r < rayPacketSize; r++)
+            farthest = maxFloat(farthest, distance[r]);
+
+        // Bound the distances at which the rays can enter and leave each child with interval arithmetic, so
+        // children that no ray of the packet enters skip the tests of the individual rays
+        int packetEnters[wideBVHWidth];
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            float enter = 0.0f;
+            float exit = farthest;
+
+            for (int axis = 0; axis < 3; axis++) {
+                float nearPlane = node.bounds[axis][nearSides[axis]][i];
+                float farPlane = node.bounds[axis][1 - nearSides[axis]][i];
+
+                enter = maxFloat(enter, intervalProductMin(nearPlane - originMax[axis], nearPlane - originMin[axis],
+                                                           inverseMin[axis], inverseMax[axis]));
+                exit = minFloat(exit, intervalProductMax(farPlane - originMax[axis], farPlane - originMin[axis],
+                                                         inverseMin[axis], inverseMax[axis]));
+            }
+
+            packetEnters[i] = enter <= exit * farDistanceScale;
+        }
+
+        // Distance at which every ray enters every child, infinite for rays that miss it
+        float entryDistances[wideBVHWidth][rayPacketSize];
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            if (!packetEnters[i]) {
+                for (unsigned int r = 0; r < rayPacketSize; r++)
+                    entryDistances[i][r] = INFINITY;
+
+                continue;
+            }
+
+            float minX = node.bounds[0][nearX][i], maxX = node.bounds[0][1 - nearX][i];
+            float minY = node.bounds[1][nearY][i], maxY = node.bounds[1][1 - nearY][i];
+            float minZ = node.bounds[2][nearZ][i], maxZ = node.bounds[2][1 - nearZ][i];
+
+            for (unsigned int r = 0; r < rayPacketSize; r++) {
+                float enter = maxFloat(maxFloat(minX * inverseX[r] - scaledX[r], minY * inverseY[r] - scaledY[r]),
+                                       maxFloat(minZ * inverseZ[r] - scaledZ[r], 0.0f));
+                float exit = minFloat(minFloat(maxX * inverseX[r] - scaledX[r], maxY * inverseY[r] - scaledY[r]),
+                                      minFloat(maxZ * inverseZ[r] - scaledZ[r], distance[r])) * farDistanceScale;
+
+                entryDistances[i][r] = (enter <= exit) & rayActive[r] ? enter : INFINITY;
+            }
+        }
+
+        // Push the children entered by any ray, the one the packet enters first on top
+        unsigned int children[wideBVHWidth];
+        float childDistances[wideBVHWidth];
+        unsigned int childCount = 0;
+
+        for (unsigned int i = 0; i < wideBVHWidth; i++) {
+            float closest = INFINITY;
+            for (unsigned int r = 0; r < rayPacketSize; r++)
+                closest = minFloat(closest, entryDistances[i][r]);
+
+            if (closest == INFINITY)
+                continue;
+
+            unsigned int j = childCount++;
+            for (; j > 0 && childDistances[j - 1] < closest; j--) {
+                children[j] = children[j - 1];
+                childDistances[j] = childDistances[j - 1];
+            }
+
+            children[j] = i;
+            childDistances[j] = closest;
+        }
+
+        for (unsigned int j = 0; j < childCount; j++) {
+            unsigned int i = children[j];
+            PacketStackEntry & child = stack[stackSize++];
+
+            child.index = node.children[i];
+            child.packetCount = node.packetCounts[i];
+            memcpy(child.distances, entryDistances[i], sizeof(child.distances));
+        }
+    }
+
+    for (unsigned int r = 0; r < rayPacketSize; r++) {
+        hits[r].distance = primitiveIndex[r] != UINT32_MAX ? distance[r] : -1.0f;
+        hits[r].primitiveIndex = primitiveIndex[r];
+        hits[r].coordinates[0] = 1.0f - u[r] - v[r];
+        hits[r].coordinates[1] = u[r];
+    }
+}
+
+size_t intersectionSize(RayIntersectionDataType dataType) {
+    switch (dataType) {
+        case RayIntersectionDataType::Distance:
+            return sizeof(float);
+        case RayIntersectionDataType::DistancePrimitiveIndex:
+            return sizeof(float) + sizeof(uint32_t);
+        case RayIntersectionDataType::DistancePrimitiveIndexCoordinates:
+            return sizeof(IntersectionDistancePrimitiveIndexCoordinates);
+    }
+
+    return 0;
+}
+
+// Intersects rays [begin, end)
+void intersectRange(const Traverser & traverser, const RayIntersectorOptions & options,
+                    const uint8_t *rays, uint8_t *intersections, size_t begin, size_t end)
+{
+    size_t outputSize = intersectionSize(options.intersectionDataType);
+
+    for (size_t first = begin; first < end; first += rayPacketSize) {
+        size_t count = std::min((size_t)rayPacketSize, end - first);
+
+        const RayOriginMaskDirectionMaxDistance *packetRays[rayPacketSize];
+        Hit hits[rayPacketSize];
+
+        // Disabled rays are skipped; the others are traversed together if their directions share signs
+        uint32_t activeRays = 0;
+        unsigned int signs[2] = { 0, 0 };
+
+        for (unsigned int r = 0; r < count; r++) {
+            packetRays[r] = (const RayOriginMaskDirectionMaxDistance *)(rays + (first + r) * options.rayStride);
+
+            hits[r].distance = -1.0f;
+            hits[r].primitiveIndex = UINT32_MAX;
+            hits[r].coordinates[0] = 0.0f;
+            hits[r].coordinates[1] = 0.0f;
+
+            const RayOriginMaskDirectionMaxDistance & ray = *packetRays[r];
+
+            if (ray.maxDistance >= 0.0f && (ray.mask || options.rayMaskOptions == RayMaskOptions::None)) {
+                activeRays |= 1u << r;
+
+                unsigned int octant = (std::signbit(ray.direction[0]) ? 1 : 0) |
+                                      (std::signbit(ray.direction[1]) ? 2 : 0) |
+                                      (std::signbit(ray.direction[2]) ? 4 : 0);
+                signs[0] |= octant;
+                signs[1] |= ~octant & 7;
+            }
+        }
+
+        bool coherent = (signs[0] & signs[1]) == 0;
+
+        if (activeRays && options.usePackets && coherent && __builtin_popcount(activeRays) > rayPacketSize / 2) {
+            traverser.intersectPacket(packetRays, activeRays, hits);
+        }
+        else {
+            for (unsigned int r = 0; r < count; r++) {
+                if (!(activeRays & (1u << r)))
+                    continue;
+
+                Hit hit = { -1.0f, UINT32_MAX, { 0.0f, 0.0f } };
+                traverser.intersectRay(*packetRays[r], hit);
+
+                if (hit.primitiveIndex != UINT32_MAX)
+                    hits[r] = hit;
+            }
+        }
+
+        for (unsigned int r = 0; r < count; r++)
+            memcpy(intersections + (first + r) * outputSize, &hits[r], outputSize);
+    }
+}
+
+}
+
+void buildWideBVH(const BVH & bvh,
+                  const void *vertices,
+                  size_t vertexStride,
+                  const uint32_t *triangleMasks,
+                  WideBVH & wideBVH)
+{
+    Collapser collapser(bvh, vertices, vertexStride, triangleMasks, wideBVH);
+    collapser.collapse();
+}
+
+void intersectRays(const WideBVH & wideBVH,
+                   const RayIntersectorOptions & options,
+                   const void *rays,
+                   void *intersections,
+                   size_t rayCount)
+{
+    assert(options.rayStride >= sizeof(RayOriginMaskDirectionMaxDistance));
+
+    if (wideBVH.nodes.empty()) {
+        size_t outputSize = intersectionSize(options.intersectionDataType);
+        Hit miss = { -1.0f, UINT32_MAX, { 0.0f, 0.0f } };
+
+        for (size_t i = 0; i < rayCount; i++)
+            memcpy((uint8_t *)intersections + i * outputSize, &miss, outputSize);
+
+        return;
+    }
+
+    Traverser traverser(wideBVH, options);
+
+    size_t chunkCount = (rayCount + rayChunkSize - 1) / rayChunkSize;
+    unsigned int threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+    threadCount = (unsigned int)std::min((size_t)std::max(threadCount, 1u), chunkCount);
+
+    // Threads take chunks of rays until none are left, which balances rays of very different costs
+    std::atomic<size_t> nextChunk(0);
+
+    auto work = [&] {
+        for (size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+            size_t begin = chunk * rayChunkSize;
+            size_t end = std::min(rayCount, begin + rayChunkSize);
+
+            intersectRange(traverser, options, (const uint8_t *)rays, (uint8_t *)intersections, begin, end);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; i++)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread & thread : threads)
+        thread.join();
+}
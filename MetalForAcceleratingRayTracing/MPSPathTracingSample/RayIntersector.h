@@ -0,0 +1,119 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for a portable CPU ray intersector reading and writing the ray and intersection buffer layouts
+ of MPSRayIntersector, as a fallback for devices without Metal Performance Shaders ray tracing and for
+ checking its results
+*/
+
+#ifndef RayIntersector_h
+#define RayIntersector_h
+
+#include "BVH.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Same layout as MPSRayOriginMaskDirectionMaxDistance, the start of the sample's rays. Rays with a negative
+// maximum distance are disabled and never hit anything.
+struct RayOriginMaskDirectionMaxDistance {
+    float origin[3];
+    uint32_t mask;
+    float direction[3];
+    float maxDistance;
+};
+
+// Same layout as MPSIntersectionDistancePrimitiveIndexCoordinates. The distance is negative on a miss, and
+// the hit point is coordinates[0] * v0 + coordinates[1] * v1 + (1 - coordinates[0] - coordinates[1]) * v2.
+struct IntersectionDistancePrimitiveIndexCoordinates {
+    float distance;
+    uint32_t primitiveIndex;
+    float coordinates[2];
+};
+
+// MPSIntersectionType equivalents
+enum class RayIntersectionType {
+    Nearest,    // Closest hit along each ray
+    Any         // Any hit, for shadow rays
+};
+
+// MPSIntersectionDataType equivalents for triangle acceleration structures. Intersections are written tightly
+// packed, each the size of the leading fields of IntersectionDistancePrimitiveIndexCoordinates it contains.
+enum class RayIntersectionDataType {
+    Distance,
+    DistancePrimitiveIndex,
+    DistancePrimitiveIndexCoordinates
+};
+
+// MPSRayMaskOptions equivalents
+enum class RayMaskOptions {
+    None,       // Ray masks are ignored
+    Primitive   // A triangle is only hit by rays whose mask shares a bit with the triangle's mask
+};
+
+// Eight children tested against a ray at once. Child bounds are stored per axis and side, minimum then maximum,
+// so the near and far planes of a ray are picked by the sign of its direction. Leaf children have a nonzero
+// packet count and reference that many TrianglePackets starting at children[i]; empty slots have inverted
+// bounds, which no ray hits.
+struct WideBVHNode {
+    float bounds[3][2][8];
+    uint32_t children[8];
+    uint32_t packetCounts[8];
+};
+
+static_assert(sizeof(WideBVHNode) == 256, "Wide BVH nodes must be 256 bytes");
+
+// Four triangles of a leaf stored for a single pass of the ray triangle test. Leaves are padded with degenerate
+// triangles whose mask is zero.
+struct TrianglePacket {
+    float vertex0[3][4];
+    float edge1[3][4];
+    float edge2[3][4];
+    uint32_t masks[4];
+    uint32_t primitiveIndices[4];
+};
+
+// Deepest wide BVH buildWideBVH makes, the depth the traversal stacks are sized for. Binary subtrees below that
+// depth are collapsed into leaves holding all of their triangles.
+static const unsigned int maxWideBVHDepth = 64;
+
+struct WideBVH {
+    std::vector<WideBVHNode> nodes;             // Root first
+    std::vector<TrianglePacket> packets;        // Triangles of the leaves
+};
+
+// Collapses a binary BVH built by buildBVH over the same vertices into an eight wide BVH. triangleMasks holds
+// one mask per triangle like the sample's masks vector, or is null if every triangle should use ~0.
+void buildWideBVH(const BVH & bvh,
+                  const void *vertices,
+                  size_t vertexStride,
+                  const uint32_t *triangleMasks,
+                  WideBVH & wideBVH);
+
+struct RayIntersectorOptions {
+    RayIntersectionType intersectionType = RayIntersectionType::Nearest;
+    RayIntersectionDataType intersectionDataType = RayIntersectionDataType::DistancePrimitiveIndexCoordinates;
+    RayMaskOptions rayMaskOptions = RayMaskOptions::Primitive;
+
+    // Bytes between rays, like MPSRayIntersector's rayStride. The sample's rays are 48 bytes.
+    size_t rayStride = sizeof(RayOriginMaskDirectionMaxDistance);
+
+    // Groups of eight consecutive rays whose directions share signs are traversed together as a packet, which
+    // suits camera rays and other coherent rays. Other rays are traversed one at a time.
+    bool usePackets = true;
+
+    // Threads splitting the rays; 0 for every hardware thread
+    unsigned int threadCount = 0;
+};
+
+// Intersects rays [0, rayCount) of `rays` with the triangles of `wideBVH` and writes one intersection per ray,
+// like encodeIntersectionToCommandBuffer
+void intersectRays(const WideBVH & wideBVH,
+                   const RayIntersectorOptions & options,
+                   const void *rays,
+                   void *intersections,
+                   size_t rayCount);
+
+#endif /* RayIntersector_h */
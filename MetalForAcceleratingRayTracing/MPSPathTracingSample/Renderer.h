@@ -13,5 +13,12 @@ Header for platform independent renderer class
 
 -(nonnull instancetype)initWithMetalKitView:(nonnull MTKView *)view;
 
+// Most bounces a path can take, from 1 to MAX_BOUNCES. Paths may end sooner by leaving the scene or
+// by Russian roulette. Changing the number of bounces restarts accumulating frames. Defaults to 3.
+@property (nonatomic) unsigned int maxBounces;
+
+// Number of rays intersected at each bounce of the last frame the GPU completed, for profiling
+@property (atomic, readonly, copy, nonnull) NSArray<NSNumber *> *activeRayCounts;
+
 @end
 
@@ -21,6 +21,14 @@ static const size_t alignedUniformsSize = (sizeof(Uniforms) + 255) & ~255;
 static const size_t rayStride = 48;
 static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitiveIndexCoordinates);
 
+static const size_t alignedRayCountsSize = (sizeof(uint32_t) * MAX_BOUNCES + 255) & ~255;
+
+@interface Renderer ()
+
+@property (atomic, readwrite, copy, nonnull) NSArray<NSNumber *> *activeRayCounts;
+
+@end
+
 @implementation Renderer
 {
     MTKView *_view;
@@ -35,18 +43,25 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     id <MTLBuffer> _vertexNormalBuffer;
     id <MTLBuffer> _vertexColorBuffer;
     id <MTLBuffer> _rayBuffer;
+    id <MTLBuffer> _compactedRayBuffer;
     id <MTLBuffer> _shadowRayBuffer;
     id <MTLBuffer> _intersectionBuffer;
+    id <MTLBuffer> _radianceBuffer;
     id <MTLBuffer> _uniformBuffer;
     id <MTLBuffer> _triangleMaskBuffer;
+    id <MTLBuffer> _rayCountBuffer;
+    id <MTLBuffer> _blockCountBuffer;
+    id <MTLBuffer> _dispatchArgumentBuffer;
     
     id <MTLComputePipelineState> _rayPipeline;
     id <MTLComputePipelineState> _shadePipeline;
     id <MTLComputePipelineState> _shadowPipeline;
     id <MTLComputePipelineState> _accumulatePipeline;
+    id <MTLComputePipelineState> _compactionCountPipeline;
+    id <MTLComputePipelineState> _compactionScanPipeline;
+    id <MTLComputePipelineState> _compactionScatterPipeline;
     id <MTLRenderPipelineState> _copyPipeline;
     
-    id <MTLTexture> _renderTargets[2];
     id <MTLTexture> _accumulationTargets[2];
     id <MTLTexture> _randomTexture;
     
@@ -54,6 +69,7 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     CGSize _size;
     NSUInteger _uniformBufferOffset;
     NSUInteger _uniformBufferIndex;
+    NSUInteger _rayCountBufferOffset;
 
     unsigned int _frameIndex;
 }
@@ -73,6 +89,9 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
 
         _sem = dispatch_semaphore_create(maxFramesInFlight);
         
+        _maxBounces = 3;
+        _activeRayCounts = @[];
+        
         [self loadMetal];
         [self createPipelines];
         [self createScene];
@@ -148,6 +167,37 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     
     if (!_accumulatePipeline)
         NSLog(@"Failed to create pipeline state: %@", error);
+    
+    // Count, scan, and scatter the rays still active after a bounce to compact them
+    computeDescriptor.computeFunction = [_library newFunctionWithName:@"compactionCountKernel"];
+    
+    _compactionCountPipeline = [_device newComputePipelineStateWithDescriptor:computeDescriptor
+                                                                      options:0
+                                                                   reflection:nil
+                                                                        error:&error];
+    
+    if (!_compactionCountPipeline)
+        NSLog(@"Failed to create pipeline state: %@", error);
+    
+    computeDescriptor.computeFunction = [_library newFunctionWithName:@"compactionScanKernel"];
+    
+    _compactionScanPipeline = [_device newComputePipelineStateWithDescriptor:computeDescriptor
+                                                                     options:0
+                                                                  reflection:nil
+                                                                       error:&error];
+    
+    if (!_compactionScanPipeline)
+        NSLog(@"Failed to create pipeline state: %@", error);
+    
+    computeDescriptor.computeFunction = [_library newFunctionWithName:@"compactionScatterKernel"];
+    
+    _compactionScatterPipeline = [_device newComputePipelineStateWithDescriptor:computeDescriptor
+                                                                        options:0
+                                                                     reflection:nil
+                                                                          error:&error];
+    
+    if (!_compactionScatterPipeline)
+        NSLog(@"Failed to create pipeline state: %@", error);
 
     // Copies rendered scene into the MTKView
     MTLRenderPipelineDescriptor *renderDescriptor = [[MTLRenderPipelineDescriptor alloc] init];
@@ -221,6 +271,11 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
 #endif
     
     _uniformBuffer = [_device newBufferWithLength:uniformBufferSize options:options];
+    
+    // The number of rays at each bounce is read back on the CPU once the frame has completed, so it
+    // is stored in shared memory. Like the uniforms, each frame in flight has its own range.
+    _rayCountBuffer = [_device newBufferWithLength:alignedRayCountsSize * maxFramesInFlight
+                                           options:MTLResourceStorageModeShared];
 
     // Allocate buffers for vertex positions, colors, and normals. Note that each vertex position is a
     // float3, which is a 16 byte aligned type.
@@ -275,10 +330,25 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     // We use private buffers here because rays and intersection results will be entirely produced
     // and consumed on the GPU
     _rayBuffer = [_device newBufferWithLength:rayStride * rayCount options:MTLResourceStorageModePrivate];
+    _compactedRayBuffer = [_device newBufferWithLength:rayStride * rayCount options:MTLResourceStorageModePrivate];
     _shadowRayBuffer = [_device newBufferWithLength:rayStride * rayCount options:MTLResourceStorageModePrivate];
     _intersectionBuffer = [_device newBufferWithLength:intersectionStride * rayCount options:MTLResourceStorageModePrivate];
     
-    // Create a render target which the shading kernel can write to
+    // The shading kernels add the light each ray brings to its pixel's color in this buffer. Once rays
+    // are compacted, the threads of these kernels no longer map to pixels, so they can't write to a
+    // texture at their thread position.
+    _radianceBuffer = [_device newBufferWithLength:sizeof(float3) * rayCount options:MTLResourceStorageModePrivate];
+    
+    // Compacting rays needs a count per block of rays, and indirect dispatch arguments for every bounce
+    // after the first, whose number of rays is only known on the GPU
+    NSUInteger blockCount = (rayCount + COMPACTION_BLOCK_SIZE - 1) / COMPACTION_BLOCK_SIZE;
+    
+    _blockCountBuffer = [_device newBufferWithLength:sizeof(uint32_t) * MAX(blockCount, 1)
+                                             options:MTLResourceStorageModePrivate];
+    _dispatchArgumentBuffer = [_device newBufferWithLength:sizeof(BounceDispatchArguments) * MAX_BOUNCES
+                                                   options:MTLResourceStorageModePrivate];
+    
+    // Create render targets which the accumulation kernel can write to
     MTLTextureDescriptor *renderTargetDescriptor = [[MTLTextureDescriptor alloc] init];
     
     renderTargetDescriptor.pixelFormat = MTLPixelFormatRGBA32Float;
@@ -292,10 +362,8 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     // Indicate that we will read and write the texture from the GPU
     renderTargetDescriptor.usage = MTLTextureUsageShaderRead | MTLTextureUsageShaderWrite;
     
-    for (NSUInteger i = 0; i < 2; i++) {
-        _renderTargets[i] = [_device newTextureWithDescriptor:renderTargetDescriptor];
+    for (NSUInteger i = 0; i < 2; i++)
         _accumulationTargets[i] = [_device newTextureWithDescriptor:renderTargetDescriptor];
-    }
     
     renderTargetDescriptor.pixelFormat = MTLPixelFormatR32Uint;
     renderTargetDescriptor.usage = MTLTextureUsageShaderRead;
@@ -325,6 +393,33 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     _frameIndex = 0;
 }
 
+- (void)setMaxBounces:(unsigned int)maxBounces {
+    maxBounces = MIN(MAX(maxBounces, 1u), (unsigned int)MAX_BOUNCES);
+    
+    if (maxBounces != _maxBounces) {
+        _maxBounces = maxBounces;
+        
+        // Frames rendered with a different number of bounces converge to a different image
+        _frameIndex = 0;
+    }
+}
+
+// The first bounce has a ray for every pixel, so its threadgroups are known on the CPU. The rays of the
+// following bounces have been compacted on the GPU, which also wrote the threadgroups to launch for them.
+- (void)dispatchRayThreadgroups:(MTLSize)threadgroups
+          threadsPerThreadgroup:(MTLSize)threadsPerThreadgroup
+                         bounce:(unsigned int)bounce
+                 argumentOffset:(NSUInteger)argumentOffset
+                      onEncoder:(id <MTLComputeCommandEncoder>)computeEncoder
+{
+    if (bounce == 0)
+        [computeEncoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+    else
+        [computeEncoder dispatchThreadgroupsWithIndirectBuffer:_dispatchArgumentBuffer
+                                          indirectBufferOffset:argumentOffset
+                                         threadsPerThreadgroup:threadsPerThreadgroup];
+}
+
 - (void)updateUniforms {
     // Update this frame's uniforms
     _uniformBufferOffset = alignedUniformsSize * _uniformBufferIndex;
@@ -360,6 +455,15 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     [_uniformBuffer didModifyRange:NSMakeRange(_uniformBufferOffset, alignedUniformsSize)];
 #endif
     
+    // The first bounce has one ray per pixel. The compaction kernels write the number of rays of
+    // each following bounce.
+    _rayCountBufferOffset = alignedRayCountsSize * _uniformBufferIndex;
+    
+    uint32_t *rayCounts = (uint32_t *)((char *)_rayCountBuffer.contents + _rayCountBufferOffset);
+    
+    for (unsigned int bounce = 0; bounce < MAX_BOUNCES; bounce++)
+        rayCounts[bounce] = bounce == 0 ? uniforms->width * uniforms->height : 0;
+    
     // Advance to the next slot in the uniform buffer
     _uniformBufferIndex = (_uniformBufferIndex + 1) % maxFramesInFlight;
 }
@@ -373,14 +477,28 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     // Create a command buffer which will contain our GPU commands
     id <MTLCommandBuffer> commandBuffer = [_queue commandBuffer];
 
-    // When the frame has finished, signal that we can reuse the uniform buffer space from this frame.
-    // Note that the contents of completion handlers should be as fast as possible as the GPU driver may
-    // have other work scheduled on the underlying dispatch queue.
+    [self updateUniforms];
+    
+    NSUInteger rayCountBufferOffset = _rayCountBufferOffset;
+    unsigned int bounceCount = _maxBounces;
+    
+    // When the frame has finished, read back how many rays each bounce intersected, then signal that we can
+    // reuse the uniform and ray count buffer space from this frame. The counts must be read first: once the
+    // semaphore is signaled, the next frame may reset them. Paths end as they leave the scene or lose the
+    // Russian roulette, so later bounces have fewer rays. Note that the contents of completion handlers should
+    // be as fast as possible as the GPU driver may have other work scheduled on the underlying dispatch queue.
     [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+        const uint32_t *rayCounts = (const uint32_t *)((char *)self->_rayCountBuffer.contents + rayCountBufferOffset);
+        
+        NSMutableArray<NSNumber *> *activeRayCounts = [NSMutableArray arrayWithCapacity:bounceCount];
+        
+        for (unsigned int bounce = 0; bounce < bounceCount; bounce++)
+            [activeRayCounts addObject:@(rayCounts[bounce])];
+        
+        self.activeRayCounts = activeRayCounts;
+        
         dispatch_semaphore_signal(self->_sem);
     }];
-
-    [self updateUniforms];
     
     NSUInteger width = (NSUInteger)_size.width;
     NSUInteger height = (NSUInteger)_size.height;
@@ -403,9 +521,9 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     // Bind buffers needed by the compute pipeline
     [computeEncoder setBuffer:_uniformBuffer   offset:_uniformBufferOffset atIndex:0];
     [computeEncoder setBuffer:_rayBuffer       offset:0                    atIndex:1];
+    [computeEncoder setBuffer:_radianceBuffer  offset:0                    atIndex:2];
     
     [computeEncoder setTexture:_randomTexture    atIndex:0];
-    [computeEncoder setTexture:_renderTargets[0] atIndex:1];
     
     // Bind the ray generation compute pipeline
     [computeEncoder setComputePipelineState:_rayPipeline];
@@ -416,18 +534,35 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     // End the encoder
     [computeEncoder endEncoding];
     
+    // After the first bounce, the kernels only run over the rays which are still active, so they use
+    // a 1D grid of threads. Each thread finds its pixel from the pixel index stored in its ray.
+    MTLSize rayThreadsPerThreadgroup = MTLSizeMake(RAY_THREADGROUP_SIZE, 1, 1);
+    MTLSize rayThreadgroups = MTLSizeMake((width * height + RAY_THREADGROUP_SIZE - 1) / RAY_THREADGROUP_SIZE, 1, 1);
+    
+    MTLSize compactionThreadsPerThreadgroup = MTLSizeMake(COMPACTION_BLOCK_SIZE, 1, 1);
+    MTLSize compactionThreadgroups = MTLSizeMake((width * height + COMPACTION_BLOCK_SIZE - 1) / COMPACTION_BLOCK_SIZE, 1, 1);
+    
     // We will iterate over the next few kernels several times to allow light to bounce around the scene
-    for (int bounce = 0; bounce < 3; bounce++) {
+    for (unsigned int bounce = 0; bounce < bounceCount; bounce++) {
+        // The number of rays of this bounce, and where the threadgroups to launch for them are stored.
+        // Only the first bounce's are known on the CPU, the others are written by the compaction
+        // kernels at the end of the previous bounce.
+        NSUInteger rayCountOffset = _rayCountBufferOffset + sizeof(uint32_t) * bounce;
+        NSUInteger dispatchArgumentOffset = sizeof(BounceDispatchArguments) * bounce;
+        
         _intersector.intersectionDataType = MPSIntersectionDataTypeDistancePrimitiveIndexCoordinates;
 
-        // We can then pass the rays to the MPSRayIntersector to compute the intersections with our acceleration structure
+        // We can then pass the rays to the MPSRayIntersector to compute the intersections with our acceleration
+        // structure. The intersector reads the number of rays from a buffer, so the GPU doesn't have to wait for
+        // the CPU to find out how many rays are left.
         [_intersector encodeIntersectionToCommandBuffer:commandBuffer               // Command buffer to encode into
                                        intersectionType:MPSIntersectionTypeNearest  // Intersection test type
                                               rayBuffer:_rayBuffer                  // Ray buffer
                                         rayBufferOffset:0                           // Offset into ray buffer
                                      intersectionBuffer:_intersectionBuffer         // Intersection buffer (destination)
                                intersectionBufferOffset:0                           // Offset into intersection buffer
-                                               rayCount:width * height              // Number of rays
+                                         rayCountBuffer:_rayCountBuffer             // Buffer containing the number of rays
+                                   rayCountBufferOffset:rayCountOffset              // Offset into ray count buffer
                                   accelerationStructure:_accelerationStructure];    // Acceleration structure
         // We launch another pipeline to consume the intersection results and shade the scene
         computeEncoder = [commandBuffer computeCommandEncoder];
@@ -440,13 +575,18 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
         [computeEncoder setBuffer:_vertexNormalBuffer offset:0                    atIndex:5];
         [computeEncoder setBuffer:_triangleMaskBuffer offset:0                    atIndex:6];
         [computeEncoder setBytes:&bounce              length:sizeof(bounce)       atIndex:7];
+        [computeEncoder setBuffer:_rayCountBuffer     offset:rayCountOffset       atIndex:8];
+        [computeEncoder setBuffer:_radianceBuffer     offset:0                    atIndex:9];
         
         [computeEncoder setTexture:_randomTexture    atIndex:0];
-        [computeEncoder setTexture:_renderTargets[0] atIndex:1];
         
         [computeEncoder setComputePipelineState:_shadePipeline];
         
-        [computeEncoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+        [self dispatchRayThreadgroups:rayThreadgroups
+                threadsPerThreadgroup:rayThreadsPerThreadgroup
+                               bounce:bounce
+                       argumentOffset:dispatchArgumentOffset + offsetof(BounceDispatchArguments, rays)
+                            onEncoder:computeEncoder];
         
         [computeEncoder endEncoding];
         
@@ -464,29 +604,71 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
                                         rayBufferOffset:0
                                      intersectionBuffer:_intersectionBuffer
                                intersectionBufferOffset:0
-                                               rayCount:width * height
+                                         rayCountBuffer:_rayCountBuffer
+                                   rayCountBufferOffset:rayCountOffset
                                   accelerationStructure:_accelerationStructure];
         
-        // Finally, we launch a kernel which writes the color computed by the shading kernel into the
-        // output image, but only if the corresponding shadow ray does not intersect anything on the way to
-        // the light. If the shadow ray intersects a triangle before reaching the light source, the original
-        // intersection point was in shadow.
+        // Finally, we launch a kernel which adds the color computed by the shading kernel to the
+        // radiance buffer, but only if the corresponding shadow ray does not intersect anything on the
+        // way to the light. If the shadow ray intersects a triangle before reaching the light source, the
+        // original intersection point was in shadow.
         computeEncoder = [commandBuffer computeCommandEncoder];
         
         [computeEncoder setBuffer:_uniformBuffer      offset:_uniformBufferOffset atIndex:0];
         [computeEncoder setBuffer:_shadowRayBuffer    offset:0                    atIndex:1];
         [computeEncoder setBuffer:_intersectionBuffer offset:0                    atIndex:2];
-        
-        [computeEncoder setTexture:_renderTargets[0] atIndex:0];
-        [computeEncoder setTexture:_renderTargets[1] atIndex:1];
+        [computeEncoder setBuffer:_rayCountBuffer     offset:rayCountOffset       atIndex:3];
+        [computeEncoder setBuffer:_radianceBuffer     offset:0                    atIndex:4];
         
         [computeEncoder setComputePipelineState:_shadowPipeline];
         
-        [computeEncoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+        [self dispatchRayThreadgroups:rayThreadgroups
+                threadsPerThreadgroup:rayThreadsPerThreadgroup
+                               bounce:bounce
+                       argumentOffset:dispatchArgumentOffset + offsetof(BounceDispatchArguments, rays)
+                            onEncoder:computeEncoder];
+        
+        [computeEncoder endEncoding];
+        
+        if (bounce + 1 == bounceCount)
+            break;
+        
+        // Move the rays still active to the front of the other ray buffer, so that the next bounce
+        // doesn't spend any time on the paths which have ended. This also writes the next bounce's
+        // ray count and the threadgroups to launch for it.
+        computeEncoder = [commandBuffer computeCommandEncoder];
+        
+        NSUInteger nextDispatchArgumentOffset = dispatchArgumentOffset + sizeof(BounceDispatchArguments);
+        
+        [computeEncoder setBuffer:_rayBuffer              offset:0                          atIndex:0];
+        [computeEncoder setBuffer:_rayCountBuffer         offset:rayCountOffset             atIndex:1];
+        [computeEncoder setBuffer:_blockCountBuffer       offset:0                          atIndex:2];
+        [computeEncoder setBuffer:_compactedRayBuffer     offset:0                          atIndex:3];
+        [computeEncoder setBuffer:_dispatchArgumentBuffer offset:nextDispatchArgumentOffset atIndex:4];
+        
+        [computeEncoder setComputePipelineState:_compactionCountPipeline];
+        
+        [self dispatchRayThreadgroups:compactionThreadgroups
+                threadsPerThreadgroup:compactionThreadsPerThreadgroup
+                               bounce:bounce
+                       argumentOffset:dispatchArgumentOffset + offsetof(BounceDispatchArguments, compactionBlocks)
+                            onEncoder:computeEncoder];
+        
+        [computeEncoder setComputePipelineState:_compactionScanPipeline];
+        
+        [computeEncoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:compactionThreadsPerThreadgroup];
+        
+        [computeEncoder setComputePipelineState:_compactionScatterPipeline];
+        
+        [self dispatchRayThreadgroups:compactionThreadgroups
+                threadsPerThreadgroup:compactionThreadsPerThreadgroup
+                               bounce:bounce
+                       argumentOffset:dispatchArgumentOffset + offsetof(BounceDispatchArguments, compactionBlocks)
+                            onEncoder:computeEncoder];
         
         [computeEncoder endEncoding];
         
-        std::swap(_renderTargets[0], _renderTargets[1]);
+        std::swap(_rayBuffer, _compactedRayBuffer);
     }
 
     // The final kernel averages the current frame's image with all previous frames to reduce noise due
@@ -494,10 +676,10 @@ static const size_t intersectionStride = sizeof(MPSIntersectionDistancePrimitive
     computeEncoder = [commandBuffer computeCommandEncoder];
         
     [computeEncoder setBuffer:_uniformBuffer      offset:_uniformBufferOffset atIndex:0];
+    [computeEncoder setBuffer:_radianceBuffer     offset:0                    atIndex:1];
     
-    [computeEncoder setTexture:_renderTargets[0]       atIndex:0];
-    [computeEncoder setTexture:_accumulationTargets[0] atIndex:1];
-    [computeEncoder setTexture:_accumulationTargets[1] atIndex:2];
+    [computeEncoder setTexture:_accumulationTargets[0] atIndex:0];
+    [computeEncoder setTexture:_accumulationTargets[1] atIndex:1];
     
     [computeEncoder setComputePipelineState:_accumulatePipeline];
     
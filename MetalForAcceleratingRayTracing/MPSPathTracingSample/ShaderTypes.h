@@ -17,6 +17,18 @@ Header containing types and enum constants shared between Metal shaders and Swif
 #define RAY_MASK_SHADOW    1
 #define RAY_MASK_SECONDARY 1
 
+// Most bounces a path can take. Every bounce uses four dimensions of the Halton sequence.
+#define MAX_BOUNCES 8
+
+// First bounce whose paths can end by Russian roulette
+#define RUSSIAN_ROULETTE_START_BOUNCE 2
+
+// Threads per threadgroup of the kernels which run over a bounce's rays
+#define RAY_THREADGROUP_SIZE 64
+
+// Rays compacted by each threadgroup of the compaction kernels
+#define COMPACTION_BLOCK_SIZE 256
+
 struct Camera {
     vector_float3 position;
     vector_float3 right;
@@ -32,6 +44,17 @@ struct AreaLight {
     vector_float3 color;
 };
 
+// Layout of MTLDispatchThreadgroupsIndirectArguments
+struct DispatchArguments {
+    unsigned int threadgroupsPerGrid[3];
+};
+
+// Threadgroups to launch for the rays of a bounce after the first, written when compacting its rays
+struct BounceDispatchArguments {
+    DispatchArguments rays;             // RAY_THREADGROUP_SIZE threads per threadgroup
+    DispatchArguments compactionBlocks; // COMPACTION_BLOCK_SIZE threads per threadgroup
+};
+
 struct Uniforms
 {
     unsigned int width;
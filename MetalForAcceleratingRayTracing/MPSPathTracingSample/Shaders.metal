@@ -31,7 +31,11 @@ struct Ray {
     float maxDistance;
     
     // The accumulated color along the ray's path so far
-    float3 color;
+    packed_float3 color;
+    
+    // Index of the pixel the ray's path started from. Rays are compacted between bounces,
+    // so a ray's index in the ray buffer is only its pixel's index for camera rays.
+    unsigned int pixelIndex;
 };
 
 // Represents an intersection between a ray and the scene, returned by the MPSRayIntersector.
@@ -51,12 +55,20 @@ struct Intersection {
 };
 
 constant unsigned int primes[] = {
-    2,   3,  5,  7,
-    11, 13, 17, 19,
-    23, 29, 31, 37,
-    41, 43, 47, 53,
+    2,     3,   5,   7,
+    11,   13,  17,  19,
+    23,   29,  31,  37,
+    41,   43,  47,  53,
+    59,   61,  67,  71,
+    73,   79,  83,  89,
+    97,  101, 103, 107,
+    109, 113, 127, 131,
+    137, 139,
 };
 
+static_assert(sizeof(primes) / sizeof(primes[0]) >= 2 + MAX_BOUNCES * 4,
+              "Every bounce needs four dimensions of the Halton sequence");
+
 // Returns the i'th element of the Halton sequence using the d'th prime number as a
 // base. The Halton sequence is a "low discrepency" sequence: the values appear
 // random but are more evenly distributed then a purely random sequence. Each random
@@ -80,6 +92,22 @@ float halton(unsigned int i, unsigned int d) {
     return r;
 }
 
+// Returns a uniformly random number for the i'th sample of a given bounce by hashing both.
+// Unlike the Halton sequence, whose dimensions with large bases only slowly cover the unit
+// interval as 'i' increases, a hash is as likely to be below any value from one frame to the
+// next, so it's used for Russian roulette, whose decisions are made from a single number.
+float hashedRandom(unsigned int i, unsigned int bounce) {
+    unsigned int x = i * MAX_BOUNCES + bounce;
+    
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
 // Generates rays starting from the camera origin and traveling towards the image plane aligned
 // with the camera's coordinate system.
 kernel void rayKernel(uint2 tid [[thread_position_in_grid]],
@@ -88,8 +116,8 @@ kernel void rayKernel(uint2 tid [[thread_position_in_grid]],
                       // used for writable data or data which will only be used by a single thread.
                       constant Uniforms & uniforms,
                       device Ray *rays,
-                      texture2d<unsigned int> randomTex,
-                      texture2d<float, access::write> dstTex)
+                      device float3 *radiance,
+                      texture2d<unsigned int> randomTex)
 {
     // Since we aligned the thread count to the threadgroup size, the thread index may be out of bounds
     // of the render target size.
@@ -135,8 +163,10 @@ kernel void rayKernel(uint2 tid [[thread_position_in_grid]],
         // is absorbed into surfaces.
         ray.color = float3(1.0f, 1.0f, 1.0f);
         
-        // Clear the destination image to black
-        dstTex.write(float4(0.0f, 0.0f, 0.0f, 0.0f), tid);
+        ray.pixelIndex = rayIdx;
+        
+        // Clear the pixel's color to black
+        radiance[rayIdx] = float3(0.0f, 0.0f, 0.0f);
     }
 }
 
@@ -234,8 +264,9 @@ inline float3 alignHemisphereWithNormal(float3 sample, float3 normal) {
     return sample.x * right + sample.y * up + sample.z * forward;
 }
 
-// Consumes ray/triangle intersection results to compute the shaded image
-kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
+// Consumes ray/triangle intersection results to compute the shaded image. There is one thread
+// per ray still active at this bounce.
+kernel void shadeKernel(uint tid [[thread_position_in_grid]],
                         constant Uniforms & uniforms,
                         device Ray *rays,
                         device Ray *shadowRays,
@@ -244,14 +275,19 @@ kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
                         device float3 *vertexNormals,
                         device uint *triangleMasks,
                         constant unsigned int & bounce,
-                        texture2d<unsigned int> randomTex,
-                        texture2d<float, access::write> dstTex)
+                        device const unsigned int & rayCount,
+                        device float3 *radiance,
+                        texture2d<unsigned int> randomTex)
 {
-    if (tid.x < uniforms.width && tid.y < uniforms.height) {
-        unsigned int rayIdx = tid.y * uniforms.width + tid.x;
-        device Ray & ray = rays[rayIdx];
-        device Ray & shadowRay = shadowRays[rayIdx];
-        device Intersection & intersection = intersections[rayIdx];
+    if (tid < rayCount) {
+        device Ray & ray = rays[tid];
+        device Ray & shadowRay = shadowRays[tid];
+        device Intersection & intersection = intersections[tid];
+        
+        unsigned int pixelIndex = ray.pixelIndex;
+        uint2 pixel = uint2(pixelIndex % uniforms.width, pixelIndex / uniforms.width);
+        
+        shadowRay.pixelIndex = pixelIndex;
         
         float3 color = ray.color;
         
@@ -271,7 +307,7 @@ kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
                 float3 surfaceNormal = interpolateVertexAttribute(vertexNormals, intersection);
                 surfaceNormal = normalize(surfaceNormal);
 
-                unsigned int offset = randomTex.read(tid).x;
+                unsigned int offset = randomTex.read(pixel).x;
                 
                 // Look up two random numbers for this thread
                 float2 r = float2(halton(offset + uniforms.frameIndex, 2 + bounce * 4 + 0),
@@ -316,6 +352,23 @@ kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
                 // output image if needed.
                 shadowRay.color = lightColor * color;
                 
+                // Paths which have lost most of their color to the surfaces they bounced off can
+                // only add a little more light to the image. Russian roulette ends such paths at
+                // random, with a probability of one minus the brightest channel of their color,
+                // and brightens the paths which continue to make up for the ones which ended.
+                // The image converges to the same result, but fewer rays are left to trace in
+                // the following bounces.
+                if (bounce >= RUSSIAN_ROULETTE_START_BOUNCE) {
+                    float survivalProbability = min(max(max(color.x, color.y), color.z), 1.0f);
+                    
+                    if (hashedRandom(offset + uniforms.frameIndex, bounce) >= survivalProbability) {
+                        ray.maxDistance = -1.0f;
+                        return;
+                    }
+                    
+                    color /= survivalProbability;
+                }
+                
                 // Next we choose a random direction to continue the path of the ray. This will
                 // cause light to bounce between surfaces. Normally we would apply a fair bit of math
                 // to compute the fraction of reflected by the current intersection point to the
@@ -338,7 +391,7 @@ kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
             else {
                 // In this case, a ray coming from the camera hit the light source directly, so
                 // we'll write the light color into the output image.
-                dstTex.write(float4(uniforms.light.color, 1.0f), tid);
+                radiance[pixelIndex] = uniforms.light.color;
                 
                 // Terminate the ray's path
                 ray.maxDistance = -1.0f;
@@ -355,45 +408,151 @@ kernel void shadeKernel(uint2 tid [[thread_position_in_grid]],
 
 // Checks if a shadow ray hit something on the way to the light source. If not, the point the
 // shadow ray started from was not in shadow so it's color should be added to the output image.
-kernel void shadowKernel(uint2 tid [[thread_position_in_grid]],
+kernel void shadowKernel(uint tid [[thread_position_in_grid]],
                          constant Uniforms & uniforms,
                          device Ray *shadowRays,
                          device float *intersections,
-                         texture2d<float, access::read> srcTex,
-                         texture2d<float, access::write> dstTex)
+                         device const unsigned int & rayCount,
+                         device float3 *radiance)
 {
-    if (tid.x < uniforms.width && tid.y < uniforms.height) {
-        unsigned int rayIdx = tid.y * uniforms.width + tid.x;
-        device Ray & shadowRay = shadowRays[rayIdx];
+    if (tid < rayCount) {
+        device Ray & shadowRay = shadowRays[tid];
         
         // Use the MPSRayIntersection intersectionDataType property to return the
         // intersection distance for this kernel only. You don't need the other fields, so
         // you'll save memory bandwidth.
-        float intersectionDistance = intersections[rayIdx];
-        
-        float3 color = srcTex.read(tid).xyz;
+        float intersectionDistance = intersections[tid];
         
         // If the shadow ray wasn't disabled (max distance >= 0) and it didn't hit anything
         // on the way to the light source, add the color passed along with the shadow ray
-        // to the output image.
+        // to the output image. Each pixel has at most one ray per bounce, so no other
+        // thread writes to the same pixel.
         if (shadowRay.maxDistance >= 0.0f && intersectionDistance < 0.0f)
-            color += shadowRay.color;
+            radiance[shadowRay.pixelIndex] += float3(shadowRay.color);
+    }
+}
+
+// Replaces the COMPACTION_BLOCK_SIZE values in threadgroup memory with their inclusive prefix
+// sum, adding each value to the ones after it in log2(COMPACTION_BLOCK_SIZE) steps. Every
+// thread of the threadgroup must call this with its index in the threadgroup.
+inline void threadgroupPrefixSum(threadgroup unsigned int *values, unsigned int lid) {
+    for (unsigned int stride = 1; stride < COMPACTION_BLOCK_SIZE; stride *= 2) {
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        unsigned int value = lid >= stride ? values[lid - stride] : 0;
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        values[lid] += value;
+    }
+    
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+}
+
+// The next three kernels compact the rays still active after a bounce into a dense ray buffer,
+// so that the following bounce only intersects and shades those rays. They work on blocks of
+// COMPACTION_BLOCK_SIZE rays, one per threadgroup, and keep the rays in the same order.
+//
+// First, count the active rays of each block.
+kernel void compactionCountKernel(uint tid [[thread_position_in_grid]],
+                                  uint lid [[thread_position_in_threadgroup]],
+                                  uint blockIdx [[threadgroup_position_in_grid]],
+                                  device Ray *rays [[buffer(0)]],
+                                  device unsigned int *rayCounts [[buffer(1)]],
+                                  device unsigned int *blockCounts [[buffer(2)]])
+{
+    threadgroup unsigned int counts[COMPACTION_BLOCK_SIZE];
+    
+    counts[lid] = tid < rayCounts[0] && rays[tid].maxDistance >= 0.0f ? 1 : 0;
+    
+    // Sum the counts in log2(COMPACTION_BLOCK_SIZE) steps
+    for (unsigned int stride = COMPACTION_BLOCK_SIZE / 2; stride > 0; stride /= 2) {
+        threadgroup_barrier(mem_flags::mem_threadgroup);
         
-        // Write result to render target
-        dstTex.write(float4(color, 1.0f), tid);
+        if (lid < stride)
+            counts[lid] += counts[lid + stride];
     }
+    
+    if (lid == 0)
+        blockCounts[blockIdx] = counts[0];
+}
+
+// Second, a single threadgroup turns the block counts into their exclusive prefix sum: the
+// index in the compacted ray buffer of each block's first active ray. The total is the next
+// bounce's ray count, from which this kernel also computes the threadgroups the next bounce
+// will launch.
+kernel void compactionScanKernel(uint lid [[thread_position_in_threadgroup]],
+                                 device unsigned int *rayCounts [[buffer(1)]],
+                                 device unsigned int *blockCounts [[buffer(2)]],
+                                 device BounceDispatchArguments & nextBounceArguments [[buffer(4)]])
+{
+    threadgroup unsigned int sums[COMPACTION_BLOCK_SIZE];
+    
+    unsigned int blockCount = (rayCounts[0] + COMPACTION_BLOCK_SIZE - 1) / COMPACTION_BLOCK_SIZE;
+    unsigned int total = 0;
+    
+    for (unsigned int firstBlock = 0; firstBlock < blockCount; firstBlock += COMPACTION_BLOCK_SIZE) {
+        unsigned int block = firstBlock + lid;
+        unsigned int count = block < blockCount ? blockCounts[block] : 0;
+        
+        sums[lid] = count;
+        
+        threadgroupPrefixSum(sums, lid);
+        
+        if (block < blockCount)
+            blockCounts[block] = total + sums[lid] - count;
+        
+        total += sums[COMPACTION_BLOCK_SIZE - 1];
+        
+        // Wait until every thread has read the sums before they are overwritten
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+    
+    if (lid == 0) {
+        rayCounts[1] = total;
+        
+        nextBounceArguments.rays.threadgroupsPerGrid[0] = (total + RAY_THREADGROUP_SIZE - 1) / RAY_THREADGROUP_SIZE;
+        nextBounceArguments.rays.threadgroupsPerGrid[1] = 1;
+        nextBounceArguments.rays.threadgroupsPerGrid[2] = 1;
+        
+        nextBounceArguments.compactionBlocks.threadgroupsPerGrid[0] = (total + COMPACTION_BLOCK_SIZE - 1) / COMPACTION_BLOCK_SIZE;
+        nextBounceArguments.compactionBlocks.threadgroupsPerGrid[1] = 1;
+        nextBounceArguments.compactionBlocks.threadgroupsPerGrid[2] = 1;
+    }
+}
+
+// Finally, copy each active ray to its block's first index plus the number of active rays
+// before it in the block.
+kernel void compactionScatterKernel(uint tid [[thread_position_in_grid]],
+                                    uint lid [[thread_position_in_threadgroup]],
+                                    uint blockIdx [[threadgroup_position_in_grid]],
+                                    device Ray *rays [[buffer(0)]],
+                                    device unsigned int *rayCounts [[buffer(1)]],
+                                    device unsigned int *blockOffsets [[buffer(2)]],
+                                    device Ray *compactedRays [[buffer(3)]])
+{
+    threadgroup unsigned int offsets[COMPACTION_BLOCK_SIZE];
+    
+    bool active = tid < rayCounts[0] && rays[tid].maxDistance >= 0.0f;
+    
+    offsets[lid] = active ? 1 : 0;
+    
+    threadgroupPrefixSum(offsets, lid);
+    
+    if (active)
+        compactedRays[blockOffsets[blockIdx] + offsets[lid] - 1] = rays[tid];
 }
 
 // Accumulates the current frame's image with a running average of all previous frames to
 // reduce noise over time.
 kernel void accumulateKernel(uint2 tid [[thread_position_in_grid]],
                              constant Uniforms & uniforms,
-                             texture2d<float> renderTex,
+                             device float3 *radiance,
                              texture2d<float> prevTex,
                              texture2d<float, access::write> accumTex)
 {
     if (tid.x < uniforms.width && tid.y < uniforms.height) {
-        float3 color = renderTex.read(tid).xyz;
+        float3 color = radiance[tid.y * uniforms.width + tid.x];
 
         // Compute the average of all frames including the current frame
         if (uniforms.frameIndex > 0) {
@@ -0,0 +1,337 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the BVH builder and of the CPU ray intersector on random triangle soups, from no triangle at all to
+ enough triangles for parallel builds. Every BVH must reference each triangle once, in leaves no larger than
+ the options allow, with bounds containing their triangles and children. The nearest hit of every ray must
+ match a test of the ray against every triangle, also for a binary BVH too deep for the traversal stacks.
+*/
+
+#include "BVH.h"
+#include "RayIntersector.h"
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Same size as vector_float3, the sample's vertex type
+struct Vertex {
+    float position[3];
+    float padding;
+};
+
+int failures = 0;
+
+void check(bool condition, const char *format, ...) {
+    if (condition)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, arguments);
+    fprintf(stderr, "\n");
+    va_end(arguments);
+
+    failures++;
+}
+
+// Small triangles scattered in a unit cube
+std::vector<Vertex> makeTriangleSoup(size_t triangleCount, std::mt19937 & generator) {
+    std::uniform_real_distribution<float> position(0.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(-0.05f, 0.05f);
+
+    std::vector<Vertex> vertices(3 * triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        float center[3] = { position(generator), position(generator), position(generator) };
+
+        for (int corner = 0; corner < 3; corner++) {
+            for (int axis = 0; axis < 3; axis++)
+                vertices[3 * i + corner].position[axis] = center[axis] + offset(generator);
+            vertices[3 * i + corner].padding = 0.0f;
+        }
+    }
+
+    return vertices;
+}
+
+bool contains(const BVHNode & node, const float point[3]) {
+    for (int axis = 0; axis < 3; axis++) {
+        if (point[axis] < node.boundsMin[axis] || point[axis] > node.boundsMax[axis])
+            return false;
+    }
+
+    return true;
+}
+
+bool contains(const BVHNode & outer, const BVHNode & inner) {
+    return contains(outer, inner.boundsMin) && contains(outer, inner.boundsMax);
+}
+
+// Returns the number of triangles below nodeIndex
+size_t checkNode(const BVH & bvh, const std::vector<Vertex> & vertices, const BVHBuildOptions & options,
+                 uint32_t nodeIndex, std::vector<unsigned int> & references)
+{
+    const BVHNode & node = bvh.nodes[nodeIndex];
+
+    if (node.triangleCount) {
+        check(node.triangleCount <= options.maxLeafSize, "leaf %u has %u triangles", nodeIndex, node.triangleCount);
+        check(node.offset + node.triangleCount <= bvh.triangleIndices.size(), "leaf %u is out of range", nodeIndex);
+
+        for (uint32_t i = node.offset; i < node.offset + node.triangleCount && i < bvh.triangleIndices.size(); i++) {
+            uint32_t triangle = bvh.triangleIndices[i];
+            check(triangle < references.size(), "leaf %u references triangle %u", nodeIndex, triangle);
+            if (triangle >= references.size())
+                continue;
+
+            references[triangle]++;
+            for (int corner = 0; corner < 3; corner++)
+                check(contains(node, vertices[3 * triangle + corner].position), "triangle %u is outside of leaf %u",
+                      triangle, nodeIndex);
+        }
+
+        return node.triangleCount;
+    }
+
+    check(node.offset > nodeIndex && node.offset + 1 < bvh.nodes.size(), "node %u has children %u and %u",
+          nodeIndex, node.offset, node.offset + 1);
+    if (node.offset <= nodeIndex || node.offset + 1 >= bvh.nodes.size())
+        return 0;
+
+    check(contains(node, bvh.nodes[node.offset]) && contains(node, bvh.nodes[node.offset + 1]),
+          "the children of node %u are outside of it", nodeIndex);
+
+    return checkNode(bvh, vertices, options, node.offset, references) +
+           checkNode(bvh, vertices, options, node.offset + 1, references);
+}
+
+// Nearest hit of a ray against every triangle, with the same edge test as the intersector
+float nearestHitDistance(const std::vector<Vertex> & vertices, const RayOriginMaskDirectionMaxDistance & ray,
+                         uint32_t *primitiveIndex)
+{
+    float nearest = INFINITY;
+    *primitiveIndex = UINT32_MAX;
+
+    for (uint32_t triangle = 0; triangle < vertices.size() / 3; triangle++) {
+        const float *v0 = vertices[3 * triangle].position;
+        const float *v1 = vertices[3 * triangle + 1].position;
+        const float *v2 = vertices[3 * triangle + 2].position;
+
+        float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+        float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+        const float *d = ray.direction;
+        float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+        float determinant = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (determinant == 0.0f)
+            continue;
+
+        float inverse = 1.0f / determinant;
+        float t[3] = { ray.origin[0] - v0[0], ray.origin[1] - v0[1], ray.origin[2] - v0[2] };
+        float u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) * inverse;
+        float q[3] = { t[1] * e1[2] - t[2] * e1[1], t[2] * e1[0] - t[0] * e1[2], t[0] * e1[1] - t[1] * e1[0] };
+        float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverse;
+        float distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverse;
+
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance >= 0.0f && distance <= ray.maxDistance &&
+            distance < nearest)
+        {
+            nearest = distance;
+            *primitiveIndex = triangle;
+        }
+    }
+
+    return nearest;
+}
+
+// Intersects rays from outside of the unit cube towards random points in it, in coherent groups of eight for the
+// packets, and compares their nearest hits with brute force. Returns the number of rays that hit.
+size_t checkIntersections(const WideBVH & wideBVH, const std::vector<Vertex> & vertices, const char *name,
+                          unsigned int threadCount, std::mt19937 & generator)
+{
+    const size_t rayCount = 512;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<RayOriginMaskDirectionMaxDistance> rays(rayCount);
+    for (size_t i = 0; i < rayCount; i++) {
+        RayOriginMaskDirectionMaxDistance & ray = rays[i];
+        float origin[3] = { -1.0f, 0.5f, 0.5f };
+        float target[3] = { unit(generator), unit(generator), unit(generator) };
+        float length = 0.0f;
+
+        for (int axis = 0; axis < 3; axis++) {
+            ray.origin[axis] = origin[axis];
+            ray.direction[axis] = target[axis] - origin[axis];
+            length += ray.direction[axis] * ray.direction[axis];
+        }
+        for (int axis = 0; axis < 3; axis++)
+            ray.direction[axis] /= std::sqrt(length);
+
+        ray.mask = ~0u;
+        ray.maxDistance = INFINITY;
+    }
+
+    size_t hits = 0;
+    for (bool usePackets : { false, true }) {
+        RayIntersectorOptions intersectorOptions;
+        intersectorOptions.usePackets = usePackets;
+        intersectorOptions.threadCount = threadCount;
+        std::vector<IntersectionDistancePrimitiveIndexCoordinates> intersections(rayCount);
+        intersectRays(wideBVH, intersectorOptions, rays.data(), intersections.data(), rayCount);
+
+        hits = 0;
+        for (size_t i = 0; i < rayCount; i++) {
+            uint32_t primitiveIndex;
+            float expected = nearestHitDistance(vertices, rays[i], &primitiveIndex);
+            const IntersectionDistancePrimitiveIndexCoordinates & intersection = intersections[i];
+
+            if (std::isinf(expected)) {
+                check(intersection.distance < 0.0f, "%s: ray %zu hits at %f instead of missing", name, i,
+                      intersection.distance);
+            }
+            else {
+                hits++;
+                check(std::fabs(intersection.distance - expected) <= 1e-4f * std::max(expected, 1.0f),
+                      "%s: ray %zu hits at %f instead of %f", name, i, intersection.distance, expected);
+            }
+        }
+    }
+
+    return hits;
+}
+
+void testSoup(size_t triangleCount, unsigned int threadCount, std::mt19937 & generator) {
+    std::vector<Vertex> vertices = makeTriangleSoup(triangleCount, generator);
+
+    BVHBuildOptions options;
+    options.threadCount = threadCount;
+    BVH bvh;
+    BVHBuildStatistics statistics;
+    buildBVH(vertices.data(), sizeof(Vertex), triangleCount, options, bvh, &statistics);
+
+    check(!bvh.nodes.empty(), "%zu triangles: no root", triangleCount);
+    check(bvh.triangleIndices.size() == triangleCount, "%zu triangles: %zu leaf triangles", triangleCount,
+          bvh.triangleIndices.size());
+    check(bvh.nodes.size() <= std::max<size_t>(2 * triangleCount, 1), "%zu triangles: %zu nodes", triangleCount,
+          bvh.nodes.size());
+
+    if (triangleCount == 0) {
+        check(bvh.nodes.size() == 1 && bvh.nodes[0].triangleCount == 0, "an empty BVH is not a single empty leaf");
+    }
+    else {
+        std::vector<unsigned int> references(triangleCount, 0);
+        size_t leafTriangles = checkNode(bvh, vertices, options, 0, references);
+        check(leafTriangles == triangleCount, "%zu triangles: %zu in the leaves", triangleCount, leafTriangles);
+        for (size_t i = 0; i < triangleCount; i++)
+            check(references[i] == 1, "%zu triangles: triangle %zu is referenced %u times", triangleCount, i,
+                  references[i]);
+    }
+
+    WideBVH wideBVH;
+    buildWideBVH(bvh, vertices.data(), sizeof(Vertex), nullptr, wideBVH);
+    check(triangleCount != 0 || wideBVH.nodes.empty(), "an empty BVH collapses to wide nodes");
+
+    char name[64];
+    snprintf(name, sizeof(name), "%zu triangles", triangleCount);
+    size_t hits = checkIntersections(wideBVH, vertices, name, threadCount, generator);
+
+    printf("%6zu triangles, %u threads: %5zu nodes, depth %2u, %4zu wide nodes, %3zu of 512 rays hit\n",
+           triangleCount, threadCount, statistics.nodeCount, statistics.maxDepth, wideBVH.nodes.size(), hits);
+}
+
+unsigned int wideDepth(const WideBVH & wideBVH, uint32_t nodeIndex) {
+    const WideBVHNode & node = wideBVH.nodes[nodeIndex];
+    unsigned int childDepth = 0;
+
+    for (unsigned int i = 0; i < 8; i++) {
+        if (!node.packetCounts[i] && node.bounds[0][0][i] <= node.bounds[0][1][i])
+            childDepth = std::max(childDepth, wideDepth(wideBVH, node.children[i]));
+    }
+
+    return childDepth + 1;
+}
+
+// A binary BVH the builder would not make: a chain peeling one triangle off per level, far deeper than the
+// traversal stacks allow. The collapser must bound the depth of the wide BVH without losing triangles.
+void testChain(size_t triangleCount, std::mt19937 & generator) {
+    std::vector<Vertex> vertices = makeTriangleSoup(triangleCount, generator);
+
+    BVH bvh;
+    bvh.nodes.resize(2 * triangleCount - 1);
+    bvh.triangleIndices.resize(triangleCount);
+
+    // Node 2 * i is the interior node of level i, or the last leaf; node 2 * i + 1 is the leaf of triangle i
+    for (size_t i = triangleCount; i-- > 0;) {
+        bvh.triangleIndices[i] = (uint32_t)i;
+
+        BVHNode & leaf = bvh.nodes[i + 1 < triangleCount ? 2 * i + 1 : 2 * i];
+        leaf.offset = (uint32_t)i;
+        leaf.triangleCount = 1;
+        leaf.splitAxis = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            leaf.boundsMin[axis] = INFINITY;
+            leaf.boundsMax[axis] = -INFINITY;
+            for (int corner = 0; corner < 3; corner++) {
+                leaf.boundsMin[axis] = std::min(leaf.boundsMin[axis], vertices[3 * i + corner].position[axis]);
+                leaf.boundsMax[axis] = std::max(leaf.boundsMax[axis], vertices[3 * i + corner].position[axis]);
+            }
+        }
+
+        if (i + 1 < triangleCount) {
+            BVHNode & node = bvh.nodes[2 * i];
+            const BVHNode & rest = bvh.nodes[2 * i + 2];
+            node.offset = (uint32_t)(2 * i + 1);
+            node.triangleCount = 0;
+            node.splitAxis = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                node.boundsMin[axis] = std::min(leaf.boundsMin[axis], rest.boundsMin[axis]);
+                node.boundsMax[axis] = std::max(leaf.boundsMax[axis], rest.boundsMax[axis]);
+            }
+        }
+    }
+
+    // Children are at offset and offset + 1, so the chain's leaf comes first and the rest of the chain second
+    std::vector<unsigned int> references(triangleCount, 0);
+    BVHBuildOptions options;
+    options.maxLeafSize = 1;
+    check(checkNode(bvh, vertices, options, 0, references) == triangleCount, "the chain loses triangles");
+
+    WideBVH wideBVH;
+    buildWideBVH(bvh, vertices.data(), sizeof(Vertex), nullptr, wideBVH);
+
+    unsigned int depth = wideDepth(wideBVH, 0);
+    check(depth <= maxWideBVHDepth, "the chain collapses to a wide BVH of depth %u", depth);
+
+    size_t packetTriangles = 0;
+    for (const TrianglePacket & packet : wideBVH.packets) {
+        for (unsigned int lane = 0; lane < 4; lane++)
+            packetTriangles += packet.masks[lane] != 0;
+    }
+    check(packetTriangles == triangleCount, "the chain collapses to %zu triangles instead of %zu", packetTriangles,
+          triangleCount);
+
+    size_t hits = checkIntersections(wideBVH, vertices, "chain", 1, generator);
+    printf("%6zu triangle chain: %5zu nodes, depth %zu, %4zu wide nodes of depth %u, %3zu of 512 rays hit\n",
+           triangleCount, bvh.nodes.size(), triangleCount, wideBVH.nodes.size(), depth, hits);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(1);
+
+    for (size_t triangleCount : { 0, 1, 2, 9, 100, 5000 })
+        testSoup(triangleCount, 1, generator);
+
+    // Large enough for parallel subtrees and parallel binning
+    testSoup(0, 4, generator);
+    testSoup(50000, 4, generator);
+
+    testChain(1000, generator);
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
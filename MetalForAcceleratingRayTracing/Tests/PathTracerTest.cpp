@@ -0,0 +1,195 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Regression render of the Cornell box with the CPU path tracer. Renders the same frames on one thread and on
+ several, with and without sorting the rays between bounces, and fails unless every render is byte for byte
+ the same image. Writes that image to a portable float map, which must read back unchanged, and checks it
+ looks like the Cornell box: finite, non-negative, with the red wall on the left and the green one on the right.
+ Usage: PathTracerTest [output.pfm] [image size] [frames]
+*/
+
+#include "BVH.h"
+#include "PathTracer.h"
+#include "RayIntersector.h"
+#include "TestScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *format, ...) {
+    if (condition)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, arguments);
+    fprintf(stderr, "\n");
+    va_end(arguments);
+
+    failures++;
+}
+
+// The camera and light of updateUniforms
+void makeCameraAndLight(unsigned int width, unsigned int height, PathTracerCamera & camera, PathTracerAreaLight & light) {
+    float fieldOfView = 45.0f * (3.14159265f / 180.0f);
+    float aspectRatio = (float)width / (float)height;
+    float imagePlaneHeight = std::tan(fieldOfView / 2.0f);
+    float imagePlaneWidth = aspectRatio * imagePlaneHeight;
+
+    camera = { { 0.0f, 1.0f, 3.38f }, { imagePlaneWidth, 0.0f, 0.0f }, { 0.0f, imagePlaneHeight, 0.0f },
+               { 0.0f, 0.0f, -1.0f } };
+    light = { { 0.0f, 1.98f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.25f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.25f },
+              { 4.0f, 4.0f, 4.0f } };
+}
+
+// Renders `frameCount` frames from the same random offsets and returns the accumulated image
+std::vector<float> render(const WideBVH & wideBVH, const PathTracerScene & scene, unsigned int size,
+                          unsigned int frameCount, const PathTracerOptions & options, PathTracer & pathTracer)
+{
+    PathTracerCamera camera;
+    PathTracerAreaLight light;
+    makeCameraAndLight(size, size, camera, light);
+
+    srand(1);
+    createPathTracer(size, size, pathTracer);
+
+    for (unsigned int frame = 0; frame < frameCount; frame++)
+        renderPathTracerFrame(wideBVH, scene, camera, light, options, pathTracer, nullptr);
+
+    return pathTracer.accumulationTarget;
+}
+
+// Reads the RGB floats of a little endian portable float map written by writePathTracerImage
+bool readImage(const char *path, unsigned int & width, unsigned int & height, std::vector<float> & pixels) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    float scale = 0.0f;
+    bool read = fscanf(file, "PF %u %u %f", &width, &height, &scale) == 3 && scale < 0.0f && fgetc(file) == '\n';
+    if (read) {
+        pixels.resize(3 * (size_t)width * height);
+        read = fread(pixels.data(), sizeof(float), pixels.size(), file) == pixels.size() && fgetc(file) == EOF;
+    }
+
+    fclose(file);
+    return read;
+}
+
+// Average color of the pixels in [x0, x1) x [y0, y1) of an RGBA image, rows from the bottom
+void averageColor(const std::vector<float> & image, unsigned int width, unsigned int x0, unsigned int x1,
+                  unsigned int y0, unsigned int y1, float color[3])
+{
+    color[0] = color[1] = color[2] = 0.0f;
+    for (unsigned int y = y0; y < y1; y++) {
+        for (unsigned int x = x0; x < x1; x++) {
+            for (int channel = 0; channel < 3; channel++)
+                color[channel] += image[4 * ((size_t)y * width + x) + channel];
+        }
+    }
+
+    for (int channel = 0; channel < 3; channel++)
+        color[channel] /= (float)((x1 - x0) * (y1 - y0));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "PathTracerTest.pfm";
+    unsigned int size = argc > 2 ? (unsigned int)std::max(atoi(argv[2]), 16) : 128;
+    unsigned int frameCount = argc > 3 ? (unsigned int)std::max(atoi(argv[3]), 1) : 8;
+
+    TestScene testScene;
+    createTestCornellBox(testScene);
+
+    BVHBuildOptions buildOptions;
+    BVH bvh;
+    buildBVH(testScene.vertices.data(), sizeof(TestFloat3), testScene.triangleCount(), buildOptions, bvh, nullptr);
+
+    WideBVH wideBVH;
+    buildWideBVH(bvh, testScene.vertices.data(), sizeof(TestFloat3), testScene.masks.data(), wideBVH);
+
+    PathTracerScene scene;
+    scene.vertexNormals = testScene.normals.data();
+    scene.vertexColors = testScene.colors.data();
+    scene.vertexStride = sizeof(TestFloat3);
+    scene.triangleMasks = testScene.masks.data();
+
+    // Every bounce, with Russian roulette ending paths from the second one, so compaction has rays to drop
+    PathTracerOptions options;
+    options.bounceCount = pathTracerMaxBounceCount;
+    options.russianRouletteStartBounce = 2;
+
+    const unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 4u);
+    printf("%ux%u pixels, %u frames of %u bounces\n", size, size, frameCount, options.bounceCount);
+
+    std::vector<float> reference;
+    PathTracer pathTracer;
+    for (bool sortRays : { false, true }) {
+        for (unsigned int threads : { 1u, threadCount }) {
+            options.sortRays = sortRays;
+            options.threadCount = threads;
+            std::vector<float> image = render(wideBVH, scene, size, frameCount, options, pathTracer);
+
+            bool same = true;
+            if (reference.empty()) {
+                reference = image;
+                check(writePathTracerImage(pathTracer, path), "could not write %s", path);
+            }
+            else {
+                same = image.size() == reference.size() &&
+                       memcmp(image.data(), reference.data(), image.size() * sizeof(float)) == 0;
+                check(same, "%u threads%s: the image differs from the one of 1 thread without sorting", threads,
+                      sortRays ? " sorting rays" : "");
+            }
+
+            printf("%2u threads, %s: %s\n", threads, sortRays ? "sorted rays  " : "unsorted rays",
+                   same ? "same image" : "differs");
+        }
+    }
+
+    // The written image is the accumulation target, bottom row first
+    unsigned int width = 0, height = 0;
+    std::vector<float> pixels;
+    bool read = readImage(path, width, height, pixels);
+    check(read && width == size && height == size, "could not read %s back", path);
+    if (read && width == size && height == size) {
+        bool same = true;
+        for (size_t i = 0; i < (size_t)size * size && same; i++)
+            same = memcmp(&pixels[3 * i], &reference[4 * i], 3 * sizeof(float)) == 0;
+        check(same, "%s differs from the accumulation target", path);
+    }
+
+    bool valid = true;
+    for (size_t i = 0; i < reference.size() && valid; i++)
+        valid = std::isfinite(reference[i]) && reference[i] >= 0.0f;
+    check(valid, "the image has negative or non finite values");
+
+    // The walls at mid height, a tenth of the image from either side
+    float left[3], right[3], center[3];
+    averageColor(reference, size, size / 20, size / 10, size * 2 / 5, size * 3 / 5, left);
+    averageColor(reference, size, size - size / 10, size - size / 20, size * 2 / 5, size * 3 / 5, right);
+    averageColor(reference, size, size * 2 / 5, size * 3 / 5, size * 2 / 5, size * 3 / 5, center);
+    check(left[0] > 2.0f * left[1] && left[0] > 2.0f * left[2], "the left wall is (%f, %f, %f), not red",
+          left[0], left[1], left[2]);
+    check(right[1] > 1.5f * right[0] && right[1] > 1.5f * right[2], "the right wall is (%f, %f, %f), not green",
+          right[0], right[1], right[2]);
+    check(center[0] + center[1] + center[2] > 0.05f, "the center of the image is black");
+
+    printf("wrote %s; left wall (%.3f, %.3f, %.3f), right wall (%.3f, %.3f, %.3f)\n", path, left[0], left[1],
+           left[2], right[0], right[1], right[2]);
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
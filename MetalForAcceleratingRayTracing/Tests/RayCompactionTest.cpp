@@ -0,0 +1,274 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the portable ray compaction. Covers an empty queue, queues whose rays are all dropped or all kept, and
+ random queues around and across block boundaries, which must keep the order of their rays within each key on
+ any number of threads. Then compacts a queue bounce after bounce like the path tracer, and checks the number
+ of rays of every bounce, and the path tracer's own counts, against the rays still alive.
+*/
+
+#include "PathTracer.h"
+#include "RayCompaction.h"
+#include "TestScene.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+// The size of the shaders' rays, with the index of the ray in the original queue and its key
+struct Ray {
+    uint32_t index;
+    uint32_t key;
+    float padding[10];
+};
+
+static_assert(sizeof(Ray) == 48, "Rays must match the shaders' rays");
+
+// Written to every ray of the output queue first, so writes past the active rays show
+static const uint32_t untouchedIndex = 0xdeadbeef;
+
+int failures = 0;
+
+void check(bool condition, const char *format, ...) {
+    if (condition)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, arguments);
+    fprintf(stderr, "\n");
+    va_end(arguments);
+
+    failures++;
+}
+
+// Compacts `keys.size()` rays and compares the result with a stable sort of the active rays by key
+void checkCompaction(const std::vector<uint32_t> & keys, unsigned int keyCount, unsigned int threadCount,
+                     const char *name)
+{
+    size_t rayCount = keys.size();
+    std::vector<Ray> rays(rayCount);
+    for (size_t i = 0; i < rayCount; i++) {
+        rays[i].index = (uint32_t)i;
+        rays[i].key = keys[i];
+    }
+
+    // One more ray than needed, which must stay untouched
+    std::vector<Ray> compactedRays(rayCount + 1);
+    for (Ray & ray : compactedRays)
+        ray.index = untouchedIndex;
+
+    RayCompactionOptions options;
+    options.keyCount = keyCount;
+    options.threadCount = threadCount;
+    size_t activeRayCount = compactRays(rays.data(), sizeof(Ray), keys.data(), rayCount, options, compactedRays.data());
+
+    std::vector<Ray> expected;
+    for (const Ray & ray : rays) {
+        if (ray.key < keyCount)
+            expected.push_back(ray);
+    }
+    std::stable_sort(expected.begin(), expected.end(), [](const Ray & a, const Ray & b) { return a.key < b.key; });
+
+    check(activeRayCount == expected.size(), "%s: %zu of %zu rays are kept instead of %zu", name, activeRayCount,
+          rayCount, expected.size());
+
+    size_t misplaced = 0;
+    for (size_t i = 0; i < std::min(activeRayCount, expected.size()); i++) {
+        if (compactedRays[i].index != expected[i].index || compactedRays[i].key != expected[i].key) {
+            if (misplaced++ == 0)
+                check(false, "%s: slot %zu holds ray %u instead of ray %u", name, i, compactedRays[i].index,
+                      expected[i].index);
+        }
+    }
+
+    bool untouched = true;
+    for (size_t i = expected.size(); i < compactedRays.size(); i++)
+        untouched &= compactedRays[i].index == untouchedIndex;
+    check(untouched, "%s: rays are written past the %zu active rays", name, expected.size());
+}
+
+void testPrefixSum() {
+    uint32_t values[5] = { 3, 0, 2, 5, 1 };
+    const uint32_t expected[5] = { 0, 3, 3, 5, 10 };
+    uint32_t sum = exclusivePrefixSum(values, 5);
+    check(sum == 11 && memcmp(values, expected, sizeof(values)) == 0, "the prefix sum of 3 0 2 5 1 is wrong");
+
+    check(exclusivePrefixSum(values, 0) == 0 && values[0] == 0, "the prefix sum of no values is not 0");
+}
+
+void testEdgeCases() {
+    for (unsigned int threadCount : { 1u, 3u, 0u }) {
+        for (unsigned int keyCount : { 1u, 8u }) {
+            char name[64];
+            snprintf(name, sizeof(name), "empty queue, %u keys, %u threads", keyCount, threadCount);
+            checkCompaction({}, keyCount, threadCount, name);
+
+            for (size_t rayCount : { 1, 256, 1000 }) {
+                snprintf(name, sizeof(name), "%zu dropped rays, %u keys, %u threads", rayCount, keyCount, threadCount);
+                checkCompaction(std::vector<uint32_t>(rayCount, inactiveRayKey), keyCount, threadCount, name);
+
+                // Keys at or past the key count are dropped like inactiveRayKey
+                snprintf(name, sizeof(name), "%zu rays past the keys, %u keys, %u threads", rayCount, keyCount,
+                         threadCount);
+                checkCompaction(std::vector<uint32_t>(rayCount, keyCount), keyCount, threadCount, name);
+
+                snprintf(name, sizeof(name), "%zu kept rays, %u keys, %u threads", rayCount, keyCount, threadCount);
+                checkCompaction(std::vector<uint32_t>(rayCount, keyCount - 1), keyCount, threadCount, name);
+            }
+        }
+    }
+}
+
+// Queues one ray short of, at, and past whole blocks, with a few rays kept at the ends of blocks
+void testBlockBoundaries(std::mt19937 & generator) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const size_t block = rayCompactionBlockSize;
+
+    for (size_t rayCount : { block - 1, block, block + 1, 3 * block - 1, 3 * block + 1, 1000 * block + 3 }) {
+        for (float activeFraction : { 0.01f, 0.5f, 0.99f }) {
+            for (unsigned int keyCount : { 1u, 8u }) {
+                std::vector<uint32_t> keys(rayCount);
+                for (size_t i = 0; i < rayCount; i++) {
+                    bool blockEnd = i % block == 0 || i % block == block - 1;
+                    keys[i] = blockEnd || unit(generator) < activeFraction ? (uint32_t)(generator() % keyCount)
+                                                                          : inactiveRayKey;
+                }
+
+                for (unsigned int threadCount : { 1u, 3u, 0u }) {
+                    char name[96];
+                    snprintf(name, sizeof(name), "%zu rays, %.0f%% kept, %u keys, %u threads", rayCount,
+                             activeFraction * 100.0f, keyCount, threadCount);
+                    checkCompaction(keys, keyCount, threadCount, name);
+                }
+            }
+        }
+    }
+}
+
+// Compacts a queue after every bounce, each ray ending its path with some probability, and checks the number
+// of rays of every bounce against the rays still alive
+void testBounceCounts(std::mt19937 & generator) {
+    const size_t rayCount = 100000;
+    const unsigned int bounceCount = pathTracerMaxBounceCount;
+
+    for (unsigned int keyCount : { 1u, 8u }) {
+        std::vector<bool> alive(rayCount, true);
+        std::vector<Ray> rays(rayCount), compactedRays(rayCount);
+        for (size_t i = 0; i < rayCount; i++) {
+            rays[i].index = (uint32_t)i;
+            rays[i].key = 0;
+        }
+
+        size_t activeRayCount = rayCount;
+        for (unsigned int bounce = 1; bounce < bounceCount; bounce++) {
+            std::vector<uint32_t> keys(activeRayCount);
+            for (size_t i = 0; i < activeRayCount; i++) {
+                bool ends = generator() % 4 == 0;
+                alive[rays[i].index] = !ends;
+                keys[i] = ends ? inactiveRayKey : (uint32_t)(generator() % keyCount);
+            }
+
+            RayCompactionOptions options;
+            options.keyCount = keyCount;
+            options.threadCount = 3;
+            activeRayCount = compactRays(rays.data(), sizeof(Ray), keys.data(), activeRayCount, options,
+                                         compactedRays.data());
+            std::swap(rays, compactedRays);
+
+            size_t expected = (size_t)std::count(alive.begin(), alive.end(), true);
+            check(activeRayCount == expected, "%u keys, bounce %u has %zu rays instead of %zu", keyCount, bounce,
+                  activeRayCount, expected);
+
+            bool survivors = true;
+            for (size_t i = 0; i < activeRayCount && survivors; i++)
+                survivors = alive[rays[i].index];
+            check(survivors, "%u keys, bounce %u has rays which ended", keyCount, bounce);
+        }
+    }
+}
+
+// The counts the path tracer reports for every bounce, like the renderer's activeRayCounts: every pixel starts
+// a path, no bounce has more rays than the one before, and the counts do not depend on sorting or threads
+void testPathTracerCounts() {
+    TestScene testScene;
+    createTestCornellBox(testScene);
+
+    BVH bvh;
+    buildBVH(testScene.vertices.data(), sizeof(TestFloat3), testScene.triangleCount(), BVHBuildOptions(), bvh, nullptr);
+    WideBVH wideBVH;
+    buildWideBVH(bvh, testScene.vertices.data(), sizeof(TestFloat3), testScene.masks.data(), wideBVH);
+
+    PathTracerScene scene = { testScene.normals.data(), testScene.colors.data(), sizeof(TestFloat3),
+                              testScene.masks.data() };
+    PathTracerCamera camera = { { 0.0f, 1.0f, 3.38f }, { 0.414f, 0.0f, 0.0f }, { 0.0f, 0.414f, 0.0f },
+                                { 0.0f, 0.0f, -1.0f } };
+    PathTracerAreaLight light = { { 0.0f, 1.98f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.25f, 0.0f, 0.0f },
+                                  { 0.0f, 0.0f, 0.25f }, { 4.0f, 4.0f, 4.0f } };
+
+    const unsigned int size = 64;
+    PathTracerFrameStatistics reference = {};
+    for (bool sortRays : { false, true }) {
+        for (unsigned int threadCount : { 1u, 3u }) {
+            PathTracerOptions options;
+            options.bounceCount = 6;
+            options.sortRays = sortRays;
+            options.threadCount = threadCount;
+
+            srand(1);
+            PathTracer pathTracer;
+            createPathTracer(size, size, pathTracer);
+            PathTracerFrameStatistics statistics;
+            renderPathTracerFrame(wideBVH, scene, camera, light, options, pathTracer, &statistics);
+
+            const size_t *counts = statistics.activeRayCounts;
+            bool valid = counts[0] == (size_t)size * size;
+            size_t total = 0;
+            for (unsigned int bounce = 0; bounce < pathTracerMaxBounceCount; bounce++) {
+                if (bounce > 0)
+                    valid &= counts[bounce] <= counts[bounce - 1];
+                if (bounce >= options.bounceCount)
+                    valid &= counts[bounce] == 0;
+                total += counts[bounce];
+            }
+            check(valid && total == statistics.rayCount, "%s, %u threads: the bounce counts %zu %zu %zu %zu %zu %zu "
+                  "are not those of paths ending", sortRays ? "sorted" : "unsorted", threadCount, counts[0], counts[1],
+                  counts[2], counts[3], counts[4], counts[5]);
+
+            // Paths end leaving the box through its open side or hitting the light, so some must end
+            check(counts[options.bounceCount - 1] < counts[0], "no path ended in %u bounces", options.bounceCount);
+
+            if (!sortRays && threadCount == 1)
+                reference = statistics;
+            check(memcmp(reference.activeRayCounts, statistics.activeRayCounts, sizeof(reference.activeRayCounts)) == 0,
+                  "%s, %u threads: the bounce counts differ from 1 thread without sorting",
+                  sortRays ? "sorted" : "unsorted", threadCount);
+        }
+    }
+
+    printf("bounce counts of a %ux%u frame: %zu %zu %zu %zu %zu %zu\n", size, size, reference.activeRayCounts[0],
+           reference.activeRayCounts[1], reference.activeRayCounts[2], reference.activeRayCounts[3],
+           reference.activeRayCounts[4], reference.activeRayCounts[5]);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(3);
+
+    testPrefixSum();
+    testEdgeCases();
+    testBlockBoundaries(generator);
+    testBounceCounts(generator);
+    testPathTracerCounts();
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,334 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Benchmark of the CPU ray intersector against a traversal of the binary BVH it is collapsed from, in millions
+ of rays per second. Traces the sample's primary rays, which are coherent, then diffuse secondary rays and
+ shadow rays from their hits, which are not, in the Cornell box and in the box filled with random cubes. The
+ eight wide BVH is traversed with packets of rays and one ray at a time, the binary BVH one ray at a time with
+ the same triangle test. Fails when the intersector and the binary traversal disagree on any ray.
+ Usage: RayIntersectorBenchmark [random cubes] [image size] [repetitions]
+*/
+
+#include "BVH.h"
+#include "RayIntersector.h"
+#include "TestScene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Same layout as the shaders' Ray, whose stride the intersector is given
+struct Ray {
+    RayOriginMaskDirectionMaxDistance ray;
+    float color[3];
+    uint32_t padding;
+};
+
+static_assert(sizeof(Ray) == 48, "Rays must match the shaders' rays");
+
+int failures = 0;
+
+void check(bool condition, const char *format, ...) {
+    if (condition)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, arguments);
+    fprintf(stderr, "\n");
+    va_end(arguments);
+
+    failures++;
+}
+
+void normalize(float v[3]) {
+    float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    for (int axis = 0; axis < 3; axis++)
+        v[axis] /= length;
+}
+
+// Traverses the binary BVH front to back, testing triangles like the intersector's leaves
+void intersectBinary(const BVH & bvh, const TestScene & scene, const RayOriginMaskDirectionMaxDistance & ray,
+                     bool anyHit, IntersectionDistancePrimitiveIndexCoordinates & intersection)
+{
+    intersection.distance = -1.0f;
+    intersection.primitiveIndex = UINT32_MAX;
+    intersection.coordinates[0] = intersection.coordinates[1] = 0.0f;
+    if (ray.maxDistance < 0.0f || scene.triangleCount() == 0)
+        return;
+
+    const float *o = ray.origin;
+    const float *d = ray.direction;
+    float inverseDirection[3] = { 1.0f / d[0], 1.0f / d[1], 1.0f / d[2] };
+    float nearest = ray.maxDistance;
+
+    uint32_t stack[128];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize) {
+        const BVHNode & node = bvh.nodes[stack[--stackSize]];
+
+        float entry = 0.0f, exit = nearest;
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (node.boundsMin[axis] - o[axis]) * inverseDirection[axis];
+            float t1 = (node.boundsMax[axis] - o[axis]) * inverseDirection[axis];
+            entry = std::max(entry, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        if (entry > exit)
+            continue;
+
+        if (!node.triangleCount) {
+            // Visit the child on the side the ray comes from first
+            bool flip = d[node.splitAxis] < 0.0f;
+            stack[stackSize++] = node.offset + (flip ? 0 : 1);
+            stack[stackSize++] = node.offset + (flip ? 1 : 0);
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.triangleCount; i++) {
+            uint32_t triangle = bvh.triangleIndices[i];
+            if (!(scene.masks[triangle] & ray.mask))
+                continue;
+
+            const TestFloat3 & v0 = scene.vertices[3 * triangle];
+            const TestFloat3 & v1 = scene.vertices[3 * triangle + 1];
+            const TestFloat3 & v2 = scene.vertices[3 * triangle + 2];
+            float e1[3] = { v1.x - v0.x, v1.y - v0.y, v1.z - v0.z };
+            float e2[3] = { v2.x - v0.x, v2.y - v0.y, v2.z - v0.z };
+            float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+            float determinant = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (determinant == 0.0f)
+                continue;
+
+            float inverse = 1.0f / determinant;
+            float t[3] = { o[0] - v0.x, o[1] - v0.y, o[2] - v0.z };
+            float u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) * inverse;
+            float q[3] = { t[1] * e1[2] - t[2] * e1[1], t[2] * e1[0] - t[0] * e1[2], t[0] * e1[1] - t[1] * e1[0] };
+            float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverse;
+            float distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverse;
+
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance >= 0.0f && distance < nearest) {
+                nearest = distance;
+                intersection.distance = distance;
+                intersection.primitiveIndex = triangle;
+                intersection.coordinates[0] = 1.0f - u - v;
+                intersection.coordinates[1] = u;
+                if (anyHit)
+                    return;
+            }
+        }
+    }
+}
+
+// Primary rays of rayKernel, jittered within their pixel
+std::vector<Ray> makePrimaryRays(unsigned int size, std::mt19937 & generator) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float imagePlaneSize = std::tan(45.0f * (3.14159265f / 180.0f) / 2.0f);
+
+    std::vector<Ray> rays((size_t)size * size);
+    for (unsigned int y = 0; y < size; y++) {
+        for (unsigned int x = 0; x < size; x++) {
+            Ray & ray = rays[(size_t)y * size + x];
+            float u = ((x + unit(generator)) / size * 2.0f - 1.0f) * imagePlaneSize;
+            float v = ((y + unit(generator)) / size * 2.0f - 1.0f) * imagePlaneSize;
+            float origin[3] = { 0.0f, 1.0f, 3.38f };
+            float direction[3] = { u, v, -1.0f };
+            normalize(direction);
+
+            memcpy(ray.ray.origin, origin, sizeof(origin));
+            memcpy(ray.ray.direction, direction, sizeof(direction));
+            ray.ray.mask = testRayMaskPrimary;
+            ray.ray.maxDistance = INFINITY;
+            ray.color[0] = ray.color[1] = ray.color[2] = 1.0f;
+            ray.padding = 0;
+        }
+    }
+
+    return rays;
+}
+
+// The diffuse bounce and the shadow ray towards the area light of every primary hit, like shadeKernel. Rays of
+// primary rays which missed are disabled.
+void makeBounceRays(const TestScene & scene, const std::vector<Ray> & primaryRays,
+                    const std::vector<IntersectionDistancePrimitiveIndexCoordinates> & intersections,
+                    std::mt19937 & generator, std::vector<Ray> & secondaryRays, std::vector<Ray> & shadowRays)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    secondaryRays = primaryRays;
+    shadowRays = primaryRays;
+
+    for (size_t i = 0; i < primaryRays.size(); i++) {
+        const RayOriginMaskDirectionMaxDistance & primary = primaryRays[i].ray;
+        const IntersectionDistancePrimitiveIndexCoordinates & intersection = intersections[i];
+        RayOriginMaskDirectionMaxDistance & secondary = secondaryRays[i].ray;
+        RayOriginMaskDirectionMaxDistance & shadow = shadowRays[i].ray;
+
+        if (intersection.distance < 0.0f) {
+            secondary.maxDistance = shadow.maxDistance = -1.0f;
+            continue;
+        }
+
+        const TestFloat3 & n = scene.normals[3 * intersection.primitiveIndex];
+        float normal[3] = { n.x, n.y, n.z };
+        float point[3];
+        for (int axis = 0; axis < 3; axis++)
+            point[axis] = primary.origin[axis] + primary.direction[axis] * intersection.distance + normal[axis] * 1e-3f;
+
+        // A direction in the hemisphere of the normal
+        float direction[3];
+        do {
+            for (int axis = 0; axis < 3; axis++)
+                direction[axis] = unit(generator) * 2.0f - 1.0f;
+        } while (direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2] > 1.0f);
+        normalize(direction);
+        if (direction[0] * normal[0] + direction[1] * normal[1] + direction[2] * normal[2] < 0.0f) {
+            for (int axis = 0; axis < 3; axis++)
+                direction[axis] = -direction[axis];
+        }
+
+        memcpy(secondary.origin, point, sizeof(point));
+        memcpy(secondary.direction, direction, sizeof(direction));
+        secondary.mask = testRayMaskSecondary;
+        secondary.maxDistance = INFINITY;
+
+        // A point on the light, which is a quarter unit on each side of (0, 1.98, 0)
+        float toLight[3] = { (unit(generator) * 2.0f - 1.0f) * 0.25f - point[0], 1.98f - point[1],
+                             (unit(generator) * 2.0f - 1.0f) * 0.25f - point[2] };
+        float lightDistance = std::sqrt(toLight[0] * toLight[0] + toLight[1] * toLight[1] + toLight[2] * toLight[2]);
+        normalize(toLight);
+
+        memcpy(shadow.origin, point, sizeof(point));
+        memcpy(shadow.direction, toLight, sizeof(toLight));
+        shadow.mask = testRayMaskShadow;
+        shadow.maxDistance = lightDistance - 1e-3f;
+    }
+}
+
+// Best time of `repetitions` runs of `function`, in seconds
+template <typename Function>
+double bestSeconds(unsigned int repetitions, Function function) {
+    double best = INFINITY;
+    for (unsigned int repetition = 0; repetition < repetitions; repetition++) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    return best;
+}
+
+// Times the wide BVH with and without packets and the binary BVH on one thread, and compares their results
+void benchmarkRays(const BVH & bvh, const WideBVH & wideBVH, const TestScene & scene, const std::vector<Ray> & rays,
+                   RayIntersectionType intersectionType, const char *sceneName, const char *raysName,
+                   unsigned int repetitions)
+{
+    const bool anyHit = intersectionType == RayIntersectionType::Any;
+    std::vector<IntersectionDistancePrimitiveIndexCoordinates> binaryIntersections(rays.size());
+    double binarySeconds = bestSeconds(repetitions, [&] {
+        for (size_t i = 0; i < rays.size(); i++)
+            intersectBinary(bvh, scene, rays[i].ray, anyHit, binaryIntersections[i]);
+    });
+
+    double wideSeconds[2];
+    for (bool usePackets : { false, true }) {
+        RayIntersectorOptions options;
+        options.intersectionType = intersectionType;
+        options.rayStride = sizeof(Ray);
+        options.usePackets = usePackets;
+        options.threadCount = 1;
+
+        std::vector<IntersectionDistancePrimitiveIndexCoordinates> intersections(rays.size());
+        wideSeconds[usePackets] = bestSeconds(repetitions, [&] {
+            intersectRays(wideBVH, options, rays.data(), intersections.data(), rays.size());
+        });
+
+        // Both test the same triangles with the same arithmetic, so they agree on hits up to the order of the
+        // nearest ones; any hit rays may stop at different triangles
+        size_t mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++) {
+            const IntersectionDistancePrimitiveIndexCoordinates & expected = binaryIntersections[i];
+            const IntersectionDistancePrimitiveIndexCoordinates & intersection = intersections[i];
+            bool mismatch = (expected.distance < 0.0f) != (intersection.distance < 0.0f);
+            if (!anyHit && expected.distance >= 0.0f)
+                mismatch |= std::fabs(expected.distance - intersection.distance) > 1e-5f * std::max(expected.distance, 1.0f);
+
+            if (mismatch && mismatches++ == 0)
+                check(false, "%s, %s rays, %s: ray %zu hits at %f instead of %f", sceneName, raysName,
+                      usePackets ? "packets" : "single rays", i, intersection.distance, expected.distance);
+        }
+        if (mismatches > 1)
+            check(false, "%s, %s rays, %s: %zu rays differ from the binary BVH", sceneName, raysName,
+                  usePackets ? "packets" : "single rays", mismatches);
+    }
+
+    double megaRays = rays.size() * 1e-6;
+    printf("  %-10s %14.2f %14.2f %14.2f %9.2fx\n", raysName, megaRays / wideSeconds[1], megaRays / wideSeconds[0],
+           megaRays / binarySeconds, binarySeconds / std::min(wideSeconds[0], wideSeconds[1]));
+}
+
+void benchmarkScene(const TestScene & scene, const char *sceneName, unsigned int imageSize, unsigned int repetitions) {
+    BVHBuildOptions buildOptions;
+    BVH bvh;
+    BVHBuildStatistics statistics;
+    buildBVH(scene.vertices.data(), sizeof(TestFloat3), scene.triangleCount(), buildOptions, bvh, &statistics);
+
+    WideBVH wideBVH;
+    buildWideBVH(bvh, scene.vertices.data(), sizeof(TestFloat3), scene.masks.data(), wideBVH);
+
+    // The binary traversal's stack holds at most one node per level
+    check(statistics.maxDepth < 128, "%s: the binary BVH is %u levels deep", sceneName, statistics.maxDepth);
+    if (statistics.maxDepth >= 128)
+        return;
+
+    printf("%s: %zu triangles, %zu binary nodes, %zu wide nodes, %ux%u rays\n", sceneName, scene.triangleCount(),
+           bvh.nodes.size(), wideBVH.nodes.size(), imageSize, imageSize);
+    printf("  %-10s %14s %14s %14s %10s\n", "rays", "8-wide packet", "8-wide single", "binary", "speedup");
+
+    std::mt19937 generator(7);
+    std::vector<Ray> primaryRays = makePrimaryRays(imageSize, generator);
+    benchmarkRays(bvh, wideBVH, scene, primaryRays, RayIntersectionType::Nearest, sceneName, "primary", repetitions);
+
+    RayIntersectorOptions options;
+    options.rayStride = sizeof(Ray);
+    std::vector<IntersectionDistancePrimitiveIndexCoordinates> intersections(primaryRays.size());
+    intersectRays(wideBVH, options, primaryRays.data(), intersections.data(), primaryRays.size());
+
+    std::vector<Ray> secondaryRays, shadowRays;
+    makeBounceRays(scene, primaryRays, intersections, generator, secondaryRays, shadowRays);
+    benchmarkRays(bvh, wideBVH, scene, secondaryRays, RayIntersectionType::Nearest, sceneName, "secondary", repetitions);
+    benchmarkRays(bvh, wideBVH, scene, shadowRays, RayIntersectionType::Any, sceneName, "shadow", repetitions);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t cubeCount = argc > 1 ? (size_t)atol(argv[1]) : 80000;
+    unsigned int imageSize = argc > 2 ? (unsigned int)std::max(atoi(argv[2]), 8) : 512;
+    unsigned int repetitions = argc > 3 ? (unsigned int)std::max(atoi(argv[3]), 1) : 5;
+
+    printf("Mrays/s on one thread, best of %u runs\n", repetitions);
+
+    TestScene scene;
+    createTestCornellBox(scene);
+    benchmarkScene(scene, "Cornell box", imageSize, repetitions);
+
+    addTestRandomCubes(scene, cubeCount, 1);
+    char name[64];
+    snprintf(name, sizeof(name), "Cornell box with %zu cubes", cubeCount);
+    benchmarkScene(scene, name, imageSize, repetitions);
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Header for the scenes of the tests: the sample's Cornell box built like createScene, optionally filled with
+ small random cubes for larger scenes
+*/
+
+#ifndef TestScene_h
+#define TestScene_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Same masks as ShaderTypes.h and Scene.h, which can't be included without the simd headers
+static const uint32_t testTriangleMaskGeometry = 1;
+static const uint32_t testTriangleMaskLight = 2;
+
+static const uint32_t testRayMaskPrimary = 3;
+static const uint32_t testRayMaskShadow = 1;
+static const uint32_t testRayMaskSecondary = 1;
+
+static const unsigned int testFaceMaskNegativeX = 1 << 0;
+static const unsigned int testFaceMaskPositiveX = 1 << 1;
+static const unsigned int testFaceMaskNegativeY = 1 << 2;
+static const unsigned int testFaceMaskPositiveY = 1 << 3;
+static const unsigned int testFaceMaskNegativeZ = 1 << 4;
+static const unsigned int testFaceMaskPositiveZ = 1 << 5;
+static const unsigned int testFaceMaskAll = (1 << 6) - 1;
+
+// Same size as vector_float3
+struct TestFloat3 {
+    float x, y, z;
+    float padding;
+};
+
+// The vertex attributes and triangle masks of createScene's global vectors
+struct TestScene {
+    std::vector<TestFloat3> vertices;
+    std::vector<TestFloat3> normals;
+    std::vector<TestFloat3> colors;
+    std::vector<uint32_t> masks;
+
+    size_t triangleCount() const {
+        return masks.size();
+    }
+};
+
+inline TestFloat3 testNormalize(TestFloat3 v) {
+    float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return { v.x / length, v.y / length, v.z / length, 0.0f };
+}
+
+// getTriangleNormal
+inline TestFloat3 testTriangleNormal(TestFloat3 v0, TestFloat3 v1, TestFloat3 v2) {
+    TestFloat3 e1 = testNormalize({ v1.x - v0.x, v1.y - v0.y, v1.z - v0.z, 0.0f });
+    TestFloat3 e2 = testNormalize({ v2.x - v0.x, v2.y - v0.y, v2.z - v0.z, 0.0f });
+
+    return { e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x, 0.0f };
+}
+
+// createCubeFace
+inline void addTestCubeFace(TestScene & scene, const TestFloat3 *cubeVertices, TestFloat3 color, unsigned int i0,
+                            unsigned int i1, unsigned int i2, unsigned int i3, bool inwardNormals,
+                            uint32_t triangleMask)
+{
+    TestFloat3 v0 = cubeVertices[i0];
+    TestFloat3 v1 = cubeVertices[i1];
+    TestFloat3 v2 = cubeVertices[i2];
+    TestFloat3 v3 = cubeVertices[i3];
+
+    TestFloat3 n0 = testTriangleNormal(v0, v1, v2);
+    TestFloat3 n1 = testTriangleNormal(v0, v2, v3);
+
+    if (inwardNormals) {
+        n0 = { -n0.x, -n0.y, -n0.z, 0.0f };
+        n1 = { -n1.x, -n1.y, -n1.z, 0.0f };
+    }
+
+    for (TestFloat3 vertex : { v0, v1, v2, v0, v2, v3 })
+        scene.vertices.push_back(vertex);
+
+    for (int i = 0; i < 6; i++) {
+        scene.normals.push_back(i < 3 ? n0 : n1);
+        scene.colors.push_back(color);
+    }
+
+    for (int i = 0; i < 2; i++)
+        scene.masks.push_back(triangleMask);
+}
+
+// createCube with the transform translation * rotation around y * scale, the only ones createScene uses
+inline void addTestCube(TestScene & scene, unsigned int faceMask, TestFloat3 color, TestFloat3 translation,
+                        float rotationY, TestFloat3 scale, bool inwardNormals, uint32_t triangleMask)
+{
+    // matrix4x4_rotation around y: x' = cos * x + sin * z, z' = -sin * x + cos * z
+    float ct = std::cos(rotationY);
+    float st = std::sin(rotationY);
+
+    TestFloat3 cubeVertices[8];
+    for (int i = 0; i < 8; i++) {
+        float x = (i & 1 ? 0.5f : -0.5f) * scale.x;
+        float y = (i & 2 ? 0.5f : -0.5f) * scale.y;
+        float z = (i & 4 ? 0.5f : -0.5f) * scale.z;
+        cubeVertices[i] = { ct * x + st * z + translation.x, y + translation.y, -st * x + ct * z + translation.z, 0.0f };
+    }
+
+    if (faceMask & testFaceMaskNegativeX)
+        addTestCubeFace(scene, cubeVertices, color, 0, 4, 6, 2, inwardNormals, triangleMask);
+
+    if (faceMask & testFaceMaskPositiveX)
+        addTestCubeFace(scene, cubeVertices, color, 1, 3, 7, 5, inwardNormals, triangleMask);
+
+    if (faceMask & testFaceMaskNegativeY)
+        addTestCubeFace(scene, cubeVertices, color, 0, 1, 5, 4, inwardNormals, triangleMask);
+
+    if (faceMask & testFaceMaskPositiveY)
+        addTestCubeFace(scene, cubeVertices, color, 2, 6, 7, 3, inwardNormals, triangleMask);
+
+    if (faceMask & testFaceMaskNegativeZ)
+        addTestCubeFace(scene, cubeVertices, color, 0, 2, 3, 1, inwardNormals, triangleMask);
+
+    if (faceMask & testFaceMaskPositiveZ)
+        addTestCubeFace(scene, cubeVertices, color, 4, 5, 7, 6, inwardNormals, triangleMask);
+}
+
+// createScene
+inline void createTestCornellBox(TestScene & scene) {
+    const TestFloat3 white = { 0.725f, 0.71f, 0.68f, 0.0f };
+
+    // Light source
+    addTestCube(scene, testFaceMaskPositiveY, { 1.0f, 1.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, 0.0f,
+                { 0.5f, 1.98f, 0.5f, 0.0f }, true, testTriangleMaskLight);
+
+    // Top, bottom, and back walls, then the left and right walls
+    addTestCube(scene, testFaceMaskNegativeY | testFaceMaskPositiveY | testFaceMaskNegativeZ, white,
+                { 0.0f, 1.0f, 0.0f, 0.0f }, 0.0f, { 2.0f, 2.0f, 2.0f, 0.0f }, true, testTriangleMaskGeometry);
+    addTestCube(scene, testFaceMaskNegativeX, { 0.63f, 0.065f, 0.05f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, 0.0f,
+                { 2.0f, 2.0f, 2.0f, 0.0f }, true, testTriangleMaskGeometry);
+    addTestCube(scene, testFaceMaskPositiveX, { 0.14f, 0.45f, 0.091f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, 0.0f,
+                { 2.0f, 2.0f, 2.0f, 0.0f }, true, testTriangleMaskGeometry);
+
+    // Short box, then tall box
+    addTestCube(scene, testFaceMaskAll, white, { 0.3275f, 0.3f, 0.3725f, 0.0f }, -0.3f, { 0.6f, 0.6f, 0.6f, 0.0f },
+                false, testTriangleMaskGeometry);
+    addTestCube(scene, testFaceMaskAll, white, { -0.335f, 0.6f, -0.29f, 0.0f }, 0.3f, { 0.6f, 1.2f, 0.6f, 0.0f },
+                false, testTriangleMaskGeometry);
+}
+
+// Small cubes scattered inside the Cornell box, 12 triangles each
+inline void addTestRandomCubes(TestScene & scene, size_t cubeCount, uint32_t seed) {
+    const TestFloat3 white = { 0.725f, 0.71f, 0.68f, 0.0f };
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Cubes shrink as there are more of them, so they cover about the same part of the box
+    float size = 0.4f / std::cbrt((float)std::max<size_t>(cubeCount, 1));
+    for (size_t i = 0; i < cubeCount; i++) {
+        TestFloat3 position = { unit(generator) * 1.9f - 0.95f, unit(generator) * 1.9f + 0.05f,
+                                unit(generator) * 1.9f - 0.95f, 0.0f };
+        float rotation = unit(generator) * 6.2831853f;
+        TestFloat3 scale = { size * (0.5f + unit(generator)), size * (0.5f + unit(generator)),
+                             size * (0.5f + unit(generator)), 0.0f };
+        addTestCube(scene, testFaceMaskAll, white, position, rotation, scale, false, testTriangleMaskGeometry);
+    }
+}
+
+#endif /* TestScene_h */
@@ -34,6 +34,13 @@ struct AAPLVertexData
 - (nullable instancetype)initWithURL:(nonnull NSURL*)URL
                                error:(NSError * __nullable * __nullable)error;
 
+// When `optimizeMesh` is set, the triangles of each submesh are reordered for the post-transform vertex cache
+//   and for less overdraw, and the vertices are reordered for fetch locality. `initWithURL:error:` keeps the
+//   file order.
+- (nullable instancetype)initWithURL:(nonnull NSURL*)URL
+                        optimizeMesh:(BOOL)optimizeMesh
+                               error:(NSError * __nullable * __nullable)error;
+
 @property (nonatomic, readonly, nonnull) struct AAPLVertexData *vertexData;
 
 @property (nonatomic, readonly) NSUInteger vertexCount;
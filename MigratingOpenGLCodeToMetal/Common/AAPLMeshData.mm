@@ -6,11 +6,12 @@ Implementation of mesh and submesh objects used for managing model data.
 */
 
 #import "AAPLMeshData.h"
+#import "AAPLMeshOptimizer.h"
+#import "AAPLVertexWelder.h"
 #import <vector>
-#import <unordered_map>
 
 
-// Implement `operator==` to use `AAPLVertexData` as a hash key in an unordered map.
+// Implement `operator==` to compare `AAPLVertexData` keys in the vertex welder.
 bool operator==(const AAPLVertexData & lhs, const AAPLVertexData & rhs)
 {
     return(simd::all(lhs.position == rhs.position) &&
@@ -18,23 +19,38 @@ bool operator==(const AAPLVertexData & lhs, const AAPLVertexData & rhs)
            simd::all(lhs.texcoord == rhs.texcoord));
 }
 
-// Implement a hash function for `AAPLVertexData` to use it as a key in an unordered map.
-template<> struct std::hash<AAPLVertexData>
+// Implement the welder traits for `AAPLVertexData`. Only the 8 used floats are hashed, so the padding
+//   lanes of the `vector_float3` members never affect the hash.
+template<> struct AAPLVertexWelderTraits<AAPLVertexData>
 {
-    std::size_t operator()(const AAPLVertexData& k) const
+    static uint64_t hash(const AAPLVertexData& k)
     {
-        std::size_t hash = 0;
-        for (uint w = 0; w < sizeof(AAPLVertexData) / sizeof(std::size_t); w++)
-            hash ^= (((std::size_t*)&k)[w] ^ (hash << 8) ^ (hash >> 8));
-        return hash;
+        const float values[8] = { k.position.x, k.position.y, k.position.z,
+                                  k.normal.x,   k.normal.y,   k.normal.z,
+                                  k.texcoord.x, k.texcoord.y };
+        return AAPLHashFloats(values, 8);
     }
+    static bool equal(const AAPLVertexData& a, const AAPLVertexData& b) { return a == b; }
 };
 
+// OBJ text takes roughly 100 bytes per unique vertex; a smaller figure makes the vertex count estimate
+//   used to size the vertex welder err on the large side.
+static const NSUInteger AAPLOBJBytesPerVertexEstimate = 64;
+
+@interface AAPLSubmeshData ()
+- (std::vector<uint32_t>&)indexVector;
+@end
+
 @implementation AAPLSubmeshData
 {
     std::vector<uint32_t> _indexVector;
 }
 
+- (std::vector<uint32_t>&)indexVector
+{
+    return _indexVector;
+}
+
 - (void)addIndex:(uint32_t)index
 {
     _indexVector.push_back(index);
@@ -66,7 +82,7 @@ template<> struct std::hash<AAPLVertexData>
     std::vector<vector_float2>  _texcoords;
     std::vector<AAPLVertexData> _vertices;
 
-    std::unordered_map<AAPLVertexData, uint32_t> _vertexMap;
+    AAPLVertexWelder<AAPLVertexData> _vertexWelder;
 
     NSURL *_OBJURL;
 }
@@ -131,18 +147,7 @@ template<> struct std::hash<AAPLVertexData>
 
 - (uint32_t) findIndexOrPushVertex:(const AAPLVertexData &)vertex
 {
-    auto ref = _vertexMap.find(vertex);
-
-    if(ref == _vertexMap.end())
-    {
-        _vertexMap.insert(std::pair<AAPLVertexData,uint32_t>(vertex, _vertices.size()));
-        _vertices.push_back(vertex);
-        return (uint32_t)(_vertices.size() - 1);
-    }
-    else
-    {
-        return ref->second;
-    }
+    return _vertexWelder.weld(vertex, _vertices);
 }
 
 - (void)readLine:(NSString*)line
@@ -243,6 +248,8 @@ template<> struct std::hash<AAPLVertexData>
 
     NSArray<NSString*> *lines = [fileString componentsSeparatedByString:@"\n"];
 
+    _vertexWelder.reserve(fileString.length / AAPLOBJBytesPerVertexEstimate);
+
     fileString = nil;
 
     for(NSString* line in lines)
@@ -255,10 +262,67 @@ template<> struct std::hash<AAPLVertexData>
     _positions.clear();
     _texcoords.clear();
     _normals.clear();
-    _vertexMap.clear();
+    _vertexWelder = AAPLVertexWelder<AAPLVertexData>();
+}
+
+// Reorder the triangles of each submesh for the post-transform vertex cache and for less overdraw,
+//   then renumber the shared vertices in order of first use for fetch locality.
+- (void)optimizeMesh
+{
+    const size_t vertexCount = _vertices.size();
+    if(vertexCount == 0)
+    {
+        return;
+    }
+
+    NSArray<NSString*> *materialNames = [_submeshes.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    std::vector<uint32_t> allIndices;
+
+    for(NSString *materialName in materialNames)
+    {
+        std::vector<uint32_t> &indices = [_submeshes[materialName] indexVector];
+        AAPLVertexCacheStats before = AAPLAnalyzeVertexCache(indices.data(), indices.size(), vertexCount);
+
+        std::vector<uint32_t> cacheOrder(indices);
+        std::vector<uint32_t> clusterStarts;
+        AAPLOptimizeVertexCache(cacheOrder.data(), cacheOrder.size(), vertexCount, kVertexCacheSize, &clusterStarts);
+
+        std::vector<uint32_t> overdrawOrder(cacheOrder);
+        AAPLOptimizeOverdraw(overdrawOrder.data(), overdrawOrder.size(), (const float*)&_vertices[0].position,
+                             sizeof(AAPLVertexData), vertexCount, clusterStarts);
+
+        // Prefer the overdraw order, then the cache order when sorting for overdraw lost the cache gain,
+        //   and keep the file order when it is already more cache friendly than both.
+        if(AAPLAnalyzeVertexCache(overdrawOrder.data(), overdrawOrder.size(), vertexCount).acmr <= before.acmr)
+        {
+            indices.swap(overdrawOrder);
+        }
+        else if(AAPLAnalyzeVertexCache(cacheOrder.data(), cacheOrder.size(), vertexCount).acmr < before.acmr)
+        {
+            indices.swap(cacheOrder);
+        }
+
+        allIndices.insert(allIndices.end(), indices.begin(), indices.end());
+    }
+
+    std::vector<uint32_t> remap;
+    AAPLComputeVertexFetchRemap(allIndices.data(), allIndices.size(), vertexCount, remap);
+    for(NSString *materialName in materialNames)
+    {
+        std::vector<uint32_t> &indices = [_submeshes[materialName] indexVector];
+        AAPLRemapIndices(indices.data(), indices.size(), remap);
+    }
+    AAPLRemapVertices(_vertices, remap);
+}
+
+- (nullable instancetype)initWithURL:(nonnull NSURL*)URL
+                               error:(NSError * __nullable * __nullable)error;
+{
+    return [self initWithURL:URL optimizeMesh:NO error:error];
 }
 
 - (nullable instancetype)initWithURL:(nonnull NSURL*)URL
+                        optimizeMesh:(BOOL)optimizeMesh
                                error:(NSError * __nullable * __nullable)error;
 {
     self = [super init];
@@ -269,6 +333,11 @@ template<> struct std::hash<AAPLVertexData>
         _submeshes = [NSMutableDictionary new];
 
         [self parseOBJFile];
+
+        if(optimizeMesh)
+        {
+            [self optimizeMesh];
+        }
     }
     return self;
 }
@@ -0,0 +1,296 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Implementation of the mesh optimization passes.
+ The vertex cache pass follows Sander et al., "Fast Triangle Reordering for Vertex Locality and
+ Reduced Overdraw", SIGGRAPH 2007, which also describes the cluster sort of the overdraw pass.
+*/
+
+#include "AAPLMeshOptimizer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+AAPLVertexCacheStats AAPLAnalyzeVertexCache (const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    // A vertex is cached while fewer than cacheSize misses happened since it was inserted
+    std::vector<uint32_t> insertedAt (vertexCount, 0);
+    std::vector<bool> referenced (vertexCount, false);
+    uint32_t time = cacheSize + 1;
+    uint32_t misses = 0;
+    uint32_t referencedCount = 0;
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t v = indices[i];
+        if (time - insertedAt[v] > cacheSize)
+        {
+            insertedAt[v] = time++;
+            misses++;
+        }
+        if (!referenced[v])
+        {
+            referenced[v] = true;
+            referencedCount++;
+        }
+    }
+
+    AAPLVertexCacheStats stats;
+    stats.transformedVertices = misses;
+    stats.acmr = indexCount ? (float) misses / (float) (indexCount / 3) : 0.0f;
+    stats.atvr = referencedCount ? (float) misses / (float) referencedCount : 0.0f;
+    return stats;
+}
+
+void AAPLOptimizeVertexCache (uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>* outClusterStarts)
+{
+    assert (indexCount % 3 == 0);
+    const size_t triangleCount = indexCount / 3;
+    if (outClusterStarts)
+        outClusterStarts->clear();
+    if (triangleCount == 0)
+        return;
+
+    // Vertex to triangle adjacency, in CSR layout; liveTriangles counts the ones not emitted yet
+    std::vector<uint32_t> liveTriangles (vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++)
+        liveTriangles[indices[i]]++;
+
+    std::vector<uint32_t> adjacencyOffsets (vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+    std::vector<uint32_t> adjacency (indexCount);
+    std::vector<uint32_t> fill (adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++)
+        adjacency[fill[indices[i]]++] = (uint32_t) (i / 3);
+
+    std::vector<uint32_t> cachedAt (vertexCount, 0);
+    std::vector<bool> emitted (triangleCount, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve (indexCount);
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+    bool startsCluster = true;
+
+    // Input order fallback once the dead-end stack holds no vertex with live triangles
+    auto skipDeadEnd = [&] () -> int64_t
+    {
+        while (!deadEnds.empty())
+        {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0)
+                return v;
+        }
+        for (; cursor < vertexCount; cursor++)
+        {
+            if (liveTriangles[cursor] > 0)
+                return (int64_t) cursor;
+        }
+        return -1;
+    };
+
+    int64_t fanning = skipDeadEnd();
+    while (fanning >= 0)
+    {
+        // Emit all live triangles around the fanning vertex
+        candidates.clear();
+        uint32_t f = (uint32_t) fanning;
+        for (uint32_t a = adjacencyOffsets[f]; a < adjacencyOffsets[f + 1]; a++)
+        {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+                continue;
+
+            if (startsCluster && outClusterStarts)
+                outClusterStarts->push_back ((uint32_t) (output.size() / 3));
+            startsCluster = false;
+
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                uint32_t v = indices[t * 3 + c];
+                output.push_back (v);
+                deadEnds.push_back (v);
+                candidates.push_back (v);
+                liveTriangles[v]--;
+                if (time - cachedAt[v] > cacheSize)
+                    cachedAt[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // Pick the candidate that is still cached after fanning its remaining triangles and has been
+        //  in the cache the longest
+        int64_t best = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+                continue;
+            int64_t priority = 0;
+            if (time - cachedAt[v] + 2 * liveTriangles[v] <= cacheSize)
+                priority = time - cachedAt[v];
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = v;
+            }
+        }
+
+        if (best < 0)
+        {
+            fanning = skipDeadEnd();
+            startsCluster = true;
+        }
+        else
+        {
+            fanning = best;
+        }
+    }
+
+    assert (output.size() == indexCount);
+    std::copy (output.begin(), output.end(), indices);
+}
+
+void AAPLOptimizeOverdraw (uint32_t*                    indices,
+                           size_t                       indexCount,
+                           const float*                 positions,
+                           size_t                       positionStride,
+                           size_t                       vertexCount,
+                           const std::vector<uint32_t>& clusterStarts,
+                           uint32_t                     cacheSize,
+                           float                        threshold)
+{
+    assert (indexCount % 3 == 0);
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusterStarts.empty())
+        return;
+
+    auto position = [&] (uint32_t v) { return (const float*) ((const uint8_t*) positions + v * positionStride); };
+
+    // Split the hard clusters further wherever the ACMR of the cluster so far, starting from a cold cache
+    //  as it may after reordering, is within the threshold of the whole mesh's
+    const float targetAcmr = AAPLAnalyzeVertexCache (indices, indexCount, vertexCount, cacheSize).acmr * threshold;
+
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> cachedAt (vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    size_t nextHardStart = 0;
+    uint32_t clusterMisses = 0;
+    uint32_t clusterTriangles = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        bool hardStart = nextHardStart < clusterStarts.size() && clusterStarts[nextHardStart] == t;
+        bool softStart = clusterTriangles > 0 && (float) clusterMisses <= targetAcmr * (float) clusterTriangles;
+        if (hardStart || softStart || t == 0)
+        {
+            starts.push_back ((uint32_t) t);
+            time += cacheSize;
+            clusterMisses = 0;
+            clusterTriangles = 0;
+        }
+        nextHardStart += hardStart ? 1 : 0;
+
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            uint32_t v = indices[t * 3 + c];
+            if (time - cachedAt[v] > cacheSize)
+            {
+                cachedAt[v] = time++;
+                clusterMisses++;
+            }
+        }
+        clusterTriangles++;
+    }
+    starts.push_back ((uint32_t) triangleCount);
+
+    // Area weighted centroid and normal of every cluster, and of the whole mesh
+    struct Cluster
+    {
+        uint32_t    start;
+        uint32_t    end;
+        float       centroid[3];
+        float       normal[3];
+        float       area;
+        float       sortKey;
+    };
+
+    std::vector<Cluster> clusters (starts.size() - 1);
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        Cluster& cluster = clusters[c];
+        cluster = { starts[c], starts[c + 1], { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, 0.0f, 0.0f };
+        for (uint32_t t = cluster.start; t < cluster.end; t++)
+        {
+            const float* p0 = position (indices[t * 3 + 0]);
+            const float* p1 = position (indices[t * 3 + 1]);
+            const float* p2 = position (indices[t * 3 + 2]);
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3]  = { e1[1] * e2[2] - e1[2] * e2[1],
+                            e1[2] * e2[0] - e1[0] * e2[2],
+                            e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                cluster.centroid[k] += (p0[k] + p1[k] + p2[k]) * area;
+                cluster.normal[k]   += n[k];
+            }
+            cluster.area += area;
+        }
+
+        for (uint32_t k = 0; k < 3; k++)
+            meshCentroid[k] += cluster.centroid[k];
+        meshArea += cluster.area;
+
+        float invArea = cluster.area > 0.0f ? 1.0f / (3.0f * cluster.area) : 0.0f;
+        for (uint32_t k = 0; k < 3; k++)
+            cluster.centroid[k] *= invArea;
+    }
+
+    float invMeshArea = meshArea > 0.0f ? 1.0f / (3.0f * meshArea) : 0.0f;
+    for (uint32_t k = 0; k < 3; k++)
+        meshCentroid[k] *= invMeshArea;
+
+    // Clusters far out along their own normal are likely to occlude the rest of the mesh
+    for (Cluster& cluster : clusters)
+    {
+        float length = sqrtf (cluster.normal[0] * cluster.normal[0] + cluster.normal[1] * cluster.normal[1] + cluster.normal[2] * cluster.normal[2]);
+        float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+        cluster.sortKey = 0.0f;
+        for (uint32_t k = 0; k < 3; k++)
+            cluster.sortKey += (cluster.centroid[k] - meshCentroid[k]) * cluster.normal[k] * invLength;
+    }
+
+    std::stable_sort (clusters.begin(), clusters.end(), [] (const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> output;
+    output.reserve (indexCount);
+    for (const Cluster& cluster : clusters)
+        output.insert (output.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+    std::copy (output.begin(), output.end(), indices);
+}
+
+void AAPLComputeVertexFetchRemap (const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& outRemap)
+{
+    outRemap.assign (vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (outRemap[indices[i]] == UINT32_MAX)
+            outRemap[indices[i]] = next++;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (outRemap[v] == UINT32_MAX)
+            outRemap[v] = next++;
+    }
+}
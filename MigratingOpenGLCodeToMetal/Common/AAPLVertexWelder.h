@@ -0,0 +1,200 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Declaration of the AAPLVertexWelder, a flat open-addressing table that de-duplicates vertices.
+ The table follows the "Swiss table" layout: one control byte per slot holding 7 bits of the hash,
+ probed 16 slots at a time with SIMD compares, next to a slot array of 32-bit vertex indices.
+ Vertices themselves live in the caller's vertex list, so nothing is allocated per vertex.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Specialize for a vertex type to provide:
+//  static uint64_t hash (const TVertex&);
+//  static bool     equal (const TVertex&, const TVertex&);
+// Values that compare equal must hash equal; see AAPLHashFloats for float attributes.
+template <typename TVertex>
+struct AAPLVertexWelderTraits;
+
+// Hashes an array of floats. -0 and +0 hash the same so the hash is consistent with float ==.
+// Every word goes through a full 64-bit multiply-xorshift, so quantized positions that only differ
+//  in a few mantissa bits still spread over the whole table.
+inline uint64_t AAPLHashFloats (const float* values, size_t count)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ (count * 0xC2B2AE3D27D4EB4Full);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t word;
+        memcpy (&word, &values[i], sizeof(word));
+        word = (word == 0x80000000u) ? 0 : word;
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    // Final avalanche, from MurmurHash3
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+template <typename TVertex, typename TTraits = AAPLVertexWelderTraits<TVertex>>
+class AAPLVertexWelder
+{
+public:
+    explicit AAPLVertexWelder (size_t expectedVertexCount = 0) :
+    count (0),
+    groupMask (0)
+    {
+        reserve (expectedVertexCount);
+    }
+
+    // Sizes the table so `expectedVertexCount` unique vertices fit without rehashing
+    // Must be called while the table is empty, e.g. right after construction or clear()
+    void reserve (size_t expectedVertexCount)
+    {
+        assert (count == 0);
+        size_t groups = 1;
+        while (groups * kGroupWidth * kMaxLoadNumerator < expectedVertexCount * kMaxLoadDenominator)
+            groups *= 2;
+        if (control.empty() || groups > groupMask + 1)
+            resize (groups, nullptr);
+    }
+
+    // Drops all entries but keeps the allocation
+    void clear ()
+    {
+        memset (control.data(), kEmpty, control.size());
+        count = 0;
+    }
+
+    size_t size () const { return count; }
+
+    // Returns the index of `vertex` in `vertices`, appending it first if an equal vertex isn't present.
+    // `vertices` must be the list that all previous calls appended to.
+    uint32_t weld (const TVertex& vertex, std::vector<TVertex>& vertices, bool* outInserted = nullptr)
+    {
+        uint64_t hash = TTraits::hash (vertex);
+        uint32_t found;
+        if (find (vertex, hash, vertices.data(), found))
+        {
+            if (outInserted) *outInserted = false;
+            return found;
+        }
+
+        if ((count + 1) * kMaxLoadDenominator > slots.size() * kMaxLoadNumerator)
+            resize ((groupMask + 1) * 2, vertices.data());
+
+        uint32_t index = (uint32_t) vertices.size();
+        vertices.push_back (vertex);
+        insert (hash, index);
+        count++;
+        if (outInserted) *outInserted = true;
+        return index;
+    }
+
+private:
+    static constexpr size_t     kGroupWidth             = 16;
+    static constexpr uint8_t    kEmpty                  = 0x80;
+    static constexpr size_t     kMaxLoadNumerator       = 7;
+    static constexpr size_t     kMaxLoadDenominator     = 8;
+
+    // Bit mask of the bytes in the group at `groupControl` that are equal to `value`
+    static uint32_t matchGroup (const uint8_t* groupControl, uint8_t value)
+    {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128 ((const __m128i*) groupControl);
+        return (uint32_t) _mm_movemask_epi8 (_mm_cmpeq_epi8 (group, _mm_set1_epi8 ((char) value)));
+#elif defined(__ARM_NEON)
+        uint8x16_t eq = vceqq_u8 (vld1q_u8 (groupControl), vdupq_n_u8 (value));
+        // Keep one bit per byte: mask each lane with its bit position and add the halves horizontally
+        static const uint8_t kBits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        uint8x16_t bits = vandq_u8 (eq, vld1q_u8 (kBits));
+        return (uint32_t) vaddv_u8 (vget_low_u8 (bits)) | ((uint32_t) vaddv_u8 (vget_high_u8 (bits)) << 8);
+#else
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < kGroupWidth; i++)
+            mask |= (groupControl[i] == value) ? (1u << i) : 0;
+        return mask;
+#endif
+    }
+
+    static uint8_t  tagOf (uint64_t hash)       { return (uint8_t) (hash & 0x7F); }
+    size_t          firstGroupOf (uint64_t hash) const { return (size_t) (hash >> 7) & groupMask; }
+
+    bool find (const TVertex& vertex, uint64_t hash, const TVertex* vertices, uint32_t& outIndex) const
+    {
+        uint8_t tag = tagOf (hash);
+        size_t group = firstGroupOf (hash);
+        for (size_t probe = 1; ; probe++)
+        {
+            const uint8_t* groupControl = &control[group * kGroupWidth];
+            for (uint32_t match = matchGroup (groupControl, tag); match != 0; match &= match - 1)
+            {
+                uint32_t slot = slots[group * kGroupWidth + __builtin_ctz (match)];
+                if (TTraits::equal (vertices[slot], vertex))
+                {
+                    outIndex = slot;
+                    return true;
+                }
+            }
+            // Entries are never erased, so an empty control byte ends the probe sequence
+            if (matchGroup (groupControl, kEmpty) != 0)
+                return false;
+            group = (group + probe) & groupMask;
+        }
+    }
+
+    void insert (uint64_t hash, uint32_t index)
+    {
+        size_t group = firstGroupOf (hash);
+        for (size_t probe = 1; ; probe++)
+        {
+            uint32_t empty = matchGroup (&control[group * kGroupWidth], kEmpty);
+            if (empty != 0)
+            {
+                size_t slot = group * kGroupWidth + __builtin_ctz (empty);
+                control[slot] = tagOf (hash);
+                slots[slot] = index;
+                return;
+            }
+            // Triangular probing visits every group of a power-of-two table
+            group = (group + probe) & groupMask;
+        }
+    }
+
+    void resize (size_t groupCount, const TVertex* vertices)
+    {
+        std::vector<uint32_t> oldSlots;
+        std::vector<uint8_t> oldControl;
+        oldSlots.swap (slots);
+        oldControl.swap (control);
+
+        groupMask = groupCount - 1;
+        control.assign (groupCount * kGroupWidth, (uint8_t) kEmpty);
+        slots.resize (groupCount * kGroupWidth);
+
+        for (size_t i = 0; i < oldControl.size(); i++)
+        {
+            if (oldControl[i] != kEmpty)
+                insert (TTraits::hash (vertices[oldSlots[i]]), oldSlots[i]);
+        }
+    }
+
+    std::vector<uint8_t>    control;
+    std::vector<uint32_t>   slots;
+    size_t                  count;
+    size_t                  groupMask;
+};
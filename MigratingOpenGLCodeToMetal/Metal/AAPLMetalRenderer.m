@@ -121,7 +121,9 @@ static const NSUInteger AAPLMaxBuffersInFlight = 3;
     // Load mesh data from a file into memory.
     // This method only loads mesh data and does not create Metal objects.
 
-    AAPLMeshData *meshData = [[AAPLMeshData alloc] initWithURL:modelFileURL error:&error];
+    AAPLMeshData *meshData = [[AAPLMeshData alloc] initWithURL:modelFileURL
+                                                  optimizeMesh:YES
+                                                         error:&error];
 
     NSAssert(meshData, @"Could not load mesh from model file (%@), error: %@.", modelFileURL.absoluteString, error);
 
@@ -131,7 +131,9 @@ Implementation of the renderer class that performs OpenGL state setup and per-fr
     // Load mesh data from a file into memory.
     // This only loads data from the bundle and does not create any OpenGL objects.
 
-    AAPLMeshData *meshData = [[AAPLMeshData alloc] initWithURL:modelFileURL error:&error];
+    AAPLMeshData *meshData = [[AAPLMeshData alloc] initWithURL:modelFileURL
+                                                  optimizeMesh:YES
+                                                         error:&error];
 
     NSAssert(meshData, @"Could not load mesh from model file (%@), error: %@.", modelFileURL.absoluteString, error);
 
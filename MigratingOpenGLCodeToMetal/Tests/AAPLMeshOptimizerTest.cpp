@@ -0,0 +1,260 @@
+/*
+See LICENSE folder for this sample’s licensing information.
+
+Abstract:
+Test of the mesh optimizer on the temple mesh and on a grid whose triangles are shuffled.
+ Each mesh is loaded into one triangle list per material and optimized the way AAPLMeshData does when it is created
+ with optimizeMesh set. Reports the ACMR and ATVR before and after, and fails when the ACMR of a submesh gets worse,
+ when a submesh no longer describes the same triangles with the same winding, or when the vertex remap is not a
+ permutation that moves every vertex along with its indices.
+*/
+
+#include "AAPLMeshOptimizer.h"
+#include "AAPLVertexWelder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <string>
+
+// Same members as AAPLVertexData, without its simd dependency
+struct AAPLTestVertex
+{
+    float   position[3];
+    float   normal[3];
+    float   texcoord[2];
+
+    bool operator == (const AAPLTestVertex& o) const { return memcmp (this, &o, sizeof(AAPLTestVertex)) == 0; }
+};
+
+template<> struct AAPLVertexWelderTraits<AAPLTestVertex>
+{
+    static uint64_t hash (const AAPLTestVertex& k) { return AAPLHashFloats (k.position, 8); }
+    static bool equal (const AAPLTestVertex& a, const AAPLTestVertex& b) { return a == b; }
+};
+
+struct AAPLTestMesh
+{
+    std::vector<AAPLTestVertex>                     vertices;
+    std::map<std::string, std::vector<uint32_t>>    submeshes;  // Sorted by material name, like optimizeMesh
+};
+
+// Reads the OBJ file at `path` with the same rules as AAPLMeshData's readLine:
+//  triangles and quads with position/texcoord/normal indices, grouped by `usemtl`
+static bool AAPLLoadTestMesh (const char* path, AAPLTestMesh& outMesh)
+{
+    FILE* file = fopen (path, "r");
+    if (!file)
+        return false;
+
+    std::vector<std::array<float, 3>> positions, normals, texcoords;
+    AAPLVertexWelder<AAPLTestVertex> welder;
+    std::vector<uint32_t>* submesh = nullptr;
+
+    char line[1024];
+    char name[256];
+    while (fgets (line, sizeof(line), file))
+    {
+        float x, y, z;
+        unsigned p[4], t[4], n[4];
+        if (sscanf (line, " v %f %f %f", &x, &y, &z) == 3)
+            positions.push_back ({ { x, y, z } });
+        else if (sscanf (line, " vt %f %f %f", &x, &y, &z) == 3)
+            texcoords.push_back ({ { x, y, z } });
+        else if (sscanf (line, " vn %f %f %f", &x, &y, &z) == 3)
+            normals.push_back ({ { x, y, z } });
+        else if (sscanf (line, " usemtl %255s", name) == 1)
+            submesh = &outMesh.submeshes[name];
+        else
+        {
+            int fields = sscanf (line, " f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u", &p[0], &t[0], &n[0], &p[1], &t[1], &n[1],
+                                 &p[2], &t[2], &n[2], &p[3], &t[3], &n[3]);
+            if (fields != 9 && fields != 12)
+                continue;
+            if (!submesh)
+                submesh = &outMesh.submeshes[""];
+
+            uint32_t indices[4];
+            for (int v = 0; v < fields / 3; v++)
+            {
+                AAPLTestVertex vertex;
+                memcpy (vertex.position, positions[p[v] - 1].data(), sizeof(vertex.position));
+                memcpy (vertex.normal, normals[n[v] - 1].data(), sizeof(vertex.normal));
+                memcpy (vertex.texcoord, texcoords[t[v] - 1].data(), sizeof(vertex.texcoord));
+                indices[v] = welder.weld (vertex, outMesh.vertices);
+            }
+            submesh->insert (submesh->end(), { indices[0], indices[1], indices[2] });
+            if (fields == 12)
+                submesh->insert (submesh->end(), { indices[0], indices[2], indices[3] });
+        }
+    }
+    fclose (file);
+    return !outMesh.vertices.empty();
+}
+
+// A `size` x `size` quad grid split into triangles, in a shuffled triangle order so the cache has something to fix
+static void AAPLMakeShuffledGrid (uint32_t size, AAPLTestMesh& outMesh)
+{
+    for (uint32_t z = 0; z <= size; z++)
+    {
+        for (uint32_t x = 0; x <= size; x++)
+            outMesh.vertices.push_back ({ { (float) x, 0.0f, (float) z }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f } });
+    }
+
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (uint32_t z = 0; z < size; z++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            uint32_t v = z * (size + 1) + x;
+            triangles.push_back ({ { v, v + size + 1, v + 1 } });
+            triangles.push_back ({ { v + 1, v + size + 1, v + size + 2 } });
+        }
+    }
+
+    uint32_t random = 1;
+    for (size_t i = triangles.size() - 1; i > 0; i--)
+    {
+        random = random * 1664525u + 1013904223u;
+        std::swap (triangles[i], triangles[random % (i + 1)]);
+    }
+
+    std::vector<uint32_t>& indices = outMesh.submeshes["grid"];
+    for (const std::array<uint32_t, 3>& triangle : triangles)
+        indices.insert (indices.end(), triangle.begin(), triangle.end());
+}
+
+// Same passes and the same choice of order as -[AAPLMeshData optimizeMesh]
+static void AAPLOptimizeTestMesh (AAPLTestMesh& mesh, std::vector<uint32_t>& outRemap)
+{
+    const size_t vertexCount = mesh.vertices.size();
+    std::vector<uint32_t> allIndices;
+
+    for (auto& submesh : mesh.submeshes)
+    {
+        std::vector<uint32_t>& indices = submesh.second;
+        AAPLVertexCacheStats before = AAPLAnalyzeVertexCache (indices.data(), indices.size(), vertexCount);
+
+        std::vector<uint32_t> cacheOrder (indices);
+        std::vector<uint32_t> clusterStarts;
+        AAPLOptimizeVertexCache (cacheOrder.data(), cacheOrder.size(), vertexCount, kVertexCacheSize, &clusterStarts);
+
+        std::vector<uint32_t> overdrawOrder (cacheOrder);
+        AAPLOptimizeOverdraw (overdrawOrder.data(), overdrawOrder.size(), mesh.vertices[0].position,
+                              sizeof(AAPLTestVertex), vertexCount, clusterStarts);
+
+        if (AAPLAnalyzeVertexCache (overdrawOrder.data(), overdrawOrder.size(), vertexCount).acmr <= before.acmr)
+            indices.swap (overdrawOrder);
+        else if (AAPLAnalyzeVertexCache (cacheOrder.data(), cacheOrder.size(), vertexCount).acmr < before.acmr)
+            indices.swap (cacheOrder);
+
+        allIndices.insert (allIndices.end(), indices.begin(), indices.end());
+    }
+
+    AAPLComputeVertexFetchRemap (allIndices.data(), allIndices.size(), vertexCount, outRemap);
+    for (auto& submesh : mesh.submeshes)
+        AAPLRemapIndices (submesh.second.data(), submesh.second.size(), outRemap);
+    AAPLRemapVertices (mesh.vertices, outRemap);
+}
+
+// The triangles of `indices` as vertex triples, each rotated to start at its smallest vertex to keep its winding,
+//  then sorted. `vertexIds` maps an index to the identity of its vertex.
+static std::vector<std::array<uint32_t, 3>> AAPLCanonicalTriangles (const std::vector<uint32_t>& indices,
+                                                                    const std::vector<uint32_t>& vertexIds)
+{
+    std::vector<std::array<uint32_t, 3>> triangles;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        std::array<uint32_t, 3> triangle = { { vertexIds[indices[i]], vertexIds[indices[i + 1]], vertexIds[indices[i + 2]] } };
+        std::rotate (triangle.begin(), std::min_element (triangle.begin(), triangle.end()), triangle.end());
+        triangles.push_back (triangle);
+    }
+    std::sort (triangles.begin(), triangles.end());
+    return triangles;
+}
+
+static int AAPLTestOptimizer (const char* meshName, AAPLTestMesh& mesh)
+{
+    int failures = 0;
+    const AAPLTestMesh original = mesh;
+    const size_t vertexCount = mesh.vertices.size();
+
+    std::vector<uint32_t> remap;
+    AAPLOptimizeTestMesh (mesh, remap);
+
+    // The remap must be a permutation, and every vertex must have moved to where the remap says
+    std::vector<uint32_t> originalOf (vertexCount, UINT32_MAX);
+    bool permutation = remap.size() == vertexCount;
+    for (size_t v = 0; permutation && v < vertexCount; v++)
+    {
+        permutation = remap[v] < vertexCount && originalOf[remap[v]] == UINT32_MAX;
+        if (permutation)
+            originalOf[remap[v]] = (uint32_t) v;
+    }
+    if (!permutation)
+    {
+        fprintf (stderr, "%s: the vertex remap is not a permutation of %zu vertices\n", meshName, vertexCount);
+        return 1;
+    }
+    size_t movedWrong = 0;
+    for (size_t v = 0; v < vertexCount; v++)
+        movedWrong += !(mesh.vertices[remap[v]] == original.vertices[v]);
+    if (movedWrong)
+    {
+        fprintf (stderr, "%s: %zu vertices are not where the remap moved them\n", meshName, movedWrong);
+        failures++;
+    }
+
+    std::vector<uint32_t> identity (vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        identity[v] = (uint32_t) v;
+
+    for (const auto& submesh : original.submeshes)
+    {
+        const std::vector<uint32_t>& before = submesh.second;
+        const std::vector<uint32_t>& after = mesh.submeshes[submesh.first];
+
+        // Compare in original vertex numbering, so a triangle that lost or changed a vertex doesn't match
+        if (AAPLCanonicalTriangles (before, identity) != AAPLCanonicalTriangles (after, originalOf))
+        {
+            fprintf (stderr, "%s/%s: the optimized index buffer describes different triangles\n", meshName, submesh.first.c_str());
+            failures++;
+        }
+
+        AAPLVertexCacheStats statsBefore = AAPLAnalyzeVertexCache (before.data(), before.size(), vertexCount);
+        AAPLVertexCacheStats statsAfter = AAPLAnalyzeVertexCache (after.data(), after.size(), vertexCount);
+        if (statsAfter.acmr > statsBefore.acmr)
+        {
+            fprintf (stderr, "%s/%s: ACMR got worse\n", meshName, submesh.first.c_str());
+            failures++;
+        }
+
+        printf ("%-8s %-10s %10zu %10.3f %10.3f %10.3f %10.3f\n", meshName, submesh.first.c_str(), before.size() / 3,
+                statsBefore.acmr, statsAfter.acmr, statsBefore.atvr, statsAfter.atvr);
+    }
+    return failures;
+}
+
+int main ()
+{
+    int failures = 0;
+    printf ("%-8s %-10s %10s %10s %10s %10s %10s\n", "mesh", "submesh", "triangles", "ACMR", "ACMR", "ATVR", "ATVR");
+    printf ("%-8s %-10s %10s %10s %10s %10s %10s\n", "", "", "", "(before)", "(after)", "(before)", "(after)");
+
+    AAPLTestMesh temple;
+    if (!AAPLLoadTestMesh (AAPL_TEMPLE_MESH_PATH, temple))
+    {
+        fprintf (stderr, "Could not load %s\n", AAPL_TEMPLE_MESH_PATH);
+        return 1;
+    }
+    failures += AAPLTestOptimizer ("temple", temple);
+
+    AAPLTestMesh grid;
+    AAPLMakeShuffledGrid (64, grid);
+    failures += AAPLTestOptimizer ("grid", grid);
+
+    return failures == 0 ? 0 : 1;
+}